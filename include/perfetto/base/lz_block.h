@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INCLUDE_PERFETTO_BASE_LZ_BLOCK_H_
+#define INCLUDE_PERFETTO_BASE_LZ_BLOCK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace perfetto {
+namespace base {
+
+// A small and fast LZ77-family block codec, optimized for speed rather than
+// compression ratio. The output follows the LZ4 block format (sequences of
+// literals + {offset, length} back-references within a 64 KB window), so it can
+// be inspected with standard tooling, but doesn't implement any framing: the
+// caller is responsible for storing the compressed and decompressed sizes.
+//
+// Blocks are independent from each other (no dictionary is shared), which
+// makes them suitable for random access and for data that can be partially
+// overwritten (e.g. ring buffers).
+
+// Returns the max size of the output of LzBlockCompress() for an input of
+// |src_size| bytes (i.e. the size of incompressible data + framing overhead).
+constexpr size_t LzBlockCompressBound(size_t src_size) {
+  return src_size + src_size / 255 + 16;
+}
+
+// Compresses |src_size| bytes from |src| into |dst|. Returns the size of the
+// compressed data or 0 if it doesn't fit into |dst_capacity| bytes. The
+// caller can pass a |dst_capacity| < LzBlockCompressBound() to give up early
+// on incompressible data.
+size_t LzBlockCompress(const uint8_t* src,
+                       size_t src_size,
+                       uint8_t* dst,
+                       size_t dst_capacity);
+
+// Decompresses |src_size| bytes of compressed data into |dst|. Returns true
+// only if the decompression succeeded and produced exactly |dst_size| bytes.
+// It is safe to call this on untrusted input: malformed data results in a
+// failure, never in reads or writes out of the given bounds.
+bool LzBlockDecompress(const uint8_t* src,
+                       size_t src_size,
+                       uint8_t* dst,
+                       size_t dst_size);
+
+}  // namespace base
+}  // namespace perfetto
+
+#endif  // INCLUDE_PERFETTO_BASE_LZ_BLOCK_H_
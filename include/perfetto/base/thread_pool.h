@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INCLUDE_PERFETTO_BASE_THREAD_POOL_H_
+#define INCLUDE_PERFETTO_BASE_THREAD_POOL_H_
+
+#include <stddef.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace perfetto {
+namespace base {
+
+// A fixed-size pool of worker threads with explicit task affinity.
+// Unlike a conventional work-stealing pool, each task is posted onto a
+// specific worker, identified by its index. Tasks posted onto the same worker
+// are executed sequentially in FIFO order. This allows callers to partition
+// their state (e.g., one shard per worker) and mutate it from the workers
+// without further locking, as long as each partition is always posted onto the
+// same worker.
+//
+// WaitIdle() acts as a barrier: once it returns, all the tasks posted before
+// the call have completed and their side effects are visible to the caller.
+//
+// This class is thread-safe, but the typical usage is: one "owner" thread
+// posting tasks and periodically calling WaitIdle() before touching the state
+// shared with the workers.
+class ThreadPool {
+ public:
+  explicit ThreadPool(size_t num_threads);
+
+  // Waits for all the pending tasks to complete and joins the threads.
+  ~ThreadPool();
+
+  size_t num_threads() const { return workers_.size(); }
+
+  // Posts |task| onto the worker with the given index. |worker_idx| is taken
+  // modulo num_threads().
+  void PostTask(size_t worker_idx, std::function<void()> task);
+
+  // Blocks until all the tasks posted so far have been executed.
+  void WaitIdle();
+
+ private:
+  struct Worker {
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::function<void()>> tasks;  // Guarded by |mutex|.
+    bool quit = false;                        // Guarded by |mutex|.
+  };
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  void RunWorker(Worker*);
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+
+  // Counts the tasks that have been posted but have not completed yet.
+  std::mutex idle_mutex_;
+  std::condition_variable idle_cv_;
+  size_t pending_tasks_ = 0;  // Guarded by |idle_mutex_|.
+};
+
+}  // namespace base
+}  // namespace perfetto
+
+#endif  // INCLUDE_PERFETTO_BASE_THREAD_POOL_H_
@@ -171,6 +171,17 @@ class PERFETTO_EXPORT Message {
     return message;
   }
 
+ protected:
+  // Appends raw bytes to the message. Used by the subclasses that write
+  // fields with a custom encoding (e.g. PackedRepeatedFieldWriter).
+  void WriteToStream(const uint8_t* src_begin, const uint8_t* src_end) {
+    PERFETTO_DCHECK(!finalized_);
+    PERFETTO_DCHECK(src_begin <= src_end);
+    const uint32_t size = static_cast<uint32_t>(src_end - src_begin);
+    stream_writer_->WriteBytes(src_begin, size);
+    size_ += size;
+  }
+
  private:
   Message(const Message&) = delete;
   Message& operator=(const Message&) = delete;
@@ -180,14 +191,6 @@ class PERFETTO_EXPORT Message {
   // Called by Finalize and Append* methods.
   void EndNestedMessage();
 
-  void WriteToStream(const uint8_t* src_begin, const uint8_t* src_end) {
-    PERFETTO_DCHECK(!finalized_);
-    PERFETTO_DCHECK(src_begin <= src_end);
-    const uint32_t size = static_cast<uint32_t>(src_end - src_begin);
-    stream_writer_->WriteBytes(src_begin, size);
-    size_ += size;
-  }
-
   // Only POD fields are allowed. This class's dtor is never called.
   // See the comment on the static_assert in the the corresponding .cc file.
 
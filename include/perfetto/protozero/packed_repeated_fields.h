@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INCLUDE_PERFETTO_PROTOZERO_PACKED_REPEATED_FIELDS_H_
+#define INCLUDE_PERFETTO_PROTOZERO_PACKED_REPEATED_FIELDS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <type_traits>
+
+#include "perfetto/protozero/message.h"
+#include "perfetto/protozero/proto_utils.h"
+
+namespace protozero {
+
+// Writes the values of a packed repeated field, i.e. a single length-delimited
+// field containing the concatenation of the encoded values, without a tag for
+// each of them. It is obtained through Message::BeginNestedMessage() (or the
+// begin_xxx() methods of the generated stubs) and behaves like a nested
+// message: the values are streamed into the buffer as they are appended,
+// possibly across several chunks, and the length of the field is backfilled
+// when it ends, i.e. when another field of the parent message is appended or
+// when the parent message is finalized. Usage:
+// auto* frame_ids = callstack->begin_frame_ids();
+// for (const Frame& frame : frames)
+//   frame_ids->Append(frame.id());
+// |WIRE_TYPE| is the wire type of each value (kVarInt, kFixed32 or kFixed64).
+template <proto_utils::ProtoWireType WIRE_TYPE, typename CPP_TYPE>
+class PackedRepeatedFieldWriter : public Message {
+ public:
+  static_assert(WIRE_TYPE == proto_utils::ProtoWireType::kVarInt ||
+                    (WIRE_TYPE == proto_utils::ProtoWireType::kFixed32 &&
+                     sizeof(CPP_TYPE) == 4) ||
+                    (WIRE_TYPE == proto_utils::ProtoWireType::kFixed64 &&
+                     sizeof(CPP_TYPE) == 8),
+                "Only scalar types can be packed");
+
+  void Append(CPP_TYPE value) {
+    uint8_t buffer[proto_utils::kMaxVarIntEncodedSize];
+    WriteToStream(buffer, EncodeValue(value, buffer));
+  }
+
+  // Appends |count| values at once. The varints are encoded in batches into
+  // an on-stack buffer to amortize the cost of writing into the stream, the
+  // fixed-size values are copied as they are.
+  void Append(const CPP_TYPE* values, size_t count) {
+    if (WIRE_TYPE != proto_utils::ProtoWireType::kVarInt) {
+      const uint8_t* begin = reinterpret_cast<const uint8_t*>(values);
+      WriteToStream(begin, begin + count * sizeof(CPP_TYPE));
+      return;
+    }
+    uint8_t buffer[kBatchBufferSize];
+    const uint8_t* const flush_threshold =
+        buffer + kBatchBufferSize - proto_utils::kMaxVarIntEncodedSize;
+    uint8_t* pos = buffer;
+    for (size_t i = 0; i < count; i++) {
+      if (pos > flush_threshold) {
+        WriteToStream(buffer, pos);
+        pos = buffer;
+      }
+      pos = EncodeValue(values[i], pos);
+    }
+    WriteToStream(buffer, pos);
+  }
+
+ private:
+  static constexpr size_t kBatchBufferSize = 256;
+
+  static inline uint8_t* EncodeValue(CPP_TYPE value, uint8_t* pos) {
+    if (WIRE_TYPE == proto_utils::ProtoWireType::kVarInt)
+      return proto_utils::WriteVarInt(value, pos);
+    memcpy(pos, &value, sizeof(CPP_TYPE));
+    return pos + sizeof(CPP_TYPE);
+  }
+};
+
+template <typename CPP_TYPE>
+using PackedVarIntWriter =
+    PackedRepeatedFieldWriter<proto_utils::ProtoWireType::kVarInt, CPP_TYPE>;
+
+template <typename CPP_TYPE>
+using PackedFixedWriter = PackedRepeatedFieldWriter<
+    sizeof(CPP_TYPE) == 8 ? proto_utils::ProtoWireType::kFixed64
+                          : proto_utils::ProtoWireType::kFixed32,
+    CPP_TYPE>;
+
+}  // namespace protozero
+
+#endif  // INCLUDE_PERFETTO_PROTOZERO_PACKED_REPEATED_FIELDS_H_
@@ -18,14 +18,23 @@
 #define INCLUDE_PERFETTO_PROTOZERO_PROTO_DECODER_H_
 
 #include <stdint.h>
+#include <string.h>
 #include <memory>
 
 #include "perfetto/base/logging.h"
 #include "perfetto/base/string_view.h"
+#include "perfetto/base/utils.h"
 #include "perfetto/protozero/proto_utils.h"
 
 namespace protozero {
 
+// A pointer + size pair pointing into the decoded buffer, used for bytes and
+// nested message fields.
+struct ConstBytes {
+  const uint8_t* data;
+  size_t size;
+};
+
 // Reads and decodes protobuf messages from a fixed length buffer. This class
 // does not allocate and does no more work than necessary so can be used in
 // performance sensitive contexts.
@@ -34,7 +43,9 @@ class ProtoDecoder {
   using StringView = ::perfetto::base::StringView;
 
   // The field of a protobuf message. |id| == 0 if the tag is not valid (e.g.
-  // because the full tag was unable to be read etc.).
+  // because the full tag was unable to be read etc.) or, when obtained from a
+  // TypedProtoDecoder, if the field is not present in the message. All the
+  // as_*() accessors of such an invalid field return zero / empty values.
   struct Field {
     struct LengthDelimited {
       const uint8_t* data;
@@ -48,46 +59,58 @@ class ProtoDecoder {
       LengthDelimited length_limited;
     };
 
+    inline bool valid() const { return id != 0; }
+
     inline bool as_bool() const {
-      PERFETTO_DCHECK(type == proto_utils::ProtoWireType::kVarInt);
+      PERFETTO_DCHECK(!valid() || type == proto_utils::ProtoWireType::kVarInt);
       return static_cast<bool>(int_value);
     }
 
     inline uint32_t as_uint32() const {
-      PERFETTO_DCHECK(type == proto_utils::ProtoWireType::kVarInt ||
+      PERFETTO_DCHECK(!valid() || type == proto_utils::ProtoWireType::kVarInt ||
                       type == proto_utils::ProtoWireType::kFixed32);
       return static_cast<uint32_t>(int_value);
     }
 
     inline int32_t as_int32() const {
-      PERFETTO_DCHECK(type == proto_utils::ProtoWireType::kVarInt ||
+      PERFETTO_DCHECK(!valid() || type == proto_utils::ProtoWireType::kVarInt ||
                       type == proto_utils::ProtoWireType::kFixed32);
       return static_cast<int32_t>(int_value);
     }
 
+    inline int32_t as_sint32() const {
+      PERFETTO_DCHECK(!valid() || type == proto_utils::ProtoWireType::kVarInt);
+      return proto_utils::ZigZagDecode(static_cast<uint32_t>(int_value));
+    }
+
     inline uint64_t as_uint64() const {
-      PERFETTO_DCHECK(type == proto_utils::ProtoWireType::kVarInt ||
+      PERFETTO_DCHECK(!valid() || type == proto_utils::ProtoWireType::kVarInt ||
                       type == proto_utils::ProtoWireType::kFixed64);
       return int_value;
     }
 
     inline int64_t as_int64() const {
-      PERFETTO_DCHECK(type == proto_utils::ProtoWireType::kVarInt ||
+      PERFETTO_DCHECK(!valid() || type == proto_utils::ProtoWireType::kVarInt ||
                       type == proto_utils::ProtoWireType::kFixed64);
       return static_cast<int64_t>(int_value);
     }
 
+    inline int64_t as_sint64() const {
+      PERFETTO_DCHECK(!valid() || type == proto_utils::ProtoWireType::kVarInt);
+      return proto_utils::ZigZagDecode(int_value);
+    }
+
     // A relaxed version for when we are storing any int as an int64
     // in the raw events table.
     inline int64_t as_integer() const {
-      PERFETTO_DCHECK(type == proto_utils::ProtoWireType::kVarInt ||
+      PERFETTO_DCHECK(!valid() || type == proto_utils::ProtoWireType::kVarInt ||
                       type == proto_utils::ProtoWireType::kFixed64 ||
                       type == proto_utils::ProtoWireType::kFixed32);
       return static_cast<int64_t>(int_value);
     }
 
     inline float as_float() const {
-      PERFETTO_DCHECK(type == proto_utils::ProtoWireType::kFixed32);
+      PERFETTO_DCHECK(!valid() || type == proto_utils::ProtoWireType::kFixed32);
       float res;
       uint32_t value32 = static_cast<uint32_t>(int_value);
       memcpy(&res, &value32, sizeof(res));
@@ -95,7 +118,7 @@ class ProtoDecoder {
     }
 
     inline double as_double() const {
-      PERFETTO_DCHECK(type == proto_utils::ProtoWireType::kFixed64);
+      PERFETTO_DCHECK(!valid() || type == proto_utils::ProtoWireType::kFixed64);
       double res;
       memcpy(&res, &int_value, sizeof(res));
       return res;
@@ -104,7 +127,8 @@ class ProtoDecoder {
     // A relaxed version for when we are storing floats and doubles
     // as real in the raw events table.
     inline double as_real() const {
-      PERFETTO_DCHECK(type == proto_utils::ProtoWireType::kFixed64 ||
+      PERFETTO_DCHECK(!valid() ||
+                      type == proto_utils::ProtoWireType::kFixed64 ||
                       type == proto_utils::ProtoWireType::kFixed32);
       double res;
       uint64_t value64 = static_cast<uint64_t>(int_value);
@@ -113,18 +137,29 @@ class ProtoDecoder {
     }
 
     inline StringView as_string() const {
-      PERFETTO_DCHECK(type == proto_utils::ProtoWireType::kLengthDelimited);
+      PERFETTO_DCHECK(!valid() ||
+                      type == proto_utils::ProtoWireType::kLengthDelimited);
+      if (!valid())
+        return StringView();
       return StringView(reinterpret_cast<const char*>(length_limited.data),
                         length_limited.length);
     }
 
+    inline ConstBytes as_bytes() const {
+      PERFETTO_DCHECK(!valid() ||
+                      type == proto_utils::ProtoWireType::kLengthDelimited);
+      return ConstBytes{length_limited.data, length_limited.length};
+    }
+
     inline const uint8_t* data() const {
-      PERFETTO_DCHECK(type == proto_utils::ProtoWireType::kLengthDelimited);
+      PERFETTO_DCHECK(!valid() ||
+                      type == proto_utils::ProtoWireType::kLengthDelimited);
       return length_limited.data;
     }
 
     inline size_t size() const {
-      PERFETTO_DCHECK(type == proto_utils::ProtoWireType::kLengthDelimited);
+      PERFETTO_DCHECK(!valid() ||
+                      type == proto_utils::ProtoWireType::kLengthDelimited);
       return static_cast<size_t>(length_limited.length);
     }
   };
@@ -137,32 +172,30 @@ class ProtoDecoder {
   // the returned struct will have id 0 which is an invalid field id.
   Field ReadField();
 
+  // Skips to the next occurrence of |field_id|, without decoding the values
+  // of the fields in between, and returns it. If |field_id| is not found
+  // returns an invalid field and leaves the decoder at the end of the buffer
+  // (or at the first field that cannot be fully read).
+  Field FindField(uint32_t field_id);
+
   template <int field_id>
   inline bool FindIntField(uint64_t* field_value) {
-    bool res = false;
-    for (auto f = ReadField(); f.id != 0; f = ReadField()) {
-      if (f.id == field_id) {
-        *field_value = f.int_value;
-        res = true;
-        break;
-      }
-    }
+    Field f = FindField(field_id);
     Reset();
-    return res;
+    if (!f.valid())
+      return false;
+    *field_value = f.int_value;
+    return true;
   }
 
   template <int field_id>
   inline bool FindStringField(StringView* field_value) {
-    bool res = false;
-    for (auto f = ReadField(); f.id != 0; f = ReadField()) {
-      if (f.id == field_id) {
-        *field_value = f.as_string();
-        res = true;
-        break;
-      }
-    }
+    Field f = FindField(field_id);
     Reset();
-    return res;
+    if (!f.valid())
+      return false;
+    *field_value = f.as_string();
+    return true;
   }
 
   // Returns true if |length_| == |current_position_| - |buffer| and false
@@ -189,12 +222,377 @@ class ProtoDecoder {
   inline const uint8_t* buffer() const { return buffer_; }
   inline uint64_t length() const { return length_; }
 
- private:
+  // Parses the field at |pos| into |field|. Returns a pointer past the end of
+  // the field or nullptr if the field can't be fully read (because the buffer
+  // is truncated or the tag is invalid), in which case |field| is left in an
+  // undefined state. Fields that are too large to be decoded are skipped:
+  // |field->id| is set to 0 and the returned pointer points past them.
+  static inline const uint8_t* ParseOneField(const uint8_t* pos,
+                                             const uint8_t* end,
+                                             Field* field);
+
+ protected:
   const uint8_t* const buffer_;
   const uint64_t length_;  // The outer buffer can be larger than 4GB.
   const uint8_t* current_position_ = nullptr;
 };
 
+// static
+PERFETTO_ALWAYS_INLINE inline const uint8_t* ProtoDecoder::ParseOneField(
+    const uint8_t* pos,
+    const uint8_t* end,
+    Field* field) {
+  // The first byte of a proto field is structured as follows:
+  // The least 3 significant bits determine the field type.
+  // The most 5 significant bits determine the field id. If MSB == 1, the
+  // field id continues on the next bytes following the VarInt encoding.
+  const uint8_t kFieldTypeNumBits = 3;
+  const uint64_t kFieldTypeMask = (1 << kFieldTypeNumBits) - 1;  // 0000 0111;
+
+  // If we've already hit the end, just return an invalid field.
+  if (pos >= end)
+    return nullptr;
+
+  uint64_t raw_field_id = 0;
+  if (PERFETTO_LIKELY(*pos < 0x80)) {
+    raw_field_id = *(pos++);  // Fastpath for fields with ID < 16.
+  } else {
+    pos = proto_utils::ParseVarInt(pos, end, &raw_field_id);
+  }
+
+  uint32_t field_id = static_cast<uint32_t>(raw_field_id >> kFieldTypeNumBits);
+  if (field_id == 0 || pos >= end)
+    return nullptr;
+
+  field->type =
+      static_cast<proto_utils::ProtoWireType>(raw_field_id & kFieldTypeMask);
+
+  const uint8_t* new_pos = nullptr;
+  uint64_t field_intvalue = 0;
+  switch (field->type) {
+    case proto_utils::ProtoWireType::kVarInt: {
+      // Fastpath for single byte varints (e.g. small ids and booleans).
+      if (PERFETTO_LIKELY(*pos < 0x80)) {
+        field->int_value = *(pos++);
+        break;
+      }
+      new_pos = proto_utils::ParseVarInt(pos, end, &field->int_value);
+
+      // new_pos not being greater than pos means ParseVarInt could not fully
+      // parse the number. This is because we are out of space in the buffer.
+      if (new_pos == pos)
+        return nullptr;
+      pos = new_pos;
+      break;
+    }
+    case proto_utils::ProtoWireType::kLengthDelimited: {
+      new_pos = proto_utils::ParseVarInt(pos, end, &field_intvalue);
+
+      // new_pos not being greater than pos means ParseVarInt could not fully
+      // parse the number. This is because we are out of space in the buffer.
+      // Alternatively, we may not have space to fully read the length
+      // delimited field.
+      // It is safe to static_cast end - new_pos as new_pos will be <= end after
+      // ParseVarInt.
+      if (new_pos == pos ||
+          field_intvalue > static_cast<uint64_t>(end - new_pos)) {
+        return nullptr;
+      }
+
+      // If the message is larger than 256 MiB silently skip it.
+      if (PERFETTO_UNLIKELY(field_intvalue >= proto_utils::kMaxMessageLength)) {
+        field->id = 0;
+        return new_pos + field_intvalue;
+      }
+
+      pos = new_pos;
+      field->length_limited.data = pos;
+      field->length_limited.length = static_cast<size_t>(field_intvalue);
+      pos += field_intvalue;
+      break;
+    }
+    case proto_utils::ProtoWireType::kFixed64: {
+      if (pos + sizeof(uint64_t) > end)
+        return nullptr;
+      memcpy(&field_intvalue, pos, sizeof(uint64_t));
+      field->int_value = field_intvalue;
+      pos += sizeof(uint64_t);
+      break;
+    }
+    case proto_utils::ProtoWireType::kFixed32: {
+      if (pos + sizeof(uint32_t) > end)
+        return nullptr;
+      uint32_t tmp;
+      memcpy(&tmp, pos, sizeof(uint32_t));
+      field->int_value = tmp;
+      pos += sizeof(uint32_t);
+      break;
+    }
+    default:
+      return nullptr;
+  }
+  field->id = field_id;
+  return pos;
+}
+
+// Iterates over all the occurrences of a repeated (non-packed) field, in the
+// order in which they appear in the message. Usage:
+// for (auto it = decoder.GetRepeated(kFooFieldNumber); it; ++it)
+//   Use(it->as_int32());
+// The occurrences are not stored anywhere: the iterator re-scans the message
+// lazily, which keeps the decoders allocation-free regardless of the number of
+// repeated fields.
+class RepeatedFieldIterator {
+ public:
+  using Field = ProtoDecoder::Field;
+
+  RepeatedFieldIterator(uint32_t field_id,
+                        const uint8_t* buffer,
+                        size_t length)
+      : field_id_(field_id), read_ptr_(buffer), end_(buffer + length) {
+    FindNextMatchingId();
+  }
+
+  explicit operator bool() const { return field_.valid(); }
+  const Field& operator*() const { return field_; }
+  const Field* operator->() const { return &field_; }
+
+  RepeatedFieldIterator& operator++() {
+    PERFETTO_DCHECK(field_.valid());
+    FindNextMatchingId();
+    return *this;
+  }
+
+ private:
+  inline void FindNextMatchingId() {
+    while (read_ptr_) {
+      read_ptr_ = ProtoDecoder::ParseOneField(read_ptr_, end_, &field_);
+      if (read_ptr_ && field_.id == field_id_)
+        return;
+    }
+    field_.id = 0;
+  }
+
+  const uint32_t field_id_;
+  const uint8_t* read_ptr_;
+  const uint8_t* const end_;
+  Field field_;
+};
+
+// Iterates over the values of a packed repeated field, i.e. a length-delimited
+// field containing the concatenation of the encoded values. |WIRE_TYPE| is the
+// wire type of each value (kVarInt, kFixed32 or kFixed64). If the payload is
+// malformed the iteration stops and |*parse_error| is set to true.
+template <proto_utils::ProtoWireType WIRE_TYPE, typename CPP_TYPE>
+class PackedRepeatedFieldIterator {
+ public:
+  static_assert(WIRE_TYPE == proto_utils::ProtoWireType::kVarInt ||
+                    WIRE_TYPE == proto_utils::ProtoWireType::kFixed32 ||
+                    WIRE_TYPE == proto_utils::ProtoWireType::kFixed64,
+                "Only scalar types can be packed");
+
+  PackedRepeatedFieldIterator(const uint8_t* data,
+                              size_t size,
+                              bool* parse_error)
+      : read_ptr_(data), end_(data + size), parse_error_(parse_error) {
+    ReadNext();
+  }
+
+  explicit operator bool() const { return has_value_; }
+  CPP_TYPE operator*() const { return value_; }
+
+  PackedRepeatedFieldIterator& operator++() {
+    ReadNext();
+    return *this;
+  }
+
+ private:
+  void ReadNext() {
+    has_value_ = false;
+    if (read_ptr_ >= end_)
+      return;
+    if (WIRE_TYPE == proto_utils::ProtoWireType::kVarInt) {
+      uint64_t raw = 0;
+      const uint8_t* next = proto_utils::ParseVarInt(read_ptr_, end_, &raw);
+      if (PERFETTO_UNLIKELY(next == read_ptr_)) {
+        *parse_error_ = true;
+        return;
+      }
+      read_ptr_ = next;
+      value_ = static_cast<CPP_TYPE>(raw);
+    } else {
+      static_assert(sizeof(CPP_TYPE) == 4 || sizeof(CPP_TYPE) == 8,
+                    "Unexpected size for a fixed type");
+      if (PERFETTO_UNLIKELY(static_cast<size_t>(end_ - read_ptr_) <
+                            sizeof(CPP_TYPE))) {
+        *parse_error_ = true;
+        return;
+      }
+      memcpy(&value_, read_ptr_, sizeof(CPP_TYPE));
+      read_ptr_ += sizeof(CPP_TYPE);
+    }
+    has_value_ = true;
+  }
+
+  const uint8_t* read_ptr_;
+  const uint8_t* const end_;
+  bool* const parse_error_;
+  CPP_TYPE value_{};
+  bool has_value_ = false;
+};
+
+// Bulk version of PackedRepeatedFieldIterator: decodes the values of the
+// packed repeated field payload [begin, end) into |values|, up to |max_values|
+// of them, and stores their number into |num_values|. Returns a pointer past
+// the last decoded value, which is |end| once the whole payload has been
+// decoded, so that big payloads can be decoded in chunks. If the returned
+// pointer is != |end| and |*num_values| < |max_values| the payload is
+// malformed.
+template <proto_utils::ProtoWireType WIRE_TYPE, typename CPP_TYPE>
+const uint8_t* DecodePackedRepeated(const uint8_t* begin,
+                                    const uint8_t* end,
+                                    CPP_TYPE* values,
+                                    size_t max_values,
+                                    size_t* num_values) {
+  static_assert(WIRE_TYPE == proto_utils::ProtoWireType::kVarInt ||
+                    WIRE_TYPE == proto_utils::ProtoWireType::kFixed32 ||
+                    WIRE_TYPE == proto_utils::ProtoWireType::kFixed64,
+                "Only scalar types can be packed");
+  const uint8_t* pos = begin;
+  size_t num = 0;
+  if (WIRE_TYPE == proto_utils::ProtoWireType::kVarInt) {
+    for (; num < max_values && pos < end; num++) {
+      // Inlined fastpath for single byte values, the common case for the
+      // small ints and enums that are usually packed.
+      if (PERFETTO_LIKELY(*pos < 0x80)) {
+        values[num] = static_cast<CPP_TYPE>(*(pos++));
+        continue;
+      }
+      uint64_t raw = 0;
+      const uint8_t* next = proto_utils::ParseVarInt(pos, end, &raw);
+      if (PERFETTO_UNLIKELY(next == pos))
+        break;
+      pos = next;
+      values[num] = static_cast<CPP_TYPE>(raw);
+    }
+  } else {
+    static_assert(sizeof(CPP_TYPE) == 4 || sizeof(CPP_TYPE) == 8,
+                  "Unexpected size for a fixed type");
+    num = static_cast<size_t>(end - begin) / sizeof(CPP_TYPE);
+    if (num > max_values)
+      num = max_values;
+    memcpy(values, begin, num * sizeof(CPP_TYPE));
+    pos += num * sizeof(CPP_TYPE);
+  }
+  *num_values = num;
+  return pos;
+}
+
+// The field ids above this are not supported by TypedProtoDecoder, as its
+// field table would become too big to be kept on the stack.
+constexpr uint32_t kMaxDecoderFieldId = 999;
+
+// Non-templated part of TypedProtoDecoder, see below.
+class TypedProtoDecoderBase : public ProtoDecoder {
+ public:
+  using Field = ProtoDecoder::Field;
+
+  // Returns the last occurrence of the field |id| (as per the proto semantics
+  // for non-repeated fields) or an invalid Field if it wasn't in the message.
+  const Field& Get(uint32_t id) const {
+    return PERFETTO_LIKELY(id < num_fields_) && is_present(id) ? fields_[id]
+                                                                : kMissingField;
+  }
+
+  // Returns an iterator over all the occurrences of the field |id|.
+  RepeatedFieldIterator GetRepeated(uint32_t id) const {
+    PERFETTO_DCHECK(id > 0 && id < num_fields_);
+    return RepeatedFieldIterator(id, buffer_, static_cast<size_t>(length_));
+  }
+
+  // Returns an iterator over the values of the packed repeated field |id|.
+  template <proto_utils::ProtoWireType WIRE_TYPE, typename CPP_TYPE>
+  PackedRepeatedFieldIterator<WIRE_TYPE, CPP_TYPE> GetPackedRepeated(
+      uint32_t id,
+      bool* parse_error) const {
+    const Field& field = Get(id);
+    return PackedRepeatedFieldIterator<WIRE_TYPE, CPP_TYPE>(
+        field.data(), field.valid() ? field.size() : 0, parse_error);
+  }
+
+ protected:
+  TypedProtoDecoderBase(Field* fields,
+                        uint64_t* present,
+                        uint32_t num_fields,
+                        const uint8_t* buffer,
+                        size_t length)
+      : ProtoDecoder(buffer, length),
+        fields_(fields),
+        present_(present),
+        num_fields_(num_fields) {}
+
+  static constexpr uint32_t NumPresenceWords(uint32_t num_fields) {
+    return (num_fields + 63) / 64;
+  }
+
+  inline bool is_present(uint32_t id) const {
+    return (present_[id / 64] >> (id % 64)) & 1;
+  }
+
+  // Decodes the whole message, filling |fields_| and |present_|.
+  void ParseAllFields();
+
+  // Returned for the fields that are not in the message.
+  static const Field kMissingField;
+
+  // The last occurrence of each field, indexed by field id. Points to the
+  // storage of the subclass. Only the entries flagged in the |present_| bitmap
+  // are initialized: clearing the bitmap is much cheaper than clearing the
+  // table, which is most of the cost of decoding a small message otherwise.
+  Field* const fields_;
+  uint64_t* const present_;
+  const uint32_t num_fields_;
+
+ private:
+  TypedProtoDecoderBase(const TypedProtoDecoderBase&) = delete;
+  TypedProtoDecoderBase& operator=(const TypedProtoDecoderBase&) = delete;
+};
+
+// Decodes a whole message in one pass into a table of fields indexed by field
+// id, which makes the lookup of each field O(1). This is the base class for
+// the Decoder classes generated by the ProtoZero plugin, which add type-safe
+// accessors, e.g.:
+// protos::pbzero::SchedSwitchFtraceEvent::Decoder evt(data, size);
+// if (evt.has_next_pid())
+//   Use(evt.next_pid());
+// The table is kept on the stack and the decoder never allocates. It doesn't
+// copy the buffer either, which must outlive it.
+template <int MAX_FIELD_ID>
+class TypedProtoDecoder : public TypedProtoDecoderBase {
+ public:
+  TypedProtoDecoder(const uint8_t* buffer, size_t length)
+      : TypedProtoDecoderBase(reinterpret_cast<Field*>(storage_),
+                              present_storage_,
+                              /*num_fields=*/MAX_FIELD_ID + 1,
+                              buffer,
+                              length) {
+    static_assert(MAX_FIELD_ID <= kMaxDecoderFieldId, "Field id too high");
+    TypedProtoDecoderBase::ParseAllFields();
+  }
+
+  template <uint32_t FIELD_ID>
+  inline const Field& at() const {
+    static_assert(FIELD_ID <= MAX_FIELD_ID, "Field id too high");
+    return is_present(FIELD_ID) ? fields_[FIELD_ID] : kMissingField;
+  }
+
+ private:
+  // Deliberately not a Field[], to avoid default-initializing the entries.
+  // ParseAllFields() initializes only the ones of the fields it finds.
+  alignas(Field) uint8_t storage_[sizeof(Field) * (MAX_FIELD_ID + 1)];
+  uint64_t present_storage_[NumPresenceWords(MAX_FIELD_ID + 1)];
+};
+
 }  // namespace protozero
 
 #endif  // INCLUDE_PERFETTO_PROTOZERO_PROTO_DECODER_H_
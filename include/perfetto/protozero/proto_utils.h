@@ -116,7 +116,9 @@ constexpr size_t kMaxMessageLength = (1u << (kMessageLengthFieldSize * 7)) - 1;
 // Largest value of simple (not length-delimited) field is 64-bit varint
 // (10 bytes at most). 15 bytes buffer is enough to store a simple field.
 constexpr size_t kMaxTagEncodedSize = 5;
-constexpr size_t kMaxSimpleFieldEncodedSize = kMaxTagEncodedSize + 10;
+constexpr size_t kMaxVarIntEncodedSize = 10;
+constexpr size_t kMaxSimpleFieldEncodedSize =
+    kMaxTagEncodedSize + kMaxVarIntEncodedSize;
 
 // Proto types: (int|uint|sint)(32|64), bool, enum.
 constexpr uint32_t MakeTagVarInt(uint32_t field_id) {
@@ -145,6 +147,16 @@ inline typename std::make_unsigned<T>::type ZigZagEncode(T value) {
       (value << 1) ^ (value >> (sizeof(T) * 8 - 1)));
 }
 
+template <typename T>
+inline typename std::make_signed<T>::type ZigZagDecode(T value) {
+  using UnsignedType = typename std::make_unsigned<T>::type;
+  using SignedType = typename std::make_signed<T>::type;
+  auto unsigned_value = static_cast<UnsignedType>(value);
+  auto mask =
+      static_cast<UnsignedType>(-static_cast<SignedType>(unsigned_value & 1));
+  return static_cast<SignedType>((unsigned_value >> 1) ^ mask);
+}
+
 template <typename T>
 inline uint8_t* WriteVarInt(T value, uint8_t* target) {
   // If value is <= 0 we must first sign extend to int64_t (see [1]).
@@ -200,23 +212,51 @@ void StaticAssertSingleBytePreamble() {
 // The parsed int value is stored in the output arg |value|. Returns a pointer
 // to the next unconsumed byte (so start < retval <= end) or |start| if the
 // VarInt could not be fully parsed because there was not enough space in the
-// buffer.
+// buffer or because it is longer than kMaxVarIntEncodedSize (malformed).
 inline const uint8_t* ParseVarInt(const uint8_t* start,
                                   const uint8_t* end,
                                   uint64_t* value) {
+  // Fast paths for the 1 and 2 bytes varints, which are by far the most
+  // common ones (tags, booleans, small ints and lengths < 16 KB).
+  if (PERFETTO_LIKELY(start < end && *start < 0x80)) {
+    *value = *start;
+    return start + 1;
+  }
+  if (PERFETTO_LIKELY(end - start >= 2 && start[1] < 0x80)) {
+    *value = (start[0] & 0x7fu) | (static_cast<uint64_t>(start[1]) << 7);
+    return start + 2;
+  }
+
   const uint8_t* pos = start;
-  uint64_t shift = 0;
-  *value = 0;
-  do {
-    if (PERFETTO_UNLIKELY(pos >= end)) {
-      *value = 0;
-      return start;
+  uint64_t result = 0;
+
+  // If the buffer can hold the longest possible varint, the bound check on
+  // each byte can be dropped. The loop has a fixed number of iterations and
+  // is unrolled by the compiler.
+  if (PERFETTO_LIKELY(end - start >=
+                      static_cast<ptrdiff_t>(kMaxVarIntEncodedSize))) {
+    for (uint32_t shift = 0; shift < 64; shift += 7) {
+      const uint64_t byte = *pos++;
+      result |= (byte & 0x7f) << shift;
+      if (!(byte & 0x80)) {
+        *value = result;
+        return pos;
+      }
+    }
+    *value = 0;
+    return start;
+  }
+
+  for (uint32_t shift = 0; shift < 64 && pos < end; shift += 7) {
+    const uint64_t byte = *pos++;
+    result |= (byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      *value = result;
+      return pos;
     }
-    PERFETTO_DCHECK(shift < 64ull);
-    *value |= static_cast<uint64_t>(*pos & 0x7f) << shift;
-    shift += 7;
-  } while (*pos++ & 0x80);
-  return pos;
+  }
+  *value = 0;
+  return start;
 }
 
 }  // namespace proto_utils
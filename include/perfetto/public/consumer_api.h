@@ -39,7 +39,8 @@ namespace consumer {
 //   | kTracing |<----------------------------+
 //   +----------+
 //        |
-//        | [after TraceConfig.duration_ms]
+//        | [after TraceConfig.duration_ms (and, for streaming sessions, after
+//        |  the last OnTraceDataCb invocation)]
 //        V
 // +-------------+
 // | kTraceEnded |
@@ -81,10 +82,13 @@ enum class State {
   // This state lasts for the whole duration of the trace session (i.e.
   // |duration_ms| in the trace config), after which the session transitions
   // either to the kTraceEnded state (if successful) or an error state.
+  // Sessions created through CreateStreaming() deliver the trace data while
+  // in this state.
   kTracing = 3,
 
   // Tracing ended succesfully. The trace buffer can now be retrieved through
-  // the ReadTrace() call.
+  // the ReadTrace() call (or, for streaming sessions, has been fully delivered
+  // to the OnTraceDataCb).
   // This state is final.
   kTraceEnded = 4,
 };
@@ -96,6 +100,22 @@ constexpr Handle kInvalidHandle = -1;
 // about state changes.
 using OnStateChangedCb = void (*)(Handle, State, void* /*callback_arg*/);
 
+// Signature for the callback function provided by the embedder to receive the
+// trace data of streaming sessions (see CreateStreaming()).
+// [data, size] is a chunk of the trace. The concatenation of all the chunks,
+// in the order they are delivered, is a valid binary-encoded Trace proto (see
+// trace.proto), i.e. each chunk is a sequence of Trace.packet fields. Packets
+// are never split across chunks, unless they are larger than the chunk size.
+// The buffer is owned by the tracing session and is valid only for the
+// duration of the callback: the embedder must copy or consume it before
+// returning. |has_more| is false only for the last chunk of the trace (which
+// may be empty), right before the session transitions to kTraceEnded.
+using OnTraceDataCb = void (*)(Handle,
+                               const void* /*data*/,
+                               size_t /*size*/,
+                               bool /*has_more*/,
+                               void* /*callback_arg*/);
+
 // None of the calls below are blocking, unless otherwise specified.
 
 // Enables tracing with the given TraceConfig. If the trace config has the
@@ -129,6 +149,29 @@ Handle Create(const void* config_proto,
 // re-configuring the trace session.
 void StartTracing(Handle);
 
+// Like Create(), but rather than accumulating the whole trace into a buffer
+// that can be read only at the end via ReadTrace(), the trace data is drained
+// from the traced daemon periodically while tracing and delivered in chunks to
+// |data_callback|. The memory used by the session is bounded by the size of
+// one chunk (256 KB) plus one read batch, regardless of the trace duration.
+// The drain period is |file_write_period_ms| from the trace config (1 s if
+// unset). The tracing buffers in the trace config must be large enough to
+// hold the data produced within that period; |write_into_file| is ignored.
+// Args:
+//   data_callback: invoked with each chunk of the trace. As for |callback|,
+//     it is invoked on an internal thread and must not block. Both callbacks
+//     are invoked on the same thread, so they don't need to synchronize with
+//     each other.
+//   See Create() for the other arguments.
+// Return value:
+//   As for Create(). ReadTrace() always returns a null buffer for the handles
+//   returned by this function.
+Handle CreateStreaming(const void* config_proto,
+                       size_t config_len,
+                       OnStateChangedCb callback,
+                       OnTraceDataCb data_callback,
+                       void* callback_arg);
+
 struct TraceBuffer {
   char* begin;
   size_t size;
@@ -141,8 +184,8 @@ struct TraceBuffer {
 //   the whole trace. This buffer can be parsed directly with libprotobuf.
 //   The buffer lifetime is tied to the tracing session and is valid until the
 //   Destroy() call.
-//   If called before the session reaches the kTraceEnded state, a null buffer
-//   is returned.
+//   If called before the session reaches the kTraceEnded state, or on a session
+//   created through CreateStreaming(), a null buffer is returned.
 TraceBuffer ReadTrace(Handle);
 
 // Destroys all the resources associated to the tracing session (connection to
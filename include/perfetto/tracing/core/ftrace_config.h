@@ -39,13 +39,56 @@
 namespace perfetto {
 namespace protos {
 class FtraceConfig;
-}
+class FtraceConfig_FieldFilter;
+}  // namespace protos
 }  // namespace perfetto
 
 namespace perfetto {
 
 class PERFETTO_EXPORT FtraceConfig {
  public:
+  class PERFETTO_EXPORT FieldFilter {
+   public:
+    FieldFilter();
+    ~FieldFilter();
+    FieldFilter(FieldFilter&&) noexcept;
+    FieldFilter& operator=(FieldFilter&&);
+    FieldFilter(const FieldFilter&);
+    FieldFilter& operator=(const FieldFilter&);
+    bool operator==(const FieldFilter&) const;
+    bool operator!=(const FieldFilter& other) const {
+      return !(*this == other);
+    }
+
+    // Conversion methods from/to the corresponding protobuf types.
+    void FromProto(const perfetto::protos::FtraceConfig_FieldFilter&);
+    void ToProto(perfetto::protos::FtraceConfig_FieldFilter*) const;
+
+    const std::string& event() const { return event_; }
+    void set_event(const std::string& value) { event_ = value; }
+
+    const std::string& field() const { return field_; }
+    void set_field(const std::string& value) { field_ = value; }
+
+    int values_size() const { return static_cast<int>(values_.size()); }
+    const std::vector<int64_t>& values() const { return values_; }
+    std::vector<int64_t>* mutable_values() { return &values_; }
+    void clear_values() { values_.clear(); }
+    int64_t* add_values() {
+      values_.emplace_back();
+      return &values_.back();
+    }
+
+   private:
+    std::string event_ = {};
+    std::string field_ = {};
+    std::vector<int64_t> values_;
+
+    // Allows to preserve unknown protobuf fields for compatibility
+    // with future versions of .proto files.
+    std::string unknown_fields_;
+  };
+
   FtraceConfig();
   ~FtraceConfig();
   FtraceConfig(FtraceConfig&&) noexcept;
@@ -102,12 +145,56 @@ class PERFETTO_EXPORT FtraceConfig {
   uint32_t drain_period_ms() const { return drain_period_ms_; }
   void set_drain_period_ms(uint32_t value) { drain_period_ms_ = value; }
 
+  bool compact_sched() const { return compact_sched_; }
+  void set_compact_sched(bool value) { compact_sched_ = value; }
+
+  bool raw_pages() const { return raw_pages_; }
+  void set_raw_pages(bool value) { raw_pages_ = value; }
+
+  int target_pids_size() const { return static_cast<int>(target_pids_.size()); }
+  const std::vector<int32_t>& target_pids() const { return target_pids_; }
+  std::vector<int32_t>* mutable_target_pids() { return &target_pids_; }
+  void clear_target_pids() { target_pids_.clear(); }
+  int32_t* add_target_pids() {
+    target_pids_.emplace_back();
+    return &target_pids_.back();
+  }
+
+  int target_tgids_size() const {
+    return static_cast<int>(target_tgids_.size());
+  }
+  const std::vector<int32_t>& target_tgids() const { return target_tgids_; }
+  std::vector<int32_t>* mutable_target_tgids() { return &target_tgids_; }
+  void clear_target_tgids() { target_tgids_.clear(); }
+  int32_t* add_target_tgids() {
+    target_tgids_.emplace_back();
+    return &target_tgids_.back();
+  }
+
+  int field_filters_size() const {
+    return static_cast<int>(field_filters_.size());
+  }
+  const std::vector<FieldFilter>& field_filters() const {
+    return field_filters_;
+  }
+  std::vector<FieldFilter>* mutable_field_filters() { return &field_filters_; }
+  void clear_field_filters() { field_filters_.clear(); }
+  FieldFilter* add_field_filters() {
+    field_filters_.emplace_back();
+    return &field_filters_.back();
+  }
+
  private:
   std::vector<std::string> ftrace_events_;
   std::vector<std::string> atrace_categories_;
   std::vector<std::string> atrace_apps_;
   uint32_t buffer_size_kb_ = {};
   uint32_t drain_period_ms_ = {};
+  bool compact_sched_ = {};
+  bool raw_pages_ = {};
+  std::vector<int32_t> target_pids_;
+  std::vector<FieldFilter> field_filters_;
+  std::vector<int32_t> target_tgids_;
 
   // Allows to preserve unknown protobuf fields for compatibility
   // with future versions of .proto files.
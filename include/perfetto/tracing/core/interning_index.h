@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INCLUDE_PERFETTO_TRACING_CORE_INTERNING_INDEX_H_
+#define INCLUDE_PERFETTO_TRACING_CORE_INTERNING_INDEX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <list>
+#include <string>
+#include <unordered_map>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/base/string_view.h"
+#include "perfetto/base/utils.h"
+
+namespace perfetto {
+
+namespace internal {
+
+// Converts a lookup key of an InterningIndex into the type stored in the
+// index.
+template <typename T>
+inline T ToInterningStorage(const T& key) {
+  return key;
+}
+
+inline std::string ToInterningStorage(const base::StringView& key) {
+  return key.ToStdString();
+}
+
+}  // namespace internal
+
+// Producer-side interning index for one type of interned data (e.g. event
+// names) of a packet sequence (i.e. of a TraceWriter), see
+// interned_data.proto. Assigns a sequential interning ID (iid) to each new
+// value, which the writer emits together with the value in the InternedData
+// of the packet and then uses to refer to the value.
+//
+// The index is bounded: once it holds |max_entries| values, interning a new
+// value evicts the least recently used one. If the evicted value is interned
+// again it gets a new iid (and has to be emitted again), as iids can't be
+// reused for different values within a tracing session.
+//
+// |Key| is the type used for the lookups, |Storage| the one of the values held
+// by the index. They differ for strings, which are looked up by StringView (no
+// copies) and stored as std::string: a Key must be constructible from a
+// Storage, referring to it, and a ToInterningStorage(const Key&) overload must
+// exist for them (see above). This class is not thread safe, like the
+// TraceWriter it is used with.
+template <typename Key,
+          typename Storage = Key,
+          typename KeyHash = std::hash<Key>>
+class InterningIndex {
+ public:
+  explicit InterningIndex(size_t max_entries) : max_entries_(max_entries) {
+    PERFETTO_DCHECK(max_entries_ > 0);
+  }
+
+  // Returns the iid of |key|. If |key| wasn't in the index, assigns it a new
+  // iid and sets |*is_new| to true: the caller must then emit the new entry
+  // before (or in the same packet as) the first reference to it.
+  uint32_t Intern(const Key& key, bool* is_new) {
+    auto it = index_.find(key);
+    if (PERFETTO_LIKELY(it != index_.end())) {
+      // Move the entry to the front of the LRU list.
+      if (it->second != entries_.begin())
+        entries_.splice(entries_.begin(), entries_, it->second);
+      *is_new = false;
+      return it->second->iid;
+    }
+
+    if (index_.size() >= max_entries_) {
+      index_.erase(Key(entries_.back().value));
+      entries_.pop_back();
+    }
+    using internal::ToInterningStorage;
+    entries_.push_front(Entry{ToInterningStorage(key), next_iid_++});
+    // The key refers to the value owned by the list node, whose address is
+    // stable until the entry is evicted.
+    index_.emplace(Key(entries_.front().value), entries_.begin());
+    *is_new = true;
+    return entries_.front().iid;
+  }
+
+  // Forgets all the values, e.g. when the incremental state of the sequence
+  // is cleared. The iids keep increasing, so that readers never see the same
+  // iid for two different values.
+  void Clear() {
+    index_.clear();
+    entries_.clear();
+  }
+
+  size_t size() const { return index_.size(); }
+
+ private:
+  struct Entry {
+    Storage value;
+    uint32_t iid;
+  };
+  using EntryList = std::list<Entry>;
+
+  const size_t max_entries_;
+  uint32_t next_iid_ = 1;  // 0 is not a valid iid.
+
+  // Ordered from the most to the least recently used.
+  EntryList entries_;
+  std::unordered_map<Key, typename EntryList::iterator, KeyHash> index_;
+};
+
+}  // namespace perfetto
+
+#endif  // INCLUDE_PERFETTO_TRACING_CORE_INTERNING_INDEX_H_
@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INCLUDE_PERFETTO_TRACING_CORE_SEQUENCE_INTERNING_STATE_H_
+#define INCLUDE_PERFETTO_TRACING_CORE_SEQUENCE_INTERNING_STATE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "perfetto/base/export.h"
+#include "perfetto/base/string_view.h"
+#include "perfetto/tracing/core/interning_index.h"
+
+namespace perfetto {
+
+namespace protos {
+namespace pbzero {
+class TracePacket;
+}  // namespace pbzero
+}  // namespace protos
+
+// Interning state of a packet sequence, i.e. of a TraceWriter: holds one
+// InterningIndex for each field of InternedData (see interned_data.proto) and
+// emits the new entries in-band, in the packet that first refers to them.
+// Usage, for each packet:
+//   bool cleared = state.BeginPacket();
+//   auto packet = trace_writer->NewTracePacket();
+//   ... packet->set_track_event()->add_category_iids(
+//           state.InternEventCategory("cat")); ...
+//   state.EndPacket(packet.get());
+//
+// Readers that lose packets of the sequence (e.g. because the ring buffer
+// wrapped) can't resolve the iids emitted before the loss, so the state is
+// cleared every |reset_period_packets| packets (if non-zero) or when Reset()
+// is called, e.g. when the embedder knows that data was lost. The next packet
+// is then marked with |incremental_state_cleared| and the values are emitted
+// again when next used. Not thread safe, like TraceWriter.
+class PERFETTO_EXPORT SequenceInterningState {
+ public:
+  static constexpr size_t kDefaultMaxEntriesPerIndex = 1024;
+
+  explicit SequenceInterningState(
+      size_t max_entries_per_index = kDefaultMaxEntriesPerIndex,
+      uint32_t reset_period_packets = 0);
+  ~SequenceInterningState();
+
+  // Must be called before writing each packet that refers to interned data.
+  // Returns true if the interning state was cleared, in which case EndPacket()
+  // will set |incremental_state_cleared| in the packet.
+  bool BeginPacket();
+
+  // Must be called after the payload of the packet has been written, before
+  // finalizing the packet. Appends the entries interned since BeginPacket()
+  // to the InternedData of |packet|.
+  void EndPacket(protos::pbzero::TracePacket* packet);
+
+  // Clears the interning state from the next BeginPacket() on.
+  void Reset() { reset_pending_ = true; }
+
+  // Each of these returns the iid of the value in its index, to be used in the
+  // corresponding *_iid field of the current packet.
+  uint32_t InternEventCategory(base::StringView name);
+  uint32_t InternLegacyEventName(base::StringView name);
+  uint32_t InternDebugAnnotationName(base::StringView name);
+  uint32_t InternSourceLocation(base::StringView file_name,
+                                base::StringView function_name);
+
+  // Source locations are interned by the pair of their strings.
+  struct SourceLocation {
+    std::string file_name;
+    std::string function_name;
+  };
+  struct SourceLocationRef {
+    SourceLocationRef(base::StringView file, base::StringView function)
+        : file_name(file), function_name(function) {}
+    explicit SourceLocationRef(const SourceLocation& loc)
+        : file_name(loc.file_name), function_name(loc.function_name) {}
+    bool operator==(const SourceLocationRef& o) const {
+      return file_name == o.file_name && function_name == o.function_name;
+    }
+
+    base::StringView file_name;
+    base::StringView function_name;
+  };
+  struct SourceLocationRefHash {
+    size_t operator()(const SourceLocationRef& loc) const {
+      return static_cast<size_t>(loc.file_name.Hash() * 31 +
+                                 loc.function_name.Hash());
+    }
+  };
+
+ private:
+  SequenceInterningState(const SequenceInterningState&) = delete;
+  SequenceInterningState& operator=(const SequenceInterningState&) = delete;
+
+  using StringIndex = InterningIndex<base::StringView, std::string>;
+  using PendingStrings = std::vector<std::pair<uint32_t, std::string>>;
+
+  static uint32_t InternString(StringIndex*,
+                               PendingStrings*,
+                               base::StringView);
+
+  const uint32_t reset_period_packets_;
+  uint32_t packets_since_reset_ = 0;
+  bool reset_pending_ = true;  // The first packet clears the state.
+  bool cleared_in_current_packet_ = false;
+
+  StringIndex event_categories_;
+  StringIndex legacy_event_names_;
+  StringIndex debug_annotation_names_;
+  InterningIndex<SourceLocationRef, SourceLocation, SourceLocationRefHash>
+      source_locations_;
+
+  // The entries interned in the current packet, which EndPacket() emits.
+  // Their capacity is retained across packets.
+  PendingStrings new_event_categories_;
+  PendingStrings new_legacy_event_names_;
+  PendingStrings new_debug_annotation_names_;
+  std::vector<std::pair<uint32_t, SourceLocation>> new_source_locations_;
+};
+
+inline SequenceInterningState::SourceLocation ToInterningStorage(
+    const SequenceInterningState::SourceLocationRef& loc) {
+  return SequenceInterningState::SourceLocation{
+      loc.file_name.ToStdString(), loc.function_name.ToStdString()};
+}
+
+}  // namespace perfetto
+
+#endif  // INCLUDE_PERFETTO_TRACING_CORE_SEQUENCE_INTERNING_STATE_H_
@@ -75,6 +75,12 @@ class PERFETTO_EXPORT SharedMemoryArbiter {
   // committed in the shared memory buffer.
   virtual void NotifyFlushComplete(FlushRequestID) = 0;
 
+  // If |batch_commits_duration_ms| > 0, the commits of the completed chunks are
+  // batched for up to that duration before being sent to the service, rather
+  // than being sent in the next task. Flushes and the shared memory buffer
+  // filling up still cause an immediate commit. Can be called on any thread.
+  virtual void SetBatchCommitsDuration(uint32_t batch_commits_duration_ms) = 0;
+
   // Implemented in src/core/shared_memory_arbiter_impl.cc .
   static std::unique_ptr<SharedMemoryArbiter> CreateInstance(
       SharedMemory*,
@@ -18,7 +18,6 @@
 #define INCLUDE_PERFETTO_TRACING_CORE_STARTUP_TRACE_WRITER_H_
 
 #include <memory>
-#include <mutex>
 #include <set>
 #include <vector>
 
@@ -26,8 +25,6 @@
 #include "perfetto/base/optional.h"
 #include "perfetto/base/thread_checker.h"
 #include "perfetto/protozero/message_handle.h"
-#include "perfetto/protozero/scattered_heap_buffer.h"
-#include "perfetto/protozero/scattered_stream_writer.h"
 #include "perfetto/tracing/core/basic_types.h"
 #include "perfetto/tracing/core/trace_writer.h"
 
@@ -55,16 +52,15 @@ class TracePacket;
 // the writer's local buffer will then be copied into the SMB and the any future
 // writes will proxy directly to a new SMB-backed TraceWriter.
 //
-// Writing to the temporary local trace buffer is guarded by a lock and flag to
-// allow binding the writer from a different thread. When the writer starts
-// writing data by calling NewTracePacket(), the writer thread acquires the lock
-// to set a flag indicating that a write is in progress. Once the packet is
-// finalized, the flag is reset. To bind the writer, the lock is acquired while
-// the flag is unset and released only once binding completed, thereby blocking
-// the writer thread from starting a write concurrently.
-//
-// While unbound, the writer thread should finalize each TracePacket as soon as
-// possible to ensure that it doesn't block binding the writer.
+// Neither writing nor binding take locks. The local buffer is a
+// single-producer single-consumer queue of packets: the writer thread appends
+// packets to it and publishes each one when it is finalized, while the binding
+// thread concurrently copies the published packets into SMB chunks. Binding
+// never blocks on the writer: once the binding thread has committed all the
+// packets published so far, it hands the SMB-backed TraceWriter over to the
+// writer thread by atomically flagging the end of the published packets. If
+// the writer thread was writing a packet at that point, it commits the packet
+// as soon as it finalizes it. From then on it writes directly into the SMB.
 class PERFETTO_EXPORT StartupTraceWriter
     : public TraceWriter,
       public protozero::MessageHandleBase::FinalizationListener {
@@ -113,51 +109,67 @@ class PERFETTO_EXPORT StartupTraceWriter
   StartupTraceWriter(const StartupTraceWriter&) = delete;
   StartupTraceWriter& operator=(const StartupTraceWriter&) = delete;
 
+  class LocalBuffer;
+
   // Bind this StartupTraceWriter to the provided SharedMemoryArbiterImpl.
   // Called by StartupTraceWriterRegistry::BindToArbiter().
   //
-  // This method can be called on any thread. If any data was written locally
-  // before the writer was bound, BindToArbiter() will copy this data into
-  // chunks in the provided target buffer via the SMB. Any future packets will
-  // be directly written into the SMB via a newly obtained TraceWriter from the
-  // arbiter.
+  // This method can be called on any thread, also while the writer thread is
+  // writing a packet. It copies the packets that were written locally and
+  // completed so far into chunks in the provided target buffer via the SMB, and
+  // then hands a newly obtained TraceWriter from the arbiter over to the writer
+  // thread, which commits the packet it was writing (if any) once it completes
+  // it and then writes all future packets directly into the SMB.
   //
-  // Will fail and return |false| if a concurrent write is in progress. Returns
-  // |true| if successfully bound and should then not be called again.
-  bool BindToArbiter(SharedMemoryArbiterImpl*,
-                     BufferID target_buffer) PERFETTO_WARN_UNUSED_RESULT;
+  // Should not be called again.
+  void BindToArbiter(SharedMemoryArbiterImpl*, BufferID target_buffer);
 
   // protozero::MessageHandleBase::FinalizationListener implementation.
   void OnMessageFinalized(protozero::Message* message) override;
 
-  void OnTracePacketCompleted();
-  ChunkID CommitLocalBufferChunks(SharedMemoryArbiterImpl*, WriterID, BufferID);
+  // Called on the writer thread once it observes that the binding thread handed
+  // over. Commits the packet that the binding thread didn't commit (if any) and
+  // switches to |trace_writer_|.
+  void CompleteBinding();
+
+  // Copies the packets published in |local_buffer_| that weren't committed yet,
+  // up to |end|, into new chunks, starting at |first_chunk_id|. Returns the ID
+  // of the chunk following the last committed one.
+  ChunkID CommitLocalBufferChunks(SharedMemoryArbiterImpl*,
+                                  WriterID,
+                                  BufferID,
+                                  ChunkID first_chunk_id,
+                                  size_t end);
 
   PERFETTO_THREAD_CHECKER(writer_thread_checker_)
 
   std::shared_ptr<StartupTraceWriterRegistryHandle> registry_handle_;
 
-  // Only set and accessed from the writer thread. The writer thread flips this
-  // bit when it sees that trace_writer_ is set (while holding the lock).
-  // Caching this fact in this variable avoids the need to acquire the lock to
-  // check on later calls to NewTracePacket().
+  // Only set and accessed from the writer thread. The writer thread sets this
+  // once it completed the binding, i.e. when it writes to |trace_writer_|.
   bool was_bound_ = false;
 
-  // All variables below this point are protected by |lock_|.
-  std::mutex lock_;
-
-  // Never reset once it is changed from |nullptr|.
+  // Set by the binding thread before it hands |local_buffer_| over. The writer
+  // thread doesn't access them until it observes the hand over. |trace_writer_|
+  // is never reset once it is changed from |nullptr|.
   std::unique_ptr<TraceWriter> trace_writer_ = nullptr;
+  SharedMemoryArbiterImpl* arbiter_ = nullptr;
+  BufferID target_buffer_ = 0;
+  ChunkID next_chunk_id_ = 0;
 
   // Local memory buffer for trace packets written before the writer is bound.
-  std::unique_ptr<protozero::ScatteredHeapBuffer> memory_buffer_;
-  std::unique_ptr<protozero::ScatteredStreamWriter> memory_stream_writer_;
-
-  std::vector<uint32_t> packet_sizes_;
+  // Written by the writer thread, read by the binding thread until it hands the
+  // buffer over and by the writer thread afterwards.
+  std::unique_ptr<LocalBuffer> local_buffer_;
 
-  // Whether the writer thread is currently writing a TracePacket.
+  // Whether the writer thread is currently writing a TracePacket into the
+  // local buffer. Only accessed on the writer thread.
   bool write_in_progress_ = false;
 
+  // The location in |local_buffer_| of the size header of the packet being
+  // written, backfilled when it is finalized.
+  uint8_t* cur_packet_header_ = nullptr;
+
   // The packet returned via NewTracePacket() while the writer is unbound. Reset
   // to |nullptr| once bound. Owned by this class, TracePacketHandle has just a
   // pointer to it.
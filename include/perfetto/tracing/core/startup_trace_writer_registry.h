@@ -87,9 +87,9 @@ class PERFETTO_EXPORT StartupTraceWriterRegistry {
   // TaskRunner's sequence. See
   // SharedMemoryArbiter::BindStartupTraceWriterRegistry() for details.
   //
-  // Note that the writers may not be bound synchronously if they are
-  // concurrently being written to. The registry will retry on the passed
-  // TaskRunner until all writers were bound successfully.
+  // Writers that are concurrently being written to are bound without waiting
+  // for their writer threads, which commit the packet they were writing (if
+  // any) once they complete it.
   //
   // Calls |on_bound_callback| asynchronously on |trace_writer| once all writers
   // were bound.
@@ -110,10 +110,6 @@ class PERFETTO_EXPORT StartupTraceWriterRegistry {
   // Called by StartupTraceWriterRegistryHandle.
   void OnStartupTraceWriterDestroyed(StartupTraceWriter*);
 
-  // Try to bind the remaining unbound writers and post a continuation to
-  // |task_runner_| if any writers could not be bound.
-  void TryBindWriters();
-
   // Notifies the arbiter when we have bound all writers. May delete |this|.
   void OnUnboundWritersRemovedLocked();
 
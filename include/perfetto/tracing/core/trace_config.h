@@ -45,6 +45,7 @@ class TraceConfig_BufferConfig;
 class TraceConfig_DataSource;
 class DataSourceConfig;
 class FtraceConfig;
+class FtraceConfig_FieldFilter;
 class ChromeConfig;
 class InodeFileConfig;
 class InodeFileConfig_MountPointMappingEntry;
@@ -177,10 +178,18 @@ class PERFETTO_EXPORT TraceConfig {
     uint32_t page_size_kb() const { return page_size_kb_; }
     void set_page_size_kb(uint32_t value) { page_size_kb_ = value; }
 
+    uint32_t batch_commits_duration_ms() const {
+      return batch_commits_duration_ms_;
+    }
+    void set_batch_commits_duration_ms(uint32_t value) {
+      batch_commits_duration_ms_ = value;
+    }
+
    private:
     std::string producer_name_ = {};
     uint32_t shm_size_kb_ = {};
     uint32_t page_size_kb_ = {};
+    uint32_t batch_commits_duration_ms_ = {};
 
     // Allows to preserve unknown protobuf fields for compatibility
     // with future versions of .proto files.
@@ -364,6 +373,9 @@ class PERFETTO_EXPORT TraceConfig {
   bool notify_traceur() const { return notify_traceur_; }
   void set_notify_traceur(bool value) { notify_traceur_ = value; }
 
+  bool compress_file() const { return compress_file_; }
+  void set_compress_file(bool value) { compress_file_ = value; }
+
  private:
   std::vector<BufferConfig> buffers_;
   std::vector<DataSource> data_sources_;
@@ -381,6 +393,7 @@ class PERFETTO_EXPORT TraceConfig {
   uint32_t flush_timeout_ms_ = {};
   bool disable_clock_snapshotting_ = {};
   bool notify_traceur_ = {};
+  bool compress_file_ = {};
 
   // Allows to preserve unknown protobuf fields for compatibility
   // with future versions of .proto files.
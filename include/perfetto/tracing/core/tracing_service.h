@@ -102,6 +102,11 @@ class PERFETTO_EXPORT TracingService {
     // See shared_memory_abi.h
     virtual size_t shared_buffer_page_size_kb() const = 0;
 
+    // How long the producer can hold the commits of the completed chunks before
+    // sending them to the service (0: no batching). It's decided by the
+    // service, from the TraceConfig, when setting up the shared memory buffer.
+    virtual uint32_t batch_commits_duration_ms() const = 0;
+
     // Creates a trace writer, which allows to create events, handling the
     // underying shared memory buffer and signalling to the Service. This method
     // is thread-safe but the returned object is not. A TraceWriter should be
@@ -167,6 +172,17 @@ class PERFETTO_EXPORT TracingService {
     // Tracing data will be delivered invoking Consumer::OnTraceData().
     virtual void ReadBuffers() = 0;
 
+    // Takes a read-only copy of the trace buffers and delivers its contents
+    // via Consumer::OnTraceData(), like ReadBuffers(). Unlike ReadBuffers(),
+    // this doesn't consume the contents of the buffers and doesn't pause the
+    // producers: the tracing session keeps running unaffected. This is meant
+    // for flight-recorder use cases, to grab the latest part of the trace when
+    // an anomaly is detected. The copy is a self-contained trace (i.e. it
+    // includes the trace config and clock snapshots). Calls to this and to
+    // ReadBuffers() must not be interleaved until the has_more == false
+    // OnTraceData() is received.
+    virtual void CloneAndReadBuffers() = 0;
+
     virtual void FreeBuffers() = 0;
 
     // Will call OnDetach().
@@ -229,6 +245,17 @@ class PERFETTO_EXPORT TracingService {
   //
   // This feature is currently used by Chrome.
   virtual void SetSMBScrapingEnabled(bool enabled) = 0;
+
+  // Enables the multi-threaded commit mode when |num_threads| > 0 (or disables
+  // it when 0). In this mode, trace buffers are sharded by sequence and the
+  // chunk copies requested by CommitData() are performed on a pool of
+  // |num_threads| worker threads, so that commits from different sequences
+  // are processed in parallel. Reads are still performed on the service
+  // thread. Can only be changed while there are no active tracing sessions.
+  // Each buffer gets |num_threads| shards of its full size, one per worker,
+  // and each {producer, writer} sequence uses one of them. This can use up to
+  // |num_threads| times the memory of the buffers, see ShardedTraceBuffer.
+  virtual void SetCommitWorkerThreads(size_t num_threads) = 0;
 };
 
 }  // namespace perfetto
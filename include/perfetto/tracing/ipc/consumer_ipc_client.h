@@ -17,6 +17,8 @@
 #ifndef INCLUDE_PERFETTO_TRACING_IPC_CONSUMER_IPC_CLIENT_H_
 #define INCLUDE_PERFETTO_TRACING_IPC_CONSUMER_IPC_CLIENT_H_
 
+#include <stddef.h>
+
 #include <memory>
 #include <string>
 
@@ -41,8 +43,16 @@ class ConsumerIPCClient {
   // callbacks invoked on the Consumer interface: no more Consumer callbacks are
   // invoked immediately after its destruction and any pending callback will be
   // dropped.
-  static std::unique_ptr<TracingService::ConsumerEndpoint>
-  Connect(const char* service_sock_name, Consumer*, base::TaskRunner*);
+  // If |read_buffers_shm_size| is > 0, the trace data of ReadBuffers() and
+  // CloneAndReadBuffers() is returned through a shared memory ring of that
+  // size (which must be a multiple of the page size), rather than being
+  // serialized into the IPCs. This is much faster for large traces. If the
+  // service doesn't support it, the data keeps coming through the IPCs.
+  static std::unique_ptr<TracingService::ConsumerEndpoint> Connect(
+      const char* service_sock_name,
+      Consumer*,
+      base::TaskRunner*,
+      size_t read_buffers_shm_size = 0);
 
  protected:
   ConsumerIPCClient() = delete;
@@ -50,6 +50,10 @@ class ServiceIPCHost {
   virtual bool Start(base::ScopedFile producer_socket_fd,
                      base::ScopedFile consumer_socket_fd) = 0;
 
+  // Returns the underlying service business logic, e.g. to tune it before
+  // starting. Valid only after Start() succeeded.
+  virtual TracingService* service() const = 0;
+
  protected:
   ServiceIPCHost();
 
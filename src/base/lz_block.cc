@@ -0,0 +1,285 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "perfetto/base/lz_block.h"
+
+#include <string.h>
+
+#include "perfetto/base/logging.h"
+
+namespace perfetto {
+namespace base {
+
+namespace {
+
+// Constants from the LZ4 block format specification.
+constexpr size_t kMinMatch = 4;
+// The last 5 bytes of the input are always encoded as literals.
+constexpr size_t kLastLiterals = 5;
+// The last match must start at least 12 bytes before the end of the input.
+constexpr size_t kMatchFindLimit = 12;
+constexpr size_t kMaxOffset = 65535;
+constexpr uint8_t kRunMask = 15;
+// Size of the fixed-size copies used by the decoder when there is enough room
+// in both the input and the output.
+constexpr size_t kWildCopy = 16;
+
+constexpr uint32_t kHashLog = 12;
+constexpr size_t kHashTableSize = 1 << kHashLog;
+
+inline uint32_t Read32(const uint8_t* ptr) {
+  uint32_t value;
+  memcpy(&value, ptr, sizeof(value));
+  return value;
+}
+
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define PERFETTO_LZ_FAST_MATCH 1
+inline uint64_t Read64(const uint8_t* ptr) {
+  uint64_t value;
+  memcpy(&value, ptr, sizeof(value));
+  return value;
+}
+#endif
+
+// Returns the number of bytes that match between |ip| and |ref|, without
+// reading past |limit|. |ref| must be < |ip|.
+inline size_t CountMatch(const uint8_t* ip,
+                         const uint8_t* ref,
+                         const uint8_t* limit) {
+  const uint8_t* const start = ip;
+#if defined(PERFETTO_LZ_FAST_MATCH)
+  while (limit - ip >= 8) {
+    const uint64_t diff = Read64(ip) ^ Read64(ref);
+    if (diff)
+      return static_cast<size_t>(ip - start) +
+             static_cast<size_t>(__builtin_ctzll(diff) >> 3);
+    ip += 8;
+    ref += 8;
+  }
+#endif
+  while (ip < limit && *ip == *ref) {
+    ip++;
+    ref++;
+  }
+  return static_cast<size_t>(ip - start);
+}
+
+inline uint32_t Hash(uint32_t sequence) {
+  return (sequence * 2654435761u) >> (32 - kHashLog);
+}
+
+// Writes the extra bytes of a length >= 15, see the LZ4 block format.
+inline uint8_t* WriteLength(size_t len, uint8_t* dst) {
+  for (; len >= 255; len -= 255)
+    *(dst++) = 255;
+  *(dst++) = static_cast<uint8_t>(len);
+  return dst;
+}
+
+// Reads the extra bytes of a length field. Returns false if the input is
+// truncated.
+inline bool ReadLength(const uint8_t** src,
+                       const uint8_t* src_end,
+                       size_t* len) {
+  for (;;) {
+    if (*src >= src_end)
+      return false;
+    uint8_t byte = *((*src)++);
+    *len += byte;
+    if (byte != 255)
+      return true;
+  }
+}
+
+// Emits a sequence of |lit_len| literals from |lit| followed (if |match_len| >
+// 0) by a back-reference. Returns the new write pointer or nullptr if the
+// sequence doesn't fit before |dst_end|.
+uint8_t* WriteSequence(const uint8_t* lit,
+                       size_t lit_len,
+                       size_t offset,
+                       size_t match_len,
+                       uint8_t* dst,
+                       uint8_t* dst_end) {
+  // Worst case: token + literal length + literals + offset + match length.
+  const size_t max_size = 1 + (lit_len / 255 + 1) + lit_len + 2 +
+                          (match_len / 255 + 1);
+  if (static_cast<size_t>(dst_end - dst) < max_size)
+    return nullptr;
+
+  uint8_t* token = dst++;
+  if (lit_len >= kRunMask) {
+    *token = kRunMask << 4;
+    dst = WriteLength(lit_len - kRunMask, dst);
+  } else {
+    *token = static_cast<uint8_t>(lit_len << 4);
+  }
+  if (lit_len)
+    memcpy(dst, lit, lit_len);
+  dst += lit_len;
+
+  if (match_len == 0)
+    return dst;  // Last sequence, literals only.
+
+  PERFETTO_DCHECK(offset > 0 && offset <= kMaxOffset);
+  *(dst++) = static_cast<uint8_t>(offset & 0xff);
+  *(dst++) = static_cast<uint8_t>(offset >> 8);
+  PERFETTO_DCHECK(match_len >= kMinMatch);
+  const size_t match_code = match_len - kMinMatch;
+  if (match_code >= kRunMask) {
+    *token |= kRunMask;
+    dst = WriteLength(match_code - kRunMask, dst);
+  } else {
+    *token |= static_cast<uint8_t>(match_code);
+  }
+  return dst;
+}
+
+}  // namespace
+
+size_t LzBlockCompress(const uint8_t* src,
+                       size_t src_size,
+                       uint8_t* dst,
+                       size_t dst_capacity) {
+  uint8_t* const dst_begin = dst;
+  uint8_t* const dst_end = dst + dst_capacity;
+  const uint8_t* const src_end = src + src_size;
+  const uint8_t* anchor = src;  // Start of the pending literals.
+
+  if (src_size > kMatchFindLimit) {
+    // Offsets of the last position (relative to |src|) for each hash bucket.
+    uint32_t table[kHashTableSize];
+    memset(table, 0, sizeof(table));
+
+    const uint8_t* const match_limit = src_end - kLastLiterals;
+    const uint8_t* const find_limit = src_end - kMatchFindLimit;
+    const uint8_t* ip = src + 1;
+    uint32_t misses = 0;
+    while (ip < find_limit) {
+      const uint32_t sequence = Read32(ip);
+      const uint32_t hash = Hash(sequence);
+      const uint8_t* ref = src + table[hash];
+      table[hash] = static_cast<uint32_t>(ip - src);
+      if (ref >= ip || static_cast<size_t>(ip - ref) > kMaxOffset ||
+          Read32(ref) != sequence) {
+        // Skip faster through incompressible data.
+        ip += 1 + (misses++ >> 6);
+        continue;
+      }
+      misses = 0;
+
+      // Extend the match backwards over the pending literals and forwards up
+      // to |match_limit|.
+      while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+        ip--;
+        ref--;
+      }
+      const size_t match_len =
+          kMinMatch + CountMatch(ip + kMinMatch, ref + kMinMatch, match_limit);
+
+      dst = WriteSequence(anchor, static_cast<size_t>(ip - anchor),
+                          static_cast<size_t>(ip - ref), match_len, dst,
+                          dst_end);
+      if (!dst)
+        return 0;
+      ip += match_len;
+      anchor = ip;
+
+      // Index a position within the match, to improve the chances of finding
+      // the next one.
+      if (ip - 2 > src && ip < find_limit)
+        table[Hash(Read32(ip - 2))] = static_cast<uint32_t>(ip - 2 - src);
+    }
+  }
+
+  dst = WriteSequence(anchor, static_cast<size_t>(src_end - anchor), 0, 0, dst,
+                      dst_end);
+  if (!dst)
+    return 0;
+  return static_cast<size_t>(dst - dst_begin);
+}
+
+bool LzBlockDecompress(const uint8_t* src,
+                       size_t src_size,
+                       uint8_t* dst,
+                       size_t dst_size) {
+  const uint8_t* const src_end = src + src_size;
+  uint8_t* const dst_begin = dst;
+  uint8_t* const dst_end = dst + dst_size;
+
+  while (src < src_end) {
+    const uint8_t token = *(src++);
+
+    size_t lit_len = token >> 4;
+    if (lit_len < kRunMask &&
+        static_cast<size_t>(src_end - src) >= kWildCopy &&
+        static_cast<size_t>(dst_end - dst) >= kWildCopy) {
+      // Fast path for short literals: copy a fixed-size block, which is
+      // much cheaper than a variable-size memcpy(). The extra bytes are
+      // overwritten by the following sequences.
+      memcpy(dst, src, kWildCopy);
+    } else {
+      if (lit_len == kRunMask && !ReadLength(&src, src_end, &lit_len))
+        return false;
+      if (lit_len > static_cast<size_t>(src_end - src) ||
+          lit_len > static_cast<size_t>(dst_end - dst)) {
+        return false;
+      }
+      if (lit_len)
+        memcpy(dst, src, lit_len);
+    }
+    src += lit_len;
+    dst += lit_len;
+
+    if (src == src_end)
+      break;  // The last sequence has only literals.
+
+    if (src_end - src < 2)
+      return false;
+    const size_t offset = static_cast<size_t>(src[0] | (src[1] << 8));
+    src += 2;
+    if (offset == 0 || offset > static_cast<size_t>(dst - dst_begin))
+      return false;
+
+    size_t match_len = token & kRunMask;
+    if (match_len == kRunMask && !ReadLength(&src, src_end, &match_len))
+      return false;
+    match_len += kMinMatch;
+    if (match_len > static_cast<size_t>(dst_end - dst))
+      return false;
+
+    const uint8_t* ref = dst - offset;
+    if (offset >= 8 &&
+        static_cast<size_t>(dst_end - dst) >= match_len + kWildCopy) {
+      // Copy in blocks of 8 bytes, which never overlap given |offset| >= 8.
+      uint8_t* const match_end = dst + match_len;
+      for (; dst < match_end; dst += 8, ref += 8)
+        memcpy(dst, ref, 8);
+      dst = match_end;
+    } else if (offset >= match_len) {
+      memcpy(dst, ref, match_len);
+      dst += match_len;
+    } else {
+      // Overlapping copy, e.g. for runs of the same byte.
+      for (size_t i = 0; i < match_len; i++)
+        *(dst++) = *(ref++);
+    }
+  }
+  return dst == dst_end;
+}
+
+}  // namespace base
+}  // namespace perfetto
@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "perfetto/base/lz_block.h"
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace perfetto {
+namespace base {
+namespace {
+
+std::vector<uint8_t> Compress(const std::vector<uint8_t>& src) {
+  std::vector<uint8_t> dst(LzBlockCompressBound(src.size()));
+  size_t size = LzBlockCompress(src.data(), src.size(), dst.data(), dst.size());
+  EXPECT_GT(size, 0u);
+  dst.resize(size);
+  return dst;
+}
+
+std::vector<uint8_t> RoundTrip(const std::vector<uint8_t>& src) {
+  std::vector<uint8_t> compressed = Compress(src);
+  std::vector<uint8_t> decompressed(src.size());
+  EXPECT_TRUE(LzBlockDecompress(compressed.data(), compressed.size(),
+                                decompressed.data(), decompressed.size()));
+  return decompressed;
+}
+
+std::vector<uint8_t> ToBytes(const std::string& str) {
+  return std::vector<uint8_t>(str.begin(), str.end());
+}
+
+TEST(LzBlockTest, EmptyAndTinyInputs) {
+  for (size_t size = 0; size < 32; size++) {
+    std::vector<uint8_t> src(size, 'a');
+    EXPECT_EQ(src, RoundTrip(src));
+  }
+}
+
+TEST(LzBlockTest, CompressibleInput) {
+  std::string str;
+  for (int i = 0; i < 1000; i++)
+    str += "sched_switch prev_comm=swapper/" + std::to_string(i % 8) + " ";
+  std::vector<uint8_t> src = ToBytes(str);
+  std::vector<uint8_t> compressed = Compress(src);
+  EXPECT_LT(compressed.size(), src.size() / 4);
+  EXPECT_EQ(src, RoundTrip(src));
+}
+
+TEST(LzBlockTest, LongRunsAndLongLiterals) {
+  std::minstd_rand0 rnd(42);
+  std::vector<uint8_t> src;
+  for (int i = 0; i < 1000; i++)
+    src.push_back(static_cast<uint8_t>(rnd()));
+  src.insert(src.end(), 70000, 'x');  // Longer than the max offset.
+  for (int i = 0; i < 1000; i++)
+    src.push_back(static_cast<uint8_t>(rnd()));
+  EXPECT_EQ(src, RoundTrip(src));
+}
+
+TEST(LzBlockTest, IncompressibleInput) {
+  std::minstd_rand0 rnd(0);
+  std::vector<uint8_t> src(4096);
+  for (auto& byte : src)
+    byte = static_cast<uint8_t>(rnd());
+  EXPECT_EQ(src, RoundTrip(src));
+
+  // Gives up if the output doesn't fit in the given capacity.
+  std::vector<uint8_t> dst(src.size());
+  EXPECT_EQ(0u,
+            LzBlockCompress(src.data(), src.size(), dst.data(), dst.size()));
+}
+
+TEST(LzBlockTest, RejectsMalformedInput) {
+  std::string str;
+  for (int i = 0; i < 100; i++)
+    str += "abcdefgh" + std::to_string(i);
+  std::vector<uint8_t> src = ToBytes(str);
+  std::vector<uint8_t> compressed = Compress(src);
+  std::vector<uint8_t> dst(src.size());
+
+  // Wrong decompressed size.
+  EXPECT_FALSE(LzBlockDecompress(compressed.data(), compressed.size(),
+                                 dst.data(), dst.size() - 1));
+  std::vector<uint8_t> bigger_dst(src.size() + 1);
+  EXPECT_FALSE(LzBlockDecompress(compressed.data(), compressed.size(),
+                                 bigger_dst.data(), bigger_dst.size()));
+
+  // Truncated input.
+  for (size_t size = 0; size < compressed.size(); size++) {
+    EXPECT_FALSE(
+        LzBlockDecompress(compressed.data(), size, dst.data(), dst.size()));
+  }
+
+  // Offset pointing before the beginning of the output.
+  const uint8_t bad_offset[] = {0x10, 'a', 0x10, 0x00};
+  EXPECT_FALSE(LzBlockDecompress(bad_offset, sizeof(bad_offset), dst.data(),
+                                 dst.size()));
+
+  // Random garbage must never crash or write out of bounds.
+  std::minstd_rand0 rnd(1);
+  for (int i = 0; i < 1000; i++) {
+    std::vector<uint8_t> garbage(compressed);
+    garbage[rnd() % garbage.size()] = static_cast<uint8_t>(rnd());
+    LzBlockDecompress(garbage.data(), garbage.size(), dst.data(), dst.size());
+  }
+}
+
+}  // namespace
+}  // namespace base
+}  // namespace perfetto
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "perfetto/base/thread_pool.h"
+
+#include "perfetto/base/logging.h"
+
+namespace perfetto {
+namespace base {
+
+ThreadPool::ThreadPool(size_t num_threads) {
+  PERFETTO_CHECK(num_threads > 0);
+  for (size_t i = 0; i < num_threads; i++)
+    workers_.emplace_back(new Worker());
+
+  // Start the threads only after |workers_| has been fully populated, so that
+  // it is never resized while a worker is running.
+  for (auto& worker : workers_) {
+    Worker* w = worker.get();
+    w->thread = std::thread(&ThreadPool::RunWorker, this, w);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  WaitIdle();
+  for (auto& worker : workers_) {
+    {
+      std::lock_guard<std::mutex> lock(worker->mutex);
+      worker->quit = true;
+    }
+    worker->cv.notify_one();
+  }
+  for (auto& worker : workers_)
+    worker->thread.join();
+}
+
+void ThreadPool::PostTask(size_t worker_idx, std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(idle_mutex_);
+    pending_tasks_++;
+  }
+  Worker* worker = workers_[worker_idx % workers_.size()].get();
+  {
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    worker->tasks.emplace_back(std::move(task));
+  }
+  worker->cv.notify_one();
+}
+
+void ThreadPool::WaitIdle() {
+  std::unique_lock<std::mutex> lock(idle_mutex_);
+  idle_cv_.wait(lock, [this] { return pending_tasks_ == 0; });
+}
+
+void ThreadPool::RunWorker(Worker* worker) {
+  for (;;) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(worker->mutex);
+      worker->cv.wait(
+          lock, [worker] { return worker->quit || !worker->tasks.empty(); });
+      if (worker->tasks.empty()) {
+        PERFETTO_DCHECK(worker->quit);
+        return;
+      }
+      task = std::move(worker->tasks.front());
+      worker->tasks.pop_front();
+    }
+
+    task();
+
+    std::lock_guard<std::mutex> lock(idle_mutex_);
+    PERFETTO_DCHECK(pending_tasks_ > 0);
+    if (--pending_tasks_ == 0)
+      idle_cv_.notify_all();
+  }
+}
+
+}  // namespace base
+}  // namespace perfetto
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "perfetto/base/thread_pool.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace perfetto {
+namespace base {
+namespace {
+
+TEST(ThreadPoolTest, RunsAllTasks) {
+  ThreadPool pool(4);
+  std::atomic<int> counter{0};
+  for (int i = 0; i < 1000; i++)
+    pool.PostTask(static_cast<size_t>(i), [&counter] { counter++; });
+  pool.WaitIdle();
+  EXPECT_EQ(1000, counter.load());
+}
+
+TEST(ThreadPoolTest, SameWorkerIsFifoAndSingleThreaded) {
+  ThreadPool pool(3);
+  std::vector<std::vector<int>> seqs(3);
+  std::vector<std::thread::id> thread_ids(3);
+  for (int i = 0; i < 300; i++) {
+    size_t worker = static_cast<size_t>(i % 3);
+    pool.PostTask(worker, [&seqs, &thread_ids, worker, i] {
+      // Each worker touches only its own slot, without locks.
+      if (seqs[worker].empty())
+        thread_ids[worker] = std::this_thread::get_id();
+      EXPECT_EQ(thread_ids[worker], std::this_thread::get_id());
+      seqs[worker].push_back(i);
+    });
+  }
+  pool.WaitIdle();
+  for (size_t w = 0; w < 3; w++) {
+    ASSERT_EQ(100u, seqs[w].size());
+    for (size_t j = 0; j < seqs[w].size(); j++)
+      EXPECT_EQ(static_cast<int>(w + j * 3), seqs[w][j]);
+  }
+  EXPECT_NE(thread_ids[0], thread_ids[1]);
+  EXPECT_NE(thread_ids[1], thread_ids[2]);
+}
+
+TEST(ThreadPoolTest, WaitIdleOnEmptyPool) {
+  ThreadPool pool(2);
+  pool.WaitIdle();
+  pool.WaitIdle();
+}
+
+TEST(ThreadPoolTest, DestructorDrainsPendingTasks) {
+  std::atomic<int> counter{0};
+  {
+    ThreadPool pool(2);
+    for (int i = 0; i < 100; i++)
+      pool.PostTask(0, [&counter] { counter++; });
+  }
+  EXPECT_EQ(100, counter.load());
+}
+
+}  // namespace
+}  // namespace base
+}  // namespace perfetto
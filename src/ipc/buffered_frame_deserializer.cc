@@ -25,6 +25,7 @@
 #include "google/protobuf/io/zero_copy_stream_impl_lite.h"
 #include "perfetto/base/logging.h"
 #include "perfetto/base/utils.h"
+#include "perfetto/protozero/proto_utils.h"
 
 #include "src/ipc/wire_protocol.pb.h"
 
@@ -35,6 +36,59 @@ namespace {
 
 // The header is just the number of bytes of the Frame protobuf message.
 constexpr size_t kHeaderSize = sizeof(uint32_t);
+
+size_t GetVarIntSize(uint64_t value) {
+  size_t size = 1;
+  for (; value >= 0x80; value >>= 7)
+    size++;
+  return size;
+}
+
+// All the fields written below have ids < 16, hence a 1-byte tag.
+size_t GetVarIntFieldSize(uint64_t value) {
+  return 1 + GetVarIntSize(value);
+}
+
+size_t GetLengthDelimitedFieldSize(size_t length) {
+  return 1 + GetVarIntSize(length) + length;
+}
+
+uint8_t* WriteVarIntField(uint32_t field_id, uint64_t value, uint8_t* ptr) {
+  using protozero::proto_utils::MakeTagVarInt;
+  *ptr++ = static_cast<uint8_t>(MakeTagVarInt(field_id));
+  return protozero::proto_utils::WriteVarInt(value, ptr);
+}
+
+// Writes only the tag and the length, the caller writes the payload.
+uint8_t* WriteLengthDelimitedPreamble(uint32_t field_id,
+                                      size_t length,
+                                      uint8_t* ptr) {
+  using protozero::proto_utils::MakeTagLengthDelimited;
+  *ptr++ = static_cast<uint8_t>(MakeTagLengthDelimited(field_id));
+  return protozero::proto_utils::WriteVarInt(length, ptr);
+}
+
+// Resizes |buf| to fit the header and a Frame with |request_id| and a nested
+// |msg_field_id| message of |msg_size| bytes. Writes everything but the nested
+// message payload and returns the pointer where that should be written.
+uint8_t* BeginFrame(RequestID request_id,
+                    uint32_t msg_field_id,
+                    size_t msg_size,
+                    std::string* buf) {
+  const size_t frame_size = GetVarIntFieldSize(request_id) +
+                            GetLengthDelimitedFieldSize(msg_size);
+  // Don't send messages larger than what the receiver can handle.
+  PERFETTO_DCHECK(kHeaderSize + frame_size <= kIPCBufferSize);
+  buf->resize(kHeaderSize + frame_size);
+  uint8_t* ptr = reinterpret_cast<uint8_t*>(&(*buf)[0]);
+  const uint32_t payload_size = static_cast<uint32_t>(frame_size);
+  memcpy(ptr, base::AssumeLittleEndian(&payload_size), kHeaderSize);
+  ptr += kHeaderSize;
+  ptr = WriteVarIntField(Frame::kRequestIdFieldNumber, request_id, ptr);
+  ptr = WriteLengthDelimitedPreamble(msg_field_id, msg_size, ptr);
+  return ptr;
+}
+
 }  // namespace
 
 BufferedFrameDeserializer::BufferedFrameDeserializer(size_t max_capacity)
@@ -189,5 +243,58 @@ std::string BufferedFrameDeserializer::Serialize(const Frame& frame) {
   return buf;
 }
 
+// static
+bool BufferedFrameDeserializer::SerializeInvokeMethod(RequestID request_id,
+                                                      ServiceID service_id,
+                                                      MethodID method_id,
+                                                      bool drop_reply,
+                                                      const ProtoMessage& args,
+                                                      std::string* buf) {
+  using InvokeMethod = Frame::InvokeMethod;
+  if (!args.IsInitialized())
+    return false;
+  // Also caches the sizes used by SerializeWithCachedSizesToArray() below.
+  // The fields are written in the same order as the protobuf serializer.
+  const size_t args_size = args.ByteSizeLong();
+  const size_t msg_size = GetVarIntFieldSize(service_id) +
+                          GetVarIntFieldSize(method_id) +
+                          GetVarIntFieldSize(drop_reply) +
+                          GetLengthDelimitedFieldSize(args_size);
+  uint8_t* ptr = BeginFrame(request_id, Frame::kMsgInvokeMethodFieldNumber,
+                            msg_size, buf);
+  ptr = WriteVarIntField(InvokeMethod::kServiceIdFieldNumber, service_id, ptr);
+  ptr = WriteVarIntField(InvokeMethod::kMethodIdFieldNumber, method_id, ptr);
+  ptr = WriteLengthDelimitedPreamble(InvokeMethod::kArgsProtoFieldNumber,
+                                     args_size, ptr);
+  ptr = args.SerializeWithCachedSizesToArray(ptr);
+  ptr = WriteVarIntField(InvokeMethod::kDropReplyFieldNumber, drop_reply, ptr);
+  PERFETTO_DCHECK(ptr == reinterpret_cast<uint8_t*>(&(*buf)[0]) + buf->size());
+  return true;
+}
+
+// static
+void BufferedFrameDeserializer::SerializeInvokeMethodReply(
+    RequestID request_id,
+    bool has_more,
+    const ProtoMessage* reply,
+    std::string* buf) {
+  using InvokeMethodReply = Frame::InvokeMethodReply;
+  const bool success = reply && reply->IsInitialized();
+  const size_t reply_size = success ? reply->ByteSizeLong() : 0;
+  size_t msg_size = GetVarIntFieldSize(success) + GetVarIntFieldSize(has_more);
+  if (success)
+    msg_size += GetLengthDelimitedFieldSize(reply_size);
+  uint8_t* ptr = BeginFrame(request_id, Frame::kMsgInvokeMethodReplyFieldNumber,
+                            msg_size, buf);
+  ptr = WriteVarIntField(InvokeMethodReply::kSuccessFieldNumber, success, ptr);
+  ptr = WriteVarIntField(InvokeMethodReply::kHasMoreFieldNumber, has_more, ptr);
+  if (success) {
+    ptr = WriteLengthDelimitedPreamble(
+        InvokeMethodReply::kReplyProtoFieldNumber, reply_size, ptr);
+    ptr = reply->SerializeWithCachedSizesToArray(ptr);
+  }
+  PERFETTO_DCHECK(ptr == reinterpret_cast<uint8_t*>(&(*buf)[0]) + buf->size());
+}
+
 }  // namespace ipc
 }  // namespace perfetto
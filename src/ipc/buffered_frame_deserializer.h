@@ -21,6 +21,7 @@
 
 #include <list>
 #include <memory>
+#include <string>
 
 #include <sys/mman.h>
 
@@ -92,6 +93,28 @@ class BufferedFrameDeserializer {
   // in common that doesn't justify having its own class.
   static std::string Serialize(const Frame&);
 
+  // Specialized versions of Serialize() for the frames that carry a method
+  // invocation and its reply, the hot path of the IPC layer (e.g. CommitData).
+  // They encode the frame by hand and serialize |args| / |reply| directly into
+  // the args_proto / reply_proto field, instead of going through an
+  // intermediate std::string and a Frame that copies it again. The output
+  // (header + frame) overwrites the contents of |buf|, which the caller is
+  // expected to reuse across calls so that its capacity is retained.
+  // The result is byte-for-byte parsable as a Frame.
+  // Returns false if |args| could not be serialized.
+  static bool SerializeInvokeMethod(RequestID,
+                                    ServiceID,
+                                    MethodID,
+                                    bool drop_reply,
+                                    const ProtoMessage& args,
+                                    std::string* buf);
+
+  // |reply| == nullptr encodes a failed invocation (success == false).
+  static void SerializeInvokeMethodReply(RequestID,
+                                         bool has_more,
+                                         const ProtoMessage* reply,
+                                         std::string* buf);
+
   // Returns a buffer that can be passed to recv(). The buffer is deliberately
   // not initialized.
   ReceiveBuffer BeginReceive();
@@ -379,6 +379,94 @@ TEST(BufferedFrameDeserializerTest, FillCapacity) {
   }
 }
 
+// The frames encoded by hand by SerializeInvokeMethod*() must be identical to
+// the ones produced by the protobuf serializer.
+TEST(BufferedFrameDeserializerTest, SerializeInvokeMethod) {
+  Frame args;  // Any message will do.
+  args.add_data_for_testing(std::string(300, 'x'));
+  args.add_data_for_testing("foo");
+
+  for (bool drop_reply : {false, true}) {
+    Frame frame;
+    frame.set_request_id(1ull << 40);
+    Frame::InvokeMethod* req = frame.mutable_msg_invoke_method();
+    req->set_service_id(3);
+    req->set_method_id(200);
+    req->set_args_proto(args.SerializeAsString());
+    req->set_drop_reply(drop_reply);
+
+    std::string buf;
+    ASSERT_TRUE(BufferedFrameDeserializer::SerializeInvokeMethod(
+        1ull << 40, 3, 200, drop_reply, args, &buf));
+    EXPECT_EQ(BufferedFrameDeserializer::Serialize(frame), buf);
+  }
+}
+
+TEST(BufferedFrameDeserializerTest, SerializeInvokeMethodReply) {
+  Frame reply;
+  reply.add_data_for_testing("bar");
+
+  for (bool has_more : {false, true}) {
+    Frame frame;
+    frame.set_request_id(42);
+    Frame::InvokeMethodReply* frame_reply =
+        frame.mutable_msg_invoke_method_reply();
+    frame_reply->set_success(true);
+    frame_reply->set_has_more(has_more);
+    frame_reply->set_reply_proto(reply.SerializeAsString());
+
+    std::string buf;
+    BufferedFrameDeserializer::SerializeInvokeMethodReply(42, has_more, &reply,
+                                                          &buf);
+    EXPECT_EQ(BufferedFrameDeserializer::Serialize(frame), buf);
+  }
+
+  // A failed invocation.
+  std::string buf;
+  BufferedFrameDeserializer::SerializeInvokeMethodReply(42, false, nullptr,
+                                                        &buf);
+  BufferedFrameDeserializer bfd;
+  BufferedFrameDeserializer::ReceiveBuffer rbuf = bfd.BeginReceive();
+  ASSERT_GE(rbuf.size, buf.size());
+  memcpy(rbuf.data, buf.data(), buf.size());
+  ASSERT_TRUE(bfd.EndReceive(buf.size()));
+  std::unique_ptr<Frame> decoded_frame = bfd.PopNextFrame();
+  ASSERT_TRUE(decoded_frame);
+  EXPECT_EQ(42u, decoded_frame->request_id());
+  ASSERT_TRUE(decoded_frame->has_msg_invoke_method_reply());
+  EXPECT_FALSE(decoded_frame->msg_invoke_method_reply().success());
+  EXPECT_FALSE(decoded_frame->msg_invoke_method_reply().has_reply_proto());
+}
+
+// The output buffer is meant to be reused, a smaller frame must replace a
+// larger one entirely.
+TEST(BufferedFrameDeserializerTest, SerializeInvokeMethodReusesBuffer) {
+  Frame large_args;
+  large_args.add_data_for_testing(std::string(4096, 'x'));
+  Frame small_args;
+  small_args.add_data_for_testing("foo");
+
+  std::string buf;
+  ASSERT_TRUE(BufferedFrameDeserializer::SerializeInvokeMethod(
+      1, 1, 1, false, large_args, &buf));
+  const size_t capacity = buf.capacity();
+  ASSERT_TRUE(BufferedFrameDeserializer::SerializeInvokeMethod(
+      2, 1, 1, false, small_args, &buf));
+  EXPECT_EQ(capacity, buf.capacity());
+
+  BufferedFrameDeserializer bfd;
+  BufferedFrameDeserializer::ReceiveBuffer rbuf = bfd.BeginReceive();
+  ASSERT_GE(rbuf.size, buf.size());
+  memcpy(rbuf.data, buf.data(), buf.size());
+  ASSERT_TRUE(bfd.EndReceive(buf.size()));
+  std::unique_ptr<Frame> decoded_frame = bfd.PopNextFrame();
+  ASSERT_TRUE(decoded_frame);
+  EXPECT_EQ(2u, decoded_frame->request_id());
+  EXPECT_EQ(small_args.SerializeAsString(),
+            decoded_frame->msg_invoke_method().args_proto());
+  EXPECT_FALSE(bfd.PopNextFrame());
+}
+
 }  // namespace
 }  // namespace ipc
 }  // namespace perfetto
@@ -89,17 +89,11 @@ RequestID ClientImpl::BeginInvoke(ServiceID service_id,
                                   bool drop_reply,
                                   base::WeakPtr<ServiceProxy> service_proxy,
                                   int fd) {
-  std::string args_proto;
   RequestID request_id = ++last_request_id_;
-  Frame frame;
-  frame.set_request_id(request_id);
-  Frame::InvokeMethod* req = frame.mutable_msg_invoke_method();
-  req->set_service_id(service_id);
-  req->set_method_id(remote_method_id);
-  req->set_drop_reply(drop_reply);
-  bool did_serialize = method_args.SerializeToString(&args_proto);
-  req->set_args_proto(args_proto);
-  if (!did_serialize || !SendFrame(frame, fd)) {
+  bool did_serialize = BufferedFrameDeserializer::SerializeInvokeMethod(
+      request_id, service_id, remote_method_id, drop_reply, method_args,
+      &send_buf_);
+  if (!did_serialize || !SendBuffer(send_buf_, fd)) {
     PERFETTO_DLOG("BeginInvoke() failed while sending the frame");
     return 0;
   }
@@ -116,8 +110,10 @@ RequestID ClientImpl::BeginInvoke(ServiceID service_id,
 
 bool ClientImpl::SendFrame(const Frame& frame, int fd) {
   // Serialize the frame into protobuf, add the size header, and send it.
-  std::string buf = BufferedFrameDeserializer::Serialize(frame);
+  return SendBuffer(BufferedFrameDeserializer::Serialize(frame), fd);
+}
 
+bool ClientImpl::SendBuffer(const std::string& buf, int fd) {
   // TODO(primiano): this should do non-blocking I/O. But then what if the
   // socket buffer is full? We might want to either drop the request or throttle
   // the send and PostTask the reply later? Right now we are making Send()
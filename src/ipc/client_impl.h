@@ -77,6 +77,7 @@ class ClientImpl : public Client, public base::UnixSocket::EventListener {
   ClientImpl& operator=(const ClientImpl&) = delete;
 
   bool SendFrame(const Frame&, int fd = -1);
+  bool SendBuffer(const std::string& buf, int fd);
   void OnFrameReceived(const Frame&);
   void OnBindServiceReply(QueuedRequest, const Frame::BindServiceReply&);
   void OnInvokeMethodReply(QueuedRequest, const Frame::InvokeMethodReply&);
@@ -86,6 +87,9 @@ class ClientImpl : public Client, public base::UnixSocket::EventListener {
   base::TaskRunner* const task_runner_;
   RequestID last_request_id_ = 0;
   BufferedFrameDeserializer frame_deserializer_;
+
+  // Reused across BeginInvoke() calls to avoid reallocating the frame buffer.
+  std::string send_buf_;
   base::ScopedFile received_fd_;
   std::map<RequestID, QueuedRequest> queued_requests_;
   std::map<ServiceID, base::WeakPtr<ServiceProxy>> service_bindings_;
@@ -211,28 +211,25 @@ void HostImpl::ReplyToMethodInvocation(ClientID client_id,
     return;  // client has disconnected by the time we got the async reply.
 
   ClientConnection* client = client_iter->second.get();
-  Frame reply_frame;
-  reply_frame.set_request_id(request_id);
 
   // TODO(fmayer): add a test to guarantee that the reply is consumed within the
   // same call stack and not kept around. ConsumerIPCService::OnTraceData()
   // relies on this behavior.
-  auto* reply_frame_data = reply_frame.mutable_msg_invoke_method_reply();
-  reply_frame_data->set_has_more(reply.has_more());
-  if (reply.success()) {
-    std::string reply_proto;
-    if (reply->SerializeToString(&reply_proto)) {
-      reply_frame_data->set_reply_proto(reply_proto);
-      reply_frame_data->set_success(true);
-    }
-  }
-  SendFrame(client, reply_frame, reply.fd());
+  BufferedFrameDeserializer::SerializeInvokeMethodReply(
+      request_id, reply.has_more(), reply.success() ? &*reply : nullptr,
+      &client->send_buf);
+  SendBuffer(client, client->send_buf, reply.fd());
 }
 
 // static
 void HostImpl::SendFrame(ClientConnection* client, const Frame& frame, int fd) {
-  std::string buf = BufferedFrameDeserializer::Serialize(frame);
+  SendBuffer(client, BufferedFrameDeserializer::Serialize(frame), fd);
+}
 
+// static
+void HostImpl::SendBuffer(ClientConnection* client,
+                          const std::string& buf,
+                          int fd) {
   // TODO(primiano): this should do non-blocking I/O. But then what if the
   // socket buffer is full? We might want to either drop the request or throttle
   // the send and PostTask the reply later? Right now we are making Send()
@@ -59,6 +59,9 @@ class HostImpl : public Host, public base::UnixSocket::EventListener {
     std::unique_ptr<base::UnixSocket> sock;
     BufferedFrameDeserializer frame_deserializer;
     base::ScopedFile received_fd;
+
+    // Reused across replies to avoid reallocating the frame buffer.
+    std::string send_buf;
   };
   struct ExposedService {
     ExposedService(ServiceID, const std::string&, std::unique_ptr<Service>);
@@ -82,6 +85,7 @@ class HostImpl : public Host, public base::UnixSocket::EventListener {
   const ExposedService* GetServiceByName(const std::string&);
 
   static void SendFrame(ClientConnection*, const Frame&, int fd = -1);
+  static void SendBuffer(ClientConnection*, const std::string& buf, int fd);
 
   base::TaskRunner* const task_runner_;
   std::map<ServiceID, ExposedService> services_;
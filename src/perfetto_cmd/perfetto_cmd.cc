@@ -59,6 +59,10 @@
 namespace perfetto {
 namespace {
 
+// Size of the shared memory ring used to read back the trace from the service,
+// see ConsumerIPCClient::Connect().
+constexpr size_t kReadBuffersShmSize = 8 * 1024 * 1024;
+
 perfetto::PerfettoCmd* g_consumer_cmd;
 
 class LoggingErrorReporter : public ErrorReporter {
@@ -490,8 +494,8 @@ int PerfettoCmd::Main(int argc, char** argv) {
   if (!limiter.ShouldTrace(args))
     return 1;
 
-  consumer_endpoint_ =
-      ConsumerIPCClient::Connect(GetConsumerSocket(), this, &task_runner_);
+  consumer_endpoint_ = ConsumerIPCClient::Connect(
+      GetConsumerSocket(), this, &task_runner_, kReadBuffersShmSize);
   SetupCtrlCSignalHandler();
   task_runner_.Run();
 
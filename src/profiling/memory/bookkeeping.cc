@@ -266,8 +266,9 @@ void DumpState::WriteMap(const Interned<Mapping> map) {
     mapping->set_end(map->end);
     mapping->set_load_bias(map->load_bias);
     mapping->set_build_id(map->build_id.id());
+    auto* path_string_ids = mapping->begin_path_string_ids();
     for (const Interned<std::string>& str : map->path_components)
-      mapping->add_path_string_ids(str.id());
+      path_string_ids->Append(str.id());
   }
 }
 
@@ -330,8 +331,9 @@ void BookkeepingThread::HandleDumpRecord(BookkeepingRecord* rec) {
     ProfilePacket::Callstack* callstack =
         dump_state.current_profile_packet->add_callstacks();
     callstack->set_id(node->id());
+    auto* frame_ids = callstack->begin_frame_ids();
     for (const Interned<Frame>& frame : built_callstack)
-      callstack->add_frame_ids(frame.id());
+      frame_ids->Append(frame.id());
   }
 
   // We cannot garbage collect until we have finished dumping, as the state
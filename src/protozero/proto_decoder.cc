@@ -32,6 +32,38 @@ using namespace proto_utils;
 #error Unimplemented for big endian archs.
 #endif
 
+namespace {
+
+// Returns a pointer past the value of a field of the given |type| starting at
+// |pos|, or nullptr if the value can't be fully skipped.
+inline const uint8_t* SkipValue(ProtoWireType type,
+                                const uint8_t* pos,
+                                const uint8_t* end) {
+  switch (type) {
+    case ProtoWireType::kVarInt:
+      // There is no need to decode the value, just to find its last byte.
+      for (; pos < end; pos++) {
+        if (!(*pos & 0x80))
+          return pos + 1;
+      }
+      return nullptr;
+    case ProtoWireType::kLengthDelimited: {
+      uint64_t length = 0;
+      const uint8_t* new_pos = ParseVarInt(pos, end, &length);
+      if (new_pos == pos || length > static_cast<uint64_t>(end - new_pos))
+        return nullptr;
+      return new_pos + length;
+    }
+    case ProtoWireType::kFixed64:
+      return end - pos >= 8 ? pos + 8 : nullptr;
+    case ProtoWireType::kFixed32:
+      return end - pos >= 4 ? pos + 4 : nullptr;
+  }
+  return nullptr;
+}
+
+}  // namespace
+
 ProtoDecoder::Field ProtoDecoder::ReadField() {
   Field field{};
 
@@ -136,4 +168,63 @@ ProtoDecoder::Field ProtoDecoder::ReadField() {
   return field;
 }
 
+ProtoDecoder::Field ProtoDecoder::FindField(uint32_t field_id) {
+  const uint8_t* const end = buffer_ + length_;
+  const uint8_t* pos = current_position_;
+  while (pos < end) {
+    uint64_t tag = 0;
+    const uint8_t* value_pos = ParseVarInt(pos, end, &tag);
+    const uint32_t id = static_cast<uint32_t>(tag >> 3);
+    if (value_pos == pos || id == 0)
+      break;
+
+    if (id != field_id) {
+      const uint8_t* next =
+          SkipValue(static_cast<ProtoWireType>(tag & 7), value_pos, end);
+      if (!next)
+        break;
+      pos = next;
+      continue;
+    }
+
+    // Only the matching field is fully decoded.
+    Field field;
+    const uint8_t* next = ParseOneField(pos, end, &field);
+    if (!next)
+      break;
+    pos = next;
+    if (PERFETTO_UNLIKELY(field.id == 0))
+      continue;  // Too large to be decoded, skipped.
+    current_position_ = pos;
+    return field;
+  }
+  current_position_ = pos;
+  return Field{};
+}
+
+// static
+const ProtoDecoder::Field TypedProtoDecoderBase::kMissingField{};
+
+void TypedProtoDecoderBase::ParseAllFields() {
+  memset(present_, 0, sizeof(uint64_t) * NumPresenceWords(num_fields_));
+  const uint8_t* const end = buffer_ + length_;
+  const uint8_t* pos = current_position_;
+  Field field;
+  for (;;) {
+    const uint8_t* next = ParseOneField(pos, end, &field);
+    if (!next)
+      break;
+    pos = next;
+
+    // Skip the unknown fields (e.g. emitted by a newer version of the proto).
+    // For the known ones the last occurrence wins, as per the proto semantics.
+    // Repeated fields are re-scanned lazily by RepeatedFieldIterator.
+    if (PERFETTO_LIKELY(field.id != 0 && field.id < num_fields_)) {
+      fields_[field.id] = field;
+      present_[field.id / 64] |= static_cast<uint64_t>(1) << (field.id % 64);
+    }
+  }
+  current_position_ = pos;
+}
+
 }  // namespace protozero
@@ -0,0 +1,275 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+
+#include "perfetto/protozero/proto_decoder.h"
+#include "perfetto/protozero/proto_utils.h"
+
+#include "perfetto/trace/trace.pb.h"
+#include "perfetto/trace/trace_packet.pb.h"
+
+namespace {
+
+using protozero::ProtoDecoder;
+using protozero::proto_utils::ProtoWireType;
+
+// Field numbers of the messages walked below.
+constexpr uint32_t kPacketFieldNumber = 1;             // Trace
+constexpr uint32_t kFtraceEventsFieldNumber = 1;       // TracePacket
+constexpr uint32_t kSequenceIdFieldNumber = 10;        // TracePacket
+constexpr uint32_t kEventFieldNumber = 2;              // FtraceEventBundle
+constexpr uint32_t kFirstEventPayloadFieldNumber = 3;  // FtraceEvent
+
+// Builds a trace that looks like the ones produced by traced_probes: packets
+// each containing a bundle of sched and print ftrace events.
+std::string MakeTrace() {
+  perfetto::protos::Trace trace;
+  uint64_t timestamp = 1234567890123ull;
+  for (int i = 0; i < 64; i++) {
+    auto* packet = trace.add_packet();
+    packet->set_trusted_uid(9999);
+    packet->set_trusted_packet_sequence_id(static_cast<uint32_t>(i % 4 + 1));
+    auto* bundle = packet->mutable_ftrace_events();
+    bundle->set_cpu(static_cast<uint32_t>(i % 8));
+    for (int j = 0; j < 100; j++) {
+      auto* event = bundle->add_event();
+      event->set_timestamp(timestamp += 2345);
+      event->set_pid(static_cast<uint32_t>(1000 + j));
+      if (j % 10 == 0) {
+        auto* print = event->mutable_print();
+        print->set_ip(0xffffff8000001234ull);
+        print->set_buf("B|1234|RenderThread::draw\n");
+      } else if (j % 2 == 0) {
+        auto* wakeup = event->mutable_sched_wakeup();
+        wakeup->set_comm("kworker/u16:3");
+        wakeup->set_pid(1000 + j);
+        wakeup->set_prio(120);
+        wakeup->set_success(1);
+        wakeup->set_target_cpu(i % 8);
+      } else {
+        auto* sched_switch = event->mutable_sched_switch();
+        sched_switch->set_prev_comm("surfaceflinger");
+        sched_switch->set_prev_pid(1000 + j);
+        sched_switch->set_prev_prio(120);
+        sched_switch->set_prev_state(1);
+        sched_switch->set_next_comm("RenderThread");
+        sched_switch->set_next_pid(2000 + j);
+        sched_switch->set_next_prio(110);
+      }
+    }
+  }
+  return trace.SerializeAsString();
+}
+
+const uint8_t* Data(const std::string& str) {
+  return reinterpret_cast<const uint8_t*>(str.data());
+}
+
+// Sums all the integer fields of a message, to prevent the compiler from
+// optimizing the decoding away.
+uint64_t SumIntFields(const uint8_t* data, size_t size) {
+  uint64_t sum = 0;
+  ProtoDecoder decoder(data, size);
+  for (auto fld = decoder.ReadField(); fld.valid(); fld = decoder.ReadField()) {
+    if (fld.type != ProtoWireType::kLengthDelimited)
+      sum += fld.int_value;
+  }
+  return sum;
+}
+
+// Decodes every field of every ftrace event in the trace.
+uint64_t DecodeTrace(const std::string& trace) {
+  uint64_t sum = 0;
+  ProtoDecoder trace_dec(Data(trace), trace.size());
+  for (auto pkt = trace_dec.ReadField(); pkt.valid();
+       pkt = trace_dec.ReadField()) {
+    if (pkt.id != kPacketFieldNumber)
+      continue;
+    ProtoDecoder pkt_dec(pkt.data(), pkt.size());
+    for (auto bundle = pkt_dec.ReadField(); bundle.valid();
+         bundle = pkt_dec.ReadField()) {
+      if (bundle.id != kFtraceEventsFieldNumber)
+        continue;
+      ProtoDecoder bundle_dec(bundle.data(), bundle.size());
+      for (auto evt = bundle_dec.ReadField(); evt.valid();
+           evt = bundle_dec.ReadField()) {
+        if (evt.id != kEventFieldNumber)
+          continue;
+        ProtoDecoder evt_dec(evt.data(), evt.size());
+        for (auto fld = evt_dec.ReadField(); fld.valid();
+             fld = evt_dec.ReadField()) {
+          if (fld.id >= kFirstEventPayloadFieldNumber) {
+            sum += SumIntFields(fld.data(), fld.size());
+          } else {
+            sum += fld.int_value;
+          }
+        }
+      }
+    }
+  }
+  return sum;
+}
+
+enum class Lookup { kReadField, kFindField };
+
+// Looks up a field that is serialized after the (large) ftrace bundle in each
+// packet of the trace.
+uint64_t LookupSequenceIds(Lookup lookup, const std::string& trace) {
+  uint64_t sum = 0;
+  ProtoDecoder trace_dec(Data(trace), trace.size());
+  for (auto pkt = trace_dec.ReadField(); pkt.valid();
+       pkt = trace_dec.ReadField()) {
+    ProtoDecoder pkt_dec(pkt.data(), pkt.size());
+    if (lookup == Lookup::kFindField) {
+      sum += pkt_dec.FindField(kSequenceIdFieldNumber).int_value;
+      continue;
+    }
+    for (auto fld = pkt_dec.ReadField(); fld.valid();
+         fld = pkt_dec.ReadField()) {
+      if (fld.id == kSequenceIdFieldNumber) {
+        sum += fld.int_value;
+        break;
+      }
+    }
+  }
+  return sum;
+}
+
+// The byte-at-a-time varint decoder, for comparison with
+// proto_utils::ParseVarInt().
+const uint8_t* ParseVarIntSimple(const uint8_t* start,
+                                 const uint8_t* end,
+                                 uint64_t* value) {
+  const uint8_t* pos = start;
+  uint64_t shift = 0;
+  *value = 0;
+  do {
+    if (pos >= end || shift >= 64) {
+      *value = 0;
+      return start;
+    }
+    *value |= static_cast<uint64_t>(*pos & 0x7f) << shift;
+    shift += 7;
+  } while (*pos++ & 0x80);
+  return pos;
+}
+
+enum class VarIntParser { kSimple, kProtoUtils };
+
+// Returns a buffer of 1024 varints each encoded in |num_bytes| bytes.
+std::vector<uint8_t> MakeVarInts(int num_bytes) {
+  using protozero::proto_utils::kMaxVarIntEncodedSize;
+  std::vector<uint8_t> buf(1024 * kMaxVarIntEncodedSize);
+  uint8_t* wptr = buf.data();
+  const uint64_t value =
+      num_bytes >= 10 ? ~0ull : (1ull << (7 * num_bytes - 1));
+  for (int i = 0; i < 1024; i++)
+    wptr = protozero::proto_utils::WriteVarInt(value, wptr);
+  buf.resize(static_cast<size_t>(wptr - buf.data()));
+  return buf;
+}
+
+template <VarIntParser parser>
+void BM_ProtoDecoderParseVarInt(benchmark::State& state) {
+  std::vector<uint8_t> buf = MakeVarInts(static_cast<int>(state.range(0)));
+  const uint8_t* const end = buf.data() + buf.size();
+  while (state.KeepRunning()) {
+    uint64_t sum = 0;
+    uint64_t value = 0;
+    for (const uint8_t* pos = buf.data(); pos < end;) {
+      pos = parser == VarIntParser::kSimple
+                ? ParseVarIntSimple(pos, end, &value)
+                : protozero::proto_utils::ParseVarInt(pos, end, &value);
+      sum += value;
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(buf.size()));
+}
+
+void BM_ProtoDecoderDecodeTrace(benchmark::State& state) {
+  std::string trace = MakeTrace();
+  while (state.KeepRunning())
+    benchmark::DoNotOptimize(DecodeTrace(trace));
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(trace.size()));
+}
+
+template <Lookup lookup>
+void BM_ProtoDecoderLookupField(benchmark::State& state) {
+  std::string trace = MakeTrace();
+  while (state.KeepRunning())
+    benchmark::DoNotOptimize(LookupSequenceIds(lookup, trace));
+}
+
+enum class PackedDecoding { kIterator, kBulk };
+
+template <PackedDecoding decoding>
+void BM_ProtoDecoderPackedVarInts(benchmark::State& state) {
+  // Small values (1-2 bytes each), e.g. counter ids or deltas.
+  std::vector<uint8_t> buf(4096 * 2);
+  uint8_t* wptr = buf.data();
+  for (uint32_t i = 0; i < 4096; i++)
+    wptr = protozero::proto_utils::WriteVarInt(i % 200, wptr);
+  buf.resize(static_cast<size_t>(wptr - buf.data()));
+  const uint8_t* const end = buf.data() + buf.size();
+
+  uint32_t values[256];
+  while (state.KeepRunning()) {
+    uint64_t sum = 0;
+    if (decoding == PackedDecoding::kIterator) {
+      bool parse_error = false;
+      protozero::PackedRepeatedFieldIterator<ProtoWireType::kVarInt, uint32_t>
+          it(buf.data(), buf.size(), &parse_error);
+      for (; it; ++it)
+        sum += *it;
+    } else {
+      size_t num_values = 0;
+      for (const uint8_t* pos = buf.data(); pos < end;) {
+        pos = protozero::DecodePackedRepeated<ProtoWireType::kVarInt>(
+            pos, end, values, 256, &num_values);
+        for (size_t i = 0; i < num_values; i++)
+          sum += values[i];
+      }
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(buf.size()));
+}
+
+}  // namespace
+
+BENCHMARK_TEMPLATE(BM_ProtoDecoderParseVarInt, VarIntParser::kSimple)
+    ->Arg(1)
+    ->Arg(2)
+    ->Arg(5)
+    ->Arg(10);
+BENCHMARK_TEMPLATE(BM_ProtoDecoderParseVarInt, VarIntParser::kProtoUtils)
+    ->Arg(1)
+    ->Arg(2)
+    ->Arg(5)
+    ->Arg(10);
+BENCHMARK(BM_ProtoDecoderDecodeTrace);
+BENCHMARK_TEMPLATE(BM_ProtoDecoderLookupField, Lookup::kReadField);
+BENCHMARK_TEMPLATE(BM_ProtoDecoderLookupField, Lookup::kFindField);
+BENCHMARK_TEMPLATE(BM_ProtoDecoderPackedVarInts, PackedDecoding::kIterator);
+BENCHMARK_TEMPLATE(BM_ProtoDecoderPackedVarInts, PackedDecoding::kBulk);
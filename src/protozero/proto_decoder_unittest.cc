@@ -16,6 +16,9 @@
 
 #include "perfetto/protozero/proto_decoder.h"
 
+#include <string>
+#include <vector>
+
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "perfetto/base/utils.h"
@@ -126,5 +129,242 @@ TEST(ProtoDecoder, FixedData) {
   }
 }
 
+// Serializes the fields appended by |fill| into a contiguous buffer.
+template <typename F>
+std::vector<uint8_t> Encode(F fill) {
+  Message message;
+  ScatteredHeapBuffer delegate(4096, 4096);
+  ScatteredStreamWriter writer(&delegate);
+  delegate.set_writer(&writer);
+  message.Reset(&writer);
+  fill(&message);
+  delegate.AdjustUsedSizeOfCurrentSlice();
+  std::vector<uint8_t> buf;
+  for (const auto& slice : delegate.slices()) {
+    auto used_range = slice.GetUsedRange();
+    buf.insert(buf.end(), used_range.begin, used_range.end);
+  }
+  return buf;
+}
+
+TEST(ProtoDecoder, TypedDecoderSimpleFields) {
+  std::vector<uint8_t> buf = Encode([](Message* msg) {
+    msg->AppendVarInt(1, 42);
+    msg->AppendString(2, "foo");
+    msg->AppendSignedVarInt(3, -7);
+    msg->AppendFixed(4, 1.5f);
+    msg->AppendVarInt(100, 1);  // Unknown field, ignored.
+    msg->AppendVarInt(1, 43);   // Last one wins.
+  });
+
+  TypedProtoDecoder</*MAX_FIELD_ID=*/5> dec(buf.data(), buf.size());
+  EXPECT_TRUE(dec.at<1>().valid());
+  EXPECT_EQ(43u, dec.at<1>().as_uint32());
+  EXPECT_EQ("foo", dec.at<2>().as_string().ToStdString());
+  EXPECT_EQ(-7, dec.at<3>().as_sint32());
+  EXPECT_EQ(1.5f, dec.at<4>().as_float());
+  EXPECT_EQ(3u, dec.Get(2).size());
+
+  // Absent and out of range fields are invalid and read as zero.
+  EXPECT_FALSE(dec.at<5>().valid());
+  EXPECT_EQ(0, dec.at<5>().as_int64());
+  EXPECT_EQ("", dec.at<5>().as_string().ToStdString());
+  EXPECT_FALSE(dec.Get(100).valid());
+}
+
+TEST(ProtoDecoder, TypedDecoderHighFieldIds) {
+  std::vector<uint8_t> buf = Encode([](Message* msg) {
+    msg->AppendVarInt(63, 1);
+    msg->AppendVarInt(64, 2);
+    msg->AppendVarInt(130, 3);
+  });
+
+  TypedProtoDecoder</*MAX_FIELD_ID=*/130> dec(buf.data(), buf.size());
+  EXPECT_EQ(1u, dec.at<63>().as_uint32());
+  EXPECT_EQ(2u, dec.at<64>().as_uint32());
+  EXPECT_EQ(3u, dec.Get(130).as_uint32());
+  EXPECT_FALSE(dec.at<65>().valid());
+  EXPECT_FALSE(dec.Get(129).valid());
+  EXPECT_FALSE(dec.Get(131).valid());
+}
+
+TEST(ProtoDecoder, TypedDecoderRepeatedFields) {
+  const int kNumValues = 200;
+  std::vector<uint8_t> buf = Encode([](Message* msg) {
+    msg->AppendVarInt(1, 1);
+    for (int i = 0; i < kNumValues; i++) {
+      msg->AppendVarInt(2, i);
+      msg->AppendString(3, std::to_string(i).c_str());
+    }
+    msg->AppendVarInt(4, 4);
+  });
+
+  TypedProtoDecoder</*MAX_FIELD_ID=*/4> dec(buf.data(), buf.size());
+  EXPECT_EQ(1, dec.at<1>().as_int32());
+  EXPECT_EQ(4, dec.at<4>().as_int32());
+  EXPECT_EQ(kNumValues - 1, dec.at<2>().as_int32());
+
+  int num_ints = 0;
+  for (auto it = dec.GetRepeated(2); it; ++it)
+    EXPECT_EQ(num_ints++, it->as_int32());
+  EXPECT_EQ(kNumValues, num_ints);
+
+  int num_strings = 0;
+  for (auto it = dec.GetRepeated(3); it; ++it)
+    EXPECT_EQ(std::to_string(num_strings++), it->as_string().ToStdString());
+  EXPECT_EQ(kNumValues, num_strings);
+
+  // A non-repeated field is visited once.
+  int num_visits = 0;
+  for (auto it = dec.GetRepeated(1); it; ++it)
+    num_visits++;
+  EXPECT_EQ(1, num_visits);
+}
+
+TEST(ProtoDecoder, TypedDecoderPackedFields) {
+  uint8_t varints[16];
+  uint8_t* wptr = varints;
+  wptr = WriteVarInt(1, wptr);
+  wptr = WriteVarInt(300, wptr);
+  wptr = WriteVarInt(int64_t{-1}, wptr);
+  const size_t varints_size = static_cast<size_t>(wptr - varints);
+  const uint32_t fixed[] = {1, 0xffffffff};
+
+  std::vector<uint8_t> buf = Encode([&](Message* msg) {
+    msg->AppendBytes(1, varints, varints_size);
+    msg->AppendBytes(2, fixed, sizeof(fixed));
+    msg->AppendBytes(3, varints, varints_size - 1);  // Truncated.
+  });
+  TypedProtoDecoder</*MAX_FIELD_ID=*/4> dec(buf.data(), buf.size());
+
+  bool parse_error = false;
+  std::vector<int64_t> values;
+  for (auto it = dec.GetPackedRepeated<ProtoWireType::kVarInt, int64_t>(
+           1, &parse_error);
+       it; ++it) {
+    values.push_back(*it);
+  }
+  EXPECT_THAT(values, ::testing::ElementsAre(1, 300, -1));
+  EXPECT_FALSE(parse_error);
+
+  std::vector<uint32_t> fixed_values;
+  for (auto it = dec.GetPackedRepeated<ProtoWireType::kFixed32, uint32_t>(
+           2, &parse_error);
+       it; ++it) {
+    fixed_values.push_back(*it);
+  }
+  EXPECT_THAT(fixed_values, ::testing::ElementsAre(1u, 0xffffffffu));
+  EXPECT_FALSE(parse_error);
+
+  values.clear();
+  for (auto it = dec.GetPackedRepeated<ProtoWireType::kVarInt, int64_t>(
+           3, &parse_error);
+       it; ++it) {
+    values.push_back(*it);
+  }
+  EXPECT_THAT(values, ::testing::ElementsAre(1, 300));
+  EXPECT_TRUE(parse_error);
+
+  // An absent packed field is empty.
+  parse_error = false;
+  EXPECT_FALSE((dec.GetPackedRepeated<ProtoWireType::kVarInt, int64_t>(
+      4, &parse_error)));
+  EXPECT_FALSE(parse_error);
+}
+
+TEST(ProtoDecoder, FindField) {
+  uint8_t payload[] = {0x11, 0x22};
+  std::vector<uint8_t> buf = Encode([&](Message* msg) {
+    msg->AppendVarInt(1, 0xffffffffffull);
+    msg->AppendBytes(2, payload, sizeof(payload));
+    msg->AppendFixed(3, uint64_t{42});
+    msg->AppendFixed(4, uint32_t{43});
+    msg->AppendVarInt(5, 1);
+    msg->AppendVarInt(4, 2);
+  });
+
+  ProtoDecoder decoder(buf.data(), buf.size());
+  ProtoDecoder::Field field = decoder.FindField(5);
+  ASSERT_TRUE(field.valid());
+  EXPECT_EQ(1u, field.as_uint32());
+
+  // The search continues from the last match.
+  field = decoder.FindField(4);
+  ASSERT_TRUE(field.valid());
+  EXPECT_EQ(ProtoWireType::kVarInt, field.type);
+  EXPECT_EQ(2u, field.as_uint32());
+  EXPECT_TRUE(decoder.IsEndOfBuffer());
+
+  EXPECT_FALSE(decoder.FindField(1).valid());
+  decoder.Reset();
+  EXPECT_FALSE(decoder.FindField(6).valid());
+  EXPECT_TRUE(decoder.IsEndOfBuffer());
+
+  decoder.Reset();
+  field = decoder.FindField(2);
+  ASSERT_TRUE(field.valid());
+  EXPECT_EQ(sizeof(payload), field.size());
+  EXPECT_EQ(0x22, field.data()[1]);
+
+  uint64_t int_value = 0;
+  EXPECT_TRUE(decoder.FindIntField<3>(&int_value));
+  EXPECT_EQ(42u, int_value);
+  EXPECT_EQ(0u, decoder.offset());
+
+  // A truncated field stops the search, the decoder is left before it.
+  ProtoDecoder truncated(buf.data(), buf.size() - 1);
+  EXPECT_FALSE(truncated.FindField(6).valid());
+  EXPECT_EQ(buf.size() - 2, truncated.offset());
+}
+
+TEST(ProtoDecoder, DecodePackedRepeated) {
+  uint8_t varints[32];
+  uint8_t* wptr = varints;
+  wptr = WriteVarInt(1, wptr);
+  wptr = WriteVarInt(300, wptr);
+  wptr = WriteVarInt(int64_t{-1}, wptr);
+  wptr = WriteVarInt(5, wptr);
+  const uint8_t* varints_end = wptr;
+
+  int64_t values[8];
+  size_t num_values = 0;
+  const uint8_t* pos = DecodePackedRepeated<ProtoWireType::kVarInt>(
+      varints, varints_end, values, 8, &num_values);
+  EXPECT_EQ(varints_end, pos);
+  EXPECT_THAT(std::vector<int64_t>(values, values + num_values),
+              ::testing::ElementsAre(1, 300, -1, 5));
+
+  // Decoding in chunks.
+  pos = DecodePackedRepeated<ProtoWireType::kVarInt>(varints, varints_end,
+                                                     values, 3, &num_values);
+  EXPECT_EQ(3u, num_values);
+  pos = DecodePackedRepeated<ProtoWireType::kVarInt>(pos, varints_end, values,
+                                                     3, &num_values);
+  EXPECT_EQ(varints_end, pos);
+  ASSERT_EQ(1u, num_values);
+  EXPECT_EQ(5, values[0]);
+
+  // Truncated payload.
+  pos = DecodePackedRepeated<ProtoWireType::kVarInt>(
+      varints, varints + 2, values, 8, &num_values);
+  EXPECT_EQ(1u, num_values);
+  EXPECT_NE(varints + 2, pos);
+
+  const uint32_t fixed[] = {1, 2, 0xffffffff};
+  const uint8_t* fixed_begin = reinterpret_cast<const uint8_t*>(fixed);
+  const uint8_t* fixed_end = fixed_begin + sizeof(fixed);
+  uint32_t fixed_values[8];
+  pos = DecodePackedRepeated<ProtoWireType::kFixed32>(
+      fixed_begin, fixed_end, fixed_values, 8, &num_values);
+  EXPECT_EQ(fixed_end, pos);
+  EXPECT_THAT(std::vector<uint32_t>(fixed_values, fixed_values + num_values),
+              ::testing::ElementsAre(1u, 2u, 0xffffffffu));
+
+  pos = DecodePackedRepeated<ProtoWireType::kFixed32>(
+      fixed_begin, fixed_end - 1, fixed_values, 8, &num_values);
+  EXPECT_EQ(2u, num_values);
+  EXPECT_NE(fixed_end - 1, pos);
+}
+
 }  // namespace
 }  // namespace protozero
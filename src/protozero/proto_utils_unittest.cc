@@ -105,6 +105,19 @@ TEST(ProtoUtilsTest, ZigZagEncoding) {
             ZigZagEncode(std::numeric_limits<int64_t>::min()));
 }
 
+TEST(ProtoUtilsTest, ZigZagDecoding) {
+  EXPECT_EQ(0, ZigZagDecode(0u));
+  EXPECT_EQ(-1, ZigZagDecode(1u));
+  EXPECT_EQ(1, ZigZagDecode(2u));
+  EXPECT_EQ(-2, ZigZagDecode(3u));
+  EXPECT_EQ(-2147483647, ZigZagDecode(4294967293u));
+  EXPECT_EQ(2147483647, ZigZagDecode(4294967294u));
+  EXPECT_EQ(std::numeric_limits<int32_t>::min(),
+            ZigZagDecode(std::numeric_limits<uint32_t>::max()));
+  EXPECT_EQ(std::numeric_limits<int64_t>::min(),
+            ZigZagDecode(std::numeric_limits<uint64_t>::max()));
+}
+
 TEST(ProtoUtilsTest, VarIntEncoding) {
   for (size_t i = 0; i < ArraySize(kVarIntExpectations); ++i) {
     const VarIntExpectation& exp = kVarIntExpectations[i];
@@ -196,6 +209,18 @@ TEST(ProtoUtilsTest, VarIntDecodingOutOfBounds) {
   }
 }
 
+TEST(ProtoUtilsTest, VarIntDecodingTooLong) {
+  // 11 bytes, longer than the longest valid varint.
+  uint8_t buf[] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+                   0xff, 0xff, 0xff, 0xff, 0x01, 0x00};
+  for (size_t size = 11; size <= sizeof(buf); size++) {
+    uint64_t value = static_cast<uint64_t>(-1);
+    const uint8_t* res = ParseVarInt(buf, buf + size, &value);
+    EXPECT_EQ(&buf[0], res);
+    EXPECT_EQ(0u, value);
+  }
+}
+
 }  // namespace
 }  // namespace proto_utils
 }  // namespace protozero
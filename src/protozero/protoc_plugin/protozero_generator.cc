@@ -16,15 +16,18 @@
 
 #include "src/protozero/protoc_plugin/protozero_generator.h"
 
+#include <algorithm>
 #include <map>
 #include <memory>
 #include <set>
 #include <string>
+#include <utility>
 
 #include "google/protobuf/descriptor.h"
 #include "google/protobuf/io/printer.h"
 #include "google/protobuf/io/zero_copy_stream.h"
 #include "google/protobuf/stubs/strutil.h"
+#include "perfetto/protozero/proto_decoder.h"
 
 namespace protozero {
 
@@ -88,8 +91,10 @@ class GeneratorJob {
     GeneratePrologue();
     for (const EnumDescriptor* enumeration : enums_)
       GenerateEnumDescriptor(enumeration);
-    for (const Descriptor* message : messages_)
+    for (const Descriptor* message : messages_) {
+      GenerateDecoder(message);
       GenerateMessageDescriptor(message);
+    }
     GenerateEpilogue();
     return error_.empty();
   }
@@ -274,8 +279,10 @@ class GeneratorJob {
         "#include <stddef.h>\n"
         "#include <stdint.h>\n\n"
         "#include \"perfetto/base/export.h\"\n"
-        "#include \"perfetto/protozero/proto_field_descriptor.h\"\n"
-        "#include \"perfetto/protozero/message.h\"\n",
+        "#include \"perfetto/protozero/message.h\"\n"
+        "#include \"perfetto/protozero/packed_repeated_fields.h\"\n"
+        "#include \"perfetto/protozero/proto_decoder.h\"\n"
+        "#include \"perfetto/protozero/proto_field_descriptor.h\"\n",
         "greeting", greeting, "guard", guard);
 
     // Print includes for public imports.
@@ -459,6 +466,26 @@ class GeneratorJob {
         action, "inner_class", inner_class);
   }
 
+  void GeneratePackedFieldDescriptor(const FieldDescriptor* field) {
+    std::map<std::string, std::string> setter;
+    setter["id"] = std::to_string(field->number());
+    setter["name"] = field->name();
+    setter["cpp_type"] = GetDecoderType(field).first;
+    setter["wire_type"] = GetPackedWireType(field);
+    stub_h_->Print(
+        setter,
+        "::protozero::PackedRepeatedFieldWriter<"
+        "::protozero::proto_utils::ProtoWireType::$wire_type$, $cpp_type$>* "
+        "begin_$name$() {\n"
+        "  return BeginNestedMessage<::protozero::PackedRepeatedFieldWriter<"
+        "::protozero::proto_utils::ProtoWireType::$wire_type$, $cpp_type$>>"
+        "($id$);\n"
+        "}\n"
+        "void set_$name$(const $cpp_type$* values, size_t count) {\n"
+        "  begin_$name$()->Append(values, count);\n"
+        "}\n");
+  }
+
   void GenerateReflectionForMessageFields(const Descriptor* message) {
     const bool has_fields = (message->field_count() > 0);
 
@@ -519,6 +546,134 @@ class GeneratorJob {
     stub_h_->Print("}\n\n");
   }
 
+  // Fields with an id > kMaxDecoderFieldId (e.g. the ones reserved for
+  // testing) get no accessors in the decoder, to keep its field table small.
+  // They can still be read with a plain ProtoDecoder.
+  static bool HasDecoderAccessors(const FieldDescriptor* field) {
+    return field->number() <= static_cast<int>(kMaxDecoderFieldId);
+  }
+
+  // Returns the C++ type and the ProtoDecoder::Field accessor used to read the
+  // |field| in the generated decoder.
+  std::pair<std::string, std::string> GetDecoderType(
+      const FieldDescriptor* field) {
+    switch (field->type()) {
+      case FieldDescriptor::TYPE_BOOL:
+        return {"bool", "as_bool"};
+      case FieldDescriptor::TYPE_INT32:
+      case FieldDescriptor::TYPE_SFIXED32:
+      case FieldDescriptor::TYPE_ENUM:
+        return {"int32_t", "as_int32"};
+      case FieldDescriptor::TYPE_UINT32:
+      case FieldDescriptor::TYPE_FIXED32:
+        return {"uint32_t", "as_uint32"};
+      case FieldDescriptor::TYPE_INT64:
+      case FieldDescriptor::TYPE_SFIXED64:
+        return {"int64_t", "as_int64"};
+      case FieldDescriptor::TYPE_UINT64:
+      case FieldDescriptor::TYPE_FIXED64:
+        return {"uint64_t", "as_uint64"};
+      case FieldDescriptor::TYPE_SINT32:
+        return {"int32_t", "as_sint32"};
+      case FieldDescriptor::TYPE_SINT64:
+        return {"int64_t", "as_sint64"};
+      case FieldDescriptor::TYPE_FLOAT:
+        return {"float", "as_float"};
+      case FieldDescriptor::TYPE_DOUBLE:
+        return {"double", "as_double"};
+      case FieldDescriptor::TYPE_STRING:
+        return {"::perfetto::base::StringView", "as_string"};
+      case FieldDescriptor::TYPE_BYTES:
+      case FieldDescriptor::TYPE_MESSAGE:
+        return {"::protozero::ConstBytes", "as_bytes"};
+      case FieldDescriptor::TYPE_GROUP:
+        break;
+    }
+    Abort("Unsupported field type.");
+    return {"", ""};
+  }
+
+  // The wire type of each value of a packed repeated |field|.
+  std::string GetPackedWireType(const FieldDescriptor* field) {
+    switch (field->type()) {
+      case FieldDescriptor::TYPE_FIXED32:
+      case FieldDescriptor::TYPE_SFIXED32:
+      case FieldDescriptor::TYPE_FLOAT:
+        return "kFixed32";
+      case FieldDescriptor::TYPE_FIXED64:
+      case FieldDescriptor::TYPE_SFIXED64:
+      case FieldDescriptor::TYPE_DOUBLE:
+        return "kFixed64";
+      case FieldDescriptor::TYPE_SINT32:
+      case FieldDescriptor::TYPE_SINT64:
+        Abort("Packed zigzag-encoded fields are not supported.");
+        return "";
+      default:
+        return "kVarInt";
+    }
+  }
+
+  void GenerateDecoder(const Descriptor* message) {
+    int max_field_id = 0;
+    for (int i = 0; i < message->field_count(); ++i) {
+      const FieldDescriptor* field = message->field(i);
+      if (!HasDecoderAccessors(field))
+        continue;
+      max_field_id = std::max(max_field_id, field->number());
+    }
+
+    std::string class_name = GetCppClassName(message) + "_Decoder";
+    stub_h_->Print(
+        "class $name$ : public "
+        "::protozero::TypedProtoDecoder</*MAX_FIELD_ID=*/$max$> {\n"
+        " public:\n",
+        "name", class_name, "max", std::to_string(max_field_id));
+    stub_h_->Indent();
+    stub_h_->Print(
+        "$name$(const uint8_t* data, size_t len) "
+        ": TypedProtoDecoder(data, len) {}\n"
+        "explicit $name$(const ::protozero::ConstBytes& raw) "
+        ": TypedProtoDecoder(raw.data, raw.size) {}\n",
+        "name", class_name);
+
+    for (int i = 0; i < message->field_count(); ++i) {
+      const FieldDescriptor* field = message->field(i);
+      if (!HasDecoderAccessors(field))
+        continue;
+      std::pair<std::string, std::string> type = GetDecoderType(field);
+      std::map<std::string, std::string> getter;
+      getter["id"] = std::to_string(field->number());
+      getter["name"] = field->name();
+      getter["cpp_type"] = type.first;
+      getter["accessor"] = type.second;
+
+      stub_h_->Print(getter,
+                     "bool has_$name$() const { "
+                     "return at<$id$>().valid(); }\n");
+      if (field->is_packed()) {
+        getter["wire_type"] = GetPackedWireType(field);
+        stub_h_->Print(
+            getter,
+            "::protozero::PackedRepeatedFieldIterator<"
+            "::protozero::proto_utils::ProtoWireType::$wire_type$, "
+            "$cpp_type$> $name$(bool* parse_error) const { "
+            "return GetPackedRepeated<"
+            "::protozero::proto_utils::ProtoWireType::$wire_type$, "
+            "$cpp_type$>($id$, parse_error); }\n");
+      } else if (field->is_repeated()) {
+        stub_h_->Print(getter,
+                       "::protozero::RepeatedFieldIterator $name$() const { "
+                       "return GetRepeated($id$); }\n");
+      } else {
+        stub_h_->Print(getter,
+                       "$cpp_type$ $name$() const { "
+                       "return at<$id$>().$accessor$(); }\n");
+      }
+    }
+    stub_h_->Outdent();
+    stub_h_->Print("};\n\n");
+  }
+
   void GenerateMessageDescriptor(const Descriptor* message) {
     stub_h_->Print(
         "class PERFETTO_EXPORT $name$ : public ::protozero::Message {\n"
@@ -526,6 +681,8 @@ class GeneratorJob {
         "name", GetCppClassName(message));
     stub_h_->Indent();
 
+    stub_h_->Print("using Decoder = $name$_Decoder;\n", "name",
+                   GetCppClassName(message));
     GenerateReflectionForMessageFields(message);
 
     // Using statements for nested messages.
@@ -561,10 +718,8 @@ class GeneratorJob {
     for (int i = 0; i < message->field_count(); ++i) {
       const FieldDescriptor* field = message->field(i);
       if (field->is_packed()) {
-        Abort("Packed repeated fields are not supported.");
-        return;
-      }
-      if (field->type() != FieldDescriptor::TYPE_MESSAGE) {
+        GeneratePackedFieldDescriptor(field);
+      } else if (field->type() != FieldDescriptor::TYPE_MESSAGE) {
         GenerateSimpleFieldDescriptor(field);
       } else {
         GenerateNestedMessageFieldDescriptor(field);
@@ -157,6 +157,64 @@ TEST_F(ProtoZeroConformanceTest, NestedMessages) {
   EXPECT_EQ(1000, gold_msg_a.super_nested().value_c());
 }
 
+TEST_F(ProtoZeroConformanceTest, PackedRepeatedFields) {
+  auto* msg = CreateMessage<pbtest::PackedRepeatedFields>();
+
+  // Enough values to span several chunks.
+  std::vector<int32_t> int32_values;
+  for (int32_t i = 0; i < 100; i++)
+    int32_values.push_back(i * 1000 - 5000);
+  msg->set_field_int32(int32_values.data(), int32_values.size());
+
+  auto* uint64_writer = msg->begin_field_uint64();
+  for (uint64_t i = 0; i < 30; i++)
+    uint64_writer->Append(i << (2 * i));
+
+  const uint32_t fixed32_values[] = {1, 0xffffffff, 42};
+  msg->set_field_fixed32(fixed32_values, 3);
+
+  auto* double_writer = msg->begin_field_double();
+  double_writer->Append(0.5);
+  double_writer->Append(-1e10);
+
+  // An empty packed field is valid and decodes as no values.
+  msg->begin_small_enum();
+  msg->Finalize();
+
+  size_t msg_size = GetNumSerializedBytes();
+  EXPECT_GT(msg_size, 2 * kChunkSize);
+  std::unique_ptr<uint8_t[]> msg_binary(new uint8_t[msg_size]);
+  GetSerializedBytes(0, msg_size, msg_binary.get());
+
+  pbgold::PackedRepeatedFields gold_msg;
+  ASSERT_TRUE(
+      gold_msg.ParseFromArray(msg_binary.get(), static_cast<int>(msg_size)));
+  ASSERT_EQ(100, gold_msg.field_int32_size());
+  for (int i = 0; i < 100; i++)
+    EXPECT_EQ(int32_values[static_cast<size_t>(i)], gold_msg.field_int32(i));
+  ASSERT_EQ(30, gold_msg.field_uint64_size());
+  for (int i = 0; i < 30; i++)
+    EXPECT_EQ(static_cast<uint64_t>(i) << (2 * i), gold_msg.field_uint64(i));
+  ASSERT_EQ(3, gold_msg.field_fixed32_size());
+  EXPECT_EQ(0xffffffffu, gold_msg.field_fixed32(1));
+  ASSERT_EQ(2, gold_msg.field_double_size());
+  EXPECT_DOUBLE_EQ(-1e10, gold_msg.field_double(1));
+  EXPECT_EQ(0, gold_msg.small_enum_size());
+
+  // The generated decoder reads them back too.
+  pbtest::PackedRepeatedFields::Decoder decoder(msg_binary.get(), msg_size);
+  bool parse_error = false;
+  size_t num_values = 0;
+  for (auto it = decoder.field_int32(&parse_error); it; ++it)
+    EXPECT_EQ(int32_values[num_values++], *it);
+  EXPECT_EQ(100u, num_values);
+  num_values = 0;
+  for (auto it = decoder.field_fixed32(&parse_error); it; ++it)
+    EXPECT_EQ(fixed32_values[num_values++], *it);
+  EXPECT_EQ(3u, num_values);
+  EXPECT_FALSE(parse_error);
+}
+
 TEST(ProtoZeroTest, Simple) {
   // Test the includes for indirect public import: library.pbzero.h ->
   // library_internals/galaxies.pbzero.h -> upper_import.pbzero.h .
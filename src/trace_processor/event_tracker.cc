@@ -54,6 +54,24 @@ void EventTracker::PushSchedSwitch(uint32_t cpu,
                                    uint32_t next_pid,
                                    base::StringView next_comm,
                                    int32_t next_prio) {
+  // We have to intern prev_comm again because our assumption that
+  // this event's |prev_comm| == previous event's |next_comm| does not hold
+  // if the thread changed its name while scheduled.
+  StringId prev_comm_id = context_->storage->InternString(prev_comm);
+  StringId next_comm_id = context_->storage->InternString(next_comm);
+  PushSchedSwitchInterned(cpu, ts, prev_pid, prev_comm_id, prev_prio,
+                          prev_state, next_pid, next_comm_id, next_prio);
+}
+
+void EventTracker::PushSchedSwitchInterned(uint32_t cpu,
+                                           int64_t ts,
+                                           uint32_t prev_pid,
+                                           StringId prev_comm_id,
+                                           int32_t prev_prio,
+                                           int64_t prev_state,
+                                           uint32_t next_pid,
+                                           StringId next_comm_id,
+                                           int32_t next_prio) {
   // At this stage all events should be globally timestamp ordered.
   if (ts < prev_timestamp_) {
     PERFETTO_ELOG("sched_switch event out of order by %.4f ms, skipping",
@@ -66,7 +84,6 @@ void EventTracker::PushSchedSwitch(uint32_t cpu,
 
   auto* slices = context_->storage->mutable_slices();
 
-  StringId next_comm_id = context_->storage->InternString(next_comm);
   auto next_utid =
       context_->process_tracker->UpdateThread(ts, next_pid, next_comm_id);
 
@@ -91,10 +108,6 @@ void EventTracker::PushSchedSwitch(uint32_t cpu,
     }
   }
 
-  // We have to intern prev_comm again because our assumption that
-  // this event's |prev_comm| == previous event's |next_comm| does not hold
-  // if the thread changed its name while scheduled.
-  StringId prev_comm_id = context_->storage->InternString(prev_comm);
   UniqueTid prev_utid =
       context_->process_tracker->UpdateThread(ts, prev_pid, prev_comm_id);
 
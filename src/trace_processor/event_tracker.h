@@ -49,6 +49,17 @@ class EventTracker {
                                base::StringView next_comm,
                                int32_t next_prio);
 
+  // Same as PushSchedSwitch(), for comms already interned in the storage.
+  virtual void PushSchedSwitchInterned(uint32_t cpu,
+                                       int64_t timestamp,
+                                       uint32_t prev_pid,
+                                       StringId prev_comm_id,
+                                       int32_t prev_prio,
+                                       int64_t prev_state,
+                                       uint32_t next_pid,
+                                       StringId next_comm_id,
+                                       int32_t next_prio);
+
   // This method is called when a cpu freq event is seen in the trace.
   virtual RowId PushCounter(int64_t timestamp,
                             double value,
@@ -0,0 +1,383 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/ftrace_raw_page_decoder.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/protozero/proto_utils.h"
+
+#include "perfetto/trace/ftrace/ftrace_event.pbzero.h"
+#include "perfetto/trace/ftrace/ftrace_event_bundle.pbzero.h"
+#include "perfetto/trace/ftrace/generic.pbzero.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+namespace {
+
+using protos::pbzero::FtraceEvent;
+using protos::pbzero::FtraceEventBundle;
+using protos::pbzero::GenericFtraceEvent;
+using RawPageFormat = protos::pbzero::FtraceEventBundle_RawPageFormat;
+
+// See linux/include/linux/ring_buffer.h and the parsing of the pages in
+// traced_probes (CpuReader::ParsePage()), which this mirrors.
+constexpr uint32_t kTypeDataTypeLengthMax = 28;
+constexpr uint32_t kTypePadding = 29;
+constexpr uint32_t kTypeTimeExtend = 30;
+constexpr uint32_t kTypeTimeStamp = 31;
+
+// The events of a bigger id than this are ignored, as the events are looked up
+// in a vector indexed by id.
+constexpr uint32_t kMaxFtraceEventId = 1 << 16;
+
+template <typename T>
+bool ReadAndAdvance(const uint8_t** ptr, const uint8_t* end, T* out) {
+  if (static_cast<size_t>(end - *ptr) < sizeof(T))
+    return false;
+  memcpy(out, *ptr, sizeof(T));
+  *ptr += sizeof(T);
+  return true;
+}
+
+template <typename T>
+T ReadValue(const uint8_t* ptr) {
+  T value;
+  memcpy(&value, ptr, sizeof(T));
+  return value;
+}
+
+void AppendVarInt(uint64_t value, std::vector<uint8_t>* out) {
+  uint8_t buf[protozero::proto_utils::kMaxVarIntEncodedSize];
+  uint8_t* end = protozero::proto_utils::WriteVarInt(value, buf);
+  out->insert(out->end(), buf, end);
+}
+
+// Signed values are sign extended to 64 bits, like protozero does.
+void AppendVarIntField(uint32_t field_id,
+                       uint64_t value,
+                       std::vector<uint8_t>* out) {
+  AppendVarInt(protozero::proto_utils::MakeTagVarInt(field_id), out);
+  AppendVarInt(value, out);
+}
+
+void AppendBytesField(uint32_t field_id,
+                      const uint8_t* data,
+                      size_t size,
+                      std::vector<uint8_t>* out) {
+  AppendVarInt(protozero::proto_utils::MakeTagLengthDelimited(field_id), out);
+  AppendVarInt(size, out);
+  out->insert(out->end(), data, data + size);
+}
+
+// Appends the null terminated string in [start, end). Returns false if it is
+// not terminated before |end|.
+bool AppendStringField(uint32_t field_id,
+                       const uint8_t* start,
+                       const uint8_t* end,
+                       std::vector<uint8_t>* out) {
+  const void* nul = memchr(start, '\0', static_cast<size_t>(end - start));
+  if (!nul)
+    return false;
+  size_t size = static_cast<size_t>(static_cast<const uint8_t*>(nul) - start);
+  AppendBytesField(field_id, start, size, out);
+  return true;
+}
+
+// The kernel stores the device ids in a different layout than the one exposed
+// to userspace, see CpuReader::TranslateBlockDeviceIDToUserspace().
+uint64_t TranslateBlockDeviceIDToUserspace(uint64_t kernel_dev) {
+  uint64_t maj = kernel_dev >> 20;
+  uint64_t min = kernel_dev & ((1U << 20) - 1);
+  return ((maj & 0xfffff000ULL) << 32) | ((maj & 0xfffULL) << 8) |
+         ((min & 0xffffff00ULL) << 12) | ((min & 0xffULL));
+}
+
+template <typename T>
+uint64_t ReadSigned(const uint8_t* ptr) {
+  return static_cast<uint64_t>(static_cast<int64_t>(ReadValue<T>(ptr)));
+}
+
+size_t SizeOfFieldType(uint32_t type) {
+  switch (type) {
+    case RawPageFormat::UINT8:
+    case RawPageFormat::INT8:
+    case RawPageFormat::BOOL:
+      return 1;
+    case RawPageFormat::UINT16:
+    case RawPageFormat::INT16:
+      return 2;
+    case RawPageFormat::UINT32:
+    case RawPageFormat::INT32:
+    case RawPageFormat::INODE32:
+    case RawPageFormat::PID32:
+    case RawPageFormat::COMMON_PID32:
+    case RawPageFormat::DEVID32:
+    case RawPageFormat::DATA_LOC:
+      return 4;
+    case RawPageFormat::UINT64:
+    case RawPageFormat::INT64:
+    case RawPageFormat::INODE64:
+    case RawPageFormat::DEVID64:
+      return 8;
+  }
+  return 0;
+}
+
+}  // namespace
+
+FtraceRawPageDecoder::FtraceRawPageDecoder() = default;
+FtraceRawPageDecoder::~FtraceRawPageDecoder() = default;
+
+void FtraceRawPageDecoder::AddFormat(const uint8_t* data, size_t size) {
+  RawPageFormat::Decoder format(data, size);
+  auto decode_field = [](const protozero::ConstBytes& bytes) {
+    RawPageFormat::Field::Decoder decoder(bytes.data, bytes.size);
+    Field field;
+    field.name = decoder.name().ToStdString();
+    field.type = static_cast<uint32_t>(decoder.type());
+    field.offset = decoder.offset();
+    field.size = decoder.size();
+    field.proto_field_id = decoder.proto_field_id();
+    return field;
+  };
+
+  page_header_size_len_ = format.page_header_size_len();
+  common_fields_.clear();
+  for (auto it = format.common_field(); it; ++it)
+    common_fields_.push_back(decode_field(it->as_bytes()));
+
+  for (auto it = format.event(); it; ++it) {
+    protozero::ConstBytes bytes = it->as_bytes();
+    RawPageFormat::Event::Decoder decoder(bytes.data, bytes.size);
+    uint32_t id = decoder.ftrace_event_id();
+    if (id == 0 || id >= kMaxFtraceEventId || !decoder.proto_field_id())
+      continue;
+    if (id >= events_.size())
+      events_.resize(id + 1);
+    Event& event = events_[id];
+    event.name = decoder.name().ToStdString();
+    event.proto_field_id = decoder.proto_field_id();
+    event.fields.clear();
+    for (auto field = decoder.field(); field; ++field)
+      event.fields.push_back(decode_field(field->as_bytes()));
+  }
+}
+
+bool FtraceRawPageDecoder::DecodePage(const uint8_t* data,
+                                      size_t size,
+                                      std::vector<uint8_t>* out) {
+  PERFETTO_DCHECK(has_format());
+  const uint8_t* ptr = data;
+  const uint8_t* const end_of_page = data + size;
+
+  // The page header: a 64 bit timestamp and the commit field, whose lower 16
+  // bits are the size of the data in the page.
+  uint64_t timestamp;
+  uint32_t overwrite_and_size;
+  if (!ReadAndAdvance(&ptr, end_of_page, &timestamp) ||
+      !ReadAndAdvance(&ptr, end_of_page, &overwrite_and_size) ||
+      page_header_size_len_ < 4 ||
+      static_cast<size_t>(end_of_page - ptr) < page_header_size_len_ - 4) {
+    return false;
+  }
+  ptr += page_header_size_len_ - 4;
+  const uint8_t* const end = ptr + (overwrite_and_size & 0xffff);
+  if (end > end_of_page)
+    return false;
+
+  while (ptr < end) {
+    uint32_t event_header;
+    if (!ReadAndAdvance(&ptr, end, &event_header))
+      return false;
+    const uint32_t type_or_length = event_header & 0x1f;
+    timestamp += event_header >> 5;
+
+    switch (type_or_length) {
+      case kTypePadding: {
+        uint32_t length;
+        if (!ReadAndAdvance(&ptr, end, &length))
+          return false;
+        // Might pad up to the end of the page, past the committed data.
+        ptr = length < static_cast<size_t>(end - ptr) ? ptr + length : end;
+        break;
+      }
+      case kTypeTimeExtend: {
+        uint32_t time_delta_ext;
+        if (!ReadAndAdvance(&ptr, end, &time_delta_ext))
+          return false;
+        timestamp += static_cast<uint64_t>(time_delta_ext) << 27;
+        break;
+      }
+      case kTypeTimeStamp: {
+        // Not generated by the kernel.
+        uint64_t time_stamp[2];
+        if (!ReadAndAdvance(&ptr, end, &time_stamp))
+          return false;
+        break;
+      }
+      default: {
+        PERFETTO_DCHECK(type_or_length <= kTypeDataTypeLengthMax);
+        uint32_t event_size;
+        if (type_or_length == 0) {
+          if (!ReadAndAdvance(&ptr, end, &event_size) || event_size < 4)
+            return false;
+          event_size -= 4;  // The size includes the size field itself.
+        } else {
+          event_size = 4 * type_or_length;
+        }
+        const uint8_t* start = ptr;
+        if (event_size > static_cast<size_t>(end - start))
+          return false;
+        const uint8_t* next = start + event_size;
+
+        uint16_t ftrace_event_id;
+        if (!ReadAndAdvance(&ptr, next, &ftrace_event_id))
+          return false;
+        if (ftrace_event_id < events_.size() &&
+            events_[ftrace_event_id].proto_field_id &&
+            !DecodeEvent(events_[ftrace_event_id], timestamp, start, next,
+                         out)) {
+          return false;
+        }
+        ptr = next;
+        break;
+      }
+    }
+  }
+  return true;
+}
+
+bool FtraceRawPageDecoder::DecodeEvent(const Event& event,
+                                       uint64_t timestamp,
+                                       const uint8_t* start,
+                                       const uint8_t* end,
+                                       std::vector<uint8_t>* out) {
+  event_.clear();
+  AppendVarIntField(FtraceEvent::kTimestampFieldNumber, timestamp, &event_);
+  bool success = true;
+  for (const Field& field : common_fields_)
+    success &= DecodeField(field, start, end, &event_);
+
+  nested_.clear();
+  if (event.proto_field_id == FtraceEvent::kGenericFieldNumber) {
+    AppendBytesField(GenericFtraceEvent::kEventNameFieldNumber,
+                     reinterpret_cast<const uint8_t*>(event.name.data()),
+                     event.name.size(), &nested_);
+    for (const Field& field : event.fields) {
+      generic_field_.clear();
+      AppendBytesField(GenericFtraceEvent::Field::kNameFieldNumber,
+                       reinterpret_cast<const uint8_t*>(field.name.data()),
+                       field.name.size(), &generic_field_);
+      success &= DecodeField(field, start, end, &generic_field_);
+      AppendBytesField(GenericFtraceEvent::kFieldFieldNumber,
+                       generic_field_.data(), generic_field_.size(), &nested_);
+    }
+  } else {
+    for (const Field& field : event.fields)
+      success &= DecodeField(field, start, end, &nested_);
+  }
+  AppendBytesField(event.proto_field_id, nested_.data(), nested_.size(),
+                   &event_);
+
+  AppendBytesField(FtraceEventBundle::kEventFieldNumber, event_.data(),
+                   event_.size(), out);
+  return success;
+}
+
+// static
+bool FtraceRawPageDecoder::DecodeField(const Field& field,
+                                       const uint8_t* start,
+                                       const uint8_t* end,
+                                       std::vector<uint8_t>* out) {
+  const size_t length = static_cast<size_t>(end - start);
+  size_t size = std::max<size_t>(field.size, SizeOfFieldType(field.type));
+  if (field.offset > length || size > length - field.offset)
+    return false;
+  const uint8_t* field_start = start + field.offset;
+  const uint32_t id = field.proto_field_id;
+
+  switch (field.type) {
+    case RawPageFormat::UINT8:
+    case RawPageFormat::BOOL:
+      AppendVarIntField(id, ReadValue<uint8_t>(field_start), out);
+      return true;
+    case RawPageFormat::UINT16:
+      AppendVarIntField(id, ReadValue<uint16_t>(field_start), out);
+      return true;
+    case RawPageFormat::UINT32:
+    case RawPageFormat::INODE32:
+      AppendVarIntField(id, ReadValue<uint32_t>(field_start), out);
+      return true;
+    case RawPageFormat::UINT64:
+    case RawPageFormat::INODE64:
+      AppendVarIntField(id, ReadValue<uint64_t>(field_start), out);
+      return true;
+    case RawPageFormat::INT8:
+      AppendVarIntField(id, ReadSigned<int8_t>(field_start), out);
+      return true;
+    case RawPageFormat::INT16:
+      AppendVarIntField(id, ReadSigned<int16_t>(field_start), out);
+      return true;
+    case RawPageFormat::INT32:
+    case RawPageFormat::PID32:
+    case RawPageFormat::COMMON_PID32:
+      AppendVarIntField(id, ReadSigned<int32_t>(field_start), out);
+      return true;
+    case RawPageFormat::INT64:
+      AppendVarIntField(id, ReadSigned<int64_t>(field_start), out);
+      return true;
+    case RawPageFormat::DEVID32:
+      AppendVarIntField(id,
+                        TranslateBlockDeviceIDToUserspace(
+                            ReadValue<uint32_t>(field_start)),
+                        out);
+      return true;
+    case RawPageFormat::DEVID64:
+      AppendVarIntField(id,
+                        TranslateBlockDeviceIDToUserspace(
+                            ReadValue<uint64_t>(field_start)),
+                        out);
+      return true;
+    case RawPageFormat::FIXED_CSTRING:
+      return AppendStringField(id, field_start, field_start + field.size, out);
+    case RawPageFormat::CSTRING:
+      return AppendStringField(id, field_start, end, out);
+    case RawPageFormat::DATA_LOC: {
+      // The offset (in the record) and length of the string.
+      uint32_t data = ReadValue<uint32_t>(field_start);
+      const uint32_t offset = data & 0xffff;
+      const uint32_t len = (data >> 16) & 0xffff;
+      if (offset == 0 || offset > length || len > length - offset)
+        return false;
+      // Not an error if the string isn't terminated: nothing is appended, like
+      // CpuReader::ReadDataLoc() does.
+      AppendStringField(id, start + offset, start + offset + len, out);
+      return true;
+    }
+    case RawPageFormat::STRING_PTR:
+      // Pointers to kernel strings, which traced_probes doesn't read either.
+      return true;
+  }
+  return true;  // Unknown types are skipped.
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_FTRACE_RAW_PAGE_DECODER_H_
+#define SRC_TRACE_PROCESSOR_FTRACE_RAW_PAGE_DECODER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+namespace perfetto {
+namespace trace_processor {
+
+// Decodes the kernel ring buffer pages of FtraceEventBundle.raw_page (see
+// FtraceConfig.raw_pages) into the FtraceEvent(s) traced_probes would have
+// emitted otherwise, using the layout of the pages and of the events recorded
+// in FtraceEventBundle.raw_page_format.
+class FtraceRawPageDecoder {
+ public:
+  FtraceRawPageDecoder();
+  ~FtraceRawPageDecoder();
+
+  // Adds the events of the RawPageFormat proto [data, data + size) to the
+  // known ones. All the formats of a trace come from the same kernel, so they
+  // agree on the layout of the events they have in common.
+  void AddFormat(const uint8_t* data, size_t size);
+
+  bool has_format() const { return page_header_size_len_ != 0; }
+
+  // Appends the events of the raw page [data, data + size) to |out|, encoded
+  // as the |event| fields of a FtraceEventBundle. The events not in the format
+  // (i.e. enabled only by other tracing sessions) are skipped. Returns false
+  // if the page is malformed, in which case only the events before the error
+  // are appended.
+  bool DecodePage(const uint8_t* data, size_t size, std::vector<uint8_t>* out);
+
+ private:
+  struct Field {
+    std::string name;
+    uint32_t type = 0;  // RawPageFormat.FieldType.
+    uint32_t offset = 0;
+    uint32_t size = 0;
+    uint32_t proto_field_id = 0;
+  };
+
+  struct Event {
+    std::string name;
+    uint32_t proto_field_id = 0;  // 0 if the event is not in the format.
+    std::vector<Field> fields;
+  };
+
+  FtraceRawPageDecoder(const FtraceRawPageDecoder&) = delete;
+  FtraceRawPageDecoder& operator=(const FtraceRawPageDecoder&) = delete;
+
+  // Appends the field of the record [start, end) like CpuReader::ParseEvent()
+  // does. Returns false if the field doesn't fit in the record.
+  static bool DecodeField(const Field&,
+                          const uint8_t* start,
+                          const uint8_t* end,
+                          std::vector<uint8_t>* out);
+  bool DecodeEvent(const Event&,
+                   uint64_t timestamp,
+                   const uint8_t* start,
+                   const uint8_t* end,
+                   std::vector<uint8_t>* out);
+
+  uint32_t page_header_size_len_ = 0;
+  std::vector<Field> common_fields_;
+  std::vector<Event> events_;  // Indexed by ftrace event id.
+
+  // The encoded messages of the event being decoded, reused across events.
+  std::vector<uint8_t> event_;
+  std::vector<uint8_t> nested_;
+  std::vector<uint8_t> generic_field_;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_FTRACE_RAW_PAGE_DECODER_H_
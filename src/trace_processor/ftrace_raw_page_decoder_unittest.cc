@@ -0,0 +1,206 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/ftrace_raw_page_decoder.h"
+
+#include <string.h>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include "perfetto/trace/ftrace/ftrace_event.pb.h"
+#include "perfetto/trace/ftrace/ftrace_event_bundle.pb.h"
+#include "perfetto/trace/ftrace/generic.pb.h"
+#include "perfetto/trace/ftrace/sched.pb.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+using RawPageFormat = protos::FtraceEventBundle_RawPageFormat;
+
+constexpr uint32_t kSchedSwitchId = 47;
+constexpr uint32_t kGenericId = 300;
+constexpr uint32_t kUnknownId = 400;
+
+void AddField(RawPageFormat::Field* field,
+              const char* name,
+              RawPageFormat::FieldType type,
+              uint32_t offset,
+              uint32_t size,
+              uint32_t proto_field_id) {
+  field->set_name(name);
+  field->set_type(type);
+  field->set_offset(offset);
+  field->set_size(size);
+  field->set_proto_field_id(proto_field_id);
+}
+
+std::string MakeFormat() {
+  RawPageFormat format;
+  format.set_page_header_size_len(8);
+  AddField(format.add_common_field(), "common_pid", RawPageFormat::COMMON_PID32,
+           4, 4, protos::FtraceEvent::kPidFieldNumber);
+
+  RawPageFormat::Event* sched_switch = format.add_event();
+  sched_switch->set_ftrace_event_id(kSchedSwitchId);
+  sched_switch->set_name("sched_switch");
+  sched_switch->set_proto_field_id(
+      protos::FtraceEvent::kSchedSwitchFieldNumber);
+  using SchedSwitch = protos::SchedSwitchFtraceEvent;
+  AddField(sched_switch->add_field(), "prev_comm", RawPageFormat::FIXED_CSTRING,
+           8, 16, SchedSwitch::kPrevCommFieldNumber);
+  AddField(sched_switch->add_field(), "prev_pid", RawPageFormat::PID32, 24, 4,
+           SchedSwitch::kPrevPidFieldNumber);
+  AddField(sched_switch->add_field(), "prev_state", RawPageFormat::INT64, 32,
+           8, SchedSwitch::kPrevStateFieldNumber);
+  AddField(sched_switch->add_field(), "next_comm", RawPageFormat::FIXED_CSTRING,
+           40, 16, SchedSwitch::kNextCommFieldNumber);
+  AddField(sched_switch->add_field(), "next_pid", RawPageFormat::PID32, 56, 4,
+           SchedSwitch::kNextPidFieldNumber);
+
+  RawPageFormat::Event* generic = format.add_event();
+  generic->set_ftrace_event_id(kGenericId);
+  generic->set_name("my_event");
+  generic->set_proto_field_id(protos::FtraceEvent::kGenericFieldNumber);
+  using GenericField = protos::GenericFtraceEvent_Field;
+  AddField(generic->add_field(), "value", RawPageFormat::UINT32, 8, 4,
+           GenericField::kUintValueFieldNumber);
+  AddField(generic->add_field(), "msg", RawPageFormat::DATA_LOC, 12, 4,
+           GenericField::kStrValueFieldNumber);
+  return format.SerializeAsString();
+}
+
+template <typename T>
+void Put(std::vector<uint8_t>* payload, size_t offset, T value) {
+  memcpy(payload->data() + offset, &value, sizeof(T));
+}
+
+void PutString(std::vector<uint8_t>* payload, size_t offset, const char* s) {
+  memcpy(payload->data() + offset, s, strlen(s) + 1);
+}
+
+void AppendRecord(const std::vector<uint8_t>& payload,
+                  uint32_t time_delta,
+                  std::vector<uint8_t>* data) {
+  uint32_t header = static_cast<uint32_t>(payload.size() / 4) | time_delta << 5;
+  const uint8_t* header_ptr = reinterpret_cast<const uint8_t*>(&header);
+  data->insert(data->end(), header_ptr, header_ptr + sizeof(header));
+  data->insert(data->end(), payload.begin(), payload.end());
+}
+
+// Returns a page with a sched_switch, an event not in the format and a
+// generic event, in turn.
+std::vector<uint8_t> MakePage() {
+  std::vector<uint8_t> data;
+
+  std::vector<uint8_t> sched_switch(64);
+  Put<uint16_t>(&sched_switch, 0, kSchedSwitchId);
+  Put<int32_t>(&sched_switch, 4, 10);
+  PutString(&sched_switch, 8, "surfaceflinger");
+  Put<int32_t>(&sched_switch, 24, 10);
+  Put<int64_t>(&sched_switch, 32, -1);
+  PutString(&sched_switch, 40, "RenderThread");
+  Put<int32_t>(&sched_switch, 56, 11);
+  AppendRecord(sched_switch, 100, &data);
+
+  std::vector<uint8_t> unknown(8);
+  Put<uint16_t>(&unknown, 0, kUnknownId);
+  AppendRecord(unknown, 50, &data);
+
+  std::vector<uint8_t> generic(24);
+  Put<uint16_t>(&generic, 0, kGenericId);
+  Put<int32_t>(&generic, 4, 11);
+  Put<uint32_t>(&generic, 8, 42);
+  Put<uint32_t>(&generic, 12, 16 | 6 << 16);
+  PutString(&generic, 16, "hello");
+  AppendRecord(generic, 25, &data);
+
+  std::vector<uint8_t> page(16);
+  Put<uint64_t>(&page, 0, 1000);
+  Put<uint64_t>(&page, 8, data.size());
+  page.insert(page.end(), data.begin(), data.end());
+  return page;
+}
+
+protos::FtraceEventBundle ParseEvents(const std::vector<uint8_t>& events) {
+  protos::FtraceEventBundle bundle;
+  EXPECT_TRUE(
+      bundle.ParseFromArray(events.data(), static_cast<int>(events.size())));
+  return bundle;
+}
+
+TEST(FtraceRawPageDecoderTest, DecodePage) {
+  FtraceRawPageDecoder decoder;
+  EXPECT_FALSE(decoder.has_format());
+  std::string format = MakeFormat();
+  decoder.AddFormat(reinterpret_cast<const uint8_t*>(format.data()),
+                    format.size());
+  ASSERT_TRUE(decoder.has_format());
+
+  std::vector<uint8_t> page = MakePage();
+  std::vector<uint8_t> events;
+  ASSERT_TRUE(decoder.DecodePage(page.data(), page.size(), &events));
+  protos::FtraceEventBundle bundle = ParseEvents(events);
+  ASSERT_EQ(bundle.event().size(), 2);
+
+  const protos::FtraceEvent& sched_switch = bundle.event(0);
+  EXPECT_EQ(sched_switch.timestamp(), 1100u);
+  EXPECT_EQ(sched_switch.pid(), 10u);
+  ASSERT_TRUE(sched_switch.has_sched_switch());
+  EXPECT_EQ(sched_switch.sched_switch().prev_comm(), "surfaceflinger");
+  EXPECT_EQ(sched_switch.sched_switch().prev_pid(), 10);
+  EXPECT_EQ(sched_switch.sched_switch().prev_state(), -1);
+  EXPECT_EQ(sched_switch.sched_switch().next_comm(), "RenderThread");
+  EXPECT_EQ(sched_switch.sched_switch().next_pid(), 11);
+
+  // The unknown event is skipped but its time delta still counts.
+  const protos::FtraceEvent& generic = bundle.event(1);
+  EXPECT_EQ(generic.timestamp(), 1175u);
+  EXPECT_EQ(generic.pid(), 11u);
+  ASSERT_TRUE(generic.has_generic());
+  EXPECT_EQ(generic.generic().event_name(), "my_event");
+  ASSERT_EQ(generic.generic().field().size(), 2);
+  EXPECT_EQ(generic.generic().field(0).name(), "value");
+  EXPECT_EQ(generic.generic().field(0).uint_value(), 42u);
+  EXPECT_EQ(generic.generic().field(1).name(), "msg");
+  EXPECT_EQ(generic.generic().field(1).str_value(), "hello");
+}
+
+TEST(FtraceRawPageDecoderTest, MalformedPage) {
+  FtraceRawPageDecoder decoder;
+  std::string format = MakeFormat();
+  decoder.AddFormat(reinterpret_cast<const uint8_t*>(format.data()),
+                    format.size());
+
+  // The committed size is past the end of the page.
+  std::vector<uint8_t> page = MakePage();
+  std::vector<uint8_t> events;
+  EXPECT_FALSE(decoder.DecodePage(page.data(), page.size() - 4, &events));
+  EXPECT_TRUE(events.empty());
+
+  // The string of the generic event is out of its record: the events before
+  // it are still decoded.
+  Put<uint32_t>(&page, page.size() - 12, 16 | 60 << 16);
+  EXPECT_FALSE(decoder.DecodePage(page.data(), page.size(), &events));
+  protos::FtraceEventBundle bundle = ParseEvents(events);
+  ASSERT_GE(bundle.event().size(), 1);
+  EXPECT_TRUE(bundle.event(0).has_sched_switch());
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,375 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string>
+
+#include "benchmark/benchmark.h"
+
+#include "perfetto/base/string_view.h"
+#include "perfetto/protozero/proto_decoder.h"
+
+#include "perfetto/trace/ftrace/ftrace_event.pb.h"
+#include "perfetto/trace/ftrace/ftrace_event.pbzero.h"
+#include "perfetto/trace/ftrace/ftrace_event_bundle.pb.h"
+#include "perfetto/trace/ftrace/ftrace_event_bundle.pbzero.h"
+#include "perfetto/trace/ftrace/sched.pb.h"
+#include "perfetto/trace/ftrace/sched.pbzero.h"
+#include "perfetto/trace/ps/process_stats.pb.h"
+#include "perfetto/trace/ps/process_stats.pbzero.h"
+
+// Compares the two ways of decoding the hottest messages of the trace
+// processor: the hand-written ProtoDecoder::ReadField() loops (kReadField)
+// and the decoders generated by the ProtoZero plugin (kTypedDecoder).
+
+namespace {
+
+using perfetto::base::StringView;
+using protozero::ProtoDecoder;
+
+enum class Decoding { kReadField, kTypedDecoder };
+
+struct SchedSwitchArgs {
+  StringView prev_comm;
+  uint32_t prev_pid = 0;
+  int32_t prev_prio = 0;
+  int64_t prev_state = 0;
+  StringView next_comm;
+  uint32_t next_pid = 0;
+  int32_t next_prio = 0;
+};
+
+std::string MakeSchedSwitch() {
+  perfetto::protos::SchedSwitchFtraceEvent evt;
+  evt.set_prev_comm("surfaceflinger");
+  evt.set_prev_pid(1234);
+  evt.set_prev_prio(120);
+  evt.set_prev_state(1);
+  evt.set_next_comm("RenderThread");
+  evt.set_next_pid(5678);
+  evt.set_next_prio(110);
+  return evt.SerializeAsString();
+}
+
+std::string MakeFtraceBundle(int num_events) {
+  perfetto::protos::FtraceEventBundle bundle;
+  bundle.set_cpu(3);
+  for (int i = 0; i < num_events; i++) {
+    auto* evt = bundle.add_event();
+    evt->set_timestamp(1000000000ull + static_cast<uint64_t>(i) * 1000);
+    evt->set_pid(1234);
+    auto* sched_switch = evt->mutable_sched_switch();
+    sched_switch->set_prev_comm("surfaceflinger");
+    sched_switch->set_prev_pid(1234);
+    sched_switch->set_next_comm("RenderThread");
+    sched_switch->set_next_pid(5678);
+  }
+  return bundle.SerializeAsString();
+}
+
+std::string MakeProcessStats(int num_processes) {
+  perfetto::protos::ProcessStats stats;
+  for (int i = 0; i < num_processes; i++) {
+    auto* process = stats.add_processes();
+    process->set_pid(i + 1);
+    process->set_vm_size_kb(100000);
+    process->set_vm_rss_kb(50000);
+    process->set_rss_anon_kb(30000);
+    process->set_rss_file_kb(15000);
+    process->set_rss_shmem_kb(5000);
+    process->set_oom_score_adj(-800);
+  }
+  return stats.SerializeAsString();
+}
+
+const uint8_t* Data(const std::string& str) {
+  return reinterpret_cast<const uint8_t*>(str.data());
+}
+
+// Mimics ProtoTraceParser::ParseSchedSwitch().
+SchedSwitchArgs DecodeSchedSwitch(Decoding decoding,
+                                  const uint8_t* data,
+                                  size_t size) {
+  using perfetto::protos::pbzero::SchedSwitchFtraceEvent;
+  SchedSwitchArgs args;
+  if (decoding == Decoding::kTypedDecoder) {
+    SchedSwitchFtraceEvent::Decoder ss(data, size);
+    args.prev_comm = ss.prev_comm();
+    args.prev_pid = static_cast<uint32_t>(ss.prev_pid());
+    args.prev_prio = ss.prev_prio();
+    args.prev_state = ss.prev_state();
+    args.next_comm = ss.next_comm();
+    args.next_pid = static_cast<uint32_t>(ss.next_pid());
+    args.next_prio = ss.next_prio();
+    return args;
+  }
+  ProtoDecoder decoder(data, size);
+  for (auto fld = decoder.ReadField(); fld.id != 0; fld = decoder.ReadField()) {
+    switch (fld.id) {
+      case SchedSwitchFtraceEvent::kPrevPidFieldNumber:
+        args.prev_pid = fld.as_uint32();
+        break;
+      case SchedSwitchFtraceEvent::kPrevStateFieldNumber:
+        args.prev_state = fld.as_int64();
+        break;
+      case SchedSwitchFtraceEvent::kPrevCommFieldNumber:
+        args.prev_comm = fld.as_string();
+        break;
+      case SchedSwitchFtraceEvent::kPrevPrioFieldNumber:
+        args.prev_prio = fld.as_int32();
+        break;
+      case SchedSwitchFtraceEvent::kNextPidFieldNumber:
+        args.next_pid = fld.as_uint32();
+        break;
+      case SchedSwitchFtraceEvent::kNextCommFieldNumber:
+        args.next_comm = fld.as_string();
+        break;
+      case SchedSwitchFtraceEvent::kNextPrioFieldNumber:
+        args.next_prio = fld.as_int32();
+        break;
+      default:
+        break;
+    }
+  }
+  return args;
+}
+
+// Mimics ProtoTraceTokenizer::ParseFtraceBundle(). Returns the sum of the
+// sizes of the events, to prevent the loop from being optimized away.
+size_t DecodeFtraceBundle(Decoding decoding,
+                          const uint8_t* data,
+                          size_t size) {
+  using perfetto::protos::pbzero::FtraceEventBundle;
+  size_t total_size = 0;
+  if (decoding == Decoding::kTypedDecoder) {
+    FtraceEventBundle::Decoder bundle(data, size);
+    total_size += bundle.cpu();
+    for (auto it = bundle.event(); it; ++it)
+      total_size += it->size();
+    return total_size;
+  }
+  ProtoDecoder decoder(data, size);
+  uint64_t cpu = 0;
+  decoder.FindIntField<FtraceEventBundle::kCpuFieldNumber>(&cpu);
+  total_size += cpu;
+  for (auto fld = decoder.ReadField(); fld.id != 0; fld = decoder.ReadField()) {
+    if (fld.id == FtraceEventBundle::kEventFieldNumber)
+      total_size += fld.size();
+  }
+  return total_size;
+}
+
+enum class SchedEncoding { kEvents, kCompact };
+
+const char* const kComms[] = {"surfaceflinger", "RenderThread", "kworker/0:1",
+                              "swapper/0"};
+
+// Returns a bundle of |num_events| sched_switch events, either as
+// FtraceEvent(s) or in the compact encoding of FtraceEventBundle.compact_sched.
+std::string MakeSchedBundle(SchedEncoding encoding, int num_events) {
+  perfetto::protos::FtraceEventBundle bundle;
+  bundle.set_cpu(3);
+  perfetto::protos::FtraceEventBundle::CompactSched* compact = nullptr;
+  if (encoding == SchedEncoding::kCompact) {
+    compact = bundle.mutable_compact_sched();
+    for (const char* comm : kComms)
+      compact->add_intern_table(comm);
+  }
+  for (int i = 0; i < num_events; i++) {
+    const int prev = i % 4;
+    const int next = (i + 1) % 4;
+    if (encoding == SchedEncoding::kCompact) {
+      compact->add_switch_timestamp(i ? 1000 : 1000000000ull);
+      compact->add_switch_prev_pid(1000 + prev);
+      compact->add_switch_prev_prio(120);
+      compact->add_switch_prev_state(prev % 2);
+      compact->add_switch_prev_comm_index(static_cast<uint32_t>(prev));
+      compact->add_switch_next_pid(1000 + next);
+      compact->add_switch_next_prio(120);
+      compact->add_switch_next_comm_index(static_cast<uint32_t>(next));
+      continue;
+    }
+    auto* evt = bundle.add_event();
+    evt->set_timestamp(1000000000ull + static_cast<uint64_t>(i) * 1000);
+    evt->set_pid(static_cast<uint32_t>(1000 + prev));
+    auto* sched_switch = evt->mutable_sched_switch();
+    sched_switch->set_prev_comm(kComms[prev]);
+    sched_switch->set_prev_pid(1000 + prev);
+    sched_switch->set_prev_prio(120);
+    sched_switch->set_prev_state(prev % 2);
+    sched_switch->set_next_comm(kComms[next]);
+    sched_switch->set_next_pid(1000 + next);
+    sched_switch->set_next_prio(120);
+  }
+  return bundle.SerializeAsString();
+}
+
+// Mimics the decoding of the sched_switch events of a bundle by the tokenizer
+// and ProtoTraceParser::ParseSchedSwitch(), for both encodings (without the
+// sorting in between). Returns the sum of the pids.
+int64_t DecodeSchedBundle(SchedEncoding encoding,
+                          const uint8_t* data,
+                          size_t size) {
+  using perfetto::protos::pbzero::FtraceEvent;
+  using perfetto::protos::pbzero::FtraceEventBundle;
+  int64_t sum = 0;
+  FtraceEventBundle::Decoder bundle(data, size);
+  if (encoding == SchedEncoding::kEvents) {
+    for (auto it = bundle.event(); it; ++it) {
+      FtraceEvent::Decoder evt(it->data(), it->size());
+      const auto& ss = evt.Get(FtraceEvent::kSchedSwitchFieldNumber);
+      SchedSwitchArgs args =
+          DecodeSchedSwitch(Decoding::kTypedDecoder, ss.data(), ss.size());
+      benchmark::DoNotOptimize(args);
+      sum += static_cast<int64_t>(evt.timestamp()) + args.prev_pid +
+             args.next_pid + static_cast<int64_t>(args.next_comm.size());
+    }
+    return sum;
+  }
+  FtraceEventBundle::CompactSched::Decoder compact(bundle.compact_sched());
+  StringView comms[4];
+  size_t num_comms = 0;
+  for (auto it = compact.intern_table(); it && num_comms < 4; ++it)
+    comms[num_comms++] = it->as_string();
+  bool parse_error = false;
+  uint64_t timestamp = 0;
+  auto prev_pid_it = compact.switch_prev_pid(&parse_error);
+  auto prev_prio_it = compact.switch_prev_prio(&parse_error);
+  auto prev_state_it = compact.switch_prev_state(&parse_error);
+  auto prev_comm_it = compact.switch_prev_comm_index(&parse_error);
+  auto next_pid_it = compact.switch_next_pid(&parse_error);
+  auto next_prio_it = compact.switch_next_prio(&parse_error);
+  auto next_comm_it = compact.switch_next_comm_index(&parse_error);
+  for (auto it = compact.switch_timestamp(&parse_error); it; ++it) {
+    timestamp += *it;
+    SchedSwitchArgs args;
+    args.prev_comm = comms[*prev_comm_it % 4];
+    args.prev_pid = static_cast<uint32_t>(*prev_pid_it);
+    args.prev_prio = *prev_prio_it;
+    args.prev_state = *prev_state_it;
+    args.next_comm = comms[*next_comm_it % 4];
+    args.next_pid = static_cast<uint32_t>(*next_pid_it);
+    args.next_prio = *next_prio_it;
+    benchmark::DoNotOptimize(args);
+    sum += static_cast<int64_t>(timestamp) + args.prev_pid + args.next_pid +
+           static_cast<int64_t>(args.next_comm.size());
+    ++prev_pid_it;
+    ++prev_prio_it;
+    ++prev_state_it;
+    ++prev_comm_it;
+    ++next_pid_it;
+    ++next_prio_it;
+    ++next_comm_it;
+  }
+  return sum;
+}
+
+// Mimics ProtoTraceParser::ParseProcessStats() and
+// ParseProcessStatsProcess(). Returns the sum of all the counters.
+int64_t DecodeProcessStats(Decoding decoding,
+                           const uint8_t* data,
+                           size_t size) {
+  using perfetto::protos::pbzero::ProcessStats;
+  constexpr uint32_t kNumFields = 11;  // 1 + max field id of Process.
+  int64_t sum = 0;
+  if (decoding == Decoding::kTypedDecoder) {
+    ProcessStats::Decoder stats(data, size);
+    for (auto it = stats.processes(); it; ++it) {
+      ProcessStats::Process::Decoder proc(it->as_bytes());
+      sum += proc.pid();
+      for (uint32_t field_id = 2; field_id < kNumFields; field_id++) {
+        const ProtoDecoder::Field& fld = proc.Get(field_id);
+        if (fld.valid())
+          sum += fld.as_int64();
+      }
+    }
+    return sum;
+  }
+  ProtoDecoder decoder(data, size);
+  for (auto fld = decoder.ReadField(); fld.id != 0; fld = decoder.ReadField()) {
+    if (fld.id != ProcessStats::kProcessesFieldNumber)
+      continue;
+    ProtoDecoder proc(fld.data(), fld.size());
+    for (auto pfld = proc.ReadField(); pfld.id != 0; pfld = proc.ReadField()) {
+      if (pfld.id == ProcessStats::Process::kPidFieldNumber) {
+        sum += pfld.as_int32();
+      } else if (pfld.id < kNumFields) {
+        sum += pfld.as_int64();
+      }
+    }
+  }
+  return sum;
+}
+
+template <Decoding decoding>
+void BM_DecodeSchedSwitch(benchmark::State& state) {
+  std::string buf = MakeSchedSwitch();
+  while (state.KeepRunning()) {
+    SchedSwitchArgs args = DecodeSchedSwitch(decoding, Data(buf), buf.size());
+    benchmark::DoNotOptimize(args);
+  }
+}
+
+template <Decoding decoding>
+void BM_DecodeFtraceBundle(benchmark::State& state) {
+  std::string buf = MakeFtraceBundle(static_cast<int>(state.range(0)));
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(
+        DecodeFtraceBundle(decoding, Data(buf), buf.size()));
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(buf.size()));
+}
+
+template <Decoding decoding>
+void BM_DecodeProcessStats(benchmark::State& state) {
+  std::string buf = MakeProcessStats(static_cast<int>(state.range(0)));
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(
+        DecodeProcessStats(decoding, Data(buf), buf.size()));
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(buf.size()));
+}
+
+template <SchedEncoding encoding>
+void BM_DecodeSchedBundle(benchmark::State& state) {
+  std::string buf = MakeSchedBundle(encoding, static_cast<int>(state.range(0)));
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(
+        DecodeSchedBundle(encoding, Data(buf), buf.size()));
+  }
+  state.counters["bundle_bytes"] =
+      benchmark::Counter(static_cast<double>(buf.size()));
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) *
+                          state.range(0));
+}
+
+}  // namespace
+
+BENCHMARK_TEMPLATE(BM_DecodeSchedSwitch, Decoding::kReadField);
+BENCHMARK_TEMPLATE(BM_DecodeSchedSwitch, Decoding::kTypedDecoder);
+BENCHMARK_TEMPLATE(BM_DecodeFtraceBundle, Decoding::kReadField)
+    ->Arg(1)
+    ->Arg(64)
+    ->Arg(512);
+BENCHMARK_TEMPLATE(BM_DecodeFtraceBundle, Decoding::kTypedDecoder)
+    ->Arg(1)
+    ->Arg(64)
+    ->Arg(512);
+BENCHMARK_TEMPLATE(BM_DecodeProcessStats, Decoding::kReadField)->Arg(200);
+BENCHMARK_TEMPLATE(BM_DecodeProcessStats, Decoding::kTypedDecoder)->Arg(200);
+BENCHMARK_TEMPLATE(BM_DecodeSchedBundle, SchedEncoding::kEvents)->Arg(64);
+BENCHMARK_TEMPLATE(BM_DecodeSchedBundle, SchedEncoding::kCompact)->Arg(64);
@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_PROTO_INCREMENTAL_STATE_H_
+#define SRC_TRACE_PROCESSOR_PROTO_INCREMENTAL_STATE_H_
+
+#include <stdint.h>
+
+#include <unordered_map>
+
+#include "src/trace_processor/trace_storage.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// Stores the incremental state of each packet sequence (i.e. of each
+// TraceWriter) of a proto trace: the interned data, which the tokenizer
+// collects from the InternedData of the packets, and the thread descriptor,
+// which the TrackEvent timestamps are relative to.
+//
+// The tokenizer sees the packets of a sequence in order and updates the state
+// as it goes, the parser then resolves the iids of the (sorted) events. As
+// producers never reuse an iid for a different value within a session, not
+// even after clearing their incremental state, the interned data is never
+// dropped here: events that are parsed after a later clear of the state still
+// resolve to the right values.
+class ProtoIncrementalState {
+ public:
+  struct SourceLocation {
+    StringId file_name = 0;
+    StringId function_name = 0;
+  };
+
+  class PacketSequenceState {
+   public:
+    // The state is valid from the first packet with
+    // |incremental_state_cleared| until packets of the sequence are lost.
+    bool IsIncrementalStateValid() const { return state_valid_; }
+    void OnIncrementalStateCleared() {
+      state_valid_ = true;
+      // The producer emits a new thread descriptor after each clear.
+      thread_descriptor_seen_ = false;
+    }
+    void OnPacketLoss() { state_valid_ = false; }
+
+    void SetThreadDescriptor(int32_t pid,
+                             int32_t tid,
+                             int64_t reference_timestamp_ns) {
+      thread_descriptor_seen_ = true;
+      pid_ = pid;
+      tid_ = tid;
+      track_event_timestamp_ns_ = reference_timestamp_ns;
+    }
+    bool has_thread_descriptor() const { return thread_descriptor_seen_; }
+    int32_t pid() const { return pid_; }
+    int32_t tid() const { return tid_; }
+
+    // TrackEvent timestamp deltas are relative to the previous event of the
+    // sequence, or to the thread descriptor for the first one.
+    int64_t IncrementAndGetTrackEventTimestampNs(int64_t delta_ns) {
+      track_event_timestamp_ns_ += delta_ns;
+      return track_event_timestamp_ns_;
+    }
+
+    std::unordered_map<uint32_t, StringId>* event_categories() {
+      return &event_categories_;
+    }
+    std::unordered_map<uint32_t, StringId>* legacy_event_names() {
+      return &legacy_event_names_;
+    }
+    std::unordered_map<uint32_t, StringId>* debug_annotation_names() {
+      return &debug_annotation_names_;
+    }
+    std::unordered_map<uint32_t, SourceLocation>* source_locations() {
+      return &source_locations_;
+    }
+
+   private:
+    bool state_valid_ = false;
+    bool thread_descriptor_seen_ = false;
+    int32_t pid_ = 0;
+    int32_t tid_ = 0;
+    int64_t track_event_timestamp_ns_ = 0;
+
+    std::unordered_map<uint32_t, StringId> event_categories_;
+    std::unordered_map<uint32_t, StringId> legacy_event_names_;
+    std::unordered_map<uint32_t, StringId> debug_annotation_names_;
+    std::unordered_map<uint32_t, SourceLocation> source_locations_;
+  };
+
+  // Returns the state of the sequence with the given
+  // |trusted_packet_sequence_id|, creating it if necessary.
+  PacketSequenceState* GetOrCreateStateForPacketSequence(uint32_t sequence_id) {
+    // References to the elements of an unordered_map stay valid on rehash.
+    return &packet_sequence_states_[sequence_id];
+  }
+
+ private:
+  std::unordered_map<uint32_t, PacketSequenceState> packet_sequence_states_;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_PROTO_INCREMENTAL_STATE_H_
@@ -31,11 +31,15 @@
 #include "src/trace_processor/event_tracker.h"
 #include "src/trace_processor/ftrace_descriptors.h"
 #include "src/trace_processor/process_tracker.h"
+#include "src/trace_processor/proto_incremental_state.h"
 #include "src/trace_processor/slice_tracker.h"
 #include "src/trace_processor/trace_processor_context.h"
+#include "src/trace_processor/trace_sorter.h"
 
+#include "perfetto/trace/ftrace/sched.pbzero.h"
 #include "perfetto/trace/trace.pb.h"
 #include "perfetto/trace/trace_packet.pb.h"
+#include "perfetto/trace/track_event/track_event.pbzero.h"
 
 namespace perfetto {
 namespace trace_processor {
@@ -261,6 +265,8 @@ ProtoTraceParser::~ProtoTraceParser() = default;
 
 void ProtoTraceParser::ParseTracePacket(int64_t ts, TraceBlobView packet) {
   ProtoDecoder decoder(packet.data(), packet.length());
+  uint32_t sequence_id = 0;
+  ProtoDecoder::Field track_event_fld{};
 
   for (auto fld = decoder.ReadField(); fld.id != 0; fld = decoder.ReadField()) {
     switch (fld.id) {
@@ -309,10 +315,22 @@ void ProtoTraceParser::ParseTracePacket(int64_t ts, TraceBlobView packet) {
         ParseProfilePacket(packet.slice(fld_off, fld.size()));
         break;
       }
+      // The sequence id is appended by the service after the payload.
+      case protos::TracePacket::kTrustedPacketSequenceIdFieldNumber:
+        sequence_id = fld.as_uint32();
+        break;
+      case protos::TracePacket::kTrackEventFieldNumber:
+        track_event_fld = fld;
+        break;
       default:
         break;
     }
   }
+  if (track_event_fld.valid()) {
+    const size_t fld_off = packet.offset_of(track_event_fld.data());
+    ParseTrackEvent(ts, sequence_id,
+                    packet.slice(fld_off, track_event_fld.size()));
+  }
   // TODO(lalitm): maybe move this to the flush method in the trace processor
   // once we have it. This may reduce performance in the ArgsTracker though so
   // needs to be handled carefully.
@@ -966,46 +984,50 @@ void ProtoTraceParser::ParseCpuIdle(int64_t timestamp, TraceBlobView view) {
 void ProtoTraceParser::ParseSchedSwitch(uint32_t cpu,
                                         int64_t timestamp,
                                         TraceBlobView sswitch) {
-  ProtoDecoder decoder(sswitch.data(), sswitch.length());
-
-  base::StringView prev_comm;
-  uint32_t prev_pid = 0;
-  int32_t prev_prio = 0;
-  int64_t prev_state = 0;
-  base::StringView next_comm;
-  uint32_t next_pid = 0;
-  int32_t next_prio = 0;
-  for (auto fld = decoder.ReadField(); fld.id != 0; fld = decoder.ReadField()) {
-    switch (fld.id) {
-      case protos::SchedSwitchFtraceEvent::kPrevPidFieldNumber:
-        prev_pid = fld.as_uint32();
-        break;
-      case protos::SchedSwitchFtraceEvent::kPrevStateFieldNumber:
-        prev_state = fld.as_int64();
-        break;
-      case protos::SchedSwitchFtraceEvent::kPrevCommFieldNumber:
-        prev_comm = fld.as_string();
-        break;
-      case protos::SchedSwitchFtraceEvent::kPrevPrioFieldNumber:
-        prev_prio = fld.as_int32();
-        break;
-      case protos::SchedSwitchFtraceEvent::kNextPidFieldNumber:
-        next_pid = fld.as_uint32();
-        break;
-      case protos::SchedSwitchFtraceEvent::kNextCommFieldNumber:
-        next_comm = fld.as_string();
-        break;
-      case protos::SchedSwitchFtraceEvent::kNextPrioFieldNumber:
-        next_prio = fld.as_int32();
-        break;
-      default:
-        break;
-    }
-  }
-  context_->event_tracker->PushSchedSwitch(cpu, timestamp, prev_pid, prev_comm,
-                                           prev_prio, prev_state, next_pid,
-                                           next_comm, next_prio);
-  PERFETTO_DCHECK(decoder.IsEndOfBuffer());
+  protos::pbzero::SchedSwitchFtraceEvent::Decoder ss(sswitch.data(),
+                                                     sswitch.length());
+  uint32_t prev_pid = static_cast<uint32_t>(ss.prev_pid());
+  uint32_t next_pid = static_cast<uint32_t>(ss.next_pid());
+  context_->event_tracker->PushSchedSwitch(
+      cpu, timestamp, prev_pid, ss.prev_comm(), ss.prev_prio(),
+      ss.prev_state(), next_pid, ss.next_comm(), ss.next_prio());
+  PERFETTO_DCHECK(ss.IsEndOfBuffer());
+}
+
+void ProtoTraceParser::ParseInlineSchedSwitch(uint32_t cpu,
+                                              int64_t timestamp,
+                                              const InlineSchedSwitch& event) {
+  context_->event_tracker->PushSchedSwitchInterned(
+      cpu, timestamp, static_cast<uint32_t>(event.prev_pid), event.prev_comm,
+      event.prev_prio, event.prev_state, static_cast<uint32_t>(event.next_pid),
+      event.next_comm, event.next_prio);
+  context_->args_tracker->Flush();
+}
+
+void ProtoTraceParser::ParseInlineSchedWakeup(uint32_t cpu,
+                                              int64_t timestamp,
+                                              const InlineSchedWakeup& event) {
+  // The same raw event that ParseTypedFtraceToRaw() adds for a sched_wakeup
+  // FtraceEvent, with the args in the order of the proto fields.
+  using SW = protos::pbzero::SchedWakeupFtraceEvent;
+  const auto& message_strings =
+      ftrace_message_strings_[protos::FtraceEvent::kSchedWakeupFieldNumber];
+  UniqueTid utid = context_->process_tracker->UpdateThread(
+      timestamp, static_cast<uint32_t>(event.common_pid), 0);
+  RowId raw_event_id = context_->storage->mutable_raw_events()->AddRawEvent(
+      timestamp, message_strings.message_name_id, cpu, utid);
+  auto add_arg = [this, raw_event_id, &message_strings](uint32_t field_id,
+                                                        Variadic value) {
+    StringId name_id = message_strings.field_name_ids[field_id];
+    context_->args_tracker->AddArg(raw_event_id, name_id, name_id, value);
+  };
+  add_arg(SW::kCommFieldNumber, Variadic::String(event.comm));
+  add_arg(SW::kPidFieldNumber, Variadic::Integer(event.pid));
+  add_arg(SW::kPrioFieldNumber, Variadic::Integer(event.prio));
+  // Not in the compact encoding: the kernel always sets it to 1.
+  add_arg(SW::kSuccessFieldNumber, Variadic::Integer(1));
+  add_arg(SW::kTargetCpuFieldNumber, Variadic::Integer(event.target_cpu));
+  context_->args_tracker->Flush();
 }
 
 void ProtoTraceParser::ParseTaskNewTask(int64_t timestamp,
@@ -1855,5 +1877,69 @@ void ProtoTraceParser::ParseProfilePacket(TraceBlobView packet) {
   PERFETTO_DCHECK(decoder.IsEndOfBuffer());
 }
 
+void ProtoTraceParser::ParseTrackEvent(int64_t ts,
+                                       uint32_t sequence_id,
+                                       TraceBlobView track_event) {
+  TraceStorage* storage = context_->storage.get();
+  auto* state =
+      context_->proto_incremental_state->GetOrCreateStateForPacketSequence(
+          sequence_id);
+  protos::pbzero::TrackEvent::Decoder event(track_event.data(),
+                                            track_event.length());
+
+  // Only the legacy (i.e. JSON-like) events are imported for now.
+  if (!event.has_legacy_event())
+    return;
+  protos::pbzero::TrackEvent::LegacyEvent::Decoder legacy_event(
+      event.legacy_event());
+
+  // As in JSON traces, the category of an event that belongs to several of
+  // them is the comma-separated list of their names.
+  StringId category_id = 0;
+  std::string categories;
+  size_t num_categories = 0;
+  for (auto it = event.category_iids(); it; ++it) {
+    auto category = state->event_categories()->find(it->as_uint32());
+    if (PERFETTO_UNLIKELY(category == state->event_categories()->end())) {
+      storage->IncrementStats(stats::track_event_parser_errors);
+      return;
+    }
+    if (num_categories++ == 0) {
+      category_id = category->second;
+      continue;
+    }
+    if (num_categories == 2)
+      categories = storage->GetString(category_id);
+    categories += ",";
+    categories += storage->GetString(category->second);
+  }
+  if (num_categories > 1)
+    category_id = storage->InternString(base::StringView(categories));
+
+  auto name = state->legacy_event_names()->find(legacy_event.name_iid());
+  if (PERFETTO_UNLIKELY(name == state->legacy_event_names()->end())) {
+    storage->IncrementStats(stats::track_event_parser_errors);
+    return;
+  }
+  const StringId name_id = name->second;
+
+  UniqueTid utid = context_->process_tracker->UpdateThread(
+      static_cast<uint32_t>(state->tid()), static_cast<uint32_t>(state->pid()));
+  switch (legacy_event.phase()) {
+    case 'B':  // TRACE_EVENT_BEGIN.
+      context_->slice_tracker->Begin(ts, utid, category_id, name_id);
+      break;
+    case 'E':  // TRACE_EVENT_END.
+      context_->slice_tracker->End(ts, utid, category_id, name_id);
+      break;
+    case 'X':  // TRACE_EVENT (scoped event).
+      context_->slice_tracker->Scoped(ts, utid, category_id, name_id,
+                                      legacy_event.duration() * 1000);
+      break;
+    default:
+      break;
+  }
+}
+
 }  // namespace trace_processor
 }  // namespace perfetto
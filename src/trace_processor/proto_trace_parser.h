@@ -31,6 +31,8 @@ namespace perfetto {
 namespace trace_processor {
 
 class TraceProcessorContext;
+struct InlineSchedSwitch;
+struct InlineSchedWakeup;
 
 struct SystraceTracePoint {
   char phase;
@@ -61,6 +63,12 @@ class ProtoTraceParser {
   virtual void ParseFtracePacket(uint32_t cpu,
                                  int64_t timestamp,
                                  TraceBlobView);
+  virtual void ParseInlineSchedSwitch(uint32_t cpu,
+                                      int64_t timestamp,
+                                      const InlineSchedSwitch&);
+  virtual void ParseInlineSchedWakeup(uint32_t cpu,
+                                      int64_t timestamp,
+                                      const InlineSchedWakeup&);
   void ParseProcessTree(TraceBlobView);
   void ParseProcessStats(int64_t timestamp, TraceBlobView);
   void ParseProcessStatsProcess(int64_t timestamp, TraceBlobView);
@@ -108,6 +116,7 @@ class ProtoTraceParser {
   void ParseTraceStats(TraceBlobView);
   void ParseFtraceStats(TraceBlobView);
   void ParseProfilePacket(TraceBlobView);
+  void ParseTrackEvent(int64_t ts, uint32_t sequence_id, TraceBlobView);
 
  private:
   TraceProcessorContext* context_;
@@ -18,11 +18,15 @@
 
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "perfetto/base/lz_block.h"
 #include "perfetto/base/string_view.h"
+#include "perfetto/protozero/proto_utils.h"
 #include "src/trace_processor/args_tracker.h"
 #include "src/trace_processor/event_tracker.h"
 #include "src/trace_processor/process_tracker.h"
+#include "src/trace_processor/proto_incremental_state.h"
 #include "src/trace_processor/proto_trace_parser.h"
+#include "src/trace_processor/slice_tracker.h"
 #include "src/trace_processor/trace_sorter.h"
 
 #include "perfetto/trace/trace.pb.h"
@@ -39,6 +43,7 @@ using ::testing::ElementsAreArray;
 using ::testing::Eq;
 using ::testing::Pointwise;
 using ::testing::NiceMock;
+using ::testing::Return;
 
 class MockEventTracker : public EventTracker {
  public:
@@ -56,6 +61,17 @@ class MockEventTracker : public EventTracker {
                     base::StringView next_comm,
                     int32_t next_prio));
 
+  MOCK_METHOD9(PushSchedSwitchInterned,
+               void(uint32_t cpu,
+                    int64_t timestamp,
+                    uint32_t prev_pid,
+                    StringId prev_comm_id,
+                    int32_t prev_prio,
+                    int64_t prev_state,
+                    uint32_t next_pid,
+                    StringId next_comm_id,
+                    int32_t next_prio));
+
   MOCK_METHOD5(PushCounter,
                RowId(int64_t timestamp,
                      double value,
@@ -77,6 +93,28 @@ class MockProcessTracker : public ProcessTracker {
   MOCK_METHOD2(UpdateThread, UniqueTid(uint32_t tid, uint32_t tgid));
 };
 
+class MockSliceTracker : public SliceTracker {
+ public:
+  MockSliceTracker(TraceProcessorContext* context) : SliceTracker(context) {}
+
+  MOCK_METHOD4(Begin,
+               void(int64_t timestamp,
+                    UniqueTid utid,
+                    StringId cat,
+                    StringId name));
+  MOCK_METHOD4(End,
+               void(int64_t timestamp,
+                    UniqueTid utid,
+                    StringId cat,
+                    StringId name));
+  MOCK_METHOD5(Scoped,
+               void(int64_t timestamp,
+                    UniqueTid utid,
+                    StringId cat,
+                    StringId name,
+                    int64_t duration));
+};
+
 class MockTraceStorage : public TraceStorage {
  public:
   MockTraceStorage() : TraceStorage() {}
@@ -93,6 +131,23 @@ class MockArgsTracker : public ArgsTracker {
   MOCK_METHOD0(Flush, void());
 };
 
+// Returns the payload of a TracePacket.compressed_packets field that wraps
+// the packets of |trace|.
+std::string CompressPackets(const protos::Trace& trace) {
+  std::string raw = trace.SerializeAsString();
+  std::string block(protozero::proto_utils::kMessageLengthFieldSize +
+                        base::LzBlockCompressBound(raw.size()),
+                    '\0');
+  uint8_t* data = reinterpret_cast<uint8_t*>(&block[0]);
+  uint8_t* wptr = protozero::proto_utils::WriteVarInt(raw.size(), data);
+  size_t compressed_size = base::LzBlockCompress(
+      reinterpret_cast<const uint8_t*>(raw.data()), raw.size(), wptr,
+      block.size() - static_cast<size_t>(wptr - data));
+  PERFETTO_CHECK(compressed_size > 0);
+  block.resize(static_cast<size_t>(wptr - data) + compressed_size);
+  return block;
+}
+
 class ProtoTraceParserTest : public ::testing::Test {
  public:
   ProtoTraceParserTest() {
@@ -104,8 +159,11 @@ class ProtoTraceParserTest : public ::testing::Test {
     context_.event_tracker.reset(event_);
     process_ = new MockProcessTracker(&context_);
     context_.process_tracker.reset(process_);
+    slice_ = new MockSliceTracker(&context_);
+    context_.slice_tracker.reset(slice_);
     context_.sorter.reset(new TraceSorter(&context_, 0 /*window size*/));
     context_.proto_parser.reset(new ProtoTraceParser(&context_));
+    context_.proto_incremental_state.reset(new ProtoIncrementalState());
   }
 
   void InitStorage() {
@@ -126,6 +184,7 @@ class ProtoTraceParserTest : public ::testing::Test {
   MockArgsTracker* args_;
   MockEventTracker* event_;
   MockProcessTracker* process_;
+  MockSliceTracker* slice_;
   NiceMock<MockTraceStorage>* nice_storage_;
   MockTraceStorage* storage_;
 };
@@ -207,6 +266,70 @@ TEST_F(ProtoTraceParserTest, LoadEventsIntoRaw) {
   // and test here.
 }
 
+TEST_F(ProtoTraceParserTest, LoadCompactSched) {
+  InitStorage();
+  protos::Trace trace;
+
+  auto* bundle = trace.add_packet()->mutable_ftrace_events();
+  bundle->set_cpu(10);
+
+  static const char kProc1Name[] = "proc1";
+  static const char kProc2Name[] = "proc2";
+  auto* compact_sched = bundle->mutable_compact_sched();
+  compact_sched->add_intern_table(kProc1Name);
+  compact_sched->add_intern_table(kProc2Name);
+
+  // Two sched_switch events at 1000 and 1100, with a sched_wakeup at 1050 in
+  // between: the timestamps are deltas.
+  compact_sched->add_switch_timestamp(1000);
+  compact_sched->add_switch_prev_pid(10);
+  compact_sched->add_switch_prev_prio(256);
+  compact_sched->add_switch_prev_state(32);
+  compact_sched->add_switch_prev_comm_index(1);
+  compact_sched->add_switch_next_pid(100);
+  compact_sched->add_switch_next_prio(1024);
+  compact_sched->add_switch_next_comm_index(0);
+
+  compact_sched->add_switch_timestamp(100);
+  compact_sched->add_switch_prev_pid(100);
+  compact_sched->add_switch_prev_prio(1024);
+  compact_sched->add_switch_prev_state(1);
+  compact_sched->add_switch_prev_comm_index(0);
+  compact_sched->add_switch_next_pid(10);
+  compact_sched->add_switch_next_prio(256);
+  compact_sched->add_switch_next_comm_index(1);
+
+  compact_sched->add_wakeup_timestamp(1050);
+  compact_sched->add_wakeup_common_pid(100);
+  compact_sched->add_wakeup_pid(10);
+  compact_sched->add_wakeup_prio(256);
+  compact_sched->add_wakeup_target_cpu(3);
+  compact_sched->add_wakeup_comm_index(1);
+
+  // The comms are interned once, when the bundle is tokenized.
+  EXPECT_CALL(*storage_, InternString(base::StringView(kProc1Name)))
+      .WillOnce(Return(1));
+  EXPECT_CALL(*storage_, InternString(base::StringView(kProc2Name)))
+      .WillOnce(Return(2));
+  EXPECT_CALL(*event_,
+              PushSchedSwitchInterned(10, 1000, 10, 2, 256, 32, 100, 1, 1024));
+  EXPECT_CALL(*event_,
+              PushSchedSwitchInterned(10, 1100, 100, 1, 1024, 1, 10, 2, 256));
+
+  Tokenize(trace);
+  const auto& raw = context_.storage->raw_events();
+  ASSERT_EQ(raw.raw_event_count(), 1);
+  EXPECT_EQ(raw.timestamps()[0], 1050);
+  EXPECT_EQ(raw.cpus()[0], 10u);
+  const auto& args = context_.storage->args();
+  ASSERT_EQ(args.args_count(), 5);
+  EXPECT_EQ(args.arg_values()[0].string_value, 2u);
+  EXPECT_EQ(args.arg_values()[1].int_value, 10);
+  EXPECT_EQ(args.arg_values()[2].int_value, 256);
+  EXPECT_EQ(args.arg_values()[3].int_value, 1);
+  EXPECT_EQ(args.arg_values()[4].int_value, 3);
+}
+
 TEST_F(ProtoTraceParserTest, LoadGenericFtrace) {
   InitStorage();
   protos::Trace trace;
@@ -507,6 +630,174 @@ TEST(SystraceParserTest, SystraceEvent) {
   EXPECT_EQ(result, (SystraceTracePoint{'C', 543, base::StringView("foo"), 8}));
 }
 
+TEST_F(ProtoTraceParserTest, LoadCompressedPackets) {
+  protos::Trace inner;
+  for (uint32_t i = 0; i < 2; i++) {
+    auto* packet = inner.add_packet();
+    packet->set_timestamp(1000 + i);
+    auto* meminfo = packet->mutable_sys_stats()->add_meminfo();
+    meminfo->set_key(perfetto::protos::MEMINFO_MEM_TOTAL);
+    meminfo->set_value(10 + i);
+  }
+
+  protos::Trace trace;
+  trace.add_packet()->set_compressed_packets(CompressPackets(inner));
+
+  EXPECT_CALL(*event_,
+              PushCounter(1000, 10 * 1024, 0, 0, RefType::kRefNoRef));
+  EXPECT_CALL(*event_,
+              PushCounter(1001, 11 * 1024, 0, 0, RefType::kRefNoRef));
+  Tokenize(trace);
+  EXPECT_EQ(0, context_.storage->stats()[stats::compressed_packets_invalid]
+                   .value);
+}
+
+TEST_F(ProtoTraceParserTest, LoadCorruptedCompressedPackets) {
+  protos::Trace inner;
+  inner.add_packet()->mutable_process_tree()->add_processes()->set_pid(1);
+  std::string block = CompressPackets(inner);
+  block.resize(block.size() - 1);
+
+  protos::Trace trace;
+  trace.add_packet()->set_compressed_packets(block);
+  trace.add_packet()->set_compressed_packets("\xff");
+
+  EXPECT_CALL(*process_, UpdateProcess(_, _, _)).Times(0);
+  Tokenize(trace);
+  EXPECT_EQ(2, context_.storage->stats()[stats::compressed_packets_invalid]
+                   .value);
+}
+
+TEST_F(ProtoTraceParserTest, RawPageFormatIsPerSequence) {
+  // An empty raw page: the timestamp and the commit field (0 bytes of data).
+  const std::string page(16, '\0');
+
+  protos::Trace trace;
+  auto* packet = trace.add_packet();
+  packet->set_trusted_packet_sequence_id(1);
+  auto* bundle = packet->mutable_ftrace_events();
+  bundle->set_cpu(0);
+  bundle->mutable_raw_page_format()->set_page_header_size_len(8);
+  bundle->add_raw_page(page);
+
+  // The format of sequence 1 doesn't apply to the pages of sequence 2.
+  for (uint32_t sequence_id : {2u, 1u}) {
+    packet = trace.add_packet();
+    packet->set_trusted_packet_sequence_id(sequence_id);
+    bundle = packet->mutable_ftrace_events();
+    bundle->set_cpu(0);
+    bundle->add_raw_page(page);
+  }
+
+  Tokenize(trace);
+  EXPECT_EQ(1, context_.storage->stats()[stats::ftrace_raw_page_errors].value);
+}
+
+TEST_F(ProtoTraceParserTest, TrackEventWithInternedData) {
+  InitStorage();
+  protos::Trace trace;
+  {
+    auto* packet = trace.add_packet();
+    packet->set_trusted_packet_sequence_id(1);
+    packet->set_incremental_state_cleared(true);
+    auto* thread_desc = packet->mutable_thread_descriptor();
+    thread_desc->set_pid(15);
+    thread_desc->set_tid(16);
+    thread_desc->set_reference_timestamp_us(1000);
+  }
+  {
+    auto* packet = trace.add_packet();
+    packet->set_trusted_packet_sequence_id(1);
+    auto* event = packet->mutable_track_event();
+    event->set_timestamp_delta_us(10);  // absolute: 1010.
+    event->add_category_iids(1);
+    auto* legacy_event = event->mutable_legacy_event();
+    legacy_event->set_name_iid(1);
+    legacy_event->set_phase('B');
+
+    // The interned data comes after the event that refers to it.
+    auto* interned_data = packet->mutable_interned_data();
+    auto* category = interned_data->add_event_categories();
+    category->set_iid(1);
+    category->set_name("cat1");
+    auto* name = interned_data->add_legacy_event_names();
+    name->set_iid(1);
+    name->set_name("ev1");
+  }
+  {
+    auto* packet = trace.add_packet();
+    packet->set_trusted_packet_sequence_id(1);
+    auto* event = packet->mutable_track_event();
+    event->set_timestamp_delta_us(10);  // absolute: 1020.
+    event->add_category_iids(1);
+    auto* legacy_event = event->mutable_legacy_event();
+    legacy_event->set_name_iid(1);
+    legacy_event->set_phase('E');
+  }
+  {
+    auto* packet = trace.add_packet();
+    packet->set_trusted_packet_sequence_id(1);
+    auto* event = packet->mutable_track_event();
+    event->set_timestamp_absolute_us(1005);
+    event->add_category_iids(1);
+    auto* legacy_event = event->mutable_legacy_event();
+    legacy_event->set_name_iid(1);
+    legacy_event->set_phase('X');
+    legacy_event->set_duration(2);
+  }
+
+  EXPECT_CALL(*storage_, InternString(base::StringView("cat1")))
+      .WillOnce(Return(1));
+  EXPECT_CALL(*storage_, InternString(base::StringView("ev1")))
+      .WillOnce(Return(2));
+  EXPECT_CALL(*process_, UpdateThread(16, 15)).WillRepeatedly(Return(1));
+
+  // The events are sorted by timestamp before being parsed.
+  context_.sorter->set_window_ns_for_testing(1000000000);
+  ::testing::InSequence in_sequence;
+  EXPECT_CALL(*slice_, Scoped(1005000, 1, 1, 2, 2000));
+  EXPECT_CALL(*slice_, Begin(1010000, 1, 1, 2));
+  EXPECT_CALL(*slice_, End(1020000, 1, 1, 2));
+
+  Tokenize(trace);
+  context_.sorter->ExtractEventsForced();
+}
+
+TEST_F(ProtoTraceParserTest, TrackEventWithoutValidIncrementalState) {
+  protos::Trace trace;
+  for (uint32_t i = 0; i < 3; i++) {
+    // The state is valid only in the second iteration.
+    auto* packet = trace.add_packet();
+    packet->set_trusted_packet_sequence_id(1);
+    packet->set_incremental_state_cleared(i == 1);
+    packet->set_previous_packet_dropped(i == 2);
+    packet->mutable_thread_descriptor()->set_reference_timestamp_us(1000);
+
+    packet = trace.add_packet();
+    packet->set_trusted_packet_sequence_id(1);
+    auto* event = packet->mutable_track_event();
+    event->set_timestamp_delta_us(10);
+    event->add_category_iids(1);
+    auto* legacy_event = event->mutable_legacy_event();
+    legacy_event->set_name_iid(1);
+    legacy_event->set_phase('B');
+    auto* interned_data = packet->mutable_interned_data();
+    auto* category = interned_data->add_event_categories();
+    category->set_iid(1);
+    category->set_name("cat1");
+    auto* name = interned_data->add_legacy_event_names();
+    name->set_iid(1);
+    name->set_name("ev1");
+  }
+
+  EXPECT_CALL(*slice_, Begin(1010000, _, _, _));
+  Tokenize(trace);
+  context_.sorter->ExtractEventsForced();
+  EXPECT_EQ(2, context_.storage
+                   ->stats()[stats::track_event_tokenizer_skipped_packets]
+                   .value);
+}
+
 }  // namespace
 }  // namespace trace_processor
 }  // namespace perfetto
@@ -16,19 +16,28 @@
 
 #include "src/trace_processor/proto_trace_tokenizer.h"
 
+#include <string.h>
+
 #include <string>
 
 #include "perfetto/base/logging.h"
+#include "perfetto/base/lz_block.h"
 #include "perfetto/base/utils.h"
 #include "perfetto/protozero/proto_decoder.h"
 #include "perfetto/protozero/proto_utils.h"
 #include "src/trace_processor/event_tracker.h"
 #include "src/trace_processor/process_tracker.h"
+#include "src/trace_processor/proto_incremental_state.h"
 #include "src/trace_processor/stats.h"
 #include "src/trace_processor/trace_blob_view.h"
 #include "src/trace_processor/trace_sorter.h"
 #include "src/trace_processor/trace_storage.h"
 
+#include "perfetto/trace/ftrace/ftrace_event_bundle.pbzero.h"
+#include "perfetto/trace/interned_data/interned_data.pbzero.h"
+#include "perfetto/trace/track_event/task_execution.pbzero.h"
+#include "perfetto/trace/track_event/thread_descriptor.pbzero.h"
+#include "perfetto/trace/track_event/track_event.pbzero.h"
 #include "perfetto/trace/trace.pb.h"
 #include "perfetto/trace/trace_packet.pb.h"
 
@@ -40,8 +49,24 @@ using protozero::proto_utils::MakeTagLengthDelimited;
 using protozero::proto_utils::MakeTagVarInt;
 using protozero::proto_utils::ParseVarInt;
 
+namespace {
+
+// Returns the number of values of a packed varint field: each of them ends
+// with the only one of its bytes without the continuation bit.
+size_t CountPackedVarInts(const ProtoDecoder::Field& field) {
+  size_t count = 0;
+  const uint8_t* const end = field.data() + field.size();
+  for (const uint8_t* ptr = field.data(); ptr < end; ptr++)
+    count += *ptr < 0x80;
+  return count;
+}
+
+}  // namespace
+
 ProtoTraceTokenizer::ProtoTraceTokenizer(TraceProcessorContext* ctx)
-    : trace_sorter_(ctx->sorter.get()), trace_storage_(ctx->storage.get()) {}
+    : trace_sorter_(ctx->sorter.get()),
+      trace_storage_(ctx->storage.get()),
+      incremental_state_(ctx->proto_incremental_state.get()) {}
 ProtoTraceTokenizer::~ProtoTraceTokenizer() = default;
 
 bool ProtoTraceTokenizer::Parse(std::unique_ptr<uint8_t[]> owned_buf,
@@ -160,26 +185,138 @@ void ProtoTraceTokenizer::ParsePacket(TraceBlobView packet) {
       timestamp_found ? static_cast<int64_t>(raw_timestamp) : latest_timestamp_;
   latest_timestamp_ = std::max(timestamp, latest_timestamp_);
 
+  // The fields that refer to the incremental state of the sequence can come
+  // in any order in the packet (e.g. the interned data is appended after the
+  // payload that refers to it), they are handled after the loop. So are the
+  // ftrace events, whose raw pages are decoded with the format previously
+  // written into the same sequence (the sequence id follows the bundle).
+  ProtoDecoder::Field sequence_id_fld{};
+  ProtoDecoder::Field ftrace_events_fld{};
+  ProtoDecoder::Field interned_data_fld{};
+  ProtoDecoder::Field thread_descriptor_fld{};
+  ProtoDecoder::Field track_event_fld{};
+  bool state_cleared = false;
+  bool packet_dropped = false;
+
   // TODO(primiano): this can be optimized for the ftrace case.
   for (auto fld = decoder.ReadField(); fld.id != 0; fld = decoder.ReadField()) {
-    if (fld.id == protos::TracePacket::kTrustedUidFieldNumber)
-      continue;
-
-    if (fld.id == protos::TracePacket::kFtraceEventsFieldNumber) {
-      const size_t fld_off = packet.offset_of(fld.data());
-      ParseFtraceBundle(packet.slice(fld_off, fld.size()));
-      return;
+    switch (fld.id) {
+      case protos::TracePacket::kTrustedUidFieldNumber:
+        break;
+      case protos::TracePacket::kFtraceEventsFieldNumber:
+        ftrace_events_fld = fld;
+        break;
+      case protos::TracePacket::kCompressedPacketsFieldNumber: {
+        const size_t fld_off = packet.offset_of(fld.data());
+        ParseCompressedPackets(packet.slice(fld_off, fld.size()));
+        return;
+      }
+      case protos::TracePacket::kTrustedPacketSequenceIdFieldNumber:
+        sequence_id_fld = fld;
+        break;
+      case protos::TracePacket::kIncrementalStateClearedFieldNumber:
+        state_cleared = fld.as_bool();
+        break;
+      case protos::TracePacket::kPreviousPacketDroppedFieldNumber:
+        packet_dropped = fld.as_bool();
+        break;
+      case protos::TracePacket::kInternedDataFieldNumber:
+        interned_data_fld = fld;
+        break;
+      case protos::TracePacket::kThreadDescriptorFieldNumber:
+        thread_descriptor_fld = fld;
+        break;
+      case protos::TracePacket::kTrackEventFieldNumber:
+        track_event_fld = fld;
+        break;
+      default:
+        break;
     }
   }
 
+  const uint32_t sequence_id = sequence_id_fld.as_uint32();
+  if (ftrace_events_fld.valid()) {
+    const size_t fld_off = packet.offset_of(ftrace_events_fld.data());
+    ParseFtraceBundle(sequence_id,
+                      packet.slice(fld_off, ftrace_events_fld.size()));
+    return;
+  }
+  if (PERFETTO_UNLIKELY(state_cleared || packet_dropped)) {
+    auto* state =
+        incremental_state_->GetOrCreateStateForPacketSequence(sequence_id);
+    // A packet can be the first one after a loss and clear the state at the
+    // same time, in which case the state is valid again.
+    if (packet_dropped)
+      state->OnPacketLoss();
+    if (state_cleared)
+      state->OnIncrementalStateCleared();
+  }
+  if (interned_data_fld.valid()) {
+    const size_t fld_off = packet.offset_of(interned_data_fld.data());
+    ParseInternedData(sequence_id,
+                      packet.slice(fld_off, interned_data_fld.size()));
+  }
+  if (thread_descriptor_fld.valid()) {
+    const size_t fld_off = packet.offset_of(thread_descriptor_fld.data());
+    ParseThreadDescriptor(sequence_id,
+                          packet.slice(fld_off, thread_descriptor_fld.size()));
+  }
+  if (track_event_fld.valid()) {
+    const size_t fld_off = packet.offset_of(track_event_fld.data());
+    TraceBlobView track_event =
+        packet.slice(fld_off, track_event_fld.size());
+    ParseTrackEventPacket(sequence_id, std::move(packet),
+                          std::move(track_event));
+    return;
+  }
+
   // Use parent data and length because we want to parse this again
   // later to get the exact type of the packet.
   trace_sorter_->PushTracePacket(timestamp, std::move(packet));
   PERFETTO_DCHECK(decoder.IsEndOfBuffer());
 }
 
+void ProtoTraceTokenizer::ParseCompressedPackets(TraceBlobView block) {
+  // The LZ4 block format can't expand data by more than ~255x, bound the
+  // allocation accordingly to guard against corrupted size headers.
+  constexpr uint64_t kMaxCompressionRatio = 256;
+  const uint8_t* const start = block.data();
+  const uint8_t* const end = start + block.length();
+  uint64_t uncompressed_size = 0;
+  const uint8_t* data = ParseVarInt(start, end, &uncompressed_size);
+  const size_t compressed_size = static_cast<size_t>(end - data);
+  if (data == start || uncompressed_size == 0 ||
+      uncompressed_size > compressed_size * kMaxCompressionRatio) {
+    trace_storage_->IncrementStats(stats::compressed_packets_invalid);
+    return;
+  }
+
+  const size_t size = static_cast<size_t>(uncompressed_size);
+  std::unique_ptr<uint8_t[]> buf(new uint8_t[size]);
+  if (!base::LzBlockDecompress(data, compressed_size, &buf[0], size)) {
+    trace_storage_->IncrementStats(stats::compressed_packets_invalid);
+    return;
+  }
+
+  // Each block contains only whole packets, so unlike ParseInternal() there
+  // is no leftover to carry over to the next block.
+  TraceBlobView whole_buf(std::move(buf), 0, size);
+  ProtoDecoder decoder(whole_buf.data(), size);
+  for (auto fld = decoder.ReadField(); fld.id != 0; fld = decoder.ReadField()) {
+    if (fld.id != protos::Trace::kPacketFieldNumber) {
+      PERFETTO_ELOG("Non-trace packet field found in compressed packets");
+      continue;
+    }
+    const size_t fld_off = whole_buf.offset_of(fld.data());
+    ParsePacket(whole_buf.slice(fld_off, fld.size()));
+  }
+  if (!decoder.IsEndOfBuffer())
+    trace_storage_->IncrementStats(stats::compressed_packets_invalid);
+}
+
 PERFETTO_ALWAYS_INLINE
-void ProtoTraceTokenizer::ParseFtraceBundle(TraceBlobView bundle) {
+void ProtoTraceTokenizer::ParseFtraceBundle(uint32_t sequence_id,
+                                            TraceBlobView bundle) {
   constexpr auto kCpuFieldNumber = protos::FtraceEventBundle::kCpuFieldNumber;
   constexpr auto kCpuFieldTag = MakeTagVarInt(kCpuFieldNumber);
   const uint8_t* data = bundle.data();
@@ -189,33 +326,58 @@ void ProtoTraceTokenizer::ParseFtraceBundle(TraceBlobView bundle) {
   // For speed we speculate on the location and size (<128) of the cpu field.
   // In P+ cpu is pushed as the first field.
   // In P cpu is pushed as the 2nd last field.
-  uint64_t cpu = 0;
+  uint64_t cpu_64 = 0;
   if (length > 2 && data[0] == kCpuFieldTag && data[1] < 0x80) {
-    cpu = data[1];
+    cpu_64 = data[1];
   } else if (PERFETTO_LIKELY(length > 4 && data[length - 4] == kCpuFieldTag) &&
              data[length - 3] < 0x80) {
-    cpu = data[length - 3];
+    cpu_64 = data[length - 3];
   } else {
-    if (!PERFETTO_LIKELY((decoder.FindIntField<kCpuFieldNumber>(&cpu)))) {
+    if (!PERFETTO_LIKELY((decoder.FindIntField<kCpuFieldNumber>(&cpu_64)))) {
       PERFETTO_ELOG("CPU field not found in FtraceEventBundle");
       trace_storage_->IncrementStats(stats::ftrace_bundle_tokenizer_errors);
       return;
     }
   }
+  const uint32_t cpu = static_cast<uint32_t>(cpu_64);
 
+  bool has_raw_pages = false;
   for (auto fld = decoder.ReadField(); fld.id != 0; fld = decoder.ReadField()) {
     switch (fld.id) {
       case protos::FtraceEventBundle::kEventFieldNumber: {
         const size_t fld_off = bundle.offset_of(fld.data());
-        auto cpu_32 = static_cast<uint32_t>(cpu);
-        ParseFtraceEvent(cpu_32, bundle.slice(fld_off, fld.size()));
+        ParseFtraceEvent(cpu, bundle.slice(fld_off, fld.size()));
         break;
       }
+      case protos::FtraceEventBundle::kCompactSchedFieldNumber:
+        ParseFtraceCompactSched(cpu, fld.data(), fld.size());
+        break;
+      case protos::FtraceEventBundle::kRawPageFormatFieldNumber:
+        raw_page_decoders_[sequence_id].AddFormat(fld.data(), fld.size());
+        break;
+      case protos::FtraceEventBundle::kRawPageFieldNumber:
+        has_raw_pages = true;
+        break;
       default:
         break;
     }
   }
-  trace_sorter_->FinalizeFtraceEventBatch(static_cast<uint32_t>(cpu));
+
+  // The format of the raw pages can follow them in the bundle (e.g. when it's
+  // serialized by libprotobuf, in field id order), they are decoded in a
+  // second pass.
+  if (has_raw_pages) {
+    // References to the elements of an unordered_map stay valid on rehash.
+    FtraceRawPageDecoder* raw_page_decoder = &raw_page_decoders_[sequence_id];
+    constexpr auto kRawPageFieldNumber =
+        protos::FtraceEventBundle::kRawPageFieldNumber;
+    decoder.Reset();
+    for (auto fld = decoder.FindField(kRawPageFieldNumber); fld.valid();
+         fld = decoder.FindField(kRawPageFieldNumber)) {
+      ParseFtraceRawPage(raw_page_decoder, cpu, fld.data(), fld.size());
+    }
+  }
+  trace_sorter_->FinalizeFtraceEventBatch(cpu);
   PERFETTO_DCHECK(decoder.IsEndOfBuffer());
 }
 
@@ -257,5 +419,261 @@ void ProtoTraceTokenizer::ParseFtraceEvent(uint32_t cpu, TraceBlobView event) {
   trace_sorter_->PushFtraceEvent(cpu, timestamp, std::move(event));
 }
 
+void ProtoTraceTokenizer::ParseFtraceCompactSched(uint32_t cpu,
+                                                  const uint8_t* data,
+                                                  size_t size) {
+  using CompactSched = protos::pbzero::FtraceEventBundle::CompactSched;
+  CompactSched::Decoder decoder(data, size);
+
+  // The comms are interned once per bundle, the events refer to them by id.
+  compact_sched_comms_.clear();
+  for (auto it = decoder.intern_table(); it; ++it) {
+    compact_sched_comms_.push_back(
+        trace_storage_->InternString(it->as_string()));
+  }
+  const size_t num_comms = compact_sched_comms_.size();
+
+  const size_t num_switches = CountPackedVarInts(
+      decoder.Get(CompactSched::kSwitchTimestampFieldNumber));
+  const size_t num_wakeups = CountPackedVarInts(
+      decoder.Get(CompactSched::kWakeupTimestampFieldNumber));
+  if (num_switches + num_wakeups == 0)
+    return;
+
+  // All the events of the bundle are decoded into one buffer, which each of
+  // them then references through a slice of the same TraceBlobView.
+  const size_t switches_size = num_switches * sizeof(InlineSchedSwitch);
+  const size_t buf_size =
+      switches_size + num_wakeups * sizeof(InlineSchedWakeup);
+  std::unique_ptr<uint8_t[]> buf(new uint8_t[buf_size]);
+  compact_sched_timestamps_.clear();
+  bool parse_error = false;
+
+  // The timestamps are deltas from the previous event of the same type.
+  size_t parsed_switches = 0;
+  {
+    uint64_t timestamp = 0;
+    auto timestamp_it = decoder.switch_timestamp(&parse_error);
+    auto prev_pid_it = decoder.switch_prev_pid(&parse_error);
+    auto prev_prio_it = decoder.switch_prev_prio(&parse_error);
+    auto prev_state_it = decoder.switch_prev_state(&parse_error);
+    auto prev_comm_it = decoder.switch_prev_comm_index(&parse_error);
+    auto next_pid_it = decoder.switch_next_pid(&parse_error);
+    auto next_prio_it = decoder.switch_next_prio(&parse_error);
+    auto next_comm_it = decoder.switch_next_comm_index(&parse_error);
+    for (; timestamp_it && parsed_switches < num_switches; ++timestamp_it) {
+      if (PERFETTO_UNLIKELY(!prev_pid_it || !prev_prio_it || !prev_state_it ||
+                            !prev_comm_it || !next_pid_it || !next_prio_it ||
+                            !next_comm_it || *prev_comm_it >= num_comms ||
+                            *next_comm_it >= num_comms)) {
+        parse_error = true;
+        break;
+      }
+      InlineSchedSwitch sched_switch;
+      sched_switch.prev_state = *prev_state_it;
+      sched_switch.prev_pid = *prev_pid_it;
+      sched_switch.prev_prio = *prev_prio_it;
+      sched_switch.next_pid = *next_pid_it;
+      sched_switch.next_prio = *next_prio_it;
+      sched_switch.prev_comm = compact_sched_comms_[*prev_comm_it];
+      sched_switch.next_comm = compact_sched_comms_[*next_comm_it];
+      memcpy(&buf[parsed_switches * sizeof(sched_switch)], &sched_switch,
+             sizeof(sched_switch));
+      timestamp += *timestamp_it;
+      compact_sched_timestamps_.push_back(static_cast<int64_t>(timestamp));
+      parsed_switches++;
+      ++prev_pid_it;
+      ++prev_prio_it;
+      ++prev_state_it;
+      ++prev_comm_it;
+      ++next_pid_it;
+      ++next_prio_it;
+      ++next_comm_it;
+    }
+  }
+
+  size_t parsed_wakeups = 0;
+  {
+    uint64_t timestamp = 0;
+    auto timestamp_it = decoder.wakeup_timestamp(&parse_error);
+    auto common_pid_it = decoder.wakeup_common_pid(&parse_error);
+    auto pid_it = decoder.wakeup_pid(&parse_error);
+    auto prio_it = decoder.wakeup_prio(&parse_error);
+    auto target_cpu_it = decoder.wakeup_target_cpu(&parse_error);
+    auto comm_it = decoder.wakeup_comm_index(&parse_error);
+    for (; timestamp_it && parsed_wakeups < num_wakeups; ++timestamp_it) {
+      if (PERFETTO_UNLIKELY(!common_pid_it || !pid_it || !prio_it ||
+                            !target_cpu_it || !comm_it ||
+                            *comm_it >= num_comms)) {
+        parse_error = true;
+        break;
+      }
+      InlineSchedWakeup sched_wakeup;
+      sched_wakeup.common_pid = *common_pid_it;
+      sched_wakeup.pid = *pid_it;
+      sched_wakeup.prio = *prio_it;
+      sched_wakeup.target_cpu = *target_cpu_it;
+      sched_wakeup.comm = compact_sched_comms_[*comm_it];
+      memcpy(&buf[switches_size + parsed_wakeups * sizeof(sched_wakeup)],
+             &sched_wakeup, sizeof(sched_wakeup));
+      timestamp += *timestamp_it;
+      compact_sched_timestamps_.push_back(static_cast<int64_t>(timestamp));
+      parsed_wakeups++;
+      ++common_pid_it;
+      ++pid_it;
+      ++prio_it;
+      ++target_cpu_it;
+      ++comm_it;
+    }
+  }
+
+  if (PERFETTO_UNLIKELY(parse_error)) {
+    PERFETTO_ELOG("Malformed compact_sched in FtraceEventBundle");
+    trace_storage_->IncrementStats(stats::ftrace_bundle_tokenizer_errors);
+  }
+
+  // Merge the two (sorted) arrays of events, so that they are pushed in
+  // order like the FtraceEvent(s) of a bundle usually are and the sorter
+  // doesn't have to sort them again.
+  using TTP = TraceSorter::TimestampedTracePiece;
+  TraceBlobView events(std::move(buf), 0, buf_size);
+  const int64_t* switch_ts = compact_sched_timestamps_.data();
+  const int64_t* wakeup_ts = switch_ts + parsed_switches;
+  size_t i = 0;
+  size_t j = 0;
+  while (i < parsed_switches || j < parsed_wakeups) {
+    if (j == parsed_wakeups ||
+        (i < parsed_switches && switch_ts[i] <= wakeup_ts[j])) {
+      trace_sorter_->PushInlineFtraceEvent(
+          cpu, switch_ts[i], TTP::kInlineSchedSwitch,
+          events.slice(i * sizeof(InlineSchedSwitch),
+                       sizeof(InlineSchedSwitch)));
+      latest_timestamp_ = std::max(switch_ts[i], latest_timestamp_);
+      i++;
+    } else {
+      trace_sorter_->PushInlineFtraceEvent(
+          cpu, wakeup_ts[j], TTP::kInlineSchedWakeup,
+          events.slice(switches_size + j * sizeof(InlineSchedWakeup),
+                       sizeof(InlineSchedWakeup)));
+      latest_timestamp_ = std::max(wakeup_ts[j], latest_timestamp_);
+      j++;
+    }
+  }
+}
+
+void ProtoTraceTokenizer::ParseFtraceRawPage(
+    FtraceRawPageDecoder* raw_page_decoder,
+    uint32_t cpu,
+    const uint8_t* data,
+    size_t size) {
+  if (PERFETTO_UNLIKELY(!raw_page_decoder->has_format())) {
+    PERFETTO_ELOG("Raw ftrace page before its format");
+    trace_storage_->IncrementStats(stats::ftrace_raw_page_errors);
+    return;
+  }
+  raw_page_events_.clear();
+  if (!raw_page_decoder->DecodePage(data, size, &raw_page_events_))
+    trace_storage_->IncrementStats(stats::ftrace_raw_page_errors);
+  if (raw_page_events_.empty())
+    return;
+
+  // The decoded events are kept by the sorter, they need a buffer of their own
+  // (shared by all the events of the page).
+  std::unique_ptr<uint8_t[]> buffer(new uint8_t[raw_page_events_.size()]);
+  memcpy(buffer.get(), raw_page_events_.data(), raw_page_events_.size());
+  TraceBlobView events(std::move(buffer), 0, raw_page_events_.size());
+  ProtoDecoder decoder(events.data(), events.length());
+  for (auto fld = decoder.ReadField(); fld.id != 0; fld = decoder.ReadField()) {
+    const size_t fld_off = events.offset_of(fld.data());
+    ParseFtraceEvent(cpu, events.slice(fld_off, fld.size()));
+  }
+}
+
+void ProtoTraceTokenizer::ParseInternedData(uint32_t sequence_id,
+                                            TraceBlobView interned_data) {
+  auto* state =
+      incremental_state_->GetOrCreateStateForPacketSequence(sequence_id);
+  protos::pbzero::InternedData::Decoder decoder(interned_data.data(),
+                                                interned_data.length());
+
+  // The names are interned into the storage right away: only the iid -> string
+  // id mappings are kept in the incremental state.
+  auto intern_names = [this](protozero::RepeatedFieldIterator it,
+                             std::unordered_map<uint32_t, StringId>* map) {
+    for (; it; ++it) {
+      // EventCategory, LegacyEventName and DebugAnnotationName all have the
+      // same fields.
+      protos::pbzero::EventCategory::Decoder entry(it->as_bytes());
+      if (PERFETTO_UNLIKELY(!entry.has_iid() || !entry.has_name())) {
+        trace_storage_->IncrementStats(stats::interned_data_tokenizer_errors);
+        continue;
+      }
+      (*map)[entry.iid()] = trace_storage_->InternString(entry.name());
+    }
+  };
+  intern_names(decoder.event_categories(), state->event_categories());
+  intern_names(decoder.legacy_event_names(), state->legacy_event_names());
+  intern_names(decoder.debug_annotation_names(),
+               state->debug_annotation_names());
+
+  for (auto it = decoder.source_locations(); it; ++it) {
+    protos::pbzero::SourceLocation::Decoder entry(it->as_bytes());
+    if (PERFETTO_UNLIKELY(!entry.has_iid())) {
+      trace_storage_->IncrementStats(stats::interned_data_tokenizer_errors);
+      continue;
+    }
+    ProtoIncrementalState::SourceLocation& location =
+        (*state->source_locations())[entry.iid()];
+    location.file_name = trace_storage_->InternString(entry.file_name());
+    location.function_name =
+        trace_storage_->InternString(entry.function_name());
+  }
+}
+
+void ProtoTraceTokenizer::ParseThreadDescriptor(uint32_t sequence_id,
+                                                TraceBlobView descriptor) {
+  auto* state =
+      incremental_state_->GetOrCreateStateForPacketSequence(sequence_id);
+  protos::pbzero::ThreadDescriptor::Decoder decoder(descriptor.data(),
+                                                    descriptor.length());
+  state->SetThreadDescriptor(decoder.pid(), decoder.tid(),
+                             decoder.reference_timestamp_us() * 1000);
+}
+
+void ProtoTraceTokenizer::ParseTrackEventPacket(uint32_t sequence_id,
+                                                TraceBlobView packet,
+                                                TraceBlobView track_event) {
+  auto* state =
+      incremental_state_->GetOrCreateStateForPacketSequence(sequence_id);
+
+  // The iids and the timestamp deltas of the events can't be resolved until
+  // the state is cleared again.
+  if (PERFETTO_UNLIKELY(!state->IsIncrementalStateValid())) {
+    trace_storage_->IncrementStats(
+        stats::track_event_tokenizer_skipped_packets);
+    return;
+  }
+
+  protos::pbzero::TrackEvent::Decoder decoder(track_event.data(),
+                                              track_event.length());
+  int64_t timestamp = 0;
+  if (decoder.has_timestamp_delta_us()) {
+    if (PERFETTO_UNLIKELY(!state->has_thread_descriptor())) {
+      trace_storage_->IncrementStats(stats::track_event_tokenizer_errors);
+      return;
+    }
+    timestamp = state->IncrementAndGetTrackEventTimestampNs(
+        decoder.timestamp_delta_us() * 1000);
+  } else if (decoder.has_timestamp_absolute_us()) {
+    timestamp = decoder.timestamp_absolute_us() * 1000;
+  } else {
+    trace_storage_->IncrementStats(stats::track_event_tokenizer_errors);
+    return;
+  }
+  latest_timestamp_ = std::max(timestamp, latest_timestamp_);
+
+  trace_sorter_->PushTracePacket(timestamp, std::move(packet));
+}
+
 }  // namespace trace_processor
 }  // namespace perfetto
@@ -20,13 +20,17 @@
 #include <stdint.h>
 
 #include <memory>
+#include <unordered_map>
 #include <vector>
 
 #include "src/trace_processor/chunked_trace_reader.h"
+#include "src/trace_processor/ftrace_raw_page_decoder.h"
+#include "src/trace_processor/trace_storage.h"
 
 namespace perfetto {
 namespace trace_processor {
 
+class ProtoIncrementalState;
 class TraceProcessorContext;
 class TraceBlobView;
 class TraceSorter;
@@ -49,11 +53,23 @@ class ProtoTraceTokenizer : public ChunkedTraceReader {
                      uint8_t* data,
                      size_t size);
   void ParsePacket(TraceBlobView);
-  void ParseFtraceBundle(TraceBlobView);
+  void ParseCompressedPackets(TraceBlobView);
+  void ParseFtraceBundle(uint32_t sequence_id, TraceBlobView);
   void ParseFtraceEvent(uint32_t cpu, TraceBlobView);
+  void ParseFtraceCompactSched(uint32_t cpu, const uint8_t* data, size_t size);
+  void ParseFtraceRawPage(FtraceRawPageDecoder*,
+                          uint32_t cpu,
+                          const uint8_t* data,
+                          size_t size);
+  void ParseInternedData(uint32_t sequence_id, TraceBlobView);
+  void ParseThreadDescriptor(uint32_t sequence_id, TraceBlobView);
+  void ParseTrackEventPacket(uint32_t sequence_id,
+                             TraceBlobView packet,
+                             TraceBlobView track_event);
 
   TraceSorter* const trace_sorter_;
   TraceStorage* const trace_storage_;
+  ProtoIncrementalState* const incremental_state_;
 
   // Used to glue together trace packets that span across two (or more)
   // Parse() boundaries.
@@ -62,6 +78,17 @@ class ProtoTraceTokenizer : public ChunkedTraceReader {
   // Temporary. Currently trace packets do not have a timestamp, so the
   // timestamp given is latest_timestamp_.
   int64_t latest_timestamp_ = 0;
+
+  // Scratch space for the compact_sched of the bundle being tokenized: its
+  // interned comms and the (absolute) timestamps of its events.
+  std::vector<StringId> compact_sched_comms_;
+  std::vector<int64_t> compact_sched_timestamps_;
+
+  // Decode the raw_page(s) of the bundles into |raw_page_events_|, one per
+  // packet sequence: each data source, and each of its drain workers, writes
+  // the raw_page_format of its pages into its own sequence.
+  std::unordered_map<uint32_t, FtraceRawPageDecoder> raw_page_decoders_;
+  std::vector<uint8_t> raw_page_events_;
 };
 
 }  // namespace trace_processor
@@ -102,6 +102,10 @@ void SliceTracker::EndAndroid(int64_t timestamp,
   End(timestamp, utid);
 }
 
+void SliceTracker::End(int64_t timestamp, UniqueTid utid) {
+  End(timestamp, utid, 0 /* cat */, 0 /* name */);
+}
+
 void SliceTracker::End(int64_t timestamp,
                        UniqueTid utid,
                        StringId cat,
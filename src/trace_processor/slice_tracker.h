@@ -29,7 +29,7 @@ class TraceProcessorContext;
 class SliceTracker {
  public:
   explicit SliceTracker(TraceProcessorContext*);
-  ~SliceTracker();
+  virtual ~SliceTracker();
 
   void BeginAndroid(int64_t timestamp,
                     uint32_t ftrace_tid,
@@ -37,20 +37,29 @@ class SliceTracker {
                     StringId cat,
                     StringId name);
 
-  void Begin(int64_t timestamp, UniqueTid utid, StringId cat, StringId name);
+  virtual void Begin(int64_t timestamp,
+                     UniqueTid utid,
+                     StringId cat,
+                     StringId name);
 
-  void Scoped(int64_t timestamp,
-              UniqueTid utid,
-              StringId cat,
-              StringId name,
-              int64_t duration);
+  virtual void Scoped(int64_t timestamp,
+                      UniqueTid utid,
+                      StringId cat,
+                      StringId name,
+                      int64_t duration);
 
   void EndAndroid(int64_t timestamp, uint32_t ftrace_tid, uint32_t atrace_tgid);
 
-  void End(int64_t timestamp,
-           UniqueTid utid,
-           StringId opt_cat = {},
-           StringId opt_name = {});
+  // Ends the innermost slice of |utid|, whatever its category and name.
+  void End(int64_t timestamp, UniqueTid utid);
+
+  // Begin(), Scoped() and End() are virtual only to be mocked in tests. End()
+  // has an overload rather than default arguments, as those would be taken
+  // from the static type of the caller and not from the override.
+  virtual void End(int64_t timestamp,
+                   UniqueTid utid,
+                   StringId opt_cat,
+                   StringId opt_name);
 
  private:
   using SlicesStack = std::vector<size_t>;
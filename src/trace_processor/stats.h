@@ -31,6 +31,7 @@ namespace stats {
   F(android_log_num_total,                      kSingle,  kInfo,  kTrace),    \
   F(atrace_tgid_mismatch,                       kSingle,  kError, kTrace),    \
   F(clock_snapshot_not_monotonic,               kSingle,  kError, kTrace),    \
+  F(compressed_packets_invalid,                 kSingle,  kError, kTrace),    \
   F(counter_events_out_of_order,                kSingle,  kError, kAnalysis), \
   F(ftrace_bundle_tokenizer_errors,             kSingle,  kError, kAnalysis), \
   F(ftrace_cpu_bytes_read_begin,                kIndexed, kInfo,  kTrace),    \
@@ -49,6 +50,8 @@ namespace stats {
   F(ftrace_cpu_overrun_end,                     kIndexed, kError, kTrace),    \
   F(ftrace_cpu_read_events_begin,               kIndexed, kInfo,  kTrace),    \
   F(ftrace_cpu_read_events_end,                 kIndexed, kInfo,  kTrace),    \
+  F(ftrace_raw_page_errors,                     kSingle,  kError, kAnalysis), \
+  F(interned_data_tokenizer_errors,             kSingle,  kError, kAnalysis), \
   F(invalid_clock_snapshots,                    kSingle,  kError, kAnalysis), \
   F(invalid_cpu_times,                          kSingle,  kError, kAnalysis), \
   F(meminfo_unknown_keys,                       kSingle,  kError, kAnalysis), \
@@ -85,6 +88,9 @@ namespace stats {
   F(traced_producers_seen,                      kSingle,  kInfo,  kTrace),    \
   F(traced_total_buffers,                       kSingle,  kInfo,  kTrace),    \
   F(traced_tracing_sessions,                    kSingle,  kInfo,  kTrace),    \
+  F(track_event_parser_errors,                  kSingle,  kError, kAnalysis), \
+  F(track_event_tokenizer_errors,               kSingle,  kError, kAnalysis), \
+  F(track_event_tokenizer_skipped_packets,      kSingle,  kInfo,  kAnalysis), \
   F(vmstat_unknown_keys,                        kSingle,  kError, kAnalysis), \
   F(clock_sync_failure,                         kSingle,  kError, kAnalysis), \
   F(process_tracker_errors,                     kSingle,  kError, kAnalysis)
@@ -26,6 +26,7 @@ class ArgsTracker;
 class ChunkedTraceReader;
 class EventTracker;
 class ProcessTracker;
+class ProtoIncrementalState;
 class ProtoTraceParser;
 class SliceTracker;
 class ClockTracker;
@@ -45,6 +46,7 @@ class TraceProcessorContext {
   std::unique_ptr<ClockTracker> clock_tracker;
   std::unique_ptr<TraceStorage> storage;
   std::unique_ptr<ProtoTraceParser> proto_parser;
+  std::unique_ptr<ProtoIncrementalState> proto_incremental_state;
   std::unique_ptr<TraceSorter> sorter;
   std::unique_ptr<ChunkedTraceReader> chunk_reader;
 };
@@ -14,6 +14,8 @@
  * limitations under the License.
  */
 
+#include <string.h>
+
 #include <algorithm>
 #include <utility>
 
@@ -132,10 +134,29 @@ void TraceSorter::SortAndExtractEventsBeyondWindow(int64_t window_size_ns) {
       if (min_queue_idx == 0) {
         // queues_[0] is for non-ftrace packets.
         next_stage->ParseTracePacket(timestamp, std::move(blob_view));
-      } else {
-        // Ftrace queues start at offset 1. So queues_[1] = cpu[0] and so on.
-        uint32_t cpu = static_cast<uint32_t>(min_queue_idx - 1);
-        next_stage->ParseFtracePacket(cpu, timestamp, std::move(blob_view));
+        continue;
+      }
+
+      // Ftrace queues start at offset 1. So queues_[1] = cpu[0] and so on.
+      uint32_t cpu = static_cast<uint32_t>(min_queue_idx - 1);
+      switch (event.payload_type()) {
+        case TimestampedTracePiece::kProto:
+          next_stage->ParseFtracePacket(cpu, timestamp, std::move(blob_view));
+          break;
+        case TimestampedTracePiece::kInlineSchedSwitch: {
+          InlineSchedSwitch sched_switch;
+          PERFETTO_DCHECK(blob_view.length() == sizeof(sched_switch));
+          memcpy(&sched_switch, blob_view.data(), sizeof(sched_switch));
+          next_stage->ParseInlineSchedSwitch(cpu, timestamp, sched_switch);
+          break;
+        }
+        case TimestampedTracePiece::kInlineSchedWakeup: {
+          InlineSchedWakeup sched_wakeup;
+          PERFETTO_DCHECK(blob_view.length() == sizeof(sched_wakeup));
+          memcpy(&sched_wakeup, blob_view.data(), sizeof(sched_wakeup));
+          next_stage->ParseInlineSchedWakeup(cpu, timestamp, sched_wakeup);
+          break;
+        }
       }
     }  // for (event: events)
 
@@ -28,6 +28,27 @@
 namespace perfetto {
 namespace trace_processor {
 
+// The sched events of a FtraceEventBundle.CompactSched, decoded by the
+// tokenizer and handed as they are to the parser: unlike the FtraceEvent(s),
+// these are not re-parsed from the proto after sorting.
+struct InlineSchedSwitch {
+  int64_t prev_state;
+  int32_t prev_pid;
+  int32_t prev_prio;
+  int32_t next_pid;
+  int32_t next_prio;
+  StringId prev_comm;
+  StringId next_comm;
+};
+
+struct InlineSchedWakeup {
+  int32_t common_pid;
+  int32_t pid;
+  int32_t prio;
+  int32_t target_cpu;
+  StringId comm;
+};
+
 // This class takes care of sorting events parsed from the trace stream in
 // arbitrary order and pushing them to the next pipeline stages (parsing) in
 // order. In order to support streaming use-cases, sorting happens within a
@@ -58,8 +79,22 @@ namespace trace_processor {
 class TraceSorter {
  public:
   struct TimestampedTracePiece {
-    TimestampedTracePiece(int64_t ts, uint64_t idx, TraceBlobView tbv)
-        : timestamp(ts), packet_idx_(idx), blob_view(std::move(tbv)) {}
+    // What |blob_view| holds: a TracePacket or FtraceEvent proto, or one of
+    // the Inline* structs above.
+    enum PayloadType : uint8_t {
+      kProto = 0,
+      kInlineSchedSwitch,
+      kInlineSchedWakeup,
+    };
+
+    TimestampedTracePiece(int64_t ts,
+                          uint64_t idx,
+                          TraceBlobView tbv,
+                          PayloadType type = kProto)
+        : timestamp(ts),
+          packet_idx_(idx),
+          payload_type_(type),
+          blob_view(std::move(tbv)) {}
 
     TimestampedTracePiece(TimestampedTracePiece&&) noexcept = default;
     TimestampedTracePiece& operator=(TimestampedTracePiece&&) = default;
@@ -75,8 +110,15 @@ class TraceSorter {
              (timestamp == o.timestamp && packet_idx_ < o.packet_idx_);
     }
 
+    PayloadType payload_type() const {
+      return static_cast<PayloadType>(payload_type_);
+    }
+
     int64_t timestamp;
-    uint64_t packet_idx_;
+    // Bitfields to keep this struct in 32 bytes, |packet_idx_| can't
+    // realistically overflow 56 bits.
+    uint64_t packet_idx_ : 56;
+    uint64_t payload_type_ : 8;
     TraceBlobView blob_view;
   };
 
@@ -103,6 +145,18 @@ class TraceSorter {
     // for a bundle are pushed.
   }
 
+  // Like PushFtraceEvent(), for an event of a FtraceEventBundle.CompactSched:
+  // |event| holds the InlineSchedSwitch or InlineSchedWakeup given by |type|.
+  inline void PushInlineFtraceEvent(uint32_t cpu,
+                                    int64_t timestamp,
+                                    TimestampedTracePiece::PayloadType type,
+                                    TraceBlobView event) {
+    PERFETTO_DCHECK(type != TimestampedTracePiece::kProto);
+    set_ftrace_batch_cpu_for_DCHECK(cpu);
+    GetQueue(cpu + 1)->Append(TimestampedTracePiece(
+        timestamp, packet_idx_++, std::move(event), type));
+  }
+
   inline void FinalizeFtraceEventBatch(uint32_t cpu) {
     DCHECK_ftrace_batch_cpu(cpu);
     set_ftrace_batch_cpu_for_DCHECK(kNoBatch);
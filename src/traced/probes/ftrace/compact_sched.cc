@@ -0,0 +1,323 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/ftrace/compact_sched.h"
+
+#include <string.h>
+
+#include "perfetto/base/logging.h"
+#include "src/traced/probes/ftrace/ftrace_metadata.h"
+
+#include "perfetto/trace/ftrace/ftrace_event.pbzero.h"
+#include "perfetto/trace/ftrace/ftrace_event_bundle.pbzero.h"
+#include "perfetto/trace/ftrace/sched.pbzero.h"
+
+namespace perfetto {
+
+namespace {
+
+using protos::pbzero::FtraceEvent;
+using protos::pbzero::SchedSwitchFtraceEvent;
+using protos::pbzero::SchedWakeupFtraceEvent;
+
+// TASK_COMM_LEN in the kernel.
+constexpr uint16_t kCommSize = 16;
+
+const Event* FindEvent(const std::vector<Event>& events,
+                       uint32_t proto_field_id) {
+  for (const Event& event : events) {
+    if (event.ftrace_event_id && event.proto_field_id == proto_field_id)
+      return &event;
+  }
+  return nullptr;
+}
+
+// Returns the field |proto_field_id| of |fields| if it is of the given type
+// and size, nullptr otherwise.
+const Field* FindField(const std::vector<Field>& fields,
+                       uint32_t proto_field_id,
+                       FtraceFieldType ftrace_type,
+                       uint16_t ftrace_size) {
+  for (const Field& field : fields) {
+    if (field.proto_field_id != proto_field_id)
+      continue;
+    if (field.ftrace_type != ftrace_type || field.ftrace_size != ftrace_size)
+      return nullptr;
+    return &field;
+  }
+  return nullptr;
+}
+
+CompactSchedSwitchFormat ValidateSchedSwitchFormat(const Event& event) {
+  using SS = SchedSwitchFtraceEvent;
+  const Field* prev_comm = FindField(event.fields, SS::kPrevCommFieldNumber,
+                                     kFtraceFixedCString, kCommSize);
+  const Field* prev_pid =
+      FindField(event.fields, SS::kPrevPidFieldNumber, kFtracePid32, 4);
+  const Field* prev_prio =
+      FindField(event.fields, SS::kPrevPrioFieldNumber, kFtraceInt32, 4);
+  const Field* prev_state =
+      FindField(event.fields, SS::kPrevStateFieldNumber, kFtraceInt64, 8);
+  if (!prev_state) {
+    prev_state =
+        FindField(event.fields, SS::kPrevStateFieldNumber, kFtraceInt32, 4);
+  }
+  const Field* next_comm = FindField(event.fields, SS::kNextCommFieldNumber,
+                                     kFtraceFixedCString, kCommSize);
+  const Field* next_pid =
+      FindField(event.fields, SS::kNextPidFieldNumber, kFtracePid32, 4);
+  const Field* next_prio =
+      FindField(event.fields, SS::kNextPrioFieldNumber, kFtraceInt32, 4);
+
+  CompactSchedSwitchFormat format;
+  if (!prev_comm || !prev_pid || !prev_prio || !prev_state || !next_comm ||
+      !next_pid || !next_prio) {
+    PERFETTO_ELOG("Unexpected sched_switch format, compact_sched disabled");
+    return format;
+  }
+  format.event_id = static_cast<uint16_t>(event.ftrace_event_id);
+  format.size = event.size;
+  format.prev_comm_offset = prev_comm->ftrace_offset;
+  format.prev_pid_offset = prev_pid->ftrace_offset;
+  format.prev_prio_offset = prev_prio->ftrace_offset;
+  format.prev_state_offset = prev_state->ftrace_offset;
+  format.prev_state_size = prev_state->ftrace_size;
+  format.next_comm_offset = next_comm->ftrace_offset;
+  format.next_pid_offset = next_pid->ftrace_offset;
+  format.next_prio_offset = next_prio->ftrace_offset;
+  return format;
+}
+
+CompactSchedWakeupFormat ValidateSchedWakeupFormat(
+    const Event& event,
+    const std::vector<Field>& common_fields) {
+  using SW = SchedWakeupFtraceEvent;
+  const Field* common_pid =
+      FindField(common_fields, FtraceEvent::kPidFieldNumber,
+                kFtraceCommonPid32, 4);
+  const Field* comm = FindField(event.fields, SW::kCommFieldNumber,
+                                kFtraceFixedCString, kCommSize);
+  const Field* pid =
+      FindField(event.fields, SW::kPidFieldNumber, kFtracePid32, 4);
+  const Field* prio =
+      FindField(event.fields, SW::kPrioFieldNumber, kFtraceInt32, 4);
+  const Field* target_cpu =
+      FindField(event.fields, SW::kTargetCpuFieldNumber, kFtraceInt32, 4);
+
+  CompactSchedWakeupFormat format;
+  if (!common_pid || !comm || !pid || !prio || !target_cpu) {
+    PERFETTO_ELOG("Unexpected sched_wakeup format, compact_sched disabled");
+    return format;
+  }
+  format.event_id = static_cast<uint16_t>(event.ftrace_event_id);
+  format.size = event.size;
+  format.common_pid_offset = common_pid->ftrace_offset;
+  format.comm_offset = comm->ftrace_offset;
+  format.pid_offset = pid->ftrace_offset;
+  format.prio_offset = prio->ftrace_offset;
+  format.target_cpu_offset = target_cpu->ftrace_offset;
+  return format;
+}
+
+template <typename T>
+T ReadValue(const uint8_t* ptr) {
+  T value;
+  memcpy(&value, ptr, sizeof(T));
+  return value;
+}
+
+}  // namespace
+
+CompactSchedFormat ValidateFormatForCompactSched(
+    const std::vector<Event>& events,
+    const std::vector<Field>& common_fields) {
+  CompactSchedFormat format;
+  const Event* sched_switch =
+      FindEvent(events, FtraceEvent::kSchedSwitchFieldNumber);
+  if (sched_switch)
+    format.sched_switch = ValidateSchedSwitchFormat(*sched_switch);
+  const Event* sched_wakeup =
+      FindEvent(events, FtraceEvent::kSchedWakeupFieldNumber);
+  if (sched_wakeup) {
+    format.sched_wakeup =
+        ValidateSchedWakeupFormat(*sched_wakeup, common_fields);
+  }
+  return format;
+}
+
+CompactSchedBuffer::CompactSchedBuffer() = default;
+CompactSchedBuffer::~CompactSchedBuffer() = default;
+CompactSchedBuffer::CompactSchedBuffer(CompactSchedBuffer&&) noexcept =
+    default;
+CompactSchedBuffer& CompactSchedBuffer::operator=(CompactSchedBuffer&&) =
+    default;
+
+bool CompactSchedBuffer::AppendEvent(const CompactSchedFormat& format,
+                                     uint16_t ftrace_event_id,
+                                     uint64_t timestamp,
+                                     const uint8_t* start,
+                                     const uint8_t* end,
+                                     FtraceMetadata* metadata) {
+  PERFETTO_DCHECK(format.IsCompactSchedEvent(ftrace_event_id));
+  const size_t length = static_cast<size_t>(end - start);
+  if (ftrace_event_id == format.sched_switch.event_id) {
+    if (format.sched_switch.size > length) {
+      PERFETTO_DFATAL("Buffer overflowed.");
+      return false;
+    }
+    AppendSchedSwitch(format.sched_switch, timestamp, start, metadata);
+  } else {
+    if (format.sched_wakeup.size > length) {
+      PERFETTO_DFATAL("Buffer overflowed.");
+      return false;
+    }
+    AppendSchedWakeup(format.sched_wakeup, timestamp, start, metadata);
+  }
+  metadata->FinishEvent();
+  return true;
+}
+
+void CompactSchedBuffer::AppendSchedSwitch(
+    const CompactSchedSwitchFormat& format,
+    uint64_t timestamp,
+    const uint8_t* start,
+    FtraceMetadata* metadata) {
+  // The events of a page are in timestamp order.
+  PERFETTO_DCHECK(timestamp >= last_switch_timestamp_);
+  switch_timestamp_.push_back(timestamp - last_switch_timestamp_);
+  last_switch_timestamp_ = timestamp;
+
+  // The common pid of sched_switch is always the prev_pid.
+  int32_t prev_pid = ReadValue<int32_t>(start + format.prev_pid_offset);
+  int32_t next_pid = ReadValue<int32_t>(start + format.next_pid_offset);
+  metadata->AddCommonPid(prev_pid);
+  metadata->AddPid(next_pid);
+
+  int64_t prev_state =
+      format.prev_state_size == 8
+          ? ReadValue<int64_t>(start + format.prev_state_offset)
+          : ReadValue<int32_t>(start + format.prev_state_offset);
+  switch_prev_pid_.push_back(prev_pid);
+  switch_prev_prio_.push_back(
+      ReadValue<int32_t>(start + format.prev_prio_offset));
+  switch_prev_state_.push_back(prev_state);
+  switch_prev_comm_index_.push_back(
+      InternComm(start + format.prev_comm_offset));
+  switch_next_pid_.push_back(next_pid);
+  switch_next_prio_.push_back(
+      ReadValue<int32_t>(start + format.next_prio_offset));
+  switch_next_comm_index_.push_back(
+      InternComm(start + format.next_comm_offset));
+}
+
+void CompactSchedBuffer::AppendSchedWakeup(
+    const CompactSchedWakeupFormat& format,
+    uint64_t timestamp,
+    const uint8_t* start,
+    FtraceMetadata* metadata) {
+  PERFETTO_DCHECK(timestamp >= last_wakeup_timestamp_);
+  wakeup_timestamp_.push_back(timestamp - last_wakeup_timestamp_);
+  last_wakeup_timestamp_ = timestamp;
+
+  int32_t common_pid = ReadValue<int32_t>(start + format.common_pid_offset);
+  int32_t pid = ReadValue<int32_t>(start + format.pid_offset);
+  metadata->AddCommonPid(common_pid);
+  metadata->AddPid(pid);
+
+  wakeup_common_pid_.push_back(common_pid);
+  wakeup_pid_.push_back(pid);
+  wakeup_prio_.push_back(ReadValue<int32_t>(start + format.prio_offset));
+  wakeup_target_cpu_.push_back(
+      ReadValue<int32_t>(start + format.target_cpu_offset));
+  wakeup_comm_index_.push_back(InternComm(start + format.comm_offset));
+}
+
+uint32_t CompactSchedBuffer::InternComm(const uint8_t* comm) {
+  const char* str = reinterpret_cast<const char*>(comm);
+  const size_t len = strnlen(str, kCommSize);
+  for (size_t i = 0; i < intern_table_.size(); i++) {
+    const std::string& interned = intern_table_[i];
+    if (interned.size() == len && memcmp(interned.data(), str, len) == 0)
+      return static_cast<uint32_t>(i);
+  }
+  intern_table_.emplace_back(str, len);
+  return static_cast<uint32_t>(intern_table_.size() - 1);
+}
+
+void CompactSchedBuffer::WriteAndReset(
+    protos::pbzero::FtraceEventBundle* bundle) {
+  if (empty())
+    return;
+  auto* compact_sched = bundle->set_compact_sched();
+  for (const std::string& comm : intern_table_)
+    compact_sched->add_intern_table(comm.data(), comm.size());
+
+  if (!switch_timestamp_.empty()) {
+    const size_t num_switches = switch_timestamp_.size();
+    compact_sched->set_switch_timestamp(switch_timestamp_.data(),
+                                        num_switches);
+    compact_sched->set_switch_prev_pid(switch_prev_pid_.data(), num_switches);
+    compact_sched->set_switch_prev_prio(switch_prev_prio_.data(),
+                                        num_switches);
+    compact_sched->set_switch_prev_state(switch_prev_state_.data(),
+                                         num_switches);
+    compact_sched->set_switch_prev_comm_index(switch_prev_comm_index_.data(),
+                                              num_switches);
+    compact_sched->set_switch_next_pid(switch_next_pid_.data(), num_switches);
+    compact_sched->set_switch_next_prio(switch_next_prio_.data(),
+                                        num_switches);
+    compact_sched->set_switch_next_comm_index(switch_next_comm_index_.data(),
+                                              num_switches);
+  }
+
+  if (!wakeup_timestamp_.empty()) {
+    const size_t num_wakeups = wakeup_timestamp_.size();
+    compact_sched->set_wakeup_timestamp(wakeup_timestamp_.data(),
+                                        num_wakeups);
+    compact_sched->set_wakeup_common_pid(wakeup_common_pid_.data(),
+                                         num_wakeups);
+    compact_sched->set_wakeup_pid(wakeup_pid_.data(), num_wakeups);
+    compact_sched->set_wakeup_prio(wakeup_prio_.data(), num_wakeups);
+    compact_sched->set_wakeup_target_cpu(wakeup_target_cpu_.data(),
+                                         num_wakeups);
+    compact_sched->set_wakeup_comm_index(wakeup_comm_index_.data(),
+                                         num_wakeups);
+  }
+  compact_sched->Finalize();
+  Reset();
+}
+
+void CompactSchedBuffer::Reset() {
+  intern_table_.clear();
+  last_switch_timestamp_ = 0;
+  switch_timestamp_.clear();
+  switch_prev_pid_.clear();
+  switch_prev_prio_.clear();
+  switch_prev_state_.clear();
+  switch_prev_comm_index_.clear();
+  switch_next_pid_.clear();
+  switch_next_prio_.clear();
+  switch_next_comm_index_.clear();
+  last_wakeup_timestamp_ = 0;
+  wakeup_timestamp_.clear();
+  wakeup_common_pid_.clear();
+  wakeup_pid_.clear();
+  wakeup_prio_.clear();
+  wakeup_target_cpu_.clear();
+  wakeup_comm_index_.clear();
+}
+
+}  // namespace perfetto
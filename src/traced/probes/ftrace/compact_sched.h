@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACED_PROBES_FTRACE_COMPACT_SCHED_H_
+#define SRC_TRACED_PROBES_FTRACE_COMPACT_SCHED_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "src/traced/probes/ftrace/event_info_constants.h"
+
+namespace perfetto {
+
+struct FtraceMetadata;
+
+namespace protos {
+namespace pbzero {
+class FtraceEventBundle;
+}  // namespace pbzero
+}  // namespace protos
+
+// The layout of the raw sched_switch and sched_wakeup records, as needed to
+// encode them in the compact form of FtraceEventBundle.CompactSched. The
+// |event_id| of an event is 0 if its format is not the expected one (or the
+// event is not known): such events are always emitted as FtraceEvent(s).
+struct CompactSchedSwitchFormat {
+  uint16_t event_id = 0;
+  uint16_t size = 0;
+  uint16_t prev_comm_offset = 0;
+  uint16_t prev_pid_offset = 0;
+  uint16_t prev_prio_offset = 0;
+  uint16_t prev_state_offset = 0;
+  uint16_t prev_state_size = 0;  // The kernel's long, 4 or 8 bytes.
+  uint16_t next_comm_offset = 0;
+  uint16_t next_pid_offset = 0;
+  uint16_t next_prio_offset = 0;
+};
+
+struct CompactSchedWakeupFormat {
+  uint16_t event_id = 0;
+  uint16_t size = 0;
+  uint16_t common_pid_offset = 0;
+  uint16_t comm_offset = 0;
+  uint16_t pid_offset = 0;
+  uint16_t prio_offset = 0;
+  uint16_t target_cpu_offset = 0;
+};
+
+struct CompactSchedFormat {
+  bool IsCompactSchedEvent(uint16_t ftrace_event_id) const {
+    return ftrace_event_id != 0 &&
+           (ftrace_event_id == sched_switch.event_id ||
+            ftrace_event_id == sched_wakeup.event_id);
+  }
+
+  CompactSchedSwitchFormat sched_switch;
+  CompactSchedWakeupFormat sched_wakeup;
+};
+
+// Looks up the layout of sched_switch and sched_wakeup in the |events| and
+// |common_fields| of a ProtoTranslationTable.
+CompactSchedFormat ValidateFormatForCompactSched(
+    const std::vector<Event>& events,
+    const std::vector<Field>& common_fields);
+
+// Accumulates the sched_switch and sched_wakeup events of a bundle as the
+// parallel arrays of FtraceEventBundle.CompactSched, interning their comms.
+// Reused across bundles to avoid allocations.
+class CompactSchedBuffer {
+ public:
+  CompactSchedBuffer();
+  ~CompactSchedBuffer();
+  CompactSchedBuffer(CompactSchedBuffer&&) noexcept;
+  CompactSchedBuffer& operator=(CompactSchedBuffer&&);
+
+  // Appends the raw record [start, end) of the event |ftrace_event_id|, which
+  // must be one of the events of |format|, adding its pids to |metadata| like
+  // CpuReader::ParseEvent() does. Returns false if the record is malformed.
+  bool AppendEvent(const CompactSchedFormat& format,
+                   uint16_t ftrace_event_id,
+                   uint64_t timestamp,
+                   const uint8_t* start,
+                   const uint8_t* end,
+                   FtraceMetadata* metadata);
+
+  // Writes the events appended since the last call, if any, as the
+  // compact_sched field of |bundle| and clears the buffer.
+  void WriteAndReset(protos::pbzero::FtraceEventBundle* bundle);
+
+  // Drops the events appended since the last WriteAndReset().
+  void Reset();
+
+  bool empty() const {
+    return switch_timestamp_.empty() && wakeup_timestamp_.empty();
+  }
+
+ private:
+  CompactSchedBuffer(const CompactSchedBuffer&) = delete;
+  CompactSchedBuffer& operator=(const CompactSchedBuffer&) = delete;
+
+  void AppendSchedSwitch(const CompactSchedSwitchFormat&,
+                         uint64_t timestamp,
+                         const uint8_t* start,
+                         FtraceMetadata*);
+  void AppendSchedWakeup(const CompactSchedWakeupFormat&,
+                         uint64_t timestamp,
+                         const uint8_t* start,
+                         FtraceMetadata*);
+
+  // Returns the index in |intern_table_| of the fixed size comm at |comm|.
+  uint32_t InternComm(const uint8_t* comm);
+
+  // Linearly searched: a bundle has only a few tens of distinct comms.
+  std::vector<std::string> intern_table_;
+
+  uint64_t last_switch_timestamp_ = 0;
+  std::vector<uint64_t> switch_timestamp_;
+  std::vector<int32_t> switch_prev_pid_;
+  std::vector<int32_t> switch_prev_prio_;
+  std::vector<int64_t> switch_prev_state_;
+  std::vector<uint32_t> switch_prev_comm_index_;
+  std::vector<int32_t> switch_next_pid_;
+  std::vector<int32_t> switch_next_prio_;
+  std::vector<uint32_t> switch_next_comm_index_;
+
+  uint64_t last_wakeup_timestamp_ = 0;
+  std::vector<uint64_t> wakeup_timestamp_;
+  std::vector<int32_t> wakeup_common_pid_;
+  std::vector<int32_t> wakeup_pid_;
+  std::vector<int32_t> wakeup_prio_;
+  std::vector<int32_t> wakeup_target_cpu_;
+  std::vector<uint32_t> wakeup_comm_index_;
+};
+
+}  // namespace perfetto
+
+#endif  // SRC_TRACED_PROBES_FTRACE_COMPACT_SCHED_H_
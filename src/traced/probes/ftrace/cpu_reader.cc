@@ -29,6 +29,8 @@
 #include "perfetto/base/metatrace.h"
 #include "perfetto/base/optional.h"
 #include "perfetto/base/utils.h"
+#include "perfetto/protozero/proto_decoder.h"
+#include "perfetto/tracing/core/trace_writer.h"
 #include "src/traced/probes/ftrace/ftrace_controller.h"
 #include "src/traced/probes/ftrace/ftrace_data_source.h"
 #include "src/traced/probes/ftrace/ftrace_thread_sync.h"
@@ -52,7 +54,10 @@ constexpr uint32_t kTypePadding = 29;
 constexpr uint32_t kTypeTimeExtend = 30;
 constexpr uint32_t kTypeTimeStamp = 31;
 
-constexpr uint32_t kMainThread = 255;  // for METATRACE
+// Size of the buffer where ParsePageForSinks() encodes the events of a page.
+// Encoded events take roughly as much space as the raw ones, except generic
+// events which are larger as they contain also the field names.
+constexpr size_t kFanOutScratchSize = 16 * base::kPageSize;
 
 struct PageHeader {
   uint64_t timestamp;
@@ -70,47 +75,6 @@ struct TimeStamp {
   uint64_t tv_sec;
 };
 
-bool ReadIntoString(const uint8_t* start,
-                    const uint8_t* end,
-                    uint32_t field_id,
-                    protozero::Message* out) {
-  for (const uint8_t* c = start; c < end; c++) {
-    if (*c != '\0')
-      continue;
-    out->AppendBytes(field_id, reinterpret_cast<const char*>(start),
-                     static_cast<uintptr_t>(c - start));
-    return true;
-  }
-  return false;
-}
-
-bool ReadDataLoc(const uint8_t* start,
-                 const uint8_t* field_start,
-                 const uint8_t* end,
-                 const Field& field,
-                 protozero::Message* message) {
-  PERFETTO_DCHECK(field.ftrace_size == 4);
-  // See
-  // https://github.com/torvalds/linux/blob/master/include/trace/trace_events.h
-  uint32_t data = 0;
-  const uint8_t* ptr = field_start;
-  if (!CpuReader::ReadAndAdvance(&ptr, end, &data)) {
-    PERFETTO_DFATAL("Buffer overflowed.");
-    return false;
-  }
-
-  const uint16_t offset = data & 0xffff;
-  const uint16_t len = (data >> 16) & 0xffff;
-  const uint8_t* const string_start = start + offset;
-  const uint8_t* const string_end = string_start + len;
-  if (string_start <= start || string_end > end) {
-    PERFETTO_DFATAL("Buffer overflowed.");
-    return false;
-  }
-  ReadIntoString(string_start, string_end, field.proto_field_id, message);
-  return true;
-}
-
 bool SetBlocking(int fd, bool is_blocking) {
   int flags = fcntl(fd, F_GETFL, 0);
   flags = (is_blocking) ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK);
@@ -146,6 +110,131 @@ base::Optional<PageHeader> ParsePageHeader(const uint8_t** ptr,
   return base::make_optional(page_header);
 }
 
+// Walks the events of the raw ftrace page at |ptr| and invokes
+// |on_event(ftrace_event_id, timestamp, start, next)| for each data record,
+// where [start, next) is the payload of the record. Stops if |on_event|
+// returns false. Returns the number of bytes of the page consumed, or 0 if
+// the page is malformed. See CpuReader::ParsePage() for the page layout.
+template <typename F>
+size_t ForEachEventInPage(const uint8_t* ptr,
+                          const ProtoTranslationTable* table,
+                          uint32_t* overwrite_count,
+                          F on_event) {
+  const uint8_t* const start_of_page = ptr;
+  const uint8_t* const end_of_page = ptr + base::kPageSize;
+
+  auto page_header = ParsePageHeader(&ptr, table->page_header_size_len());
+  if (!page_header.has_value())
+    return 0;
+
+  // ParsePageHeader advances |ptr| to point past the end of the header.
+
+  *overwrite_count = static_cast<uint32_t>(page_header->overwrite);
+  const uint8_t* const end = ptr + page_header->size;
+  if (end > end_of_page)
+    return 0;
+
+  uint64_t timestamp = page_header->timestamp;
+
+  while (ptr < end) {
+    EventHeader event_header;
+    if (!CpuReader::ReadAndAdvance(&ptr, end, &event_header))
+      return 0;
+
+    timestamp += event_header.time_delta;
+
+    switch (event_header.type_or_length) {
+      case kTypePadding: {
+        // Left over page padding or discarded event.
+        if (event_header.time_delta == 0) {
+          // Not clear what the correct behaviour is in this case.
+          PERFETTO_DFATAL("Empty padding event.");
+          return 0;
+        }
+        uint32_t length;
+        if (!CpuReader::ReadAndAdvance<uint32_t>(&ptr, end, &length))
+          return 0;
+        ptr += length;
+        break;
+      }
+      case kTypeTimeExtend: {
+        // Extend the time delta.
+        uint32_t time_delta_ext;
+        if (!CpuReader::ReadAndAdvance<uint32_t>(&ptr, end, &time_delta_ext))
+          return 0;
+        // See https://goo.gl/CFBu5x
+        timestamp += (static_cast<uint64_t>(time_delta_ext)) << 27;
+        break;
+      }
+      case kTypeTimeStamp: {
+        // Sync time stamp with external clock.
+        TimeStamp time_stamp;
+        if (!CpuReader::ReadAndAdvance<TimeStamp>(&ptr, end, &time_stamp))
+          return 0;
+        // Not implemented in the kernel, nothing should generate this.
+        PERFETTO_DFATAL("Unimplemented in kernel. Should be unreachable.");
+        break;
+      }
+      // Data record:
+      default: {
+        PERFETTO_CHECK(event_header.type_or_length <= kTypeDataTypeLengthMax);
+        // type_or_length is <=28 so it represents the length of a data
+        // record. if == 0, this is an extended record and the size of the
+        // record is stored in the first uint32_t word in the payload. See
+        // Kernel's include/linux/ring_buffer.h
+        uint32_t event_size;
+        if (event_header.type_or_length == 0) {
+          if (!CpuReader::ReadAndAdvance<uint32_t>(&ptr, end, &event_size))
+            return 0;
+          // Size includes the size field itself.
+          if (event_size < 4)
+            return 0;
+          event_size -= 4;
+        } else {
+          event_size = 4 * event_header.type_or_length;
+        }
+        const uint8_t* start = ptr;
+        const uint8_t* next = ptr + event_size;
+
+        if (next > end)
+          return 0;
+
+        uint16_t ftrace_event_id;
+        if (!CpuReader::ReadAndAdvance<uint16_t>(&ptr, end, &ftrace_event_id))
+          return 0;
+        if (!on_event(ftrace_event_id, timestamp, start, next))
+          return 0;
+
+        // Jump to next event.
+        ptr = next;
+      }
+    }
+  }
+  return static_cast<size_t>(ptr - start_of_page);
+}
+
+using RawPageFormat = protos::pbzero::FtraceEventBundle_RawPageFormat;
+using RawPageFieldType =
+    protos::pbzero::FtraceEventBundle_RawPageFormat_FieldType;
+
+// The FieldType of RawPageFormat mirrors FtraceFieldType.
+static_assert(
+    static_cast<int>(kFtraceUint8) ==
+        protos::pbzero::FtraceEventBundle_RawPageFormat_FieldType_UINT8,
+    "RawPageFormat.FieldType out of sync");
+static_assert(
+    static_cast<int>(kFtraceDataLoc) ==
+        protos::pbzero::FtraceEventBundle_RawPageFormat_FieldType_DATA_LOC,
+    "RawPageFormat.FieldType out of sync");
+
+void WriteRawPageField(const Field& field, RawPageFormat::Field* out) {
+  out->set_name(field.ftrace_name);
+  out->set_type(static_cast<RawPageFieldType>(field.ftrace_type));
+  out->set_offset(field.ftrace_offset);
+  out->set_size(field.ftrace_size);
+  out->set_proto_field_id(field.proto_field_id);
+}
+
 }  // namespace
 
 using protos::pbzero::GenericFtraceEvent;
@@ -159,6 +248,9 @@ CpuReader::CpuReader(const ProtoTranslationTable* table,
       thread_sync_(thread_sync),
       cpu_(cpu),
       trace_fd_(std::move(fd)) {
+  // Drain() is called either on the main thread or on a drain worker.
+  PERFETTO_DETACH_FROM_THREAD(thread_checker_);
+
   // Make reads from the raw pipe blocking so that splice() can sleep.
   PERFETTO_CHECK(trace_fd_);
   PERFETTO_CHECK(SetBlocking(*trace_fd_, true));
@@ -356,21 +448,35 @@ void CpuReader::RunWorkerThread(size_t cpu,
         //   to happen if the system is under high load).
         // In all these cases the most useful thing we can do is skip the
         // current cycle and try again later.
-        if (read_ftrace_pipe(cur_mode, kBlock) <= 0)
+        int res = read_ftrace_pipe(cur_mode, kBlock);
+        if (res <= 0)
           break;  // Wait for next command.
 
+        // The FtraceController uses the bytes read in a cycle as an estimate
+        // of how full the kernel buffer got since the previous drain.
+        size_t bytes_read = static_cast<size_t>(res);
+
         // If we are in read mode (because of a previous flush) check if the
         // in-kernel read cursor is page-aligned again. If a non-blocking splice
         // succeeds, it means that we can safely switch back to splice mode
         // (See b/120188810).
-        if (cur_mode == kRead && read_ftrace_pipe(kSplice, kNonBlock) > 0)
-          cur_mode = kSplice;
+        if (cur_mode == kRead) {
+          res = read_ftrace_pipe(kSplice, kNonBlock);
+          if (res > 0) {
+            bytes_read += static_cast<size_t>(res);
+            cur_mode = kSplice;
+          }
+        }
 
         // Do as many non-blocking read/splice as we can.
-        while (read_ftrace_pipe(cur_mode, kNonBlock) > kRoughlyAPage) {
+        while ((res = read_ftrace_pipe(cur_mode, kNonBlock)) > 0) {
+          bytes_read += static_cast<size_t>(res);
+          if (res <= kRoughlyAPage)
+            break;
         }
         pool->CommitWrittenPages();
-        FtraceController::OnCpuReaderRead(cpu, generation, thread_sync);
+        FtraceController::OnCpuReaderRead(cpu, generation, thread_sync,
+                                          bytes_read);
         break;
       }
 
@@ -397,11 +503,48 @@ void CpuReader::RunWorkerThread(size_t cpu,
 #endif
 }
 
-// Invoked on the main thread by FtraceController, |drain_rate_ms| after the
-// first CPU wakes up from the blocking read()/splice().
-void CpuReader::Drain(const std::set<FtraceDataSource*>& data_sources) {
+CpuReader::FanOutScratch::FanOutScratch() : stream_(this) {}
+
+CpuReader::FanOutScratch::~FanOutScratch() = default;
+
+void CpuReader::FanOutScratch::Reset() {
+  // Allocated lazily, as it's needed only with more than one data source.
+  if (!memory_.IsValid()) {
+    memory_ =
+        base::PagedMemory::Allocate(kFanOutScratchSize + base::kPageSize);
+  }
+  uint8_t* begin = static_cast<uint8_t*>(memory_.Get());
+  stream_.Reset({begin, begin + kFanOutScratchSize});
+  events_.Reset(&stream_);
+  overflowed_ = false;
+  parsed_events_.clear();
+  sinks_enabled_.clear();
+  pids_.clear();
+  inodes_.clear();
+  event_metadata_.Clear();
+}
+
+protozero::ContiguousMemoryRange CpuReader::FanOutScratch::GetNewBuffer() {
+  // The last page of |memory_| is used only to discard the overflowing bytes.
+  overflowed_ = true;
+  uint8_t* discard_page =
+      static_cast<uint8_t*>(memory_.Get()) + kFanOutScratchSize;
+  return {discard_page, discard_page + base::kPageSize};
+}
+
+// Invoked by FtraceController, |drain_rate_ms| after the first CPU wakes up
+// from the blocking read()/splice(). This happens either on the main thread or,
+// on machines with many CPUs, on one of the controller's drain workers.
+void CpuReader::Drain(const std::set<FtraceDataSource*>& data_sources,
+                      size_t drain_worker) {
   PERFETTO_DCHECK_THREAD(thread_checker_);
-  PERFETTO_METATRACE("Drain(" + std::to_string(cpu_) + ")", kMainThread);
+
+  std::vector<TraceWriter::TracePacketHandle> packets;
+  std::vector<PageSink> sinks;
+  packets.reserve(data_sources.size());
+  sinks.reserve(data_sources.size());
+  if (compact_sched_buffers_.size() < data_sources.size())
+    compact_sched_buffers_.resize(data_sources.size());
 
   auto page_blocks = pool_.BeginRead();
   for (const auto& page_block : page_blocks) {
@@ -409,20 +552,51 @@ void CpuReader::Drain(const std::set<FtraceDataSource*>& data_sources) {
       const uint8_t* page = page_block.At(i);
 
       for (FtraceDataSource* data_source : data_sources) {
-        auto packet = data_source->trace_writer()->NewTracePacket();
-        auto* bundle = packet->set_ftrace_events();
-        auto* metadata = data_source->mutable_metadata();
-        auto* filter = data_source->event_filter();
+        packets.emplace_back(
+            data_source->trace_writer(drain_worker)->NewTracePacket());
+        auto* bundle = packets.back()->set_ftrace_events();
 
         // Note: The fastpath in proto_trace_parser.cc speculates on the fact
         // that the cpu field is the first field of the proto message. If this
         // changes, change proto_trace_parser.cc accordingly.
         bundle->set_cpu(static_cast<uint32_t>(cpu_));
 
-        size_t evt_size = ParsePage(page, filter, bundle, table_, metadata);
+        // Raw pages are copied as they are, the trace processor decodes them.
+        if (data_source->raw_pages()) {
+          if (data_source->OnRawPageBundle(drain_worker)) {
+            WriteRawPageFormat(table_, data_source->event_filter(),
+                               bundle->set_raw_page_format());
+          }
+          size_t raw_size = WriteRawPage(page, table_, bundle);
+          PERFETTO_DCHECK(raw_size);
+          continue;
+        }
+
+        if (data_source->config().raw_pages())
+          data_source->OnRawPageFallback(drain_worker);
+        CompactSchedBuffer* compact_sched =
+            data_source->config().compact_sched()
+                ? &compact_sched_buffers_[sinks.size()]
+                : nullptr;
+        sinks.push_back({data_source->event_filter(), bundle,
+                         data_source->mutable_metadata(drain_worker),
+                         compact_sched});
+      }
+
+      // With several data sources, parse the page only once for all of them.
+      if (!sinks.empty()) {
+        size_t evt_size =
+            sinks.size() == 1
+                ? ParsePage(page, sinks[0].filter, sinks[0].bundle, table_,
+                            sinks[0].metadata, sinks[0].compact_sched)
+                : ParsePageForSinks(page, sinks, table_, &fan_out_scratch_);
         PERFETTO_DCHECK(evt_size);
-        bundle->set_overwrite_count(metadata->overwrite_count);
       }
+
+      for (const PageSink& sink : sinks)
+        sink.bundle->set_overwrite_count(sink.metadata->overwrite_count);
+      sinks.clear();
+      packets.clear();
     }
   }
   pool_.EndRead(std::move(page_blocks));
@@ -440,102 +614,219 @@ size_t CpuReader::ParsePage(const uint8_t* ptr,
                             const EventFilter* filter,
                             FtraceEventBundle* bundle,
                             const ProtoTranslationTable* table,
-                            FtraceMetadata* metadata) {
-  const uint8_t* const start_of_page = ptr;
-  const uint8_t* const end_of_page = ptr + base::kPageSize;
+                            FtraceMetadata* metadata,
+                            CompactSchedBuffer* compact_sched) {
+  const CompactSchedFormat& compact_format = table->compact_sched_format();
+  size_t parsed_size = ForEachEventInPage(
+      ptr, table, &metadata->overwrite_count,
+      [filter, bundle, table, metadata, compact_sched, &compact_format](
+          uint16_t ftrace_event_id, uint64_t timestamp, const uint8_t* start,
+          const uint8_t* next) {
+        if (!filter->IsRecordEnabled(ftrace_event_id, start, next))
+          return true;
+        if (compact_sched &&
+            compact_format.IsCompactSchedEvent(ftrace_event_id)) {
+          return compact_sched->AppendEvent(compact_format, ftrace_event_id,
+                                            timestamp, start, next, metadata);
+        }
+        protos::pbzero::FtraceEvent* event = bundle->add_event();
+        event->set_timestamp(timestamp);
+        return ParseEvent(ftrace_event_id, start, next, table, event,
+                          metadata);
+      });
+  if (compact_sched)
+    compact_sched->WriteAndReset(bundle);
+  return parsed_size;
+}
 
+// static
+size_t CpuReader::WriteRawPage(const uint8_t* ptr,
+                               const ProtoTranslationTable* table,
+                               FtraceEventBundle* bundle) {
+  const uint8_t* const start_of_page = ptr;
   auto page_header = ParsePageHeader(&ptr, table->page_header_size_len());
   if (!page_header.has_value())
     return 0;
-
-  // ParsePageHeader advances |ptr| to point past the end of the header.
-
-  metadata->overwrite_count = static_cast<uint32_t>(page_header->overwrite);
-  const uint8_t* const end = ptr + page_header->size;
-  if (end > end_of_page)
+  size_t size = static_cast<size_t>(ptr - start_of_page) + page_header->size;
+  if (size > base::kPageSize)
     return 0;
+  bundle->add_raw_page(start_of_page, size);
+  return size;
+}
 
-  uint64_t timestamp = page_header->timestamp;
-
-  while (ptr < end) {
-    EventHeader event_header;
-    if (!ReadAndAdvance(&ptr, end, &event_header))
-      return 0;
-
-    timestamp += event_header.time_delta;
+// static
+void CpuReader::WriteRawPageFormat(const ProtoTranslationTable* table,
+                                   const EventFilter* filter,
+                                   RawPageFormat* format) {
+  format->set_page_header_size_len(table->page_header_size_len());
+  for (const Field& field : table->common_fields())
+    WriteRawPageField(field, format->add_common_field());
+  for (size_t id : filter->GetEnabledEvents()) {
+    const Event* event = table->GetEventById(id);
+    if (!event)
+      continue;
+    RawPageFormat::Event* out = format->add_event();
+    out->set_ftrace_event_id(event->ftrace_event_id);
+    out->set_name(event->name);
+    out->set_proto_field_id(event->proto_field_id);
+    for (const Field& field : event->fields)
+      WriteRawPageField(field, out->add_field());
+  }
+}
 
-    switch (event_header.type_or_length) {
-      case kTypePadding: {
-        // Left over page padding or discarded event.
-        if (event_header.time_delta == 0) {
-          // Not clear what the correct behaviour is in this case.
-          PERFETTO_DFATAL("Empty padding event.");
-          return 0;
+// static
+size_t CpuReader::ParsePageForSinks(const uint8_t* ptr,
+                                    const std::vector<PageSink>& sinks,
+                                    const ProtoTranslationTable* table,
+                                    FanOutScratch* scratch) {
+  scratch->Reset();
+  FtraceMetadata* event_metadata = &scratch->event_metadata_;
+  const CompactSchedFormat& compact_format = table->compact_sched_format();
+  uint32_t overwrite_count = 0;
+  size_t parsed_size = ForEachEventInPage(
+      ptr, table, &overwrite_count,
+      [&sinks, table, scratch, event_metadata, &compact_format](
+          uint16_t ftrace_event_id, uint64_t timestamp, const uint8_t* start,
+          const uint8_t* next) {
+        // The sched events of the sinks that want them in the compact form
+        // go straight into their buffers, they are not shared.
+        const bool is_compact_sched =
+            compact_format.IsCompactSchedEvent(ftrace_event_id);
+        bool enabled = false;
+        bool compact_success = true;
+        const size_t sinks_enabled_size = scratch->sinks_enabled_.size();
+        for (const PageSink& sink : sinks) {
+          bool sink_enabled =
+              sink.filter->IsRecordEnabled(ftrace_event_id, start, next);
+          if (sink_enabled && is_compact_sched && sink.compact_sched) {
+            compact_success &= sink.compact_sched->AppendEvent(
+                compact_format, ftrace_event_id, timestamp, start, next,
+                sink.metadata);
+            sink_enabled = false;
+          }
+          scratch->sinks_enabled_.push_back(sink_enabled);
+          enabled |= sink_enabled;
         }
-        uint32_t length;
-        if (!ReadAndAdvance<uint32_t>(&ptr, end, &length))
-          return 0;
-        ptr += length;
-        break;
-      }
-      case kTypeTimeExtend: {
-        // Extend the time delta.
-        uint32_t time_delta_ext;
-        if (!ReadAndAdvance<uint32_t>(&ptr, end, &time_delta_ext))
-          return 0;
-        // See https://goo.gl/CFBu5x
-        timestamp += (static_cast<uint64_t>(time_delta_ext)) << 27;
-        break;
-      }
-      case kTypeTimeStamp: {
-        // Sync time stamp with external clock.
-        TimeStamp time_stamp;
-        if (!ReadAndAdvance<TimeStamp>(&ptr, end, &time_stamp))
-          return 0;
-        // Not implemented in the kernel, nothing should generate this.
-        PERFETTO_DFATAL("Unimplemented in kernel. Should be unreachable.");
-        break;
-      }
-      // Data record:
-      default: {
-        PERFETTO_CHECK(event_header.type_or_length <= kTypeDataTypeLengthMax);
-        // type_or_length is <=28 so it represents the length of a data
-        // record. if == 0, this is an extended record and the size of the
-        // record is stored in the first uint32_t word in the payload. See
-        // Kernel's include/linux/ring_buffer.h
-        uint32_t event_size;
-        if (event_header.type_or_length == 0) {
-          if (!ReadAndAdvance<uint32_t>(&ptr, end, &event_size))
-            return 0;
-          // Size includes the size field itself.
-          if (event_size < 4)
-            return 0;
-          event_size -= 4;
-        } else {
-          event_size = 4 * event_header.type_or_length;
+        if (!enabled) {
+          scratch->sinks_enabled_.resize(sinks_enabled_size);
+          return compact_success;
         }
-        const uint8_t* start = ptr;
-        const uint8_t* next = ptr + event_size;
 
-        if (next > end)
-          return 0;
-
-        uint16_t ftrace_event_id;
-        if (!ReadAndAdvance<uint16_t>(&ptr, end, &ftrace_event_id))
-          return 0;
-        if (filter->IsEventEnabled(ftrace_event_id)) {
-          protos::pbzero::FtraceEvent* event = bundle->add_event();
-          event->set_timestamp(timestamp);
-          if (!ParseEvent(ftrace_event_id, start, next, table, event, metadata))
-            return 0;
-        }
+        auto* event =
+            scratch->events_.BeginNestedMessage<protos::pbzero::FtraceEvent>(
+                FtraceEventBundle::kEventFieldNumber);
+        event->set_timestamp(timestamp);
+        bool success = ParseEvent(ftrace_event_id, start, next, table, event,
+                                  event_metadata);
+
+        // Keep the metadata of each event separate, so that each sink gets
+        // only the one of the events it enables.
+        FanOutScratch::ParsedEvent parsed_event;
+        parsed_event.num_pids =
+            static_cast<uint32_t>(event_metadata->pids.size());
+        parsed_event.num_inodes =
+            static_cast<uint32_t>(event_metadata->inode_and_device.size());
+        scratch->parsed_events_.push_back(parsed_event);
+        scratch->pids_.insert(scratch->pids_.end(),
+                              event_metadata->pids.begin(),
+                              event_metadata->pids.end());
+        scratch->inodes_.insert(scratch->inodes_.end(),
+                                event_metadata->inode_and_device.begin(),
+                                event_metadata->inode_and_device.end());
+        event_metadata->Clear();
+        return success && compact_success;
+      });
+  scratch->events_.Finalize();
+
+  // Very verbose events (e.g. generic ones) might not fit in the scratch
+  // buffer. This is rare, just parse the page again for each sink.
+  if (scratch->overflowed_) {
+    for (const PageSink& sink : sinks) {
+      if (sink.compact_sched)
+        sink.compact_sched->Reset();
+      parsed_size = ParsePage(ptr, sink.filter, sink.bundle, table,
+                              sink.metadata, sink.compact_sched);
+    }
+    return parsed_size;
+  }
 
-        // Jump to next event.
-        ptr = next;
+  const uint8_t* const encoded = static_cast<uint8_t*>(scratch->memory_.Get());
+  const size_t encoded_size =
+      static_cast<size_t>(scratch->stream_.write_ptr() - encoded);
+  for (size_t i = 0; i < sinks.size(); i++) {
+    const PageSink& sink = sinks[i];
+    sink.metadata->overwrite_count = overwrite_count;
+    protozero::ProtoDecoder decoder(encoded, encoded_size);
+    const int32_t* pid = scratch->pids_.data();
+    const std::pair<Inode, BlockDeviceID>* inode = scratch->inodes_.data();
+    const uint8_t* sink_enabled = scratch->sinks_enabled_.data() + i;
+    for (size_t j = 0; j < scratch->parsed_events_.size();
+         j++, sink_enabled += sinks.size()) {
+      const FanOutScratch::ParsedEvent& parsed_event =
+          scratch->parsed_events_[j];
+      protozero::ProtoDecoder::Field field = decoder.ReadField();
+      PERFETTO_DCHECK(field.id == FtraceEventBundle::kEventFieldNumber);
+      const int32_t* const pids_end = pid + parsed_event.num_pids;
+      const auto* const inodes_end = inode + parsed_event.num_inodes;
+      if (!*sink_enabled) {
+        pid = pids_end;
+        inode = inodes_end;
+        continue;
       }
+      sink.bundle->AppendBytes(FtraceEventBundle::kEventFieldNumber,
+                               field.data(), field.size());
+      for (; pid < pids_end; pid++)
+        sink.metadata->AddPid(*pid);
+      sink.metadata->inode_and_device.insert(
+          sink.metadata->inode_and_device.end(), inode, inodes_end);
+      inode = inodes_end;
     }
+    if (sink.compact_sched)
+      sink.compact_sched->WriteAndReset(sink.bundle);
   }
-  return static_cast<size_t>(ptr - start_of_page);
+  return parsed_size;
+}
+
+// static
+bool CpuReader::ReadIntoString(const uint8_t* start,
+                               const uint8_t* end,
+                               uint32_t field_id,
+                               protozero::Message* out) {
+  for (const uint8_t* c = start; c < end; c++) {
+    if (*c != '\0')
+      continue;
+    out->AppendBytes(field_id, reinterpret_cast<const char*>(start),
+                     static_cast<uintptr_t>(c - start));
+    return true;
+  }
+  return false;
+}
+
+// static
+bool CpuReader::ReadDataLoc(const uint8_t* start,
+                            const uint8_t* field_start,
+                            const uint8_t* end,
+                            uint32_t field_id,
+                            protozero::Message* message) {
+  // See
+  // https://github.com/torvalds/linux/blob/master/include/trace/trace_events.h
+  uint32_t data = 0;
+  const uint8_t* ptr = field_start;
+  if (!ReadAndAdvance(&ptr, end, &data)) {
+    PERFETTO_DFATAL("Buffer overflowed.");
+    return false;
+  }
+
+  const uint16_t offset = data & 0xffff;
+  const uint16_t len = (data >> 16) & 0xffff;
+  const uint8_t* const string_start = start + offset;
+  const uint8_t* const string_end = string_start + len;
+  if (string_start <= start || string_end > end) {
+    PERFETTO_DFATAL("Buffer overflowed.");
+    return false;
+  }
+  ReadIntoString(string_start, string_end, field_id, message);
+  return true;
 }
 
 // |start| is the start of the current event.
@@ -560,8 +851,10 @@ bool CpuReader::ParseEvent(uint16_t ftrace_event_id,
   }
 
   bool success = true;
-  for (const Field& field : table->common_fields())
-    success &= ParseField(field, start, end, message, metadata);
+  for (const CompiledField& field : table->compiled_common_fields()) {
+    PERFETTO_DCHECK(start + field.ftrace_offset + field.ftrace_size <= end);
+    success &= field.translate(field, start, end, message, metadata);
+  }
 
   protozero::Message* nested =
       message->BeginNestedMessage<protozero::Message>(info.proto_field_id);
@@ -569,17 +862,24 @@ bool CpuReader::ParseEvent(uint16_t ftrace_event_id,
   // Parse generic event.
   if (info.proto_field_id == protos::pbzero::FtraceEvent::kGenericFieldNumber) {
     nested->AppendString(GenericFtraceEvent::kEventNameFieldNumber, info.name);
-    for (const Field& field : info.fields) {
+    const std::vector<CompiledField>& fields =
+        table->GetCompiledFields(ftrace_event_id);
+    PERFETTO_DCHECK(fields.size() == info.fields.size());
+    for (size_t i = 0; i < fields.size(); i++) {
+      const CompiledField& field = fields[i];
+      PERFETTO_DCHECK(start + field.ftrace_offset + field.ftrace_size <= end);
       auto generic_field = nested->BeginNestedMessage<protozero::Message>(
           GenericFtraceEvent::kFieldFieldNumber);
       // TODO(taylori): Avoid outputting field names every time.
       generic_field->AppendString(GenericFtraceEvent::Field::kNameFieldNumber,
-                                  field.ftrace_name);
-      success &= ParseField(field, start, end, generic_field, metadata);
+                                  info.fields[i].ftrace_name);
+      success &= field.translate(field, start, end, generic_field, metadata);
     }
   } else {  // Parse all other events.
-    for (const Field& field : info.fields) {
-      success &= ParseField(field, start, end, nested, metadata);
+    for (const CompiledField& field :
+         table->GetCompiledFields(ftrace_event_id)) {
+      PERFETTO_DCHECK(start + field.ftrace_offset + field.ftrace_size <= end);
+      success &= field.translate(field, start, end, nested, metadata);
     }
   }
 
@@ -589,89 +889,4 @@ bool CpuReader::ParseEvent(uint16_t ftrace_event_id,
   return success;
 }
 
-// Caller must guarantee that the field fits in the range,
-// explicitly: start + field.ftrace_offset + field.ftrace_size <= end
-// The only exception is fields with strategy = kCStringToString
-// where the total size isn't known up front. In this case ParseField
-// will check the string terminates in the bounds and won't read past |end|.
-bool CpuReader::ParseField(const Field& field,
-                           const uint8_t* start,
-                           const uint8_t* end,
-                           protozero::Message* message,
-                           FtraceMetadata* metadata) {
-  PERFETTO_DCHECK(start + field.ftrace_offset + field.ftrace_size <= end);
-  const uint8_t* field_start = start + field.ftrace_offset;
-  uint32_t field_id = field.proto_field_id;
-
-  switch (field.strategy) {
-    case kUint8ToUint32:
-    case kUint8ToUint64:
-      ReadIntoVarInt<uint8_t>(field_start, field_id, message);
-      return true;
-    case kUint16ToUint32:
-    case kUint16ToUint64:
-      ReadIntoVarInt<uint16_t>(field_start, field_id, message);
-      return true;
-    case kUint32ToUint32:
-    case kUint32ToUint64:
-      ReadIntoVarInt<uint32_t>(field_start, field_id, message);
-      return true;
-    case kUint64ToUint64:
-      ReadIntoVarInt<uint64_t>(field_start, field_id, message);
-      return true;
-    case kInt8ToInt32:
-    case kInt8ToInt64:
-      ReadIntoVarInt<int8_t>(field_start, field_id, message);
-      return true;
-    case kInt16ToInt32:
-    case kInt16ToInt64:
-      ReadIntoVarInt<int16_t>(field_start, field_id, message);
-      return true;
-    case kInt32ToInt32:
-    case kInt32ToInt64:
-      ReadIntoVarInt<int32_t>(field_start, field_id, message);
-      return true;
-    case kInt64ToInt64:
-      ReadIntoVarInt<int64_t>(field_start, field_id, message);
-      return true;
-    case kFixedCStringToString:
-      // TODO(hjd): Add AppendMaxLength string to protozero.
-      return ReadIntoString(field_start, field_start + field.ftrace_size,
-                            field_id, message);
-    case kCStringToString:
-      // TODO(hjd): Kernel-dive to check this how size:0 char fields work.
-      return ReadIntoString(field_start, end, field.proto_field_id, message);
-    case kStringPtrToString:
-      // TODO(hjd): Figure out how to read these.
-      return true;
-    case kDataLocToString:
-      return ReadDataLoc(start, field_start, end, field, message);
-    case kBoolToUint32:
-    case kBoolToUint64:
-      ReadIntoVarInt<uint8_t>(field_start, field_id, message);
-      return true;
-    case kInode32ToUint64:
-      ReadInode<uint32_t>(field_start, field_id, message, metadata);
-      return true;
-    case kInode64ToUint64:
-      ReadInode<uint64_t>(field_start, field_id, message, metadata);
-      return true;
-    case kPid32ToInt32:
-    case kPid32ToInt64:
-      ReadPid(field_start, field_id, message, metadata);
-      return true;
-    case kCommonPid32ToInt32:
-    case kCommonPid32ToInt64:
-      ReadCommonPid(field_start, field_id, message, metadata);
-      return true;
-    case kDevId32ToUint64:
-      ReadDevId<uint32_t>(field_start, field_id, message, metadata);
-      return true;
-    case kDevId64ToUint64:
-      ReadDevId<uint64_t>(field_start, field_id, message, metadata);
-      return true;
-  }
-  PERFETTO_FATAL("Not reached");  // For gcc
-}
-
 }  // namespace perfetto
@@ -25,6 +25,8 @@
 #include <memory>
 #include <set>
 #include <thread>
+#include <utility>
+#include <vector>
 
 #include "perfetto/base/gtest_prod_util.h"
 #include "perfetto/base/paged_memory.h"
@@ -33,7 +35,9 @@
 #include "perfetto/base/thread_checker.h"
 #include "perfetto/protozero/message.h"
 #include "perfetto/protozero/message_handle.h"
+#include "perfetto/protozero/scattered_stream_writer.h"
 #include "perfetto/traced/data_source_types.h"
+#include "src/traced/probes/ftrace/compact_sched.h"
 #include "src/traced/probes/ftrace/ftrace_config.h"
 #include "src/traced/probes/ftrace/ftrace_metadata.h"
 #include "src/traced/probes/ftrace/page_pool.h"
@@ -48,6 +52,7 @@ class ProtoTranslationTable;
 namespace protos {
 namespace pbzero {
 class FtraceEventBundle;
+class FtraceEventBundle_RawPageFormat;
 }  // namespace pbzero
 }  // namespace protos
 
@@ -58,6 +63,56 @@ class CpuReader {
  public:
   using FtraceEventBundle = protos::pbzero::FtraceEventBundle;
 
+  // One of the destinations of the events of a page in ParsePageForSinks(),
+  // i.e. the bundle of a data source and its filter and metadata.
+  // |compact_sched| is null unless the data source asked for the compact
+  // encoding of the sched events.
+  struct PageSink {
+    const EventFilter* filter;
+    FtraceEventBundle* bundle;
+    FtraceMetadata* metadata;
+    CompactSchedBuffer* compact_sched;
+  };
+
+  // Scratch space used by ParsePageForSinks() to encode the events of a page
+  // only once. It is reused across pages to avoid allocations.
+  class FanOutScratch : public protozero::ScatteredStreamWriter::Delegate {
+   public:
+    FanOutScratch();
+    ~FanOutScratch() override;
+
+    // ScatteredStreamWriter::Delegate implementation. Called only when the
+    // encoded events don't fit in the scratch buffer: the rest of the page is
+    // written into a throwaway page and the page is parsed again for each
+    // sink.
+    protozero::ContiguousMemoryRange GetNewBuffer() override;
+
+   private:
+    friend class CpuReader;
+
+    struct ParsedEvent {
+      uint32_t num_pids;
+      uint32_t num_inodes;
+    };
+
+    void Reset();
+
+    base::PagedMemory memory_;
+    bool overflowed_ = false;
+    protozero::ScatteredStreamWriter stream_;
+    protozero::Message events_;
+    std::vector<ParsedEvent> parsed_events_;
+
+    // For each event of |parsed_events_|, whether each sink (in order) gets
+    // it as a FtraceEvent. Not a vector<bool>, to avoid the bit twiddling.
+    std::vector<uint8_t> sinks_enabled_;
+
+    // The metadata of the events in |parsed_events_|, in the same order.
+    FtraceMetadata event_metadata_;
+    std::vector<int32_t> pids_;
+    std::vector<std::pair<Inode, BlockDeviceID>> inodes_;
+  };
+
   CpuReader(const ProtoTranslationTable*,
             FtraceThreadSync*,
             size_t cpu,
@@ -65,8 +120,13 @@ class CpuReader {
             base::ScopedFile fd);
   ~CpuReader();
 
-  // Drains all available data into the buffer of the passed data sources.
-  void Drain(const std::set<FtraceDataSource*>&);
+  size_t cpu() const { return cpu_; }
+
+  // Drains all available data into the buffer of the passed data sources,
+  // using the writers of the given drain worker (see
+  // FtraceDataSource::trace_writer()). The same CpuReader must always be
+  // drained on the same thread.
+  void Drain(const std::set<FtraceDataSource*>&, size_t drain_worker = 0);
 
   void InterruptWorkerThreadWithSignal();
 
@@ -130,6 +190,22 @@ class CpuReader {
     metadata->AddCommonPid(pid);
   }
 
+  // Appends the null terminated string starting at |start| as |field_id|.
+  // Returns false if the string is not terminated before |end|.
+  static bool ReadIntoString(const uint8_t* start,
+                             const uint8_t* end,
+                             uint32_t field_id,
+                             protozero::Message* out);
+
+  // Appends the __data_loc string whose 32 bit descriptor (offset and length
+  // of the string in the record) is at |field_start| in the record [start,
+  // end) as |field_id|.
+  static bool ReadDataLoc(const uint8_t* start,
+                          const uint8_t* field_start,
+                          const uint8_t* end,
+                          uint32_t field_id,
+                          protozero::Message* message);
+
   // Internally the kernel stores device ids in a different layout to that
   // exposed to userspace via stat etc. There's no userspace function to convert
   // between the formats so we have to do it ourselves.
@@ -153,11 +229,39 @@ class CpuReader {
   // run time (e.g. field offset and size) information necessary to do this.
   // The table is initialized once at start time by the ftrace controller
   // which passes it to the CpuReader which passes it here.
+  // If |compact_sched| is not null, the sched_switch and sched_wakeup events
+  // are accumulated there and written into the bundle in the compact form.
   static size_t ParsePage(const uint8_t* ptr,
                           const EventFilter*,
                           protos::pbzero::FtraceEventBundle*,
                           const ProtoTranslationTable* table,
-                          FtraceMetadata*);
+                          FtraceMetadata*,
+                          CompactSchedBuffer* compact_sched = nullptr);
+
+  // Writes the raw ftrace page at |ptr|, i.e. its header and the data
+  // committed in it, into the raw_page field of |bundle|, for the trace
+  // processor to decode. Returns the number of bytes written, or 0 if the
+  // page header is malformed.
+  static size_t WriteRawPage(const uint8_t* ptr,
+                             const ProtoTranslationTable* table,
+                             protos::pbzero::FtraceEventBundle* bundle);
+
+  // Writes the layout of the raw pages and of the events enabled by |filter|,
+  // which the trace processor needs to decode the pages written by
+  // WriteRawPage().
+  static void WriteRawPageFormat(
+      const ProtoTranslationTable* table,
+      const EventFilter* filter,
+      protos::pbzero::FtraceEventBundle_RawPageFormat* format);
+
+  // Like calling ParsePage() for each of the |sinks|, but decodes each event
+  // of the page only once: the events enabled by at least one of the sinks are
+  // encoded into |scratch| and then copied into the bundle of each sink whose
+  // filter enables them. Used when more than one data source is active.
+  static size_t ParsePageForSinks(const uint8_t* ptr,
+                                  const std::vector<PageSink>& sinks,
+                                  const ProtoTranslationTable* table,
+                                  FanOutScratch* scratch);
 
   // Parse a single raw ftrace event beginning at |start| and ending at |end|
   // and write it into the provided bundle as a proto.
@@ -173,12 +277,6 @@ class CpuReader {
                          protozero::Message* message,
                          FtraceMetadata* metadata);
 
-  static bool ParseField(const Field& field,
-                         const uint8_t* start,
-                         const uint8_t* end,
-                         protozero::Message* message,
-                         FtraceMetadata* metadata);
-
  private:
   static void RunWorkerThread(size_t cpu,
                               int generation,
@@ -194,6 +292,8 @@ class CpuReader {
   FtraceThreadSync* const thread_sync_;
   const size_t cpu_;
   PagePool pool_;
+  FanOutScratch fan_out_scratch_;
+  std::vector<CompactSchedBuffer> compact_sched_buffers_;
   base::ScopedFile trace_fd_;
   std::thread worker_thread_;
   PERFETTO_THREAD_CHECKER(thread_checker_)
@@ -12,11 +12,19 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+#include <utility>
+#include <vector>
+
 #include "benchmark/benchmark.h"
 
 #include "src/traced/probes/ftrace/cpu_reader.h"
 #include "src/traced/probes/ftrace/proto_translation_table.h"
 
+#include "perfetto/base/thread_pool.h"
 #include "perfetto/base/utils.h"
 #include "perfetto/protozero/scattered_stream_null_delegate.h"
 #include "perfetto/protozero/scattered_stream_writer.h"
@@ -324,3 +332,323 @@ static void BM_ParsePageFullOfSchedSwitch(benchmark::State& state) {
   }
 }
 BENCHMARK(BM_ParsePageFullOfSchedSwitch);
+
+namespace {
+
+enum class SchedEncoding { kEvents, kCompact };
+
+// Like BM_ParsePageFullOfSchedSwitch, either into FtraceEvent(s) or into the
+// compact encoding of FtraceConfig.compact_sched. The bundle_bytes counter is
+// the size of the bundle emitted for the page.
+template <SchedEncoding encoding>
+void BM_ParsePageSchedEncoding(benchmark::State& state) {
+  const ExamplePage* test_case = &g_full_page_sched_switch;
+
+  ScatteredStreamWriterNullDelegate delegate(perfetto::base::kPageSize);
+  ScatteredStreamWriter stream(&delegate);
+  FtraceEventBundle writer;
+
+  ProtoTranslationTable* table = GetTable(test_case->name);
+  auto page = PageFromXxd(test_case->data);
+
+  EventFilter filter;
+  filter.AddEnabledEvent(
+      table->EventToFtraceId(GroupAndName("sched", "sched_switch")));
+
+  FtraceMetadata metadata{};
+  perfetto::CompactSchedBuffer compact_sched;
+  perfetto::CompactSchedBuffer* compact_sched_ptr =
+      encoding == SchedEncoding::kCompact ? &compact_sched : nullptr;
+  uint32_t bundle_size = 0;
+  while (state.KeepRunning()) {
+    writer.Reset(&stream);
+    CpuReader::ParsePage(page.get(), &filter, &writer, table, &metadata,
+                         compact_sched_ptr);
+    bundle_size = writer.Finalize();
+    metadata.Clear();
+  }
+  state.counters["bundle_bytes"] = benchmark::Counter(bundle_size);
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(perfetto::base::kPageSize));
+}
+
+}  // namespace
+
+BENCHMARK_TEMPLATE(BM_ParsePageSchedEncoding, SchedEncoding::kEvents);
+BENCHMARK_TEMPLATE(BM_ParsePageSchedEncoding, SchedEncoding::kCompact);
+
+namespace {
+
+// Appends to |page| a data record with the given |payload|, which must be a
+// multiple of 4 bytes long, see the kernel's include/linux/ring_buffer.h.
+void AppendRecord(const std::vector<uint8_t>& payload,
+                  uint32_t time_delta,
+                  std::vector<uint8_t>* page) {
+  PERFETTO_CHECK(payload.size() % 4 == 0 && payload.size() <= 4 * 28);
+  uint32_t header = static_cast<uint32_t>(payload.size() / 4) | time_delta << 5;
+  const uint8_t* header_ptr = reinterpret_cast<const uint8_t*>(&header);
+  page->insert(page->end(), header_ptr, header_ptr + sizeof(header));
+  page->insert(page->end(), payload.begin(), payload.end());
+}
+
+template <typename T>
+void Put(std::vector<uint8_t>* payload, size_t offset, T value) {
+  memcpy(payload->data() + offset, &value, sizeof(T));
+}
+
+// Returns the payload of an event of the "synthetic" table: the common fields
+// followed by |size| - 8 bytes for the fields of the event.
+std::vector<uint8_t> MakePayload(const ProtoTranslationTable* table,
+                                 const char* group,
+                                 const char* name,
+                                 size_t size,
+                                 int32_t pid) {
+  std::vector<uint8_t> payload(size);
+  Put(&payload, 0,
+      static_cast<uint16_t>(table->EventToFtraceId(GroupAndName(group, name))));
+  Put(&payload, 4, pid);
+  return payload;
+}
+
+// Builds a page with a mix of events, in proportions typical of a trace:
+// sched_switch, sys_enter/sys_exit pairs, rss_stat counters and userspace
+// trace markers (print).
+std::unique_ptr<uint8_t[]> MakeMixedEventsPage(
+    const ProtoTranslationTable* table) {
+  constexpr size_t kPageHeaderSize = 16;
+  std::vector<uint8_t> data;
+  for (int32_t i = 0;; i++) {
+    int32_t pid = 1000 + i % 7;
+    std::vector<std::vector<uint8_t>> records;
+
+    auto sched_switch = MakePayload(table, "sched", "sched_switch", 64, pid);
+    memcpy(&sched_switch[8], "RenderThread", 13);
+    Put(&sched_switch, 24, pid);
+    Put<int32_t>(&sched_switch, 28, 120);
+    Put<int64_t>(&sched_switch, 32, 1);
+    memcpy(&sched_switch[40], "surfaceflinger", 15);
+    Put<int32_t>(&sched_switch, 56, pid + 1);
+    Put<int32_t>(&sched_switch, 60, 110);
+    records.push_back(sched_switch);
+
+    auto sys_enter = MakePayload(table, "raw_syscalls", "sys_enter", 64, pid);
+    Put<int64_t>(&sys_enter, 8, 63);
+    for (size_t arg = 0; arg < 6; arg++)
+      Put<uint64_t>(&sys_enter, 16 + arg * 8, 0x7fff0000 + arg);
+    records.push_back(sys_enter);
+
+    auto sys_exit = MakePayload(table, "raw_syscalls", "sys_exit", 24, pid);
+    Put<int64_t>(&sys_exit, 8, 63);
+    Put<int64_t>(&sys_exit, 16, 4096);
+    records.push_back(sys_exit);
+
+    auto rss_stat = MakePayload(table, "kmem", "rss_stat", 24, pid);
+    Put<int32_t>(&rss_stat, 8, 1);
+    Put<int64_t>(&rss_stat, 16, 123456789);
+    records.push_back(rss_stat);
+
+    auto print = MakePayload(table, "ftrace", "print", 44, pid);
+    Put<uint64_t>(&print, 8, 0xffffff8000001234ull);
+    memcpy(&print[16], "B|1234|RenderThread::draw\n", 27);
+    records.push_back(print);
+
+    for (const auto& record : records) {
+      if (kPageHeaderSize + data.size() + 4 + record.size() >
+          perfetto::base::kPageSize) {
+        std::unique_ptr<uint8_t[]> page(
+            new uint8_t[perfetto::base::kPageSize]());
+        uint64_t timestamp = 1234567890;
+        uint64_t commit = data.size();
+        memcpy(&page[0], &timestamp, sizeof(timestamp));
+        memcpy(&page[8], &commit, sizeof(commit));
+        memcpy(&page[kPageHeaderSize], data.data(), data.size());
+        return page;
+      }
+      AppendRecord(record, 1000, &data);
+    }
+  }
+}
+
+// Like BM_ParsePageFullOfSchedSwitch, but for a page with a mix of events
+// which have different layouts.
+void BM_ParsePageMixedEvents(benchmark::State& state) {
+  ProtoTranslationTable* table = GetTable("synthetic");
+  auto page = MakeMixedEventsPage(table);
+
+  ScatteredStreamWriterNullDelegate delegate(perfetto::base::kPageSize);
+  ScatteredStreamWriter stream(&delegate);
+  FtraceEventBundle writer;
+
+  EventFilter filter;
+  for (const auto& event : {std::make_pair("sched", "sched_switch"),
+                            std::make_pair("raw_syscalls", "sys_enter"),
+                            std::make_pair("raw_syscalls", "sys_exit"),
+                            std::make_pair("kmem", "rss_stat"),
+                            std::make_pair("ftrace", "print")}) {
+    filter.AddEnabledEvent(
+        table->EventToFtraceId(GroupAndName(event.first, event.second)));
+  }
+
+  FtraceMetadata metadata{};
+  while (state.KeepRunning()) {
+    writer.Reset(&stream);
+    CpuReader::ParsePage(page.get(), &filter, &writer, table, &metadata);
+    metadata.Clear();
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(perfetto::base::kPageSize));
+}
+
+}  // namespace
+
+BENCHMARK(BM_ParsePageMixedEvents);
+
+namespace {
+
+// The state of each drain worker: its own output stream and metadata, like the
+// per-worker TraceWriter(s) and FtraceMetadata of the FtraceDataSource(s).
+class DrainWorkerState {
+ public:
+  DrainWorkerState()
+      : delegate_(perfetto::base::kPageSize), stream_(&delegate_) {}
+
+  void DrainPages(const uint8_t* page,
+                  size_t num_pages,
+                  const EventFilter* filter,
+                  const ProtoTranslationTable* table) {
+    for (size_t i = 0; i < num_pages; i++) {
+      bundle_.Reset(&stream_);
+      CpuReader::ParsePage(page, filter, &bundle_, table, &metadata_);
+      bundle_.Finalize();
+    }
+    metadata_.Clear();
+  }
+
+ private:
+  ScatteredStreamWriterNullDelegate delegate_;
+  ScatteredStreamWriter stream_;
+  FtraceEventBundle bundle_;
+  FtraceMetadata metadata_;
+};
+
+enum class DrainMode { kMainThread, kWorkers };
+
+// End-to-end throughput of draining |state.range(0)| CPUs, each with a batch of
+// pages full of sched_switch events, either serially on the calling thread or
+// in parallel on a pool of workers, each one draining a group of CPUs (like
+// FtraceController on machines with many CPUs).
+template <DrainMode mode>
+void BM_DrainCpus(benchmark::State& state) {
+  constexpr size_t kPagesPerCpu = 32;
+  constexpr size_t kCpusPerWorker = 8;
+  constexpr size_t kMaxWorkers = 8;
+  const size_t num_cpus = static_cast<size_t>(state.range(0));
+  const size_t num_workers =
+      mode == DrainMode::kMainThread
+          ? 1
+          : std::min(kMaxWorkers,
+                     (num_cpus + kCpusPerWorker - 1) / kCpusPerWorker);
+
+  const ExamplePage* test_case = &g_full_page_sched_switch;
+  ProtoTranslationTable* table = GetTable(test_case->name);
+  auto page = PageFromXxd(test_case->data);
+  EventFilter filter;
+  filter.AddEnabledEvent(
+      table->EventToFtraceId(GroupAndName("sched", "sched_switch")));
+
+  std::vector<std::unique_ptr<DrainWorkerState>> workers;
+  for (size_t i = 0; i < num_workers; i++)
+    workers.emplace_back(new DrainWorkerState());
+  std::unique_ptr<perfetto::base::ThreadPool> pool;
+  if (mode == DrainMode::kWorkers)
+    pool.reset(new perfetto::base::ThreadPool(num_workers));
+
+  while (state.KeepRunning()) {
+    if (!pool) {
+      for (size_t cpu = 0; cpu < num_cpus; cpu++)
+        workers[0]->DrainPages(page.get(), kPagesPerCpu, &filter, table);
+      continue;
+    }
+    for (size_t cpu = 0; cpu < num_cpus; cpu++) {
+      DrainWorkerState* worker = workers[cpu % num_workers].get();
+      const uint8_t* page_ptr = page.get();
+      pool->PostTask(cpu % num_workers, [worker, page_ptr, &filter, table] {
+        worker->DrainPages(page_ptr, kPagesPerCpu, &filter, table);
+      });
+    }
+    pool->WaitIdle();
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(num_cpus * kPagesPerCpu *
+                                               perfetto::base::kPageSize));
+}
+
+}  // namespace
+
+BENCHMARK_TEMPLATE(BM_DrainCpus, DrainMode::kMainThread)
+    ->Arg(8)
+    ->Arg(32)
+    ->Arg(96)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_DrainCpus, DrainMode::kWorkers)
+    ->Arg(8)
+    ->Arg(32)
+    ->Arg(96)
+    ->UseRealTime();
+
+namespace {
+
+enum class FanOutMode { kParsePerSession, kParseOnce };
+
+// Parses a page full of sched_switch events for |state.range(0)| concurrent
+// tracing sessions, either parsing the page again for each session or only
+// once for all of them (like CpuReader::Drain() does).
+template <FanOutMode mode>
+void BM_ParsePageForSessions(benchmark::State& state) {
+  const size_t num_sessions = static_cast<size_t>(state.range(0));
+
+  const ExamplePage* test_case = &g_full_page_sched_switch;
+  ProtoTranslationTable* table = GetTable(test_case->name);
+  auto page = PageFromXxd(test_case->data);
+  EventFilter filter;
+  filter.AddEnabledEvent(
+      table->EventToFtraceId(GroupAndName("sched", "sched_switch")));
+
+  ScatteredStreamWriterNullDelegate delegate(perfetto::base::kPageSize);
+  ScatteredStreamWriter stream(&delegate);
+  std::vector<FtraceEventBundle> bundles(num_sessions);
+  std::vector<FtraceMetadata> metadata(num_sessions);
+  std::vector<CpuReader::PageSink> sinks;
+  for (size_t i = 0; i < num_sessions; i++)
+    sinks.push_back({&filter, &bundles[i], &metadata[i], nullptr});
+  CpuReader::FanOutScratch scratch;
+
+  while (state.KeepRunning()) {
+    for (FtraceEventBundle& bundle : bundles)
+      bundle.Reset(&stream);
+    if (mode == FanOutMode::kParseOnce && num_sessions > 1) {
+      CpuReader::ParsePageForSinks(page.get(), sinks, table, &scratch);
+    } else {
+      for (const CpuReader::PageSink& sink : sinks)
+        CpuReader::ParsePage(page.get(), sink.filter, sink.bundle, table,
+                             sink.metadata);
+    }
+    for (size_t i = 0; i < num_sessions; i++) {
+      bundles[i].Finalize();
+      metadata[i].Clear();
+    }
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(perfetto::base::kPageSize));
+}
+
+}  // namespace
+
+BENCHMARK_TEMPLATE(BM_ParsePageForSessions, FanOutMode::kParsePerSession)
+    ->Arg(1)
+    ->Arg(2)
+    ->Arg(4);
+BENCHMARK_TEMPLATE(BM_ParsePageForSessions, FanOutMode::kParseOnce)
+    ->Arg(1)
+    ->Arg(2)
+    ->Arg(4);
@@ -16,8 +16,14 @@
 
 #include "src/traced/probes/ftrace/cpu_reader.h"
 
+#include <string.h>
 #include <sys/stat.h>
 
+#include <algorithm>
+#include <memory>
+#include <set>
+#include <vector>
+
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "src/traced/probes/ftrace/event_info.h"
@@ -35,6 +41,7 @@
 #include "perfetto/trace/ftrace/ftrace_event_bundle.pbzero.h"
 #include "src/traced/probes/ftrace/ftrace_procfs.h"
 #include "src/traced/probes/ftrace/test/cpu_reader_support.h"
+#include "src/traced/probes/ftrace/test/page_generator.h"
 #include "src/traced/probes/ftrace/test/test_messages.pb.h"
 #include "src/traced/probes/ftrace/test/test_messages.pbzero.h"
 
@@ -175,6 +182,140 @@ class BinaryWriter {
   uint8_t* ptr_;
 };
 
+template <typename T>
+void Put(std::vector<uint8_t>* payload, size_t offset, T value) {
+  memcpy(payload->data() + offset, &value, sizeof(T));
+}
+
+void PutString(std::vector<uint8_t>* payload, size_t offset, const char* s) {
+  memcpy(payload->data() + offset, s, strlen(s) + 1);
+}
+
+// Appends a data record with the given payload to the |data| of a page.
+void AppendRecord(const std::vector<uint8_t>& payload,
+                  uint32_t time_delta,
+                  std::vector<uint8_t>* data) {
+  PERFETTO_CHECK(payload.size() % 4 == 0 && payload.size() <= 4 * 28);
+  uint32_t header = static_cast<uint32_t>(payload.size() / 4) | time_delta << 5;
+  const uint8_t* header_ptr = reinterpret_cast<const uint8_t*>(&header);
+  data->insert(data->end(), header_ptr, header_ptr + sizeof(header));
+  data->insert(data->end(), payload.begin(), payload.end());
+}
+
+// Returns a page of the "synthetic" table with a sched_wakeup, a sched_switch
+// and a print event in turn, from a few threads.
+std::unique_ptr<uint8_t[]> MakeSchedPage(const ProtoTranslationTable* table) {
+  const char* const kComms[] = {"surfaceflinger", "RenderThread",
+                                "kworker/0:1"};
+  const uint16_t sched_wakeup_id = static_cast<uint16_t>(
+      table->EventToFtraceId(GroupAndName("sched", "sched_wakeup")));
+  const uint16_t sched_switch_id = static_cast<uint16_t>(
+      table->EventToFtraceId(GroupAndName("sched", "sched_switch")));
+  const uint16_t print_id = static_cast<uint16_t>(
+      table->EventToFtraceId(GroupAndName("ftrace", "print")));
+
+  std::vector<uint8_t> data;
+  for (int32_t i = 0; i < 25; i++) {
+    const int32_t pid = 100 + i % 3;
+    const int32_t next_pid = 100 + (i + 1) % 3;
+
+    std::vector<uint8_t> wakeup(40);
+    Put(&wakeup, 0, sched_wakeup_id);
+    Put(&wakeup, 4, pid);
+    PutString(&wakeup, 8, kComms[(i + 1) % 3]);
+    Put<int32_t>(&wakeup, 24, next_pid);
+    Put<int32_t>(&wakeup, 28, 120);
+    Put<int32_t>(&wakeup, 32, 1);
+    Put<int32_t>(&wakeup, 36, i % 4);
+    AppendRecord(wakeup, 1000, &data);
+
+    std::vector<uint8_t> sched_switch(64);
+    Put(&sched_switch, 0, sched_switch_id);
+    Put(&sched_switch, 4, pid);
+    PutString(&sched_switch, 8, kComms[i % 3]);
+    Put<int32_t>(&sched_switch, 24, pid);
+    Put<int32_t>(&sched_switch, 28, 120);
+    Put<int64_t>(&sched_switch, 32, i % 2);
+    PutString(&sched_switch, 40, kComms[(i + 1) % 3]);
+    Put<int32_t>(&sched_switch, 56, next_pid);
+    Put<int32_t>(&sched_switch, 60, 110 + i % 3);
+    AppendRecord(sched_switch, 500 + static_cast<uint32_t>(i), &data);
+
+    std::vector<uint8_t> print(24);
+    Put(&print, 0, print_id);
+    Put(&print, 4, next_pid);
+    Put<uint64_t>(&print, 8, 0x1234);
+    PutString(&print, 16, "hello\n");
+    AppendRecord(print, 200, &data);
+  }
+
+  std::unique_ptr<uint8_t[]> page(new uint8_t[base::kPageSize]());
+  const uint64_t timestamp = 1000000;
+  const uint64_t commit = data.size();
+  PERFETTO_CHECK(16 + commit <= base::kPageSize);
+  memcpy(&page[0], &timestamp, sizeof(timestamp));
+  memcpy(&page[8], &commit, sizeof(commit));
+  memcpy(&page[16], data.data(), data.size());
+  return page;
+}
+
+// Returns the events of |bundle|, with the ones in its compact_sched expanded
+// back into FtraceEvent(s), in timestamp order.
+std::vector<protos::FtraceEvent> ExpandCompactSched(
+    const protos::FtraceEventBundle& bundle) {
+  std::vector<protos::FtraceEvent> events(bundle.event().begin(),
+                                          bundle.event().end());
+  const auto& compact = bundle.compact_sched();
+  uint64_t timestamp = 0;
+  for (int i = 0; i < compact.switch_timestamp_size(); i++) {
+    protos::FtraceEvent event;
+    timestamp += compact.switch_timestamp(i);
+    event.set_timestamp(timestamp);
+    event.set_pid(static_cast<uint32_t>(compact.switch_prev_pid(i)));
+    auto* sched_switch = event.mutable_sched_switch();
+    sched_switch->set_prev_comm(compact.intern_table(
+        static_cast<int>(compact.switch_prev_comm_index(i))));
+    sched_switch->set_prev_pid(compact.switch_prev_pid(i));
+    sched_switch->set_prev_prio(compact.switch_prev_prio(i));
+    sched_switch->set_prev_state(compact.switch_prev_state(i));
+    sched_switch->set_next_comm(compact.intern_table(
+        static_cast<int>(compact.switch_next_comm_index(i))));
+    sched_switch->set_next_pid(compact.switch_next_pid(i));
+    sched_switch->set_next_prio(compact.switch_next_prio(i));
+    events.push_back(event);
+  }
+  timestamp = 0;
+  for (int i = 0; i < compact.wakeup_timestamp_size(); i++) {
+    protos::FtraceEvent event;
+    timestamp += compact.wakeup_timestamp(i);
+    event.set_timestamp(timestamp);
+    event.set_pid(static_cast<uint32_t>(compact.wakeup_common_pid(i)));
+    auto* sched_wakeup = event.mutable_sched_wakeup();
+    sched_wakeup->set_comm(
+        compact.intern_table(static_cast<int>(compact.wakeup_comm_index(i))));
+    sched_wakeup->set_pid(compact.wakeup_pid(i));
+    sched_wakeup->set_prio(compact.wakeup_prio(i));
+    sched_wakeup->set_success(1);
+    sched_wakeup->set_target_cpu(compact.wakeup_target_cpu(i));
+    events.push_back(event);
+  }
+  std::stable_sort(events.begin(), events.end(),
+                   [](const protos::FtraceEvent& a,
+                      const protos::FtraceEvent& b) {
+                     return a.timestamp() < b.timestamp();
+                   });
+  return events;
+}
+
+void ExpectSameEvents(const std::vector<protos::FtraceEvent>& events,
+                      const protos::FtraceEventBundle& expected) {
+  ASSERT_EQ(events.size(), static_cast<size_t>(expected.event().size()));
+  for (size_t i = 0; i < events.size(); i++) {
+    EXPECT_EQ(events[i].SerializeAsString(),
+              expected.event(static_cast<int>(i)).SerializeAsString());
+  }
+}
+
 }  // namespace
 
 TEST(PageFromXxdTest, OneLine) {
@@ -1778,4 +1919,317 @@ TEST(CpuReaderTest, ParseExt4WithOverwrite) {
   EXPECT_EQ(metadata.overwrite_count, 192ul);
 }
 
+TEST(CpuReaderTest, ParsePageForSinksMatchesParsePage) {
+  const ExamplePage* test_case = &g_full_page_sched_switch;
+
+  ProtoTranslationTable* table = GetTable(test_case->name);
+  auto page = PageFromXxd(test_case->data);
+  size_t sched_switch_id =
+      table->EventToFtraceId(GroupAndName("sched", "sched_switch"));
+  size_t print_id = table->EventToFtraceId(GroupAndName("ftrace", "print"));
+
+  // Overlapping filters, the events of the last one are not in the page.
+  EventFilter filters[3];
+  filters[0].AddEnabledEvent(sched_switch_id);
+  filters[1].AddEnabledEvent(sched_switch_id);
+  filters[1].AddEnabledEvent(print_id);
+  filters[2].AddEnabledEvent(print_id);
+
+  std::vector<std::unique_ptr<BundleProvider>> providers;
+  std::vector<FtraceMetadata> metadata(3);
+  std::vector<CpuReader::PageSink> sinks;
+  for (size_t i = 0; i < 3; i++) {
+    providers.emplace_back(new BundleProvider(base::kPageSize));
+    sinks.push_back({&filters[i], providers[i]->writer(), &metadata[i],
+                     nullptr});
+  }
+
+  CpuReader::FanOutScratch scratch;
+  ASSERT_TRUE(
+      CpuReader::ParsePageForSinks(page.get(), sinks, table, &scratch));
+
+  for (size_t i = 0; i < 3; i++) {
+    BundleProvider expected_provider(base::kPageSize);
+    FtraceMetadata expected_metadata{};
+    ASSERT_TRUE(CpuReader::ParsePage(page.get(), &filters[i],
+                                     expected_provider.writer(), table,
+                                     &expected_metadata));
+
+    auto bundle = providers[i]->ParseProto();
+    auto expected_bundle = expected_provider.ParseProto();
+    ASSERT_TRUE(bundle);
+    ASSERT_TRUE(expected_bundle);
+    EXPECT_EQ(bundle->event().size(), expected_bundle->event().size());
+    EXPECT_EQ(bundle->SerializeAsString(),
+              expected_bundle->SerializeAsString());
+    EXPECT_EQ(metadata[i].overwrite_count, expected_metadata.overwrite_count);
+    EXPECT_EQ(metadata[i].pids, expected_metadata.pids);
+    EXPECT_EQ(metadata[i].inode_and_device,
+              expected_metadata.inode_and_device);
+  }
+  EXPECT_EQ(providers[0]->ParseProto()->event().size(), 59);
+  EXPECT_EQ(providers[1]->ParseProto()->event().size(), 59);
+  EXPECT_EQ(providers[2]->ParseProto()->event().size(), 0);
+  EXPECT_FALSE(metadata[0].pids.empty());
+  EXPECT_TRUE(metadata[2].pids.empty());
+}
+
+TEST(CpuReaderTest, ParseSchedSwitchCompact) {
+  const ExamplePage* test_case = &g_full_page_sched_switch;
+
+  ProtoTranslationTable* table = GetTable(test_case->name);
+  auto page = PageFromXxd(test_case->data);
+  EventFilter filter;
+  filter.AddEnabledEvent(
+      table->EventToFtraceId(GroupAndName("sched", "sched_switch")));
+
+  BundleProvider expected_provider(base::kPageSize);
+  FtraceMetadata expected_metadata{};
+  ASSERT_TRUE(CpuReader::ParsePage(page.get(), &filter,
+                                   expected_provider.writer(), table,
+                                   &expected_metadata));
+
+  BundleProvider bundle_provider(base::kPageSize);
+  FtraceMetadata metadata{};
+  CompactSchedBuffer compact_sched;
+  ASSERT_TRUE(CpuReader::ParsePage(page.get(), &filter,
+                                   bundle_provider.writer(), table, &metadata,
+                                   &compact_sched));
+  EXPECT_TRUE(compact_sched.empty());
+
+  auto bundle = bundle_provider.ParseProto();
+  auto expected_bundle = expected_provider.ParseProto();
+  ASSERT_TRUE(bundle);
+  ASSERT_TRUE(expected_bundle);
+  EXPECT_EQ(bundle->event().size(), 0);
+  const auto& compact = bundle->compact_sched();
+  EXPECT_EQ(compact.switch_timestamp().size(), 59);
+  EXPECT_EQ(compact.switch_next_comm_index().size(), 59);
+  EXPECT_EQ(compact.wakeup_timestamp().size(), 0);
+  EXPECT_LT(compact.intern_table().size(), 59);
+  ExpectSameEvents(ExpandCompactSched(*bundle), *expected_bundle);
+  EXPECT_EQ(metadata.pids, expected_metadata.pids);
+  EXPECT_LT(bundle->ByteSize(), expected_bundle->ByteSize() / 2);
+}
+
+TEST(CpuReaderTest, ParseSchedWakeupCompact) {
+  ProtoTranslationTable* table = GetTable("synthetic");
+  auto page = MakeSchedPage(table);
+  EventFilter filter;
+  filter.AddEnabledEvent(
+      table->EventToFtraceId(GroupAndName("sched", "sched_switch")));
+  filter.AddEnabledEvent(
+      table->EventToFtraceId(GroupAndName("sched", "sched_wakeup")));
+  filter.AddEnabledEvent(
+      table->EventToFtraceId(GroupAndName("ftrace", "print")));
+
+  BundleProvider expected_provider(base::kPageSize);
+  FtraceMetadata expected_metadata{};
+  ASSERT_TRUE(CpuReader::ParsePage(page.get(), &filter,
+                                   expected_provider.writer(), table,
+                                   &expected_metadata));
+
+  BundleProvider bundle_provider(base::kPageSize);
+  FtraceMetadata metadata{};
+  CompactSchedBuffer compact_sched;
+  ASSERT_TRUE(CpuReader::ParsePage(page.get(), &filter,
+                                   bundle_provider.writer(), table, &metadata,
+                                   &compact_sched));
+
+  auto bundle = bundle_provider.ParseProto();
+  auto expected_bundle = expected_provider.ParseProto();
+  ASSERT_TRUE(bundle);
+  ASSERT_TRUE(expected_bundle);
+
+  // Only the print events are left as FtraceEvent(s).
+  EXPECT_EQ(bundle->event().size(), 25);
+  const auto& compact = bundle->compact_sched();
+  EXPECT_EQ(compact.switch_timestamp().size(), 25);
+  EXPECT_EQ(compact.wakeup_timestamp().size(), 25);
+  EXPECT_EQ(compact.wakeup_target_cpu().size(), 25);
+  EXPECT_EQ(compact.intern_table().size(), 3);
+  ExpectSameEvents(ExpandCompactSched(*bundle), *expected_bundle);
+  EXPECT_EQ(metadata.pids, expected_metadata.pids);
+}
+
+TEST(CpuReaderTest, ParsePageForSinksWithCompactSched) {
+  ProtoTranslationTable* table = GetTable("synthetic");
+  auto page = MakeSchedPage(table);
+  size_t sched_switch_id =
+      table->EventToFtraceId(GroupAndName("sched", "sched_switch"));
+  size_t sched_wakeup_id =
+      table->EventToFtraceId(GroupAndName("sched", "sched_wakeup"));
+  size_t print_id = table->EventToFtraceId(GroupAndName("ftrace", "print"));
+
+  // Same events, with and without the compact encoding, and a compact sink
+  // with a subset of them.
+  EventFilter filters[3];
+  for (size_t i = 0; i < 2; i++) {
+    filters[i].AddEnabledEvent(sched_switch_id);
+    filters[i].AddEnabledEvent(sched_wakeup_id);
+    filters[i].AddEnabledEvent(print_id);
+  }
+  filters[2].AddEnabledEvent(sched_switch_id);
+  const bool compact[3] = {true, false, true};
+
+  std::vector<std::unique_ptr<BundleProvider>> providers;
+  std::vector<FtraceMetadata> metadata(3);
+  CompactSchedBuffer compact_sched[3];
+  std::vector<CpuReader::PageSink> sinks;
+  for (size_t i = 0; i < 3; i++) {
+    providers.emplace_back(new BundleProvider(base::kPageSize));
+    sinks.push_back({&filters[i], providers[i]->writer(), &metadata[i],
+                     compact[i] ? &compact_sched[i] : nullptr});
+  }
+
+  CpuReader::FanOutScratch scratch;
+  ASSERT_TRUE(
+      CpuReader::ParsePageForSinks(page.get(), sinks, table, &scratch));
+
+  for (size_t i = 0; i < 3; i++) {
+    BundleProvider expected_provider(base::kPageSize);
+    FtraceMetadata expected_metadata{};
+    CompactSchedBuffer expected_compact_sched;
+    ASSERT_TRUE(CpuReader::ParsePage(
+        page.get(), &filters[i], expected_provider.writer(), table,
+        &expected_metadata, compact[i] ? &expected_compact_sched : nullptr));
+
+    auto bundle = providers[i]->ParseProto();
+    auto expected_bundle = expected_provider.ParseProto();
+    ASSERT_TRUE(bundle);
+    ASSERT_TRUE(expected_bundle);
+    EXPECT_EQ(bundle->has_compact_sched(), compact[i]);
+    EXPECT_EQ(bundle->SerializeAsString(),
+              expected_bundle->SerializeAsString());
+    // The compact sinks get the pids of their sched events first.
+    EXPECT_EQ(std::set<int32_t>(metadata[i].pids.begin(),
+                                metadata[i].pids.end()),
+              std::set<int32_t>(expected_metadata.pids.begin(),
+                                expected_metadata.pids.end()));
+  }
+  EXPECT_EQ(providers[0]->ParseProto()->event().size(), 25);
+  EXPECT_EQ(providers[1]->ParseProto()->event().size(), 75);
+  EXPECT_EQ(providers[2]->ParseProto()->event().size(), 0);
+}
+
+TEST(CpuReaderTest, WriteRawPage) {
+  ProtoTranslationTable* table = GetTable("synthetic");
+  auto page = MakeSchedPage(table);
+  size_t sched_switch_id =
+      table->EventToFtraceId(GroupAndName("sched", "sched_switch"));
+  size_t print_id = table->EventToFtraceId(GroupAndName("ftrace", "print"));
+  EventFilter filter;
+  filter.AddEnabledEvent(sched_switch_id);
+  filter.AddEnabledEvent(print_id);
+
+  BundleProvider bundle_provider(base::kPageSize * 2);
+  CpuReader::WriteRawPageFormat(
+      table, &filter, bundle_provider.writer()->set_raw_page_format());
+  size_t size =
+      CpuReader::WriteRawPage(page.get(), table, bundle_provider.writer());
+
+  uint64_t commit;
+  memcpy(&commit, &page[8], sizeof(commit));
+  EXPECT_EQ(size, 16 + commit);
+
+  auto bundle = bundle_provider.ParseProto();
+  ASSERT_TRUE(bundle);
+  EXPECT_EQ(bundle->event().size(), 0);
+  ASSERT_EQ(bundle->raw_page().size(), 1);
+  EXPECT_EQ(bundle->raw_page(0),
+            std::string(reinterpret_cast<const char*>(page.get()), size));
+
+  const auto& format = bundle->raw_page_format();
+  EXPECT_EQ(format.page_header_size_len(), table->page_header_size_len());
+  ASSERT_EQ(static_cast<size_t>(format.common_field().size()),
+            table->common_fields().size());
+  EXPECT_EQ(format.common_field(0).name(),
+            table->common_fields()[0].ftrace_name);
+  std::set<uint32_t> ids;
+  for (const auto& event : format.event()) {
+    ids.insert(event.ftrace_event_id());
+    const Event* table_event = table->GetEventById(event.ftrace_event_id());
+    ASSERT_TRUE(table_event);
+    EXPECT_EQ(event.name(), table_event->name);
+    EXPECT_EQ(event.proto_field_id(), table_event->proto_field_id);
+    ASSERT_EQ(static_cast<size_t>(event.field().size()),
+              table_event->fields.size());
+    for (int i = 0; i < event.field().size(); i++) {
+      const Field& field = table_event->fields[static_cast<size_t>(i)];
+      EXPECT_EQ(event.field(i).name(), field.ftrace_name);
+      EXPECT_EQ(event.field(i).offset(), field.ftrace_offset);
+      EXPECT_EQ(event.field(i).size(), field.ftrace_size);
+      EXPECT_EQ(event.field(i).type(), static_cast<int>(field.ftrace_type));
+      EXPECT_EQ(event.field(i).proto_field_id(), field.proto_field_id);
+    }
+  }
+  EXPECT_EQ(ids, std::set<uint32_t>({static_cast<uint32_t>(sched_switch_id),
+                                     static_cast<uint32_t>(print_id)}));
+
+  // A page whose header claims more data than fits in a page is not written.
+  uint64_t bad_commit = base::kPageSize;
+  memcpy(&page[8], &bad_commit, sizeof(bad_commit));
+  BundleProvider bad_provider(base::kPageSize);
+  EXPECT_EQ(CpuReader::WriteRawPage(page.get(), table, bad_provider.writer()),
+            0u);
+}
+
+// The pages of the PageGenerator, used by the benchmarks, must parse like the
+// ones of the kernel: every data record becomes an event, the time extends
+// and discarded events are skipped.
+TEST(CpuReaderTest, ParseGeneratedPages) {
+  ProtoTranslationTable* table =
+      GetTable("android_walleye_OPM5.171019.017.A1_4.4.88");
+  PageGenerator::Options options = PageGenerator::DefaultOptions();
+  options.idle_one_in = 20;
+  options.padding_one_in = 20;
+  PageGenerator generator(table, options, /*seed=*/42);
+  EventFilter filter;
+  for (const PageGenerator::EventWeight& event : options.events)
+    filter.AddEnabledEvent(
+        table->EventToFtraceId(GroupAndName(event.group, event.name)));
+
+  int events = 0;
+  uint64_t last_timestamp = 0;
+  bool has_time_extend = false;
+  std::set<std::string> event_types;
+  for (size_t i = 0; i < 16; i++) {
+    auto page = generator.GeneratePage();
+    uint64_t commit;
+    memcpy(&commit, &page[8], sizeof(commit));
+    BundleProvider bundle_provider(base::kPageSize * 2);
+    FtraceMetadata metadata{};
+    ASSERT_EQ(CpuReader::ParsePage(page.get(), &filter,
+                                   bundle_provider.writer(), table, &metadata),
+              16 + commit);
+    auto bundle = bundle_provider.ParseProto();
+    ASSERT_TRUE(bundle);
+    for (const auto& event : bundle->event()) {
+      ASSERT_GT(event.timestamp(), last_timestamp);
+      has_time_extend |= event.timestamp() - last_timestamp > (1u << 27);
+      last_timestamp = event.timestamp();
+      if (event.has_print()) {
+        EXPECT_THAT(event.print().buf(), EndsWith("\n"));
+        event_types.insert("print");
+      } else if (event.has_irq_handler_entry()) {
+        EXPECT_FALSE(event.irq_handler_entry().name().empty());
+        event_types.insert("irq_handler_entry");
+      } else if (event.has_sched_switch()) {
+        EXPECT_NE(event.sched_switch().next_pid(), 0);
+        EXPECT_FALSE(event.sched_switch().next_comm().empty());
+        event_types.insert("sched_switch");
+      } else if (event.has_block_rq_issue()) {
+        EXPECT_FALSE(event.block_rq_issue().cmd().empty());
+        event_types.insert("block_rq_issue");
+      }
+    }
+    events += bundle->event().size();
+  }
+  EXPECT_EQ(static_cast<size_t>(events), generator.events());
+  EXPECT_TRUE(has_time_extend);
+  EXPECT_EQ(event_types,
+            std::set<std::string>({"print", "irq_handler_entry",
+                                   "sched_switch", "block_rq_issue"}));
+}
+
 }  // namespace perfetto
@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/ftrace/field_translation.h"
+
+#include "perfetto/base/logging.h"
+#include "src/traced/probes/ftrace/cpu_reader.h"
+#include "src/traced/probes/ftrace/ftrace_metadata.h"
+
+namespace perfetto {
+
+namespace {
+
+// One function per way of translating a field, each one specialized for the
+// type of the field.
+
+template <typename T>
+bool TranslateVarInt(const CompiledField& field,
+                     const uint8_t* start,
+                     const uint8_t*,
+                     protozero::Message* message,
+                     FtraceMetadata*) {
+  CpuReader::ReadIntoVarInt<T>(start + field.ftrace_offset,
+                               field.proto_field_id, message);
+  return true;
+}
+
+template <typename T>
+bool TranslateInode(const CompiledField& field,
+                    const uint8_t* start,
+                    const uint8_t*,
+                    protozero::Message* message,
+                    FtraceMetadata* metadata) {
+  CpuReader::ReadInode<T>(start + field.ftrace_offset, field.proto_field_id,
+                          message, metadata);
+  return true;
+}
+
+template <typename T>
+bool TranslateDevId(const CompiledField& field,
+                    const uint8_t* start,
+                    const uint8_t*,
+                    protozero::Message* message,
+                    FtraceMetadata* metadata) {
+  CpuReader::ReadDevId<T>(start + field.ftrace_offset, field.proto_field_id,
+                          message, metadata);
+  return true;
+}
+
+bool TranslatePid(const CompiledField& field,
+                  const uint8_t* start,
+                  const uint8_t*,
+                  protozero::Message* message,
+                  FtraceMetadata* metadata) {
+  CpuReader::ReadPid(start + field.ftrace_offset, field.proto_field_id,
+                     message, metadata);
+  return true;
+}
+
+bool TranslateCommonPid(const CompiledField& field,
+                        const uint8_t* start,
+                        const uint8_t*,
+                        protozero::Message* message,
+                        FtraceMetadata* metadata) {
+  CpuReader::ReadCommonPid(start + field.ftrace_offset, field.proto_field_id,
+                           message, metadata);
+  return true;
+}
+
+bool TranslateFixedCString(const CompiledField& field,
+                           const uint8_t* start,
+                           const uint8_t*,
+                           protozero::Message* message,
+                           FtraceMetadata*) {
+  // TODO(hjd): Add AppendMaxLength string to protozero.
+  const uint8_t* field_start = start + field.ftrace_offset;
+  return CpuReader::ReadIntoString(field_start, field_start + field.ftrace_size,
+                                   field.proto_field_id, message);
+}
+
+bool TranslateCString(const CompiledField& field,
+                      const uint8_t* start,
+                      const uint8_t* end,
+                      protozero::Message* message,
+                      FtraceMetadata*) {
+  // TODO(hjd): Kernel-dive to check this how size:0 char fields work.
+  return CpuReader::ReadIntoString(start + field.ftrace_offset, end,
+                                   field.proto_field_id, message);
+}
+
+bool TranslateDataLoc(const CompiledField& field,
+                      const uint8_t* start,
+                      const uint8_t* end,
+                      protozero::Message* message,
+                      FtraceMetadata*) {
+  return CpuReader::ReadDataLoc(start, start + field.ftrace_offset, end,
+                                field.proto_field_id, message);
+}
+
+bool SkipField(const CompiledField&,
+               const uint8_t*,
+               const uint8_t*,
+               protozero::Message*,
+               FtraceMetadata*) {
+  // TODO(hjd): Figure out how to read these.
+  return true;
+}
+
+CompiledField::TranslateFn GetTranslateFn(TranslationStrategy strategy) {
+  switch (strategy) {
+    case kUint8ToUint32:
+    case kUint8ToUint64:
+    case kBoolToUint32:
+    case kBoolToUint64:
+      return &TranslateVarInt<uint8_t>;
+    case kUint16ToUint32:
+    case kUint16ToUint64:
+      return &TranslateVarInt<uint16_t>;
+    case kUint32ToUint32:
+    case kUint32ToUint64:
+      return &TranslateVarInt<uint32_t>;
+    case kUint64ToUint64:
+      return &TranslateVarInt<uint64_t>;
+    case kInt8ToInt32:
+    case kInt8ToInt64:
+      return &TranslateVarInt<int8_t>;
+    case kInt16ToInt32:
+    case kInt16ToInt64:
+      return &TranslateVarInt<int16_t>;
+    case kInt32ToInt32:
+    case kInt32ToInt64:
+      return &TranslateVarInt<int32_t>;
+    case kInt64ToInt64:
+      return &TranslateVarInt<int64_t>;
+    case kFixedCStringToString:
+      return &TranslateFixedCString;
+    case kCStringToString:
+      return &TranslateCString;
+    case kStringPtrToString:
+      return &SkipField;
+    case kDataLocToString:
+      return &TranslateDataLoc;
+    case kInode32ToUint64:
+      return &TranslateInode<uint32_t>;
+    case kInode64ToUint64:
+      return &TranslateInode<uint64_t>;
+    case kPid32ToInt32:
+    case kPid32ToInt64:
+      return &TranslatePid;
+    case kCommonPid32ToInt32:
+    case kCommonPid32ToInt64:
+      return &TranslateCommonPid;
+    case kDevId32ToUint64:
+      return &TranslateDevId<uint32_t>;
+    case kDevId64ToUint64:
+      return &TranslateDevId<uint64_t>;
+  }
+  PERFETTO_FATAL("Not reached");  // For gcc
+}
+
+}  // namespace
+
+CompiledField CompileField(const Field& field) {
+  PERFETTO_DCHECK(field.strategy != kDataLocToString ||
+                  field.ftrace_size == 4);
+  CompiledField compiled;
+  compiled.translate = GetTranslateFn(field.strategy);
+  compiled.ftrace_offset = field.ftrace_offset;
+  compiled.ftrace_size = field.ftrace_size;
+  compiled.proto_field_id = field.proto_field_id;
+  return compiled;
+}
+
+}  // namespace perfetto
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACED_PROBES_FTRACE_FIELD_TRANSLATION_H_
+#define SRC_TRACED_PROBES_FTRACE_FIELD_TRANSLATION_H_
+
+#include <stdint.h>
+
+#include "src/traced/probes/ftrace/event_info_constants.h"
+
+namespace protozero {
+class Message;
+}  // namespace protozero
+
+namespace perfetto {
+
+struct FtraceMetadata;
+
+// A Field of an event compiled into a direct call to the function that
+// translates it from the raw ftrace record into the proto. The function is
+// picked once, when the ProtoTranslationTable is built, so that parsing an
+// event is a straight loop over its compiled fields rather than a switch over
+// the TranslationStrategy of each of them for every event.
+struct CompiledField {
+  // Translates the field of the raw record [start, end) into |message|.
+  // Returns false if the record is malformed. The caller must guarantee that
+  // the field fits in the record, but for the kCStringToString fields, whose
+  // size isn't known up front: those are checked to end within it.
+  using TranslateFn = bool (*)(const CompiledField&,
+                               const uint8_t* start,
+                               const uint8_t* end,
+                               protozero::Message* message,
+                               FtraceMetadata* metadata);
+
+  TranslateFn translate;
+  uint16_t ftrace_offset;
+  uint16_t ftrace_size;
+  uint32_t proto_field_id;
+};
+
+// Returns the compiled form of |field|, whose |strategy| must have been set.
+CompiledField CompileField(const Field& field);
+
+}  // namespace perfetto
+
+#endif  // SRC_TRACED_PROBES_FTRACE_FIELD_TRANSLATION_H_
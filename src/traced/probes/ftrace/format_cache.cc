@@ -0,0 +1,284 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/ftrace/format_cache.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+#include "perfetto/base/file_utils.h"
+#include "perfetto/base/logging.h"
+#include "perfetto/base/scoped_file.h"
+#include "perfetto/base/utils.h"
+#include "src/traced/probes/ftrace/ftrace_procfs.h"
+
+namespace perfetto {
+
+namespace {
+
+constexpr uint32_t kMagic = 0x43465450;  // "PTFC".
+// Bump when changing the encoding below.
+constexpr uint32_t kVersion = 1;
+
+// All the integers are in host byte order: the cache is only ever read back
+// by the same device. Strings are prefixed by their size.
+class Writer {
+ public:
+  explicit Writer(std::string* out) : out_(out) {}
+
+  template <typename T>
+  void Write(T value) {
+    out_->append(reinterpret_cast<const char*>(&value), sizeof(T));
+  }
+
+  void WriteString(const std::string& str) {
+    Write<uint32_t>(static_cast<uint32_t>(str.size()));
+    out_->append(str);
+  }
+
+  void WriteFields(const std::vector<FtraceEvent::Field>& fields) {
+    Write<uint32_t>(static_cast<uint32_t>(fields.size()));
+    for (const FtraceEvent::Field& field : fields) {
+      WriteString(field.type_and_name);
+      Write<uint16_t>(field.offset);
+      Write<uint16_t>(field.size);
+      Write<uint8_t>(field.is_signed);
+    }
+  }
+
+ private:
+  std::string* const out_;
+};
+
+class Reader {
+ public:
+  explicit Reader(const std::string& data)
+      : ptr_(data.data()), end_(data.data() + data.size()) {}
+
+  template <typename T>
+  bool Read(T* value) {
+    if (static_cast<size_t>(end_ - ptr_) < sizeof(T))
+      return false;
+    memcpy(value, ptr_, sizeof(T));
+    ptr_ += sizeof(T);
+    return true;
+  }
+
+  bool ReadString(std::string* str) {
+    uint32_t size;
+    if (!Read(&size) || static_cast<size_t>(end_ - ptr_) < size)
+      return false;
+    str->assign(ptr_, size);
+    ptr_ += size;
+    return true;
+  }
+
+  bool ReadFields(std::vector<FtraceEvent::Field>* fields) {
+    uint32_t count;
+    if (!Read(&count))
+      return false;
+    fields->clear();
+    for (uint32_t i = 0; i < count; i++) {
+      FtraceEvent::Field field{};
+      uint8_t is_signed;
+      if (!ReadString(&field.type_and_name) || !Read(&field.offset) ||
+          !Read(&field.size) || !Read(&is_signed)) {
+        return false;
+      }
+      // CpuReader trusts the fields to be within the records, which can't be
+      // larger than a page.
+      if (static_cast<size_t>(field.offset) + field.size > base::kPageSize)
+        return false;
+      field.is_signed = is_signed;
+      fields->push_back(std::move(field));
+    }
+    return true;
+  }
+
+  bool at_end() const { return ptr_ == end_; }
+
+ private:
+  const char* ptr_;
+  const char* const end_;
+};
+
+// Returns true if |dir| is a directory, not a symlink, owned by the current
+// user and accessible only by them: nobody else can plant or replace the cache
+// file in it.
+bool IsPrivateDirectory(const std::string& dir) {
+  struct stat st;
+  return lstat(dir.c_str(), &st) == 0 && S_ISDIR(st.st_mode) &&
+         st.st_uid == geteuid() && (st.st_mode & 077) == 0;
+}
+
+bool ReadPrivateFile(const std::string& path, std::string* out) {
+  base::ScopedFile fd = base::OpenFile(path, O_RDONLY | O_NOFOLLOW);
+  struct stat st;
+  if (!fd || fstat(*fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+      st.st_uid != geteuid() || (st.st_mode & 077) != 0) {
+    return false;
+  }
+  return base::ReadFileDescriptor(*fd, out);
+}
+
+}  // namespace
+
+FormatCache::FormatCache(const FtraceProcfs* ftrace_procfs,
+                         std::string path,
+                         std::string kernel_key)
+    : ftrace_procfs_(ftrace_procfs),
+      path_(std::move(path)),
+      kernel_key_(std::move(kernel_key)) {
+  if (path_.empty())
+    return;
+  size_t slash = path_.rfind('/');
+  if (slash == std::string::npos ||
+      !IsPrivateDirectory(path_.substr(0, slash))) {
+    PERFETTO_ELOG("Caching the ftrace formats only in memory, %s is not in a "
+                  "private directory",
+                  path_.c_str());
+    path_.clear();
+    return;
+  }
+  std::string data;
+  if (!ReadPrivateFile(path_, &data))
+    return;
+  if (!Deserialize(data, kernel_key_, &formats_)) {
+    PERFETTO_DLOG("Ignoring the ftrace format cache %s", path_.c_str());
+    formats_.clear();
+  }
+}
+
+FormatCache::~FormatCache() = default;
+
+// static
+std::string FormatCache::GetKernelKey() {
+  struct utsname uts {};
+  if (uname(&uts) != 0)
+    return "";
+  return std::string(uts.sysname) + "\n" + uts.release + "\n" + uts.version +
+         "\n" + uts.machine;
+}
+
+bool FormatCache::GetEventFormat(const std::string& group,
+                                 const std::string& name,
+                                 FtraceEvent* out) {
+  std::string key = group + "/" + name;
+  auto it = formats_.find(key);
+  if (it != formats_.end()) {
+    uint32_t id = ftrace_procfs_->ReadEventId(group, name);
+    if (id && id == it->second.id) {
+      hits_++;
+      *out = it->second;
+      return true;
+    }
+    formats_.erase(it);
+    dirty_ = true;
+  }
+
+  misses_++;
+  std::string contents = ftrace_procfs_->ReadEventFormat(group, name);
+  FtraceEvent event{};
+  if (contents.empty() || !ParseFtraceEvent(contents, &event))
+    return false;
+  *out = event;
+  formats_.emplace(std::move(key), std::move(event));
+  dirty_ = true;
+  return true;
+}
+
+bool FormatCache::Save() {
+  if (path_.empty() || !dirty_)
+    return true;
+  std::string data = Serialize(kernel_key_, formats_);
+
+  // Write a new file and move it over the old one, so that a traced_probes
+  // crashing half way through never leaves a truncated cache behind. The new
+  // file is created exclusively (mode 0600) and rename() replaces the old one
+  // without following it, should it be a symlink.
+  std::string tmp_path = path_ + ".XXXXXX";
+  base::ScopedFile fd(mkstemp(&tmp_path[0]));
+  if (!fd) {
+    PERFETTO_DPLOG("Failed to create %s", tmp_path.c_str());
+    return false;
+  }
+  if (base::WriteAll(*fd, data.data(), data.size()) !=
+          static_cast<ssize_t>(data.size()) ||
+      rename(tmp_path.c_str(), path_.c_str()) != 0) {
+    PERFETTO_DPLOG("Failed to write the ftrace format cache %s",
+                   path_.c_str());
+    unlink(tmp_path.c_str());
+    return false;
+  }
+  dirty_ = false;
+  return true;
+}
+
+// static
+std::string FormatCache::Serialize(
+    const std::string& kernel_key,
+    const std::map<std::string, FtraceEvent>& formats) {
+  std::string data;
+  Writer writer(&data);
+  writer.Write<uint32_t>(kMagic);
+  writer.Write<uint32_t>(kVersion);
+  writer.WriteString(kernel_key);
+  writer.Write<uint32_t>(static_cast<uint32_t>(formats.size()));
+  for (const auto& key_and_format : formats) {
+    const FtraceEvent& format = key_and_format.second;
+    writer.WriteString(key_and_format.first);
+    writer.WriteString(format.name);
+    writer.Write<uint32_t>(format.id);
+    writer.WriteFields(format.common_fields);
+    writer.WriteFields(format.fields);
+  }
+  return data;
+}
+
+// static
+bool FormatCache::Deserialize(const std::string& data,
+                              const std::string& kernel_key,
+                              std::map<std::string, FtraceEvent>* formats) {
+  Reader reader(data);
+  uint32_t magic;
+  uint32_t version;
+  std::string cached_kernel_key;
+  uint32_t count;
+  if (!reader.Read(&magic) || magic != kMagic || !reader.Read(&version) ||
+      version != kVersion || !reader.ReadString(&cached_kernel_key) ||
+      cached_kernel_key != kernel_key || !reader.Read(&count)) {
+    return false;
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    std::string key;
+    FtraceEvent format{};
+    if (!reader.ReadString(&key) || !reader.ReadString(&format.name) ||
+        !reader.Read(&format.id) || !reader.ReadFields(&format.common_fields) ||
+        !reader.ReadFields(&format.fields)) {
+      return false;
+    }
+    (*formats)[key] = std::move(format);
+  }
+  return reader.at_end();
+}
+
+}  // namespace perfetto
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACED_PROBES_FTRACE_FORMAT_CACHE_H_
+#define SRC_TRACED_PROBES_FTRACE_FORMAT_CACHE_H_
+
+#include <stddef.h>
+
+#include <map>
+#include <string>
+
+#include "src/traced/probes/ftrace/format_parser.h"
+
+namespace perfetto {
+
+class FtraceProcfs;
+
+// Caches the parsed format files of the ftrace events in a file, so that
+// traced_probes doesn't read and parse them again from tracefs when it
+// restarts or after a reboot. On some devices reading the format files of all
+// the events ProtoTranslationTable knows takes seconds.
+//
+// The file is keyed by the kernel build (see GetKernelKey()): the formats
+// cached by another kernel are ignored. The ids of the events of kernel modules
+// can still change from a boot to the other, so a cached format is used only
+// if the id of the event in tracefs, a much cheaper read than its format,
+// still matches.
+class FormatCache {
+ public:
+  // Loads the formats cached in |path|, if written for |kernel_key|. The
+  // directory of |path| must be owned by the current user and not accessible
+  // by the others, otherwise, as with an empty |path|, the formats are only
+  // cached in memory.
+  FormatCache(const FtraceProcfs*, std::string path, std::string kernel_key);
+  ~FormatCache();
+
+  // Returns the sysname, release, version and machine from uname(2).
+  static std::string GetKernelKey();
+
+  // Sets |out| to the parsed format of the event |group|/|name|, from the
+  // cache if still valid, otherwise from tracefs. Returns false if the event
+  // doesn't exist.
+  bool GetEventFormat(const std::string& group,
+                      const std::string& name,
+                      FtraceEvent* out);
+
+  // Writes the cache file if some formats were read from tracefs since it
+  // was loaded or last saved. Returns false if writing the file failed.
+  bool Save();
+
+  size_t hits() const { return hits_; }
+  size_t misses() const { return misses_; }
+
+  // The cached formats by "group/name", encoded in a compact binary form.
+  // Public for testing.
+  static std::string Serialize(const std::string& kernel_key,
+                               const std::map<std::string, FtraceEvent>&);
+  static bool Deserialize(const std::string& data,
+                          const std::string& kernel_key,
+                          std::map<std::string, FtraceEvent>*);
+
+ private:
+  FormatCache(const FormatCache&) = delete;
+  FormatCache& operator=(const FormatCache&) = delete;
+
+  const FtraceProcfs* const ftrace_procfs_;
+  std::string path_;
+  const std::string kernel_key_;
+  std::map<std::string, FtraceEvent> formats_;
+  bool dirty_ = false;
+  size_t hits_ = 0;
+  size_t misses_ = 0;
+};
+
+}  // namespace perfetto
+
+#endif  // SRC_TRACED_PROBES_FTRACE_FORMAT_CACHE_H_
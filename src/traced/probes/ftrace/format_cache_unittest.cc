@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/ftrace/format_cache.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "perfetto/base/temp_file.h"
+#include "src/traced/probes/ftrace/ftrace_procfs.h"
+
+using testing::_;
+using testing::ElementsAre;
+using testing::Eq;
+using testing::Return;
+
+namespace perfetto {
+namespace {
+
+const char kSchedSwitchFormat[] = R"(name: sched_switch
+ID: 68
+format:
+	field:unsigned short common_type;	offset:0;	size:2;	signed:0;
+	field:int common_pid;	offset:4;	size:4;	signed:1;
+
+	field:char prev_comm[16];	offset:8;	size:16;	signed:0;
+	field:pid_t prev_pid;	offset:24;	size:4;	signed:1;
+
+print fmt: "prev_comm=%s prev_pid=%d", REC->prev_comm, REC->prev_pid
+)";
+
+class MockFtraceProcfs : public FtraceProcfs {
+ public:
+  MockFtraceProcfs() : FtraceProcfs("/root/") {}
+
+  MOCK_CONST_METHOD2(ReadEventFormat,
+                     std::string(const std::string& group,
+                                 const std::string& name));
+  MOCK_CONST_METHOD2(ReadEventId,
+                     uint32_t(const std::string& group,
+                              const std::string& name));
+};
+
+class FormatCacheTest : public ::testing::Test {
+ protected:
+  FormatCacheTest()
+      : dir_(base::TempDir::Create()), path_(dir_.path() + "/cache") {}
+  ~FormatCacheTest() override { unlink(path_.c_str()); }
+
+  base::TempDir dir_;
+  const std::string path_;
+  MockFtraceProcfs ftrace_;
+};
+
+TEST(FormatCacheSerializationTest, RoundTrip) {
+  std::map<std::string, FtraceEvent> formats;
+  FtraceEvent* format = &formats["sched/sched_switch"];
+  format->name = "sched_switch";
+  format->id = 68;
+  format->common_fields.push_back({"int common_pid", 4, 4, true});
+  format->fields.push_back({"char prev_comm[16]", 8, 16, false});
+  format->fields.push_back({"pid_t prev_pid", 24, 4, true});
+  formats["ftrace/print"].name = "print";
+  formats["ftrace/print"].id = 5;
+  std::string data = FormatCache::Serialize("kernel", formats);
+
+  std::map<std::string, FtraceEvent> actual;
+  ASSERT_TRUE(FormatCache::Deserialize(data, "kernel", &actual));
+  ASSERT_EQ(actual.size(), 2u);
+  const FtraceEvent& sched_switch = actual["sched/sched_switch"];
+  EXPECT_EQ(sched_switch.name, "sched_switch");
+  EXPECT_EQ(sched_switch.id, 68u);
+  EXPECT_THAT(
+      sched_switch.common_fields,
+      ElementsAre(Eq(FtraceEvent::Field{"int common_pid", 4, 4, true})));
+  EXPECT_THAT(
+      sched_switch.fields,
+      ElementsAre(Eq(FtraceEvent::Field{"char prev_comm[16]", 8, 16, false}),
+                  Eq(FtraceEvent::Field{"pid_t prev_pid", 24, 4, true})));
+  EXPECT_EQ(actual["ftrace/print"].id, 5u);
+
+  // Another kernel, truncated or trailing data.
+  actual.clear();
+  EXPECT_FALSE(FormatCache::Deserialize(data, "other kernel", &actual));
+  EXPECT_FALSE(
+      FormatCache::Deserialize(data.substr(0, data.size() - 1), "kernel",
+                               &actual));
+  EXPECT_FALSE(FormatCache::Deserialize(data + "x", "kernel", &actual));
+  EXPECT_FALSE(FormatCache::Deserialize("", "kernel", &actual));
+
+  // A field past the end of any record.
+  formats["sched/sched_switch"].fields.push_back(
+      {"int bad", 0xfff0, 0x20, true});
+  data = FormatCache::Serialize("kernel", formats);
+  EXPECT_FALSE(FormatCache::Deserialize(data, "kernel", &actual));
+}
+
+TEST_F(FormatCacheTest, ReadsFormatsOnceAcrossRestarts) {
+  FtraceEvent format{};
+  {
+    FormatCache cache(&ftrace_, path_, "kernel");
+    EXPECT_CALL(ftrace_, ReadEventId(_, _)).Times(0);
+    EXPECT_CALL(ftrace_, ReadEventFormat("sched", "sched_switch"))
+        .WillOnce(Return(kSchedSwitchFormat));
+    EXPECT_CALL(ftrace_, ReadEventFormat("sched", "sched_foo"))
+        .WillOnce(Return(""));
+    ASSERT_TRUE(cache.GetEventFormat("sched", "sched_switch", &format));
+    EXPECT_EQ(format.id, 68u);
+    EXPECT_FALSE(cache.GetEventFormat("sched", "sched_foo", &format));
+    EXPECT_EQ(cache.misses(), 2u);
+    ASSERT_TRUE(cache.Save());
+    testing::Mock::VerifyAndClearExpectations(&ftrace_);
+  }
+
+  // After a restart only the id of the event is read.
+  {
+    FormatCache cache(&ftrace_, path_, "kernel");
+    EXPECT_CALL(ftrace_, ReadEventId("sched", "sched_switch"))
+        .WillOnce(Return(68));
+    EXPECT_CALL(ftrace_, ReadEventFormat(_, _)).Times(0);
+    format = FtraceEvent{};
+    ASSERT_TRUE(cache.GetEventFormat("sched", "sched_switch", &format));
+    EXPECT_EQ(format.name, "sched_switch");
+    EXPECT_EQ(format.id, 68u);
+    EXPECT_THAT(format.fields,
+                ElementsAre(Eq(FtraceEvent::Field{"char prev_comm[16]", 8, 16,
+                                                  false}),
+                            Eq(FtraceEvent::Field{"pid_t prev_pid", 24, 4,
+                                                  true})));
+    EXPECT_EQ(cache.hits(), 1u);
+    EXPECT_EQ(cache.misses(), 0u);
+    testing::Mock::VerifyAndClearExpectations(&ftrace_);
+  }
+}
+
+TEST_F(FormatCacheTest, InvalidatedByKernelAndEventId) {
+  {
+    FormatCache cache(&ftrace_, path_, "kernel");
+    EXPECT_CALL(ftrace_, ReadEventFormat("sched", "sched_switch"))
+        .WillOnce(Return(kSchedSwitchFormat));
+    FtraceEvent format{};
+    ASSERT_TRUE(cache.GetEventFormat("sched", "sched_switch", &format));
+    ASSERT_TRUE(cache.Save());
+    testing::Mock::VerifyAndClearExpectations(&ftrace_);
+  }
+
+  // Another kernel: the cache file is ignored.
+  {
+    FormatCache cache(&ftrace_, path_, "other kernel");
+    EXPECT_CALL(ftrace_, ReadEventId(_, _)).Times(0);
+    EXPECT_CALL(ftrace_, ReadEventFormat("sched", "sched_switch"))
+        .WillOnce(Return(kSchedSwitchFormat));
+    FtraceEvent format{};
+    ASSERT_TRUE(cache.GetEventFormat("sched", "sched_switch", &format));
+    EXPECT_EQ(cache.misses(), 1u);
+    testing::Mock::VerifyAndClearExpectations(&ftrace_);
+  }
+
+  // The id of the event changed: its format is read again.
+  {
+    FormatCache cache(&ftrace_, path_, "kernel");
+    EXPECT_CALL(ftrace_, ReadEventId("sched", "sched_switch"))
+        .WillOnce(Return(69));
+    EXPECT_CALL(ftrace_, ReadEventFormat("sched", "sched_switch"))
+        .WillOnce(Return(kSchedSwitchFormat));
+    FtraceEvent format{};
+    ASSERT_TRUE(cache.GetEventFormat("sched", "sched_switch", &format));
+    EXPECT_EQ(cache.hits(), 0u);
+    EXPECT_EQ(cache.misses(), 1u);
+    testing::Mock::VerifyAndClearExpectations(&ftrace_);
+  }
+}
+
+TEST_F(FormatCacheTest, IgnoresFilesOthersCanWrite) {
+  {
+    FormatCache cache(&ftrace_, path_, "kernel");
+    EXPECT_CALL(ftrace_, ReadEventFormat("sched", "sched_switch"))
+        .WillOnce(Return(kSchedSwitchFormat));
+    FtraceEvent format{};
+    ASSERT_TRUE(cache.GetEventFormat("sched", "sched_switch", &format));
+    ASSERT_TRUE(cache.Save());
+    testing::Mock::VerifyAndClearExpectations(&ftrace_);
+  }
+  ASSERT_EQ(chmod(path_.c_str(), 0666), 0);
+
+  FormatCache cache(&ftrace_, path_, "kernel");
+  EXPECT_CALL(ftrace_, ReadEventId(_, _)).Times(0);
+  EXPECT_CALL(ftrace_, ReadEventFormat("sched", "sched_switch"))
+      .WillOnce(Return(kSchedSwitchFormat));
+  FtraceEvent format{};
+  ASSERT_TRUE(cache.GetEventFormat("sched", "sched_switch", &format));
+  EXPECT_EQ(cache.hits(), 0u);
+}
+
+TEST_F(FormatCacheTest, InMemoryOnlyInSharedDirectory) {
+  ASSERT_EQ(chmod(dir_.path().c_str(), 0755), 0);
+  FormatCache cache(&ftrace_, path_, "kernel");
+  EXPECT_CALL(ftrace_, ReadEventFormat("sched", "sched_switch"))
+      .WillOnce(Return(kSchedSwitchFormat));
+  FtraceEvent format{};
+  ASSERT_TRUE(cache.GetEventFormat("sched", "sched_switch", &format));
+  EXPECT_TRUE(cache.Save());
+  EXPECT_NE(access(path_.c_str(), F_OK), 0);
+}
+
+TEST_F(FormatCacheTest, InMemoryOnly) {
+  FormatCache cache(&ftrace_, "", "kernel");
+  EXPECT_CALL(ftrace_, ReadEventFormat("sched", "sched_switch"))
+      .WillOnce(Return(kSchedSwitchFormat));
+  EXPECT_CALL(ftrace_, ReadEventId("sched", "sched_switch"))
+      .WillOnce(Return(68));
+  FtraceEvent format{};
+  ASSERT_TRUE(cache.GetEventFormat("sched", "sched_switch", &format));
+  ASSERT_TRUE(cache.GetEventFormat("sched", "sched_switch", &format));
+  EXPECT_EQ(cache.hits(), 1u);
+  EXPECT_TRUE(cache.Save());
+  EXPECT_NE(access(path_.c_str(), F_OK), 0);
+}
+
+}  // namespace
+}  // namespace perfetto
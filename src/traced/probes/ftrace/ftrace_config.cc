@@ -54,6 +54,18 @@ bool IsValidFtraceEventName(const std::string& str) {
   return true;
 }
 
+// The field filters end up in the filter expressions of the kernel, which must
+// not be able to contain anything else than the comparisons of the filter.
+bool IsValidFieldName(const std::string& str) {
+  if (str.empty())
+    return false;
+  for (size_t i = 0; i < str.size(); i++) {
+    if (!isalnum(str[i]) && str[i] != '_')
+      return false;
+  }
+  return true;
+}
+
 }  // namespace
 
 FtraceConfig CreateFtraceConfig(std::set<std::string> names) {
@@ -86,6 +98,18 @@ bool ValidConfig(const FtraceConfig& config) {
       return false;
     }
   }
+  for (const FtraceConfig::FieldFilter& filter : config.field_filters()) {
+    const std::string& event = filter.event();
+    if (!IsValidFtraceEventName(event) ||
+        event.find('*') != std::string::npos) {
+      PERFETTO_ELOG("Bad filtered event '%s'", event.c_str());
+      return false;
+    }
+    if (!IsValidFieldName(filter.field())) {
+      PERFETTO_ELOG("Bad filtered field '%s'", filter.field().c_str());
+      return false;
+    }
+  }
   return true;
 }
 
@@ -16,13 +16,16 @@
 
 #include "src/traced/probes/ftrace/ftrace_config_muxer.h"
 
+#include <dirent.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include <algorithm>
 
+#include "perfetto/base/scoped_file.h"
 #include "perfetto/base/utils.h"
 #include "src/traced/probes/ftrace/atrace_wrapper.h"
 
@@ -65,6 +68,48 @@ std::pair<std::string, std::string> EventToStringGroupAndName(
                         event.substr(slash_pos + 1));
 }
 
+const Field* FindField(const std::vector<Field>& fields,
+                       const std::string& name) {
+  for (const Field& field : fields) {
+    if (name == field.ftrace_name)
+      return &field;
+  }
+  return nullptr;
+}
+
+// The scheduling events that concern another thread than the one emitting
+// them, and the fields with its id. Like the kernel's set_event_pid, the
+// target_pids keep them if either thread is a target.
+struct PeerPidEvent {
+  const char* group;
+  const char* name;
+  const char* pid_fields[2];
+};
+constexpr PeerPidEvent kPeerPidEvents[] = {
+    {"sched", "sched_switch", {"prev_pid", "next_pid"}},
+    {"sched", "sched_wakeup", {"pid", nullptr}},
+    {"sched", "sched_wakeup_new", {"pid", nullptr}},
+    {"sched", "sched_waking", {"pid", nullptr}},
+};
+
+// Appends the threads of the process |tgid| to |tids|.
+void AppendThreadsOfProcess(int32_t tgid, std::vector<int32_t>* tids) {
+  std::string path = "/proc/" + std::to_string(tgid) + "/task";
+  base::ScopedDir dir(opendir(path.c_str()));
+  if (!dir) {
+    PERFETTO_PLOG("Failed to list the threads of %d", tgid);
+    return;
+  }
+  struct dirent* ent;
+  while ((ent = readdir(*dir)) != nullptr) {
+    char* end;
+    long tid = strtol(ent->d_name, &end, 10);
+    if (*end != '\0' || tid <= 0)
+      continue;
+    tids->push_back(static_cast<int32_t>(tid));
+  }
+}
+
 }  // namespace
 
 std::set<GroupAndName> FtraceConfigMuxer::GetFtraceEvents(
@@ -324,6 +369,14 @@ FtraceConfigId FtraceConfigMuxer::SetupConfig(const FtraceConfig& request) {
     }
   }
 
+  std::map<GroupAndName, std::string> kernel_filters;
+  SetupEventPredicates(request, &filter, &actual, &kernel_filters);
+  if (configs_.empty()) {
+    SetupKernelFilters(actual.target_pids(), kernel_filters);
+  } else {
+    ClearKernelFilters();
+  }
+
   FtraceConfigId id = ++last_id_;
   configs_.emplace(id, std::move(actual));
   filters_.emplace(id, std::move(filter));
@@ -390,6 +443,7 @@ bool FtraceConfigMuxer::RemoveConfig(FtraceConfigId config_id) {
   // configs around. Tear down the rest of the ftrace config only if all
   // configs are removed.
   if (configs_.empty()) {
+    ClearKernelFilters();
     ftrace_->SetCpuBufferSizeInPages(0);
     ftrace_->DisableAllEvents();
     ftrace_->ClearTrace();
@@ -412,6 +466,22 @@ const EventFilter* FtraceConfigMuxer::GetEventFilter(FtraceConfigId id) {
   return &filters_.at(id);
 }
 
+bool FtraceConfigMuxer::CanUseRawPages(FtraceConfigId id) const {
+  if (configs_.size() != 1 || configs_.count(id) == 0)
+    return false;
+  const EventFilter& filter = filters_.at(id);
+  if (filter.has_predicates())
+    return false;
+  for (size_t event_id : current_state_.ftrace_events.GetEnabledEvents()) {
+    if (!filter.IsEventEnabled(event_id))
+      return false;
+  }
+  // The writes to trace_marker are recorded whatever the enabled events.
+  const auto& events = configs_.at(id).ftrace_events();
+  return std::find(events.begin(), events.end(), "ftrace/print") !=
+         events.end();
+}
+
 void FtraceConfigMuxer::SetupClock(const FtraceConfig&) {
   std::string current_clock = ftrace_->GetClock();
   std::set<std::string> clocks = ftrace_->AvailableClocks();
@@ -459,6 +529,116 @@ void FtraceConfigMuxer::UpdateAtrace(const FtraceConfig& request) {
   PERFETTO_DLOG("...done");
 }
 
+void FtraceConfigMuxer::SetupEventPredicates(
+    const FtraceConfig& request,
+    EventFilter* filter,
+    FtraceConfig* actual,
+    std::map<GroupAndName, std::string>* kernel_filters) {
+  std::vector<int32_t> target_pids = request.target_pids();
+  for (int32_t tgid : request.target_tgids())
+    AppendThreadsOfProcess(tgid, &target_pids);
+  std::sort(target_pids.begin(), target_pids.end());
+  target_pids.erase(std::unique(target_pids.begin(), target_pids.end()),
+                    target_pids.end());
+  if (!target_pids.empty()) {
+    const Field* common_pid = FindField(table_->common_fields(), "common_pid");
+    std::vector<int64_t> pids(target_pids.begin(), target_pids.end());
+    if (common_pid && filter->AddFieldPredicate(0, {common_pid}, pids)) {
+      *actual->mutable_target_pids() = target_pids;
+      *actual->mutable_target_tgids() = request.target_tgids();
+      for (const PeerPidEvent& peer_pid_event : kPeerPidEvents) {
+        const Event* event = table_->GetEvent(
+            GroupAndName(peer_pid_event.group, peer_pid_event.name));
+        if (!event || !filter->IsEventEnabled(event->ftrace_event_id))
+          continue;
+        std::vector<const Field*> fields = {common_pid};
+        for (const char* name : peer_pid_event.pid_fields) {
+          const Field* field = name ? FindField(event->fields, name) : nullptr;
+          if (field)
+            fields.push_back(field);
+        }
+        if (filter->AddFieldPredicate(event->ftrace_event_id, fields, pids))
+          filter->ExcludeFromCommonPredicates(event->ftrace_event_id);
+      }
+    } else {
+      PERFETTO_ELOG("Can't filter the events by pid: no common_pid field");
+    }
+  }
+
+  for (const FtraceConfig::FieldFilter& field_filter :
+       request.field_filters()) {
+    std::string group;
+    std::string name;
+    std::tie(group, name) = EventToStringGroupAndName(field_filter.event());
+    const Event* event = group.empty()
+                             ? table_->GetEventByName(name)
+                             : table_->GetEventById(table_->EventToFtraceId(
+                                   GroupAndName(group, name)));
+    if (!event || !filter->IsEventEnabled(event->ftrace_event_id)) {
+      PERFETTO_ELOG("Can't filter %s: the event is not enabled",
+                    field_filter.event().c_str());
+      continue;
+    }
+    const Field* field = FindField(event->fields, field_filter.field());
+    if (!field || !filter->AddFieldPredicate(event->ftrace_event_id, {field},
+                                             field_filter.values())) {
+      PERFETTO_ELOG("Can't filter %s on %s: not an integer field",
+                    field_filter.event().c_str(), field_filter.field().c_str());
+      continue;
+    }
+    GroupAndName group_and_name(event->group, event->name);
+    FtraceConfig::FieldFilter* actual_filter = actual->add_field_filters();
+    *actual_filter = field_filter;
+    actual_filter->set_event(group_and_name.ToString());
+
+    // E.g. "(prev_pid == 1 || prev_pid == 2) && (next_pid == 3)". A filter
+    // without values drops all the events, which a kernel filter can't
+    // express: those are left to the predicate.
+    if (field_filter.values().empty())
+      continue;
+    std::string expression;
+    for (int64_t value : field_filter.values()) {
+      if (!expression.empty())
+        expression += " || ";
+      expression += field_filter.field() + " == " + std::to_string(value);
+    }
+    std::string& kernel_filter = (*kernel_filters)[group_and_name];
+    if (!kernel_filter.empty())
+      kernel_filter += " && ";
+    kernel_filter += "(" + expression + ")";
+  }
+}
+
+void FtraceConfigMuxer::SetupKernelFilters(
+    const std::vector<int32_t>& pids,
+    const std::map<GroupAndName, std::string>& kernel_filters) {
+  PERFETTO_DCHECK(current_state_.kernel_filtered_events.empty());
+  if (!pids.empty() && ftrace_->SetEventPids(pids))
+    current_state_.kernel_event_pids_set = true;
+  for (const auto& it : kernel_filters) {
+    const GroupAndName& group_and_name = it.first;
+    if (ftrace_->SetEventFilter(group_and_name.group(), group_and_name.name(),
+                                it.second)) {
+      current_state_.kernel_filtered_events.insert(group_and_name);
+    } else {
+      PERFETTO_DPLOG("Failed to set the filter of %s",
+                     group_and_name.ToString().c_str());
+    }
+  }
+}
+
+void FtraceConfigMuxer::ClearKernelFilters() {
+  if (current_state_.kernel_event_pids_set) {
+    ftrace_->ClearEventPids();
+    current_state_.kernel_event_pids_set = false;
+  }
+  for (const GroupAndName& group_and_name :
+       current_state_.kernel_filtered_events) {
+    ftrace_->ClearEventFilter(group_and_name.group(), group_and_name.name());
+  }
+  current_state_.kernel_filtered_events.clear();
+}
+
 void FtraceConfigMuxer::DisableAtrace() {
   PERFETTO_DCHECK(current_state_.atrace_on);
 
@@ -19,6 +19,8 @@
 
 #include <map>
 #include <set>
+#include <string>
+#include <vector>
 
 #include "src/traced/probes/ftrace/ftrace_config.h"
 #include "src/traced/probes/ftrace/ftrace_controller.h"
@@ -68,6 +70,19 @@ class FtraceConfigMuxer {
 
   const EventFilter* GetEventFilter(FtraceConfigId id);
 
+  // Whether the kernel pages contain only the events that the config |id|
+  // asks for, so that they can be handed to it as they are (see
+  // FtraceConfig.raw_pages). That is the case if it is the only config, it
+  // enables all the events enabled in the kernel, and ftrace/print which the
+  // kernel always records, and it has no target_pids or field_filters.
+  bool CanUseRawPages(FtraceConfigId id) const;
+
+  // The size of the kernel buffer of each CPU, as set up by the configs. 0 if
+  // none was set up yet.
+  size_t GetPerCpuBufferSizePages() const {
+    return current_state_.cpu_buffer_size_pages;
+  }
+
   // public for testing
   void SetupClockForTesting(const FtraceConfig& request) {
     SetupClock(request);
@@ -89,6 +104,12 @@ class FtraceConfigMuxer {
     bool tracing_on = false;
     bool atrace_on = false;
     size_t cpu_buffer_size_pages = 0;
+
+    // The kernel side filters (events/*/filter and set_event_pid) set for
+    // the only config. They are cleared as soon as another config is set up,
+    // as they could drop the events it wants.
+    std::set<GroupAndName> kernel_filtered_events;
+    bool kernel_event_pids_set = false;
   };
 
   FtraceConfigMuxer(const FtraceConfigMuxer&) = delete;
@@ -99,6 +120,20 @@ class FtraceConfigMuxer {
   void UpdateAtrace(const FtraceConfig& request);
   void DisableAtrace();
 
+  // Adds the target_pids, the threads of the target_tgids and the
+  // field_filters of |request| to |filter|, as predicates on the raw records,
+  // and to |actual|. The filters to set in the kernel for the same predicates
+  // are added to |kernel_filters|.
+  void SetupEventPredicates(
+      const FtraceConfig& request,
+      EventFilter* filter,
+      FtraceConfig* actual,
+      std::map<GroupAndName, std::string>* kernel_filters);
+  void SetupKernelFilters(
+      const std::vector<int32_t>& pids,
+      const std::map<GroupAndName, std::string>& kernel_filters);
+  void ClearKernelFilters();
+
   // This processes the config to get the exact events.
   // group/* -> Will read the fs and add all events in group.
   // event -> Will look up the event to find the group.
@@ -16,10 +16,13 @@
 
 #include "src/traced/probes/ftrace/ftrace_config_muxer.h"
 
+#include <unistd.h>
+
 #include <memory>
 
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "perfetto/base/thread_utils.h"
 #include "src/traced/probes/ftrace/atrace_wrapper.h"
 #include "src/traced/probes/ftrace/ftrace_procfs.h"
 #include "src/traced/probes/ftrace/proto_translation_table.h"
@@ -89,6 +92,19 @@ class MockProtoTranslationTable : public ProtoTranslationTable {
                      const Event*(const GroupAndName& group_and_name));
 };
 
+Field MakePidField(const char* name,
+                   FtraceFieldType type,
+                   uint16_t offset,
+                   TranslationStrategy strategy) {
+  Field field(offset, 4);
+  field.ftrace_name = name;
+  field.ftrace_type = type;
+  field.proto_field_id = 1;
+  field.proto_field_type = protozero::proto_utils::ProtoSchemaType::kInt32;
+  field.strategy = strategy;
+  return field;
+}
+
 class FtraceConfigMuxerTest : public ::testing::Test {
  protected:
   std::unique_ptr<MockProtoTranslationTable> GetMockTable() {
@@ -101,12 +117,18 @@ class FtraceConfigMuxerTest : public ::testing::Test {
   }
   std::unique_ptr<ProtoTranslationTable> CreateFakeTable() {
     std::vector<Field> common_fields;
+    common_fields.push_back(MakePidField("common_pid", kFtraceCommonPid32, 4,
+                                         kCommonPid32ToInt32));
     std::vector<Event> events;
     {
       Event event;
       event.name = "sched_switch";
       event.group = "sched";
       event.ftrace_event_id = 1;
+      event.fields.push_back(
+          MakePidField("prev_pid", kFtracePid32, 24, kPid32ToInt32));
+      event.fields.push_back(
+          MakePidField("next_pid", kFtracePid32, 56, kPid32ToInt32));
       events.push_back(event);
     }
 
@@ -115,6 +137,8 @@ class FtraceConfigMuxerTest : public ::testing::Test {
       event.name = "sched_wakeup";
       event.group = "sched";
       event.ftrace_event_id = 10;
+      event.fields.push_back(
+          MakePidField("pid", kFtracePid32, 24, kPid32ToInt32));
       events.push_back(event);
     }
 
@@ -551,5 +575,181 @@ TEST_F(FtraceConfigMuxerTest, FallbackOnSetEvent) {
   ASSERT_TRUE(model.RemoveConfig(id));
 }
 
+TEST_F(FtraceConfigMuxerTest, TargetPidsAndFieldFilters) {
+  NiceMock<MockFtraceProcfs> ftrace;
+  FtraceConfigMuxer model(&ftrace, table_.get());
+
+  FtraceConfig config =
+      CreateFtraceConfig({"sched/sched_switch", "sched/sched_wakeup"});
+  *config.add_target_pids() = 42;
+  *config.add_target_pids() = 43;
+  FtraceConfig::FieldFilter* filter = config.add_field_filters();
+  filter->set_event("sched_switch");
+  filter->set_field("next_pid");
+  *filter->add_values() = 1;
+  *filter->add_values() = 2;
+  filter = config.add_field_filters();
+  filter->set_event("sched/sched_switch");
+  filter->set_field("prev_pid");
+  *filter->add_values() = 42;
+  // Neither an enabled event nor a known field: ignored.
+  filter = config.add_field_filters();
+  filter->set_event("sched/sched_new");
+  filter->set_field("prev_pid");
+  filter = config.add_field_filters();
+  filter->set_event("sched/sched_wakeup");
+  filter->set_field("foo");
+
+  EXPECT_CALL(ftrace, WriteToFile(_, _)).Times(AnyNumber());
+  EXPECT_CALL(ftrace, ClearFile(_)).Times(AnyNumber());
+  // The only config: the filters are pushed into the kernel too.
+  EXPECT_CALL(ftrace, WriteToFile("/root/set_event_pid", "42 43"));
+  EXPECT_CALL(ftrace,
+              WriteToFile("/root/events/sched/sched_switch/filter",
+                          "(next_pid == 1 || next_pid == 2) && "
+                          "(prev_pid == 42)"));
+  FtraceConfigId id = model.SetupConfig(config);
+  ASSERT_TRUE(id);
+
+  const FtraceConfig* actual_config = model.GetConfigForTesting(id);
+  ASSERT_TRUE(actual_config);
+  EXPECT_THAT(actual_config->target_pids(), ElementsAreArray({42, 43}));
+  ASSERT_EQ(actual_config->field_filters_size(), 2);
+  EXPECT_EQ(actual_config->field_filters()[0].event(), "sched/sched_switch");
+
+  // A sched_switch record from pid 42 to pid 2 passes, other records don't.
+  const EventFilter* event_filter = model.GetEventFilter(id);
+  ASSERT_TRUE(event_filter);
+  EXPECT_TRUE(event_filter->has_predicates());
+  uint8_t record[64] = {};
+  auto set_pids = [&record](int32_t common_pid, int32_t prev_pid,
+                            int32_t next_pid) {
+    memcpy(&record[4], &common_pid, sizeof(common_pid));
+    memcpy(&record[24], &prev_pid, sizeof(prev_pid));
+    memcpy(&record[56], &next_pid, sizeof(next_pid));
+  };
+  set_pids(42, 42, 2);
+  EXPECT_TRUE(event_filter->IsRecordEnabled(1, record, record + 64));
+  EXPECT_FALSE(event_filter->IsRecordEnabled(1, record, record + 40));
+  EXPECT_FALSE(event_filter->IsRecordEnabled(11, record, record + 64));
+  set_pids(43, 42, 2);
+  EXPECT_TRUE(event_filter->IsRecordEnabled(1, record, record + 64));
+  set_pids(44, 44, 2);
+  EXPECT_FALSE(event_filter->IsRecordEnabled(1, record, record + 64));
+  set_pids(42, 43, 2);
+  EXPECT_FALSE(event_filter->IsRecordEnabled(1, record, record + 64));
+  set_pids(42, 42, 3);
+  EXPECT_FALSE(event_filter->IsRecordEnabled(1, record, record + 64));
+  // Only the pid predicate applies to sched_wakeup.
+  set_pids(42, 0, 0);
+  EXPECT_TRUE(event_filter->IsRecordEnabled(10, record, record + 64));
+
+  // A second config might want the events of other pids: the kernel filters
+  // are removed, while the predicates of the first config stay.
+  EXPECT_CALL(ftrace, ClearFile("/root/set_event_pid"));
+  EXPECT_CALL(ftrace,
+              WriteToFile("/root/events/sched/sched_switch/filter", "0"));
+  FtraceConfigId id2 =
+      model.SetupConfig(CreateFtraceConfig({"sched/sched_switch"}));
+  ASSERT_TRUE(id2);
+  EXPECT_FALSE(model.GetEventFilter(id2)->has_predicates());
+  EXPECT_TRUE(model.GetEventFilter(id)->has_predicates());
+  ::testing::Mock::VerifyAndClearExpectations(&ftrace);
+
+  // Nothing left to clear.
+  EXPECT_CALL(ftrace, WriteToFile(_, _))
+      .Times(AnyNumber())
+      .WillRepeatedly(Return(true));
+  EXPECT_CALL(ftrace, ClearFile(_))
+      .Times(AnyNumber())
+      .WillRepeatedly(Return(true));
+  EXPECT_CALL(ftrace, ClearFile("/root/set_event_pid")).Times(0);
+  ASSERT_TRUE(model.RemoveConfig(id));
+  ASSERT_TRUE(model.RemoveConfig(id2));
+}
+
+TEST_F(FtraceConfigMuxerTest, CanUseRawPages) {
+  NiceMock<MockFtraceProcfs> ftrace;
+  FtraceConfigMuxer model(&ftrace, table_.get());
+
+  // The kernel records the writes to trace_marker whatever the events.
+  FtraceConfigId id =
+      model.SetupConfig(CreateFtraceConfig({"sched/sched_switch"}));
+  ASSERT_TRUE(id);
+  EXPECT_FALSE(model.CanUseRawPages(id));
+  ASSERT_TRUE(model.RemoveConfig(id));
+
+  id = model.SetupConfig(
+      CreateFtraceConfig({"sched/sched_switch", "ftrace/print"}));
+  ASSERT_TRUE(id);
+  EXPECT_TRUE(model.CanUseRawPages(id));
+
+  // Another config enables other events.
+  FtraceConfigId id2 = model.SetupConfig(
+      CreateFtraceConfig({"sched/sched_wakeup", "ftrace/print"}));
+  ASSERT_TRUE(id2);
+  EXPECT_FALSE(model.CanUseRawPages(id));
+  EXPECT_FALSE(model.CanUseRawPages(id2));
+  ASSERT_TRUE(model.RemoveConfig(id2));
+  EXPECT_TRUE(model.CanUseRawPages(id));
+  ASSERT_TRUE(model.RemoveConfig(id));
+
+  // The target pids would have to be applied to the records.
+  FtraceConfig config =
+      CreateFtraceConfig({"sched/sched_switch", "ftrace/print"});
+  *config.add_target_pids() = 42;
+  id = model.SetupConfig(config);
+  ASSERT_TRUE(id);
+  EXPECT_FALSE(model.CanUseRawPages(id));
+  ASSERT_TRUE(model.RemoveConfig(id));
+}
+
+TEST_F(FtraceConfigMuxerTest, TargetPidsMatchTheOtherThreadOfSchedEvents) {
+  NiceMock<MockFtraceProcfs> ftrace;
+  FtraceConfigMuxer model(&ftrace, table_.get());
+
+  FtraceConfig config =
+      CreateFtraceConfig({"sched/sched_switch", "sched/sched_wakeup"});
+  *config.add_target_pids() = 42;
+  // The threads of this process, e.g. the one running the test, are added
+  // to the target pids.
+  *config.add_target_tgids() = getpid();
+  FtraceConfigId id = model.SetupConfig(config);
+  ASSERT_TRUE(id);
+
+  const FtraceConfig* actual_config = model.GetConfigForTesting(id);
+  ASSERT_TRUE(actual_config);
+  EXPECT_THAT(actual_config->target_pids(), Contains(42));
+  EXPECT_THAT(actual_config->target_pids(),
+              Contains(static_cast<int32_t>(base::GetThreadId())));
+  EXPECT_THAT(actual_config->target_tgids(), ElementsAreArray({getpid()}));
+
+  const EventFilter* event_filter = model.GetEventFilter(id);
+  ASSERT_TRUE(event_filter);
+  uint8_t record[64] = {};
+  auto set_pids = [&record](int32_t common_pid, int32_t pid_24,
+                            int32_t pid_56) {
+    memcpy(&record[4], &common_pid, sizeof(common_pid));
+    memcpy(&record[24], &pid_24, sizeof(pid_24));
+    memcpy(&record[56], &pid_56, sizeof(pid_56));
+  };
+
+  // sched_switch: switching out of or into a target thread.
+  set_pids(42, 42, 2);
+  EXPECT_TRUE(event_filter->IsRecordEnabled(1, record, record + 64));
+  set_pids(2, 2, 42);
+  EXPECT_TRUE(event_filter->IsRecordEnabled(1, record, record + 64));
+  set_pids(2, 2, 3);
+  EXPECT_FALSE(event_filter->IsRecordEnabled(1, record, record + 64));
+
+  // sched_wakeup: waking up, or woken up by, a target thread.
+  set_pids(42, 2, 0);
+  EXPECT_TRUE(event_filter->IsRecordEnabled(10, record, record + 64));
+  set_pids(2, 42, 0);
+  EXPECT_TRUE(event_filter->IsRecordEnabled(10, record, record + 64));
+  set_pids(2, 3, 0);
+  EXPECT_FALSE(event_filter->IsRecordEnabled(10, record, record + 64));
+}
+
 }  // namespace
 }  // namespace perfetto
@@ -33,5 +33,27 @@ TEST(ConfigTest, CreateFtraceConfig) {
   EXPECT_THAT(config.ftrace_events(), Contains("bbb"));
 }
 
+TEST(ConfigTest, ValidFieldFilters) {
+  FtraceConfig config = CreateFtraceConfig({"sched/sched_switch"});
+  FtraceConfig::FieldFilter* filter = config.add_field_filters();
+  filter->set_event("sched/sched_switch");
+  filter->set_field("prev_pid");
+  *filter->add_values() = 42;
+  EXPECT_TRUE(ValidConfig(config));
+
+  filter->set_event("sched/*");
+  EXPECT_FALSE(ValidConfig(config));
+
+  filter->set_event("sched_switch");
+  EXPECT_TRUE(ValidConfig(config));
+
+  // The field ends up in the filter expression of the kernel.
+  filter->set_field("prev_pid == 1 || prev_pid");
+  EXPECT_FALSE(ValidConfig(config));
+
+  filter->set_field("");
+  EXPECT_FALSE(ValidConfig(config));
+}
+
 }  // namespace
 }  // namespace perfetto
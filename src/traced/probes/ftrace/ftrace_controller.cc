@@ -17,6 +17,7 @@
 #include "src/traced/probes/ftrace/ftrace_controller.h"
 
 #include <fcntl.h>
+#include <inttypes.h>
 #include <stdint.h>
 #include <string.h>
 #include <sys/stat.h>
@@ -24,19 +25,24 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <array>
+#include <limits>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "perfetto/base/build_config.h"
 #include "perfetto/base/file_utils.h"
 #include "perfetto/base/logging.h"
 #include "perfetto/base/metatrace.h"
+#include "perfetto/base/thread_pool.h"
 #include "perfetto/base/time.h"
 #include "perfetto/tracing/core/trace_writer.h"
 #include "src/traced/probes/ftrace/cpu_reader.h"
 #include "src/traced/probes/ftrace/cpu_stats_parser.h"
 #include "src/traced/probes/ftrace/event_info.h"
+#include "src/traced/probes/ftrace/format_cache.h"
 #include "src/traced/probes/ftrace/ftrace_config_muxer.h"
 #include "src/traced/probes/ftrace/ftrace_data_source.h"
 #include "src/traced/probes/ftrace/ftrace_metadata.h"
@@ -52,6 +58,32 @@ constexpr int kFlushTimeoutMs = 500;
 constexpr int kMinDrainPeriodMs = 1;
 constexpr int kMaxDrainPeriodMs = 1000 * 60;
 constexpr uint32_t kMainThread = 255;  // for METATRACE
+// The drain worker |i| is traced as kFirstDrainWorkerThread + i.
+constexpr uint32_t kFirstDrainWorkerThread = 256;  // for METATRACE
+
+// The drain period adapts to how full the kernel buffers get between two
+// drains, see UpdateDrainPeriod(). It is halved when a CPU filled more than
+// kHighWatermarkPercent of its buffer (which also triggers a drain right away)
+// and doubled when all of them filled less than kLowWatermarkPercent, within
+// [configured / kAdaptiveDrainPeriodMinDivisor,
+//  configured * kAdaptiveDrainPeriodMaxFactor].
+constexpr uint64_t kHighWatermarkPercent = 50;
+constexpr uint64_t kLowWatermarkPercent = 10;
+constexpr uint32_t kAdaptiveDrainPeriodMinDivisor = 8;
+constexpr uint32_t kAdaptiveDrainPeriodMaxFactor = 4;
+constexpr uint64_t kUnknownOverrun = std::numeric_limits<uint64_t>::max();
+
+// Parsing the ftrace pages of all the CPUs on the main thread doesn't keep up
+// with the kernel on machines with many CPUs. There, groups of CPUs are drained
+// in parallel by up to kMaxDrainWorkers workers.
+constexpr size_t kCpusPerDrainWorker = 8;
+constexpr size_t kMaxDrainWorkers = 8;
+
+size_t ComputeNumDrainWorkers(size_t num_cpus) {
+  size_t num_workers =
+      (num_cpus + kCpusPerDrainWorker - 1) / kCpusPerDrainWorker;
+  return std::max<size_t>(1, std::min(num_workers, kMaxDrainWorkers));
+}
 
 uint32_t ClampDrainPeriodMs(uint32_t drain_period_ms) {
   if (drain_period_ms == 0) {
@@ -66,6 +98,18 @@ uint32_t ClampDrainPeriodMs(uint32_t drain_period_ms) {
   return drain_period_ms;
 }
 
+uint32_t MinAdaptiveDrainPeriodMs(uint32_t configured_drain_period_ms) {
+  return std::max<uint32_t>(
+      kMinDrainPeriodMs,
+      configured_drain_period_ms / kAdaptiveDrainPeriodMinDivisor);
+}
+
+uint32_t MaxAdaptiveDrainPeriodMs(uint32_t configured_drain_period_ms) {
+  return std::min<uint32_t>(
+      kMaxDrainPeriodMs,
+      configured_drain_period_ms * kAdaptiveDrainPeriodMaxFactor);
+}
+
 void WriteToFile(const char* path, const char* str) {
   auto fd = base::OpenFile(path, O_WRONLY);
   if (!fd)
@@ -106,7 +150,8 @@ void HardResetFtraceState() {
 // TODO(taylori): Add a test for tracing paths in integration tests.
 std::unique_ptr<FtraceController> FtraceController::Create(
     base::TaskRunner* runner,
-    Observer* observer) {
+    Observer* observer,
+    const std::string& format_cache_path) {
   size_t index = 0;
   std::unique_ptr<FtraceProcfs> ftrace_procfs = nullptr;
   while (!ftrace_procfs && kTracingPaths[index]) {
@@ -116,8 +161,15 @@ std::unique_ptr<FtraceController> FtraceController::Create(
   if (!ftrace_procfs)
     return nullptr;
 
+  // Only the events enabled by the tracing sessions have their format read,
+  // through the cache: the first session after boot starts faster.
+  std::unique_ptr<FormatCache> format_cache(new FormatCache(
+      ftrace_procfs.get(), format_cache_path, FormatCache::GetKernelKey()));
   auto table = ProtoTranslationTable::Create(
-      ftrace_procfs.get(), GetStaticEventInfo(), GetStaticCommonFieldsInfo());
+      ftrace_procfs.get(), GetStaticEventInfo(), GetStaticCommonFieldsInfo(),
+      std::move(format_cache), ProtoTranslationTable::Resolution::kLazy);
+  if (table)
+    table->format_cache()->Save();
 
   if (!table)
     return nullptr;
@@ -140,12 +192,20 @@ FtraceController::FtraceController(std::unique_ptr<FtraceProcfs> ftrace_procfs,
       ftrace_procfs_(std::move(ftrace_procfs)),
       table_(std::move(table)),
       ftrace_config_muxer_(std::move(model)),
+      num_drain_workers_(
+          ComputeNumDrainWorkers(ftrace_procfs_->NumberOfCpus())),
       weak_factory_(this) {
   thread_sync_.trace_controller_weak = GetWeakPtr();
 }
 
 FtraceController::~FtraceController() {
   PERFETTO_DCHECK_THREAD(thread_checker_);
+  // Nothing can run the tasks the drain workers post back at this point: wait
+  // for them before destroying what they use.
+  drain_workers_.reset();
+  pending_drain_tasks_ = 0;
+  pending_setups_.clear();
+  retired_data_sources_.clear();
   for (const auto* data_source : data_sources_)
     ftrace_config_muxer_->RemoveConfig(data_source->config_id());
   data_sources_.clear();
@@ -164,22 +224,43 @@ uint64_t FtraceController::NowMs() const {
 // static
 void FtraceController::OnCpuReaderRead(size_t cpu,
                                        int generation,
-                                       FtraceThreadSync* thread_sync) {
+                                       FtraceThreadSync* thread_sync,
+                                       size_t bytes_read) {
   PERFETTO_METATRACE("OnCpuReaderRead()", cpu);
 
+  bool drain_now = false;
   {
     std::lock_guard<std::mutex> lock(thread_sync->mutex);
+    thread_sync->bytes_read[cpu] += bytes_read;
+
     // If this was the first CPU to wake up, schedule a drain for the next
     // drain interval.
     bool post_drain_task = thread_sync->cpus_to_drain.none();
     thread_sync->cpus_to_drain[cpu] = true;
-    if (!post_drain_task)
+
+    // If the kernel buffer of this CPU is filling up faster than the drain
+    // period allows for, drain right away rather than risk overruns.
+    if (thread_sync->immediate_drain_bytes &&
+        thread_sync->bytes_read[cpu] >= thread_sync->immediate_drain_bytes &&
+        !thread_sync->immediate_drain_posted) {
+      thread_sync->immediate_drain_posted = true;
+      drain_now = true;
+    }
+    if (!post_drain_task && !drain_now)
       return;
   }  // lock(thread_sync_.mutex)
 
   base::WeakPtr<FtraceController> weak_ctl = thread_sync->trace_controller_weak;
   base::TaskRunner* task_runner = thread_sync->task_runner;
 
+  if (drain_now) {
+    task_runner->PostTask([weak_ctl, generation] {
+      if (weak_ctl)
+        weak_ctl->DrainCPUs(generation);
+    });
+    return;
+  }
+
   // The nested PostTask is used because the FtraceController (and hence
   // GetDrainPeriodMs()) can be called only on the main thread.
   task_runner->PostTask([weak_ctl, task_runner, generation] {
@@ -225,31 +306,151 @@ void FtraceController::DrainCPUs(int generation) {
   if (generation != generation_)
     return;
 
+  // The CPUs that became ready while the workers are still draining stay
+  // flagged in |thread_sync_| and are drained once the workers are done.
+  if (pending_drain_tasks_) {
+    drain_requested_ = true;
+    return;
+  }
+
   const size_t num_cpus = ftrace_procfs_->NumberOfCpus();
   PERFETTO_DCHECK(cpu_readers_.size() == num_cpus);
-  FlushRequestID ack_flush_request_id = 0;
   std::bitset<base::kMaxCpus> cpus_to_drain;
+  std::bitset<base::kMaxCpus> cpus_near_full;
+  uint64_t max_bytes_read = 0;
   {
     std::lock_guard<std::mutex> lock(thread_sync_.mutex);
     std::swap(cpus_to_drain, thread_sync_.cpus_to_drain);
 
+    for (size_t cpu = 0; cpu < num_cpus; cpu++) {
+      if (!cpus_to_drain[cpu])
+        continue;
+      uint64_t bytes_read = thread_sync_.bytes_read[cpu];
+      thread_sync_.bytes_read[cpu] = 0;
+      max_bytes_read = std::max(max_bytes_read, bytes_read);
+      if (thread_sync_.immediate_drain_bytes &&
+          bytes_read >= thread_sync_.immediate_drain_bytes) {
+        cpus_near_full[cpu] = true;
+      }
+    }
+    if (thread_sync_.immediate_drain_posted) {
+      thread_sync_.immediate_drain_posted = false;
+      immediate_drains_++;
+    }
+
     // Check also if a flush is pending and if all cpus have acked. If that's
-    // the case, ack the overall Flush() request at the end of this function.
+    // the case, ack the overall Flush() request once the CPUs are drained.
     if (cur_flush_request_id_ && thread_sync_.flush_acks.count() >= num_cpus) {
       thread_sync_.flush_acks.reset();
-      ack_flush_request_id = cur_flush_request_id_;
+      drain_flush_request_id_ = cur_flush_request_id_;
       cur_flush_request_id_ = 0;
     }
   }
 
+  // A drain posted at the end of the drain period finds nothing to do if an
+  // immediate drain took care of the CPUs in the meantime.
+  if (cpus_to_drain.none() && !drain_flush_request_id_)
+    return;
+
+  // The readers don't report what they read for a flush, so flushes don't
+  // tell anything about the fill level of the kernel buffers.
+  if (!cur_flush_request_id_ && !drain_flush_request_id_)
+    UpdateDrainPeriod(max_bytes_read, cpus_near_full);
+
+  if (!drain_workers_) {
+    for (size_t cpu = 0; cpu < num_cpus; cpu++) {
+      if (!cpus_to_drain[cpu])
+        continue;
+      // This method reads the pipe and converts the raw ftrace data into
+      // protobufs using the |data_source|'s TraceWriter.
+      PERFETTO_METATRACE("Drain(" + std::to_string(cpu) + ")", kMainThread);
+      cpu_readers_[cpu]->Drain(started_data_sources_);
+      OnDrainCpuForTesting(cpu);
+    }
+    OnCPUsDrained();
+    return;
+  }
+
+  // Each worker drains its group of CPUs into its own writers of the data
+  // sources. The main thread only waits for all of them to post back before
+  // notifying the observer and acking the flush (if any). The main thread is
+  // never blocked on the workers: they might be waiting for shared memory
+  // chunks that are freed only after the main thread commits the full ones.
+  // Instead, the CpuReader(s) and the data sources outlive the tasks, see
+  // OnDrainWorkersIdle().
+  std::vector<std::vector<CpuReader*>> readers_per_worker(num_drain_workers_);
   for (size_t cpu = 0; cpu < num_cpus; cpu++) {
-    if (!cpus_to_drain[cpu])
+    if (cpus_to_drain[cpu])
+      readers_per_worker[cpu % num_drain_workers_].push_back(
+          cpu_readers_[cpu].get());
+  }
+  base::WeakPtr<FtraceController> weak_this = weak_factory_.GetWeakPtr();
+  for (size_t worker = 0; worker < num_drain_workers_; worker++) {
+    if (readers_per_worker[worker].empty())
+      continue;
+    pending_drain_tasks_++;
+    base::TaskRunner* task_runner = task_runner_;
+    const std::vector<CpuReader*>& readers = readers_per_worker[worker];
+    const std::set<FtraceDataSource*>& data_sources = started_data_sources_;
+    drain_workers_->PostTask(worker, [worker, task_runner, weak_this,
+                                      generation, readers, data_sources] {
+      for (CpuReader* reader : readers) {
+        PERFETTO_METATRACE("Drain(" + std::to_string(reader->cpu()) + ")",
+                           kFirstDrainWorkerThread + worker);
+        reader->Drain(data_sources, worker);
+      }
+      task_runner->PostTask([weak_this, generation] {
+        if (weak_this)
+          weak_this->OnDrainWorkerDone(generation);
+      });
+    });
+  }
+  if (!pending_drain_tasks_)
+    OnCPUsDrained();
+}
+
+void FtraceController::OnDrainWorkerDone(int generation) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  if (generation != generation_ || !pending_drain_tasks_)
+    return;
+  if (--pending_drain_tasks_)
+    return;
+
+  for (FtraceDataSource* data_source : started_data_sources_)
+    data_source->MergeDrainWorkerMetadata();
+  OnCPUsDrained();
+  OnDrainWorkersIdle();
+
+  if (drain_requested_) {
+    drain_requested_ = false;
+    DrainCPUs(generation);
+  }
+}
+
+// Makes the changes deferred while the drain tasks were in flight.
+void FtraceController::OnDrainWorkersIdle() {
+  PERFETTO_DCHECK(!pending_drain_tasks_);
+
+  // Destroying the retired data sources removes them, which stops the
+  // CpuReader(s) if no other data source is started.
+  retired_data_sources_.clear();
+
+  std::vector<PendingSetup> pending_setups;
+  std::swap(pending_setups, pending_setups_);
+  for (const PendingSetup& pending_setup : pending_setups) {
+    if (!SetupDataSource(pending_setup.data_source)) {
+      PERFETTO_ELOG(
+          "Failed to setup tracing (too many concurrent sessions or ftrace is "
+          "already in use)");
       continue;
-    // This method reads the pipe and converts the raw ftrace data into
-    // protobufs using the |data_source|'s TraceWriter.
-    cpu_readers_[cpu]->Drain(started_data_sources_);
-    OnDrainCpuForTesting(cpu);
+    }
+    if (pending_setup.start)
+      StartDataSource(pending_setup.data_source);
   }
+}
+
+void FtraceController::OnCPUsDrained() {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
 
   // If we filled up any SHM pages while draining the data, we will have posted
   // a task to notify traced about this. Only unblock the readers after this
@@ -266,15 +467,23 @@ void FtraceController::DrainCPUs(int generation) {
 
   observer_->OnFtraceDataWrittenIntoDataSourceBuffers();
 
-  if (ack_flush_request_id) {
+  if (drain_flush_request_id_) {
     // Flush completed, all CpuReader(s) acked.
+    FlushRequestID flush_request_id = drain_flush_request_id_;
+    drain_flush_request_id_ = 0;
 
     IssueThreadSyncCmd(FtraceThreadSync::kRun);  // Switch back to reading mode.
 
     // This will call FtraceDataSource::OnFtraceFlushComplete(), which in turn
     // will flush the userspace buffers and ack the flush to the ProbesProducer
     // which in turn will ack the flush to the tracing service.
-    NotifyFlushCompleteToStartedDataSources(ack_flush_request_id);
+    NotifyFlushCompleteToStartedDataSources(flush_request_id);
+  }
+
+  if (timed_out_flush_request_id_) {
+    FlushRequestID flush_request_id = timed_out_flush_request_id_;
+    timed_out_flush_request_id_ = 0;
+    NotifyFlushCompleteToStartedDataSources(flush_request_id);
   }
 }
 
@@ -294,19 +503,28 @@ void FtraceController::UnblockReaders() {
 void FtraceController::StartIfNeeded() {
   if (started_data_sources_.size() > 1)
     return;
+  // The CpuReader(s) are still running if the last started data source was
+  // retired while the drain workers were busy, see StopIfNeeded().
+  if (!cpu_readers_.empty())
+    return;
   PERFETTO_DCHECK(!started_data_sources_.empty());
-  PERFETTO_DCHECK(cpu_readers_.empty());
   base::WeakPtr<FtraceController> weak_this = weak_factory_.GetWeakPtr();
 
   {
     std::lock_guard<std::mutex> lock(thread_sync_.mutex);
     thread_sync_.cmd = FtraceThreadSync::kRun;
     thread_sync_.cmd_id++;
+    thread_sync_.bytes_read.fill(0);
+    thread_sync_.immediate_drain_bytes = GetImmediateDrainBytes();
+    thread_sync_.immediate_drain_posted = false;
   }
+  last_overrun_.assign(ftrace_procfs_->NumberOfCpus(), kUnknownOverrun);
 
   generation_++;
   cpu_readers_.clear();
   cpu_readers_.reserve(ftrace_procfs_->NumberOfCpus());
+  if (num_drain_workers_ > 1)
+    drain_workers_.reset(new base::ThreadPool(num_drain_workers_));
   for (size_t cpu = 0; cpu < ftrace_procfs_->NumberOfCpus(); cpu++) {
     cpu_readers_.emplace_back(
         new CpuReader(table_.get(), &thread_sync_, cpu, generation_,
@@ -315,6 +533,18 @@ void FtraceController::StartIfNeeded() {
 }
 
 uint32_t FtraceController::GetDrainPeriodMs() {
+  uint32_t configured_drain_period_ms = GetConfiguredDrainPeriodMs();
+  if (!adaptive_drain_period_ms_)
+    return configured_drain_period_ms;
+  // The data sources, and hence the bounds, might have changed since the
+  // period was adapted.
+  return std::min(
+      std::max(adaptive_drain_period_ms_,
+               MinAdaptiveDrainPeriodMs(configured_drain_period_ms)),
+      MaxAdaptiveDrainPeriodMs(configured_drain_period_ms));
+}
+
+uint32_t FtraceController::GetConfiguredDrainPeriodMs() {
   if (data_sources_.empty())
     return kDefaultDrainPeriodMs;
   uint32_t min_drain_period_ms = kMaxDrainPeriodMs + 1;
@@ -325,6 +555,61 @@ uint32_t FtraceController::GetDrainPeriodMs() {
   return ClampDrainPeriodMs(min_drain_period_ms);
 }
 
+uint64_t FtraceController::GetImmediateDrainBytes() {
+  uint64_t buffer_bytes =
+      ftrace_config_muxer_->GetPerCpuBufferSizePages() * base::kPageSize;
+  return buffer_bytes * kHighWatermarkPercent / 100;
+}
+
+void FtraceController::UpdateDrainPeriod(
+    uint64_t max_bytes_read,
+    const std::bitset<base::kMaxCpus>& cpus_near_full) {
+  uint64_t buffer_bytes =
+      ftrace_config_muxer_->GetPerCpuBufferSizePages() * base::kPageSize;
+  if (!buffer_bytes)
+    return;
+
+  // The kernel stats are read only for the CPUs close to full, to find out
+  // whether they overflowed already: reading them on every drain would cost
+  // more wakeups than it saves. The overrun counters are cumulative, the first
+  // read of each CPU only sets its baseline.
+  bool new_overruns = false;
+  for (size_t cpu = 0; cpu < last_overrun_.size(); cpu++) {
+    if (!cpus_near_full[cpu])
+      continue;
+    FtraceCpuStats cpu_stats{};
+    if (!DumpCpuStats(ftrace_procfs_->ReadCpuStats(cpu), &cpu_stats))
+      continue;
+    if (last_overrun_[cpu] != kUnknownOverrun &&
+        cpu_stats.overrun > last_overrun_[cpu]) {
+      new_overruns = true;
+    }
+    last_overrun_[cpu] = cpu_stats.overrun;
+  }
+
+  uint32_t configured_drain_period_ms = GetConfiguredDrainPeriodMs();
+  uint32_t drain_period_ms = GetDrainPeriodMs();
+  uint32_t new_drain_period_ms = drain_period_ms;
+  if (new_overruns) {
+    overrun_drains_++;
+    new_drain_period_ms = MinAdaptiveDrainPeriodMs(configured_drain_period_ms);
+  } else if (max_bytes_read * 100 >= buffer_bytes * kHighWatermarkPercent) {
+    new_drain_period_ms =
+        std::max(MinAdaptiveDrainPeriodMs(configured_drain_period_ms),
+                 drain_period_ms / 2);
+  } else if (max_bytes_read * 100 < buffer_bytes * kLowWatermarkPercent) {
+    new_drain_period_ms =
+        std::min(MaxAdaptiveDrainPeriodMs(configured_drain_period_ms),
+                 drain_period_ms * 2);
+  }
+
+  if (new_drain_period_ms < drain_period_ms)
+    drain_period_shortened_++;
+  if (new_drain_period_ms > drain_period_ms)
+    drain_period_lengthened_++;
+  adaptive_drain_period_ms_ = new_drain_period_ms;
+}
+
 void FtraceController::ClearTrace() {
   ftrace_procfs_->ClearTrace();
 }
@@ -376,6 +661,13 @@ void FtraceController::OnFlushTimeout(FlushRequestID flush_request_id) {
   PERFETTO_ELOG("Ftrace flush(%" PRIu64 ") timed out. Acked cpus: 0x%" PRIx64,
                 flush_request_id, acks);
   cur_flush_request_id_ = 0;
+
+  // The data sources' writers can't be flushed while the drain workers write
+  // into them. Defer the notification until they are done.
+  if (pending_drain_tasks_) {
+    timed_out_flush_request_id_ = flush_request_id;
+    return;
+  }
   NotifyFlushCompleteToStartedDataSources(flush_request_id);
 }
 
@@ -383,12 +675,25 @@ void FtraceController::StopIfNeeded() {
   if (!started_data_sources_.empty())
     return;
 
+  // The drain tasks in flight use the CpuReader(s). Retiring the last started
+  // data source calls this again once they are done, see RetireDataSource().
+  if (pending_drain_tasks_)
+    return;
+
   // We are not implicitly flushing on Stop. The tracing service is supposed to
   // ask for an explicit flush before stopping, unless it needs to perform a
   // non-graceful stop.
 
   IssueThreadSyncCmd(FtraceThreadSync::kQuit);
 
+  // No drain task is in flight, destroying the drain workers just joins them.
+  drain_workers_.reset();
+  drain_requested_ = false;
+  drain_flush_request_id_ = 0;
+  timed_out_flush_request_id_ = 0;
+  adaptive_drain_period_ms_ = 0;
+  last_overrun_.clear();
+
   // Destroying the CpuReader(s) will join on their worker threads.
   cpu_readers_.clear();
   generation_++;
@@ -399,7 +704,19 @@ bool FtraceController::AddDataSource(FtraceDataSource* data_source) {
   if (!ValidConfig(data_source->config()))
     return false;
 
+  // The drain tasks in flight read the translation table, which SetupConfig()
+  // extends with the events enabled for the first time.
+  if (pending_drain_tasks_) {
+    pending_setups_.push_back({data_source, false});
+    return true;
+  }
+  return SetupDataSource(data_source);
+}
+
+bool FtraceController::SetupDataSource(FtraceDataSource* data_source) {
   auto config_id = ftrace_config_muxer_->SetupConfig(data_source->config());
+  if (table_->format_cache())
+    table_->format_cache()->Save();
   if (!config_id)
     return false;
 
@@ -407,18 +724,42 @@ bool FtraceController::AddDataSource(FtraceDataSource* data_source) {
   auto it_and_inserted = data_sources_.insert(data_source);
   PERFETTO_DCHECK(it_and_inserted.second);
   data_source->Initialize(config_id, filter);
+
+  // The pages can contain the events of this config from now on. The data
+  // sources with raw_pages parse them instead, also after this config is
+  // removed: the pages already in the kernel buffer still contain them.
+  // No drain is in flight here, see AddDataSource().
+  for (FtraceDataSource* ds : data_sources_) {
+    if (ds->raw_pages() &&
+        !ftrace_config_muxer_->CanUseRawPages(ds->config_id())) {
+      PERFETTO_LOG("Parsing the raw_pages of config %" PRIu64
+                   ", as other events could be in them",
+                   ds->config_id());
+      ds->DisableRawPages();
+    }
+  }
   return true;
 }
 
 bool FtraceController::StartDataSource(FtraceDataSource* data_source) {
   PERFETTO_DCHECK_THREAD(thread_checker_);
 
+  for (PendingSetup& pending_setup : pending_setups_) {
+    if (pending_setup.data_source == data_source) {
+      pending_setup.start = true;
+      return true;
+    }
+  }
+
   FtraceConfigId config_id = data_source->config_id();
   PERFETTO_CHECK(config_id);
 
   if (!ftrace_config_muxer_->ActivateConfig(config_id))
     return false;
 
+  PERFETTO_DCHECK(num_drain_workers_ == 1 ||
+                  data_source->num_drain_workers() == num_drain_workers_);
+
   started_data_sources_.insert(data_source);
   StartIfNeeded();
   return true;
@@ -426,6 +767,16 @@ bool FtraceController::StartDataSource(FtraceDataSource* data_source) {
 
 void FtraceController::RemoveDataSource(FtraceDataSource* data_source) {
   PERFETTO_DCHECK_THREAD(thread_checker_);
+  for (auto it = pending_setups_.begin(); it != pending_setups_.end(); ++it) {
+    if (it->data_source == data_source) {
+      pending_setups_.erase(it);
+      return;
+    }
+  }
+  // The drain tasks in flight might be writing into |data_source|, see
+  // RetireDataSource().
+  PERFETTO_DCHECK(!pending_drain_tasks_ ||
+                  !started_data_sources_.count(data_source));
   started_data_sources_.erase(data_source);
   size_t removed = data_sources_.erase(data_source);
   if (!removed)
@@ -434,8 +785,26 @@ void FtraceController::RemoveDataSource(FtraceDataSource* data_source) {
   StopIfNeeded();
 }
 
+void FtraceController::RetireDataSource(
+    std::unique_ptr<FtraceDataSource> data_source) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  FtraceDataSource* raw_data_source = data_source.get();
+  if (!pending_drain_tasks_ || !started_data_sources_.count(raw_data_source)) {
+    data_source.reset();  // Calls RemoveDataSource().
+    return;
+  }
+  // The drain tasks posted from now on don't write into it anymore.
+  started_data_sources_.erase(raw_data_source);
+  retired_data_sources_.push_back(std::move(data_source));
+}
+
 void FtraceController::DumpFtraceStats(FtraceStats* stats) {
   DumpAllCpuStats(ftrace_procfs_.get(), stats);
+  stats->drain_period_ms = GetDrainPeriodMs();
+  stats->drain_period_shortened = drain_period_shortened_;
+  stats->drain_period_lengthened = drain_period_lengthened_;
+  stats->immediate_drains = immediate_drains_;
+  stats->overrun_drains = overrun_drains_;
 }
 
 void FtraceController::IssueThreadSyncCmd(
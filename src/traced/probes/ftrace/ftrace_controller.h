@@ -26,6 +26,7 @@
 #include <memory>
 #include <set>
 #include <string>
+#include <vector>
 
 #include "perfetto/base/gtest_prod_util.h"
 #include "perfetto/base/task_runner.h"
@@ -37,6 +38,10 @@
 
 namespace perfetto {
 
+namespace base {
+class ThreadPool;
+}  // namespace base
+
 class CpuReader;
 class FtraceConfigMuxer;
 class FtraceDataSource;
@@ -59,21 +64,40 @@ class FtraceController {
   };
 
   // The passed Observer must outlive the returned FtraceController instance.
-  static std::unique_ptr<FtraceController> Create(base::TaskRunner*, Observer*);
+  // The parsed formats of the ftrace events are kept across restarts in
+  // |format_cache_path| (see FormatCache). If empty, they are cached only in
+  // memory.
+  static std::unique_ptr<FtraceController> Create(
+      base::TaskRunner*,
+      Observer*,
+      const std::string& format_cache_path);
   virtual ~FtraceController();
 
   // These two methods are called by CpuReader(s) from their worker threads.
-  static void OnCpuReaderRead(size_t cpu, int generation, FtraceThreadSync*);
+  // |bytes_read| is the amount of data the CpuReader read in the cycle.
+  static void OnCpuReaderRead(size_t cpu,
+                              int generation,
+                              FtraceThreadSync*,
+                              size_t bytes_read);
   static void OnCpuReaderFlush(size_t cpu, int generation, FtraceThreadSync*);
 
   void DisableAllEvents();
   void WriteTraceMarker(const std::string& s);
   void ClearTrace();
 
+  // While the drain workers are busy, the setup of the data source is
+  // deferred until they are done: the data source is initialized then, and
+  // started if StartDataSource() was called in the meantime.
   bool AddDataSource(FtraceDataSource*) PERFETTO_WARN_UNUSED_RESULT;
   bool StartDataSource(FtraceDataSource*);
   void RemoveDataSource(FtraceDataSource*);
 
+  // Destroys |data_source|, which stops and removes it. The drain workers might
+  // still be writing into it: in that case it stops receiving data right away
+  // and is destroyed once they are done. Started data sources must be
+  // destroyed this way when the controller has more than one drain worker.
+  void RetireDataSource(std::unique_ptr<FtraceDataSource> data_source);
+
   // Force a read of the ftrace buffers, including kernel buffer pages that
   // are not full. Will call OnFtraceFlushComplete() on all
   // |started_data_sources_| once all workers have flushed (or timed out).
@@ -81,6 +105,13 @@ class FtraceController {
 
   void DumpFtraceStats(FtraceStats*);
 
+  // The number of workers that drain the CPUs in parallel. On machines with
+  // many CPUs each worker drains a group of CPUs, otherwise all CPUs are
+  // drained on the main thread and this returns 1. Each data source must be
+  // given one TraceWriter per worker, see
+  // FtraceDataSource::SetDrainWorkerWriters().
+  size_t num_drain_workers() const { return num_drain_workers_; }
+
   base::WeakPtr<FtraceController> GetWeakPtr() {
     return weak_factory_.GetWeakPtr();
   }
@@ -107,13 +138,28 @@ class FtraceController {
 
   void OnFlushTimeout(FlushRequestID);
   void DrainCPUs(int generation);
+  void OnDrainWorkerDone(int generation);
+  void OnDrainWorkersIdle();
+  void OnCPUsDrained();
   void UnblockReaders();
   void NotifyFlushCompleteToStartedDataSources(FlushRequestID);
   void IssueThreadSyncCmd(FtraceThreadSync::Cmd,
                           std::unique_lock<std::mutex> = {});
 
+  // Returns the drain period in use: the one adapted by UpdateDrainPeriod()
+  // if any, otherwise GetConfiguredDrainPeriodMs().
   uint32_t GetDrainPeriodMs();
+  uint32_t GetConfiguredDrainPeriodMs();
+
+  // Adapts the drain period to how full the kernel buffers got since the
+  // previous drain: |max_bytes_read| is the most any of the drained CPUs read
+  // in that time and |cpus_near_full| are the CPUs that read more than
+  // |thread_sync_.immediate_drain_bytes|.
+  void UpdateDrainPeriod(uint64_t max_bytes_read,
+                         const std::bitset<base::kMaxCpus>& cpus_near_full);
+  uint64_t GetImmediateDrainBytes();
 
+  bool SetupDataSource(FtraceDataSource*);
   void StartIfNeeded();
   void StopIfNeeded();
 
@@ -127,6 +173,33 @@ class FtraceController {
   FlushRequestID cur_flush_request_id_ = 0;
   bool atrace_running_ = false;
   std::vector<std::unique_ptr<CpuReader>> cpu_readers_;
+
+  // Drain workers, only created while tracing and if |num_drain_workers_| > 1.
+  // CPU |i| is always drained by the worker |i % num_drain_workers_|.
+  const size_t num_drain_workers_;
+  std::unique_ptr<base::ThreadPool> drain_workers_;
+  size_t pending_drain_tasks_ = 0;
+  bool drain_requested_ = false;  // DrainCPUs() was called while draining.
+  FlushRequestID drain_flush_request_id_ = 0;  // Acked once drained.
+  FlushRequestID timed_out_flush_request_id_ = 0;
+
+  // The changes that can't be made while the drain workers are busy, made
+  // once they are done, see OnDrainWorkersIdle().
+  struct PendingSetup {
+    FtraceDataSource* data_source;
+    bool start;  // StartDataSource() was called before the setup.
+  };
+  std::vector<PendingSetup> pending_setups_;
+  std::vector<std::unique_ptr<FtraceDataSource>> retired_data_sources_;
+
+  // Adaptive drain scheduling, see UpdateDrainPeriod(). Reset on stop.
+  uint32_t adaptive_drain_period_ms_ = 0;  // 0: not adapted yet.
+  std::vector<uint64_t> last_overrun_;      // Per CPU, from the kernel stats.
+  uint64_t drain_period_shortened_ = 0;
+  uint64_t drain_period_lengthened_ = 0;
+  uint64_t immediate_drains_ = 0;
+  uint64_t overrun_drains_ = 0;
+
   std::set<FtraceDataSource*> data_sources_;
   std::set<FtraceDataSource*> started_data_sources_;
   base::WeakPtrFactory<FtraceController> weak_factory_;  // Keep last.
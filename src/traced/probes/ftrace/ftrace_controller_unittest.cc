@@ -120,6 +120,14 @@ std::unique_ptr<Table> FakeTable(FtraceProcfs* ftrace) {
     events.push_back(event);
   }
 
+  {
+    Event event;
+    event.name = "print";
+    event.group = "ftrace";
+    event.ftrace_event_id = 20;
+    events.push_back(event);
+  }
+
   return std::unique_ptr<Table>(
       new Table(ftrace, events, std::move(common_fields),
                 ProtoTranslationTable::DefaultPageHeaderSpecForTesting()));
@@ -222,11 +230,13 @@ class TestFtraceController : public FtraceController,
 
   uint32_t drain_period_ms() { return GetDrainPeriodMs(); }
 
-  std::function<void()> GetDataAvailableCallback(size_t cpu) {
+  std::function<void()> GetDataAvailableCallback(size_t cpu,
+                                                 size_t bytes_read = 0) {
     int generation = generation_;
     auto* thread_sync = &thread_sync_;
-    return [cpu, generation, thread_sync] {
-      FtraceController::OnCpuReaderRead(cpu, generation, thread_sync);
+    return [cpu, generation, thread_sync, bytes_read] {
+      FtraceController::OnCpuReaderRead(cpu, generation, thread_sync,
+                                        bytes_read);
     };
   }
 
@@ -241,17 +251,31 @@ class TestFtraceController : public FtraceController,
     }
   }
 
+  void MarkCpuToDrain(size_t cpu) {
+    std::unique_lock<std::mutex> lock(thread_sync_.mutex);
+    thread_sync_.cpus_to_drain[cpu] = true;
+  }
+
+  void DrainCPUs() { FtraceController::DrainCPUs(generation_); }
+
   std::unique_ptr<FtraceDataSource> AddFakeDataSource(const FtraceConfig& cfg) {
     std::unique_ptr<FtraceDataSource> data_source(new FtraceDataSource(
         GetWeakPtr(), 0 /* session id */, cfg, nullptr /* trace_writer */));
+    std::vector<std::unique_ptr<TraceWriter>> worker_writers;
+    for (size_t i = 1; i < num_drain_workers(); i++)
+      worker_writers.emplace_back(new TraceWriterForTesting());
+    data_source->SetDrainWorkerWriters(std::move(worker_writers));
     if (!AddDataSource(data_source.get()))
       return nullptr;
     return data_source;
   }
 
-  void OnFtraceDataWrittenIntoDataSourceBuffers() override {}
+  void OnFtraceDataWrittenIntoDataSourceBuffers() override {
+    num_data_written_notifications++;
+  }
 
   uint64_t now_ms = 0;
+  size_t num_data_written_notifications = 0;
 
  private:
   TestFtraceController(const TestFtraceController&) = delete;
@@ -548,6 +572,223 @@ TEST(FtraceControllerTest, PeriodicDrainConfig) {
   }
 }
 
+TEST(FtraceControllerTest, DrainsCpuGroupsOnWorkers) {
+  auto controller = CreateTestController(
+      true /* nice runner */, true /* nice procfs */, 16 /* cpu_count */);
+  EXPECT_EQ(2u, controller->num_drain_workers());
+
+  FtraceConfig config = CreateFtraceConfig({"group/foo"});
+  auto data_source = controller->AddFakeDataSource(config);
+  ASSERT_TRUE(controller->StartDataSource(data_source.get()));
+
+  // CPUs 0 and 2 are drained by the first worker, not on the main thread.
+  EXPECT_CALL(*controller, OnDrainCpuForTesting(_)).Times(0);
+  controller->MarkCpuToDrain(0);
+  controller->MarkCpuToDrain(2);
+  controller->DrainCPUs();
+
+  // The observer is notified once the worker posts back to the main thread.
+  std::function<void()> task;
+  while (!(task = controller->runner()->TakeTask()))
+    usleep(1000);
+  EXPECT_EQ(0u, controller->num_data_written_notifications);
+  task();
+  EXPECT_EQ(1u, controller->num_data_written_notifications);
+}
+
+TEST(FtraceControllerTest, RetiresDataSourcesWhileWorkersDrain) {
+  auto controller = CreateTestController(
+      true /* nice runner */, true /* nice procfs */, 16 /* cpu_count */);
+  ASSERT_EQ(2u, controller->num_drain_workers());
+
+  FtraceConfig config = CreateFtraceConfig({"group/foo"});
+  auto data_source = controller->AddFakeDataSource(config);
+  ASSERT_TRUE(controller->StartDataSource(data_source.get()));
+  controller->MarkCpuToDrain(0);
+  controller->DrainCPUs();
+
+  // The main thread doesn't wait for the worker: the data source is destroyed,
+  // and ftrace stopped, once the worker posts back.
+  controller->RetireDataSource(std::move(data_source));
+  EXPECT_TRUE(controller->procfs()->is_tracing_on());
+
+  std::function<void()> task;
+  while (!(task = controller->runner()->TakeTask()))
+    usleep(1000);
+  task();
+  EXPECT_FALSE(controller->procfs()->is_tracing_on());
+}
+
+TEST(FtraceControllerTest, DefersSetupWhileWorkersDrain) {
+  auto controller = CreateTestController(
+      true /* nice runner */, true /* nice procfs */, 16 /* cpu_count */);
+  ASSERT_EQ(2u, controller->num_drain_workers());
+
+  FtraceConfig config = CreateFtraceConfig({"group/foo"});
+  auto data_source = controller->AddFakeDataSource(config);
+  ASSERT_TRUE(controller->StartDataSource(data_source.get()));
+  controller->MarkCpuToDrain(0);
+  controller->DrainCPUs();
+
+  // The drain task in flight reads the translation table: the new data source
+  // is set up, and started, once the worker posts back.
+  auto other_data_source = controller->AddFakeDataSource(config);
+  ASSERT_TRUE(other_data_source);
+  EXPECT_EQ(0u, other_data_source->config_id());
+  EXPECT_TRUE(controller->StartDataSource(other_data_source.get()));
+  controller->RetireDataSource(std::move(data_source));
+
+  std::function<void()> task;
+  while (!(task = controller->runner()->TakeTask()))
+    usleep(1000);
+  task();
+  EXPECT_NE(0u, other_data_source->config_id());
+  EXPECT_TRUE(controller->procfs()->is_tracing_on());
+}
+
+TEST(FtraceControllerTest, RepeatsRawPageFormat) {
+  auto controller = CreateTestController(
+      true /* nice runner */, true /* nice procfs */, 16 /* cpu_count */);
+  ASSERT_EQ(2u, controller->num_drain_workers());
+
+  FtraceConfig config = CreateFtraceConfig({"group/foo"});
+  config.set_raw_pages(true);
+  auto data_source = controller->AddFakeDataSource(config);
+  ASSERT_TRUE(controller->StartDataSource(data_source.get()));
+
+  // Each worker writes the layout of the pages into its own sequence, every
+  // kRawPageFormatInterval bundles.
+  for (size_t worker = 0; worker < 2; worker++) {
+    for (uint32_t i = 0; i < 2 * FtraceDataSource::kRawPageFormatInterval;
+         i++) {
+      EXPECT_EQ(i % FtraceDataSource::kRawPageFormatInterval == 0,
+                data_source->OnRawPageBundle(worker));
+    }
+  }
+  EXPECT_TRUE(data_source->OnRawPageBundle(0));
+  EXPECT_TRUE(data_source->OnRawPageBundle(1));
+
+  // And again after each flush.
+  controller->runner()->TakeTask();  // The periodic drain.
+  data_source->Flush(1, [] {});
+  controller->runner()->RunLastTask();  // The flush times out.
+  EXPECT_TRUE(data_source->OnRawPageBundle(0));
+  EXPECT_TRUE(data_source->OnRawPageBundle(1));
+  EXPECT_FALSE(data_source->OnRawPageBundle(1));
+}
+
+TEST(FtraceControllerTest, RawPagesOnlyWhileTheOnlyConfig) {
+  auto controller =
+      CreateTestController(true /* nice runner */, true /* nice procfs */);
+
+  FtraceConfig config = CreateFtraceConfig({"group/foo", "ftrace/print"});
+  config.set_raw_pages(true);
+  auto data_source = controller->AddFakeDataSource(config);
+  ASSERT_TRUE(data_source);
+  EXPECT_TRUE(data_source->raw_pages());
+
+  // The pages contain the events of the other config from now on. They are
+  // parsed even once it is removed, as the kernel buffer can still hold its
+  // events.
+  auto other_data_source =
+      controller->AddFakeDataSource(CreateFtraceConfig({"group/bar"}));
+  ASSERT_TRUE(other_data_source);
+  EXPECT_FALSE(data_source->raw_pages());
+  EXPECT_FALSE(other_data_source->raw_pages());
+  other_data_source.reset();
+  EXPECT_FALSE(data_source->raw_pages());
+
+  // Without ftrace/print, the pages can contain the writes to trace_marker.
+  data_source.reset();
+  config = CreateFtraceConfig({"group/foo"});
+  config.set_raw_pages(true);
+  data_source = controller->AddFakeDataSource(config);
+  ASSERT_TRUE(data_source);
+  EXPECT_FALSE(data_source->raw_pages());
+}
+
+TEST(FtraceControllerTest, AdaptsDrainPeriodToKernelBufferFill) {
+  auto controller =
+      CreateTestController(true /* nice runner */, true /* nice procfs */);
+
+  FtraceConfig config = CreateFtraceConfig({"group/foo"});
+  config.set_buffer_size_kb(1024);
+  auto data_source = controller->AddFakeDataSource(config);
+  ASSERT_TRUE(controller->StartDataSource(data_source.get()));
+  EXPECT_EQ(100u, controller->drain_period_ms());
+
+  // Runs the tasks of a read cycle of CPU 0 that read |bytes_read|: the drain
+  // (either delayed or immediate) and the unblocking of the readers.
+  auto read_and_drain = [&controller](size_t bytes_read) {
+    controller->GetDataAvailableCallback(0, bytes_read)();
+    for (int i = 0; i < 3; i++)
+      controller->runner()->RunLastTask();
+  };
+
+  // Less than 10% of the buffer: the period is doubled, up to 4x.
+  read_and_drain(4096);
+  EXPECT_EQ(200u, controller->drain_period_ms());
+  read_and_drain(4096);
+  EXPECT_EQ(400u, controller->drain_period_ms());
+
+  // The next two drains are delayed by the adapted period.
+  EXPECT_CALL(*controller->runner(), PostDelayedTask(_, 400)).Times(2);
+  read_and_drain(4096);
+  EXPECT_EQ(400u, controller->drain_period_ms());
+
+  // Between 10% and 50%: the period stays.
+  read_and_drain(300 * 1024);
+  EXPECT_EQ(400u, controller->drain_period_ms());
+
+  // Over 50%: drained right away and the period is halved.
+  EXPECT_CALL(*controller->runner(), PostDelayedTask(_, _)).Times(0);
+  read_and_drain(600 * 1024);
+  EXPECT_EQ(200u, controller->drain_period_ms());
+
+  FtraceStats stats{};
+  controller->DumpFtraceStats(&stats);
+  EXPECT_EQ(200u, stats.drain_period_ms);
+  EXPECT_EQ(1u, stats.drain_period_shortened);
+  EXPECT_EQ(2u, stats.drain_period_lengthened);
+  EXPECT_EQ(1u, stats.immediate_drains);
+  EXPECT_EQ(0u, stats.overrun_drains);
+}
+
+TEST(FtraceControllerTest, KernelOverrunsResetDrainPeriod) {
+  auto controller =
+      CreateTestController(true /* nice runner */, true /* nice procfs */);
+
+  FtraceConfig config = CreateFtraceConfig({"group/foo"});
+  config.set_buffer_size_kb(1024);
+  auto data_source = controller->AddFakeDataSource(config);
+  ASSERT_TRUE(controller->StartDataSource(data_source.get()));
+
+  auto read_and_drain = [&controller](size_t bytes_read) {
+    controller->GetDataAvailableCallback(0, bytes_read)();
+    for (int i = 0; i < 3; i++)
+      controller->runner()->RunLastTask();
+  };
+
+  // The first stats read of a CPU sets the baseline of its overruns.
+  ON_CALL(*controller->procfs(),
+          ReadFileIntoString("/root/per_cpu/cpu0/stats"))
+      .WillByDefault(Return("overrun: 3\n"));
+  read_and_drain(600 * 1024);
+  EXPECT_EQ(50u, controller->drain_period_ms());
+
+  // New overruns: straight to the shortest period.
+  ON_CALL(*controller->procfs(),
+          ReadFileIntoString("/root/per_cpu/cpu0/stats"))
+      .WillByDefault(Return("overrun: 5\n"));
+  read_and_drain(600 * 1024);
+  EXPECT_EQ(12u, controller->drain_period_ms());
+
+  FtraceStats stats{};
+  controller->DumpFtraceStats(&stats);
+  EXPECT_EQ(2u, stats.immediate_drains);
+  EXPECT_EQ(1u, stats.overrun_drains);
+}
+
 TEST(FtraceMetadataTest, Clear) {
   FtraceMetadata metadata;
   metadata.inode_and_device.push_back(std::make_pair(1, 1));
@@ -604,6 +845,9 @@ TEST(FtraceStatsTest, Write) {
   cpu_stats.entries = 1;
   cpu_stats.overrun = 2;
   stats.cpu_stats.push_back(cpu_stats);
+  stats.drain_period_ms = 50;
+  stats.immediate_drains = 3;
+  stats.raw_page_fallbacks = 4;
 
   std::unique_ptr<TraceWriterForTesting> writer =
       std::unique_ptr<TraceWriterForTesting>(new TraceWriterForTesting());
@@ -618,6 +862,10 @@ TEST(FtraceStatsTest, Write) {
   EXPECT_EQ(result.cpu(), 0);
   EXPECT_EQ(result.entries(), 1);
   EXPECT_EQ(result.overrun(), 2);
+  EXPECT_EQ(result_packet->ftrace_stats().drain_period_ms(), 50u);
+  EXPECT_EQ(result_packet->ftrace_stats().immediate_drains(), 3u);
+  EXPECT_EQ(result_packet->ftrace_stats().overrun_drains(), 0u);
+  EXPECT_EQ(result_packet->ftrace_stats().raw_page_fallbacks(), 4u);
 }
 
 }  // namespace perfetto
@@ -16,6 +16,8 @@
 
 #include "src/traced/probes/ftrace/ftrace_data_source.h"
 
+#include <algorithm>
+
 #include "src/traced/probes/ftrace/cpu_reader.h"
 #include "src/traced/probes/ftrace/ftrace_controller.h"
 
@@ -27,6 +29,7 @@ namespace perfetto {
 
 // static
 constexpr int FtraceDataSource::kTypeId;
+constexpr uint32_t FtraceDataSource::kRawPageFormatInterval;
 
 FtraceDataSource::FtraceDataSource(
     base::WeakPtr<FtraceController> controller_weak,
@@ -36,6 +39,9 @@ FtraceDataSource::FtraceDataSource(
     : ProbesDataSource(session_id, kTypeId),
       config_(config),
       writer_(std::move(writer)),
+      raw_bundles_since_format_(1),
+      raw_pages_(config.raw_pages()),
+      raw_page_fallbacks_(1),
       controller_weak_(std::move(controller_weak)){};
 
 FtraceDataSource::~FtraceDataSource() {
@@ -50,11 +56,38 @@ void FtraceDataSource::Initialize(FtraceConfigId config_id,
   event_filter_ = event_filter;
 }
 
+void FtraceDataSource::SetDrainWorkerWriters(
+    std::vector<std::unique_ptr<TraceWriter>> writers) {
+  worker_writers_ = std::move(writers);
+  worker_metadata_.clear();
+  worker_metadata_.resize(worker_writers_.size());
+  raw_bundles_since_format_.assign(1 + worker_writers_.size(), 0);
+  raw_page_fallbacks_.resize(1 + worker_writers_.size());
+}
+
+bool FtraceDataSource::OnRawPageBundle(size_t drain_worker) {
+  uint32_t& bundles = raw_bundles_since_format_[drain_worker];
+  bool needs_format = bundles == 0;
+  bundles = (bundles + 1) % kRawPageFormatInterval;
+  return needs_format;
+}
+
+void FtraceDataSource::MergeDrainWorkerMetadata() {
+  for (FtraceMetadata& metadata : worker_metadata_) {
+    metadata_.inode_and_device.insert(metadata_.inode_and_device.end(),
+                                      metadata.inode_and_device.begin(),
+                                      metadata.inode_and_device.end());
+    metadata_.pids.insert(metadata_.pids.end(), metadata.pids.begin(),
+                          metadata.pids.end());
+    metadata.Clear();
+  }
+}
+
 void FtraceDataSource::Start() {
   FtraceController* ftrace = controller_weak_.get();
   if (!ftrace)
     return;
-  PERFETTO_CHECK(config_id_);  // Must be initialized at this point.
+  // The controller might still be setting it up, see AddDataSource().
   if (!ftrace->StartDataSource(this))
     return;
   DumpFtraceStats(&stats_before_);
@@ -63,6 +96,9 @@ void FtraceDataSource::Start() {
 void FtraceDataSource::DumpFtraceStats(FtraceStats* stats) {
   if (controller_weak_)
     controller_weak_->DumpFtraceStats(stats);
+  stats->raw_page_fallbacks = 0;
+  for (uint64_t fallbacks : raw_page_fallbacks_)
+    stats->raw_page_fallbacks += fallbacks;
 }
 
 void FtraceDataSource::Flush(FlushRequestID flush_request_id,
@@ -92,6 +128,13 @@ void FtraceDataSource::OnFtraceFlushComplete(FlushRequestID flush_request_id) {
   }
   auto callback = std::move(it->second);
   pending_flushes_.erase(it);
+  // The chunks of the drain workers' writers are committed before the ones of
+  // |writer_|, whose flush acks the request.
+  for (const auto& worker_writer : worker_writers_)
+    worker_writer->Flush();
+  // The drain workers are idle, see FtraceController::Flush().
+  std::fill(raw_bundles_since_format_.begin(), raw_bundles_since_format_.end(),
+            0);
   if (writer_) {
     WriteStats();
     writer_->Flush(std::move(callback));
@@ -23,6 +23,7 @@
 #include <set>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "perfetto/base/scoped_file.h"
 #include "perfetto/base/weak_ptr.h"
@@ -55,6 +56,7 @@ class FtraceEventBundle;
 class FtraceDataSource : public ProbesDataSource {
  public:
   static constexpr int kTypeId = 1;
+  static constexpr uint32_t kRawPageFormatInterval = 64;
   FtraceDataSource(base::WeakPtr<FtraceController>,
                    TracingSessionID,
                    const FtraceConfig&,
@@ -73,12 +75,53 @@ class FtraceDataSource : public ProbesDataSource {
   void Flush(FlushRequestID, std::function<void()> callback) override;
   void OnFtraceFlushComplete(FlushRequestID);
 
+  // Called by ProbesProducer when the FtraceController drains the CPUs on more
+  // than one worker (see FtraceController::num_drain_workers()). Each worker
+  // after the first writes into its own TraceWriter, so that the workers
+  // never share the same chunks.
+  void SetDrainWorkerWriters(std::vector<std::unique_ptr<TraceWriter>>);
+
+  // Appends the metadata collected by the drain workers to the one returned by
+  // mutable_metadata(). Called on the main thread once the workers are idle.
+  void MergeDrainWorkerMetadata();
+
   FtraceConfigId config_id() const { return config_id_; }
   const FtraceConfig& config() const { return config_; }
   const EventFilter* event_filter() { return event_filter_; }
   FtraceMetadata* mutable_metadata() { return &metadata_; }
   TraceWriter* trace_writer() { return writer_.get(); }
 
+  // The writer and metadata used by the drain worker with the given index. The
+  // first worker (and the main thread, when there are no workers) uses
+  // trace_writer() and mutable_metadata().
+  size_t num_drain_workers() const { return 1 + worker_writers_.size(); }
+  TraceWriter* trace_writer(size_t drain_worker) {
+    return drain_worker ? worker_writers_[drain_worker - 1].get()
+                        : writer_.get();
+  }
+  FtraceMetadata* mutable_metadata(size_t drain_worker) {
+    return drain_worker ? &worker_metadata_[drain_worker - 1] : &metadata_;
+  }
+
+  // Called for each bundle of raw pages written by the given drain worker,
+  // see FtraceConfig.raw_pages. Returns whether the bundle has to carry the
+  // layout of the pages too. The layout is repeated every
+  // kRawPageFormatInterval bundles and after each flush: in ring buffer mode
+  // the first bundles of the sequence are overwritten, and without it the
+  // pages that are left can't be decoded.
+  bool OnRawPageBundle(size_t drain_worker);
+
+  // Whether the pages are written as they are, see FtraceConfig.raw_pages.
+  // The FtraceController turns this off for good, with DisableRawPages(), as
+  // soon as the pages could contain events that this data source didn't ask
+  // for. From then on they are parsed, and each of them is counted by
+  // OnRawPageFallback() for the FtraceStats.
+  bool raw_pages() const { return raw_pages_; }
+  void DisableRawPages() { raw_pages_ = false; }
+  void OnRawPageFallback(size_t drain_worker) {
+    raw_page_fallbacks_[drain_worker]++;
+  }
+
  private:
   FtraceDataSource(const FtraceDataSource&) = delete;
   FtraceDataSource& operator=(const FtraceDataSource&) = delete;
@@ -94,6 +137,16 @@ class FtraceDataSource : public ProbesDataSource {
   // Initialized by the Initialize() call.
   FtraceConfigId config_id_ = 0;
   std::unique_ptr<TraceWriter> writer_;
+  std::vector<std::unique_ptr<TraceWriter>> worker_writers_;
+  std::vector<FtraceMetadata> worker_metadata_;
+  // The raw page bundles written by each drain worker since the last one with
+  // the layout of the pages, see OnRawPageBundle(). Each entry is written only
+  // by its worker.
+  std::vector<uint32_t> raw_bundles_since_format_;
+  bool raw_pages_;
+  // The pages parsed by each drain worker although raw_pages was requested.
+  // Each entry is written only by its worker.
+  std::vector<uint64_t> raw_page_fallbacks_;
   base::WeakPtr<FtraceController> controller_weak_;
   const EventFilter* event_filter_;
 };
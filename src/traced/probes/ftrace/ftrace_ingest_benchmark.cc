@@ -0,0 +1,247 @@
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <memory>
+#include <vector>
+
+#include <atomic>
+
+#include "benchmark/benchmark.h"
+
+#include "perfetto/base/paged_memory.h"
+#include "perfetto/base/task_runner.h"
+#include "perfetto/base/thread_pool.h"
+#include "perfetto/base/utils.h"
+#include "perfetto/tracing/core/commit_data_request.h"
+#include "perfetto/tracing/core/shared_memory_abi.h"
+#include "perfetto/tracing/core/trace_writer.h"
+#include "perfetto/tracing/core/tracing_service.h"
+#include "src/traced/probes/ftrace/compact_sched.h"
+#include "src/traced/probes/ftrace/cpu_reader.h"
+#include "src/traced/probes/ftrace/ftrace_metadata.h"
+#include "src/traced/probes/ftrace/proto_translation_table.h"
+#include "src/traced/probes/ftrace/test/cpu_reader_support.h"
+#include "src/traced/probes/ftrace/test/page_generator.h"
+#include "src/tracing/core/shared_memory_arbiter_impl.h"
+
+#include "perfetto/trace/ftrace/ftrace_event_bundle.pbzero.h"
+#include "perfetto/trace/trace_packet.pbzero.h"
+
+// End-to-end throughput of the ftrace hot path of traced_probes: the raw pages
+// of |state.range(0)| CPUs, full of a realistic mix of events generated from
+// the format files of a device, are translated by CpuReader into TracePackets
+// written into the shared memory buffer, as CpuReader::Drain() does. Like the
+// drain workers of FtraceController, each simulated CPU is drained by its own
+// thread through its own TraceWriter, and all the writers share the arbiter
+// of the shared memory buffer. The service end frees the chunks as soon as
+// they are committed. Reported:
+// - bytes_per_second: raw ftrace data consumed.
+// - events: ftrace events per second, also per CPU.
+// - smb_bytes: bytes committed to the shared memory buffer per raw page.
+
+namespace perfetto {
+namespace {
+
+constexpr char kDevice[] = "android_walleye_OPM5.171019.017.A1_4.4.88";
+constexpr size_t kSmbPageSize = 4096;
+constexpr size_t kSmbPages = 128;
+constexpr BufferID kBufId = 1;
+// The pages each CPU has to drain in each iteration, a few tens of ms of a
+// busy CPU with the default options of the PageGenerator.
+constexpr size_t kPagesPerCpu = 16;
+
+// Runs the tasks synchronously on the posting thread, so that the arbiter
+// commits the chunks without the need of a message loop. The chunks are thus
+// committed by the threads that complete them.
+class InlineTaskRunner : public base::TaskRunner {
+ public:
+  void PostTask(std::function<void()> task) override { task(); }
+  void PostDelayedTask(std::function<void()> task, uint32_t) override {
+    task();
+  }
+  void AddFileDescriptorWatch(int, std::function<void()>) override {}
+  void RemoveFileDescriptorWatch(int) override {}
+  bool RunsTasksOnCurrentThread() const override { return true; }
+};
+
+// Frees the committed chunks straight away, as the service would do after
+// copying them into its trace buffer, and counts their bytes.
+class RecyclingProducerEndpoint : public TracingService::ProducerEndpoint {
+ public:
+  void set_shmem_abi(SharedMemoryABI* abi) { abi_ = abi; }
+  uint64_t committed_bytes() const { return committed_bytes_.load(); }
+
+  void CommitData(const CommitDataRequest& req,
+                  CommitDataCallback callback) override {
+    for (const auto& ctm : req.chunks_to_move()) {
+      auto chunk = abi_->TryAcquireChunkForReading(ctm.page(), ctm.chunk());
+      if (!chunk.is_valid())
+        continue;
+      committed_bytes_.fetch_add(chunk.size(), std::memory_order_relaxed);
+      abi_->ReleaseChunkAsFree(std::move(chunk));
+    }
+    if (callback)
+      callback();
+  }
+
+  void RegisterDataSource(const DataSourceDescriptor&) override {}
+  void UnregisterDataSource(const std::string&) override {}
+  void RegisterTraceWriter(uint32_t, uint32_t) override {}
+  void UnregisterTraceWriter(uint32_t) override {}
+  void NotifyFlushComplete(FlushRequestID) override {}
+  void NotifyDataSourceStopped(DataSourceInstanceID) override {}
+  SharedMemory* shared_memory() const override { return nullptr; }
+  size_t shared_buffer_page_size_kb() const override { return 0; }
+  uint32_t batch_commits_duration_ms() const override { return 0; }
+  std::unique_ptr<TraceWriter> CreateTraceWriter(BufferID) override {
+    return nullptr;
+  }
+
+ private:
+  SharedMemoryABI* abi_ = nullptr;
+  std::atomic<uint64_t> committed_bytes_{0};
+};
+
+struct TracingEnvironment {
+  TracingEnvironment()
+      : buf(base::PagedMemory::Allocate(kSmbPageSize * kSmbPages)),
+        arbiter(static_cast<uint8_t*>(buf.Get()),
+                kSmbPageSize * kSmbPages,
+                kSmbPageSize,
+                &endpoint,
+                &task_runner) {
+    endpoint.set_shmem_abi(arbiter.shmem_abi_for_testing());
+  }
+
+  base::PagedMemory buf;
+  InlineTaskRunner task_runner;
+  RecyclingProducerEndpoint endpoint;
+  SharedMemoryArbiterImpl arbiter;
+};
+
+// How the data source translates the pages, see FtraceConfig.
+enum class Encoding { kEvents, kCompactSched, kRawPages };
+
+template <Encoding encoding>
+void BM_FtraceIngest(benchmark::State& state) {
+  const size_t num_cpus = static_cast<size_t>(state.range(0));
+  ProtoTranslationTable* table = GetTable(kDevice);
+
+  PageGenerator::Options options = PageGenerator::DefaultOptions();
+  EventFilter filter;
+  for (const PageGenerator::EventWeight& event : options.events)
+    filter.AddEnabledEvent(
+        table->EventToFtraceId(GroupAndName(event.group, event.name)));
+
+  // The state of a simulated CPU, only touched by its own drain thread.
+  struct Cpu {
+    std::vector<std::unique_ptr<uint8_t[]>> pages;
+    std::unique_ptr<TraceWriter> writer;
+    FtraceMetadata metadata{};
+    CompactSchedBuffer compact_sched;
+    bool raw_page_format_written = false;
+  };
+
+  // Each CPU has its own stream of events.
+  TracingEnvironment env;
+  std::vector<std::unique_ptr<Cpu>> cpus;
+  size_t num_events = 0;
+  for (size_t i = 0; i < num_cpus; i++) {
+    std::unique_ptr<Cpu> cpu(new Cpu());
+    PageGenerator generator(table, options, static_cast<uint32_t>(i + 1));
+    for (size_t j = 0; j < kPagesPerCpu; j++)
+      cpu->pages.push_back(generator.GeneratePage());
+    num_events += generator.events();
+    cpu->writer = env.arbiter.CreateTraceWriter(kBufId);
+    cpus.push_back(std::move(cpu));
+  }
+
+  auto drain = [table, &filter](uint32_t cpu_index, Cpu* cpu) {
+    for (const std::unique_ptr<uint8_t[]>& page : cpu->pages) {
+      auto packet = cpu->writer->NewTracePacket();
+      auto* bundle = packet->set_ftrace_events();
+      bundle->set_cpu(cpu_index);
+      if (encoding == Encoding::kRawPages) {
+        if (!cpu->raw_page_format_written) {
+          CpuReader::WriteRawPageFormat(table, &filter,
+                                        bundle->set_raw_page_format());
+          cpu->raw_page_format_written = true;
+        }
+        CpuReader::WriteRawPage(page.get(), table, bundle);
+        continue;
+      }
+      CpuReader::ParsePage(
+          page.get(), &filter, bundle, table, &cpu->metadata,
+          encoding == Encoding::kCompactSched ? &cpu->compact_sched : nullptr);
+      bundle->set_overwrite_count(cpu->metadata.overwrite_count);
+    }
+    // The metadata is cleared by each flush of the data source.
+    cpu->metadata.Clear();
+  };
+
+  base::ThreadPool drain_threads(num_cpus);
+  uint64_t committed_bytes = env.endpoint.committed_bytes();
+  while (state.KeepRunning()) {
+    for (size_t i = 0; i < num_cpus; i++) {
+      Cpu* cpu = cpus[i].get();
+      drain_threads.PostTask(i, [&drain, i, cpu] {
+        drain(static_cast<uint32_t>(i), cpu);
+      });
+    }
+    drain_threads.WaitIdle();
+  }
+  for (size_t i = 0; i < num_cpus; i++) {
+    Cpu* cpu = cpus[i].get();
+    drain_threads.PostTask(i, [cpu] { cpu->writer->Flush(); });
+  }
+  drain_threads.WaitIdle();
+
+  const double num_pages = static_cast<double>(num_cpus * kPagesPerCpu);
+  const double iterations = static_cast<double>(state.iterations());
+  state.SetBytesProcessed(static_cast<int64_t>(
+      static_cast<size_t>(state.iterations()) * num_cpus * kPagesPerCpu *
+      base::kPageSize));
+  state.counters["events"] =
+      benchmark::Counter(static_cast<double>(num_events) * iterations,
+                         benchmark::Counter::kIsRate);
+  state.counters["events_per_cpu"] = benchmark::Counter(
+      static_cast<double>(num_events) * iterations /
+          static_cast<double>(num_cpus),
+      benchmark::Counter::kIsRate);
+  state.counters["smb_bytes"] = benchmark::Counter(
+      static_cast<double>(env.endpoint.committed_bytes() - committed_bytes) /
+      (num_pages * iterations));
+}
+
+}  // namespace
+}  // namespace perfetto
+
+using perfetto::BM_FtraceIngest;
+using perfetto::Encoding;
+
+BENCHMARK_TEMPLATE(BM_FtraceIngest, Encoding::kEvents)
+    ->Arg(1)
+    ->Arg(4)
+    ->Arg(8)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_FtraceIngest, Encoding::kCompactSched)
+    ->Arg(1)
+    ->Arg(4)
+    ->Arg(8)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_FtraceIngest, Encoding::kRawPages)
+    ->Arg(1)
+    ->Arg(4)
+    ->Arg(8)
+    ->UseRealTime();
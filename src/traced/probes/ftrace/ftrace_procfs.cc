@@ -16,6 +16,7 @@
 
 #include "src/traced/probes/ftrace/ftrace_procfs.h"
 
+#include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -101,12 +102,48 @@ bool FtraceProcfs::DisableAllEvents() {
   return WriteToFile(path, "0");
 }
 
+bool FtraceProcfs::SetEventFilter(const std::string& group,
+                                  const std::string& name,
+                                  const std::string& filter) {
+  std::string path = root_ + "events/" + group + "/" + name + "/filter";
+  return WriteToFile(path, filter);
+}
+
+bool FtraceProcfs::ClearEventFilter(const std::string& group,
+                                    const std::string& name) {
+  std::string path = root_ + "events/" + group + "/" + name + "/filter";
+  return WriteToFile(path, "0");
+}
+
+bool FtraceProcfs::SetEventPids(const std::vector<int32_t>& pids) {
+  std::string path = root_ + "set_event_pid";
+  std::string str;
+  for (int32_t pid : pids) {
+    if (!str.empty())
+      str += " ";
+    str += std::to_string(pid);
+  }
+  return WriteToFile(path, str);
+}
+
+bool FtraceProcfs::ClearEventPids() {
+  std::string path = root_ + "set_event_pid";
+  return ClearFile(path);
+}
+
 std::string FtraceProcfs::ReadEventFormat(const std::string& group,
                                           const std::string& name) const {
   std::string path = root_ + "events/" + group + "/" + name + "/format";
   return ReadFileIntoString(path);
 }
 
+uint32_t FtraceProcfs::ReadEventId(const std::string& group,
+                                   const std::string& name) const {
+  std::string path = root_ + "events/" + group + "/" + name + "/id";
+  std::string id = ReadFileIntoString(path);
+  return static_cast<uint32_t>(strtoul(id.c_str(), nullptr, 10));
+}
+
 std::string FtraceProcfs::ReadPageHeaderFormat() const {
   std::string path = root_ + "events/header_page";
   return ReadFileIntoString(path);
@@ -17,9 +17,12 @@
 #ifndef SRC_TRACED_PROBES_FTRACE_FTRACE_PROCFS_H_
 #define SRC_TRACED_PROBES_FTRACE_FTRACE_PROCFS_H_
 
+#include <stdint.h>
+
 #include <memory>
 #include <set>
 #include <string>
+#include <vector>
 
 #include "perfetto/base/scoped_file.h"
 
@@ -42,6 +45,21 @@ class FtraceProcfs {
   // Disable all events by writing to the global enable file.
   bool DisableAllEvents();
 
+  // Sets the filter expression (e.g. "prev_pid == 42") of the event with the
+  // given |group| and |name|: the kernel records only the events that match.
+  bool SetEventFilter(const std::string& group,
+                      const std::string& name,
+                      const std::string& filter);
+
+  // Removes the filter of the event with the given |group| and |name|.
+  bool ClearEventFilter(const std::string& group, const std::string& name);
+
+  // Makes the kernel record only the events emitted by the threads |pids|.
+  bool SetEventPids(const std::vector<int32_t>& pids);
+
+  // Makes the kernel record again the events of all the threads.
+  bool ClearEventPids();
+
   // Read the format for event with the given |group| and |name|.
   // virtual for testing.
   virtual std::string ReadEventFormat(const std::string& group,
@@ -49,6 +67,12 @@ class FtraceProcfs {
 
   virtual std::string ReadPageHeaderFormat() const;
 
+  // Read the id of the event with the given |group| and |name|, 0 if the
+  // event doesn't exist. Much cheaper than reading its format.
+  // virtual for testing.
+  virtual uint32_t ReadEventId(const std::string& group,
+                               const std::string& name) const;
+
   // Read the "/per_cpu/cpuXX/stats" file for the given |cpu|.
   std::string ReadCpuStats(size_t cpu) const;
 
@@ -24,6 +24,13 @@ void FtraceStats::Write(protos::pbzero::FtraceStats* writer) const {
   for (const FtraceCpuStats& cpu_specific_stats : cpu_stats) {
     cpu_specific_stats.Write(writer->add_cpu_stats());
   }
+  if (drain_period_ms)
+    writer->set_drain_period_ms(drain_period_ms);
+  writer->set_drain_period_shortened(drain_period_shortened);
+  writer->set_drain_period_lengthened(drain_period_lengthened);
+  writer->set_immediate_drains(immediate_drains);
+  writer->set_overrun_drains(overrun_drains);
+  writer->set_raw_page_fallbacks(raw_page_fallbacks);
 }
 
 void FtraceCpuStats::Write(protos::pbzero::FtraceCpuStats* writer) const {
@@ -47,6 +47,18 @@ struct FtraceCpuStats {
 struct FtraceStats {
   std::vector<FtraceCpuStats> cpu_stats;
 
+  // The adaptive drain scheduling of the FtraceController, see
+  // FtraceController::UpdateDrainPeriod().
+  uint32_t drain_period_ms;
+  uint64_t drain_period_shortened;
+  uint64_t drain_period_lengthened;
+  uint64_t immediate_drains;
+  uint64_t overrun_drains;
+
+  // Pages parsed into events for a data source with FtraceConfig.raw_pages,
+  // because other events than its own could be in them.
+  uint64_t raw_page_fallbacks;
+
   void Write(protos::pbzero::FtraceStats*) const;
 };
 
@@ -19,6 +19,7 @@
 
 #include <stdint.h>
 
+#include <array>
 #include <bitset>
 #include <condition_variable>
 #include <mutex>
@@ -71,6 +72,18 @@ struct FtraceThreadSync {
   // This bitmap is cleared by the FtraceController before issuing a kFlush
   // command and set by each CpuReader after they have completed the flush.
   std::bitset<base::kMaxCpus> flush_acks;
+
+  // Bytes read by each CpuReader since its CPU was last drained. Set by
+  // OnCpuReaderRead() and cleared by the FtraceController when draining.
+  std::array<uint64_t, base::kMaxCpus> bytes_read{};
+
+  // If non-zero, a CPU that reads this many bytes between two drains makes
+  // OnCpuReaderRead() post a drain right away rather than at the end of the
+  // drain period, as its kernel buffer is about to overflow.
+  // |immediate_drain_posted| avoids posting more than one of those per drain.
+  // Both are reset by the FtraceController.
+  uint64_t immediate_drain_bytes = 0;
+  bool immediate_drain_posted = false;
 };
 
 }  // namespace perfetto
@@ -16,40 +16,50 @@
 
 #include "src/traced/probes/ftrace/page_pool.h"
 
-#include <array>
-
 namespace perfetto {
 
-namespace {
-constexpr size_t kMaxFreelistBlocks = 128;  // 128 * 32 * 4KB = 16MB.
-}
+// static
+constexpr size_t PagePool::kReadyRingBlocks;
+constexpr size_t PagePool::kFreeRingBlocks;
 
 void PagePool::NewPageBlock() {
-  std::lock_guard<std::mutex> lock(mutex_);
-  if (freelist_.empty()) {
-    write_queue_.emplace_back(PageBlock::Create());
+  base::Optional<PageBlock> block;
+  if (free_ring_.Pop(&block)) {
+    write_queue_.emplace_back(std::move(*block));
   } else {
-    write_queue_.emplace_back(std::move(freelist_.back()));
-    freelist_.pop_back();
+    write_queue_.emplace_back(PageBlock::Create());
   }
   PERFETTO_DCHECK(write_queue_.back().size() == 0);
 }
 
+void PagePool::CommitWrittenPages() {
+  PERFETTO_DCHECK_THREAD(writer_thread_);
+  auto it = write_queue_.begin();
+  while (it != write_queue_.end() && ready_ring_.Push(&*it))
+    it++;
+  write_queue_.erase(write_queue_.begin(), it);
+}
+
+std::vector<PagePool::PageBlock> PagePool::BeginRead() {
+  PERFETTO_DCHECK_THREAD(reader_thread_);
+  std::vector<PageBlock> res;
+  base::Optional<PageBlock> block;
+  while (ready_ring_.Pop(&block))
+    res.emplace_back(std::move(*block));
+  return res;
+}
+
 void PagePool::EndRead(std::vector<PageBlock> page_blocks) {
   PERFETTO_DCHECK_THREAD(reader_thread_);
-  for (PageBlock& page_block : page_blocks)
+  for (PageBlock& page_block : page_blocks) {
     page_block.Clear();
-
-  std::lock_guard<std::mutex> lock(mutex_);
-  freelist_.insert(freelist_.end(),
-                   std::make_move_iterator(page_blocks.begin()),
-                   std::make_move_iterator(page_blocks.end()));
-
-  // Even if blocks in the freelist don't waste any resident memory (because
-  // the Clear() call above madvise()s them) let's avoid that in pathological
-  // cases we keep accumulating virtual address space reservations.
-  if (freelist_.size() > kMaxFreelistBlocks)
-    freelist_.erase(freelist_.begin() + kMaxFreelistBlocks, freelist_.end());
+    // Even if blocks in the free ring don't waste any resident memory (because
+    // the Clear() call above madvise()s them) let's avoid that in pathological
+    // cases we keep accumulating virtual address space reservations: the
+    // blocks that don't fit are freed.
+    if (!free_ring_.Push(&page_block))
+      break;
+  }
 }
 
 }  // namespace perfetto
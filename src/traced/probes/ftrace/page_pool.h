@@ -19,7 +19,8 @@
 
 #include <stdint.h>
 
-#include <mutex>
+#include <atomic>
+#include <memory>
 #include <vector>
 
 #include "perfetto/base/logging.h"
@@ -64,12 +65,17 @@ namespace perfetto {
 //
 //      [      Writer (thread worker)    ] | [    Reader (main thread)   ]
 //                                  ~~~~~~~~~~~~~~~~~~~~~
-//      +---> write queue ------------> ready queue --+
+//      +---> write queue ------------> ready ring ---+
 //      |                                             |
-//      +------------------------------- freelist <---+
+//      +------------------------------- free ring <--+
 //                                  ~~~~~~~~~~~~~~~~~~~~~
-//                                  ~  mutex protected  ~
+//                                  ~ lock-free (SPSC)  ~
 //                                  ~~~~~~~~~~~~~~~~~~~~~
+//
+// Both rings have exactly one producer and one consumer thread, so the
+// handoffs don't need any lock. Neither side ever waits for the other: the
+// reader is told that there is data by FtraceController, and the writer
+// allocates a new block if the free ring is empty.
 class PagePool {
  public:
   class PageBlock {
@@ -115,6 +121,16 @@ class PagePool {
     size_t size_ = 0;
   };
 
+  // The capacity of the ready ring, in blocks: as much as the biggest per-cpu
+  // kernel buffer (64 MB), which is the most a writer can read between two
+  // reads unless the kernel overwrote some of it. Beyond that, the blocks wait
+  // in the write queue for the next CommitWrittenPages().
+  static constexpr size_t kReadyRingBlocks = 512;
+
+  // The capacity of the free ring, in blocks. The blocks returned beyond that
+  // are freed.
+  static constexpr size_t kFreeRingBlocks = 128;  // 128 * 32 * 4KB = 16MB.
+
   PagePool() {
     PERFETTO_DETACH_FROM_THREAD(writer_thread_);
     PERFETTO_DETACH_FROM_THREAD(reader_thread_);
@@ -139,35 +155,77 @@ class PagePool {
     write_queue_.back().NextPage();
   }
 
-  // Makes all written pages available to the reader.
-  void CommitWrittenPages() {
-    PERFETTO_DCHECK_THREAD(writer_thread_);
-    std::lock_guard<std::mutex> lock(mutex_);
-    read_queue_.insert(read_queue_.end(),
-                       std::make_move_iterator(write_queue_.begin()),
-                       std::make_move_iterator(write_queue_.end()));
-    write_queue_.clear();
-  }
+  // Makes all written pages available to the reader. If the ready ring is
+  // full, the blocks that don't fit are made available by the next call.
+  void CommitWrittenPages();
 
-  // Moves ownership of all the page blocks in the read queue to the caller.
+  // Moves ownership of all the page blocks in the ready ring to the caller.
   // The caller is expected to move them back after reading through EndRead().
   // PageBlocks will be freed if the caller doesn't call EndRead().
-  std::vector<PageBlock> BeginRead() {
-    PERFETTO_DCHECK_THREAD(reader_thread_);
-    std::lock_guard<std::mutex> lock(mutex_);
-    auto res = std::move(read_queue_);
-    read_queue_.clear();
-    return res;
-  }
+  std::vector<PageBlock> BeginRead();
 
   // Returns the page blocks borrowed for read and makes them available for
   // reuse. This allows the writer to avoid doing syscalls after the initial
   // writes.
   void EndRead(std::vector<PageBlock> page_blocks);
 
-  size_t freelist_size_for_testing() const { return freelist_.size(); }
+  // Only valid when neither the writer nor the reader are active.
+  size_t freelist_size_for_testing() const { return free_ring_.size(); }
+  size_t write_queue_size_for_testing() const { return write_queue_.size(); }
 
  private:
+  // A bounded lock-free queue of PageBlock(s) between exactly one producer
+  // thread and one consumer thread. Each side writes only its own position in
+  // the ring, so that the two threads can go through their blocks without
+  // bouncing each other's cache line.
+  template <size_t kCapacity>
+  class BlockRing {
+   public:
+    static_assert((kCapacity & (kCapacity - 1)) == 0,
+                  "kCapacity must be a power of 2");
+
+    BlockRing() : slots_(new base::Optional<PageBlock>[kCapacity]) {}
+
+    // Called only by the producer. Moves |*block| at the end of the ring and
+    // returns true, unless the ring is full.
+    bool Push(PageBlock* block) {
+      const size_t tail = pos_.tail.load(std::memory_order_relaxed);
+      if (tail - pos_.head.load(std::memory_order_acquire) == kCapacity)
+        return false;
+      slots_[tail & (kCapacity - 1)] = std::move(*block);
+      pos_.tail.store(tail + 1, std::memory_order_release);
+      return true;
+    }
+
+    // Called only by the consumer. Moves the block at the start of the ring
+    // into |*out| and returns true, unless the ring is empty.
+    bool Pop(base::Optional<PageBlock>* out) {
+      const size_t head = pos_.head.load(std::memory_order_relaxed);
+      if (head == pos_.tail.load(std::memory_order_acquire))
+        return false;
+      base::Optional<PageBlock>& slot = slots_[head & (kCapacity - 1)];
+      *out = std::move(slot);
+      slot.reset();
+      pos_.head.store(head + 1, std::memory_order_release);
+      return true;
+    }
+
+    size_t size() const {
+      return pos_.tail.load(std::memory_order_acquire) -
+             pos_.head.load(std::memory_order_acquire);
+    }
+
+   private:
+    struct Positions {
+      std::atomic<size_t> head{0};  // Written only by the consumer.
+      char padding[64];  // Keeps |head| and |tail| on different cache lines.
+      std::atomic<size_t> tail{0};  // Written only by the producer.
+    };
+
+    std::unique_ptr<base::Optional<PageBlock>[]> slots_;
+    Positions pos_;
+  };
+
   PagePool(const PagePool&) = delete;
   PagePool& operator=(const PagePool&) = delete;
   void NewPageBlock();
@@ -175,11 +233,13 @@ class PagePool {
   PERFETTO_THREAD_CHECKER(writer_thread_)
   std::vector<PageBlock> write_queue_;  // Accessed exclusively by the writer.
 
-  std::mutex mutex_;  // Protects both the read queue and the freelist.
-
   PERFETTO_THREAD_CHECKER(reader_thread_)
-  std::vector<PageBlock> read_queue_;  // Accessed by both threads.
-  std::vector<PageBlock> freelist_;    // Accessed by both threads.
+
+  // Written by the writer and read by the reader.
+  BlockRing<kReadyRingBlocks> ready_ring_;
+
+  // Written by the reader and read by the writer.
+  BlockRing<kFreeRingBlocks> free_ring_;
 };
 
 }  // namespace perfetto
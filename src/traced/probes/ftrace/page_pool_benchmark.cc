@@ -0,0 +1,67 @@
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <atomic>
+#include <thread>
+#include <utility>
+
+#include "benchmark/benchmark.h"
+
+#include "src/traced/probes/ftrace/page_pool.h"
+
+namespace perfetto {
+namespace {
+
+constexpr size_t kPagesPerIteration = 256;
+
+}  // namespace
+
+// Throughput of the handoff of pages from a writer (the benchmark thread) to a
+// reader thread which keeps reading them at the same time, with the writer
+// committing every |state.range(0)| pages. The reader spins rather than
+// waiting for a drain period, to maximize the contention on the rings.
+static void BM_PagePoolHandoff(benchmark::State& state) {
+  PagePool pool;
+  const size_t commit_interval = static_cast<size_t>(state.range(0));
+  std::atomic<bool> done{false};
+  std::thread reader([&pool, &done] {
+    while (!done.load(std::memory_order_relaxed)) {
+      auto blocks = pool.BeginRead();
+      for (const auto& block : blocks) {
+        for (size_t i = 0; i < block.size(); i++)
+          benchmark::DoNotOptimize(*block.At(i));
+      }
+      pool.EndRead(std::move(blocks));
+    }
+  });
+
+  while (state.KeepRunning()) {
+    for (size_t i = 0; i < kPagesPerIteration; i++) {
+      uint8_t* page = pool.BeginWrite();
+      page[0] = static_cast<uint8_t>(i);
+      pool.EndWrite();
+      if ((i + 1) % commit_interval == 0)
+        pool.CommitWrittenPages();
+    }
+  }
+
+  done.store(true, std::memory_order_relaxed);
+  reader.join();
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(kPagesPerIteration));
+}
+
+BENCHMARK(BM_PagePoolHandoff)->Arg(1)->Arg(8)->Arg(32)->UseRealTime();
+
+}  // namespace perfetto
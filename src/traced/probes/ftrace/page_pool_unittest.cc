@@ -16,6 +16,7 @@
 
 #include "src/traced/probes/ftrace/page_pool.h"
 
+#include <algorithm>
 #include <array>
 #include <mutex>
 #include <random>
@@ -111,5 +112,88 @@ TEST(PagePoolTest, MultiThreaded) {
   reader.join();
 }
 
+TEST(PagePoolTest, MultiThreadedStress) {
+  PagePool pool;
+  const uint64_t kNumPages = 100000;
+
+  // Each page carries its sequence number, so that the reader can tell if any
+  // page is lost, duplicated or reordered while the two sides keep handing
+  // blocks over to each other through the rings.
+  auto writer_fn = [&pool, kNumPages] {
+    std::minstd_rand0 rnd(0);
+    for (uint64_t seq = 0; seq < kNumPages; seq++) {
+      uint8_t* dst = pool.BeginWrite();
+      memcpy(dst, &seq, sizeof(seq));
+      pool.EndWrite();
+      if (rnd() % 8 == 0)
+        pool.CommitWrittenPages();
+    }
+    pool.CommitWrittenPages();
+  };
+
+  auto reader_fn = [&pool, kNumPages] {
+    uint64_t expected_seq = 0;
+    while (expected_seq < kNumPages) {
+      auto blocks = pool.BeginRead();
+      for (const auto& block : blocks) {
+        for (size_t i = 0; i < block.size(); i++) {
+          uint64_t seq;
+          memcpy(&seq, block.At(i), sizeof(seq));
+          ASSERT_EQ(seq, expected_seq);
+          expected_seq++;
+        }
+      }
+      pool.EndRead(std::move(blocks));
+    }
+  };
+
+  std::thread writer(writer_fn);
+  std::thread reader(reader_fn);
+  writer.join();
+  reader.join();
+  EXPECT_LE(pool.freelist_size_for_testing(), PagePool::kFreeRingBlocks);
+}
+
+TEST(PagePoolTest, RingsFull) {
+  PagePool pool;
+  const size_t kNumBlocks = PagePool::kReadyRingBlocks + 3;
+  const size_t kPagesPerBlock = PagePool::PageBlock::kPagesPerBlock;
+
+  // The pages are not written to, to avoid faulting in hundreds of MB.
+  std::vector<uint8_t*> first_pages;
+  for (size_t i = 0; i < kNumBlocks * kPagesPerBlock; i++) {
+    uint8_t* page = pool.BeginWrite();
+    if (i % kPagesPerBlock == 0)
+      first_pages.push_back(page);
+    pool.EndWrite();
+  }
+
+  // The blocks that don't fit in the ready ring stay in the write queue until
+  // the next commit.
+  pool.CommitWrittenPages();
+  EXPECT_EQ(pool.write_queue_size_for_testing(), 3u);
+  auto blocks = pool.BeginRead();
+  ASSERT_EQ(blocks.size(), PagePool::kReadyRingBlocks);
+  pool.CommitWrittenPages();
+  EXPECT_EQ(pool.write_queue_size_for_testing(), 0u);
+  auto more_blocks = pool.BeginRead();
+  ASSERT_EQ(more_blocks.size(), 3u);
+  for (auto& block : more_blocks)
+    blocks.emplace_back(std::move(block));
+  for (size_t i = 0; i < kNumBlocks; i++) {
+    EXPECT_EQ(blocks[i].size(), kPagesPerBlock);
+    EXPECT_EQ(blocks[i].At(0), first_pages[i]);
+  }
+
+  // The blocks that don't fit in the free ring are freed.
+  pool.EndRead(std::move(blocks));
+  EXPECT_EQ(pool.freelist_size_for_testing(), PagePool::kFreeRingBlocks);
+
+  // The next blocks come from the free ring.
+  uint8_t* page = pool.BeginWrite();
+  EXPECT_EQ(pool.freelist_size_for_testing(), PagePool::kFreeRingBlocks - 1);
+  EXPECT_NE(page, nullptr);
+}
+
 }  // namespace
 }  // namespace perfetto
@@ -17,6 +17,7 @@
 #include "src/traced/probes/ftrace/proto_translation_table.h"
 
 #include <regex.h>
+#include <string.h>
 
 #include <algorithm>
 
@@ -147,6 +148,31 @@ uint16_t MergeFields(const std::vector<FtraceEvent::Field>& ftrace_fields,
   return fields_end;
 }
 
+// Reads and parses the format of the event |group|/|name|, through
+// |format_cache| if not null.
+bool ReadEventFormat(const FtraceProcfs* ftrace_procfs,
+                     FormatCache* format_cache,
+                     const std::string& group,
+                     const std::string& name,
+                     FtraceEvent* ftrace_event) {
+  if (format_cache)
+    return format_cache->GetEventFormat(group, name, ftrace_event);
+  std::string contents = ftrace_procfs->ReadEventFormat(group, name);
+  return !contents.empty() && ParseFtraceEvent(contents, ftrace_event);
+}
+
+bool IsCompactSchedEvent(const Event& event) {
+  return strcmp(event.group, "sched") == 0 &&
+         (strcmp(event.name, "sched_switch") == 0 ||
+          strcmp(event.name, "sched_wakeup") == 0);
+}
+
+void ReplaceEvent(std::vector<const Event*>* events,
+                  const Event* old_event,
+                  const Event* new_event) {
+  std::replace(events->begin(), events->end(), old_event, new_event);
+}
+
 bool Contains(const std::string& haystack, const std::string& needle) {
   return haystack.find(needle) != std::string::npos;
 }
@@ -336,7 +362,9 @@ ProtoTranslationTable::DefaultPageHeaderSpecForTesting() {
 std::unique_ptr<ProtoTranslationTable> ProtoTranslationTable::Create(
     const FtraceProcfs* ftrace_procfs,
     std::vector<Event> events,
-    std::vector<Field> common_fields) {
+    std::vector<Field> common_fields,
+    std::unique_ptr<FormatCache> format_cache,
+    Resolution resolution) {
   bool common_fields_processed = false;
   uint16_t common_fields_end = 0;
 
@@ -352,6 +380,7 @@ std::unique_ptr<ProtoTranslationTable> ProtoTranslationTable::Create(
     return nullptr;
   }
 
+  std::vector<Event> unresolved_events;
   for (Event& event : events) {
     if (event.proto_field_id ==
         protos::pbzero::FtraceEvent::kGenericFieldNumber) {
@@ -362,10 +391,16 @@ std::unique_ptr<ProtoTranslationTable> ProtoTranslationTable::Create(
     PERFETTO_DCHECK(event.proto_field_id);
     PERFETTO_DCHECK(!event.ftrace_event_id);
 
-    std::string contents =
-        ftrace_procfs->ReadEventFormat(event.group, event.name);
-    FtraceEvent ftrace_event;
-    if (contents.empty() || !ParseFtraceEvent(contents, &ftrace_event)) {
+    // The compact sched format is validated once below: its events can't be
+    // resolved later.
+    if (resolution == Resolution::kLazy && !IsCompactSchedEvent(event)) {
+      unresolved_events.push_back(event);
+      continue;
+    }
+
+    FtraceEvent ftrace_event{};
+    if (!ReadEventFormat(ftrace_procfs, format_cache.get(), event.group,
+                         event.name, &ftrace_event)) {
       continue;
     }
 
@@ -393,6 +428,16 @@ std::unique_ptr<ProtoTranslationTable> ProtoTranslationTable::Create(
   auto table = std::unique_ptr<ProtoTranslationTable>(
       new ProtoTranslationTable(ftrace_procfs, events, std::move(common_fields),
                                 MakeFtracePageHeaderSpec(page_header_fields)));
+  table->format_cache_ = std::move(format_cache);
+  table->common_fields_merged_ = common_fields_processed;
+  table->common_fields_end_ = common_fields_end;
+  for (Event& event : unresolved_events) {
+    GroupAndName group_and_name(event.group, event.name);
+    const Event* unresolved =
+        &table->unresolved_events_.emplace(group_and_name, std::move(event))
+             .first->second;
+    table->AddToIndexes(unresolved);
+  }
   return table;
 }
 
@@ -412,6 +457,24 @@ ProtoTranslationTable::ProtoTranslationTable(
     name_to_events_[event.name].push_back(&events_.at(event.ftrace_event_id));
     group_to_events_[event.group].push_back(&events_.at(event.ftrace_event_id));
   }
+
+  // The common fields are taken as they are: Create() tells if they still
+  // need the offsets from a format file.
+  common_fields_merged_ = true;
+  for (const Field& field : common_fields_) {
+    compiled_common_fields_.push_back(CompileField(field));
+    common_fields_end_ = std::max<uint16_t>(
+        common_fields_end_, field.ftrace_offset + field.ftrace_size);
+  }
+  compiled_fields_.resize(events_.size());
+  for (const Event& event : events) {
+    std::vector<CompiledField>* compiled =
+        &compiled_fields_[event.ftrace_event_id];
+    for (const Field& field : event.fields)
+      compiled->push_back(CompileField(field));
+  }
+  compact_sched_format_ =
+      ValidateFormatForCompactSched(events_, common_fields_);
 }
 
 const Event* ProtoTranslationTable::GetOrCreateEvent(
@@ -419,20 +482,25 @@ const Event* ProtoTranslationTable::GetOrCreateEvent(
   const Event* event = GetEvent(group_and_name);
   if (event)
     return event;
-  // The ftrace event does not already exist so a new one will be created
-  // by parsing the format file.
-  std::string contents = ftrace_procfs_->ReadEventFormat(group_and_name.group(),
-                                                         group_and_name.name());
-  if (contents.empty())
+  // The format of the event wasn't read yet: either it's known at compile time
+  // and resolved lazily, or a new generic event is created from it.
+  FtraceEvent ftrace_event{};
+  if (!ReadEventFormat(ftrace_procfs_, format_cache_.get(),
+                       group_and_name.group(), group_and_name.name(),
+                       &ftrace_event)) {
     return nullptr;
-  FtraceEvent ftrace_event = {};
-  ParseFtraceEvent(contents, &ftrace_event);
-
-  // Ensure events vector is large enough
-  if (ftrace_event.id > largest_id_) {
-    events_.resize(ftrace_event.id + 1);
-    largest_id_ = ftrace_event.id;
   }
+  if (ftrace_event.id == 0) {
+    PERFETTO_DLOG("Invalid id for %s", group_and_name.ToString().c_str());
+    return nullptr;
+  }
+  auto unresolved_it = unresolved_events_.find(group_and_name);
+  if (unresolved_it != unresolved_events_.end())
+    return ResolveEvent(unresolved_it, ftrace_event);
+
+  MergeCommonFields(ftrace_event);
+  if (ftrace_event.id > largest_id_)
+    GrowEvents(ftrace_event.id);
 
   // Set known event variables
   Event* e = &events_.at(ftrace_event.id);
@@ -450,13 +518,72 @@ const Event* ProtoTranslationTable::GetOrCreateEvent(
   // For every field in the ftrace event, make a field in the generic event.
   for (const FtraceEvent::Field& ftrace_field : ftrace_event.fields)
     e->size = std::max(CreateGenericEventField(ftrace_field, *e), e->size);
+  std::vector<CompiledField>* compiled = &compiled_fields_[e->ftrace_event_id];
+  compiled->clear();
+  for (const Field& field : e->fields)
+    compiled->push_back(CompileField(field));
+
+  AddToIndexes(e);
+  return e;
+}
 
-  group_and_name_to_event_[group_and_name] = &events_.at(e->ftrace_event_id);
-  name_to_events_[e->name].push_back(&events_.at(e->ftrace_event_id));
-  group_to_events_[e->group].push_back(&events_.at(e->ftrace_event_id));
+const Event* ProtoTranslationTable::ResolveEvent(
+    std::map<GroupAndName, Event>::iterator it,
+    const FtraceEvent& ftrace_event) {
+  MergeCommonFields(ftrace_event);
+  if (ftrace_event.id > largest_id_)
+    GrowEvents(ftrace_event.id);
 
+  const Event* unresolved = &it->second;
+  Event* e = &events_.at(ftrace_event.id);
+  *e = std::move(it->second);
+  e->ftrace_event_id = ftrace_event.id;
+  uint16_t fields_end = MergeFields(ftrace_event.fields, &e->fields, e->name);
+  e->size = std::max<uint16_t>(fields_end, common_fields_end_);
+  std::vector<CompiledField>* compiled = &compiled_fields_[e->ftrace_event_id];
+  compiled->clear();
+  for (const Field& field : e->fields)
+    compiled->push_back(CompileField(field));
+
+  group_and_name_to_event_[it->first] = e;
+  ReplaceEvent(&name_to_events_[e->name], unresolved, e);
+  ReplaceEvent(&group_to_events_[e->group], unresolved, e);
+  unresolved_events_.erase(it);
   return e;
-};
+}
+
+void ProtoTranslationTable::MergeCommonFields(const FtraceEvent& ftrace_event) {
+  if (common_fields_merged_)
+    return;
+  common_fields_end_ =
+      MergeFields(ftrace_event.common_fields, &common_fields_, "common");
+  compiled_common_fields_.clear();
+  for (const Field& field : common_fields_)
+    compiled_common_fields_.push_back(CompileField(field));
+  common_fields_merged_ = true;
+}
+
+void ProtoTranslationTable::GrowEvents(size_t id) {
+  events_.resize(id + 1);
+  compiled_fields_.resize(id + 1);
+  largest_id_ = id;
+  group_and_name_to_event_.clear();
+  name_to_events_.clear();
+  group_to_events_.clear();
+  for (const Event& event : events_) {
+    if (event.ftrace_event_id)
+      AddToIndexes(&event);
+  }
+  for (const auto& it : unresolved_events_)
+    AddToIndexes(&it.second);
+}
+
+void ProtoTranslationTable::AddToIndexes(const Event* event) {
+  if (event->ftrace_event_id)
+    group_and_name_to_event_[GroupAndName(event->group, event->name)] = event;
+  name_to_events_[event->name].push_back(event);
+  group_to_events_[event->group].push_back(event);
+}
 
 const char* ProtoTranslationTable::InternString(const std::string& str) {
   auto it_and_inserted = interned_strings_.insert(str);
@@ -539,6 +666,124 @@ void EventFilter::EnableEventsFrom(const EventFilter& other) {
   }
 }
 
+bool EventFilter::AddFieldPredicate(size_t ftrace_event_id,
+                                    const std::vector<const Field*>& fields,
+                                    std::vector<int64_t> values) {
+  FieldPredicate predicate;
+  for (const Field* field : fields) {
+    FieldPredicate::Location location;
+    switch (field->ftrace_type) {
+      case kFtraceInt8:
+      case kFtraceInt16:
+      case kFtraceInt32:
+      case kFtraceInt64:
+      case kFtracePid32:
+      case kFtraceCommonPid32:
+        location.is_signed = true;
+        break;
+      case kFtraceUint8:
+      case kFtraceUint16:
+      case kFtraceUint32:
+      case kFtraceUint64:
+      case kFtraceBool:
+      case kFtraceInode32:
+      case kFtraceInode64:
+        break;
+      default:
+        return false;
+    }
+    if (field->ftrace_size != 1 && field->ftrace_size != 2 &&
+        field->ftrace_size != 4 && field->ftrace_size != 8) {
+      return false;
+    }
+    location.offset = field->ftrace_offset;
+    location.size = field->ftrace_size;
+    predicate.fields.push_back(location);
+  }
+  if (predicate.fields.empty())
+    return false;
+  predicate.values = std::move(values);
+  std::sort(predicate.values.begin(), predicate.values.end());
+
+  if (ftrace_event_id == 0) {
+    common_predicates_.emplace_back(std::move(predicate));
+  } else {
+    if (ftrace_event_id >= predicates_.size())
+      predicates_.resize(ftrace_event_id + 1);
+    predicates_[ftrace_event_id].emplace_back(std::move(predicate));
+  }
+  has_predicates_ = true;
+  return true;
+}
+
+void EventFilter::ExcludeFromCommonPredicates(size_t ftrace_event_id) {
+  if (ftrace_event_id >= common_predicates_excluded_.size())
+    common_predicates_excluded_.resize(ftrace_event_id + 1);
+  common_predicates_excluded_[ftrace_event_id] = true;
+}
+
+// static
+bool EventFilter::Matches(const FieldPredicate& predicate,
+                          const uint8_t* start,
+                          const uint8_t* end) {
+  for (const FieldPredicate::Location& field : predicate.fields) {
+    if (field.offset + field.size > end - start)
+      continue;
+    const uint8_t* ptr = start + field.offset;
+    int64_t value = 0;
+    switch (field.size) {
+      case 1: {
+        uint8_t v;
+        memcpy(&v, ptr, sizeof(v));
+        value = field.is_signed ? static_cast<int8_t>(v) : v;
+        break;
+      }
+      case 2: {
+        uint16_t v;
+        memcpy(&v, ptr, sizeof(v));
+        value = field.is_signed ? static_cast<int16_t>(v) : v;
+        break;
+      }
+      case 4: {
+        uint32_t v;
+        memcpy(&v, ptr, sizeof(v));
+        value = field.is_signed ? static_cast<int32_t>(v) : v;
+        break;
+      }
+      case 8: {
+        uint64_t v;
+        memcpy(&v, ptr, sizeof(v));
+        value = static_cast<int64_t>(v);
+        break;
+      }
+    }
+    if (std::binary_search(predicate.values.begin(), predicate.values.end(),
+                           value)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool EventFilter::MatchesPredicates(size_t ftrace_event_id,
+                                    const uint8_t* start,
+                                    const uint8_t* end) const {
+  if (ftrace_event_id >= common_predicates_excluded_.size() ||
+      !common_predicates_excluded_[ftrace_event_id]) {
+    for (const FieldPredicate& predicate : common_predicates_) {
+      if (!Matches(predicate, start, end))
+        return false;
+    }
+  }
+  if (ftrace_event_id >= predicates_.size())
+    return true;
+  for (const FieldPredicate& predicate : predicates_[ftrace_event_id]) {
+    if (!Matches(predicate, start, end))
+      return false;
+  }
+  return true;
+}
+
 ProtoTranslationTable::~ProtoTranslationTable() = default;
 
 }  // namespace perfetto
@@ -26,7 +26,10 @@
 #include <vector>
 
 #include "perfetto/base/scoped_file.h"
+#include "src/traced/probes/ftrace/compact_sched.h"
 #include "src/traced/probes/ftrace/event_info.h"
+#include "src/traced/probes/ftrace/field_translation.h"
+#include "src/traced/probes/ftrace/format_cache.h"
 #include "src/traced/probes/ftrace/format_parser.h"
 
 namespace perfetto {
@@ -79,13 +82,21 @@ class ProtoTranslationTable {
 
   static FtracePageHeaderSpec DefaultPageHeaderSpecForTesting();
 
+  // Whether Create() reads the formats of all the |events| upfront, or only
+  // the ones the compact sched encoding needs: the others are then read when
+  // first enabled, see GetOrCreateEvent().
+  enum class Resolution { kEager, kLazy };
+
   // This method mutates the |events| and |common_fields| vectors to
   // fill some of the fields and to delete unused events/fields
   // before std:move'ing them into the ProtoTranslationTable.
+  // If |format_cache| is not null the format files are read through it.
   static std::unique_ptr<ProtoTranslationTable> Create(
       const FtraceProcfs* ftrace_procfs,
       std::vector<Event> events,
-      std::vector<Field> common_fields);
+      std::vector<Field> common_fields,
+      std::unique_ptr<FormatCache> format_cache = nullptr,
+      Resolution resolution = Resolution::kEager);
   virtual ~ProtoTranslationTable();
 
   ProtoTranslationTable(const FtraceProcfs* ftrace_procfs,
@@ -97,6 +108,22 @@ class ProtoTranslationTable {
 
   const std::vector<Field>& common_fields() const { return common_fields_; }
 
+  // The common fields and the fields of each event compiled for CpuReader,
+  // see CompileField(). The compiled fields of an event are in the same order
+  // as Event::fields.
+  const std::vector<CompiledField>& compiled_common_fields() const {
+    return compiled_common_fields_;
+  }
+  const std::vector<CompiledField>& GetCompiledFields(size_t id) const {
+    return compiled_fields_.at(id);
+  }
+
+  // The layout of sched_switch and sched_wakeup, used to encode them in the
+  // compact form when FtraceConfig.compact_sched is set.
+  const CompactSchedFormat& compact_sched_format() const {
+    return compact_sched_format_;
+  }
+
   // Virtual for testing.
   virtual const Event* GetEvent(const GroupAndName& group_and_name) const {
     if (!group_and_name_to_event_.count(group_and_name))
@@ -104,6 +131,7 @@ class ProtoTranslationTable {
     return group_and_name_to_event_.at(group_and_name);
   }
 
+  // Like GetEventByName(), can return events whose format wasn't read yet.
   const std::vector<const Event*>* GetEventsByGroup(
       const std::string& group) const {
     if (!group_to_events_.count(group))
@@ -144,17 +172,35 @@ class ProtoTranslationTable {
   virtual const Event* GetOrCreateEvent(const GroupAndName&);
 
   // This is for backwards compatibility. If a group is not specified in the
-  // config then the first event with that name will be returned.
+  // config then the first event with that name will be returned. With
+  // Resolution::kLazy it might be an event known at compile time whose format
+  // wasn't read yet: its ftrace_event_id is 0 until GetOrCreateEvent().
   const Event* GetEventByName(const std::string& name) const {
     if (!name_to_events_.count(name))
       return nullptr;
     return name_to_events_.at(name)[0];
   }
 
+  // Null unless passed to Create().
+  FormatCache* format_cache() { return format_cache_.get(); }
+
  private:
   ProtoTranslationTable(const ProtoTranslationTable&) = delete;
   ProtoTranslationTable& operator=(const ProtoTranslationTable&) = delete;
 
+  // Sets the offsets of the common fields from the first format read.
+  void MergeCommonFields(const FtraceEvent& ftrace_event);
+
+  // Fills the event |it| known at compile time from its format and moves it
+  // from |unresolved_events_| to |events_|.
+  const Event* ResolveEvent(std::map<GroupAndName, Event>::iterator it,
+                            const FtraceEvent& ftrace_event);
+
+  // Grows |events_| to fit the event |id|. The indexes below point into
+  // |events_| so they are rebuilt.
+  void GrowEvents(size_t id);
+  void AddToIndexes(const Event* event);
+
   // Store strings so they can be read when writing the trace output.
   const char* InternString(const std::string& str);
 
@@ -162,19 +208,32 @@ class ProtoTranslationTable {
                                    Event& event);
 
   const FtraceProcfs* ftrace_procfs_;
+  std::unique_ptr<FormatCache> format_cache_;
   std::vector<Event> events_;
   size_t largest_id_;
   std::map<GroupAndName, const Event*> group_and_name_to_event_;
   std::map<std::string, std::vector<const Event*>> name_to_events_;
   std::map<std::string, std::vector<const Event*>> group_to_events_;
   std::vector<Field> common_fields_;
+  bool common_fields_merged_ = false;
+  uint16_t common_fields_end_ = 0;
+  std::vector<CompiledField> compiled_common_fields_;
+  std::vector<std::vector<CompiledField>> compiled_fields_;
+  CompactSchedFormat compact_sched_format_;
   FtracePageHeaderSpec ftrace_page_header_spec_{};
   std::set<std::string> interned_strings_;
+
+  // The events known at compile time whose format wasn't read yet, only with
+  // Resolution::kLazy. Also in |name_to_events_| and |group_to_events_|.
+  std::map<GroupAndName, Event> unresolved_events_;
 };
 
 // Class for efficient 'is event with id x enabled?' checks.
 // Mirrors the data in a FtraceConfig but in a format better suited
 // to be consumed by CpuReader.
+// It can also hold predicates on the values of the fields of the events (see
+// FtraceConfig.target_pids and FtraceConfig.field_filters), checked against
+// the raw records before they are parsed.
 class EventFilter {
  public:
   EventFilter();
@@ -188,11 +247,56 @@ class EventFilter {
   std::set<size_t> GetEnabledEvents() const;
   void EnableEventsFrom(const EventFilter&);
 
+  // Records only the events whose (integer) |fields| have, any of them, one of
+  // |values|. If |ftrace_event_id| is 0, |fields| are common fields and the
+  // predicate applies to all the events but the ones excluded by
+  // ExcludeFromCommonPredicates(). Returns false if a field is not an integer.
+  bool AddFieldPredicate(size_t ftrace_event_id,
+                         const std::vector<const Field*>& fields,
+                         std::vector<int64_t> values);
+
+  // The predicates on the common fields don't apply to |ftrace_event_id|, e.g.
+  // because it has its own version of them.
+  void ExcludeFromCommonPredicates(size_t ftrace_event_id);
+
+  bool has_predicates() const { return has_predicates_; }
+
+  // Returns true if the event |ftrace_event_id| is enabled and its raw record
+  // [start, end) satisfies all the predicates of the event.
+  bool IsRecordEnabled(uint16_t ftrace_event_id,
+                       const uint8_t* start,
+                       const uint8_t* end) const {
+    if (!IsEventEnabled(ftrace_event_id))
+      return false;
+    return !has_predicates_ || MatchesPredicates(ftrace_event_id, start, end);
+  }
+
  private:
+  struct FieldPredicate {
+    struct Location {
+      uint16_t offset = 0;
+      uint16_t size = 0;
+      bool is_signed = false;
+    };
+    std::vector<Location> fields;
+    std::vector<int64_t> values;  // Sorted.
+  };
+
   EventFilter(const EventFilter&) = delete;
   EventFilter& operator=(const EventFilter&) = delete;
 
+  static bool Matches(const FieldPredicate&,
+                      const uint8_t* start,
+                      const uint8_t* end);
+  bool MatchesPredicates(size_t ftrace_event_id,
+                         const uint8_t* start,
+                         const uint8_t* end) const;
+
   std::vector<bool> enabled_ids_;
+  bool has_predicates_ = false;
+  std::vector<FieldPredicate> common_predicates_;
+  std::vector<bool> common_predicates_excluded_;  // By ftrace event id.
+  std::vector<std::vector<FieldPredicate>> predicates_;  // By ftrace event id.
 };
 
 }  // namespace perfetto
@@ -0,0 +1,152 @@
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <unistd.h>
+
+#include <map>
+#include <string>
+
+#include "benchmark/benchmark.h"
+
+#include "perfetto/base/temp_file.h"
+#include "src/traced/probes/ftrace/event_info.h"
+#include "src/traced/probes/ftrace/format_cache.h"
+#include "src/traced/probes/ftrace/ftrace_procfs.h"
+#include "src/traced/probes/ftrace/proto_translation_table.h"
+
+namespace perfetto {
+namespace {
+
+constexpr char kDevice[] =
+    "src/traced/probes/ftrace/test/data/"
+    "android_walleye_OPM5.171019.017.A1_4.4.88/";
+
+// The events a typical tracing session enables.
+constexpr const char* kSessionEvents[][2] = {
+    {"sched", "sched_switch"},        {"sched", "sched_wakeup"},
+    {"sched", "sched_waking"},        {"sched", "sched_process_exit"},
+    {"sched", "sched_process_free"},  {"task", "task_newtask"},
+    {"task", "task_rename"},          {"power", "cpu_frequency"},
+    {"power", "cpu_idle"},            {"power", "suspend_resume"},
+    {"ftrace", "print"},              {"kmem", "rss_stat"},
+    {"lowmemorykiller", "lowmemory_kill"},
+};
+
+// The tracefs snapshot of a device, where reading a format or id file takes
+// |read_latency_us| more, like on the devices with a slow tracefs. The
+// snapshots don't have the id files: the ids come from the formats.
+class SlowFtraceProcfs : public FtraceProcfs {
+ public:
+  explicit SlowFtraceProcfs(uint32_t read_latency_us)
+      : FtraceProcfs(kDevice), read_latency_us_(read_latency_us) {
+    for (const Event& event : GetStaticEventInfo()) {
+      FtraceEvent format{};
+      if (ParseFtraceEvent(
+              FtraceProcfs::ReadEventFormat(event.group, event.name),
+              &format)) {
+        ids_[std::string(event.group) + "/" + event.name] = format.id;
+      }
+    }
+  }
+
+  std::string ReadEventFormat(const std::string& group,
+                              const std::string& name) const override {
+    Read();
+    return FtraceProcfs::ReadEventFormat(group, name);
+  }
+
+  uint32_t ReadEventId(const std::string& group,
+                       const std::string& name) const override {
+    Read();
+    auto it = ids_.find(group + "/" + name);
+    return it == ids_.end() ? 0 : it->second;
+  }
+
+  size_t reads() const { return reads_; }
+
+ private:
+  void Read() const {
+    reads_++;
+    if (read_latency_us_)
+      usleep(read_latency_us_);
+  }
+
+  const uint32_t read_latency_us_;
+  std::map<std::string, uint32_t> ids_;
+  mutable size_t reads_ = 0;
+};
+
+enum class ColdStart { kEager, kLazy, kCached };
+
+// Creates the translation table of traced_probes and enables the events of a
+// typical session, with every tracefs read taking |state.range(0)| us more:
+// - kEager: all the formats are read at creation, as before the format cache.
+// - kLazy: only the formats of the enabled events are read, e.g. after boot.
+// - kCached: as kLazy but the formats come from the cache file written by a
+//   previous run, e.g. after a traced_probes restart.
+// The reads counter is the number of tracefs reads per cold start.
+template <ColdStart cold_start>
+void BM_TranslationTableColdStart(benchmark::State& state) {
+  SlowFtraceProcfs ftrace(static_cast<uint32_t>(state.range(0)));
+  base::TempDir dir = base::TempDir::Create();
+  std::string cache_path = dir.path() + "/cache";
+  if (cold_start == ColdStart::kCached) {
+    FormatCache cache(&ftrace, cache_path, "kernel");
+    FtraceEvent format{};
+    for (const auto& event : kSessionEvents)
+      cache.GetEventFormat(event[0], event[1], &format);
+    PERFETTO_CHECK(cache.Save());
+  }
+
+  size_t reads = ftrace.reads();
+  while (state.KeepRunning()) {
+    std::unique_ptr<FormatCache> format_cache;
+    auto resolution = ProtoTranslationTable::Resolution::kEager;
+    if (cold_start != ColdStart::kEager) {
+      format_cache.reset(new FormatCache(
+          &ftrace, cold_start == ColdStart::kCached ? cache_path : "",
+          "kernel"));
+      resolution = ProtoTranslationTable::Resolution::kLazy;
+    }
+    auto table = ProtoTranslationTable::Create(
+        &ftrace, GetStaticEventInfo(), GetStaticCommonFieldsInfo(),
+        std::move(format_cache), resolution);
+    for (const auto& event : kSessionEvents)
+      benchmark::DoNotOptimize(
+          table->GetOrCreateEvent(GroupAndName(event[0], event[1])));
+  }
+  state.counters["reads"] = benchmark::Counter(
+      static_cast<double>(ftrace.reads() - reads) /
+      static_cast<double>(state.iterations()));
+  unlink(cache_path.c_str());
+}
+
+}  // namespace
+}  // namespace perfetto
+
+using perfetto::BM_TranslationTableColdStart;
+using perfetto::ColdStart;
+
+BENCHMARK_TEMPLATE(BM_TranslationTableColdStart, ColdStart::kEager)
+    ->Arg(0)
+    ->Arg(100)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_TranslationTableColdStart, ColdStart::kLazy)
+    ->Arg(0)
+    ->Arg(100)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_TranslationTableColdStart, ColdStart::kCached)
+    ->Arg(0)
+    ->Arg(100)
+    ->UseRealTime();
@@ -33,6 +33,7 @@ using testing::AnyNumber;
 using testing::IsNull;
 using testing::Contains;
 using testing::Eq;
+using testing::Not;
 using testing::Pointee;
 
 namespace perfetto {
@@ -86,8 +87,19 @@ TEST_P(AllTranslationTableTest, Create) {
       EXPECT_TRUE(field.ftrace_type);
       EXPECT_TRUE(static_cast<int>(field.proto_field_type));
     }
+    const std::vector<CompiledField>& compiled_fields =
+        table_->GetCompiledFields(event.ftrace_event_id);
+    ASSERT_EQ(compiled_fields.size(), event.fields.size());
+    for (size_t i = 0; i < compiled_fields.size(); i++) {
+      EXPECT_TRUE(compiled_fields[i].translate);
+      EXPECT_EQ(compiled_fields[i].ftrace_offset,
+                event.fields[i].ftrace_offset);
+      EXPECT_EQ(compiled_fields[i].proto_field_id,
+                event.fields[i].proto_field_id);
+    }
   }
   ASSERT_EQ(table_->common_fields().size(), 1u);
+  ASSERT_EQ(table_->compiled_common_fields().size(), 1u);
   const Field& pid_field = table_->common_fields().at(0);
   EXPECT_EQ(std::string(pid_field.ftrace_name), "common_pid");
   EXPECT_EQ(pid_field.proto_field_id, 2u);
@@ -146,6 +158,74 @@ TEST(TranslationTableTest, Seed) {
   }
 }
 
+TEST(TranslationTableTest, LazyResolution) {
+  std::string path =
+      "src/traced/probes/ftrace/test/data/android_seed_N2F62_3.10.49/";
+  FtraceProcfs ftrace_procfs(path);
+  auto eager_table = ProtoTranslationTable::Create(
+      &ftrace_procfs, GetStaticEventInfo(), GetStaticCommonFieldsInfo());
+  std::unique_ptr<FormatCache> format_cache(
+      new FormatCache(&ftrace_procfs, "", "kernel"));
+  FormatCache* cache = format_cache.get();
+  auto table = ProtoTranslationTable::Create(
+      &ftrace_procfs, GetStaticEventInfo(), GetStaticCommonFieldsInfo(),
+      std::move(format_cache), ProtoTranslationTable::Resolution::kLazy);
+  PERFETTO_CHECK(eager_table && table);
+  EXPECT_EQ(table->format_cache(), cache);
+
+  // Only the events of the compact sched format are read upfront.
+  EXPECT_EQ(cache->misses(), 2u);
+  EXPECT_TRUE(table->compact_sched_format().IsCompactSchedEvent(68));
+  EXPECT_TRUE(table->GetEvent(GroupAndName("sched", "sched_switch")));
+  EXPECT_EQ(table->common_fields().at(0).ftrace_offset, 4u);
+  EXPECT_GE(table->GetEventsByGroup("sched")->size(),
+            eager_table->GetEventsByGroup("sched")->size());
+
+  // The others can be found by name or group before being resolved.
+  GroupAndName group_and_name("ext4", "ext4_da_write_begin");
+  EXPECT_FALSE(table->GetEvent(group_and_name));
+  const Event* unresolved = table->GetEventByName("ext4_da_write_begin");
+  ASSERT_TRUE(unresolved);
+  EXPECT_EQ(std::string(unresolved->group), "ext4");
+  EXPECT_EQ(unresolved->ftrace_event_id, 0u);
+  EXPECT_THAT(*table->GetEventsByGroup("ext4"), Contains(unresolved));
+
+  const Event* event = table->GetOrCreateEvent(group_and_name);
+  ASSERT_TRUE(event);
+  EXPECT_EQ(cache->misses(), 3u);
+  EXPECT_EQ(table->GetEvent(group_and_name), event);
+  EXPECT_EQ(table->GetEventByName("ext4_da_write_begin"), event);
+  EXPECT_EQ(table->GetEventById(303), event);
+  EXPECT_THAT(*table->GetEventsByGroup("ext4"), Contains(event));
+  EXPECT_THAT(*table->GetEventsByGroup("ext4"), Not(Contains(unresolved)));
+  EXPECT_EQ(table->largest_id(), 303u);
+
+  // Same as if read upfront.
+  const Event* expected = eager_table->GetEvent(group_and_name);
+  EXPECT_EQ(event->ftrace_event_id, expected->ftrace_event_id);
+  EXPECT_EQ(event->proto_field_id, expected->proto_field_id);
+  EXPECT_EQ(event->size, expected->size);
+  ASSERT_EQ(event->fields.size(), expected->fields.size());
+  ASSERT_EQ(table->GetCompiledFields(303).size(), expected->fields.size());
+  for (size_t i = 0; i < event->fields.size(); i++) {
+    EXPECT_EQ(event->fields[i].ftrace_offset,
+              expected->fields[i].ftrace_offset);
+    EXPECT_EQ(event->fields[i].ftrace_type, expected->fields[i].ftrace_type);
+    EXPECT_EQ(table->GetCompiledFields(303)[i].ftrace_offset,
+              expected->fields[i].ftrace_offset);
+  }
+
+  // The events resolved earlier survive the growth of the table.
+  const Event* sched_switch =
+      table->GetEvent(GroupAndName("sched", "sched_switch"));
+  ASSERT_TRUE(sched_switch);
+  EXPECT_EQ(sched_switch->ftrace_event_id, 68u);
+  EXPECT_EQ(table->GetEventById(68), sched_switch);
+
+  // Events unknown to the kernel stay unresolved.
+  EXPECT_FALSE(table->GetOrCreateEvent(GroupAndName("sde", "sde_foo")));
+}
+
 TEST_P(TranslationTableCreationTest, Create) {
   MockFtraceProcfs ftrace;
   std::vector<Field> common_fields;
@@ -410,6 +490,9 @@ print fmt: "some format")"));
             group_and_name.name());
 
   EXPECT_EQ(e->fields.size(), 4ul);
+  // Generic events are compiled too, in the order of their fields.
+  ASSERT_EQ(table->GetCompiledFields(42).size(), 4ul);
+  EXPECT_EQ(table->GetCompiledFields(42)[2].ftrace_offset, 25u);
   const std::vector<Field>& fields = e->fields;
   // Check string field
   const auto& str_field = fields[0];
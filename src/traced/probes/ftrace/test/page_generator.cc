@@ -0,0 +1,253 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/ftrace/test/page_generator.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/base/utils.h"
+
+namespace perfetto {
+namespace {
+
+// See the kernel's include/linux/ring_buffer.h.
+constexpr uint32_t kTypePadding = 29;
+constexpr uint32_t kTypeTimeExtend = 30;
+constexpr uint32_t kTypeDataTypeLengthMax = 28;
+constexpr uint32_t kTimeDeltaBits = 27;
+constexpr uint32_t kMaxTimeDelta = (1u << kTimeDeltaBits) - 1;
+
+constexpr int32_t kPids[] = {1,    642,  781,  1024, 1039, 1502, 1733, 2048,
+                             2311, 2312, 2313, 3109, 4096, 4097, 5120, 6001};
+constexpr const char* kComms[] = {
+    "swapper/0",       "surfaceflinger", "RenderThread", "system_server",
+    "HwBinder:781_2",  "kworker/u16:3",  "mmcqd/0",      "ui",
+    "android.bg",      "Binder:1502_4",  "hwuiTask1",    "ksoftirqd/2",
+};
+
+}  // namespace
+
+// static
+PageGenerator::Options PageGenerator::DefaultOptions() {
+  Options options;
+  options.events = {
+      {"sched", "sched_switch", 30},     {"sched", "sched_wakeup", 20},
+      {"irq", "irq_handler_entry", 10},  {"irq", "irq_handler_exit", 10},
+      {"block", "block_rq_issue", 3},    {"block", "block_rq_complete", 3},
+      {"ftrace", "print", 24},
+  };
+  return options;
+}
+
+PageGenerator::PageGenerator(const ProtoTranslationTable* table,
+                             const Options& options,
+                             uint32_t seed)
+    : table_(table), options_(options), rnd_(seed) {
+  for (const EventWeight& event_weight : options_.events) {
+    const Event* event =
+        table_->GetEvent(GroupAndName(event_weight.group, event_weight.name));
+    PERFETTO_CHECK(event);
+    event_types_.push_back({event, event_weight.weight});
+    total_weight_ += event_weight.weight;
+  }
+  PERFETTO_CHECK(total_weight_ > 0);
+}
+
+PageGenerator::~PageGenerator() = default;
+
+std::unique_ptr<uint8_t[]> PageGenerator::GeneratePage() {
+  const size_t header_size = 8 + table_->page_header_size_len();
+  std::unique_ptr<uint8_t[]> page(new uint8_t[base::kPageSize]());
+  uint64_t page_timestamp = 0;
+  size_t size = 0;
+  for (;;) {
+    if (record_.empty()) {
+      record_timestamp_ = timestamp_;
+      record_events_ = GenerateRecord();
+    }
+    if (header_size + size + record_.size() > base::kPageSize)
+      break;
+    // The deltas of the records are relative to the previous one, which can
+    // be in the previous page.
+    if (size == 0)
+      page_timestamp = record_timestamp_;
+    memcpy(&page[header_size + size], record_.data(), record_.size());
+    size += record_.size();
+    events_ += record_events_;
+    record_.clear();
+  }
+  PERFETTO_CHECK(size > 0);
+
+  // The commit field is 4 or 8 bytes long, little endian like the rest.
+  uint64_t commit = size;
+  memcpy(&page[0], &page_timestamp, sizeof(page_timestamp));
+  memcpy(&page[8], &commit, table_->page_header_size_len());
+  return page;
+}
+
+size_t PageGenerator::GenerateRecord() {
+  uint32_t pick = Uniform(total_weight_);
+  const Event* event = event_types_.back().event;
+  for (const EventType& type : event_types_) {
+    if (pick < type.weight) {
+      event = type.event;
+      break;
+    }
+    pick -= type.weight;
+  }
+
+  uint64_t delta = 1 + Uniform(2 * options_.mean_time_delta_ns);
+  if (options_.idle_one_in && Uniform(options_.idle_one_in) == 0) {
+    // Idle for 150-650 ms, more than the 27 bits of the header can hold.
+    delta += 150000000 + Uniform(500000000);
+  }
+  timestamp_ += delta;
+  if (delta > kMaxTimeDelta) {
+    AppendHeader(kTypeTimeExtend,
+                 static_cast<uint32_t>(delta & kMaxTimeDelta));
+    AppendWord(static_cast<uint32_t>(delta >> kTimeDeltaBits));
+    delta = 0;
+  }
+  uint32_t time_delta = static_cast<uint32_t>(delta);
+
+  // A discarded event keeps its space in the buffer as padding, its length in
+  // the first word. Its delta can't be 0, that is the padding at the end of
+  // the page.
+  if (time_delta && options_.padding_one_in &&
+      Uniform(options_.padding_one_in) == 0) {
+    uint32_t length = static_cast<uint32_t>(base::AlignUp<4>(event->size));
+    AppendHeader(kTypePadding, time_delta);
+    AppendWord(length);
+    record_.resize(record_.size() + length);
+    return 0;
+  }
+
+  AppendPayload(*event, time_delta);
+  return 1;
+}
+
+void PageGenerator::AppendHeader(uint32_t type_or_length,
+                                 uint32_t time_delta) {
+  PERFETTO_DCHECK(time_delta <= kMaxTimeDelta);
+  AppendWord(type_or_length | time_delta << 5);
+}
+
+void PageGenerator::AppendWord(uint32_t word) {
+  const uint8_t* ptr = reinterpret_cast<const uint8_t*>(&word);
+  record_.insert(record_.end(), ptr, ptr + sizeof(word));
+}
+
+void PageGenerator::AppendPayload(const Event& event, uint32_t time_delta) {
+  std::vector<uint8_t> payload(event.size);
+  uint16_t common_type = static_cast<uint16_t>(event.ftrace_event_id);
+  memcpy(payload.data(), &common_type, sizeof(common_type));
+  uint16_t dynamic_offset = event.size;
+  for (const Field& field : table_->common_fields())
+    FillField(field, &payload, &dynamic_offset);
+  for (const Field& field : event.fields)
+    FillField(field, &payload, &dynamic_offset);
+  payload.resize(base::AlignUp<4>(payload.size()));
+
+  uint32_t size = static_cast<uint32_t>(payload.size());
+  if (size > 0 && size <= 4 * kTypeDataTypeLengthMax) {
+    AppendHeader(size / 4, time_delta);
+  } else {
+    // Too long for the header: the length, which includes itself, is in the
+    // first word.
+    AppendHeader(0, time_delta);
+    AppendWord(size + 4);
+  }
+  record_.insert(record_.end(), payload.begin(), payload.end());
+}
+
+void PageGenerator::FillField(const Field& field,
+                              std::vector<uint8_t>* payload,
+                              uint16_t* dynamic_offset) {
+  uint8_t* ptr = payload->data() + field.ftrace_offset;
+  switch (field.ftrace_type) {
+    case kFtracePid32:
+    case kFtraceCommonPid32: {
+      int32_t pid = RandomPid();
+      memcpy(ptr, &pid, sizeof(pid));
+      return;
+    }
+    case kFtraceFixedCString: {
+      const char* comm = RandomComm();
+      size_t len = std::min<size_t>(strlen(comm), field.ftrace_size - 1u);
+      memcpy(ptr, comm, len);
+      return;
+    }
+    case kFtraceCString: {
+      // The variable length buffer at the end of ftrace/print, with the
+      // formats of the atrace markers.
+      std::string str = "E";
+      uint32_t kind = Uniform(3);
+      if (kind != 0) {
+        str = (kind == 1 ? "B|" : "C|") + std::to_string(RandomPid()) + "|";
+        uint32_t len = Uniform(options_.max_print_size);
+        for (uint32_t i = 0; str.size() < len; i++)
+          str += static_cast<char>('a' + (i * 7 + len) % 26);
+      }
+      str += "\n";
+      payload->resize(field.ftrace_offset + str.size() + 1);
+      memcpy(payload->data() + field.ftrace_offset, str.c_str(),
+             str.size() + 1);
+      *dynamic_offset =
+          static_cast<uint16_t>(field.ftrace_offset + str.size() + 1);
+      return;
+    }
+    case kFtraceDataLoc: {
+      // A string appended after the fixed size fields, its offset in the
+      // lower and its length in the upper 16 bits.
+      const char* str = RandomComm();
+      uint16_t len = static_cast<uint16_t>(strlen(str) + 1);
+      uint32_t data_loc = static_cast<uint32_t>(len) << 16 | *dynamic_offset;
+      memcpy(ptr, &data_loc, sizeof(data_loc));
+      payload->resize(*dynamic_offset + len);
+      memcpy(payload->data() + *dynamic_offset, str, len);
+      *dynamic_offset = static_cast<uint16_t>(*dynamic_offset + len);
+      return;
+    }
+    case kFtraceStringPtr:
+      // A pointer into the kernel, can't be resolved.
+      return;
+    case kFtraceBool:
+      *ptr = Uniform(2) ? 1 : 0;
+      return;
+    default:
+      for (size_t i = 0; i < field.ftrace_size; i++)
+        ptr[i] = static_cast<uint8_t>(Uniform(256));
+      return;
+  }
+}
+
+int32_t PageGenerator::RandomPid() {
+  return kPids[Uniform(base::ArraySize(kPids))];
+}
+
+const char* PageGenerator::RandomComm() {
+  return kComms[Uniform(base::ArraySize(kComms))];
+}
+
+uint32_t PageGenerator::Uniform(uint32_t max) {
+  return static_cast<uint32_t>(rnd_() % max);
+}
+
+}  // namespace perfetto
@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACED_PROBES_FTRACE_TEST_PAGE_GENERATOR_H_
+#define SRC_TRACED_PROBES_FTRACE_TEST_PAGE_GENERATOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "src/traced/probes/ftrace/proto_translation_table.h"
+
+namespace perfetto {
+
+// Generates raw ftrace pages, as read from per_cpu/cpuN/trace_pipe_raw, full
+// of random events laid out as described by the format files of |table|. The
+// fields of the events are filled according to their type: pids from a small
+// set of threads, fixed and dynamic (__data_loc) strings, the variable length
+// buffer of ftrace/print and random integers. Besides the data records, the
+// pages have the records the kernel writes less often: time extends after the
+// CPU was idle, discarded events (padding) and records too long for the length
+// to fit in their header. The same seed always generates the same pages.
+class PageGenerator {
+ public:
+  struct EventWeight {
+    const char* group;
+    const char* name;
+    uint32_t weight;
+  };
+
+  struct Options {
+    // The events to generate, in proportion to their weight.
+    std::vector<EventWeight> events;
+    // The mean time between two events of the CPU.
+    uint32_t mean_time_delta_ns = 20000;
+    // One record in |idle_one_in| is preceded by an idle period long enough
+    // to need a time extend record. 0 for none.
+    uint32_t idle_one_in = 200;
+    // One record in |padding_one_in| is a discarded event. 0 for none.
+    uint32_t padding_one_in = 100;
+    // The maximum length of the strings written by ftrace/print.
+    uint32_t max_print_size = 200;
+  };
+
+  // The mix of a typical trace: scheduling, interrupts, block I/O and
+  // userspace trace markers.
+  static Options DefaultOptions();
+
+  PageGenerator(const ProtoTranslationTable* table,
+                const Options& options,
+                uint32_t seed);
+  ~PageGenerator();
+
+  // Returns the next page, of base::kPageSize bytes.
+  std::unique_ptr<uint8_t[]> GeneratePage();
+
+  // The number of data records in the pages generated so far, excluding the
+  // padding and time extend records.
+  size_t events() const { return events_; }
+
+ private:
+  struct EventType {
+    const Event* event;
+    uint32_t weight;
+  };
+
+  // Appends the next record, preceded by a time extend if needed, to
+  // |record_|. Returns the number of data records appended, 0 or 1.
+  size_t GenerateRecord();
+  void AppendHeader(uint32_t type_or_length, uint32_t time_delta);
+  void AppendWord(uint32_t word);
+  void AppendPayload(const Event& event, uint32_t time_delta);
+  void FillField(const Field& field,
+                 std::vector<uint8_t>* payload,
+                 uint16_t* dynamic_offset);
+  int32_t RandomPid();
+  const char* RandomComm();
+  uint32_t Uniform(uint32_t max);
+
+  const ProtoTranslationTable* const table_;
+  const Options options_;
+  std::vector<EventType> event_types_;
+  uint32_t total_weight_ = 0;
+  std::minstd_rand rnd_;
+  uint64_t timestamp_ = 1000000000;
+  // The record which didn't fit in the last page, if any.
+  std::vector<uint8_t> record_;
+  uint64_t record_timestamp_ = 0;
+  size_t record_events_ = 0;
+  size_t events_ = 0;
+};
+
+}  // namespace perfetto
+
+#endif  // SRC_TRACED_PROBES_FTRACE_TEST_PAGE_GENERATOR_H_
@@ -14,11 +14,16 @@
  * limitations under the License.
  */
 
+#include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#include <string>
+
+#include "perfetto/base/build_config.h"
 #include "perfetto/base/logging.h"
 #include "perfetto/base/unix_task_runner.h"
 #include "perfetto/traced/traced.h"
@@ -28,23 +33,54 @@
 #include "src/tracing/ipc/default_socket.h"
 
 namespace perfetto {
+namespace {
+
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+// The directory where the parsed formats of the ftrace events are kept across
+// restarts by default. Only root can create it. On Android traced_probes runs
+// as the "nobody" user, shared with other daemons, and has no directory of its
+// own: there the formats are only read lazily and cached in memory.
+constexpr char kDefaultFtraceFormatCacheDir[] = "/var/cache/perfetto";
+#endif
+
+std::string GetDefaultFtraceFormatCachePath() {
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+  if (mkdir(kDefaultFtraceFormatCacheDir, 0700) == 0 || errno == EEXIST)
+    return std::string(kDefaultFtraceFormatCacheDir) + "/ftrace-formats";
+#endif
+  return "";
+}
+
+}  // namespace
 
 int __attribute__((visibility("default"))) ProbesMain(int argc, char** argv) {
   static struct option long_options[] = {
       {"cleanup-after-crash", no_argument, nullptr, 'd'},
+      {"ftrace-format-cache", required_argument, nullptr, 'f'},
       {nullptr, 0, nullptr, 0}};
   int option_index;
   int c;
+  bool has_ftrace_format_cache_path = false;
+  std::string ftrace_format_cache_path;
   while ((c = getopt_long(argc, argv, "", long_options, &option_index)) != -1) {
     switch (c) {
       case 'd':
         HardResetFtraceState();
         return 0;
+      case 'f':
+        // An empty path keeps the ftrace formats only in memory.
+        has_ftrace_format_cache_path = true;
+        ftrace_format_cache_path = optarg;
+        break;
       default:
-        PERFETTO_ELOG("Usage: %s [--cleanup-after-crash]", argv[0]);
+        PERFETTO_ELOG(
+            "Usage: %s [--cleanup-after-crash] [--ftrace-format-cache=PATH]",
+            argv[0]);
         return 1;
     }
   }
+  if (!has_ftrace_format_cache_path)
+    ftrace_format_cache_path = GetDefaultFtraceFormatCachePath();
 
   // Set the watchdog to kill the process if we average more than 32MB of
   // memory or 75% CPU over a 30 second window.
@@ -68,7 +104,7 @@ int __attribute__((visibility("default"))) ProbesMain(int argc, char** argv) {
   }
 
   base::UnixTaskRunner task_runner;
-  ProbesProducer producer;
+  ProbesProducer producer(ftrace_format_cache_path);
   producer.ConnectWithRetries(GetProducerSocket(), &task_runner);
   task_runner.Run();
   return 0;
@@ -22,6 +22,7 @@
 #include <algorithm>
 #include <queue>
 #include <string>
+#include <vector>
 
 #include "perfetto/base/logging.h"
 #include "perfetto/base/utils.h"
@@ -72,9 +73,13 @@ constexpr char kAndroidLogSourceName[] = "android.log";
 //                    +--------------+
 //
 
-ProbesProducer::ProbesProducer() : weak_factory_(this) {}
+ProbesProducer::ProbesProducer(const std::string& ftrace_format_cache_path)
+    : ftrace_format_cache_path_(ftrace_format_cache_path),
+      weak_factory_(this) {}
 ProbesProducer::~ProbesProducer() {
   // The ftrace data sources must be deleted before the ftrace controller.
+  for (auto& id_and_data_source : data_sources_)
+    DestroyDataSource(std::move(id_and_data_source.second));
   data_sources_.clear();
   ftrace_.reset();
 }
@@ -216,7 +221,8 @@ std::unique_ptr<ProbesDataSource> ProbesProducer::CreateFtraceDataSource(
 
   // Lazily create on the first instance.
   if (!ftrace_) {
-    ftrace_ = FtraceController::Create(task_runner_, this);
+    ftrace_ = FtraceController::Create(task_runner_, this,
+                                       ftrace_format_cache_path_);
 
     if (!ftrace_) {
       PERFETTO_ELOG("Failed to create FtraceController");
@@ -233,6 +239,16 @@ std::unique_ptr<ProbesDataSource> ProbesProducer::CreateFtraceDataSource(
   std::unique_ptr<FtraceDataSource> data_source(new FtraceDataSource(
       ftrace_->GetWeakPtr(), session_id, config.ftrace_config(),
       endpoint_->CreateTraceWriter(buffer_id)));
+
+  // On machines with many CPUs the ftrace data is drained in parallel, each
+  // drain worker needs its own writer.
+  if (ftrace_->num_drain_workers() > 1) {
+    std::vector<std::unique_ptr<TraceWriter>> worker_writers;
+    for (size_t i = 1; i < ftrace_->num_drain_workers(); i++)
+      worker_writers.emplace_back(endpoint_->CreateTraceWriter(buffer_id));
+    data_source->SetDrainWorkerWriters(std::move(worker_writers));
+  }
+
   if (!ftrace_->AddDataSource(data_source.get())) {
     PERFETTO_ELOG(
         "Failed to setup tracing (too many concurrent sessions or ftrace is "
@@ -308,10 +324,21 @@ void ProbesProducer::StopDataSource(DataSourceInstanceID id) {
     session_data_sources_.erase(kv);
     break;
   }
+  DestroyDataSource(std::move(it->second));
   data_sources_.erase(it);
   watchdogs_.erase(id);
 }
 
+void ProbesProducer::DestroyDataSource(
+    std::unique_ptr<ProbesDataSource> data_source) {
+  // The drain workers of the ftrace controller might still be writing into an
+  // ftrace data source, the controller destroys it once they are done.
+  if (data_source->type_id == FtraceDataSource::kTypeId && ftrace_) {
+    ftrace_->RetireDataSource(std::unique_ptr<FtraceDataSource>(
+        static_cast<FtraceDataSource*>(data_source.release())));
+  }
+}
+
 void ProbesProducer::OnTracingSetup() {}
 
 void ProbesProducer::Flush(FlushRequestID flush_request_id,
@@ -18,6 +18,7 @@
 #define SRC_TRACED_PROBES_PROBES_PRODUCER_H_
 
 #include <memory>
+#include <string>
 #include <unordered_map>
 #include <utility>
 
@@ -41,7 +42,8 @@ const uint64_t kLRUInodeCacheSize = 1000;
 
 class ProbesProducer : public Producer, public FtraceController::Observer {
  public:
-  ProbesProducer();
+  // |ftrace_format_cache_path| is passed to FtraceController::Create().
+  explicit ProbesProducer(const std::string& ftrace_format_cache_path = "");
   ~ProbesProducer() override;
 
   // Producer Impl:
@@ -97,12 +99,14 @@ class ProbesProducer : public Producer, public FtraceController::Observer {
   void IncreaseConnectionBackoff();
   void OnDataSourceFlushComplete(FlushRequestID, DataSourceInstanceID);
   void OnFlushTimeout(FlushRequestID);
+  void DestroyDataSource(std::unique_ptr<ProbesDataSource>);
 
   State state_ = kNotStarted;
   base::TaskRunner* task_runner_ = nullptr;
   std::unique_ptr<TracingService::ProducerEndpoint> endpoint_;
   std::unique_ptr<FtraceController> ftrace_;
   bool ftrace_creation_failed_ = false;
+  const std::string ftrace_format_cache_path_;
   uint32_t connection_backoff_ms_ = 0;
   const char* socket_name_ = nullptr;
 
@@ -14,15 +14,76 @@
  * limitations under the License.
  */
 
+#include <errno.h>
+#include <getopt.h>
+#include <stdlib.h>
+
 #include "perfetto/base/unix_task_runner.h"
 #include "perfetto/base/watchdog.h"
 #include "perfetto/traced/traced.h"
+#include "perfetto/tracing/core/tracing_service.h"
 #include "perfetto/tracing/ipc/service_ipc_host.h"
 #include "src/tracing/ipc/default_socket.h"
 
 namespace perfetto {
 
-int __attribute__((visibility("default"))) ServiceMain(int, char**) {
+namespace {
+
+// Each worker gets its own full size shard of every trace buffer, which
+// multiplies the worst case memory usage of the buffers by N.
+constexpr long kMaxCommitThreads = 16;
+
+void PrintUsage(const char* prog_name) {
+  PERFETTO_ELOG(R"(
+Usage: %s [option]
+  --commit-threads N : Copies the chunks committed by producers into the trace
+                       buffers using N worker threads, 0 to %ld (default: 0,
+                       i.e. copy on the main thread). Each trace buffer gets N
+                       shards of its full size, so it can use up to N times
+                       its configured size.
+)",
+                prog_name, kMaxCommitThreads);
+}
+
+// Parses the argument of --commit-threads. Returns false if it isn't a number
+// in [0, kMaxCommitThreads].
+bool ParseCommitThreads(const char* arg, size_t* commit_threads) {
+  char* end = nullptr;
+  errno = 0;
+  long value = strtol(arg, &end, 10);
+  if (errno || end == arg || *end != '\0' || value < 0 ||
+      value > kMaxCommitThreads) {
+    return false;
+  }
+  *commit_threads = static_cast<size_t>(value);
+  return true;
+}
+
+}  // namespace
+
+int __attribute__((visibility("default"))) ServiceMain(int argc, char** argv) {
+  enum LongOption {
+    OPT_COMMIT_THREADS = 1000,
+  };
+  static const struct option long_options[] = {
+      {"commit-threads", required_argument, nullptr, OPT_COMMIT_THREADS},
+      {nullptr, 0, nullptr, 0}};
+
+  size_t commit_threads = 0;
+  int option_index;
+  for (;;) {
+    int option = getopt_long(argc, argv, "", long_options, &option_index);
+    if (option == -1)
+      break;
+    if (option == OPT_COMMIT_THREADS) {
+      if (ParseCommitThreads(optarg, &commit_threads))
+        continue;
+      PERFETTO_ELOG("Invalid --commit-threads: %s", optarg);
+    }
+    PrintUsage(argv[0]);
+    return 1;
+  }
+
   base::UnixTaskRunner task_runner;
   std::unique_ptr<ServiceIPCHost> svc;
   svc = ServiceIPCHost::CreateInstance(&task_runner);
@@ -49,6 +110,9 @@ int __attribute__((visibility("default"))) ServiceMain(int, char**) {
     return 1;
   }
 
+  if (commit_threads > 0)
+    svc->service()->SetCommitWorkerThreads(commit_threads);
+
   // Set the CPU limit and start the watchdog running. The memory limit will
   // be set inside the service code as it relies on the size of buffers.
   // The CPU limit is 75% over a 30 second interval.
@@ -26,10 +26,12 @@
 #include <sys/uio.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <atomic>
 #include <memory>
 #include <mutex>
 #include <thread>
+#include <vector>
 
 #include "perfetto/base/build_config.h"
 #include "perfetto/base/event.h"
@@ -38,6 +40,7 @@
 #include "perfetto/base/thread_checker.h"
 #include "perfetto/base/unix_task_runner.h"
 #include "perfetto/base/utils.h"
+#include "perfetto/base/weak_ptr.h"
 #include "perfetto/tracing/core/consumer.h"
 #include "perfetto/tracing/core/trace_config.h"
 #include "perfetto/tracing/core/trace_packet.h"
@@ -58,11 +61,23 @@ namespace consumer {
 
 namespace {
 
+// Size of the buffer used to batch the packets passed to the OnTraceDataCb of
+// streaming sessions.
+constexpr size_t kStreamingChunkSize = 256 * 1024;
+
+// Period of the ReadBuffers() calls of streaming sessions, unless overridden
+// by |file_write_period_ms| in the trace config.
+constexpr uint32_t kDefaultStreamingPeriodMs = 1000;
+
 class TracingSession : public Consumer {
  public:
+  // If |data_callback| is not null the session is a streaming one: rather than
+  // asking the service to write the trace into |buf_fd_|, it reads the trace
+  // buffers periodically and passes their contents to |data_callback|.
   TracingSession(base::TaskRunner*,
                  Handle,
                  OnStateChangedCb,
+                 OnTraceDataCb data_callback,
                  void* callback_arg,
                  const perfetto::protos::TraceConfig&);
   ~TracingSession() override;
@@ -100,9 +115,18 @@ class TracingSession : public Consumer {
   void DestroyConnection();
   void NotifyCallback();
 
+  bool is_streaming() const { return data_callback_ != nullptr; }
+
+  // Used only by streaming sessions.
+  void ReadBuffersPeriodically();
+  void ReadBuffers();
+  void AppendToChunk(const char* data, size_t size);
+  void FlushChunk(bool has_more);
+
   base::TaskRunner* const task_runner_;
   Handle const handle_;
   OnStateChangedCb const callback_ = nullptr;
+  OnTraceDataCb const data_callback_ = nullptr;
   void* const callback_arg_ = nullptr;
   TraceConfig trace_config_;
   base::ScopedFile buf_fd_;
@@ -113,21 +137,44 @@ class TracingSession : public Consumer {
   char* mapped_buf_ = nullptr;
   size_t mapped_buf_size_ = 0;
 
+  // State of streaming sessions. |chunk_| is allocated once, with capacity
+  // kStreamingChunkSize, and reused for all the OnTraceDataCb invocations.
+  uint32_t read_period_ms_ = 0;
+  bool read_in_progress_ = false;
+  bool tracing_disabled_ = false;
+  bool final_read_issued_ = false;
+  std::vector<char> chunk_;
+
   PERFETTO_THREAD_CHECKER(thread_checker_)
+
+  // Keep last. Initialized by Initialize(), as the session is created on the
+  // client thread but weak pointers are only valid on |task_runner_|'s thread.
+  std::unique_ptr<base::WeakPtrFactory<TracingSession>> weak_ptr_factory_;
 };
 
 TracingSession::TracingSession(
     base::TaskRunner* task_runner,
     Handle handle,
     OnStateChangedCb callback,
+    OnTraceDataCb data_callback,
     void* callback_arg,
     const perfetto::protos::TraceConfig& trace_config_proto)
     : task_runner_(task_runner),
       handle_(handle),
       callback_(callback),
+      data_callback_(data_callback),
       callback_arg_(callback_arg) {
   PERFETTO_DETACH_FROM_THREAD(thread_checker_);
   trace_config_.FromProto(trace_config_proto);
+
+  if (is_streaming()) {
+    read_period_ms_ = trace_config_.file_write_period_ms();
+    if (!read_period_ms_)
+      read_period_ms_ = kDefaultStreamingPeriodMs;
+    trace_config_.set_write_into_file(false);
+    return;
+  }
+
   trace_config_.set_write_into_file(true);
 
   // TODO(primiano): this really doesn't matter because the trace will be
@@ -148,19 +195,25 @@ bool TracingSession::Initialize() {
   if (state_ != State::kIdle)
     return false;
 
+  if (is_streaming()) {
+    chunk_.reserve(kStreamingChunkSize);
+    weak_ptr_factory_.reset(new base::WeakPtrFactory<TracingSession>(this));
+  } else {
 #if PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
-  char memfd_name[64];
-  snprintf(memfd_name, sizeof(memfd_name), "perfetto_trace_%" PRId64, handle_);
-  buf_fd_.reset(
-      static_cast<int>(syscall(__NR_memfd_create, memfd_name, MFD_CLOEXEC)));
+    char memfd_name[64];
+    snprintf(memfd_name, sizeof(memfd_name), "perfetto_trace_%" PRId64,
+             handle_);
+    buf_fd_.reset(
+        static_cast<int>(syscall(__NR_memfd_create, memfd_name, MFD_CLOEXEC)));
 #else
-  // Fallback for testing on Linux/mac.
-  buf_fd_ = base::TempFile::CreateUnlinked().ReleaseFD();
+    // Fallback for testing on Linux/mac.
+    buf_fd_ = base::TempFile::CreateUnlinked().ReleaseFD();
 #endif
 
-  if (!buf_fd_) {
-    PERFETTO_PLOG("Failed to allocate temporary tracing buffer");
-    return false;
+    if (!buf_fd_) {
+      PERFETTO_PLOG("Failed to allocate temporary tracing buffer");
+      return false;
+    }
   }
 
   state_ = State::kConnecting;
@@ -176,12 +229,17 @@ void TracingSession::OnConnect() {
 
   PERFETTO_DLOG("OnConnect");
   PERFETTO_DCHECK(state_ == State::kConnecting);
-  consumer_endpoint_->EnableTracing(trace_config_,
-                                    base::ScopedFile(dup(*buf_fd_)));
-  if (trace_config_.deferred_start())
+  base::ScopedFile fd;
+  if (buf_fd_)
+    fd.reset(dup(*buf_fd_));
+  consumer_endpoint_->EnableTracing(trace_config_, std::move(fd));
+  if (trace_config_.deferred_start()) {
     state_ = State::kConfigured;
-  else
+  } else {
     state_ = State::kTracing;
+    if (is_streaming())
+      ReadBuffersPeriodically();
+  }
   NotifyCallback();
 }
 
@@ -196,12 +254,25 @@ void TracingSession::StartTracing() {
   }
   state_ = State::kTracing;
   consumer_endpoint_->StartTracing();
+  if (is_streaming())
+    ReadBuffersPeriodically();
 }
 
 void TracingSession::OnTracingDisabled() {
   PERFETTO_DCHECK_THREAD(thread_checker_);
   PERFETTO_DLOG("OnTracingDisabled");
 
+  if (is_streaming()) {
+    // Drain what is left in the trace buffers. The session transitions to
+    // kTraceEnded only once the last chunk has been delivered.
+    tracing_disabled_ = true;
+    if (!read_in_progress_) {
+      final_read_issued_ = true;
+      ReadBuffers();
+    }
+    return;
+  }
+
   struct stat stat_buf {};
   int res = fstat(buf_fd_.get(), &stat_buf);
   mapped_buf_size_ = res == 0 ? static_cast<size_t>(stat_buf.st_size) : 0;
@@ -248,10 +319,88 @@ void TracingSession::DestroyConnection() {
   task_runner_->PostTask([endpoint] { delete endpoint; });
 }
 
-void TracingSession::OnTraceData(std::vector<TracePacket>, bool) {
-  // This should be never called because we are using |write_into_file| and
-  // asking the traced service to directly write into the |buf_fd_|.
-  PERFETTO_DFATAL("Should be unreachable.");
+void TracingSession::OnTraceData(std::vector<TracePacket> packets,
+                                 bool has_more) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+
+  // Non-streaming sessions never get here because they use |write_into_file|
+  // and ask the traced service to directly write into the |buf_fd_|.
+  PERFETTO_DCHECK(is_streaming());
+  PERFETTO_DCHECK(read_in_progress_);
+
+  for (TracePacket& packet : packets) {
+    char* preamble;
+    size_t preamble_size;
+    std::tie(preamble, preamble_size) = packet.GetProtoPreamble();
+    // Flush before the packet, rather than in the middle of it, if it doesn't
+    // fit in what is left of the chunk.
+    if (chunk_.size() + preamble_size + packet.size() > kStreamingChunkSize)
+      FlushChunk(/*has_more=*/true);
+    AppendToChunk(preamble, preamble_size);
+    for (const Slice& slice : packet.slices())
+      AppendToChunk(static_cast<const char*>(slice.start), slice.size);
+  }
+  if (has_more)
+    return;
+
+  read_in_progress_ = false;
+  if (!tracing_disabled_) {
+    // Don't hold back the data until the next read.
+    if (!chunk_.empty())
+      FlushChunk(/*has_more=*/true);
+    return;
+  }
+
+  // If this read was already in progress when tracing was disabled, the trace
+  // buffers might have been written afterwards, so read them once more.
+  if (!final_read_issued_) {
+    final_read_issued_ = true;
+    ReadBuffers();
+    return;
+  }
+  FlushChunk(/*has_more=*/false);
+  DestroyConnection();
+  state_ = State::kTraceEnded;
+  NotifyCallback();
+}
+
+void TracingSession::ReadBuffersPeriodically() {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  if (state_ != State::kTracing || tracing_disabled_)
+    return;
+  if (!read_in_progress_)
+    ReadBuffers();
+  auto weak_this = weak_ptr_factory_->GetWeakPtr();
+  task_runner_->PostDelayedTask(
+      [weak_this] {
+        if (weak_this)
+          weak_this->ReadBuffersPeriodically();
+      },
+      read_period_ms_);
+}
+
+void TracingSession::ReadBuffers() {
+  PERFETTO_DCHECK(!read_in_progress_);
+  read_in_progress_ = true;
+  consumer_endpoint_->ReadBuffers();
+}
+
+void TracingSession::AppendToChunk(const char* data, size_t size) {
+  // Packets larger than the chunk are split across several chunks.
+  while (size > 0) {
+    if (chunk_.size() == kStreamingChunkSize)
+      FlushChunk(/*has_more=*/true);
+    size_t len = std::min(size, kStreamingChunkSize - chunk_.size());
+    chunk_.insert(chunk_.end(), data, data + len);
+    data += len;
+    size -= len;
+  }
+}
+
+void TracingSession::FlushChunk(bool has_more) {
+  data_callback_(handle_, chunk_.data(), chunk_.size(), has_more,
+                 callback_arg_);
+  chunk_.clear();  // Keeps the capacity.
 }
 
 void TracingSession::NotifyCallback() {
@@ -272,7 +421,11 @@ class TracingController {
   TracingController();
 
   // These methods are called from a thread != |task_runner_|.
-  Handle Create(const void*, size_t, OnStateChangedCb, void* callback_arg);
+  Handle Create(const void*,
+                size_t,
+                OnStateChangedCb,
+                OnTraceDataCb,
+                void* callback_arg);
   void StartTracing(Handle);
   State PollState(Handle);
   TraceBuffer ReadTrace(Handle);
@@ -312,6 +465,7 @@ void TracingController::ThreadMain() {
 Handle TracingController::Create(const void* config_proto_buf,
                                  size_t config_len,
                                  OnStateChangedCb callback,
+                                 OnTraceDataCb data_callback,
                                  void* callback_arg) {
   perfetto::protos::TraceConfig config_proto;
   bool parsed = config_proto.ParseFromArray(config_proto_buf,
@@ -329,7 +483,7 @@ Handle TracingController::Create(const void* config_proto_buf,
   std::unique_lock<std::mutex> lock(mutex_);
   Handle handle = ++last_handle_;
   auto* session = new TracingSession(task_runner_.get(), handle, callback,
-                                     callback_arg, config_proto);
+                                     data_callback, callback_arg, config_proto);
   sessions_.emplace(handle, std::unique_ptr<TracingSession>(session));
 
   // Enable the TracingSession on its own thread.
@@ -397,8 +551,22 @@ PERFETTO_EXPORTED_API Handle Create(const void* config_proto,
                                     size_t config_len,
                                     OnStateChangedCb callback,
                                     void* callback_arg) {
-  return TracingController::GetInstance()->Create(config_proto, config_len,
-                                                  callback, callback_arg);
+  return TracingController::GetInstance()->Create(
+      config_proto, config_len, callback, /*data_callback=*/nullptr,
+      callback_arg);
+}
+
+PERFETTO_EXPORTED_API Handle CreateStreaming(const void* config_proto,
+                                             size_t config_len,
+                                             OnStateChangedCb callback,
+                                             OnTraceDataCb data_callback,
+                                             void* callback_arg) {
+  if (!data_callback) {
+    PERFETTO_ELOG("CreateStreaming(): the data callback must not be null");
+    return kInvalidHandle;
+  }
+  return TracingController::GetInstance()->Create(
+      config_proto, config_len, callback, data_callback, callback_arg);
 }
 
 PERFETTO_EXPORTED_API
@@ -111,6 +111,72 @@ void TestSingle() {
   Destroy(handle);
 }
 
+struct StreamingStats {
+  size_t num_chunks = 0;
+  size_t num_bytes = 0;
+  int num_packets = 0;
+  bool got_last_chunk = false;
+};
+
+void OnTraceData(Handle,
+                 const void* data,
+                 size_t size,
+                 bool has_more,
+                 void* ptr) {
+  auto* stats = static_cast<StreamingStats*>(ptr);
+  PERFETTO_CHECK(!stats->got_last_chunk);
+  stats->num_chunks++;
+  stats->num_bytes += size;
+  stats->got_last_chunk = !has_more;
+
+  // Packets that fit in a chunk are never split, so each chunk can be parsed
+  // on its own.
+  perfetto::protos::Trace trace;
+  if (!trace.ParseFromArray(data, static_cast<int>(size))) {
+    PERFETTO_ELOG("Failed to parse the trace chunk");
+    return;
+  }
+  stats->num_packets += trace.packet_size();
+}
+
+void OnStreamingStateChanged(Handle handle, State state, void*) {
+  PERFETTO_LOG("Callback: handle=%" PRId64 " state=%d", handle,
+               static_cast<int>(state));
+}
+
+void TestStreaming() {
+  std::string cfg = GetConfig(3000);
+  StreamingStats stats;
+  auto handle = CreateStreaming(cfg.data(), cfg.size(),
+                                &OnStreamingStateChanged, &OnTraceData, &stats);
+  // The session is created asynchronously, it can still be idle here.
+  while (PollState(handle) == State::kIdle ||
+         PollState(handle) == State::kConnecting) {
+    usleep(10000);
+  }
+  StartTracing(handle);
+  while (static_cast<int>(PollState(handle)) > 0 &&
+         PollState(handle) != State::kTraceEnded) {
+    usleep(10000);
+  }
+
+  // |stats| is written by the callback on the internal thread only until the
+  // session reaches the kTraceEnded state.
+  if (PollState(handle) != State::kTraceEnded) {
+    PERFETTO_ELOG("Trace failed");
+  } else if (!stats.got_last_chunk) {
+    PERFETTO_ELOG("FAIL: the last chunk was not delivered");
+  } else {
+    PERFETTO_LOG("Got %zu chunks, %zu bytes, %d packets", stats.num_chunks,
+                 stats.num_bytes, stats.num_packets);
+  }
+  if (ReadTrace(handle).begin)
+    PERFETTO_ELOG("FAIL: ReadTrace() is not supported on streaming sessions");
+
+  PERFETTO_ILOG("Destroying");
+  Destroy(handle);
+}
+
 void TestMany() {
   std::string cfg = GetConfig(8000);
 
@@ -186,5 +252,7 @@ int main() {
   TestMany();
   PERFETTO_LOG("=============================================================");
 
+  TestStreaming();
+
   return 0;
 }
@@ -45,7 +45,12 @@ bool FtraceConfig::operator==(const FtraceConfig& other) const {
          (atrace_categories_ == other.atrace_categories_) &&
          (atrace_apps_ == other.atrace_apps_) &&
          (buffer_size_kb_ == other.buffer_size_kb_) &&
-         (drain_period_ms_ == other.drain_period_ms_);
+         (drain_period_ms_ == other.drain_period_ms_) &&
+         (compact_sched_ == other.compact_sched_) &&
+         (raw_pages_ == other.raw_pages_) &&
+         (target_pids_ == other.target_pids_) &&
+         (field_filters_ == other.field_filters_) &&
+         (target_tgids_ == other.target_tgids_);
 }
 #pragma GCC diagnostic pop
 
@@ -88,6 +93,39 @@ void FtraceConfig::FromProto(const perfetto::protos::FtraceConfig& proto) {
                 "size mismatch");
   drain_period_ms_ =
       static_cast<decltype(drain_period_ms_)>(proto.drain_period_ms());
+
+  static_assert(sizeof(compact_sched_) == sizeof(proto.compact_sched()),
+                "size mismatch");
+  compact_sched_ = static_cast<decltype(compact_sched_)>(proto.compact_sched());
+
+  static_assert(sizeof(raw_pages_) == sizeof(proto.raw_pages()),
+                "size mismatch");
+  raw_pages_ = static_cast<decltype(raw_pages_)>(proto.raw_pages());
+
+  target_pids_.clear();
+  for (const auto& field : proto.target_pids()) {
+    target_pids_.emplace_back();
+    static_assert(sizeof(target_pids_.back()) == sizeof(proto.target_pids(0)),
+                  "size mismatch");
+    target_pids_.back() =
+        static_cast<decltype(target_pids_)::value_type>(field);
+  }
+
+  field_filters_.clear();
+  for (const auto& field : proto.field_filters()) {
+    field_filters_.emplace_back();
+    field_filters_.back().FromProto(field);
+  }
+
+  target_tgids_.clear();
+  for (const auto& field : proto.target_tgids()) {
+    target_tgids_.emplace_back();
+    static_assert(
+        sizeof(target_tgids_.back()) == sizeof(proto.target_tgids(0)),
+        "size mismatch");
+    target_tgids_.back() =
+        static_cast<decltype(target_tgids_)::value_type>(field);
+  }
   unknown_fields_ = proto.unknown_fields();
 }
 
@@ -122,6 +160,87 @@ void FtraceConfig::ToProto(perfetto::protos::FtraceConfig* proto) const {
                 "size mismatch");
   proto->set_drain_period_ms(
       static_cast<decltype(proto->drain_period_ms())>(drain_period_ms_));
+
+  static_assert(sizeof(compact_sched_) == sizeof(proto->compact_sched()),
+                "size mismatch");
+  proto->set_compact_sched(
+      static_cast<decltype(proto->compact_sched())>(compact_sched_));
+
+  static_assert(sizeof(raw_pages_) == sizeof(proto->raw_pages()),
+                "size mismatch");
+  proto->set_raw_pages(static_cast<decltype(proto->raw_pages())>(raw_pages_));
+
+  for (const auto& it : target_pids_) {
+    proto->add_target_pids(static_cast<decltype(proto->target_pids(0))>(it));
+    static_assert(sizeof(it) == sizeof(proto->target_pids(0)),
+                  "size mismatch");
+  }
+
+  for (const auto& it : field_filters_) {
+    auto* entry = proto->add_field_filters();
+    it.ToProto(entry);
+  }
+
+  for (const auto& it : target_tgids_) {
+    proto->add_target_tgids(static_cast<decltype(proto->target_tgids(0))>(it));
+    static_assert(sizeof(it) == sizeof(proto->target_tgids(0)),
+                  "size mismatch");
+  }
+  *(proto->mutable_unknown_fields()) = unknown_fields_;
+}
+
+FtraceConfig::FieldFilter::FieldFilter() = default;
+FtraceConfig::FieldFilter::~FieldFilter() = default;
+FtraceConfig::FieldFilter::FieldFilter(const FtraceConfig::FieldFilter&) =
+    default;
+FtraceConfig::FieldFilter& FtraceConfig::FieldFilter::operator=(
+    const FtraceConfig::FieldFilter&) = default;
+FtraceConfig::FieldFilter::FieldFilter(FtraceConfig::FieldFilter&&) noexcept =
+    default;
+FtraceConfig::FieldFilter& FtraceConfig::FieldFilter::operator=(
+    FtraceConfig::FieldFilter&&) = default;
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wfloat-equal"
+bool FtraceConfig::FieldFilter::operator==(
+    const FtraceConfig::FieldFilter& other) const {
+  return (event_ == other.event_) && (field_ == other.field_) &&
+         (values_ == other.values_);
+}
+#pragma GCC diagnostic pop
+
+void FtraceConfig::FieldFilter::FromProto(
+    const perfetto::protos::FtraceConfig_FieldFilter& proto) {
+  static_assert(sizeof(event_) == sizeof(proto.event()), "size mismatch");
+  event_ = static_cast<decltype(event_)>(proto.event());
+
+  static_assert(sizeof(field_) == sizeof(proto.field()), "size mismatch");
+  field_ = static_cast<decltype(field_)>(proto.field());
+
+  values_.clear();
+  for (const auto& field : proto.values()) {
+    values_.emplace_back();
+    static_assert(sizeof(values_.back()) == sizeof(proto.values(0)),
+                  "size mismatch");
+    values_.back() = static_cast<decltype(values_)::value_type>(field);
+  }
+  unknown_fields_ = proto.unknown_fields();
+}
+
+void FtraceConfig::FieldFilter::ToProto(
+    perfetto::protos::FtraceConfig_FieldFilter* proto) const {
+  proto->Clear();
+
+  static_assert(sizeof(event_) == sizeof(proto->event()), "size mismatch");
+  proto->set_event(static_cast<decltype(proto->event())>(event_));
+
+  static_assert(sizeof(field_) == sizeof(proto->field()), "size mismatch");
+  proto->set_field(static_cast<decltype(proto->field())>(field_));
+
+  for (const auto& it : values_) {
+    proto->add_values(static_cast<decltype(proto->values(0))>(it));
+    static_assert(sizeof(it) == sizeof(proto->values(0)), "size mismatch");
+  }
   *(proto->mutable_unknown_fields()) = unknown_fields_;
 }
 
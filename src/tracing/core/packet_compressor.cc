@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/tracing/core/packet_compressor.h"
+
+#include <string.h>
+
+#include <tuple>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/base/lz_block.h"
+#include "perfetto/protozero/proto_utils.h"
+#include "perfetto/trace/trusted_packet.pb.h"
+
+namespace perfetto {
+
+namespace {
+
+using protozero::proto_utils::MakeTagLengthDelimited;
+using protozero::proto_utils::WriteVarInt;
+
+constexpr uint32_t kCompressedPacketsFieldNumber = 45;
+static_assert(kCompressedPacketsFieldNumber ==
+                  protos::TrustedPacket::kCompressedPacketsFieldNumber,
+              "Field number mismatch with TracePacket.compressed_packets");
+
+// Max size of a varint-encoded 64-bit integer.
+constexpr size_t kMaxVarIntSize = 10;
+
+// Field tag + field length + uncompressed size.
+constexpr size_t kMaxHeaderSize = 2 + kMaxVarIntSize * 2;
+
+TracePacket CompressBlock(const std::vector<uint8_t>& block) {
+  const size_t bound = base::LzBlockCompressBound(block.size());
+  Slice slice = Slice::Allocate(kMaxHeaderSize + bound);
+  uint8_t* const compressed = slice.own_data() + kMaxHeaderSize;
+  const size_t compressed_size =
+      base::LzBlockCompress(block.data(), block.size(), compressed, bound);
+  PERFETTO_CHECK(compressed_size > 0);
+
+  // The header is written backwards, right before the compressed data, now
+  // that its size is known.
+  uint8_t header[kMaxHeaderSize];
+  uint8_t* ptr = header;
+  ptr = WriteVarInt(MakeTagLengthDelimited(kCompressedPacketsFieldNumber), ptr);
+  uint8_t size_buf[kMaxVarIntSize];
+  const size_t size_len = static_cast<size_t>(
+      WriteVarInt(block.size(), size_buf) - size_buf);
+  ptr = WriteVarInt(size_len + compressed_size, ptr);
+  memcpy(ptr, size_buf, size_len);
+  ptr += size_len;
+  const size_t header_size = static_cast<size_t>(ptr - header);
+  PERFETTO_DCHECK(header_size <= kMaxHeaderSize);
+
+  uint8_t* const start = compressed - header_size;
+  memcpy(start, header, header_size);
+  slice.start = start;
+  slice.size = header_size + compressed_size;
+
+  TracePacket packet;
+  packet.AddSlice(std::move(slice));
+  return packet;
+}
+
+}  // namespace
+
+constexpr size_t PacketCompressor::kDefaultBlockSize;
+
+// static
+void PacketCompressor::Compress(std::vector<TracePacket>* packets,
+                                size_t block_size) {
+  std::vector<TracePacket> compressed_packets;
+  std::vector<uint8_t> block;
+  block.reserve(block_size);
+  for (TracePacket& packet : *packets) {
+    char* preamble;
+    size_t preamble_size;
+    std::tie(preamble, preamble_size) = packet.GetProtoPreamble();
+    if (!block.empty() &&
+        block.size() + preamble_size + packet.size() > block_size) {
+      compressed_packets.emplace_back(CompressBlock(block));
+      block.clear();
+    }
+    block.insert(block.end(), preamble, preamble + preamble_size);
+    for (const Slice& slice : packet.slices()) {
+      const uint8_t* data = reinterpret_cast<const uint8_t*>(slice.start);
+      block.insert(block.end(), data, data + slice.size);
+    }
+  }
+  if (!block.empty())
+    compressed_packets.emplace_back(CompressBlock(block));
+  *packets = std::move(compressed_packets);
+}
+
+}  // namespace perfetto
@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACING_CORE_PACKET_COMPRESSOR_H_
+#define SRC_TRACING_CORE_PACKET_COMPRESSOR_H_
+
+#include <stddef.h>
+
+#include <vector>
+
+#include "perfetto/tracing/core/trace_packet.h"
+
+namespace perfetto {
+
+// Used when writing the trace into a file with TraceConfig.compress_file set.
+// Batches the packets into blocks and replaces each block with a single
+// TracePacket that holds the compressed block in its |compressed_packets|
+// field (see trace_packet.proto for the format).
+//
+// Each block is compressed independently, so a reader can decode the output
+// with bounded memory and a truncated file loses at most its last block.
+class PacketCompressor {
+ public:
+  // Target size of the uncompressed blocks. Packets are never split, so
+  // blocks can be bigger if a single packet exceeds this size.
+  static constexpr size_t kDefaultBlockSize = 128 * 1024;
+
+  PacketCompressor() = delete;
+
+  // Replaces the contents of |packets| with the compressed packets.
+  static void Compress(std::vector<TracePacket>* packets,
+                       size_t block_size = kDefaultBlockSize);
+};
+
+}  // namespace perfetto
+
+#endif  // SRC_TRACING_CORE_PACKET_COMPRESSOR_H_
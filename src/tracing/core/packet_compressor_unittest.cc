@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/tracing/core/packet_compressor.h"
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "perfetto/base/lz_block.h"
+#include "perfetto/protozero/proto_utils.h"
+
+#include "perfetto/trace/trace.pb.h"
+#include "perfetto/trace/trace_packet.pb.h"
+
+namespace perfetto {
+namespace {
+
+class PacketCompressorTest : public ::testing::Test {
+ protected:
+  // Appends a packet with the given payload to |packets_|, split in two
+  // slices to check that slices are stitched together.
+  void AddPacket(const std::string& payload) {
+    protos::TracePacket proto;
+    proto.mutable_for_testing()->set_str(payload);
+    buffers_.emplace_back(proto.SerializeAsString());
+    const std::string& buf = buffers_.back();
+    TracePacket packet;
+    packet.AddSlice(buf.data(), buf.size() / 2);
+    packet.AddSlice(buf.data() + buf.size() / 2, buf.size() - buf.size() / 2);
+    packets_.emplace_back(std::move(packet));
+  }
+
+  // Decompresses the blocks in |packets_| and returns the payloads of the
+  // packets contained in them.
+  std::vector<std::string> Decompress() {
+    std::vector<std::string> payloads;
+    for (const TracePacket& packet : packets_) {
+      protos::TracePacket proto;
+      EXPECT_TRUE(packet.Decode(&proto));
+      EXPECT_EQ(1u, packet.slices().size());
+      const std::string& block = proto.compressed_packets();
+      EXPECT_FALSE(block.empty());
+
+      const uint8_t* begin = reinterpret_cast<const uint8_t*>(block.data());
+      const uint8_t* end = begin + block.size();
+      uint64_t size = 0;
+      const uint8_t* data =
+          protozero::proto_utils::ParseVarInt(begin, end, &size);
+      std::string decompressed(static_cast<size_t>(size), '\0');
+      EXPECT_TRUE(base::LzBlockDecompress(
+          data, static_cast<size_t>(end - data),
+          reinterpret_cast<uint8_t*>(&decompressed[0]), decompressed.size()));
+
+      protos::Trace trace;
+      EXPECT_TRUE(trace.ParseFromString(decompressed));
+      for (const auto& inner : trace.packet())
+        payloads.push_back(inner.for_testing().str());
+    }
+    return payloads;
+  }
+
+  std::deque<std::string> buffers_;  // Stable addresses for the slices.
+  std::vector<TracePacket> packets_;
+};
+
+TEST_F(PacketCompressorTest, Empty) {
+  PacketCompressor::Compress(&packets_);
+  EXPECT_TRUE(packets_.empty());
+}
+
+TEST_F(PacketCompressorTest, SingleBlock) {
+  std::vector<std::string> expected;
+  for (int i = 0; i < 100; i++) {
+    expected.push_back("payload-" + std::to_string(i));
+    AddPacket(expected.back());
+  }
+  size_t uncompressed_size = 0;
+  for (const TracePacket& packet : packets_)
+    uncompressed_size += packet.size();
+
+  PacketCompressor::Compress(&packets_);
+  ASSERT_EQ(1u, packets_.size());
+  EXPECT_LT(packets_[0].size(), uncompressed_size);
+  EXPECT_EQ(expected, Decompress());
+}
+
+TEST_F(PacketCompressorTest, MultipleBlocks) {
+  std::vector<std::string> expected;
+  for (int i = 0; i < 100; i++) {
+    expected.push_back(std::string(100, static_cast<char>('a' + i % 26)));
+    AddPacket(expected.back());
+  }
+
+  // Each packet is ~100 bytes, so ~10 of them fit in a block.
+  PacketCompressor::Compress(&packets_, 1024);
+  EXPECT_GE(packets_.size(), 10u);
+  EXPECT_LE(packets_.size(), 12u);
+  EXPECT_EQ(expected, Decompress());
+}
+
+// Packets bigger than the block size are not split.
+TEST_F(PacketCompressorTest, PacketBiggerThanBlock) {
+  std::vector<std::string> expected;
+  expected.push_back("small");
+  expected.push_back(std::string(4096, 'x'));
+  expected.push_back("small again");
+  for (const std::string& payload : expected)
+    AddPacket(payload);
+
+  PacketCompressor::Compress(&packets_, 1024);
+  EXPECT_EQ(3u, packets_.size());
+  EXPECT_EQ(expected, Decompress());
+}
+
+}  // namespace
+}  // namespace perfetto
@@ -59,6 +59,11 @@ bool PacketStreamValidator::Validate(const Slices& slices) {
   if (!packet.synchronization_marker().empty())
     return false;
 
+  // Only the service is allowed to emit compressed packets, as they can wrap
+  // packets with arbitrary trusted fields.
+  if (!packet.compressed_packets().empty())
+    return false;
+
   // We are deliberately not checking for clock_snapshot for the moment. It's
   // unclear if we want to allow producers to snapshot their clocks. Ideally we
   // want a security model where producers can only snapshot their own clocks
@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "perfetto/tracing/core/sequence_interning_state.h"
+
+#include "perfetto/trace/interned_data/interned_data.pbzero.h"
+#include "perfetto/trace/trace_packet.pbzero.h"
+#include "perfetto/trace/track_event/debug_annotation.pbzero.h"
+#include "perfetto/trace/track_event/task_execution.pbzero.h"
+#include "perfetto/trace/track_event/track_event.pbzero.h"
+
+namespace perfetto {
+
+constexpr size_t SequenceInterningState::kDefaultMaxEntriesPerIndex;
+
+SequenceInterningState::SequenceInterningState(size_t max_entries_per_index,
+                                               uint32_t reset_period_packets)
+    : reset_period_packets_(reset_period_packets),
+      event_categories_(max_entries_per_index),
+      legacy_event_names_(max_entries_per_index),
+      debug_annotation_names_(max_entries_per_index),
+      source_locations_(max_entries_per_index) {}
+
+SequenceInterningState::~SequenceInterningState() = default;
+
+bool SequenceInterningState::BeginPacket() {
+  new_event_categories_.clear();
+  new_legacy_event_names_.clear();
+  new_debug_annotation_names_.clear();
+  new_source_locations_.clear();
+
+  if (reset_period_packets_ && ++packets_since_reset_ >= reset_period_packets_)
+    reset_pending_ = true;
+
+  cleared_in_current_packet_ = reset_pending_;
+  if (PERFETTO_LIKELY(!reset_pending_))
+    return false;
+
+  // The iids are not reset: the entries emitted from now on get new ones, see
+  // InterningIndex::Clear().
+  event_categories_.Clear();
+  legacy_event_names_.Clear();
+  debug_annotation_names_.Clear();
+  source_locations_.Clear();
+  reset_pending_ = false;
+  packets_since_reset_ = 0;
+  return true;
+}
+
+void SequenceInterningState::EndPacket(protos::pbzero::TracePacket* packet) {
+  if (cleared_in_current_packet_)
+    packet->set_incremental_state_cleared(true);
+  cleared_in_current_packet_ = false;
+
+  if (new_event_categories_.empty() && new_legacy_event_names_.empty() &&
+      new_debug_annotation_names_.empty() && new_source_locations_.empty()) {
+    return;
+  }
+
+  auto* interned_data = packet->set_interned_data();
+  for (const auto& entry : new_event_categories_) {
+    auto* category = interned_data->add_event_categories();
+    category->set_iid(entry.first);
+    category->set_name(entry.second.data(), entry.second.size());
+  }
+  for (const auto& entry : new_legacy_event_names_) {
+    auto* name = interned_data->add_legacy_event_names();
+    name->set_iid(entry.first);
+    name->set_name(entry.second.data(), entry.second.size());
+  }
+  for (const auto& entry : new_debug_annotation_names_) {
+    auto* name = interned_data->add_debug_annotation_names();
+    name->set_iid(entry.first);
+    name->set_name(entry.second.data(), entry.second.size());
+  }
+  for (const auto& entry : new_source_locations_) {
+    auto* location = interned_data->add_source_locations();
+    location->set_iid(entry.first);
+    location->set_file_name(entry.second.file_name.data(),
+                            entry.second.file_name.size());
+    location->set_function_name(entry.second.function_name.data(),
+                                entry.second.function_name.size());
+  }
+}
+
+// static
+uint32_t SequenceInterningState::InternString(StringIndex* index,
+                                              PendingStrings* pending,
+                                              base::StringView value) {
+  bool is_new = false;
+  uint32_t iid = index->Intern(value, &is_new);
+  if (PERFETTO_UNLIKELY(is_new))
+    pending->emplace_back(iid, value.ToStdString());
+  return iid;
+}
+
+uint32_t SequenceInterningState::InternEventCategory(base::StringView name) {
+  return InternString(&event_categories_, &new_event_categories_, name);
+}
+
+uint32_t SequenceInterningState::InternLegacyEventName(base::StringView name) {
+  return InternString(&legacy_event_names_, &new_legacy_event_names_, name);
+}
+
+uint32_t SequenceInterningState::InternDebugAnnotationName(
+    base::StringView name) {
+  return InternString(&debug_annotation_names_, &new_debug_annotation_names_,
+                      name);
+}
+
+uint32_t SequenceInterningState::InternSourceLocation(
+    base::StringView file_name,
+    base::StringView function_name) {
+  bool is_new = false;
+  uint32_t iid = source_locations_.Intern(
+      SourceLocationRef(file_name, function_name), &is_new);
+  if (PERFETTO_UNLIKELY(is_new)) {
+    new_source_locations_.emplace_back(
+        iid, SourceLocation{file_name.ToStdString(),
+                            function_name.ToStdString()});
+  }
+  return iid;
+}
+
+}  // namespace perfetto
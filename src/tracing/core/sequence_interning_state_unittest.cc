@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "perfetto/tracing/core/sequence_interning_state.h"
+
+#include <memory>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "perfetto/tracing/core/interning_index.h"
+#include "src/tracing/core/trace_writer_for_testing.h"
+
+#include "perfetto/trace/trace_packet.pb.h"
+#include "perfetto/trace/trace_packet.pbzero.h"
+#include "perfetto/trace/track_event/track_event.pbzero.h"
+
+namespace perfetto {
+namespace {
+
+TEST(InterningIndexTest, AssignsSequentialIids) {
+  InterningIndex<base::StringView, std::string> index(8);
+  bool is_new = false;
+  EXPECT_EQ(1u, index.Intern("foo", &is_new));
+  EXPECT_TRUE(is_new);
+  EXPECT_EQ(2u, index.Intern("bar", &is_new));
+  EXPECT_TRUE(is_new);
+
+  // The lookups don't depend on the lifetime of the caller's string.
+  std::string foo = "foo";
+  EXPECT_EQ(1u, index.Intern(base::StringView(foo), &is_new));
+  EXPECT_FALSE(is_new);
+  EXPECT_EQ(2u, index.size());
+}
+
+TEST(InterningIndexTest, EvictsLeastRecentlyUsed) {
+  InterningIndex<uint64_t> index(2);
+  bool is_new = false;
+  EXPECT_EQ(1u, index.Intern(100, &is_new));
+  EXPECT_EQ(2u, index.Intern(200, &is_new));
+  EXPECT_EQ(1u, index.Intern(100, &is_new));  // 200 is now the LRU entry.
+  EXPECT_EQ(3u, index.Intern(300, &is_new));
+  EXPECT_TRUE(is_new);
+  EXPECT_EQ(2u, index.size());
+
+  EXPECT_EQ(1u, index.Intern(100, &is_new));
+  EXPECT_FALSE(is_new);
+  // The evicted value gets a new iid.
+  EXPECT_EQ(4u, index.Intern(200, &is_new));
+  EXPECT_TRUE(is_new);
+}
+
+TEST(InterningIndexTest, ClearDoesNotReuseIids) {
+  InterningIndex<uint64_t> index(8);
+  bool is_new = false;
+  EXPECT_EQ(1u, index.Intern(100, &is_new));
+  index.Clear();
+  EXPECT_EQ(0u, index.size());
+  EXPECT_EQ(2u, index.Intern(100, &is_new));
+  EXPECT_TRUE(is_new);
+}
+
+class SequenceInterningStateTest : public ::testing::Test {
+ protected:
+  // Writes a packet that refers to |category| and |name| and returns it,
+  // parsed.
+  std::unique_ptr<protos::TracePacket> WritePacket(const char* category,
+                                                   const char* name,
+                                                   bool* cleared = nullptr) {
+    TraceWriterForTesting writer;
+    bool state_cleared = state_->BeginPacket();
+    if (cleared)
+      *cleared = state_cleared;
+    {
+      auto packet = writer.NewTracePacket();
+      auto* event = packet->set_track_event();
+      event->add_category_iids(state_->InternEventCategory(category));
+      event->set_legacy_event()->set_name_iid(
+          state_->InternLegacyEventName(name));
+      state_->EndPacket(&*packet);
+    }
+    return writer.ParseProto();
+  }
+
+  std::unique_ptr<SequenceInterningState> state_{new SequenceInterningState()};
+};
+
+TEST_F(SequenceInterningStateTest, EmitsNewEntriesOnce) {
+  bool cleared = false;
+  auto packet = WritePacket("cat", "name", &cleared);
+  ASSERT_TRUE(packet);
+  EXPECT_TRUE(cleared);
+  EXPECT_TRUE(packet->incremental_state_cleared());
+  ASSERT_EQ(1, packet->interned_data().event_categories_size());
+  EXPECT_EQ(1u, packet->interned_data().event_categories(0).iid());
+  EXPECT_EQ("cat", packet->interned_data().event_categories(0).name());
+  ASSERT_EQ(1, packet->interned_data().legacy_event_names_size());
+  EXPECT_EQ(1u, packet->interned_data().legacy_event_names(0).iid());
+  EXPECT_EQ("name", packet->interned_data().legacy_event_names(0).name());
+  EXPECT_EQ(1u, packet->track_event().category_iids(0));
+  EXPECT_EQ(1u, packet->track_event().legacy_event().name_iid());
+
+  packet = WritePacket("cat", "other_name", &cleared);
+  ASSERT_TRUE(packet);
+  EXPECT_FALSE(cleared);
+  EXPECT_FALSE(packet->has_incremental_state_cleared());
+  EXPECT_EQ(0, packet->interned_data().event_categories_size());
+  ASSERT_EQ(1, packet->interned_data().legacy_event_names_size());
+  EXPECT_EQ(2u, packet->interned_data().legacy_event_names(0).iid());
+  EXPECT_EQ("other_name", packet->interned_data().legacy_event_names(0).name());
+
+  packet = WritePacket("cat", "name");
+  ASSERT_TRUE(packet);
+  EXPECT_FALSE(packet->has_interned_data());
+  EXPECT_EQ(1u, packet->track_event().legacy_event().name_iid());
+}
+
+TEST_F(SequenceInterningStateTest, ResetEmitsEntriesAgainWithNewIids) {
+  WritePacket("cat", "name");
+  state_->Reset();
+
+  bool cleared = false;
+  auto packet = WritePacket("cat", "name", &cleared);
+  ASSERT_TRUE(packet);
+  EXPECT_TRUE(cleared);
+  EXPECT_TRUE(packet->incremental_state_cleared());
+  ASSERT_EQ(1, packet->interned_data().event_categories_size());
+  EXPECT_EQ(2u, packet->interned_data().event_categories(0).iid());
+  EXPECT_EQ("cat", packet->interned_data().event_categories(0).name());
+  EXPECT_EQ(2u, packet->track_event().category_iids(0));
+}
+
+TEST_F(SequenceInterningStateTest, PeriodicReset) {
+  state_.reset(new SequenceInterningState(
+      SequenceInterningState::kDefaultMaxEntriesPerIndex,
+      /*reset_period_packets=*/3));
+  bool cleared = false;
+  for (int i = 0; i < 7; i++) {
+    auto packet = WritePacket("cat", "name", &cleared);
+    ASSERT_TRUE(packet);
+    EXPECT_EQ(i % 3 == 0, cleared) << i;
+    EXPECT_EQ(cleared, packet->has_interned_data()) << i;
+  }
+}
+
+TEST_F(SequenceInterningStateTest, SourceLocations) {
+  TraceWriterForTesting writer;
+  state_->BeginPacket();
+  {
+    auto packet = writer.NewTracePacket();
+    EXPECT_EQ(1u, state_->InternSourceLocation("a.cc", "Foo"));
+    EXPECT_EQ(2u, state_->InternSourceLocation("a.cc", "Bar"));
+    EXPECT_EQ(1u, state_->InternSourceLocation("a.cc", "Foo"));
+    state_->EndPacket(&*packet);
+  }
+  auto packet = writer.ParseProto();
+  ASSERT_TRUE(packet);
+  const auto& interned_data = packet->interned_data();
+  ASSERT_EQ(2, interned_data.source_locations_size());
+  EXPECT_EQ(1u, interned_data.source_locations(0).iid());
+  EXPECT_EQ("a.cc", interned_data.source_locations(0).file_name());
+  EXPECT_EQ("Foo", interned_data.source_locations(0).function_name());
+  EXPECT_EQ(2u, interned_data.source_locations(1).iid());
+  EXPECT_EQ("Bar", interned_data.source_locations(1).function_name());
+}
+
+}  // namespace
+}  // namespace perfetto
@@ -21,8 +21,10 @@
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "perfetto/base/file_utils.h"
+#include "perfetto/base/lz_block.h"
 #include "perfetto/base/temp_file.h"
 #include "perfetto/base/utils.h"
+#include "perfetto/protozero/proto_utils.h"
 #include "perfetto/tracing/core/consumer.h"
 #include "perfetto/tracing/core/data_source_config.h"
 #include "perfetto/tracing/core/data_source_descriptor.h"
@@ -397,6 +399,87 @@ TEST_F(TracingServiceImplTest, WriteIntoFileAndStopOnMaxSize) {
   }
 }
 
+TEST_F(TracingServiceImplTest, WriteIntoFileCompressed) {
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer");
+  producer->RegisterDataSource("data_source");
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(4096);
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name("data_source");
+  ds_config->set_target_buffer(0);
+  trace_config.set_write_into_file(true);
+  trace_config.set_file_write_period_ms(100000);  // 100s
+  trace_config.set_compress_file(true);
+  base::TempFile tmp_file = base::TempFile::Create();
+  consumer->EnableTracing(trace_config, base::ScopedFile(dup(tmp_file.fd())));
+
+  producer->WaitForTracingSetup();
+  producer->WaitForDataSourceSetup("data_source");
+  producer->WaitForDataSourceStart("data_source");
+
+  static const int kNumTestPackets = 100;
+  static const char kPayload[] = "1234567890abcdef-";
+
+  std::unique_ptr<TraceWriter> writer =
+      producer->CreateTraceWriter("data_source");
+  for (int i = 0; i < kNumTestPackets; i++) {
+    auto tp = writer->NewTracePacket();
+    std::string payload(kPayload);
+    payload.append(std::to_string(i));
+    tp->set_for_testing()->set_str(payload.c_str(), payload.size());
+  }
+  writer->Flush();
+  writer.reset();
+
+  consumer->DisableTracing();
+  producer->WaitForDataSourceStop("data_source");
+  consumer->WaitForTracingDisabled();
+
+  // All the packets in the file, including the preamble, must be wrapped into
+  // compressed blocks.
+  std::string trace_raw;
+  ASSERT_TRUE(base::ReadFile(tmp_file.path().c_str(), &trace_raw));
+  protos::Trace trace;
+  ASSERT_TRUE(trace.ParseFromString(trace_raw));
+  ASSERT_GT(trace.packet_size(), 0);
+
+  std::vector<std::string> payloads;
+  size_t uncompressed_size = 0;
+  for (const protos::TracePacket& packet : trace.packet()) {
+    const std::string& block = packet.compressed_packets();
+    ASSERT_FALSE(block.empty());
+    const uint8_t* start = reinterpret_cast<const uint8_t*>(block.data());
+    const uint8_t* end = start + block.size();
+    uint64_t size = 0;
+    const uint8_t* data =
+        protozero::proto_utils::ParseVarInt(start, end, &size);
+    ASSERT_NE(start, data);
+    std::string decompressed(static_cast<size_t>(size), '\0');
+    ASSERT_TRUE(base::LzBlockDecompress(
+        data, static_cast<size_t>(end - data),
+        reinterpret_cast<uint8_t*>(&decompressed[0]), decompressed.size()));
+    uncompressed_size += decompressed.size();
+
+    protos::Trace inner;
+    ASSERT_TRUE(inner.ParseFromString(decompressed));
+    for (const protos::TracePacket& inner_packet : inner.packet()) {
+      EXPECT_TRUE(inner_packet.compressed_packets().empty());
+      if (inner_packet.has_for_testing())
+        payloads.push_back(inner_packet.for_testing().str());
+    }
+  }
+  EXPECT_LT(trace_raw.size(), uncompressed_size);
+
+  ASSERT_EQ(static_cast<size_t>(kNumTestPackets), payloads.size());
+  for (int i = 0; i < kNumTestPackets; i++)
+    EXPECT_EQ(kPayload + std::to_string(i), payloads[static_cast<size_t>(i)]);
+}
+
 // Test the logic that allows the trace config to set the shm total size and
 // page size from the trace config. Also check that, if the config doesn't
 // specify a value we fall back on the hint provided by the producer.
@@ -459,6 +542,41 @@ TEST_F(TracingServiceImplTest, ProducerShmAndPageSizeOverriddenByTraceConfig) {
   ASSERT_THAT(actual_shm_sizes_kb, ElementsAreArray(kExpectedSizesKb));
 }
 
+// The commit batching duration is passed to the producer, capped by the
+// service.
+TEST_F(TracingServiceImplTest, ProducerBatchCommitsDurationFromTraceConfig) {
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+  const uint32_t kConfigDurationsMs[] = {0, 100, 60000};
+  const uint32_t kExpectedDurationsMs[] = {0, 100, 1000};
+
+  const size_t kNumProducers = base::ArraySize(kConfigDurationsMs);
+  std::unique_ptr<MockProducer> producer[kNumProducers];
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(128);
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name("data_source");
+  for (size_t i = 0; i < kNumProducers; i++) {
+    auto name = "mock_producer_" + std::to_string(i);
+    producer[i] = CreateMockProducer();
+    producer[i]->Connect(svc.get(), name);
+    producer[i]->RegisterDataSource("data_source");
+    auto* producer_config = trace_config.add_producers();
+    producer_config->set_producer_name(name);
+    producer_config->set_batch_commits_duration_ms(kConfigDurationsMs[i]);
+  }
+
+  consumer->EnableTracing(trace_config);
+  for (size_t i = 0; i < kNumProducers; i++) {
+    producer[i]->WaitForTracingSetup();
+    producer[i]->WaitForDataSourceSetup("data_source");
+    EXPECT_EQ(kExpectedDurationsMs[i],
+              producer[i]->endpoint()->batch_commits_duration_ms());
+  }
+  for (size_t i = 0; i < kNumProducers; i++)
+    producer[i]->WaitForDataSourceStart("data_source");
+}
+
 TEST_F(TracingServiceImplTest, ExplicitFlush) {
   std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
   consumer->Connect(svc.get());
@@ -497,6 +615,68 @@ TEST_F(TracingServiceImplTest, ExplicitFlush) {
                         Property(&protos::TestEvent::str, Eq("payload")))));
 }
 
+// Cloning the buffers returns their contents without consuming them and
+// without affecting the running session.
+TEST_F(TracingServiceImplTest, CloneAndReadBuffers) {
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer");
+  producer->RegisterDataSource("data_source");
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(128);
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name("data_source");
+
+  consumer->EnableTracing(trace_config);
+  producer->WaitForTracingSetup();
+  producer->WaitForDataSourceSetup("data_source");
+  producer->WaitForDataSourceStart("data_source");
+
+  std::unique_ptr<TraceWriter> writer =
+      producer->CreateTraceWriter("data_source");
+  auto write_and_flush = [&](const char* payload) {
+    writer->NewTracePacket()->set_for_testing()->set_str(payload);
+    auto flush_request = consumer->Flush();
+    producer->WaitForFlush(writer.get());
+    ASSERT_TRUE(flush_request.WaitForReply());
+  };
+  auto has_payload = [](const char* payload) {
+    return Contains(Property(&protos::TracePacket::for_testing,
+                             Property(&protos::TestEvent::str, Eq(payload))));
+  };
+
+  write_and_flush("payload1");
+  auto packets = consumer->CloneAndReadBuffers();
+  EXPECT_THAT(packets, has_payload("payload1"));
+  EXPECT_THAT(packets,
+              Contains(Property(&protos::TracePacket::has_trace_config, true)));
+
+  write_and_flush("payload2");
+  packets = consumer->CloneAndReadBuffers();
+  EXPECT_THAT(packets, has_payload("payload1"));
+  EXPECT_THAT(packets, has_payload("payload2"));
+  EXPECT_THAT(packets,
+              Contains(Property(&protos::TracePacket::has_trace_config, true)));
+
+  // The clones didn't consume the buffers.
+  packets = consumer->ReadBuffers();
+  EXPECT_THAT(packets, has_payload("payload1"));
+  EXPECT_THAT(packets, has_payload("payload2"));
+
+  // ReadBuffers() instead did.
+  write_and_flush("payload3");
+  packets = consumer->CloneAndReadBuffers();
+  EXPECT_THAT(packets, Not(has_payload("payload1")));
+  EXPECT_THAT(packets, has_payload("payload3"));
+
+  consumer->DisableTracing();
+  producer->WaitForDataSourceStop("data_source");
+  consumer->WaitForTracingDisabled();
+}
+
 TEST_F(TracingServiceImplTest, ImplicitFlushOnTimedTraces) {
   std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
   consumer->Connect(svc.get());
@@ -1026,6 +1206,71 @@ TEST_F(TracingServiceImplTest, ProducerUIDsAndPacketSequenceIDs) {
           Property(&protos::TracePacket::trusted_packet_sequence_id, Eq(4u)))));
 }
 
+TEST_F(TracingServiceImplTest, MultiThreadedCommit) {
+  svc->SetCommitWorkerThreads(2);
+
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  static constexpr size_t kNumProducers = 3;
+  std::vector<std::unique_ptr<MockProducer>> producers;
+  for (size_t i = 0; i < kNumProducers; i++) {
+    producers.emplace_back(CreateMockProducer());
+    producers.back()->Connect(svc.get(),
+                              "mock_producer" + std::to_string(i));
+    producers.back()->RegisterDataSource("data_source");
+  }
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(128);
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name("data_source");
+
+  consumer->EnableTracing(trace_config);
+  for (auto& producer : producers) {
+    producer->WaitForTracingSetup();
+    producer->WaitForDataSourceSetup("data_source");
+  }
+  for (auto& producer : producers)
+    producer->WaitForDataSourceStart("data_source");
+
+  // Write enough packets to fill several chunks for each producer, so that
+  // the commits are spread over the workers.
+  static constexpr size_t kNumPackets = 100;
+  std::vector<std::unique_ptr<TraceWriter>> writers;
+  for (auto& producer : producers)
+    writers.emplace_back(producer->CreateTraceWriter("data_source"));
+  for (size_t i = 0; i < kNumPackets; i++) {
+    for (size_t w = 0; w < writers.size(); w++) {
+      char payload[64];
+      sprintf(payload, "payload_%zu_%zu", w, i);
+      writers[w]->NewTracePacket()->set_for_testing()->set_str(payload);
+    }
+  }
+
+  auto flush_request = consumer->Flush();
+  for (size_t i = 0; i < kNumProducers; i++)
+    producers[i]->WaitForFlush(writers[i].get());
+  ASSERT_TRUE(flush_request.WaitForReply());
+
+  consumer->DisableTracing();
+  for (auto& producer : producers)
+    producer->WaitForDataSourceStop("data_source");
+  consumer->WaitForTracingDisabled();
+
+  auto packets = consumer->ReadBuffers();
+  for (size_t w = 0; w < writers.size(); w++) {
+    for (size_t i = 0; i < kNumPackets; i++) {
+      char payload[64];
+      sprintf(payload, "payload_%zu_%zu", w, i);
+      EXPECT_THAT(packets,
+                  Contains(Property(
+                      &protos::TracePacket::for_testing,
+                      Property(&protos::TestEvent::str, Eq(payload)))));
+    }
+  }
+}
+
 TEST_F(TracingServiceImplTest, AllowedBuffers) {
   std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
   consumer->Connect(svc.get());
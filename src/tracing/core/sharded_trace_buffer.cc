@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/tracing/core/sharded_trace_buffer.h"
+
+#include <algorithm>
+
+#include "perfetto/tracing/core/trace_packet.h"
+
+namespace perfetto {
+
+// static
+std::unique_ptr<ShardedTraceBuffer> ShardedTraceBuffer::Create(
+    size_t size_in_bytes,
+    TraceBuffer::OverwritePolicy policy,
+    size_t num_shards) {
+  num_shards = std::max(num_shards, size_t(1));
+  std::unique_ptr<ShardedTraceBuffer> buf(new ShardedTraceBuffer());
+  for (size_t i = 0; i < num_shards; i++) {
+    std::unique_ptr<TraceBuffer> shard =
+        TraceBuffer::Create(size_in_bytes, policy);
+    if (!shard)
+      return nullptr;
+    buf->size_ += shard->size();
+    buf->shards_.emplace_back(std::move(shard));
+  }
+  return buf;
+}
+
+ShardedTraceBuffer::ShardedTraceBuffer() = default;
+ShardedTraceBuffer::~ShardedTraceBuffer() = default;
+
+void ShardedTraceBuffer::BeginRead() {
+  read_shard_ = 0;
+  shards_[0]->BeginRead();
+}
+
+bool ShardedTraceBuffer::ReadNextTracePacket(
+    TracePacket* packet,
+    TraceBuffer::PacketSequenceProperties* sequence_properties) {
+  for (;;) {
+    if (shards_[read_shard_]->ReadNextTracePacket(packet, sequence_properties))
+      return true;
+    if (read_shard_ + 1 >= shards_.size())
+      return false;
+    shards_[++read_shard_]->BeginRead();
+  }
+}
+
+std::unique_ptr<ShardedTraceBuffer> ShardedTraceBuffer::CloneReadOnly() const {
+  std::unique_ptr<ShardedTraceBuffer> buf(new ShardedTraceBuffer());
+  for (const auto& shard : shards_) {
+    std::unique_ptr<TraceBuffer> clone = shard->CloneReadOnly();
+    if (!clone)
+      return nullptr;
+    buf->shards_.emplace_back(std::move(clone));
+  }
+  buf->size_ = size_;
+  return buf;
+}
+
+TraceStats::BufferStats ShardedTraceBuffer::stats() const {
+  if (shards_.size() == 1)
+    return shards_[0]->stats();
+
+  TraceStats::BufferStats res;
+  for (const auto& shard : shards_) {
+    const TraceStats::BufferStats& s = shard->stats();
+    res.set_buffer_size(res.buffer_size() + s.buffer_size());
+    res.set_bytes_written(res.bytes_written() + s.bytes_written());
+    res.set_bytes_overwritten(res.bytes_overwritten() + s.bytes_overwritten());
+    res.set_bytes_read(res.bytes_read() + s.bytes_read());
+    res.set_padding_bytes_written(res.padding_bytes_written() +
+                                  s.padding_bytes_written());
+    res.set_padding_bytes_cleared(res.padding_bytes_cleared() +
+                                  s.padding_bytes_cleared());
+    res.set_chunks_written(res.chunks_written() + s.chunks_written());
+    res.set_chunks_rewritten(res.chunks_rewritten() + s.chunks_rewritten());
+    res.set_chunks_overwritten(res.chunks_overwritten() +
+                               s.chunks_overwritten());
+    res.set_chunks_discarded(res.chunks_discarded() + s.chunks_discarded());
+    res.set_chunks_read(res.chunks_read() + s.chunks_read());
+    res.set_chunks_committed_out_of_order(
+        res.chunks_committed_out_of_order() +
+        s.chunks_committed_out_of_order());
+    res.set_write_wrap_count(res.write_wrap_count() + s.write_wrap_count());
+    res.set_patches_succeeded(res.patches_succeeded() + s.patches_succeeded());
+    res.set_patches_failed(res.patches_failed() + s.patches_failed());
+    res.set_readaheads_succeeded(res.readaheads_succeeded() +
+                                 s.readaheads_succeeded());
+    res.set_readaheads_failed(res.readaheads_failed() + s.readaheads_failed());
+    res.set_abi_violations(res.abi_violations() + s.abi_violations());
+  }
+  return res;
+}
+
+}  // namespace perfetto
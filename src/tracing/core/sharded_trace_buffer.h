@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACING_CORE_SHARDED_TRACE_BUFFER_H_
+#define SRC_TRACING_CORE_SHARDED_TRACE_BUFFER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+#include "perfetto/tracing/core/basic_types.h"
+#include "perfetto/tracing/core/trace_stats.h"
+#include "src/tracing/core/trace_buffer.h"
+
+namespace perfetto {
+
+class TracePacket;
+
+// A trace buffer split into N independent TraceBuffer shards, each one with
+// its own ring, lookaside index and write pointer. This is what the service
+// allocates for each entry of TraceConfig.buffers.
+//
+// Chunks are routed to shards by a hash of their {ProducerID, WriterID}
+// sequence. Hence all the chunks of a given sequence (and all the patches for
+// them) always land in the same shard, and the per-sequence guarantees of
+// TraceBuffer (FIFO reads, stitching of fragmented packets, out-of-band
+// patching) are preserved. The writers of a single producer (e.g. the per-CPU
+// ftrace writers of traced_probes) are spread across all the shards.
+//
+// Each shard has the full size of the buffer, so that sharding never reduces
+// how much history a sequence keeps: a sequence that writes most of the data
+// wraps exactly when it would in an unsharded buffer. The shards are committed
+// lazily (see TraceBuffer::Create()), but in the worst case, when all of them
+// fill up, the buffer uses N times its configured size.
+//
+// Threading model: this class does NOT do any locking. Different shards can
+// be written concurrently from different threads, as long as each shard is
+// only accessed by one thread at a time. TracingServiceImpl guarantees this
+// when using its commit worker pool by posting all the writes for a given
+// shard onto the same worker and by draining the workers (see
+// ThreadPool::WaitIdle()) before any other access (reads, stats, scraping).
+//
+// With one shard (the default) this is a pass-through wrapper around a single
+// TraceBuffer.
+//
+// Reading merges the shards: BeginRead() + ReadNextTracePacket() drain the
+// shards one after the other. As for TraceBuffer, no ordering is guaranteed
+// between packets that belong to different sequences.
+class ShardedTraceBuffer {
+ public:
+  // |size_in_bytes| is the size of each shard, see the class comment.
+  // Can return nullptr if the memory allocation fails.
+  static std::unique_ptr<ShardedTraceBuffer> Create(
+      size_t size_in_bytes,
+      TraceBuffer::OverwritePolicy = TraceBuffer::kOverwrite,
+      size_t num_shards = 1);
+
+  ~ShardedTraceBuffer();
+
+  // Returns the index of the shard that holds all the chunks of the given
+  // {ProducerID, WriterID} sequence.
+  size_t GetShardForSequence(ProducerID producer_id, WriterID writer_id) const {
+    // Fibonacci hashing of the 32-bit sequence key, mapped onto [0, N) using
+    // the high bits of the product, which are the well mixed ones.
+    const uint32_t key =
+        (static_cast<uint32_t>(producer_id) << 16) | writer_id;
+    const uint32_t hash = key * 2654435761u;
+    return static_cast<size_t>(
+        (static_cast<uint64_t>(hash) * shards_.size()) >> 32);
+  }
+
+  // See TraceBuffer::CopyChunkUntrusted(). Routes the chunk to the shard of
+  // its sequence.
+  void CopyChunkUntrusted(ProducerID producer_id_trusted,
+                          uid_t producer_uid_trusted,
+                          WriterID writer_id,
+                          ChunkID chunk_id,
+                          uint16_t num_fragments,
+                          uint8_t chunk_flags,
+                          bool chunk_complete,
+                          const uint8_t* src,
+                          size_t size) {
+    shards_[GetShardForSequence(producer_id_trusted, writer_id)]
+        ->CopyChunkUntrusted(
+        producer_id_trusted, producer_uid_trusted, writer_id, chunk_id,
+        num_fragments, chunk_flags, chunk_complete, src, size);
+  }
+
+  // See TraceBuffer::TryPatchChunkContents().
+  bool TryPatchChunkContents(ProducerID producer_id,
+                             WriterID writer_id,
+                             ChunkID chunk_id,
+                             const TraceBuffer::Patch* patches,
+                             size_t patches_size,
+                             bool other_patches_pending) {
+    return shards_[GetShardForSequence(producer_id, writer_id)]
+        ->TryPatchChunkContents(producer_id, writer_id, chunk_id, patches,
+                                patches_size, other_patches_pending);
+  }
+
+  // See TraceBuffer::BeginRead() and TraceBuffer::ReadNextTracePacket().
+  void BeginRead();
+  bool ReadNextTracePacket(TracePacket*,
+                           TraceBuffer::PacketSequenceProperties*);
+
+  // See TraceBuffer::CloneReadOnly(). Clones all the shards.
+  std::unique_ptr<ShardedTraceBuffer> CloneReadOnly() const;
+
+  // Returns the sum of the stats of all shards.
+  TraceStats::BufferStats stats() const;
+
+  // Returns the total size of all shards, i.e. the worst case memory usage.
+  size_t size() const { return size_; }
+
+  size_t num_shards() const { return shards_.size(); }
+  TraceBuffer* shard(size_t idx) { return shards_[idx].get(); }
+
+ private:
+  ShardedTraceBuffer();
+  ShardedTraceBuffer(const ShardedTraceBuffer&) = delete;
+  ShardedTraceBuffer& operator=(const ShardedTraceBuffer&) = delete;
+
+  std::vector<std::unique_ptr<TraceBuffer>> shards_;
+  size_t size_ = 0;
+
+  // Index of the shard currently being read. Reset by BeginRead().
+  size_t read_shard_ = 0;
+};
+
+}  // namespace perfetto
+
+#endif  // SRC_TRACING_CORE_SHARDED_TRACE_BUFFER_H_
@@ -0,0 +1,216 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/tracing/core/sharded_trace_buffer.h"
+
+#include <string.h>
+
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "perfetto/base/utils.h"
+#include "perfetto/tracing/core/trace_packet.h"
+
+#include "gtest/gtest.h"
+
+namespace perfetto {
+namespace {
+
+// Copies a chunk containing a single packet with the given payload.
+void CopySinglePacketChunk(ShardedTraceBuffer* buf,
+                           ProducerID p,
+                           WriterID w,
+                           ChunkID c,
+                           const std::string& payload) {
+  PERFETTO_CHECK(payload.size() < 128);
+  std::vector<uint8_t> data;
+  data.push_back(static_cast<uint8_t>(payload.size()));
+  data.insert(data.end(), payload.begin(), payload.end());
+  buf->CopyChunkUntrusted(p, /*uid=*/0, w, c, /*num_fragments=*/1,
+                          /*chunk_flags=*/0, /*chunk_complete=*/true,
+                          data.data(), data.size());
+}
+
+std::vector<std::string> ReadAll(ShardedTraceBuffer* buf) {
+  std::vector<std::string> payloads;
+  buf->BeginRead();
+  for (;;) {
+    TracePacket packet;
+    TraceBuffer::PacketSequenceProperties seq_props{};
+    if (!buf->ReadNextTracePacket(&packet, &seq_props))
+      break;
+    std::string payload;
+    for (const Slice& slice : packet.slices())
+      payload.append(reinterpret_cast<const char*>(slice.start), slice.size);
+    payloads.push_back(payload);
+  }
+  return payloads;
+}
+
+TEST(ShardedTraceBufferTest, SingleShard) {
+  auto buf = ShardedTraceBuffer::Create(4096 * 4);
+  ASSERT_TRUE(buf);
+  EXPECT_EQ(1u, buf->num_shards());
+  EXPECT_EQ(4096u * 4, buf->size());
+  EXPECT_EQ(4096u * 4, buf->shard(0)->size());
+
+  CopySinglePacketChunk(buf.get(), 1, 1, 0, "p1");
+  CopySinglePacketChunk(buf.get(), 2, 1, 0, "p2");
+  std::vector<std::string> payloads = ReadAll(buf.get());
+  EXPECT_EQ(std::set<std::string>({"p1", "p2"}),
+            std::set<std::string>(payloads.begin(), payloads.end()));
+  EXPECT_EQ(2u, buf->stats().chunks_written());
+}
+
+TEST(ShardedTraceBufferTest, ShardSizes) {
+  // Each shard gets the full size of the buffer.
+  auto buf = ShardedTraceBuffer::Create(base::kPageSize * 5,
+                                        TraceBuffer::kOverwrite, 2);
+  ASSERT_TRUE(buf);
+  ASSERT_EQ(2u, buf->num_shards());
+  EXPECT_EQ(base::kPageSize * 5, buf->shard(0)->size());
+  EXPECT_EQ(base::kPageSize * 5, buf->shard(1)->size());
+  EXPECT_EQ(base::kPageSize * 10, buf->size());
+  EXPECT_EQ(base::kPageSize * 10, buf->stats().buffer_size());
+}
+
+TEST(ShardedTraceBufferTest, RoutingAndMergedRead) {
+  auto buf = ShardedTraceBuffer::Create(base::kPageSize * 4,
+                                        TraceBuffer::kOverwrite, 4);
+  ASSERT_TRUE(buf);
+  ASSERT_EQ(4u, buf->num_shards());
+
+  std::set<std::string> expected;
+  std::vector<uint64_t> chunks_per_shard(buf->num_shards());
+  for (ProducerID p = 1; p <= 8; p++) {
+    for (WriterID w = 1; w <= 2; w++) {
+      for (ChunkID c = 0; c < 3; c++) {
+        std::string payload = "p" + std::to_string(p) + "w" +
+                              std::to_string(w) + "c" + std::to_string(c);
+        CopySinglePacketChunk(buf.get(), p, w, c, payload);
+        chunks_per_shard[buf->GetShardForSequence(p, w)]++;
+        expected.insert(payload);
+      }
+    }
+  }
+
+  // All the chunks of a sequence land in the shard of that sequence.
+  for (size_t i = 0; i < buf->num_shards(); i++)
+    EXPECT_EQ(chunks_per_shard[i], buf->shard(i)->stats().chunks_written());
+  EXPECT_EQ(48u, buf->stats().chunks_written());
+
+  std::vector<std::string> payloads = ReadAll(buf.get());
+  EXPECT_EQ(expected.size(), payloads.size());
+  EXPECT_EQ(expected, std::set<std::string>(payloads.begin(), payloads.end()));
+  EXPECT_EQ(48u, buf->stats().chunks_read());
+
+  // A second read pass returns nothing.
+  EXPECT_TRUE(ReadAll(buf.get()).empty());
+}
+
+TEST(ShardedTraceBufferTest, WritersOfOneProducerUseAllShards) {
+  static constexpr size_t kNumShards = 4;
+  auto buf = ShardedTraceBuffer::Create(base::kPageSize,
+                                        TraceBuffer::kOverwrite, kNumShards);
+  ASSERT_TRUE(buf);
+
+  // E.g. the per-CPU ftrace writers of traced_probes.
+  std::set<size_t> shards;
+  for (WriterID w = 1; w <= 8; w++)
+    shards.insert(buf->GetShardForSequence(1, w));
+  EXPECT_EQ(kNumShards, shards.size());
+}
+
+TEST(ShardedTraceBufferTest, ShardingKeepsTheHistoryOfASequence) {
+  // A single sequence fills up the buffer. Sharding must not make it wrap
+  // any sooner than it would in an unsharded buffer of the same size.
+  static constexpr ChunkID kNumChunks = 1000;
+  auto unsharded = ShardedTraceBuffer::Create(base::kPageSize * 4);
+  auto sharded = ShardedTraceBuffer::Create(base::kPageSize * 4,
+                                            TraceBuffer::kOverwrite, 4);
+  ASSERT_TRUE(unsharded && sharded);
+  for (ChunkID c = 0; c < kNumChunks; c++) {
+    std::string payload = "c" + std::to_string(c);
+    CopySinglePacketChunk(unsharded.get(), 1, 1, c, payload);
+    CopySinglePacketChunk(sharded.get(), 1, 1, c, payload);
+  }
+  std::vector<std::string> expected = ReadAll(unsharded.get());
+  ASSERT_GT(expected.size(), 0u);
+  ASSERT_LT(expected.size(), kNumChunks);
+  EXPECT_EQ(expected, ReadAll(sharded.get()));
+}
+
+TEST(ShardedTraceBufferTest, CloneReadOnly) {
+  auto buf = ShardedTraceBuffer::Create(base::kPageSize * 4,
+                                        TraceBuffer::kOverwrite, 2);
+  ASSERT_TRUE(buf);
+  CopySinglePacketChunk(buf.get(), 1, 1, 0, "p1");
+  CopySinglePacketChunk(buf.get(), 2, 1, 0, "p2");
+
+  auto clone = buf->CloneReadOnly();
+  ASSERT_TRUE(clone);
+  ASSERT_EQ(2u, clone->num_shards());
+  EXPECT_EQ(buf->size(), clone->size());
+  CopySinglePacketChunk(buf.get(), 1, 1, 1, "p3");
+
+  std::vector<std::string> payloads = ReadAll(clone.get());
+  EXPECT_EQ(std::set<std::string>({"p1", "p2"}),
+            std::set<std::string>(payloads.begin(), payloads.end()));
+  payloads = ReadAll(buf.get());
+  EXPECT_EQ(std::set<std::string>({"p1", "p2", "p3"}),
+            std::set<std::string>(payloads.begin(), payloads.end()));
+}
+
+TEST(ShardedTraceBufferTest, ConcurrentWritesToDifferentShards) {
+  static constexpr size_t kNumShards = 4;
+  static constexpr ChunkID kNumChunks = 50;
+  auto buf = ShardedTraceBuffer::Create(base::kPageSize * 16,
+                                        TraceBuffer::kOverwrite, kNumShards);
+  ASSERT_TRUE(buf);
+  ASSERT_EQ(kNumShards, buf->num_shards());
+
+  // Pick one writer per shard, so each thread owns a distinct shard.
+  std::vector<WriterID> writer_for_shard(kNumShards);
+  for (WriterID w = 1; w < 64; w++) {
+    size_t shard = buf->GetShardForSequence(1, w);
+    if (!writer_for_shard[shard])
+      writer_for_shard[shard] = w;
+  }
+  for (WriterID w : writer_for_shard)
+    ASSERT_NE(0u, w);
+
+  std::vector<std::thread> threads;
+  for (WriterID w : writer_for_shard) {
+    threads.emplace_back([&buf, w] {
+      for (ChunkID c = 0; c < kNumChunks; c++) {
+        CopySinglePacketChunk(buf.get(), 1, w, c,
+                              "w" + std::to_string(w) + "c" +
+                                  std::to_string(c));
+      }
+    });
+  }
+  for (auto& thread : threads)
+    thread.join();
+
+  std::vector<std::string> payloads = ReadAll(buf.get());
+  EXPECT_EQ(kNumShards * kNumChunks, payloads.size());
+  EXPECT_EQ(kNumShards * kNumChunks, buf->stats().chunks_written());
+}
+
+}  // namespace
+}  // namespace perfetto
@@ -0,0 +1,253 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <pthread.h>
+#include <time.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+
+#include "perfetto/base/logging.h"
+#include "perfetto/base/paged_memory.h"
+#include "perfetto/base/unix_task_runner.h"
+#include "perfetto/tracing/core/commit_data_request.h"
+#include "perfetto/tracing/core/shared_memory_abi.h"
+#include "perfetto/tracing/core/trace_writer.h"
+#include "perfetto/tracing/core/tracing_service.h"
+#include "src/tracing/core/shared_memory_arbiter_impl.h"
+
+#include "perfetto/common/commit_data_request.pb.h"
+#include "perfetto/trace/test_event.pbzero.h"
+#include "perfetto/trace/trace_packet.pbzero.h"
+
+// Measures how many CommitData() IPCs a producer sends, and the CPU time
+// spent handling them, when N writer threads complete chunks at a steady rate,
+// with and without batching (SetBatchCommitsDuration()).
+// Arguments: {batch_commits_duration_ms, number of writer threads}.
+// Counters:
+// - commits_per_s: CommitData() calls per second.
+// - chunks_per_commit: chunks moved by each call. The packets span several
+//   chunks, so some calls only carry the patches for the previous chunk.
+// - commit_thread_cpu: CPU time of the IPC thread of the producer, which
+//   sends the requests, as a fraction of the wall time. Each request is
+//   serialized as it would be for the IPC and its chunks are copied and freed
+//   as the service would do, so this also stands for the service side cost.
+
+namespace perfetto {
+namespace {
+
+constexpr size_t kPageSize = 4096;
+constexpr size_t kShmSize = 256 * 1024;  // TracingServiceImpl::kDefaultShmSize
+constexpr BufferID kBufId = 1;
+
+// Each writer writes a packet of kPacketSize bytes every kPacketIntervalUs,
+// i.e. completes a 4 KB chunk about every millisecond.
+constexpr size_t kPacketSize = 1000;
+constexpr int64_t kPacketIntervalUs = 250;
+constexpr int64_t kDurationMs = 500;
+
+// Handles the CommitData() requests as the service would: copies the chunks
+// out of the shared memory buffer and frees them. Runs on the IPC thread.
+class CountingProducerEndpoint : public TracingService::ProducerEndpoint {
+ public:
+  void set_shmem_abi(SharedMemoryABI* abi) { abi_ = abi; }
+
+  void CommitData(const CommitDataRequest& req,
+                  CommitDataCallback callback) override {
+    protos::CommitDataRequest proto;
+    req.ToProto(&proto);
+    proto.SerializeToString(&serialized_);
+    for (const auto& ctm : req.chunks_to_move()) {
+      auto chunk = abi_->TryAcquireChunkForReading(ctm.page(), ctm.chunk());
+      if (!chunk.is_valid())
+        continue;
+      memcpy(copy_, chunk.begin(), chunk.size());
+      abi_->ReleaseChunkAsFree(std::move(chunk));
+    }
+    num_commits.fetch_add(1, std::memory_order_relaxed);
+    num_chunks.fetch_add(static_cast<uint64_t>(req.chunks_to_move_size()),
+                         std::memory_order_relaxed);
+    if (callback)
+      callback();
+  }
+
+  void RegisterDataSource(const DataSourceDescriptor&) override {}
+  void UnregisterDataSource(const std::string&) override {}
+  void RegisterTraceWriter(uint32_t, uint32_t) override {}
+  void UnregisterTraceWriter(uint32_t) override {}
+  void NotifyFlushComplete(FlushRequestID) override {}
+  void NotifyDataSourceStopped(DataSourceInstanceID) override {}
+  SharedMemory* shared_memory() const override { return nullptr; }
+  size_t shared_buffer_page_size_kb() const override { return 0; }
+  uint32_t batch_commits_duration_ms() const override { return 0; }
+  std::unique_ptr<TraceWriter> CreateTraceWriter(BufferID) override {
+    return nullptr;
+  }
+
+  std::atomic<uint64_t> num_commits{0};
+  std::atomic<uint64_t> num_chunks{0};
+
+ private:
+  SharedMemoryABI* abi_ = nullptr;
+  std::string serialized_;
+  uint8_t copy_[kPageSize];
+};
+
+// Runs a UnixTaskRunner, which plays the role of the IPC thread of the
+// producer, on its own thread.
+class IpcThread {
+ public:
+  IpcThread() {
+    thread_ = std::thread([this] {
+      base::UnixTaskRunner task_runner;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        task_runner_ = &task_runner;
+      }
+      cv_.notify_one();
+      task_runner.Run();
+    });
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this] { return task_runner_ != nullptr; });
+  }
+
+  ~IpcThread() {
+    base::UnixTaskRunner* task_runner = task_runner_;
+    task_runner->PostTask([task_runner] { task_runner->Quit(); });
+    thread_.join();
+  }
+
+  base::TaskRunner* task_runner() { return task_runner_; }
+
+  // Returns the CPU time consumed so far by the thread, in nanoseconds.
+  int64_t GetCpuTimeNs() {
+    clockid_t clock_id;
+    PERFETTO_CHECK(pthread_getcpuclockid(thread_.native_handle(), &clock_id) ==
+                   0);
+    struct timespec ts = {};
+    PERFETTO_CHECK(clock_gettime(clock_id, &ts) == 0);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+  }
+
+  // Runs |task| on the thread and waits for it.
+  void RunAndWait(std::function<void()> task) {
+    bool done = false;
+    task_runner_->PostTask([this, &task, &done] {
+      task();
+      std::lock_guard<std::mutex> lock(mutex_);
+      done = true;
+      cv_.notify_one();
+    });
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [&done] { return done; });
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  base::UnixTaskRunner* task_runner_ = nullptr;
+  std::thread thread_;
+};
+
+void WriterMain(TraceWriter* writer,
+                std::chrono::steady_clock::time_point deadline) {
+  const std::string payload(kPacketSize, 'x');
+  auto next_packet = std::chrono::steady_clock::now();
+  while (next_packet < deadline) {
+    writer->NewTracePacket()->set_for_testing()->set_str(payload.data(),
+                                                       payload.size());
+    next_packet += std::chrono::microseconds(kPacketIntervalUs);
+    std::this_thread::sleep_until(next_packet);
+  }
+}
+
+void BM_SharedMemoryArbiter_CommitBatching(benchmark::State& state) {
+  const uint32_t batch_commits_duration_ms =
+      static_cast<uint32_t>(state.range(0));
+  const size_t num_writers = static_cast<size_t>(state.range(1));
+  uint64_t num_commits = 0;
+  uint64_t num_chunks = 0;
+  int64_t commit_thread_cpu_ns = 0;
+  int64_t wall_time_ns = 0;
+
+  while (state.KeepRunning()) {
+    base::PagedMemory shm = base::PagedMemory::Allocate(kShmSize);
+    CountingProducerEndpoint endpoint;
+    IpcThread ipc_thread;
+    std::unique_ptr<SharedMemoryArbiterImpl> arbiter;
+    ipc_thread.RunAndWait([&] {
+      arbiter.reset(new SharedMemoryArbiterImpl(shm.Get(), kShmSize, kPageSize,
+                                                &endpoint,
+                                                ipc_thread.task_runner()));
+      arbiter->SetBatchCommitsDuration(batch_commits_duration_ms);
+      endpoint.set_shmem_abi(arbiter->shmem_abi_for_testing());
+    });
+
+    std::vector<std::unique_ptr<TraceWriter>> writers;
+    for (size_t i = 0; i < num_writers; i++)
+      writers.emplace_back(arbiter->CreateTraceWriter(kBufId));
+
+    const auto start = std::chrono::steady_clock::now();
+    const int64_t start_cpu_ns = ipc_thread.GetCpuTimeNs();
+    const auto deadline = start + std::chrono::milliseconds(kDurationMs);
+    std::vector<std::thread> threads;
+    for (auto& writer : writers)
+      threads.emplace_back(WriterMain, writer.get(), deadline);
+    for (auto& thread : threads)
+      thread.join();
+
+    num_commits += endpoint.num_commits.load();
+    num_chunks += endpoint.num_chunks.load();
+    commit_thread_cpu_ns += ipc_thread.GetCpuTimeNs() - start_cpu_ns;
+    wall_time_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+
+    writers.clear();
+    ipc_thread.RunAndWait([&arbiter] { arbiter.reset(); });
+  }
+
+  const double wall_time_s = static_cast<double>(wall_time_ns) / 1e9;
+  state.counters["commits_per_s"] =
+      benchmark::Counter(static_cast<double>(num_commits) / wall_time_s);
+  state.counters["chunks_per_commit"] = benchmark::Counter(
+      static_cast<double>(num_chunks) / static_cast<double>(num_commits));
+  state.counters["commit_thread_cpu"] = benchmark::Counter(
+      static_cast<double>(commit_thread_cpu_ns) /
+      static_cast<double>(wall_time_ns));
+}
+
+}  // namespace
+
+BENCHMARK(BM_SharedMemoryArbiter_CommitBatching)
+    ->Args({0, 1})
+    ->Args({10, 1})
+    ->Args({0, 8})
+    ->Args({10, 8})
+    ->Args({100, 8})
+    ->Iterations(2)
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+
+}  // namespace perfetto
@@ -157,6 +157,7 @@ void SharedMemoryArbiterImpl::UpdateCommitDataRequest(Chunk chunk,
   // Note: chunk will be invalid if the call came from SendPatches().
   bool should_post_callback = false;
   bool should_commit_synchronously = false;
+  uint32_t commit_delay_ms = 0;
   base::WeakPtr<SharedMemoryArbiterImpl> weak_this;
   {
     std::lock_guard<std::mutex> scoped_lock(lock_);
@@ -165,6 +166,8 @@ void SharedMemoryArbiterImpl::UpdateCommitDataRequest(Chunk chunk,
       commit_data_req_.reset(new CommitDataRequest());
       weak_this = weak_ptr_factory_.GetWeakPtr();
       should_post_callback = true;
+      commit_delay_ms = batch_commits_duration_ms_;
+      immediate_commit_posted_ = commit_delay_ms == 0;
     }
 
     // If a valid chunk is specified, return it and attach it to the request.
@@ -192,10 +195,19 @@ void SharedMemoryArbiterImpl::UpdateCommitDataRequest(Chunk chunk,
       // to commit synchronously on a different thread. Attempting to flush
       // synchronously on another thread will lead to subtle bugs caused by
       // out-of-order commit requests (crbug.com/919187#c28).
-      if (task_runner_->RunsTasksOnCurrentThread() &&
-          bytes_pending_commit_ >= shmem_abi_.size() / 2) {
-        should_commit_synchronously = true;
-        should_post_callback = false;
+      //
+      // On other threads, if commits are being batched, post an immediate
+      // commit rather than waiting for the delayed one.
+      if (bytes_pending_commit_ >= shmem_abi_.size() / 2) {
+        if (task_runner_->RunsTasksOnCurrentThread()) {
+          should_commit_synchronously = true;
+          should_post_callback = false;
+        } else if (!immediate_commit_posted_) {
+          weak_this = weak_ptr_factory_.GetWeakPtr();
+          should_post_callback = true;
+          commit_delay_ms = 0;
+          immediate_commit_posted_ = true;
+        }
       }
     }
 
@@ -229,11 +241,17 @@ void SharedMemoryArbiterImpl::UpdateCommitDataRequest(Chunk chunk,
   }  // scoped_lock(lock_)
 
   if (should_post_callback) {
-    PERFETTO_DCHECK(weak_this);
-    task_runner_->PostTask([weak_this] {
+    // Don't DCHECK(weak_this) here: WeakPtr can be dereferenced only on the
+    // |task_runner_| thread, while chunks can be returned from any thread.
+    auto commit_task = [weak_this] {
       if (weak_this)
         weak_this->FlushPendingCommitDataRequests();
-    });
+    };
+    if (commit_delay_ms) {
+      task_runner_->PostDelayedTask(commit_task, commit_delay_ms);
+    } else {
+      task_runner_->PostTask(commit_task);
+    }
   }
 
   if (should_commit_synchronously)
@@ -266,6 +284,7 @@ void SharedMemoryArbiterImpl::FlushPendingCommitDataRequests(
     std::lock_guard<std::mutex> scoped_lock(lock_);
     req = std::move(commit_data_req_);
     bytes_pending_commit_ = 0;
+    immediate_commit_posted_ = false;
   }
 
   // |req| could be a nullptr if |commit_data_req_| became a nullptr. For
@@ -335,7 +354,8 @@ void SharedMemoryArbiterImpl::NotifyFlushComplete(FlushRequestID req_id) {
   {
     std::lock_guard<std::mutex> scoped_lock(lock_);
     // If a commit_data_req_ exists it means that somebody else already posted a
-    // FlushPendingCommitDataRequests() task.
+    // FlushPendingCommitDataRequests() task. That might be a delayed one though
+    // if commits are being batched, flushes must not wait for it.
     if (!commit_data_req_) {
       commit_data_req_.reset(new CommitDataRequest());
       should_post_commit_task = true;
@@ -343,7 +363,9 @@ void SharedMemoryArbiterImpl::NotifyFlushComplete(FlushRequestID req_id) {
       // If there is another request queued and that also contains is a reply
       // to a flush request, reply with the highest id.
       req_id = std::max(req_id, commit_data_req_->flush_request_id());
+      should_post_commit_task = !immediate_commit_posted_;
     }
+    immediate_commit_posted_ = true;
     commit_data_req_->set_flush_request_id(req_id);
   }
   if (should_post_commit_task) {
@@ -355,6 +377,12 @@ void SharedMemoryArbiterImpl::NotifyFlushComplete(FlushRequestID req_id) {
   }
 }
 
+void SharedMemoryArbiterImpl::SetBatchCommitsDuration(
+    uint32_t batch_commits_duration_ms) {
+  std::lock_guard<std::mutex> scoped_lock(lock_);
+  batch_commits_duration_ms_ = batch_commits_duration_ms;
+}
+
 void SharedMemoryArbiterImpl::ReleaseWriterID(WriterID id) {
   auto weak_this = weak_ptr_factory_.GetWeakPtr();
   task_runner_->PostTask([weak_this, id] {
@@ -110,6 +110,7 @@ class SharedMemoryArbiterImpl : public SharedMemoryArbiter {
       BufferID target_buffer) override;
 
   void NotifyFlushComplete(FlushRequestID) override;
+  void SetBatchCommitsDuration(uint32_t batch_commits_duration_ms) override;
 
  private:
   friend class TraceWriterImpl;
@@ -137,6 +138,11 @@ class SharedMemoryArbiterImpl : public SharedMemoryArbiter {
   size_t page_idx_ = 0;
   std::unique_ptr<CommitDataRequest> commit_data_req_;
   size_t bytes_pending_commit_ = 0;  // SUM(chunk.size() : commit_data_req_).
+  uint32_t batch_commits_duration_ms_ = 0;
+  // Whether a FlushPendingCommitDataRequests() task that runs as soon as
+  // possible has been posted for |commit_data_req_|. When batching commits, the
+  // task posted for a new request is a delayed one instead.
+  bool immediate_commit_posted_ = false;
   IdAllocator<WriterID> active_writer_ids_;
   // Registries whose Bind() is in progress. We destroy each registry when their
   // Bind() is complete or when the arbiter is destroyed itself.
@@ -42,6 +42,7 @@ class MockProducerEndpoint : public TracingService::ProducerEndpoint {
   void NotifyDataSourceStopped(DataSourceInstanceID) override {}
   SharedMemory* shared_memory() const override { return nullptr; }
   size_t shared_buffer_page_size_kb() const override { return 0; }
+  uint32_t batch_commits_duration_ms() const override { return 0; }
   std::unique_ptr<TraceWriter> CreateTraceWriter(BufferID) override {
     return nullptr;
   }
@@ -131,6 +132,60 @@ TEST_P(SharedMemoryArbiterImplTest, GetAndReturnChunks) {
   task_runner_->RunUntilCheckpoint("on_commit_2");
 }
 
+// With batching enabled, the completed chunks are committed in one request
+// when the batching period expires.
+TEST_P(SharedMemoryArbiterImplTest, BatchCommits) {
+  SharedMemoryArbiterImpl::set_default_layout_for_testing(
+      SharedMemoryABI::PageLayout::kPageDiv4);
+  arbiter_->SetBatchCommitsDuration(10);
+
+  auto on_commit = task_runner_->CreateCheckpoint("on_commit");
+  EXPECT_CALL(mock_producer_endpoint_, CommitData(_, _))
+      .WillOnce(Invoke([on_commit](const CommitDataRequest& req,
+                                   MockProducerEndpoint::CommitDataCallback) {
+        ASSERT_EQ(3, req.chunks_to_move_size());
+        for (size_t i = 0; i < 3; i++)
+          EXPECT_EQ(i, req.chunks_to_move()[i].chunk());
+        on_commit();
+      }));
+  PatchList ignored;
+  for (size_t i = 0; i < 3; i++) {
+    SharedMemoryABI::Chunk chunk = arbiter_->GetNewChunk({}, 0 /*size_hint*/);
+    ASSERT_TRUE(chunk.is_valid());
+    arbiter_->ReturnCompletedChunk(std::move(chunk), 1, &ignored);
+    task_runner_->RunUntilIdle();
+  }
+  task_runner_->RunUntilCheckpoint("on_commit");
+}
+
+// Flushes don't wait for the batching period.
+TEST_P(SharedMemoryArbiterImplTest, FlushWhileBatchingCommits) {
+  SharedMemoryArbiterImpl::set_default_layout_for_testing(
+      SharedMemoryABI::PageLayout::kPageDiv4);
+  arbiter_->SetBatchCommitsDuration(60 * 1000);
+
+  EXPECT_CALL(mock_producer_endpoint_, CommitData(_, _)).Times(0);
+  PatchList ignored;
+  for (size_t i = 0; i < 2; i++) {
+    SharedMemoryABI::Chunk chunk = arbiter_->GetNewChunk({}, 0 /*size_hint*/);
+    ASSERT_TRUE(chunk.is_valid());
+    arbiter_->ReturnCompletedChunk(std::move(chunk), 1, &ignored);
+  }
+  task_runner_->RunUntilIdle();
+  testing::Mock::VerifyAndClearExpectations(&mock_producer_endpoint_);
+
+  auto on_commit = task_runner_->CreateCheckpoint("on_commit");
+  EXPECT_CALL(mock_producer_endpoint_, CommitData(_, _))
+      .WillOnce(Invoke([on_commit](const CommitDataRequest& req,
+                                   MockProducerEndpoint::CommitDataCallback) {
+        EXPECT_EQ(2, req.chunks_to_move_size());
+        EXPECT_EQ(42u, req.flush_request_id());
+        on_commit();
+      }));
+  arbiter_->NotifyFlushComplete(42);
+  task_runner_->RunUntilCheckpoint("on_commit");
+}
+
 // Check that we can actually create up to kMaxWriterID TraceWriter(s).
 TEST_P(SharedMemoryArbiterImplTest, WriterIDsAllocation) {
   auto checkpoint = task_runner_->CreateCheckpoint("last_unregistered");
@@ -16,10 +16,15 @@
 
 #include "perfetto/tracing/core/startup_trace_writer.h"
 
-#include <numeric>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
 
 #include "perfetto/base/logging.h"
+#include "perfetto/base/utils.h"
 #include "perfetto/protozero/proto_utils.h"
+#include "perfetto/protozero/scattered_stream_writer.h"
 #include "perfetto/trace/trace_packet.pbzero.h"
 #include "perfetto/tracing/core/shared_memory_abi.h"
 #include "perfetto/tracing/core/startup_trace_writer_registry.h"
@@ -32,6 +37,16 @@ namespace perfetto {
 
 namespace {
 
+// Sizes of the pages of StartupTraceWriter::LocalBuffer, which grow
+// geometrically up to kMaxLocalBufferPageSize.
+constexpr size_t kInitialLocalBufferPageSize = base::kPageSize;
+constexpr size_t kMaxLocalBufferPageSize = 128 * 1024;
+
+// Set in the published size of StartupTraceWriter::LocalBuffer once the reader
+// handed the buffer over to the writer.
+constexpr size_t kHandedOverBit = static_cast<size_t>(1)
+                                  << (sizeof(size_t) * 8 - 1);
+
 SharedMemoryABI::Chunk NewChunk(SharedMemoryArbiterImpl* arbiter,
                                 WriterID writer_id,
                                 ChunkID chunk_id,
@@ -53,80 +68,167 @@ SharedMemoryABI::Chunk NewChunk(SharedMemoryArbiterImpl* arbiter,
   return arbiter->GetNewChunk(header);
 }
 
-class LocalBufferReader {
- public:
-  LocalBufferReader(protozero::ScatteredHeapBuffer* buffer)
-      : buffer_slices_(buffer->slices()), cur_slice_(buffer_slices_.begin()) {}
-
-  size_t ReadBytes(SharedMemoryABI::Chunk* target_chunk,
-                   size_t num_bytes,
-                   size_t cur_payload_size) {
-    PERFETTO_CHECK(target_chunk->payload_size() >=
-                   num_bytes + cur_payload_size);
-    uint8_t* target_ptr = target_chunk->payload_begin() + cur_payload_size;
-    size_t bytes_read = 0;
-    while (bytes_read < num_bytes) {
-      if (cur_slice_ == buffer_slices_.end())
-        return bytes_read;
-
-      auto cur_slice_range = cur_slice_->GetUsedRange();
-
-      if (cur_slice_range.size() == cur_slice_offset_) {
-        cur_slice_offset_ = 0;
-        cur_slice_++;
-        continue;
-      }
+}  // namespace
 
-      size_t read_size = std::min(num_bytes - bytes_read,
-                                  cur_slice_range.size() - cur_slice_offset_);
-      memcpy(target_ptr + bytes_read, cur_slice_range.begin + cur_slice_offset_,
-             read_size);
-      cur_slice_offset_ += read_size;
-      bytes_read += read_size;
+// Single-producer single-consumer buffer of the packets written while the
+// writer is unbound. The writer thread appends the packets, each preceded by
+// its size encoded like the SMB packet headers, and publishes them by bumping
+// |published_size_| once they are finalized. The reader (the binding thread)
+// concurrently copies out the published packets and eventually hands the
+// buffer over to the writer thread, which reads the rest itself. Neither side
+// takes locks: the pages of the buffer are never reallocated, they are chained
+// through atomic pointers and the reader frees the ones it has fully consumed,
+// which the writer doesn't touch anymore.
+class StartupTraceWriter::LocalBuffer
+    : public protozero::ScatteredStreamWriter::Delegate {
+ public:
+  LocalBuffer() : stream_writer_(this) {
+    // The first page is allocated upfront, so that the reader's cursor is set
+    // before the buffer is shared.
+    stream_writer_.Reset(AppendPage());
+    read_page_ = tail_page_;
+  }
 
-      // Should have either read all of the chunk or completed reading now.
-      PERFETTO_DCHECK(cur_slice_offset_ == cur_slice_range.size() ||
-                      bytes_read == num_bytes);
+  ~LocalBuffer() override {
+    for (Page* page = read_page_; page;) {
+      Page* next = page->next.load(std::memory_order_relaxed);
+      delete page;
+      page = next;
     }
-    return bytes_read;
   }
 
-  size_t TotalUsedSize() const {
-    size_t used_size = 0;
-    for (const auto& slice : buffer_slices_) {
-      used_size += slice.GetUsedRange().size();
-    }
-    return used_size;
+  // Writer side.
+  protozero::ScatteredStreamWriter* stream_writer() { return &stream_writer_; }
+
+  uint8_t* BeginPacket() {
+    return stream_writer_.ReserveBytes(SharedMemoryABI::kPacketHeaderSize);
   }
 
-  bool DidReadAllData() const {
-    if (cur_slice_ == buffer_slices_.end())
+  // Publishes the packet. Returns false if the reader handed the buffer over
+  // before, see TryHandOver(): the writer has to read the packet itself.
+  bool EndPacket(uint8_t* header, uint32_t packet_size) {
+    protozero::proto_utils::WriteRedundantVarInt(packet_size, header);
+    // Only the writer changes the size, the reader only sets kHandedOverBit.
+    size_t expected = last_published_size_;
+    last_published_size_ = write_position();
+    if (published_size_.compare_exchange_strong(expected, last_published_size_,
+                                                std::memory_order_acq_rel,
+                                                std::memory_order_acquire)) {
       return true;
+    }
+    published_size_.store(last_published_size_ | kHandedOverBit,
+                          std::memory_order_relaxed);
+    return false;
+  }
+
+  // Whether the reader handed the buffer over. From then on the writer is also
+  // the reader.
+  bool handed_over() const {
+    return published_size_.load(std::memory_order_acquire) & kHandedOverBit;
+  }
+
+  size_t write_position() const {
+    return tail_page_->start +
+           static_cast<size_t>(stream_writer_.write_ptr() - tail_page_->data());
+  }
+
+  // protozero::ScatteredStreamWriter::Delegate implementation.
+  protozero::ContiguousMemoryRange GetNewBuffer() override {
+    // Record how much of the current page was used, the rest of it (if any)
+    // is skipped by the reader.
+    tail_page_->used =
+        static_cast<size_t>(stream_writer_.write_ptr() - tail_page_->data());
+    return AppendPage();
+  }
+
+  // Reader side. Returns the end of the data published by the writer.
+  size_t published_size() const {
+    return published_size_.load(std::memory_order_acquire) & ~kHandedOverBit;
+  }
+
+  // Hands the buffer over to the writer, unless the writer published more data
+  // after |end|. The reader must not access the buffer after a successful
+  // hand over, and all its writes before it are visible to the writer.
+  bool TryHandOver(size_t end) {
+    return published_size_.compare_exchange_strong(
+        end, end | kHandedOverBit, std::memory_order_acq_rel);
+  }
+
+  size_t read_position() const { return read_position_; }
+
+  // Copies |size| bytes to |dst|. The caller must ensure that the bytes were
+  // published, i.e. read_position() + |size| <= published_size().
+  void Read(uint8_t* dst, size_t size) {
+    while (size > 0) {
+      size_t offset = read_position_ - read_page_->start;
+      Page* next = read_page_->next.load(std::memory_order_acquire);
+      // If the writer didn't move on to another page, all the published bytes
+      // are in this one.
+      size_t available = next ? read_page_->used - offset : size;
+      if (available == 0) {
+        delete read_page_;
+        read_page_ = next;
+        continue;
+      }
+      size_t read_size = std::min(size, available);
+      memcpy(dst, read_page_->data() + offset, read_size);
+      dst += read_size;
+      size -= read_size;
+      read_position_ += read_size;
+    }
+  }
 
-    const auto next_slice = cur_slice_ + 1;
-    return next_slice == buffer_slices_.end() &&
-           cur_slice_->GetUsedRange().size() == cur_slice_offset_;
+  uint32_t ReadPacketHeader() {
+    uint8_t header[SharedMemoryABI::kPacketHeaderSize];
+    Read(header, sizeof(header));
+    uint64_t packet_size = 0;
+    protozero::proto_utils::ParseVarInt(header, header + sizeof(header),
+                                        &packet_size);
+    return static_cast<uint32_t>(packet_size);
   }
 
  private:
-  const std::vector<protozero::ScatteredHeapBuffer::Slice>& buffer_slices_;
+  struct Page {
+    explicit Page(size_t page_size)
+        : buffer(new uint8_t[page_size]), size(page_size) {}
+    uint8_t* data() const { return buffer.get(); }
+
+    std::unique_ptr<uint8_t[]> buffer;
+    const size_t size;
+    size_t start = 0;  // Position of the page's first byte in the stream.
+    size_t used = 0;   // Only valid once |next| is set.
+    std::atomic<Page*> next{nullptr};
+  };
+
+  protozero::ContiguousMemoryRange AppendPage() {
+    Page* page = new Page(next_page_size_);
+    next_page_size_ = std::min(next_page_size_ * 2, kMaxLocalBufferPageSize);
+    if (tail_page_) {
+      page->start = tail_page_->start + tail_page_->used;
+      tail_page_->next.store(page, std::memory_order_release);
+    }
+    tail_page_ = page;
+    return {page->data(), page->data() + page->size};
+  }
 
-  // Iterator pointing to slice in |buffer_slices_| that we're currently reading
-  // from.
-  std::vector<protozero::ScatteredHeapBuffer::Slice>::const_iterator cur_slice_;
-  // Read offset in the current slice in bytes.
-  size_t cur_slice_offset_ = 0;
-};
+  // Writer side.
+  protozero::ScatteredStreamWriter stream_writer_;
+  Page* tail_page_ = nullptr;
+  size_t next_page_size_ = kInitialLocalBufferPageSize;
+  size_t last_published_size_ = 0;
 
-}  // namespace
+  // Shared. The reader sets kHandedOverBit when it hands the buffer over.
+  std::atomic<size_t> published_size_{0};
+
+  // Reader side.
+  Page* read_page_ = nullptr;
+  size_t read_position_ = 0;
+};
 
 StartupTraceWriter::StartupTraceWriter(
     std::shared_ptr<StartupTraceWriterRegistryHandle> registry_handle)
     : registry_handle_(std::move(registry_handle)),
-      memory_buffer_(new protozero::ScatteredHeapBuffer()),
-      memory_stream_writer_(
-          new protozero::ScatteredStreamWriter(memory_buffer_.get())) {
-  memory_buffer_->set_writer(memory_stream_writer_.get());
+      local_buffer_(new LocalBuffer()) {
   PERFETTO_DETACH_FROM_THREAD(writer_thread_checker_);
 }
 
@@ -137,68 +239,69 @@ StartupTraceWriter::StartupTraceWriter(
 StartupTraceWriter::~StartupTraceWriter() {
   if (registry_handle_)
     registry_handle_->OnWriterDestroyed(this);
+
+  // Switch to |trace_writer_| if the binding thread handed over.
+  if (!was_bound_ && local_buffer_->handed_over())
+    CompleteBinding();
 }
 
-bool StartupTraceWriter::BindToArbiter(SharedMemoryArbiterImpl* arbiter,
+void StartupTraceWriter::BindToArbiter(SharedMemoryArbiterImpl* arbiter,
                                        BufferID target_buffer) {
-  std::lock_guard<std::mutex> lock(lock_);
-
-  PERFETTO_DCHECK(!trace_writer_);
+  PERFETTO_DCHECK(!local_buffer_->handed_over());
 
-  // Can't bind while the writer thread is writing.
-  if (write_in_progress_)
-    return false;
-
-  // If there's a pending trace packet, it should have been completed by the
-  // writer thread before write_in_progress_ is reset.
-  if (cur_packet_) {
-    PERFETTO_DCHECK(cur_packet_->is_finalized());
-    cur_packet_.reset();
+  // The writer thread may be writing into the local buffer concurrently. The
+  // packets it publishes while the ones before are being committed are
+  // committed in the next round. The hand over succeeds once a round finds no
+  // new packet, then the writer thread commits the packet it was writing (if
+  // any) as soon as it finalizes it, see OnMessageFinalized().
+  trace_writer_ = arbiter->CreateTraceWriter(target_buffer);
+  arbiter_ = arbiter;
+  target_buffer_ = target_buffer;
+  for (;;) {
+    size_t end = local_buffer_->published_size();
+    next_chunk_id_ =
+        CommitLocalBufferChunks(arbiter, trace_writer_->writer_id(),
+                                target_buffer, next_chunk_id_, end);
+    // Any access to the members above on this thread must happen before this.
+    if (local_buffer_->TryHandOver(end))
+      return;
   }
+}
 
-  trace_writer_ = arbiter->CreateTraceWriter(target_buffer);
-  ChunkID next_chunk_id = CommitLocalBufferChunks(
-      arbiter, trace_writer_->writer_id(), target_buffer);
+void StartupTraceWriter::CompleteBinding() {
+  PERFETTO_DCHECK(!write_in_progress_);
+  next_chunk_id_ = CommitLocalBufferChunks(
+      arbiter_, trace_writer_->writer_id(), target_buffer_, next_chunk_id_,
+      local_buffer_->published_size());
 
   // The real TraceWriter should start writing at the subsequent chunk ID.
-  bool success = trace_writer_->SetFirstChunkId(next_chunk_id);
+  bool success = trace_writer_->SetFirstChunkId(next_chunk_id_);
   PERFETTO_DCHECK(success);
 
-  memory_stream_writer_.reset();
-  memory_buffer_.reset();
-
-  return true;
+  cur_packet_.reset();
+  local_buffer_.reset();
+  was_bound_ = true;
 }
 
 TraceWriter::TracePacketHandle StartupTraceWriter::NewTracePacket() {
   PERFETTO_DCHECK_THREAD(writer_thread_checker_);
 
-  // Check if we are already bound without grabbing the lock. This is an
-  // optimization to avoid any locking in the common case where the proxy was
-  // bound some time ago.
+  // Check if we are already bound without touching the atomic flag, which is
+  // the common case when the writer was bound some time ago.
   if (PERFETTO_LIKELY(was_bound_)) {
     PERFETTO_DCHECK(!cur_packet_);
     PERFETTO_DCHECK(trace_writer_);
     return trace_writer_->NewTracePacket();
   }
 
-  // Now grab the lock and safely check whether we are still unbound.
-  {
-    std::lock_guard<std::mutex> lock(lock_);
-    if (trace_writer_) {
-      PERFETTO_DCHECK(!cur_packet_);
-      // Set the |was_bound_| flag to avoid locking in future calls to
-      // NewTracePacket().
-      was_bound_ = true;
-      return trace_writer_->NewTracePacket();
-    }
-    // Not bound. Make sure it stays this way until the TracePacketHandle goes
-    // out of scope by setting |write_in_progress_|.
-    PERFETTO_DCHECK(!write_in_progress_);
-    write_in_progress_ = true;
+  if (local_buffer_->handed_over()) {
+    CompleteBinding();
+    return trace_writer_->NewTracePacket();
   }
 
   // Write to the local buffer.
+  PERFETTO_DCHECK(!write_in_progress_);
+  write_in_progress_ = true;
   if (cur_packet_) {
     // If we hit this, the caller is calling NewTracePacket() without having
     // finalized the previous packet.
@@ -206,7 +309,8 @@ TraceWriter::TracePacketHandle StartupTraceWriter::NewTracePacket() {
   } else {
     cur_packet_.reset(new protos::pbzero::TracePacket());
   }
-  cur_packet_->Reset(memory_stream_writer_.get());
+  cur_packet_header_ = local_buffer_->BeginPacket();
+  cur_packet_->Reset(local_buffer_->stream_writer());
   TraceWriter::TracePacketHandle handle(cur_packet_.get());
   // |this| outlives the packet handle.
   handle.set_finalization_listener(this);
@@ -215,9 +319,9 @@ TraceWriter::TracePacketHandle StartupTraceWriter::NewTracePacket() {
 
 void StartupTraceWriter::Flush(std::function<void()> callback) {
   PERFETTO_DCHECK_THREAD(writer_thread_checker_);
-  // It's fine to check |was_bound_| instead of acquiring the lock because
-  // |trace_writer_| will only need flushing after the first trace packet was
-  // written to it and |was_bound_| is set.
+  if (PERFETTO_UNLIKELY(!was_bound_ && local_buffer_->handed_over()))
+    CompleteBinding();
+
   if (PERFETTO_LIKELY(was_bound_)) {
     PERFETTO_DCHECK(trace_writer_);
     return trace_writer_->Flush(std::move(callback));
@@ -230,9 +334,8 @@ void StartupTraceWriter::Flush(std::function<void()> callback) {
 
 WriterID StartupTraceWriter::writer_id() const {
   PERFETTO_DCHECK_THREAD(writer_thread_checker_);
-  // We can't acquire the lock because this is a const method. So we'll only
-  // proxy to |trace_writer_| once we have written the first packet to it
-  // instead.
+  // We'll only proxy to |trace_writer_| once the writer thread completed the
+  // binding, when it starts to write to it.
   if (PERFETTO_LIKELY(was_bound_)) {
     PERFETTO_DCHECK(trace_writer_);
     return trace_writer_->writer_id();
@@ -242,9 +345,8 @@ WriterID StartupTraceWriter::writer_id() const {
 
 uint64_t StartupTraceWriter::written() const {
   PERFETTO_DCHECK_THREAD(writer_thread_checker_);
-  // We can't acquire the lock because this is a const method. So we'll only
-  // proxy to |trace_writer_| once we have written the first packet to it
-  // instead.
+  // We'll only proxy to |trace_writer_| once the writer thread completed the
+  // binding, when it starts to write to it.
   if (PERFETTO_LIKELY(was_bound_)) {
     PERFETTO_DCHECK(trace_writer_);
     return trace_writer_->written();
@@ -256,64 +358,46 @@ size_t StartupTraceWriter::used_buffer_size() {
   PERFETTO_DCHECK_THREAD(writer_thread_checker_);
   if (PERFETTO_LIKELY(was_bound_))
     return 0;
-
-  std::lock_guard<std::mutex> lock(lock_);
-  if (trace_writer_)
-    return 0;
-
-  size_t used_size = 0;
-  memory_buffer_->AdjustUsedSizeOfCurrentSlice();
-  for (const auto& slice : memory_buffer_->slices()) {
-    used_size += slice.GetUsedRange().size();
-  }
-  return used_size;
+  return local_buffer_->write_position();
 }
 
 void StartupTraceWriter::OnMessageFinalized(protozero::Message* message) {
   PERFETTO_DCHECK(cur_packet_.get() == message);
   PERFETTO_DCHECK(cur_packet_->is_finalized());
+  PERFETTO_DCHECK(write_in_progress_);
   // Finalize() is a no-op because the packet is already finalized.
   uint32_t packet_size = cur_packet_->Finalize();
-  packet_sizes_.push_back(packet_size);
 
-  // Write is complete, reset the flag to allow binding.
-  std::lock_guard<std::mutex> lock(lock_);
-  PERFETTO_DCHECK(write_in_progress_);
+  // Publish the packet to the binding thread. If it handed over already,
+  // commit the packet right away rather than on the next call on this writer,
+  // which might never come.
+  bool published = local_buffer_->EndPacket(cur_packet_header_, packet_size);
+  cur_packet_header_ = nullptr;
   write_in_progress_ = false;
+  if (!published)
+    CompleteBinding();
 }
 
 ChunkID StartupTraceWriter::CommitLocalBufferChunks(
     SharedMemoryArbiterImpl* arbiter,
     WriterID writer_id,
-    BufferID target_buffer) {
-  // TODO(eseckler): Write and commit these chunks asynchronously. This would
-  // require that the service is informed of the missing initial chunks, e.g. by
-  // committing our first chunk here before the new trace writer has a chance to
-  // commit its first chunk. Otherwise the service wouldn't know to wait for our
-  // chunks.
-
-  if (packet_sizes_.empty() || !writer_id)
-    return 0;
-
-  memory_buffer_->AdjustUsedSizeOfCurrentSlice();
-  LocalBufferReader local_buffer_reader(memory_buffer_.get());
-
-  PERFETTO_DCHECK(local_buffer_reader.TotalUsedSize() ==
-                  std::accumulate(packet_sizes_.begin(), packet_sizes_.end(),
-                                  static_cast<size_t>(0u)));
-
-  ChunkID next_chunk_id = 0;
+    BufferID target_buffer,
+    ChunkID first_chunk_id,
+    size_t end) {
+  PERFETTO_DCHECK(end <= local_buffer_->published_size());
+  if (local_buffer_->read_position() == end || !writer_id)
+    return first_chunk_id;
+
+  ChunkID next_chunk_id = first_chunk_id;
   SharedMemoryABI::Chunk cur_chunk =
       NewChunk(arbiter, writer_id, next_chunk_id++, false);
 
   size_t max_payload_size = cur_chunk.payload_size();
   size_t cur_payload_size = 0;
   uint16_t cur_num_packets = 0;
-  size_t total_num_packets = packet_sizes_.size();
   PatchList empty_patch_list;
-  for (size_t packet_idx = 0; packet_idx < total_num_packets; packet_idx++) {
-    uint32_t packet_size = packet_sizes_[packet_idx];
-    uint32_t remaining_packet_size = packet_size;
+  while (local_buffer_->read_position() < end) {
+    uint32_t remaining_packet_size = local_buffer_->ReadPacketHeader();
     ++cur_num_packets;
     do {
       uint32_t fragment_size = static_cast<uint32_t>(
@@ -326,15 +410,14 @@ ChunkID StartupTraceWriter::CommitLocalBufferChunks(
       cur_payload_size += SharedMemoryABI::kPacketHeaderSize;
 
       // Copy packet content into the chunk.
-      size_t bytes_read = local_buffer_reader.ReadBytes(
-          &cur_chunk, fragment_size, cur_payload_size);
-      PERFETTO_DCHECK(bytes_read == fragment_size);
+      local_buffer_->Read(cur_chunk.payload_begin() + cur_payload_size,
+                          fragment_size);
 
       cur_payload_size += fragment_size;
       remaining_packet_size -= fragment_size;
 
       bool last_write =
-          packet_idx == total_num_packets - 1 && remaining_packet_size == 0;
+          local_buffer_->read_position() == end && remaining_packet_size == 0;
 
       // We should return the current chunk if we've filled its payload, reached
       // the maximum number of packets, or wrote everything we wanted to.
@@ -373,8 +456,7 @@ ChunkID StartupTraceWriter::CommitLocalBufferChunks(
 
   // The last chunk should have been returned.
   PERFETTO_DCHECK(!cur_chunk.is_valid());
-  // We should have read all data from the local buffer.
-  PERFETTO_DCHECK(local_buffer_reader.DidReadAllData());
+  PERFETTO_DCHECK(local_buffer_->read_position() == end);
 
   return next_chunk_id;
 }
@@ -91,32 +91,16 @@ void StartupTraceWriterRegistry::BindToArbiter(
   }
 
   // Bind and destroy the owned writers.
-  for (const auto& writer : unbound_owned_writers) {
-    // This should succeed since nobody can write to these writers concurrently.
-    bool success = writer->BindToArbiter(arbiter_, target_buffer_);
-    PERFETTO_DCHECK(success);
-  }
+  for (const auto& writer : unbound_owned_writers)
+    writer->BindToArbiter(arbiter_, target_buffer_);
   unbound_owned_writers.clear();
 
-  TryBindWriters();
-}
-
-void StartupTraceWriterRegistry::TryBindWriters() {
+  // Binding doesn't wait for the writer threads, see
+  // StartupTraceWriter::BindToArbiter().
   std::lock_guard<std::mutex> lock(lock_);
-  for (auto it = unbound_writers_.begin(); it != unbound_writers_.end();) {
-    if ((*it)->BindToArbiter(arbiter_, target_buffer_)) {
-      it = unbound_writers_.erase(it);
-    } else {
-      it++;
-    }
-  }
-  if (!unbound_writers_.empty()) {
-    auto weak_this = weak_ptr_factory_->GetWeakPtr();
-    task_runner_->PostTask([weak_this] {
-      if (weak_this)
-        weak_this->TryBindWriters();
-    });
-  }
+  for (StartupTraceWriter* writer : unbound_writers_)
+    writer->BindToArbiter(arbiter_, target_buffer_);
+  unbound_writers_.clear();
   OnUnboundWritersRemovedLocked();
 }
 
@@ -16,6 +16,9 @@
 
 #include "perfetto/tracing/core/startup_trace_writer.h"
 
+#include <atomic>
+#include <thread>
+
 #include "gtest/gtest.h"
 #include "perfetto/tracing/core/startup_trace_writer_registry.h"
 #include "perfetto/tracing/core/trace_packet.h"
@@ -57,9 +60,9 @@ class StartupTraceWriterTest : public AlignedBufferTest {
         new StartupTraceWriter(registry));
   }
 
-  bool BindWriter(StartupTraceWriter* writer) {
+  void BindWriter(StartupTraceWriter* writer) {
     const BufferID kBufId = 42;
-    return writer->BindToArbiter(arbiter_.get(), kBufId);
+    writer->BindToArbiter(arbiter_.get(), kBufId);
   }
 
   void WritePackets(StartupTraceWriter* writer, size_t packet_count) {
@@ -185,7 +188,7 @@ TEST_P(StartupTraceWriterTest, CreateUnboundAndBind) {
   auto writer = CreateUnboundWriter();
 
   // Bind writer right away without having written any data before.
-  EXPECT_TRUE(BindWriter(writer.get()));
+  BindWriter(writer.get());
 
   const size_t kNumPackets = 32;
   WritePackets(writer.get(), kNumPackets);
@@ -229,7 +232,7 @@ TEST_P(StartupTraceWriterTest, WriteWhileUnboundAndBind) {
 
   // Binding the writer should cause the previously written packets to be
   // written to the SMB and committed.
-  EXPECT_TRUE(BindWriter(writer.get()));
+  BindWriter(writer.get());
 
   VerifyPackets(kNumPackets);
 
@@ -255,7 +258,7 @@ TEST_P(StartupTraceWriterTest, WriteMultipleChunksWhileUnboundAndBind) {
 
   // Binding the writer should cause the previously written packets to be
   // written to the SMB and committed.
-  EXPECT_TRUE(BindWriter(writer.get()));
+  BindWriter(writer.get());
 
   VerifyPackets(kNumPackets + 1);
 
@@ -268,7 +271,7 @@ TEST_P(StartupTraceWriterTest, WriteMultipleChunksWhileUnboundAndBind) {
   VerifyPackets(kNumAdditionalPackets);
 }
 
-TEST_P(StartupTraceWriterTest, BindingWhileWritingFails) {
+TEST_P(StartupTraceWriterTest, BindingWhileWritingSucceeds) {
   auto writer = CreateUnboundWriter();
 
   {
@@ -276,13 +279,40 @@ TEST_P(StartupTraceWriterTest, BindingWhileWritingFails) {
     auto packet = writer->NewTracePacket();
     packet->set_for_testing()->set_str(kPacketPayload);
 
-    // Binding while writing should fail.
-    EXPECT_FALSE(BindWriter(writer.get()));
+    // Binding while writing should succeed, but the open packet isn't
+    // committed yet.
+    BindWriter(writer.get());
+    VerifyPackets(0);
   }
 
-  // Packet was completed, so binding should work now and emit the packet.
-  EXPECT_TRUE(BindWriter(writer.get()));
+  // The packet completed after binding is committed right away, even if the
+  // writer isn't used anymore.
   VerifyPackets(1);
+  writer.reset();
+  VerifyPackets(0);
+}
+
+TEST_P(StartupTraceWriterTest, BindWhileWritingOnAnotherThread) {
+  std::unique_ptr<StartupTraceWriter> writer = CreateUnboundWriter();
+
+  // Write packets on another thread and bind the writer concurrently, after a
+  // part of the packets were written.
+  const size_t kNumPackets = 200;
+  std::atomic<size_t> num_packets_written{0};
+  std::thread writer_thread([&writer, &num_packets_written, this] {
+    for (size_t i = 0; i < kNumPackets; i++) {
+      WritePackets(writer.get(), 1);
+      num_packets_written.store(i + 1, std::memory_order_relaxed);
+    }
+  });
+  while (num_packets_written.load(std::memory_order_relaxed) < kNumPackets / 2)
+    std::this_thread::yield();
+  BindWriter(writer.get());
+  writer_thread.join();
+
+  // Commits the packets that were completed after binding, if any.
+  writer.reset();
+  VerifyPackets(kNumPackets);
 }
 
 TEST_P(StartupTraceWriterTest, CreateAndBindViaRegistry) {
@@ -302,13 +332,13 @@ TEST_P(StartupTraceWriterTest, CreateAndBindViaRegistry) {
     // Begin a write by opening a TracePacket on |writer1|.
     auto packet = writer1->NewTracePacket();
 
-    // Binding |writer1| writing should fail, but |writer2| should be bound.
+    // Both writers should be bound, also |writer1| while it is being written.
     const BufferID kBufId = 42;
     arbiter_->BindStartupTraceWriterRegistry(std::move(registry), kBufId);
-    EXPECT_EQ(1u, GetUnboundWriterCount(*arbiter_));
+    EXPECT_EQ(0u, GetUnboundWriterCount(*arbiter_));
   }
 
-  // Wait for |writer1| to be bound and the registry to be deleted.
+  // Wait for the registry to be deleted.
   auto checkpoint_name = "all_bound";
   auto all_bound = task_runner_->CreateCheckpoint(checkpoint_name);
   std::function<void()> task;
@@ -16,6 +16,8 @@
 
 #include "src/tracing/core/trace_buffer.h"
 
+#include <algorithm>
+#include <iterator>
 #include <limits>
 
 #include "perfetto/base/logging.h"
@@ -94,9 +96,8 @@ bool TraceBuffer::Initialize(size_t size) {
   stats_.set_buffer_size(size);
   max_chunk_size_ = std::min(size, ChunkRecord::kMaxSize);
   wptr_ = begin();
-  index_.clear();
-  last_chunk_id_written_.clear();
-  read_iter_ = GetReadIterForSequence(index_.end());
+  sequences_.clear();
+  read_iter_ = GetReadIterForSequence(sequences_.end());
   return true;
 }
 
@@ -112,6 +113,8 @@ void TraceBuffer::CopyChunkUntrusted(ProducerID producer_id_trusted,
                                      bool chunk_complete,
                                      const uint8_t* src,
                                      size_t size) {
+  PERFETTO_DCHECK(!read_only_);
+
   // |record_size| = |size| + sizeof(ChunkRecord), rounded up to avoid to end
   // up in a fragmented state where size_to_end() < sizeof(ChunkRecord).
   const size_t record_size =
@@ -151,9 +154,8 @@ void TraceBuffer::CopyChunkUntrusted(ProducerID producer_id_trusted,
   // before receiving commit requests for them from the producer. Note that the
   // service may scrape and thus override chunks in arbitrary order since the
   // chunks aren't ordered in the SMB.
-  const auto it = index_.find(key);
-  if (PERFETTO_UNLIKELY(it != index_.end())) {
-    ChunkMeta* record_meta = &it->second;
+  ChunkMeta* record_meta = FindChunkMeta(key);
+  if (PERFETTO_UNLIKELY(record_meta)) {
     ChunkRecord* prev = record_meta->chunk_record;
 
     // Verify that the old chunk's metadata corresponds to the new one.
@@ -178,9 +180,8 @@ void TraceBuffer::CopyChunkUntrusted(ProducerID producer_id_trusted,
     static_assert(std::numeric_limits<ChunkID>::max() == kMaxChunkID,
                   "ChunkID wraps");
     subsequent_key.chunk_id++;
-    const auto subsequent_it = index_.find(subsequent_key);
-    if (subsequent_it != index_.end() &&
-        subsequent_it->second.num_fragments_read > 0) {
+    const ChunkMeta* subsequent_meta = FindChunkMeta(subsequent_key);
+    if (subsequent_meta && subsequent_meta->num_fragments_read > 0) {
       stats_.set_abi_violations(stats_.abi_violations() + 1);
       PERFETTO_DCHECK(suppress_sanity_dchecks_for_testing_);
       return;
@@ -268,10 +269,19 @@ void TraceBuffer::CopyChunkUntrusted(ProducerID producer_id_trusted,
   // Now first insert the new chunk. At the end, if necessary, add the padding.
   stats_.set_chunks_written(stats_.chunks_written() + 1);
   stats_.set_bytes_written(stats_.bytes_written() + record_size);
-  auto it_and_inserted = index_.emplace(
-      key, ChunkMeta(GetChunkRecordAt(wptr_), num_fragments, chunk_complete,
-                     chunk_flags, producer_uid_trusted));
-  PERFETTO_DCHECK(it_and_inserted.second);
+  SequenceIndex& seq =
+      sequences_[std::make_pair(producer_id_trusted, writer_id)];
+  ChunkMeta chunk_meta(GetChunkRecordAt(wptr_), chunk_id, num_fragments,
+                       chunk_complete, chunk_flags, producer_uid_trusted);
+  if (PERFETTO_LIKELY(seq.chunks.empty() ||
+                      seq.chunks.back().chunk_id < chunk_id)) {
+    // Fast path: chunks of a sequence are normally committed in order.
+    seq.chunks.push_back(chunk_meta);
+  } else {
+    auto pos = LowerBound(&seq.chunks, chunk_id);
+    PERFETTO_DCHECK(pos == seq.chunks.end() || pos->chunk_id != chunk_id);
+    seq.chunks.insert(pos, chunk_meta);
+  }
   TRACE_BUFFER_DLOG("  copying @ [%lu - %lu] %zu", wptr_ - begin(),
                     uintptr_t(wptr_ - begin()) + record_size, record_size);
   WriteChunkRecord(wptr_, record, src, size);
@@ -296,8 +306,7 @@ void TraceBuffer::CopyChunkUntrusted(ProducerID producer_id_trusted,
   // last_chunk_id shouldn't be updated even though it's larger (e.g. |chunk_id|
   // = kMaxChunkId and |last_chunk_id| = 1; chunk_id - last_chunk_id =
   // kMaxChunkId - 1).
-  auto producer_and_writer_id = std::make_pair(producer_id_trusted, writer_id);
-  ChunkID& last_chunk_id = last_chunk_id_written_[producer_and_writer_id];
+  ChunkID& last_chunk_id = seq.last_chunk_id_written;
   static_assert(std::numeric_limits<ChunkID>::max() == kMaxChunkID,
                 "This code assumes that ChunkID wraps at kMaxChunkID");
   if (chunk_id - last_chunk_id < kMaxChunkID / 2) {
@@ -322,7 +331,7 @@ ssize_t TraceBuffer::DeleteNextChunksFor(size_t bytes_to_clear) {
   TRACE_BUFFER_DLOG("Delete [%zu %zu]", wptr_ - begin(), search_end - begin());
   DcheckIsAlignedAndWithinBounds(wptr_);
   PERFETTO_DCHECK(search_end <= end());
-  std::vector<ChunkMap::iterator> index_delete;
+  std::vector<std::pair<ChunkArray*, ChunkID>> index_delete;
   uint64_t chunks_overwritten = stats_.chunks_overwritten();
   uint64_t bytes_overwritten = stats_.bytes_overwritten();
   uint64_t padding_bytes_cleared = stats_.padding_bytes_cleared();
@@ -348,17 +357,23 @@ ssize_t TraceBuffer::DeleteNextChunksFor(size_t bytes_to_clear) {
     // records are not part of the index).
     if (PERFETTO_LIKELY(!next_chunk.is_padding)) {
       ChunkMeta::Key key(next_chunk);
-      auto it = index_.find(key);
+      auto seq_it =
+          sequences_.find(std::make_pair(key.producer_id, key.writer_id));
+      ChunkArray* chunks =
+          seq_it == sequences_.end() ? nullptr : &seq_it->second.chunks;
+      auto it =
+          chunks ? LowerBound(chunks, key.chunk_id) : ChunkArray::iterator();
       bool will_remove = false;
-      if (PERFETTO_LIKELY(it != index_.end())) {
-        const ChunkMeta& meta = it->second;
+      if (PERFETTO_LIKELY(chunks && it != chunks->end() &&
+                          it->chunk_id == key.chunk_id)) {
+        const ChunkMeta& meta = *it;
         if (PERFETTO_UNLIKELY(meta.num_fragments_read < meta.num_fragments)) {
           if (overwrite_policy_ == kDiscard)
             return -1;
           chunks_overwritten++;
           bytes_overwritten += next_chunk.size;
         }
-        index_delete.push_back(it);
+        index_delete.emplace_back(chunks, key.chunk_id);
         will_remove = true;
       }
       TRACE_BUFFER_DLOG("  del index {%" PRIu32 ",%" PRIu32
@@ -380,9 +395,19 @@ ssize_t TraceBuffer::DeleteNextChunksFor(size_t bytes_to_clear) {
     PERFETTO_CHECK(next_chunk_ptr <= end());
   }
 
-  // Remove from the index.
-  for (auto it : index_delete) {
-    index_.erase(it);
+  // Remove from the index. This is deferred to here because the kDiscard case
+  // above must leave the index untouched. The chunks being overwritten are
+  // normally the oldest ones of their sequence, hence at the front.
+  for (const auto& chunks_and_id : index_delete) {
+    ChunkArray* chunks = chunks_and_id.first;
+    if (PERFETTO_LIKELY(chunks->front().chunk_id == chunks_and_id.second)) {
+      chunks->pop_front();
+      continue;
+    }
+    auto it = LowerBound(chunks, chunks_and_id.second);
+    PERFETTO_DCHECK(it != chunks->end() &&
+                    it->chunk_id == chunks_and_id.second);
+    chunks->erase(it);
   }
   stats_.set_chunks_overwritten(chunks_overwritten);
   stats_.set_bytes_overwritten(bytes_overwritten);
@@ -409,20 +434,20 @@ bool TraceBuffer::TryPatchChunkContents(ProducerID producer_id,
                                         const Patch* patches,
                                         size_t patches_size,
                                         bool other_patches_pending) {
+  PERFETTO_DCHECK(!read_only_);
   ChunkMeta::Key key(producer_id, writer_id, chunk_id);
-  auto it = index_.find(key);
-  if (it == index_.end()) {
+  ChunkMeta* chunk_meta = FindChunkMeta(key);
+  if (!chunk_meta) {
     stats_.set_patches_failed(stats_.patches_failed() + 1);
     return false;
   }
-  ChunkMeta& chunk_meta = it->second;
 
   // Check that the index is consistent with the actual ProducerID/WriterID
   // stored in the ChunkRecord.
-  PERFETTO_DCHECK(ChunkMeta::Key(*chunk_meta.chunk_record) == key);
-  uint8_t* chunk_begin = reinterpret_cast<uint8_t*>(chunk_meta.chunk_record);
+  PERFETTO_DCHECK(ChunkMeta::Key(*chunk_meta->chunk_record) == key);
+  uint8_t* chunk_begin = reinterpret_cast<uint8_t*>(chunk_meta->chunk_record);
   PERFETTO_DCHECK(chunk_begin >= begin());
-  uint8_t* chunk_end = chunk_begin + chunk_meta.chunk_record->size;
+  uint8_t* chunk_end = chunk_begin + chunk_meta->chunk_record->size;
   PERFETTO_DCHECK(chunk_end <= end());
 
   static_assert(Patch::kSize == SharedMemoryABI::kPacketHeaderSize,
@@ -456,88 +481,131 @@ bool TraceBuffer::TryPatchChunkContents(ProducerID producer_id,
   }
   TRACE_BUFFER_DLOG(
       "Chunk raw (after patch): %s",
-      HexDump(chunk_begin, chunk_meta.chunk_record->size).c_str());
+      HexDump(chunk_begin, chunk_meta->chunk_record->size).c_str());
 
   stats_.set_patches_succeeded(stats_.patches_succeeded() + patches_size);
   if (!other_patches_pending) {
-    chunk_meta.flags &= ~kChunkNeedsPatching;
-    chunk_meta.chunk_record->flags = chunk_meta.flags;
+    chunk_meta->flags &= ~kChunkNeedsPatching;
+    chunk_meta->chunk_record->flags = chunk_meta->flags;
   }
   return true;
 }
 
+std::unique_ptr<TraceBuffer> TraceBuffer::CloneReadOnly() const {
+  std::unique_ptr<TraceBuffer> clone(new TraceBuffer(overwrite_policy_));
+  if (!clone->Initialize(size_))
+    return nullptr;
+
+  // Until the first wrap, nothing past |wptr_| has ever been written.
+  const size_t used_size = stats_.write_wrap_count()
+                               ? size_
+                               : static_cast<size_t>(wptr_ - begin());
+  clone->data_.EnsureCommitted(used_size);
+  memcpy(clone->begin(), begin(), used_size);
+  clone->wptr_ = clone->begin() + (wptr_ - begin());
+
+  // The index (including the read state of each chunk) is copied as-is, only
+  // the pointers to the ChunkRecord(s) need to be rebased onto the copy.
+  clone->sequences_ = sequences_;
+  for (auto& seq : clone->sequences_) {
+    for (ChunkMeta& chunk_meta : seq.second.chunks) {
+      uint8_t* record = reinterpret_cast<uint8_t*>(chunk_meta.chunk_record);
+      chunk_meta.chunk_record = reinterpret_cast<ChunkRecord*>(
+          clone->begin() + (record - begin()));
+    }
+  }
+  clone->read_iter_ = clone->GetReadIterForSequence(clone->sequences_.end());
+  clone->discard_writes_ = discard_writes_;
+  clone->stats_ = stats_;
+  clone->read_only_ = true;
+  return clone;
+}
+
 void TraceBuffer::BeginRead() {
-  read_iter_ = GetReadIterForSequence(index_.begin());
+  read_iter_ = GetReadIterForSequence(sequences_.begin());
 #if PERFETTO_DCHECK_IS_ON()
   changed_since_last_read_ = false;
 #endif
 }
 
 TraceBuffer::SequenceIterator TraceBuffer::GetReadIterForSequence(
-    ChunkMap::iterator seq_begin) {
+    SequenceMap::iterator seq) {
   SequenceIterator iter;
-  iter.seq_begin = seq_begin;
-  if (seq_begin == index_.end()) {
-    iter.cur = iter.seq_end = index_.end();
+  iter.seq = seq;
+  if (seq == sequences_.end()) {
+    iter.cur = iter.seq_begin = iter.seq_end = ChunkArray::iterator();
+    iter.wrapping_id = 0;
     return iter;
   }
 
-#if PERFETTO_DCHECK_IS_ON()
-  // Either |seq_begin| is == index_.begin() or the item immediately before must
-  // belong to a different {ProducerID, WriterID} sequence.
-  if (seq_begin != index_.begin() && seq_begin != index_.end()) {
-    auto prev_it = seq_begin;
-    prev_it--;
-    PERFETTO_DCHECK(
-        seq_begin == index_.begin() ||
-        std::tie(prev_it->first.producer_id, prev_it->first.writer_id) <
-            std::tie(seq_begin->first.producer_id, seq_begin->first.writer_id));
+  ChunkArray* chunks = &seq->second.chunks;
+  iter.seq_begin = chunks->begin();
+  iter.seq_end = chunks->end();
+  iter.wrapping_id = seq->second.last_chunk_id_written;
+  if (chunks->empty()) {
+    iter.cur = iter.seq_end;
+    return iter;
   }
-#endif
-
-  // Find the first entry that has a greater {ProducerID, WriterID} (or just
-  // index_.end() if we reached the end).
-  ChunkMeta::Key key = seq_begin->first;  // Deliberate copy.
-  key.chunk_id = kMaxChunkID;
-  iter.seq_end = index_.upper_bound(key);
-  PERFETTO_DCHECK(iter.seq_begin != iter.seq_end);
 
   // Now find the first entry between [seq_begin, seq_end) that is
-  // > last_chunk_id_written_. This is where we the sequence will start (see
+  // > last_chunk_id_written. This is where we the sequence will start (see
   // notes about wrapping of IDs in the header).
-  auto producer_and_writer_id = std::make_pair(key.producer_id, key.writer_id);
-  PERFETTO_DCHECK(last_chunk_id_written_.count(producer_and_writer_id));
-  iter.wrapping_id = last_chunk_id_written_[producer_and_writer_id];
-  key.chunk_id = iter.wrapping_id;
-  iter.cur = index_.upper_bound(key);
+  iter.cur = std::upper_bound(
+      iter.seq_begin, iter.seq_end, iter.wrapping_id,
+      [](ChunkID id, const ChunkMeta& meta) { return id < meta.chunk_id; });
   if (iter.cur == iter.seq_end)
     iter.cur = iter.seq_begin;
   return iter;
 }
 
+TraceBuffer::ChunkMeta* TraceBuffer::FindChunkMeta(const ChunkMeta::Key& key) {
+  auto seq_it =
+      sequences_.find(std::make_pair(key.producer_id, key.writer_id));
+  if (seq_it == sequences_.end())
+    return nullptr;
+  ChunkArray* chunks = &seq_it->second.chunks;
+
+  // Fast path: patches and re-commits usually target the latest chunk.
+  if (!chunks->empty() && chunks->back().chunk_id == key.chunk_id)
+    return &chunks->back();
+
+  auto it = LowerBound(chunks, key.chunk_id);
+  if (it == chunks->end() || it->chunk_id != key.chunk_id)
+    return nullptr;
+  return &*it;
+}
+
+// static
+TraceBuffer::ChunkArray::iterator TraceBuffer::LowerBound(ChunkArray* chunks,
+                                                          ChunkID chunk_id) {
+  return std::lower_bound(
+      chunks->begin(), chunks->end(), chunk_id,
+      [](const ChunkMeta& meta, ChunkID id) { return meta.chunk_id < id; });
+}
+
 void TraceBuffer::SequenceIterator::MoveNext() {
   // Stop iterating when we reach the end of the sequence.
   // Note: |seq_begin| might be == |seq_end|.
-  if (cur == seq_end || cur->first.chunk_id == wrapping_id) {
+  if (cur == seq_end || cur->chunk_id == wrapping_id) {
     cur = seq_end;
     return;
   }
 
   // If the current chunk wasn't completed yet, we shouldn't advance past it as
   // it may be rewritten with additional packets.
-  if (!cur->second.is_complete) {
+  if (!cur->is_complete) {
     cur = seq_end;
     return;
   }
 
-  ChunkID last_chunk_id = cur->first.chunk_id;
+  ChunkID last_chunk_id = cur->chunk_id;
   if (++cur == seq_end)
     cur = seq_begin;
 
   // There may be a missing chunk in the sequence of chunks, in which case the
   // next chunk's ID won't follow the last one's. If so, skip the rest of the
   // sequence. We'll return to it later once the hole is filled.
-  if (last_chunk_id + 1 != cur->first.chunk_id)
+  if (last_chunk_id + 1 != cur->chunk_id)
     cur = seq_end;
 }
 
@@ -558,18 +626,17 @@ bool TraceBuffer::ReadNextTracePacket(
   PERFETTO_DCHECK(!changed_since_last_read_);
 #endif
   for (;; read_iter_.MoveNext()) {
-    if (PERFETTO_UNLIKELY(!read_iter_.is_valid())) {
+    while (PERFETTO_UNLIKELY(!read_iter_.is_valid())) {
       // We ran out of chunks in the current {ProducerID, WriterID} sequence or
-      // we just reached the index_.end().
+      // we just reached the sequences_.end().
 
-      if (PERFETTO_UNLIKELY(read_iter_.seq_end == index_.end()))
+      if (PERFETTO_UNLIKELY(read_iter_.seq == sequences_.end()))
         return false;
 
-      // We reached the end of sequence, move to the next one.
-      // Note: ++read_iter_.seq_end might become index_.end(), but
+      // We reached the end of sequence, move to the next one. This might be
+      // sequences_.end() or a sequence that has no chunks left, but
       // GetReadIterForSequence() knows how to deal with that.
-      read_iter_ = GetReadIterForSequence(read_iter_.seq_end);
-      PERFETTO_DCHECK(read_iter_.is_valid() && read_iter_.cur != index_.end());
+      read_iter_ = GetReadIterForSequence(std::next(read_iter_.seq));
     }
 
     ChunkMeta* chunk_meta = &*read_iter_;
@@ -21,9 +21,11 @@
 #include <string.h>
 
 #include <array>
+#include <deque>
 #include <limits>
 #include <map>
 #include <tuple>
+#include <utility>
 
 #include "perfetto/base/logging.h"
 #include "perfetto/base/paged_memory.h"
@@ -108,8 +110,12 @@ class TracePacket;
 // quite useful in future to recover the buffer from crash reports).
 //
 // However, in order to keep some operations (patching and reading) fast, a
-// lookaside index is maintained (in |index_|), keeping each chunk in the buffer
-// indexed by their {ProducerID, WriterID, ChunkID} tuple.
+// lookaside index is maintained (in |sequences_|), keeping each chunk in the
+// buffer indexed by their {ProducerID, WriterID, ChunkID} tuple. The index is
+// two-level: one entry per {ProducerID, WriterID} sequence, each holding a flat
+// array of ChunkMeta sorted by ChunkID. Chunks are normally written in ChunkID
+// order and overwritten oldest-first, so insertions and deletions hit the ends
+// of the array and don't allocate per-chunk nodes.
 //
 // Patching data out-of-band
 // -------------------------
@@ -244,8 +250,17 @@ class TraceBuffer {
   bool ReadNextTracePacket(TracePacket*,
                            PacketSequenceProperties* sequence_properties);
 
+  // Returns a read-only copy of the buffer, which can be read (through
+  // BeginRead() and ReadNextTracePacket()) without affecting this buffer.
+  // The copy includes the read state, i.e. it returns exactly the packets that
+  // the next read pass on this buffer would return. Only the portion of the
+  // buffer that has been written so far is copied. Returns nullptr if the
+  // allocation fails.
+  std::unique_ptr<TraceBuffer> CloneReadOnly() const;
+
   const TraceStats::BufferStats& stats() const { return stats_; }
   size_t size() const { return size_; }
+  bool read_only() const { return read_only_; }
 
  private:
   friend class TraceBufferTest;
@@ -349,15 +364,27 @@ class TraceBuffer {
       ChunkID chunk_id;
     };
 
-    ChunkMeta(ChunkRecord* r, uint16_t p, bool c, uint8_t f, uid_t u)
+    ChunkMeta(ChunkRecord* r,
+              ChunkID id,
+              uint16_t p,
+              bool c,
+              uint8_t f,
+              uid_t u)
         : chunk_record{r},
           trusted_uid{u},
+          chunk_id{id},
           is_complete{c},
           flags{f},
           num_fragments{p} {}
 
-    ChunkRecord* const chunk_record;  // Addr of ChunkRecord within |data_|.
-    const uid_t trusted_uid;          // uid of the producer.
+    // These are logically const but can't be declared as such, because
+    // entries are moved around within SequenceIndex::chunks.
+    ChunkRecord* chunk_record;  // Addr of ChunkRecord within |data_|.
+    uid_t trusted_uid;          // uid of the producer.
+
+    // Matches |chunk_record->chunk_id|. The {ProducerID, WriterID} part of the
+    // key is implied by the SequenceIndex that contains this entry.
+    ChunkID chunk_id;
 
     // If true, the chunk state was kChunkComplete at the time it was copied. If
     // false, the chunk was still kChunkBeingWritten while copied. |is_complete|
@@ -380,12 +407,29 @@ class TraceBuffer {
     uint16_t cur_fragment_offset = 0;
   };
 
-  using ChunkMap = std::map<ChunkMeta::Key, ChunkMeta>;
+  // All the chunks of a {ProducerID, WriterID} sequence that are currently in
+  // the buffer, sorted by ChunkID (without taking wrapping into account, as
+  // in ChunkMeta::Key::operator<).
+  using ChunkArray = std::deque<ChunkMeta>;
+  struct SequenceIndex {
+    ChunkArray chunks;
+
+    // Keeps track of the highest ChunkID written for this sequence, taking
+    // into account a potential overflow of ChunkIDs. In the case of overflow,
+    // stores the highest ChunkID written since the overflow.
+    ChunkID last_chunk_id_written = 0;
+  };
 
-  // Allows to iterate over a sub-sequence of |index_| for all keys belonging to
-  // the same {ProducerID,WriterID}. Furthermore takes into account the wrapping
-  // of ChunkID. Instances are valid only as long as the |index_| is not altered
-  // (can be used safely only between adjacent ReadNextTracePacket() calls).
+  // TODO(primiano): should clean up entries from this map. Right now it grows
+  // without bounds (although realistically is not a problem unless we have too
+  // many producers/writers within the same trace session). Note that entries
+  // are added only when a new sequence is seen, not for each chunk.
+  using SequenceMap = std::map<std::pair<ProducerID, WriterID>, SequenceIndex>;
+
+  // Allows to iterate over the chunks of a sequence of |sequences_|.
+  // Furthermore takes into account the wrapping of ChunkID. Instances are
+  // valid only as long as |sequences_| is not altered (can be used safely only
+  // between adjacent ReadNextTracePacket() calls).
   // The order of the iteration will proceed in the following order:
   // |wrapping_id| + 1 -> |seq_end|, |seq_begin| -> |wrapping_id|.
   // Practical example:
@@ -396,14 +440,18 @@ class TraceBuffer {
   //   through a CopyChunkUntrusted()).
   // The resulting iteration order will be: c5, c6, c7, c0, c1, c2, c3, c4.
   struct SequenceIterator {
-    // Points to the 1st key (the one with the numerically min ChunkID).
-    ChunkMap::iterator seq_begin;
+    // The sequence being iterated, or |sequences_|.end().
+    SequenceMap::iterator seq;
+
+    // Points to the 1st chunk (the one with the numerically min ChunkID).
+    ChunkArray::iterator seq_begin;
 
-    // Points one past the last key (the one with the numerically max ChunkID).
-    ChunkMap::iterator seq_end;
+    // Points one past the last chunk (the one with the numerically max
+    // ChunkID).
+    ChunkArray::iterator seq_end;
 
     // Current iterator, always >= seq_begin && <= seq_end.
-    ChunkMap::iterator cur;
+    ChunkArray::iterator cur;
 
     // The latest ChunkID written. Determines the start/end of the sequence.
     ChunkID wrapping_id;
@@ -412,22 +460,22 @@ class TraceBuffer {
 
     ProducerID producer_id() const {
       PERFETTO_DCHECK(is_valid());
-      return cur->first.producer_id;
+      return seq->first.first;
     }
 
     WriterID writer_id() const {
       PERFETTO_DCHECK(is_valid());
-      return cur->first.writer_id;
+      return seq->first.second;
     }
 
     ChunkID chunk_id() const {
       PERFETTO_DCHECK(is_valid());
-      return cur->first.chunk_id;
+      return cur->chunk_id;
     }
 
     ChunkMeta& operator*() {
       PERFETTO_DCHECK(is_valid());
-      return cur->second;
+      return *cur;
     }
 
     // Moves |cur| to the next chunk in the index.
@@ -450,14 +498,18 @@ class TraceBuffer {
 
   bool Initialize(size_t size);
 
-  // Returns an object that allows to iterate over chunks in the |index_| that
-  // have the same {ProducerID, WriterID} of
-  // |seq_begin.first.{producer,writer}_id|. |seq_begin| must be an iterator to
-  // the first entry in the |index_| that has a different {ProducerID, WriterID}
-  // from the previous one. It is valid for |seq_begin| to be == index_.end()
-  // (i.e. if the index is empty). The iteration takes care of ChunkID wrapping,
-  // by using |last_chunk_id_|.
-  SequenceIterator GetReadIterForSequence(ChunkMap::iterator seq_begin);
+  // Returns an object that allows to iterate over the chunks of |seq|. It is
+  // valid for |seq| to be == sequences_.end() or to have no chunks, in which
+  // case the returned iterator is not valid. The iteration takes care of
+  // ChunkID wrapping, by using |seq->second.last_chunk_id_written|.
+  SequenceIterator GetReadIterForSequence(SequenceMap::iterator seq);
+
+  // Returns the index entry for the given chunk, or nullptr if the chunk is
+  // not in the buffer.
+  ChunkMeta* FindChunkMeta(const ChunkMeta::Key&);
+
+  // Returns the position of the first chunk in |chunks| with ID >= |chunk_id|.
+  static ChunkArray::iterator LowerBound(ChunkArray* chunks, ChunkID chunk_id);
 
   // Used as a last resort when a buffer corruption is detected.
   void ClearContentsAndResetRWCursors();
@@ -561,11 +613,11 @@ class TraceBuffer {
   uint8_t* wptr_ = nullptr;    // Write pointer.
 
   // An index that keeps track of the positions and metadata of each
-  // ChunkRecord.
-  ChunkMap index_;
+  // ChunkRecord, grouped by sequence.
+  SequenceMap sequences_;
 
   // Read iterator used for ReadNext(). It is reset by calling BeginRead().
-  // It becomes invalid after any call to methods that alters the |index_|.
+  // It becomes invalid after any call to methods that alters |sequences_|.
   SequenceIterator read_iter_;
 
   // See comments at the top of the file.
@@ -575,14 +627,8 @@ class TraceBuffer {
   // a write fails because it would overwrite unread chunks.
   bool discard_writes_ = false;
 
-  // Keeps track of the highest ChunkID written for a given sequence, taking
-  // into account a potential overflow of ChunkIDs. In the case of overflow,
-  // stores the highest ChunkID written since the overflow.
-  //
-  // TODO(primiano): should clean up keys from this map. Right now it grows
-  // without bounds (although realistically is not a problem unless we have too
-  // many producers/writers within the same trace session).
-  std::map<std::pair<ProducerID, WriterID>, ChunkID> last_chunk_id_written_;
+  // Set on the buffers returned by CloneReadOnly(), which can't be written.
+  bool read_only_ = false;
 
   // Statistics about buffer usage.
   TraceStats::BufferStats stats_;
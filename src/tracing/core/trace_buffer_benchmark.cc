@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <memory>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+
+#include "perfetto/base/logging.h"
+#include "perfetto/protozero/proto_utils.h"
+#include "perfetto/tracing/core/trace_packet.h"
+#include "src/tracing/core/trace_buffer.h"
+
+namespace {
+
+using perfetto::ChunkID;
+using perfetto::ProducerID;
+using perfetto::TraceBuffer;
+using perfetto::TracePacket;
+using perfetto::WriterID;
+
+// 4 KB chunks, as used by default by the SharedMemoryArbiter.
+constexpr size_t kChunkSize = 4096;
+constexpr size_t kBufferSize = 32 * 1024 * 1024;
+
+// Returns the payload of a chunk that contains a single packet and which,
+// including the ChunkRecord header, occupies exactly |kChunkSize| bytes in the
+// buffer.
+std::vector<uint8_t> CreateChunkPayload() {
+  using protozero::proto_utils::WriteVarInt;
+  const size_t payload_size = kChunkSize - 16;  // 16 = sizeof(ChunkRecord).
+  const size_t packet_size = payload_size - 2;  // 2 = varint header size.
+  std::vector<uint8_t> payload(payload_size, 'x');
+  uint8_t* end = WriteVarInt(packet_size, payload.data());
+  PERFETTO_CHECK(end == payload.data() + 2);
+  return payload;
+}
+
+class ChunkWriter {
+ public:
+  ChunkWriter(TraceBuffer* buf, size_t num_writers)
+      : buf_(buf),
+        next_chunk_id_(num_writers),
+        payload_(CreateChunkPayload()) {}
+
+  // Writes the next chunk, round-robin across |num_writers| sequences.
+  void WriteNextChunk() {
+    size_t writer = cur_writer_++ % next_chunk_id_.size();
+    buf_->CopyChunkUntrusted(
+        ProducerID(1 + writer / 8), 0, WriterID(1 + writer % 8),
+        next_chunk_id_[writer]++, /*num_fragments=*/1, /*chunk_flags=*/0,
+        /*chunk_complete=*/true, payload_.data(), payload_.size());
+  }
+
+ private:
+  TraceBuffer* const buf_;
+  size_t cur_writer_ = 0;
+  std::vector<ChunkID> next_chunk_id_;
+  const std::vector<uint8_t> payload_;
+};
+
+size_t ReadAll(TraceBuffer* buf) {
+  size_t num_packets = 0;
+  buf->BeginRead();
+  for (;;) {
+    TracePacket packet;
+    TraceBuffer::PacketSequenceProperties sequence_properties{};
+    if (!buf->ReadNextTracePacket(&packet, &sequence_properties))
+      break;
+    num_packets++;
+  }
+  return num_packets;
+}
+
+}  // namespace
+
+// Writes chunks into an empty buffer, until it's full.
+static void BM_TraceBuffer_WriteIntoEmptyBuffer(benchmark::State& state) {
+  const size_t num_writers = static_cast<size_t>(state.range(0));
+  const size_t num_chunks = kBufferSize / kChunkSize;
+  while (state.KeepRunning()) {
+    state.PauseTiming();
+    std::unique_ptr<TraceBuffer> buf = TraceBuffer::Create(kBufferSize);
+    ChunkWriter writer(buf.get(), num_writers);
+    state.ResumeTiming();
+    for (size_t i = 0; i < num_chunks; i++)
+      writer.WriteNextChunk();
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(
+      state.iterations() * static_cast<int64_t>(kBufferSize)));
+}
+BENCHMARK(BM_TraceBuffer_WriteIntoEmptyBuffer)->Arg(1)->Arg(16)->Arg(256);
+
+// Writes chunks into a buffer that has already wrapped, so that each write
+// overwrites (and removes from the index) the oldest chunk.
+static void BM_TraceBuffer_Overwrite(benchmark::State& state) {
+  const size_t num_writers = static_cast<size_t>(state.range(0));
+  std::unique_ptr<TraceBuffer> buf = TraceBuffer::Create(kBufferSize);
+  ChunkWriter writer(buf.get(), num_writers);
+  for (size_t i = 0; i < kBufferSize / kChunkSize; i++)
+    writer.WriteNextChunk();
+  while (state.KeepRunning())
+    writer.WriteNextChunk();
+  state.SetBytesProcessed(static_cast<int64_t>(
+      state.iterations() * static_cast<int64_t>(kChunkSize)));
+}
+BENCHMARK(BM_TraceBuffer_Overwrite)->Arg(1)->Arg(16)->Arg(256);
+
+// Reads back a full buffer.
+static void BM_TraceBuffer_ReadFullBuffer(benchmark::State& state) {
+  const size_t num_writers = static_cast<size_t>(state.range(0));
+  const size_t num_chunks = kBufferSize / kChunkSize;
+  while (state.KeepRunning()) {
+    state.PauseTiming();
+    std::unique_ptr<TraceBuffer> buf = TraceBuffer::Create(kBufferSize);
+    ChunkWriter writer(buf.get(), num_writers);
+    for (size_t i = 0; i < num_chunks; i++)
+      writer.WriteNextChunk();
+    state.ResumeTiming();
+    size_t num_packets = ReadAll(buf.get());
+    PERFETTO_CHECK(num_packets == num_chunks);
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(
+      state.iterations() * static_cast<int64_t>(kBufferSize)));
+}
+BENCHMARK(BM_TraceBuffer_ReadFullBuffer)->Arg(1)->Arg(16)->Arg(256);
+
+// Takes a read-only copy of a full buffer of |state.range(0)| MB, as done by
+// TracingServiceImpl::CloneAndReadBuffers().
+static void BM_TraceBuffer_CloneReadOnly(benchmark::State& state) {
+  const size_t buffer_size = static_cast<size_t>(state.range(0)) * 1024 * 1024;
+  std::unique_ptr<TraceBuffer> buf = TraceBuffer::Create(buffer_size);
+  ChunkWriter writer(buf.get(), 16);
+  for (size_t i = 0; i < buffer_size / kChunkSize; i++)
+    writer.WriteNextChunk();
+  while (state.KeepRunning()) {
+    std::unique_ptr<TraceBuffer> clone = buf->CloneReadOnly();
+    PERFETTO_CHECK(clone);
+    state.PauseTiming();
+    clone.reset();
+    state.ResumeTiming();
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(
+      state.iterations() * static_cast<int64_t>(buffer_size)));
+}
+BENCHMARK(BM_TraceBuffer_CloneReadOnly)
+    ->Arg(64)
+    ->Arg(256)
+    ->Unit(benchmark::kMillisecond);
@@ -72,10 +72,16 @@ class TraceBufferTest : public testing::Test {
 
   std::vector<FakePacketFragment> ReadPacket(
       TraceBuffer::PacketSequenceProperties* sequence_properties = nullptr) {
+    return ReadPacketFrom(trace_buffer_.get(), sequence_properties);
+  }
+
+  static std::vector<FakePacketFragment> ReadPacketFrom(
+      TraceBuffer* buf,
+      TraceBuffer::PacketSequenceProperties* sequence_properties = nullptr) {
     std::vector<FakePacketFragment> fragments;
     TracePacket packet;
     TraceBuffer::PacketSequenceProperties ignore{};
-    if (!trace_buffer_->ReadNextTracePacket(
+    if (!buf->ReadNextTracePacket(
             &packet, sequence_properties ? sequence_properties : &ignore)) {
       return fragments;
     }
@@ -114,9 +120,8 @@ class TraceBufferTest : public testing::Test {
   }
 
   SequenceIterator GetReadIterForSequence(ProducerID p, WriterID w) {
-    TraceBuffer::ChunkMeta::Key key(p, w, 0);
     return trace_buffer_->GetReadIterForSequence(
-        trace_buffer_->index_.lower_bound(key));
+        trace_buffer_->sequences_.find(std::make_pair(p, w)));
   }
 
   void SuppressSanityDchecksForTesting() {
@@ -125,9 +130,11 @@ class TraceBufferTest : public testing::Test {
 
   std::vector<ChunkMetaKey> GetIndex() {
     std::vector<ChunkMetaKey> keys;
-    keys.reserve(trace_buffer_->index_.size());
-    for (const auto& it : trace_buffer_->index_)
-      keys.push_back(it.first);
+    for (const auto& seq : trace_buffer_->sequences_) {
+      for (const auto& chunk_meta : seq.second.chunks)
+        keys.emplace_back(seq.first.first, seq.first.second,
+                          chunk_meta.chunk_id);
+    }
     return keys;
   }
 
@@ -455,6 +462,36 @@ TEST_F(TraceBufferTest, ReadWrite_PaddingAtEndUpdatesIndexMisaligned) {
   ASSERT_THAT(ReadPacket(), IsEmpty());
 }
 
+// Overwrites all the chunks of a sequence and checks that the reader skips the
+// (now empty) sequence and moves on to the next ones.
+TEST_F(TraceBufferTest, ReadWrite_SequenceFullyOverwritten) {
+  ResetBuffer(4096);
+  CreateChunk(ProducerID(1), WriterID(1), ChunkID(0))
+      .AddPacket(2048 - 16, 'a')
+      .CopyIntoTraceBuffer();
+  CreateChunk(ProducerID(2), WriterID(1), ChunkID(0))
+      .AddPacket(2048 - 16, 'b')
+      .CopyIntoTraceBuffer();
+  CreateChunk(ProducerID(3), WriterID(1), ChunkID(0))
+      .AddPacket(2048 - 16, 'c')
+      .CopyIntoTraceBuffer();
+  ASSERT_THAT(GetIndex(),
+              ElementsAre(ChunkMetaKey(2, 1, 0), ChunkMetaKey(3, 1, 0)));
+
+  trace_buffer()->BeginRead();
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(2048 - 16, 'b')));
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(2048 - 16, 'c')));
+  ASSERT_THAT(ReadPacket(), IsEmpty());
+
+  // The sequence can resume after having been fully overwritten.
+  CreateChunk(ProducerID(1), WriterID(1), ChunkID(1))
+      .AddPacket(2048 - 16, 'd')
+      .CopyIntoTraceBuffer();
+  trace_buffer()->BeginRead();
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(2048 - 16, 'd')));
+  ASSERT_THAT(ReadPacket(), IsEmpty());
+}
+
 // --------------------------------------
 // Fragments stitching and skipping logic
 // --------------------------------------
@@ -1675,6 +1712,92 @@ TEST_F(TraceBufferTest, DiscardPolicy) {
   ASSERT_THAT(ReadPacket(), IsEmpty());
 }
 
+// -------------------
+// CloneReadOnly tests
+// -------------------
+
+TEST_F(TraceBufferTest, Clone_ReadsDontAffectOriginal) {
+  ResetBuffer(4096);
+  AppendChunks({{ProducerID(1), WriterID(1), ChunkID(0)},
+                {ProducerID(1), WriterID(2), ChunkID(0)},
+                {ProducerID(2), WriterID(1), ChunkID(0)}});
+  std::unique_ptr<TraceBuffer> clone = trace_buffer()->CloneReadOnly();
+  ASSERT_TRUE(clone);
+  EXPECT_TRUE(clone->read_only());
+  EXPECT_EQ(trace_buffer()->size(), clone->size());
+  EXPECT_EQ(3u, clone->stats().chunks_written());
+
+  // Chunks written after the clone are not visible in the clone.
+  AppendChunks({{ProducerID(1), WriterID(1), ChunkID(1)}});
+
+  clone->BeginRead();
+  ASSERT_THAT(ReadPacketFrom(clone.get()),
+              ElementsAre(FakePacketFragment(4, 1 + 1 + 0)));
+  ASSERT_THAT(ReadPacketFrom(clone.get()),
+              ElementsAre(FakePacketFragment(4, 1 + 2 + 0)));
+  ASSERT_THAT(ReadPacketFrom(clone.get()),
+              ElementsAre(FakePacketFragment(4, 2 + 1 + 0)));
+  ASSERT_THAT(ReadPacketFrom(clone.get()), IsEmpty());
+
+  trace_buffer()->BeginRead();
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(4, 1 + 1 + 0)));
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(4, 1 + 1 + 1)));
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(4, 1 + 2 + 0)));
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(4, 2 + 1 + 0)));
+  ASSERT_THAT(ReadPacket(), IsEmpty());
+}
+
+// Packets already read from the original buffer are not returned again by the
+// clone, while fragmented packets still being stitched are.
+TEST_F(TraceBufferTest, Clone_PreservesReadState) {
+  ResetBuffer(4096);
+  CreateChunk(ProducerID(1), WriterID(1), ChunkID(0))
+      .AddPacket(10, 'a')
+      .AddPacket(10, 'b', kContOnNextChunk)
+      .CopyIntoTraceBuffer();
+  trace_buffer()->BeginRead();
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(10, 'a')));
+  ASSERT_THAT(ReadPacket(), IsEmpty());
+
+  std::unique_ptr<TraceBuffer> clone = trace_buffer()->CloneReadOnly();
+  ASSERT_TRUE(clone);
+  CreateChunk(ProducerID(1), WriterID(1), ChunkID(1))
+      .AddPacket(10, 'c', kContFromPrevChunk)
+      .CopyIntoTraceBuffer();
+
+  // The clone doesn't have the continuation of 'b'.
+  clone->BeginRead();
+  ASSERT_THAT(ReadPacketFrom(clone.get()), IsEmpty());
+
+  trace_buffer()->BeginRead();
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(10, 'b'),
+                                        FakePacketFragment(10, 'c')));
+  ASSERT_THAT(ReadPacket(), IsEmpty());
+}
+
+TEST_F(TraceBufferTest, Clone_AfterWrapping) {
+  ResetBuffer(4096);
+  for (ChunkID chunk_id = 0; chunk_id < 10; chunk_id++) {
+    CreateChunk(ProducerID(1), WriterID(1), chunk_id)
+        .AddPacket(512 - 16, static_cast<char>('a' + chunk_id))
+        .CopyIntoTraceBuffer();
+  }
+  ASSERT_EQ(1u, trace_buffer()->stats().write_wrap_count());
+  std::unique_ptr<TraceBuffer> clone = trace_buffer()->CloneReadOnly();
+  ASSERT_TRUE(clone);
+
+  clone->BeginRead();
+  trace_buffer()->BeginRead();
+  for (ChunkID chunk_id = 2; chunk_id < 10; chunk_id++) {
+    auto expected = ElementsAre(
+        FakePacketFragment(512 - 16, static_cast<char>('a' + chunk_id)));
+    ASSERT_THAT(ReadPacketFrom(clone.get()), expected);
+    ASSERT_THAT(ReadPacket(), expected);
+  }
+  ASSERT_THAT(ReadPacketFrom(clone.get()), IsEmpty());
+  ASSERT_THAT(ReadPacket(), IsEmpty());
+}
+
 // TODO(primiano): test stats().
 // TODO(primiano): test multiple streams interleaved.
 // TODO(primiano): more testing on packet merging.
@@ -57,7 +57,8 @@ bool TraceConfig::operator==(const TraceConfig& other) const {
          (flush_period_ms_ == other.flush_period_ms_) &&
          (flush_timeout_ms_ == other.flush_timeout_ms_) &&
          (disable_clock_snapshotting_ == other.disable_clock_snapshotting_) &&
-         (notify_traceur_ == other.notify_traceur_);
+         (notify_traceur_ == other.notify_traceur_) &&
+         (compress_file_ == other.compress_file_);
 }
 #pragma GCC diagnostic pop
 
@@ -141,6 +142,10 @@ void TraceConfig::FromProto(const perfetto::protos::TraceConfig& proto) {
                 "size mismatch");
   notify_traceur_ =
       static_cast<decltype(notify_traceur_)>(proto.notify_traceur());
+
+  static_assert(sizeof(compress_file_) == sizeof(proto.compress_file()),
+                "size mismatch");
+  compress_file_ = static_cast<decltype(compress_file_)>(proto.compress_file());
   unknown_fields_ = proto.unknown_fields();
 }
 
@@ -228,6 +233,11 @@ void TraceConfig::ToProto(perfetto::protos::TraceConfig* proto) const {
                 "size mismatch");
   proto->set_notify_traceur(
       static_cast<decltype(proto->notify_traceur())>(notify_traceur_));
+
+  static_assert(sizeof(compress_file_) == sizeof(proto->compress_file()),
+                "size mismatch");
+  proto->set_compress_file(
+      static_cast<decltype(proto->compress_file())>(compress_file_));
   *(proto->mutable_unknown_fields()) = unknown_fields_;
 }
 
@@ -342,7 +352,8 @@ bool TraceConfig::ProducerConfig::operator==(
     const TraceConfig::ProducerConfig& other) const {
   return (producer_name_ == other.producer_name_) &&
          (shm_size_kb_ == other.shm_size_kb_) &&
-         (page_size_kb_ == other.page_size_kb_);
+         (page_size_kb_ == other.page_size_kb_) &&
+         (batch_commits_duration_ms_ == other.batch_commits_duration_ms_);
 }
 #pragma GCC diagnostic pop
 
@@ -359,6 +370,13 @@ void TraceConfig::ProducerConfig::FromProto(
   static_assert(sizeof(page_size_kb_) == sizeof(proto.page_size_kb()),
                 "size mismatch");
   page_size_kb_ = static_cast<decltype(page_size_kb_)>(proto.page_size_kb());
+
+  static_assert(sizeof(batch_commits_duration_ms_) ==
+                    sizeof(proto.batch_commits_duration_ms()),
+                "size mismatch");
+  batch_commits_duration_ms_ =
+      static_cast<decltype(batch_commits_duration_ms_)>(
+          proto.batch_commits_duration_ms());
   unknown_fields_ = proto.unknown_fields();
 }
 
@@ -380,6 +398,13 @@ void TraceConfig::ProducerConfig::ToProto(
                 "size mismatch");
   proto->set_page_size_kb(
       static_cast<decltype(proto->page_size_kb())>(page_size_kb_));
+
+  static_assert(sizeof(batch_commits_duration_ms_) ==
+                    sizeof(proto->batch_commits_duration_ms()),
+                "size mismatch");
+  proto->set_batch_commits_duration_ms(
+      static_cast<decltype(proto->batch_commits_duration_ms())>(
+          batch_commits_duration_ms_));
   *(proto->mutable_unknown_fields()) = unknown_fields_;
 }
 
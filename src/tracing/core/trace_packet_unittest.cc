@@ -47,6 +47,10 @@ static_assert(protos::TracePacket::kClockSnapshotFieldNumber ==
                   protos::TrustedPacket::kClockSnapshotFieldNumber,
               "clock_snapshot field id mismatch");
 
+static_assert(protos::TracePacket::kCompressedPacketsFieldNumber ==
+                  protos::TrustedPacket::kCompressedPacketsFieldNumber,
+              "compressed_packets field id mismatch");
+
 TEST(TracePacketTest, Simple) {
   protos::TracePacket proto;
   proto.mutable_for_testing()->set_str("string field");
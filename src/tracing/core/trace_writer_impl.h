@@ -29,8 +29,11 @@ namespace perfetto {
 class SharedMemoryArbiterImpl;
 
 // See //include/perfetto/tracing/core/trace_writer.h for docs.
-class TraceWriterImpl : public TraceWriter,
-                        public protozero::ScatteredStreamWriter::Delegate {
+// This class is final so that the calls made through a TraceWriterImpl* are
+// not virtual.
+class TraceWriterImpl final
+    : public TraceWriter,
+      public protozero::ScatteredStreamWriter::Delegate {
  public:
   // TracePacketHandle is defined in trace_writer.h
   TraceWriterImpl(SharedMemoryArbiterImpl*, WriterID, BufferID);
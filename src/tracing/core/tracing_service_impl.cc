@@ -37,6 +37,7 @@
 #include "perfetto/base/build_config.h"
 #include "perfetto/base/file_utils.h"
 #include "perfetto/base/task_runner.h"
+#include "perfetto/base/thread_pool.h"
 #include "perfetto/base/utils.h"
 #include "perfetto/tracing/core/consumer.h"
 #include "perfetto/tracing/core/data_source_config.h"
@@ -45,8 +46,10 @@
 #include "perfetto/tracing/core/shared_memory_abi.h"
 #include "perfetto/tracing/core/trace_packet.h"
 #include "perfetto/tracing/core/trace_writer.h"
+#include "src/tracing/core/packet_compressor.h"
 #include "src/tracing/core/packet_stream_validator.h"
 #include "src/tracing/core/shared_memory_arbiter_impl.h"
+#include "src/tracing/core/sharded_trace_buffer.h"
 #include "src/tracing/core/trace_buffer.h"
 
 #include "perfetto/trace/clock_snapshot.pb.h"
@@ -66,6 +69,23 @@ constexpr base::TimeMillis kSnapshotsInterval(10 * 1000);
 constexpr int kDefaultWriteIntoFilePeriodMs = 5000;
 constexpr int kMaxConcurrentTracingSessions = 5;
 
+// Upper bound for ProducerConfig.batch_commits_duration_ms. Completed chunks
+// are not in the trace buffer until committed, don't hold them back for long.
+constexpr uint32_t kMaxBatchCommitsDurationMs = 1000;
+
+// This is a rough threshold to determine how much to read from the buffer in
+// each task. This is to avoid executing a single huge sending task for too
+// long and risk to hit the watchdog. This is *not* an upper bound: we just
+// stop accumulating new packets and PostTask *after* we cross this threshold.
+// This constant essentially balances the PostTask and IPC overhead vs the
+// responsiveness of the service. An extremely small value will cause one IPC
+// and one PostTask for each slice but will keep the service extremely
+// responsive. An extremely large value will batch the send for the full
+// buffer in one large task, will hit the blocking send() once the socket
+// buffers are full and hang the service for a bit (until the consumer
+// catches up).
+constexpr size_t kApproxBytesPerTask = 32768;
+
 constexpr uint32_t kMillisPerHour = 3600000;
 constexpr uint32_t kMaxTracingDurationMillis = 7 * 24 * kMillisPerHour;
 
@@ -168,6 +188,10 @@ TracingServiceImpl::ConnectProducer(Producer* producer,
 void TracingServiceImpl::DisconnectProducer(ProducerID id) {
   PERFETTO_DCHECK_THREAD(thread_checker_);
   PERFETTO_DLOG("Producer %" PRIu16 " disconnected", id);
+
+  // The commit workers might still be copying chunks out of the producer's
+  // SMB, which is about to be unmapped.
+  DrainCommitWorkers();
   PERFETTO_DCHECK(producers_.count(id));
 
   // Scrape remaining chunks for this producer to ensure we don't lose data.
@@ -388,14 +412,25 @@ bool TracingServiceImpl::EnableTracing(ConsumerEndpointImpl* consumer,
         buffer_cfg.fill_policy() == TraceConfig::BufferConfig::DISCARD
             ? TraceBuffer::kDiscard
             : TraceBuffer::kOverwrite;
+    const size_t num_shards =
+        commit_workers_ ? commit_workers_->num_threads() : 1;
     auto it_and_inserted = buffers_.emplace(
-        global_id, TraceBuffer::Create(buf_size_bytes, policy));
+        global_id,
+        ShardedTraceBuffer::Create(buf_size_bytes, policy, num_shards));
     PERFETTO_DCHECK(it_and_inserted.second);  // buffers_.count(global_id) == 0.
-    std::unique_ptr<TraceBuffer>& trace_buffer = it_and_inserted.first->second;
+    std::unique_ptr<ShardedTraceBuffer>& trace_buffer =
+        it_and_inserted.first->second;
     if (!trace_buffer) {
       did_allocate_all_buffers = false;
       break;
     }
+    if (trace_buffer->num_shards() > 1) {
+      PERFETTO_DLOG("Buffer %zu (%" PRIu32
+                    " KB) has %zu shards, one per commit worker, it can use "
+                    "up to %zu KB",
+                    i, buffer_cfg.size_kb(), trace_buffer->num_shards(),
+                    trace_buffer->size() / 1024);
+    }
   }
 
   UpdateMemoryGuardrail();
@@ -712,6 +747,10 @@ void TracingServiceImpl::Flush(TracingSessionID tsid,
 void TracingServiceImpl::NotifyFlushDoneForProducer(
     ProducerID producer_id,
     FlushRequestID flush_request_id) {
+  // The flush is complete only once the data committed before the flush ack
+  // has landed in the trace buffers.
+  DrainCommitWorkers();
+
   for (auto& kv : tracing_sessions_) {
     // Remove all pending flushes <= |flush_request_id| for |producer_id|.
     auto& pending_flushes = kv.second.pending_flushes;
@@ -796,6 +835,9 @@ void TracingServiceImpl::ScrapeSharedMemoryBuffers(
 
   PERFETTO_DLOG("Scraping SMB for producer %" PRIu16, producer->id_);
 
+  // Scraped chunks are copied directly from this thread.
+  DrainCommitWorkers();
+
   // Find and copy any uncommitted chunks from the SMB.
   //
   // In nominal conditions, the page layout of the used SMB pages should never
@@ -966,6 +1008,11 @@ void TracingServiceImpl::ReadBuffers(TracingSessionID tsid,
     return;
   }
 
+  // The packets returned by ReadNextTracePacket() point directly into the
+  // buffers' memory. Make sure no worker is writing into them until the
+  // packets have been sent or written into the file.
+  DrainCommitWorkers();
+
   std::vector<TracePacket> packets;
   packets.reserve(1024);  // Just an educated guess to avoid trivial expansions.
 
@@ -989,18 +1036,10 @@ void TracingServiceImpl::ReadBuffers(TracingSessionID tsid,
     total_slices += packet.slices().size();
   }
 
-  // This is a rough threshold to determine how much to read from the buffer in
-  // each task. This is to avoid executing a single huge sending task for too
-  // long and risk to hit the watchdog. This is *not* an upper bound: we just
-  // stop accumulating new packets and PostTask *after* we cross this threshold.
-  // This constant essentially balances the PostTask and IPC overhead vs the
-  // responsiveness of the service. An extremely small value will cause one IPC
-  // and one PostTask for each slice but will keep the service extremely
-  // responsive. An extremely large value will batch the send for the full
-  // buffer in one large task, will hit the blocking send() once the socket
-  // buffers are full and hang the service for a bit (until the consumer
-  // catches up).
-  static constexpr size_t kApproxBytesPerTask = 32768;
+  // Don't split the reads in several tasks when writing into a file.
+  const size_t max_bytes_per_task = tracing_session->write_into_file
+                                        ? std::numeric_limits<size_t>::max()
+                                        : kApproxBytesPerTask;
   bool did_hit_threshold = false;
 
   // TODO(primiano): Extend the ReadBuffers API to allow reading only some
@@ -1013,54 +1052,10 @@ void TracingServiceImpl::ReadBuffers(TracingSessionID tsid,
       PERFETTO_DFATAL("Buffer not found.");
       continue;
     }
-    TraceBuffer& tbuf = *tbuf_iter->second;
-    tbuf.BeginRead();
-    while (!did_hit_threshold) {
-      TracePacket packet;
-      TraceBuffer::PacketSequenceProperties sequence_properties{};
-      if (!tbuf.ReadNextTracePacket(&packet, &sequence_properties)) {
-        break;
-      }
-      PERFETTO_DCHECK(sequence_properties.producer_id_trusted != 0);
-      PERFETTO_DCHECK(sequence_properties.writer_id != 0);
-      PERFETTO_DCHECK(sequence_properties.producer_uid_trusted != kInvalidUid);
-      PERFETTO_DCHECK(packet.size() > 0);
-      if (!PacketStreamValidator::Validate(packet.slices())) {
-        PERFETTO_DLOG("Dropping invalid packet");
-        continue;
-      }
-
-      // Append a slice with the trusted field data. This can't be spoofed
-      // because above we validated that the existing slices don't contain any
-      // trusted fields. For added safety we append instead of prepending
-      // because according to protobuf semantics, if the same field is
-      // encountered multiple times the last instance takes priority. Note that
-      // truncated packets are also rejected, so the producer can't give us a
-      // partial packet (e.g., a truncated string) which only becomes valid when
-      // the trusted data is appended here.
-      protos::TrustedPacket trusted_packet;
-      trusted_packet.set_trusted_uid(
-          static_cast<int32_t>(sequence_properties.producer_uid_trusted));
-      trusted_packet.set_trusted_packet_sequence_id(
-          tracing_session->GetPacketSequenceID(
-              sequence_properties.producer_id_trusted,
-              sequence_properties.writer_id));
-      static constexpr size_t kTrustedBufSize = 16;
-      Slice slice = Slice::Allocate(kTrustedBufSize);
-      PERFETTO_CHECK(
-          trusted_packet.SerializeToArray(slice.own_data(), kTrustedBufSize));
-      slice.size = static_cast<size_t>(trusted_packet.GetCachedSize());
-      PERFETTO_DCHECK(slice.size > 0 && slice.size <= kTrustedBufSize);
-      packet.AddSlice(std::move(slice));
-
-      // Append the packet (inclusive of the trusted uid) to |packets|.
-      packets_bytes += packet.size();
-      total_slices += packet.slices().size();
-      did_hit_threshold = packets_bytes >= kApproxBytesPerTask &&
-                          !tracing_session->write_into_file;
-      packets.emplace_back(std::move(packet));
-    }  // for(packets...)
-  }    // for(buffers...)
+    did_hit_threshold = ReadPacketsFromBuffer(
+        tracing_session, tbuf_iter->second.get(), max_bytes_per_task, &packets,
+        &packets_bytes, &total_slices);
+  }  // for(buffers...)
 
   // If the caller asked us to write into a file by setting
   // |write_into_file| == true in the trace config, drain the packets read
@@ -1070,6 +1065,13 @@ void TracingServiceImpl::ReadBuffers(TracingSessionID tsid,
                                   ? tracing_session->max_file_size_bytes
                                   : std::numeric_limits<size_t>::max();
 
+    // The compressed blocks replace the packets read above. Each block is a
+    // single packet with a single slice.
+    if (tracing_session->config.compress_file() && !packets.empty()) {
+      PacketCompressor::Compress(&packets);
+      total_slices = packets.size();
+    }
+
     // When writing into a file, the file should look like a root trace.proto
     // message. Each packet should be prepended with a proto preamble stating
     // its field id (within trace.proto) and size. Hence the addition below.
@@ -1161,6 +1163,155 @@ void TracingServiceImpl::ReadBuffers(TracingSessionID tsid,
   consumer->consumer_->OnTraceData(std::move(packets), has_more);
 }
 
+bool TracingServiceImpl::ReadPacketsFromBuffer(
+    TracingSession* tracing_session,
+    ShardedTraceBuffer* buf,
+    size_t max_bytes,
+    std::vector<TracePacket>* packets,
+    size_t* packets_bytes,
+    size_t* total_slices) {
+  buf->BeginRead();
+  for (;;) {
+    TracePacket packet;
+    TraceBuffer::PacketSequenceProperties sequence_properties{};
+    if (!buf->ReadNextTracePacket(&packet, &sequence_properties))
+      return false;
+    PERFETTO_DCHECK(sequence_properties.producer_id_trusted != 0);
+    PERFETTO_DCHECK(sequence_properties.writer_id != 0);
+    PERFETTO_DCHECK(sequence_properties.producer_uid_trusted != kInvalidUid);
+    PERFETTO_DCHECK(packet.size() > 0);
+    if (!PacketStreamValidator::Validate(packet.slices())) {
+      PERFETTO_DLOG("Dropping invalid packet");
+      continue;
+    }
+
+    // Append a slice with the trusted field data. This can't be spoofed
+    // because above we validated that the existing slices don't contain any
+    // trusted fields. For added safety we append instead of prepending
+    // because according to protobuf semantics, if the same field is
+    // encountered multiple times the last instance takes priority. Note that
+    // truncated packets are also rejected, so the producer can't give us a
+    // partial packet (e.g., a truncated string) which only becomes valid when
+    // the trusted data is appended here.
+    protos::TrustedPacket trusted_packet;
+    trusted_packet.set_trusted_uid(
+        static_cast<int32_t>(sequence_properties.producer_uid_trusted));
+    trusted_packet.set_trusted_packet_sequence_id(
+        tracing_session->GetPacketSequenceID(
+            sequence_properties.producer_id_trusted,
+            sequence_properties.writer_id));
+    static constexpr size_t kTrustedBufSize = 16;
+    Slice slice = Slice::Allocate(kTrustedBufSize);
+    PERFETTO_CHECK(
+        trusted_packet.SerializeToArray(slice.own_data(), kTrustedBufSize));
+    slice.size = static_cast<size_t>(trusted_packet.GetCachedSize());
+    PERFETTO_DCHECK(slice.size > 0 && slice.size <= kTrustedBufSize);
+    packet.AddSlice(std::move(slice));
+
+    // Append the packet (inclusive of the trusted uid) to |packets|.
+    *packets_bytes += packet.size();
+    *total_slices += packet.slices().size();
+    packets->emplace_back(std::move(packet));
+    if (*packets_bytes >= max_bytes)
+      return true;
+  }
+}
+
+void TracingServiceImpl::CloneAndReadBuffers(TracingSessionID tsid,
+                                             ConsumerEndpointImpl* consumer) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  TracingSession* tracing_session = GetTracingSession(tsid);
+  if (!tracing_session) {
+    PERFETTO_DLOG("Cannot CloneAndReadBuffers(): no tracing session is active");
+    return;
+  }
+  if (!tracing_session->cloned_buffers.empty()) {
+    PERFETTO_ELOG("CloneAndReadBuffers(): a clone is already being read");
+    return;
+  }
+
+  // Only the copy needs to be consistent: once the commit workers have been
+  // drained, producers can keep writing into the original buffers.
+  DrainCommitWorkers();
+  const base::TimeNanos clone_start = base::GetWallTimeNs();
+  for (BufferID buffer_id : tracing_session->buffers_index) {
+    auto tbuf_iter = buffers_.find(buffer_id);
+    if (tbuf_iter == buffers_.end()) {
+      PERFETTO_DFATAL("Buffer not found.");
+      continue;
+    }
+    std::unique_ptr<ShardedTraceBuffer> clone =
+        tbuf_iter->second->CloneReadOnly();
+    if (!clone) {
+      PERFETTO_ELOG("Failed to allocate the copy of the trace buffers");
+      tracing_session->cloned_buffers.clear();
+      consumer->consumer_->OnTraceData({}, /*has_more=*/false);
+      return;
+    }
+    tracing_session->cloned_buffers.emplace_back(std::move(clone));
+  }
+  PERFETTO_DLOG("Cloned %zu buffers in %" PRId64 " us",
+                tracing_session->cloned_buffers.size(),
+                static_cast<int64_t>(
+                    (base::GetWallTimeNs() - clone_start).count() / 1000));
+  UpdateMemoryGuardrail();
+
+  // The copy is a self-contained trace: emit the service packets and the
+  // trace config regardless of what ReadBuffers() emitted so far.
+  std::vector<TracePacket> packets;
+  SnapshotSyncMarker(&packets);
+  SnapshotStats(tracing_session, &packets);
+  if (!tracing_session->config.disable_clock_snapshotting())
+    SnapshotClocks(&packets);
+  EmitTraceConfig(tracing_session, &packets);
+  ReadClonedBuffers(tsid, consumer, std::move(packets));
+}
+
+void TracingServiceImpl::ReadClonedBuffers(TracingSessionID tsid,
+                                           ConsumerEndpointImpl* consumer,
+                                           std::vector<TracePacket> packets) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  TracingSession* tracing_session = GetTracingSession(tsid);
+  if (!tracing_session || tracing_session->cloned_buffers.empty())
+    return;
+
+  size_t packets_bytes = 0;
+  size_t total_slices = 0;
+  for (const TracePacket& packet : packets)
+    packets_bytes += packet.size();
+
+  bool has_more = false;
+  for (auto& buf : tracing_session->cloned_buffers) {
+    has_more = ReadPacketsFromBuffer(tracing_session, buf.get(),
+                                     kApproxBytesPerTask, &packets,
+                                     &packets_bytes, &total_slices);
+    if (has_more)
+      break;
+  }
+
+  if (has_more) {
+    auto weak_consumer = consumer->GetWeakPtr();
+    auto weak_this = weak_ptr_factory_.GetWeakPtr();
+    task_runner_->PostTask([weak_this, weak_consumer, tsid] {
+      if (!weak_this || !weak_consumer)
+        return;
+      weak_this->ReadClonedBuffers(tsid, weak_consumer.get(), {});
+    });
+    consumer->consumer_->OnTraceData(std::move(packets), has_more);
+    return;
+  }
+
+  // The packets point into the cloned buffers, release them only after the
+  // consumer has received the last batch. Move them out of the session first,
+  // in case the consumer re-enters.
+  std::vector<std::unique_ptr<ShardedTraceBuffer>> cloned_buffers =
+      std::move(tracing_session->cloned_buffers);
+  tracing_session->cloned_buffers.clear();
+  consumer->consumer_->OnTraceData(std::move(packets), has_more);
+  cloned_buffers.clear();
+  UpdateMemoryGuardrail();
+}
+
 void TracingServiceImpl::FreeBuffers(TracingSessionID tsid) {
   PERFETTO_DCHECK_THREAD(thread_checker_);
   PERFETTO_DLOG("Freeing buffers for session %" PRIu64, tsid);
@@ -1176,6 +1327,7 @@ void TracingServiceImpl::FreeBuffers(TracingSessionID tsid) {
     producer->OnFreeBuffers(tracing_session->buffers_index);
   }
 
+  DrainCommitWorkers();
   for (BufferID buffer_id : tracing_session->buffers_index) {
     buffer_ids_.Free(buffer_id);
     PERFETTO_DCHECK(buffers_.count(buffer_id) == 1);
@@ -1346,6 +1498,9 @@ TracingServiceImpl::DataSourceInstance* TracingServiceImpl::SetupDataSource(
     if (page_size < base::kPageSize || page_size % base::kPageSize != 0)
       page_size = kDefaultShmPageSize;
     producer->shared_buffer_page_size_kb_ = page_size / 1024;
+    producer->batch_commits_duration_ms_ =
+        std::min(producer_config.batch_commits_duration_ms(),
+                 kMaxBatchCommitsDurationMs);
 
     // Determine the SMB size. Must be an integer multiple of the SMB page size.
     // The decisional tree is as follows:
@@ -1387,20 +1542,36 @@ void TracingServiceImpl::CopyProducerPageIntoLogBuffer(
     size_t size) {
   PERFETTO_DCHECK_THREAD(thread_checker_);
 
+  ShardedTraceBuffer* buf =
+      GetTargetBufferForChunk(producer_id_trusted, writer_id, buffer_id);
+  if (!buf)
+    return;
+
+  buf->CopyChunkUntrusted(producer_id_trusted, producer_uid_trusted, writer_id,
+                          chunk_id, num_fragments, chunk_flags, chunk_complete,
+                          src, size);
+}
+
+ShardedTraceBuffer* TracingServiceImpl::GetTargetBufferForChunk(
+    ProducerID producer_id_trusted,
+    WriterID writer_id,
+    BufferID buffer_id) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+
   ProducerEndpointImpl* producer = GetProducer(producer_id_trusted);
   if (!producer) {
     PERFETTO_DFATAL("Producer not found.");
     chunks_discarded_++;
-    return;
+    return nullptr;
   }
 
-  TraceBuffer* buf = GetBufferByID(buffer_id);
+  ShardedTraceBuffer* buf = GetBufferByID(buffer_id);
   if (!buf) {
     PERFETTO_DLOG("Could not find target buffer %" PRIu16
                   " for producer %" PRIu16,
                   buffer_id, producer_id_trusted);
     chunks_discarded_++;
-    return;
+    return nullptr;
   }
 
   // Verify that the producer is actually allowed to write into the target
@@ -1413,7 +1584,7 @@ void TracingServiceImpl::CopyProducerPageIntoLogBuffer(
                   producer_id_trusted, buffer_id);
     PERFETTO_DFATAL("Forbidden target buffer");
     chunks_discarded_++;
-    return;
+    return nullptr;
   }
 
   // If the writer was registered by the producer, it should only write into the
@@ -1428,12 +1599,10 @@ void TracingServiceImpl::CopyProducerPageIntoLogBuffer(
                   buffer_id);
     PERFETTO_DFATAL("Wrong target buffer");
     chunks_discarded_++;
-    return;
+    return nullptr;
   }
 
-  buf->CopyChunkUntrusted(producer_id_trusted, producer_uid_trusted, writer_id,
-                          chunk_id, num_fragments, chunk_flags, chunk_complete,
-                          src, size);
+  return buf;
 }
 
 void TracingServiceImpl::ApplyChunkPatches(
@@ -1444,7 +1613,7 @@ void TracingServiceImpl::ApplyChunkPatches(
   for (const auto& chunk : chunks_to_patch) {
     const ChunkID chunk_id = static_cast<ChunkID>(chunk.chunk_id());
     const WriterID writer_id = static_cast<WriterID>(chunk.writer_id());
-    TraceBuffer* buf =
+    ShardedTraceBuffer* buf =
         GetBufferByID(static_cast<BufferID>(chunk.target_buffer()));
     static_assert(std::numeric_limits<ChunkID>::max() == kMaxChunkID,
                   "Add a '|| chunk_id > kMaxChunkID' below if this fails");
@@ -1490,6 +1659,22 @@ void TracingServiceImpl::ApplyChunkPatches(
       memcpy(&patches[i].data[0], patch_data.data(), patches[i].data.size());
       i++;
     }
+
+    if (commit_workers_) {
+      // The patches must be applied after the chunk copies for the same
+      // sequence, which are posted on the worker that owns the shard.
+      std::vector<TraceBuffer::Patch> patches_copy(&patches[0], &patches[i]);
+      const bool has_more_patches = chunk.has_more_patches();
+      commit_workers_->PostTask(
+          buf->GetShardForSequence(producer_id_trusted, writer_id),
+          [buf, producer_id_trusted, writer_id, chunk_id, patches_copy,
+           has_more_patches] {
+            buf->TryPatchChunkContents(producer_id_trusted, writer_id,
+                                       chunk_id, patches_copy.data(),
+                                       patches_copy.size(), has_more_patches);
+          });
+      continue;
+    }
     buf->TryPatchChunkContents(producer_id_trusted, writer_id, chunk_id,
                                &patches[0], i, chunk.has_more_patches());
   }
@@ -1528,13 +1713,33 @@ ProducerID TracingServiceImpl::GetNextProducerID() {
   return last_producer_id_;
 }
 
-TraceBuffer* TracingServiceImpl::GetBufferByID(BufferID buffer_id) {
+ShardedTraceBuffer* TracingServiceImpl::GetBufferByID(BufferID buffer_id) {
   auto buf_iter = buffers_.find(buffer_id);
   if (buf_iter == buffers_.end())
     return nullptr;
   return &*buf_iter->second;
 }
 
+void TracingServiceImpl::SetCommitWorkerThreads(size_t num_threads) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  if (!tracing_sessions_.empty()) {
+    // The number of shards of the existing buffers is tied to the number of
+    // workers, see ShardedTraceBuffer::GetShardForSequence().
+    PERFETTO_ELOG(
+        "Cannot change the number of commit workers with active sessions");
+    return;
+  }
+  commit_workers_.reset();
+  if (num_threads > 0)
+    commit_workers_.reset(new base::ThreadPool(num_threads));
+}
+
+void TracingServiceImpl::DrainCommitWorkers() {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  if (commit_workers_)
+    commit_workers_->WaitIdle();
+}
+
 void TracingServiceImpl::UpdateMemoryGuardrail() {
 #if !PERFETTO_BUILDFLAG(PERFETTO_EMBEDDER_BUILD) && \
     !PERFETTO_BUILDFLAG(PERFETTO_OS_MACOSX)
@@ -1551,6 +1756,12 @@ void TracingServiceImpl::UpdateMemoryGuardrail() {
     total_buffer_bytes += id_to_buffer.second->size();
   }
 
+  // Sum up the copies of the buffers being read by CloneAndReadBuffers().
+  for (const auto& id_to_session : tracing_sessions_) {
+    for (const auto& buf : id_to_session.second.cloned_buffers)
+      total_buffer_bytes += buf->size();
+  }
+
   // Set the guard rail to 32MB + the sum of all the buffers over a 30 second
   // interval.
   uint64_t guardrail = 32 * 1024 * 1024 + total_buffer_bytes;
@@ -1666,8 +1877,9 @@ TraceStats TracingServiceImpl::GetTraceStats(TracingSession* tracing_session) {
   trace_stats.set_chunks_discarded(chunks_discarded_);
   trace_stats.set_patches_discarded(patches_discarded_);
 
+  DrainCommitWorkers();
   for (BufferID buf_id : tracing_session->buffers_index) {
-    TraceBuffer* buf = GetBufferByID(buf_id);
+    ShardedTraceBuffer* buf = GetBufferByID(buf_id);
     if (!buf) {
       PERFETTO_DFATAL("Buffer not found.");
       continue;
@@ -1683,6 +1895,11 @@ void TracingServiceImpl::MaybeEmitTraceConfig(
   if (tracing_session->did_emit_config)
     return;
   tracing_session->did_emit_config = true;
+  EmitTraceConfig(tracing_session, packets);
+}
+
+void TracingServiceImpl::EmitTraceConfig(TracingSession* tracing_session,
+                                         std::vector<TracePacket>* packets) {
   protos::TrustedPacket packet;
   tracing_session->config.ToProto(packet.mutable_trace_config());
   packet.set_trusted_uid(static_cast<int32_t>(uid_));
@@ -1757,6 +1974,16 @@ void TracingServiceImpl::ConsumerEndpointImpl::ReadBuffers() {
   service_->ReadBuffers(tracing_session_id_, this);
 }
 
+void TracingServiceImpl::ConsumerEndpointImpl::CloneAndReadBuffers() {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  if (!tracing_session_id_) {
+    PERFETTO_LOG(
+        "Consumer called CloneAndReadBuffers() but tracing was not active");
+    return;
+  }
+  service_->CloneAndReadBuffers(tracing_session_id_, this);
+}
+
 void TracingServiceImpl::ConsumerEndpointImpl::FreeBuffers() {
   PERFETTO_DCHECK_THREAD(thread_checker_);
   if (!tracing_session_id_) {
@@ -1895,6 +2122,21 @@ void TracingServiceImpl::ProducerEndpointImpl::CommitData(
     return;
   }
   PERFETTO_DCHECK(shmem_abi_.is_valid());
+
+  // In multi-threaded commit mode, the chunks are validated here and then
+  // copied and released by the worker that owns the target shard. Chunks
+  // headed to the same shard are batched into a single task.
+  struct ChunkToCopy {
+    SharedMemoryABI::Chunk chunk;
+    ShardedTraceBuffer* buf;
+    WriterID writer_id;
+    ChunkID chunk_id;
+    uint16_t num_fragments;
+    uint8_t chunk_flags;
+  };
+  using CopyBatch = std::vector<ChunkToCopy>;
+  std::map<size_t /*worker*/, std::shared_ptr<CopyBatch>> copy_batches;
+
   for (const auto& entry : req_untrusted.chunks_to_move()) {
     const uint32_t page_idx = entry.page();
     if (page_idx >= shmem_abi_.num_pages())
@@ -1921,6 +2163,22 @@ void TracingServiceImpl::ProducerEndpointImpl::CommitData(
     uint16_t num_fragments = packets.count;
     uint8_t chunk_flags = packets.flags;
 
+    if (service_->commit_workers_) {
+      ShardedTraceBuffer* buf =
+          service_->GetTargetBufferForChunk(id_, writer_id, buffer_id);
+      if (!buf) {
+        shmem_abi_.ReleaseChunkAsFree(std::move(chunk));
+        continue;
+      }
+      std::shared_ptr<CopyBatch>& batch =
+          copy_batches[buf->GetShardForSequence(id_, writer_id)];
+      if (!batch)
+        batch.reset(new CopyBatch());
+      batch->push_back({std::move(chunk), buf, writer_id, chunk_id,
+                        num_fragments, chunk_flags});
+      continue;
+    }
+
     service_->CopyProducerPageIntoLogBuffer(
         id_, uid_, writer_id, chunk_id, buffer_id, num_fragments, chunk_flags,
         /*chunk_complete=*/true, chunk.payload_begin(), chunk.payload_size());
@@ -1929,6 +2187,26 @@ void TracingServiceImpl::ProducerEndpointImpl::CommitData(
     shmem_abi_.ReleaseChunkAsFree(std::move(chunk));
   }  // for(chunks_to_move)
 
+  for (auto& worker_and_batch : copy_batches) {
+    SharedMemoryABI* shmem_abi = &shmem_abi_;
+    const ProducerID producer_id = id_;
+    const uid_t producer_uid = uid_;
+    std::shared_ptr<CopyBatch> batch = std::move(worker_and_batch.second);
+    service_->commit_workers_->PostTask(
+        worker_and_batch.first,
+        [shmem_abi, producer_id, producer_uid, batch] {
+          for (ChunkToCopy& c : *batch) {
+            c.buf->CopyChunkUntrusted(
+                producer_id, producer_uid, c.writer_id, c.chunk_id,
+                c.num_fragments, c.chunk_flags, /*chunk_complete=*/true,
+                c.chunk.payload_begin(), c.chunk.payload_size());
+            shmem_abi->ReleaseChunkAsFree(std::move(c.chunk));
+          }
+        });
+  }
+
+  // The patches are applied (or posted on the commit workers) after the chunk
+  // copies above, so they can find the chunks in the buffer.
   service_->ApplyChunkPatches(id_, req_untrusted.chunks_to_patch());
 
   if (req_untrusted.flush_request_id()) {
@@ -1961,6 +2239,11 @@ size_t TracingServiceImpl::ProducerEndpointImpl::shared_buffer_page_size_kb()
   return shared_buffer_page_size_kb_;
 }
 
+uint32_t TracingServiceImpl::ProducerEndpointImpl::batch_commits_duration_ms()
+    const {
+  return batch_commits_duration_ms_;
+}
+
 void TracingServiceImpl::ProducerEndpointImpl::StopDataSource(
     DataSourceInstanceID ds_inst_id) {
   // TODO(primiano): When we'll support tearing down the SMB, at this point we
@@ -1982,6 +2265,7 @@ TracingServiceImpl::ProducerEndpointImpl::GetOrCreateShmemArbiter() {
     inproc_shmem_arbiter_.reset(new SharedMemoryArbiterImpl(
         shared_memory_->start(), shared_memory_->size(),
         shared_buffer_page_size_kb_ * 1024, this, task_runner_));
+    inproc_shmem_arbiter_->SetBatchCommitsDuration(batch_commits_duration_ms_);
   }
   return inproc_shmem_arbiter_.get();
 }
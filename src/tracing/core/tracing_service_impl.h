@@ -41,6 +41,7 @@ namespace perfetto {
 
 namespace base {
 class TaskRunner;
+class ThreadPool;
 }  // namespace base
 
 class Consumer;
@@ -48,7 +49,7 @@ class DataSourceConfig;
 class Producer;
 class SharedMemory;
 class SharedMemoryArbiterImpl;
-class TraceBuffer;
+class ShardedTraceBuffer;
 class TraceConfig;
 class TracePacket;
 
@@ -86,6 +87,7 @@ class TracingServiceImpl : public TracingService {
     void NotifyDataSourceStopped(DataSourceInstanceID) override;
     SharedMemory* shared_memory() const override;
     size_t shared_buffer_page_size_kb() const override;
+    uint32_t batch_commits_duration_ms() const override;
 
     void OnTracingSetup();
     void SetupDataSource(DataSourceInstanceID, const DataSourceConfig&);
@@ -119,6 +121,7 @@ class TracingServiceImpl : public TracingService {
     Producer* producer_;
     std::unique_ptr<SharedMemory> shared_memory_;
     size_t shared_buffer_page_size_kb_ = 0;
+    uint32_t batch_commits_duration_ms_ = 0;
     SharedMemoryABI shmem_abi_;
     size_t shmem_size_hint_bytes_ = 0;
     const std::string name_;
@@ -164,6 +167,7 @@ class TracingServiceImpl : public TracingService {
     void StartTracing() override;
     void DisableTracing() override;
     void ReadBuffers() override;
+    void CloneAndReadBuffers() override;
     void FreeBuffers() override;
     void Flush(uint32_t timeout_ms, FlushCallback) override;
     void Detach(const std::string& key) override;
@@ -221,6 +225,7 @@ class TracingServiceImpl : public TracingService {
              ConsumerEndpoint::FlushCallback);
   void FlushAndDisableTracing(TracingSessionID);
   void ReadBuffers(TracingSessionID, ConsumerEndpointImpl*);
+  void CloneAndReadBuffers(TracingSessionID, ConsumerEndpointImpl*);
   void FreeBuffers(TracingSessionID);
 
   // Service implementation.
@@ -238,6 +243,8 @@ class TracingServiceImpl : public TracingService {
     smb_scraping_enabled_ = enabled;
   }
 
+  void SetCommitWorkerThreads(size_t num_threads) override;
+
   // Exposed mainly for testing.
   size_t num_producers() const { return producers_.size(); }
   ProducerEndpointImpl* GetProducer(ProducerID) const;
@@ -363,6 +370,11 @@ class TracingServiceImpl : public TracingService {
     // Whether we mirrored the trace config back to the trace output yet.
     bool did_emit_config = false;
 
+    // Read-only copies of the buffers, in the same order of |buffers_index|,
+    // taken by CloneAndReadBuffers(). Non-empty only while they are being
+    // read by the consumer.
+    std::vector<std::unique_ptr<ShardedTraceBuffer>> cloned_buffers;
+
     State state = DISABLED;
 
     // If the consumer detached the session, this variable defines the key used
@@ -407,6 +419,23 @@ class TracingServiceImpl : public TracingService {
   void SnapshotStats(TracingSession*, std::vector<TracePacket>*);
   TraceStats GetTraceStats(TracingSession* tracing_session);
   void MaybeEmitTraceConfig(TracingSession*, std::vector<TracePacket>*);
+  void EmitTraceConfig(TracingSession*, std::vector<TracePacket>*);
+
+  // Reads packets from |buf| into |packets|, after having validated them and
+  // appended the trusted fields. Returns true if it stopped because
+  // |*packets_bytes| crossed |max_bytes|, false if |buf| has been drained.
+  bool ReadPacketsFromBuffer(TracingSession*,
+                             ShardedTraceBuffer* buf,
+                             size_t max_bytes,
+                             std::vector<TracePacket>* packets,
+                             size_t* packets_bytes,
+                             size_t* total_slices);
+
+  // Reads the next batch of packets from the |cloned_buffers| of the session
+  // and sends them to the consumer, appended to |packets|.
+  void ReadClonedBuffers(TracingSessionID,
+                         ConsumerEndpointImpl*,
+                         std::vector<TracePacket> packets);
   void OnFlushTimeout(TracingSessionID, FlushRequestID);
   void OnDisableTracingTimeout(TracingSessionID);
   void DisableTracingNotifyConsumerAndFlushFile(TracingSession*);
@@ -416,7 +445,20 @@ class TracingServiceImpl : public TracingService {
                      bool success);
   void ScrapeSharedMemoryBuffers(TracingSession* tracing_session,
                                  ProducerEndpointImpl* producer);
-  TraceBuffer* GetBufferByID(BufferID);
+  ShardedTraceBuffer* GetBufferByID(BufferID);
+
+  // Validates that |producer_id| is allowed to write into |buffer_id| with the
+  // given writer and returns the target buffer. Returns nullptr (and accounts
+  // the chunk as discarded) if the validation fails.
+  ShardedTraceBuffer* GetTargetBufferForChunk(ProducerID,
+                                              WriterID,
+                                              BufferID);
+
+  // In multi-threaded commit mode, blocks until all the chunk copies and
+  // patches posted on the commit workers have been applied. Must be called
+  // before any access to |buffers_| contents from the service thread. No-op
+  // if the commit workers are not enabled.
+  void DrainCommitWorkers();
 
   base::TaskRunner* const task_runner_;
   std::unique_ptr<SharedMemory::Factory> shm_factory_;
@@ -434,7 +476,13 @@ class TracingServiceImpl : public TracingService {
   std::map<ProducerID, ProducerEndpointImpl*> producers_;
   std::set<ConsumerEndpointImpl*> consumers_;
   std::map<TracingSessionID, TracingSession> tracing_sessions_;
-  std::map<BufferID, std::unique_ptr<TraceBuffer>> buffers_;
+  std::map<BufferID, std::unique_ptr<ShardedTraceBuffer>> buffers_;
+
+  // Only set in multi-threaded commit mode (see SetCommitWorkerThreads()).
+  // Chunk copies and patches for the I-th shard of each buffer are always
+  // posted onto the I-th worker, so that each shard is written by at most one
+  // thread. Declared after |buffers_| so it's destroyed (and drained) first.
+  std::unique_ptr<base::ThreadPool> commit_workers_;
 
   bool smb_scraping_enabled_ = false;
   bool lockdown_mode_ = false;
@@ -0,0 +1,206 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "benchmark/benchmark.h"
+
+#include "perfetto/base/file_utils.h"
+#include "perfetto/base/logging.h"
+#include "perfetto/base/scoped_file.h"
+#include "perfetto/base/utils.h"
+#include "src/ipc/buffered_frame_deserializer.h"
+
+#include "perfetto/common/commit_data_request.pb.h"
+#include "perfetto/ipc/producer_port.pb.h"
+#include "src/ipc/wire_protocol.pb.h"
+
+// Measures the cost of the CommitData IPC, sent by producers every time a
+// chunk is returned to the service, with the two ways of encoding the frames:
+// - kFrame: as done before, serializing the arguments into a std::string, then
+//   copying that into a Frame that is serialized into another std::string.
+// - kDirect: BufferedFrameDeserializer::SerializeInvokeMethod*(), which write
+//   the frame in place into a buffer reused across calls.
+// The *_RoundTrip benchmarks mimic ClientImpl and HostImpl on two threads
+// connected by a socketpair.
+
+namespace {
+
+using perfetto::ipc::BufferedFrameDeserializer;
+using perfetto::ipc::Frame;
+using perfetto::ipc::RequestID;
+
+enum class Encoding { kFrame, kDirect };
+
+constexpr perfetto::ipc::ServiceID kServiceId = 1;
+constexpr perfetto::ipc::MethodID kMethodId = 4;
+
+// A request as sent by SharedMemoryArbiterImpl, with |num_chunks| chunks to
+// move and a patch for one of them.
+perfetto::protos::CommitDataRequest MakeRequest(size_t num_chunks) {
+  perfetto::protos::CommitDataRequest req;
+  for (size_t i = 0; i < num_chunks; i++) {
+    auto* chunk = req.add_chunks_to_move();
+    chunk->set_page(static_cast<uint32_t>(i / 4));
+    chunk->set_chunk(static_cast<uint32_t>(i % 4));
+    chunk->set_target_buffer(1);
+  }
+  auto* chunk_to_patch = req.add_chunks_to_patch();
+  chunk_to_patch->set_target_buffer(1);
+  chunk_to_patch->set_writer_id(1);
+  chunk_to_patch->set_chunk_id(42);
+  auto* patch = chunk_to_patch->add_patches();
+  patch->set_offset(16);
+  patch->set_data("\x01\x02\x03\x04", 4);
+  return req;
+}
+
+// Mimics ClientImpl::BeginInvoke().
+void EncodeRequest(Encoding encoding,
+                   RequestID request_id,
+                   const perfetto::protos::CommitDataRequest& req,
+                   std::string* buf) {
+  if (encoding == Encoding::kDirect) {
+    PERFETTO_CHECK(BufferedFrameDeserializer::SerializeInvokeMethod(
+        request_id, kServiceId, kMethodId, /*drop_reply=*/false, req, buf));
+    return;
+  }
+  std::string args_proto;
+  Frame frame;
+  frame.set_request_id(request_id);
+  Frame::InvokeMethod* invoke = frame.mutable_msg_invoke_method();
+  invoke->set_service_id(kServiceId);
+  invoke->set_method_id(kMethodId);
+  invoke->set_drop_reply(false);
+  PERFETTO_CHECK(req.SerializeToString(&args_proto));
+  invoke->set_args_proto(args_proto);
+  *buf = BufferedFrameDeserializer::Serialize(frame);
+}
+
+// Mimics HostImpl::ReplyToMethodInvocation().
+void EncodeReply(Encoding encoding,
+                 RequestID request_id,
+                 const perfetto::protos::CommitDataResponse& reply,
+                 std::string* buf) {
+  if (encoding == Encoding::kDirect) {
+    BufferedFrameDeserializer::SerializeInvokeMethodReply(
+        request_id, /*has_more=*/false, &reply, buf);
+    return;
+  }
+  Frame frame;
+  frame.set_request_id(request_id);
+  Frame::InvokeMethodReply* reply_frame =
+      frame.mutable_msg_invoke_method_reply();
+  reply_frame->set_has_more(false);
+  std::string reply_proto;
+  PERFETTO_CHECK(reply.SerializeToString(&reply_proto));
+  reply_frame->set_reply_proto(reply_proto);
+  reply_frame->set_success(true);
+  *buf = BufferedFrameDeserializer::Serialize(frame);
+}
+
+void Send(int fd, const std::string& buf) {
+  PERFETTO_CHECK(perfetto::base::WriteAll(fd, buf.data(), buf.size()) ==
+                 static_cast<ssize_t>(buf.size()));
+}
+
+// Returns nullptr when the other end closes the socket.
+std::unique_ptr<Frame> Receive(int fd, BufferedFrameDeserializer* bfd) {
+  for (;;) {
+    std::unique_ptr<Frame> frame = bfd->PopNextFrame();
+    if (frame)
+      return frame;
+    auto rbuf = bfd->BeginReceive();
+    ssize_t rsize = PERFETTO_EINTR(read(fd, rbuf.data, rbuf.size));
+    if (rsize <= 0)
+      return nullptr;
+    PERFETTO_CHECK(bfd->EndReceive(static_cast<size_t>(rsize)));
+  }
+}
+
+template <Encoding encoding>
+void BM_CommitData_Encode(benchmark::State& state) {
+  perfetto::protos::CommitDataRequest req =
+      MakeRequest(static_cast<size_t>(state.range(0)));
+  std::string buf;
+  RequestID request_id = 0;
+  while (state.KeepRunning()) {
+    EncodeRequest(encoding, ++request_id, req, &buf);
+    benchmark::DoNotOptimize(buf.data());
+  }
+}
+
+template <Encoding encoding>
+void BM_CommitData_RoundTrip(benchmark::State& state) {
+  perfetto::protos::CommitDataRequest req =
+      MakeRequest(static_cast<size_t>(state.range(0)));
+  int fds[2];
+  PERFETTO_CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+  perfetto::base::ScopedFile host_sock(fds[0]);
+  perfetto::base::ScopedFile client_sock(fds[1]);
+
+  std::thread host([&host_sock] {
+    BufferedFrameDeserializer bfd;
+    std::string buf;
+    const perfetto::protos::CommitDataResponse reply;
+    for (;;) {
+      std::unique_ptr<Frame> frame = Receive(*host_sock, &bfd);
+      if (!frame)
+        return;
+      // Mimics the request_proto_decoder of the generated ProducerPort stub.
+      perfetto::protos::CommitDataRequest decoded_req;
+      PERFETTO_CHECK(
+          decoded_req.ParseFromString(frame->msg_invoke_method().args_proto()));
+      benchmark::DoNotOptimize(decoded_req);
+      EncodeReply(encoding, frame->request_id(), reply, &buf);
+      Send(*host_sock, buf);
+    }
+  });
+
+  BufferedFrameDeserializer bfd;
+  std::string buf;
+  RequestID request_id = 0;
+  while (state.KeepRunning()) {
+    EncodeRequest(encoding, ++request_id, req, &buf);
+    Send(*client_sock, buf);
+    std::unique_ptr<Frame> reply = Receive(*client_sock, &bfd);
+    PERFETTO_CHECK(reply && reply->request_id() == request_id);
+    perfetto::protos::CommitDataResponse decoded_reply;
+    PERFETTO_CHECK(decoded_reply.ParseFromString(
+        reply->msg_invoke_method_reply().reply_proto()));
+  }
+  client_sock.reset();
+  host.join();
+}
+
+}  // namespace
+
+BENCHMARK_TEMPLATE(BM_CommitData_Encode, Encoding::kFrame)->Arg(1)->Arg(32);
+BENCHMARK_TEMPLATE(BM_CommitData_Encode, Encoding::kDirect)->Arg(1)->Arg(32);
+BENCHMARK_TEMPLATE(BM_CommitData_RoundTrip, Encoding::kFrame)
+    ->Arg(1)
+    ->Arg(32)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_CommitData_RoundTrip, Encoding::kDirect)
+    ->Arg(1)
+    ->Arg(32)
+    ->UseRealTime();
@@ -35,17 +35,21 @@ namespace perfetto {
 std::unique_ptr<TracingService::ConsumerEndpoint> ConsumerIPCClient::Connect(
     const char* service_sock_name,
     Consumer* consumer,
-    base::TaskRunner* task_runner) {
+    base::TaskRunner* task_runner,
+    size_t read_buffers_shm_size) {
   return std::unique_ptr<TracingService::ConsumerEndpoint>(
-      new ConsumerIPCClientImpl(service_sock_name, consumer, task_runner));
+      new ConsumerIPCClientImpl(service_sock_name, consumer, task_runner,
+                                read_buffers_shm_size));
 }
 
 ConsumerIPCClientImpl::ConsumerIPCClientImpl(const char* service_sock_name,
                                              Consumer* consumer,
-                                             base::TaskRunner* task_runner)
+                                             base::TaskRunner* task_runner,
+                                             size_t read_buffers_shm_size)
     : consumer_(consumer),
       ipc_channel_(ipc::Client::CreateInstance(service_sock_name, task_runner)),
       consumer_port_(this /* event_listener */),
+      read_buffers_shm_size_(read_buffers_shm_size),
       weak_ptr_factory_(this) {
   ipc_channel_->BindService(consumer_port_.GetWeakPtr());
 }
@@ -55,9 +59,32 @@ ConsumerIPCClientImpl::~ConsumerIPCClientImpl() = default;
 // Called by the IPC layer if the BindService() succeeds.
 void ConsumerIPCClientImpl::OnConnect() {
   connected_ = true;
+  if (read_buffers_shm_size_)
+    SetupReadBuffersSharedMemory();
   consumer_->OnConnect();
 }
 
+void ConsumerIPCClientImpl::SetupReadBuffersSharedMemory() {
+  // The ring is used as soon as the service processes this request, which
+  // precedes any ReadBuffers() request sent after this. The service rejects
+  // the request if it doesn't support shared memory reads.
+  read_buffers_ring_ = ReadBuffersRing::Create(read_buffers_shm_size_);
+  ipc::Deferred<protos::SetupReadBuffersSharedMemoryResponse> async_response;
+  auto weak_this = weak_ptr_factory_.GetWeakPtr();
+  async_response.Bind(
+      [weak_this](
+          ipc::AsyncResult<protos::SetupReadBuffersSharedMemoryResponse>
+              response) {
+        if (!weak_this || response)
+          return;
+        PERFETTO_DLOG("SetupReadBuffersSharedMemory() failed");
+        weak_this->read_buffers_ring_.reset();
+      });
+  consumer_port_.SetupReadBuffersSharedMemory(
+      protos::SetupReadBuffersSharedMemoryRequest(), std::move(async_response),
+      read_buffers_ring_->fd());
+}
+
 void ConsumerIPCClientImpl::OnDisconnect() {
   PERFETTO_DLOG("Tracing service connection failure");
   connected_ = false;
@@ -138,6 +165,24 @@ void ConsumerIPCClientImpl::ReadBuffers() {
                              std::move(async_response));
 }
 
+void ConsumerIPCClientImpl::CloneAndReadBuffers() {
+  if (!connected_) {
+    PERFETTO_DLOG(
+        "Cannot CloneAndReadBuffers(), not connected to tracing service");
+    return;
+  }
+
+  // The response is the same of ReadBuffers(), see the comment there about
+  // binding |this|.
+  ipc::Deferred<protos::ReadBuffersResponse> async_response;
+  async_response.Bind(
+      [this](ipc::AsyncResult<protos::ReadBuffersResponse> response) {
+        OnReadBuffersResponse(std::move(response));
+      });
+  consumer_port_.CloneAndReadBuffers(protos::CloneAndReadBuffersRequest(),
+                                     std::move(async_response));
+}
+
 void ConsumerIPCClientImpl::OnReadBuffersResponse(
     ipc::AsyncResult<protos::ReadBuffersResponse> response) {
   if (!response) {
@@ -145,6 +190,14 @@ void ConsumerIPCClientImpl::OnReadBuffersResponse(
     return;
   }
   std::vector<TracePacket> trace_packets;
+  if (response->has_shm_write_pos()) {
+    // The packets in the shared memory ring precede the inlined slices.
+    if (!read_buffers_ring_ ||
+        !read_buffers_ring_->ReadPackets(response->shm_write_pos(),
+                                         &trace_packets)) {
+      PERFETTO_ELOG("Invalid ReadBuffers() shared memory ring");
+    }
+  }
   for (auto& resp_slice : *response->mutable_slices()) {
     partial_packet_.AddSlice(
         Slice(std::unique_ptr<std::string>(resp_slice.release_data())));
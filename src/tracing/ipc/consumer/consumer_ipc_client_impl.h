@@ -17,6 +17,7 @@
 #ifndef SRC_TRACING_IPC_CONSUMER_CONSUMER_IPC_CLIENT_IMPL_H_
 #define SRC_TRACING_IPC_CONSUMER_CONSUMER_IPC_CLIENT_IMPL_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include <vector>
@@ -28,6 +29,7 @@
 #include "perfetto/tracing/core/trace_packet.h"
 #include "perfetto/tracing/core/tracing_service.h"
 #include "perfetto/tracing/ipc/consumer_ipc_client.h"
+#include "src/tracing/ipc/read_buffers_ring.h"
 
 #include "perfetto/ipc/consumer_port.ipc.h"
 
@@ -53,7 +55,8 @@ class ConsumerIPCClientImpl : public TracingService::ConsumerEndpoint,
  public:
   ConsumerIPCClientImpl(const char* service_sock_name,
                         Consumer*,
-                        base::TaskRunner*);
+                        base::TaskRunner*,
+                        size_t read_buffers_shm_size = 0);
   ~ConsumerIPCClientImpl() override;
 
   // TracingService::ConsumerEndpoint implementation.
@@ -63,6 +66,7 @@ class ConsumerIPCClientImpl : public TracingService::ConsumerEndpoint,
   void StartTracing() override;
   void DisableTracing() override;
   void ReadBuffers() override;
+  void CloneAndReadBuffers() override;
   void FreeBuffers() override;
   void Flush(uint32_t timeout_ms, FlushCallback) override;
   void Detach(const std::string& key) override;
@@ -76,6 +80,7 @@ class ConsumerIPCClientImpl : public TracingService::ConsumerEndpoint,
   void OnDisconnect() override;
 
  private:
+  void SetupReadBuffersSharedMemory();
   void OnReadBuffersResponse(ipc::AsyncResult<protos::ReadBuffersResponse>);
   void OnEnableTracingResponse(ipc::AsyncResult<protos::EnableTracingResponse>);
 
@@ -98,6 +103,13 @@ class ConsumerIPCClientImpl : public TracingService::ConsumerEndpoint,
   // one with |last_slice_for_packet| == true is received.
   TracePacket partial_packet_;
 
+  // Size of the |read_buffers_ring_| to set up upon connection, 0 if disabled.
+  const size_t read_buffers_shm_size_;
+
+  // The shared memory ring through which the service returns the trace data,
+  // see ReadBuffersRing. Null if disabled or not supported by the service.
+  std::unique_ptr<ReadBuffersRing> read_buffers_ring_;
+
   base::WeakPtrFactory<ConsumerIPCClientImpl> weak_ptr_factory_;
 };
 
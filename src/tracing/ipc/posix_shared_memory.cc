@@ -31,7 +31,8 @@
 #include "perfetto/base/logging.h"
 #include "perfetto/base/temp_file.h"
 
-#if PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX)
 #include <linux/memfd.h>
 #include <sys/syscall.h>
 #endif
@@ -41,8 +42,10 @@ namespace perfetto {
 // static
 std::unique_ptr<PosixSharedMemory> PosixSharedMemory::Create(size_t size) {
   base::ScopedFile fd;
-#if PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
   bool is_memfd = false;
+#if (PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID) || \
+     PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX)) &&   \
+    defined(__NR_memfd_create)
   fd.reset(static_cast<int>(syscall(__NR_memfd_create, "perfetto_shmem",
                                     MFD_CLOEXEC | MFD_ALLOW_SEALING)));
   is_memfd = !!fd;
@@ -59,11 +62,13 @@ std::unique_ptr<PosixSharedMemory> PosixSharedMemory::Create(size_t size) {
   PERFETTO_CHECK(fd);
   int res = ftruncate(fd.get(), static_cast<off_t>(size));
   PERFETTO_CHECK(res == 0);
-#if PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+#if defined(F_ADD_SEALS)
   if (is_memfd) {
     res = fcntl(*fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
     PERFETTO_DCHECK(res == 0);
   }
+#else
+  base::ignore_result(is_memfd);
 #endif
   return MapFD(std::move(fd), size);
 }
@@ -152,9 +152,12 @@ void ProducerIPCClientImpl::OnServiceRequest(
     shared_memory_ = PosixSharedMemory::AttachToFd(std::move(shmem_fd));
     shared_buffer_page_size_kb_ =
         cmd.setup_tracing().shared_buffer_page_size_kb();
+    batch_commits_duration_ms_ =
+        cmd.setup_tracing().batch_commits_duration_ms();
     shared_memory_arbiter_ = SharedMemoryArbiter::CreateInstance(
         shared_memory_.get(), shared_buffer_page_size_kb_ * 1024, this,
         task_runner_);
+    shared_memory_arbiter_->SetBatchCommitsDuration(batch_commits_duration_ms_);
     producer_->OnTracingSetup();
     return;
   }
@@ -292,4 +295,8 @@ size_t ProducerIPCClientImpl::shared_buffer_page_size_kb() const {
   return shared_buffer_page_size_kb_;
 }
 
+uint32_t ProducerIPCClientImpl::batch_commits_duration_ms() const {
+  return batch_commits_duration_ms_;
+}
+
 }  // namespace perfetto
@@ -0,0 +1,202 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/tracing/ipc/read_buffers_ring.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <tuple>
+
+#include "perfetto/base/build_config.h"
+#include "perfetto/base/logging.h"
+#include "perfetto/protozero/proto_utils.h"
+#include "perfetto/tracing/core/slice.h"
+#include "perfetto/tracing/core/trace_packet.h"
+#include "src/tracing/ipc/posix_shared_memory.h"
+
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX)
+#include <linux/memfd.h>
+#endif
+
+namespace perfetto {
+
+namespace {
+
+// Lives at the beginning of the shared memory region. Written only by the
+// reader.
+struct RingHeader {
+  std::atomic<uint64_t> read_pos;
+};
+static_assert(sizeof(RingHeader) <= ReadBuffersRing::kHeaderSize,
+              "RingHeader doesn't fit in the header page");
+
+// Tag (1 byte, see TracePacket::GetProtoPreamble()) + max varint size.
+constexpr size_t kMaxPreambleSize = 1 + 10;
+
+RingHeader* GetHeader(PosixSharedMemory* shm) {
+  return reinterpret_cast<RingHeader*>(shm->start());
+}
+
+}  // namespace
+
+// static
+std::unique_ptr<ReadBuffersRing> ReadBuffersRing::Create(size_t size) {
+  PERFETTO_CHECK(size > kHeaderSize && size <= kMaxSize);
+  PERFETTO_CHECK(size % base::kPageSize == 0);
+  return std::unique_ptr<ReadBuffersRing>(
+      new ReadBuffersRing(PosixSharedMemory::Create(size)));
+}
+
+// static
+std::unique_ptr<ReadBuffersRing> ReadBuffersRing::AttachToFd(
+    base::ScopedFile fd) {
+  if (!fd)
+    return nullptr;
+
+  // Check upfront everything that would make the mmap() CHECK in
+  // PosixSharedMemory fail, the fd is provided by the consumer.
+  struct stat stat_buf = {};
+  if (fstat(*fd, &stat_buf) != 0 || !S_ISREG(stat_buf.st_mode)) {
+    PERFETTO_ELOG("ReadBuffers ring: not a shared memory fd");
+    return nullptr;
+  }
+  const size_t size = static_cast<size_t>(stat_buf.st_size);
+  if (size <= kHeaderSize || size > kMaxSize || size % base::kPageSize) {
+    PERFETTO_ELOG("ReadBuffers ring: invalid size %zu", size);
+    return nullptr;
+  }
+  if ((fcntl(*fd, F_GETFL) & O_ACCMODE) != O_RDWR) {
+    PERFETTO_ELOG("ReadBuffers ring: the fd is not writable");
+    return nullptr;
+  }
+
+  // If the consumer could shrink the file, accessing the tail of the mapping
+  // would SIGBUS the service. Without seals (e.g. on Mac) the consumer reads
+  // the buffers through the socket.
+  bool sealed = false;
+#if defined(F_GET_SEALS)
+  int seals = fcntl(*fd, F_GET_SEALS);
+  sealed = seals != -1 && (seals & F_SEAL_SHRINK);
+#endif
+  if (!sealed) {
+    PERFETTO_ELOG("ReadBuffers ring: the memfd is not sealed");
+    return nullptr;
+  }
+
+  return std::unique_ptr<ReadBuffersRing>(
+      new ReadBuffersRing(PosixSharedMemory::AttachToFd(std::move(fd))));
+}
+
+ReadBuffersRing::ReadBuffersRing(std::unique_ptr<PosixSharedMemory> shm)
+    : shm_(std::move(shm)) {
+  data_ = reinterpret_cast<uint8_t*>(shm_->start()) + kHeaderSize;
+  capacity_ = shm_->size() - kHeaderSize;
+}
+
+ReadBuffersRing::~ReadBuffersRing() = default;
+
+int ReadBuffersRing::fd() const {
+  return shm_->fd();
+}
+
+bool ReadBuffersRing::WritePacket(TracePacket* packet) {
+  // The reader can write anything in the header, don't trust it.
+  const uint64_t read_pos =
+      GetHeader(shm_.get())->read_pos.load(std::memory_order_acquire);
+  if (read_pos > write_pos_ || write_pos_ - read_pos > capacity_)
+    return false;
+  const size_t free_space =
+      capacity_ - static_cast<size_t>(write_pos_ - read_pos);
+
+  char* preamble;
+  size_t preamble_size;
+  std::tie(preamble, preamble_size) = packet->GetProtoPreamble();
+  if (preamble_size + packet->size() > free_space)
+    return false;
+
+  uint64_t pos = write_pos_;
+  CopyToRing(pos, preamble, preamble_size);
+  pos += preamble_size;
+  for (const Slice& slice : packet->slices()) {
+    CopyToRing(pos, slice.start, slice.size);
+    pos += slice.size;
+  }
+  write_pos_ = pos;
+  return true;
+}
+
+bool ReadBuffersRing::ReadPackets(uint64_t write_pos,
+                                  std::vector<TracePacket>* packets) {
+  using protozero::proto_utils::MakeTagLengthDelimited;
+  using protozero::proto_utils::ParseVarInt;
+
+  if (write_pos < read_pos_ || write_pos - read_pos_ > capacity_)
+    return false;
+
+  while (read_pos_ < write_pos) {
+    uint8_t preamble[kMaxPreambleSize];
+    const size_t avail = static_cast<size_t>(write_pos - read_pos_);
+    const size_t preamble_avail = std::min(avail, sizeof(preamble));
+    CopyFromRing(read_pos_, preamble, preamble_avail);
+    if (preamble[0] != MakeTagLengthDelimited(TracePacket::kPacketFieldNumber))
+      return false;
+    uint64_t packet_size = 0;
+    const uint8_t* payload =
+        ParseVarInt(&preamble[1], &preamble[preamble_avail], &packet_size);
+    if (payload == &preamble[1])
+      return false;
+    const size_t preamble_size = static_cast<size_t>(payload - &preamble[0]);
+    if (packet_size > avail - preamble_size)
+      return false;
+
+    TracePacket packet;
+    if (packet_size > 0) {
+      const size_t size = static_cast<size_t>(packet_size);
+      Slice slice = Slice::Allocate(size);
+      CopyFromRing(read_pos_ + preamble_size, slice.own_data(), size);
+      packet.AddSlice(std::move(slice));
+    }
+    packets->emplace_back(std::move(packet));
+    read_pos_ += preamble_size + packet_size;
+  }
+
+  // Give the space back to the writer only after having copied the data out.
+  GetHeader(shm_.get())->read_pos.store(read_pos_, std::memory_order_release);
+  return true;
+}
+
+void ReadBuffersRing::CopyToRing(uint64_t pos, const void* src, size_t size) {
+  const size_t offset = static_cast<size_t>(pos % capacity_);
+  const size_t first = std::min(size, capacity_ - offset);
+  memcpy(data_ + offset, src, first);
+  if (first < size)
+    memcpy(data_, static_cast<const uint8_t*>(src) + first, size - first);
+}
+
+void ReadBuffersRing::CopyFromRing(uint64_t pos, void* dst, size_t size) const {
+  const size_t offset = static_cast<size_t>(pos % capacity_);
+  const size_t first = std::min(size, capacity_ - offset);
+  memcpy(dst, data_ + offset, first);
+  if (first < size)
+    memcpy(static_cast<uint8_t*>(dst) + first, data_, size - first);
+}
+
+}  // namespace perfetto
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACING_IPC_READ_BUFFERS_RING_H_
+#define SRC_TRACING_IPC_READ_BUFFERS_RING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+#include "perfetto/base/scoped_file.h"
+#include "perfetto/base/utils.h"
+
+namespace perfetto {
+
+class PosixSharedMemory;
+class TracePacket;
+
+// A single-writer single-reader ring buffer in shared memory, used to move the
+// trace data returned by ReadBuffers() from the service to a consumer without
+// serializing it into the IPC frames. The consumer creates the ring and passes
+// its fd to the service through SetupReadBuffersSharedMemory(). Then:
+// - The service copies each packet, prefixed by its proto preamble, into the
+//   ring (WritePacket()) and tells the consumer the new write position through
+//   the |shm_write_pos| field of the ReadBuffersResponse (the "doorbell").
+// - The consumer reads the packets up to that position (ReadPackets()) and
+//   publishes its read position in the ring header, freeing up the space.
+// The contents of the ring are hence a valid sequence of trace.proto packets.
+//
+// Positions are monotonic byte counters: the offset in the ring is
+// |pos| % capacity(). A packet can wrap around the end of the ring.
+//
+// Layout of the shared memory region:
+// +-------------------------------+------------------------------------------+
+// | Header (kHeaderSize)          | Data (capacity())                        |
+// +-------------------------------+------------------------------------------+
+class ReadBuffersRing {
+ public:
+  static constexpr size_t kHeaderSize = base::kPageSize;
+
+  // Upper bound for the size accepted by AttachToFd(), to bound the address
+  // space that each consumer can make the service map.
+  static constexpr size_t kMaxSize = 64 * 1024 * 1024;
+
+  // Creates a new ring of |size| bytes, inclusive of the header (the consumer
+  // uses this). |size| must be a multiple of the page size.
+  static std::unique_ptr<ReadBuffersRing> Create(size_t size);
+
+  // Maps a ring created by the other endpoint (the service uses this). The fd
+  // comes from an untrusted consumer: returns nullptr if it isn't a valid
+  // shared memory region.
+  static std::unique_ptr<ReadBuffersRing> AttachToFd(base::ScopedFile);
+
+  ~ReadBuffersRing();
+
+  // Writer side. Copies the preamble and the slices of |packet| into the ring.
+  // Returns false, without writing anything, if there isn't enough free space
+  // or if the reader has corrupted the header.
+  bool WritePacket(TracePacket* packet);
+
+  // Writer side. The position to pass to the reader after WritePacket().
+  uint64_t write_pos() const { return write_pos_; }
+
+  // Reader side. Reads the packets written up to |write_pos| and appends them
+  // to |packets|. The returned packets own their data, the space in the ring is
+  // released before returning. Returns false if the data is malformed.
+  bool ReadPackets(uint64_t write_pos, std::vector<TracePacket>* packets);
+
+  int fd() const;
+  size_t capacity() const { return capacity_; }
+
+ private:
+  explicit ReadBuffersRing(std::unique_ptr<PosixSharedMemory>);
+  ReadBuffersRing(const ReadBuffersRing&) = delete;
+  ReadBuffersRing& operator=(const ReadBuffersRing&) = delete;
+
+  // Copies |size| bytes at |pos|, handling the wrapping.
+  void CopyToRing(uint64_t pos, const void* src, size_t size);
+  void CopyFromRing(uint64_t pos, void* dst, size_t size) const;
+
+  std::unique_ptr<PosixSharedMemory> shm_;
+  uint8_t* data_ = nullptr;
+  size_t capacity_ = 0;
+
+  // Only one of the two is used, depending on which side owns this instance.
+  // The reader mirrors |read_pos_| into the shared header.
+  uint64_t write_pos_ = 0;
+  uint64_t read_pos_ = 0;
+};
+
+}  // namespace perfetto
+
+#endif  // SRC_TRACING_IPC_READ_BUFFERS_RING_H_
@@ -0,0 +1,245 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+
+#include "perfetto/base/file_utils.h"
+#include "perfetto/base/logging.h"
+#include "perfetto/base/scoped_file.h"
+#include "perfetto/base/utils.h"
+#include "perfetto/tracing/core/slice.h"
+#include "perfetto/tracing/core/trace_packet.h"
+#include "src/ipc/buffered_frame_deserializer.h"
+#include "src/tracing/ipc/read_buffers_ring.h"
+
+#include "perfetto/ipc/consumer_port.pb.h"
+#include "src/ipc/wire_protocol.pb.h"
+
+// Compares the throughput of the two ways the service can return the trace
+// data to a consumer: serialized into the ReadBuffersResponse IPCs or copied
+// into a shared memory ring. The service and the consumer run on two threads
+// connected by a socketpair, the packets are batched as done by
+// TracingServiceImpl::ReadBuffers().
+
+namespace {
+
+using perfetto::ReadBuffersRing;
+using perfetto::Slice;
+using perfetto::TracePacket;
+using perfetto::ipc::BufferedFrameDeserializer;
+using perfetto::ipc::Frame;
+
+constexpr size_t kTraceSize = 64 * 1024 * 1024;
+constexpr size_t kBytesPerBatch = 32 * 1024;  // kApproxBytesPerTask.
+constexpr size_t kRingSize = 8 * 1024 * 1024;
+
+struct SocketPair {
+  SocketPair() {
+    int fds[2];
+    PERFETTO_CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    service.reset(fds[0]);
+    consumer.reset(fds[1]);
+  }
+  perfetto::base::ScopedFile service;
+  perfetto::base::ScopedFile consumer;
+};
+
+// The packets in the trace buffer. Each packet is a single slice of
+// |packet_size| bytes, as for packets that fit in one chunk.
+class FakeTrace {
+ public:
+  explicit FakeTrace(size_t packet_size)
+      : packet_size_(packet_size), data_(kTraceSize) {
+    for (size_t i = 0; i < data_.size(); i++)
+      data_[i] = static_cast<uint8_t>(i * 7);
+  }
+
+  size_t num_packets() const { return data_.size() / packet_size_; }
+
+  // Returns the |num| packets starting from the |first|-th one.
+  std::vector<TracePacket> GetPackets(size_t first, size_t num) const {
+    std::vector<TracePacket> packets(num);
+    for (size_t i = 0; i < num; i++)
+      packets[i].AddSlice(&data_[(first + i) * packet_size_], packet_size_);
+    return packets;
+  }
+
+  size_t packets_per_batch() const { return kBytesPerBatch / packet_size_; }
+
+ private:
+  const size_t packet_size_;
+  std::vector<uint8_t> data_;
+};
+
+// Mimics ConsumerIPCService::RemoteConsumer::OnTraceData() + HostImpl.
+void SendBatchOverSocket(std::vector<TracePacket> packets, int fd) {
+  perfetto::protos::ReadBuffersResponse response;
+  for (const TracePacket& packet : packets) {
+    for (const Slice& slice : packet.slices()) {
+      auto* res_slice = response.add_slices();
+      res_slice->set_last_slice_for_packet(true);
+      res_slice->set_data(slice.start, slice.size);
+    }
+  }
+  Frame frame;
+  frame.set_request_id(1);
+  auto* reply = frame.mutable_msg_invoke_method_reply();
+  reply->set_success(true);
+  reply->set_has_more(true);
+  reply->set_reply_proto(response.SerializeAsString());
+  std::string buf = BufferedFrameDeserializer::Serialize(frame);
+  PERFETTO_CHECK(perfetto::base::WriteAll(fd, buf.data(), buf.size()) ==
+                 static_cast<ssize_t>(buf.size()));
+}
+
+void SendDoorbell(int fd, uint64_t write_pos) {
+  PERFETTO_CHECK(perfetto::base::WriteAll(fd, &write_pos, sizeof(write_pos)) ==
+                 sizeof(write_pos));
+}
+
+bool ReadFully(int fd, void* dst, size_t size) {
+  uint8_t* wptr = static_cast<uint8_t*>(dst);
+  for (size_t rd = 0; rd < size;) {
+    ssize_t res = PERFETTO_EINTR(read(fd, wptr + rd, size - rd));
+    if (res <= 0)
+      return false;
+    rd += static_cast<size_t>(res);
+  }
+  return true;
+}
+
+}  // namespace
+
+static void BM_ReadBuffers_Socket(benchmark::State& state) {
+  FakeTrace trace(static_cast<size_t>(state.range(0)));
+  const size_t num_packets = trace.num_packets();
+  while (state.KeepRunning()) {
+    SocketPair sock;
+    std::thread service([&trace, &sock, num_packets] {
+      for (size_t i = 0; i < num_packets; i += trace.packets_per_batch()) {
+        size_t num = std::min(trace.packets_per_batch(), num_packets - i);
+        SendBatchOverSocket(trace.GetPackets(i, num), *sock.service);
+      }
+    });
+
+    // Mimics ConsumerIPCClientImpl::OnReadBuffersResponse() + ClientImpl.
+    BufferedFrameDeserializer frame_deserializer;
+    size_t num_packets_rx = 0;
+    while (num_packets_rx < num_packets) {
+      auto rbuf = frame_deserializer.BeginReceive();
+      ssize_t rsize =
+          PERFETTO_EINTR(read(*sock.consumer, rbuf.data, rbuf.size));
+      PERFETTO_CHECK(rsize > 0);
+      PERFETTO_CHECK(
+          frame_deserializer.EndReceive(static_cast<size_t>(rsize)));
+      for (;;) {
+        std::unique_ptr<Frame> frame = frame_deserializer.PopNextFrame();
+        if (!frame)
+          break;
+        perfetto::protos::ReadBuffersResponse response;
+        PERFETTO_CHECK(response.ParseFromString(
+            frame->msg_invoke_method_reply().reply_proto()));
+        std::vector<TracePacket> packets;
+        for (auto& resp_slice : *response.mutable_slices()) {
+          TracePacket packet;
+          packet.AddSlice(
+              Slice(std::unique_ptr<std::string>(resp_slice.release_data())));
+          packets.emplace_back(std::move(packet));
+        }
+        num_packets_rx += packets.size();
+        benchmark::DoNotOptimize(packets);
+      }
+    }
+    service.join();
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(
+      state.iterations() * static_cast<int64_t>(kTraceSize)));
+}
+BENCHMARK(BM_ReadBuffers_Socket)
+    ->Arg(512)
+    ->Arg(4096)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+static void BM_ReadBuffers_SharedMemory(benchmark::State& state) {
+  FakeTrace trace(static_cast<size_t>(state.range(0)));
+  const size_t num_packets = trace.num_packets();
+  std::unique_ptr<ReadBuffersRing> consumer_ring =
+      ReadBuffersRing::Create(kRingSize);
+  std::unique_ptr<ReadBuffersRing> service_ring = ReadBuffersRing::AttachToFd(
+      perfetto::base::ScopedFile(dup(consumer_ring->fd())));
+  PERFETTO_CHECK(service_ring);
+
+  while (state.KeepRunning()) {
+    SocketPair sock;
+    ReadBuffersRing* ring = service_ring.get();
+    std::thread service([&trace, &sock, ring, num_packets] {
+      uint64_t doorbell_pos = ring->write_pos();
+      for (size_t i = 0; i < num_packets; i += trace.packets_per_batch()) {
+        size_t num = std::min(trace.packets_per_batch(), num_packets - i);
+        for (TracePacket& packet : trace.GetPackets(i, num)) {
+          // In the real service the packets are inlined into the IPC if the
+          // ring is full. Here the service waits for the consumer instead, to
+          // measure the throughput of the ring alone.
+          while (!ring->WritePacket(&packet)) {
+            if (ring->write_pos() != doorbell_pos) {
+              doorbell_pos = ring->write_pos();
+              SendDoorbell(*sock.service, doorbell_pos);
+            }
+            char ack;
+            PERFETTO_CHECK(ReadFully(*sock.service, &ack, 1));
+          }
+        }
+        if (ring->write_pos() - doorbell_pos >= ring->capacity() / 4) {
+          doorbell_pos = ring->write_pos();
+          SendDoorbell(*sock.service, doorbell_pos);
+        }
+      }
+      if (ring->write_pos() != doorbell_pos)
+        SendDoorbell(*sock.service, ring->write_pos());
+    });
+
+    size_t num_packets_rx = 0;
+    while (num_packets_rx < num_packets) {
+      uint64_t write_pos;
+      PERFETTO_CHECK(ReadFully(*sock.consumer, &write_pos, sizeof(write_pos)));
+      std::vector<TracePacket> packets;
+      PERFETTO_CHECK(consumer_ring->ReadPackets(write_pos, &packets));
+      num_packets_rx += packets.size();
+      benchmark::DoNotOptimize(packets);
+      const char ack = 0;
+      PERFETTO_CHECK(perfetto::base::WriteAll(*sock.consumer, &ack, 1) == 1);
+    }
+    service.join();
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(
+      state.iterations() * static_cast<int64_t>(kTraceSize)));
+}
+BENCHMARK(BM_ReadBuffers_SharedMemory)
+    ->Arg(512)
+    ->Arg(4096)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
@@ -0,0 +1,218 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/tracing/ipc/read_buffers_ring.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "perfetto/base/temp_file.h"
+#include "perfetto/base/utils.h"
+#include "perfetto/tracing/core/slice.h"
+#include "perfetto/tracing/core/trace_packet.h"
+
+namespace perfetto {
+namespace {
+
+constexpr size_t kRingSize = ReadBuffersRing::kHeaderSize + base::kPageSize;
+
+// Returns a packet made of one slice for each string in |slices|. The slices
+// point into |slices|, which must outlive the packet.
+TracePacket MakePacket(const std::vector<std::string>& slices) {
+  TracePacket packet;
+  for (const std::string& slice : slices)
+    packet.AddSlice(slice.data(), slice.size());
+  return packet;
+}
+
+std::string GetPayload(const TracePacket& packet) {
+  std::string payload;
+  for (const Slice& slice : packet.slices())
+    payload.append(reinterpret_cast<const char*>(slice.start), slice.size);
+  return payload;
+}
+
+// Returns a pair of rings backed by the same shared memory, as seen by the
+// consumer (reader) and by the service (writer).
+std::pair<std::unique_ptr<ReadBuffersRing>, std::unique_ptr<ReadBuffersRing>>
+CreateRingPair(size_t size = kRingSize) {
+  std::unique_ptr<ReadBuffersRing> reader = ReadBuffersRing::Create(size);
+  std::unique_ptr<ReadBuffersRing> writer =
+      ReadBuffersRing::AttachToFd(base::ScopedFile(dup(reader->fd())));
+  return std::make_pair(std::move(reader), std::move(writer));
+}
+
+TEST(ReadBuffersRingTest, WriteAndRead) {
+  auto rings = CreateRingPair();
+  ReadBuffersRing* reader = rings.first.get();
+  ReadBuffersRing* writer = rings.second.get();
+  ASSERT_TRUE(writer);
+  EXPECT_EQ(base::kPageSize, writer->capacity());
+
+  std::vector<std::string> p1 = {"foo"};
+  std::vector<std::string> p2 = {"bar", "baz", std::string(200, 'x')};
+  TracePacket packet1 = MakePacket(p1);
+  TracePacket packet2 = MakePacket(p2);
+  ASSERT_TRUE(writer->WritePacket(&packet1));
+  ASSERT_TRUE(writer->WritePacket(&packet2));
+
+  std::vector<TracePacket> packets;
+  ASSERT_TRUE(reader->ReadPackets(writer->write_pos(), &packets));
+  ASSERT_EQ(2u, packets.size());
+  EXPECT_EQ("foo", GetPayload(packets[0]));
+  EXPECT_EQ("barbaz" + std::string(200, 'x'), GetPayload(packets[1]));
+
+  // Reading up to the same position again returns nothing.
+  packets.clear();
+  ASSERT_TRUE(reader->ReadPackets(writer->write_pos(), &packets));
+  EXPECT_TRUE(packets.empty());
+}
+
+TEST(ReadBuffersRingTest, ContentsAreATrace) {
+  auto rings = CreateRingPair();
+  std::vector<std::string> p1 = {"foo"};
+  TracePacket packet = MakePacket(p1);
+  ASSERT_TRUE(rings.second->WritePacket(&packet));
+  ASSERT_EQ(5u, rings.second->write_pos());
+
+  // The ring contains |packet| prefixed by the Trace.packet preamble.
+  char buf[5];
+  ASSERT_EQ(5, pread(rings.first->fd(), buf, sizeof(buf),
+                     static_cast<off_t>(ReadBuffersRing::kHeaderSize)));
+  EXPECT_EQ(std::string("\x0a\x03"
+                        "foo",
+                        5),
+            std::string(buf, sizeof(buf)));
+}
+
+TEST(ReadBuffersRingTest, FullRing) {
+  auto rings = CreateRingPair();
+  ReadBuffersRing* reader = rings.first.get();
+  ReadBuffersRing* writer = rings.second.get();
+
+  // 3 bytes of preamble + 1021 of payload = 1 KB.
+  std::vector<std::string> p = {std::string(1021, 'x')};
+  for (int i = 0; i < 4; i++) {
+    TracePacket packet = MakePacket(p);
+    ASSERT_TRUE(writer->WritePacket(&packet));
+  }
+  EXPECT_EQ(base::kPageSize, writer->write_pos());
+  std::vector<std::string> small = {"y"};
+  TracePacket packet = MakePacket(small);
+  EXPECT_FALSE(writer->WritePacket(&packet));
+  EXPECT_EQ(base::kPageSize, writer->write_pos());
+
+  // Reading frees up the space.
+  std::vector<TracePacket> packets;
+  ASSERT_TRUE(reader->ReadPackets(writer->write_pos(), &packets));
+  EXPECT_EQ(4u, packets.size());
+  EXPECT_TRUE(writer->WritePacket(&packet));
+}
+
+TEST(ReadBuffersRingTest, Wrapping) {
+  auto rings = CreateRingPair();
+  ReadBuffersRing* reader = rings.first.get();
+  ReadBuffersRing* writer = rings.second.get();
+
+  // Packets of 1000 bytes (inclusive of the preamble) don't divide the ring
+  // evenly, so they end up wrapping around its end.
+  for (size_t i = 0; i < 50; i++) {
+    std::string payload(997, static_cast<char>('a' + i % 26));
+    std::vector<std::string> slices = {payload};
+    TracePacket packet = MakePacket(slices);
+    ASSERT_TRUE(writer->WritePacket(&packet));
+    ASSERT_TRUE(writer->WritePacket(&packet));
+
+    std::vector<TracePacket> packets;
+    ASSERT_TRUE(reader->ReadPackets(writer->write_pos(), &packets));
+    ASSERT_EQ(2u, packets.size());
+    EXPECT_EQ(payload, GetPayload(packets[0]));
+    EXPECT_EQ(payload, GetPayload(packets[1]));
+  }
+  EXPECT_EQ(50u * 2 * 1000, writer->write_pos());
+}
+
+TEST(ReadBuffersRingTest, CorruptedReadPosition) {
+  auto rings = CreateRingPair();
+  ReadBuffersRing* writer = rings.second.get();
+
+  // A read position ahead of the write position is ignored by the writer.
+  uint64_t bogus_read_pos = 1234;
+  ASSERT_EQ(static_cast<ssize_t>(sizeof(bogus_read_pos)),
+            pwrite(rings.first->fd(), &bogus_read_pos, sizeof(bogus_read_pos),
+                   0));
+  std::vector<std::string> p = {"foo"};
+  TracePacket packet = MakePacket(p);
+  EXPECT_FALSE(writer->WritePacket(&packet));
+  EXPECT_EQ(0u, writer->write_pos());
+}
+
+TEST(ReadBuffersRingTest, MalformedData) {
+  auto rings = CreateRingPair();
+  ReadBuffersRing* reader = rings.first.get();
+  std::vector<TracePacket> packets;
+
+  // A write position beyond the capacity of the ring.
+  EXPECT_FALSE(reader->ReadPackets(base::kPageSize + 1, &packets));
+
+  // A packet that is longer than the data written.
+  const char kTruncated[] = {0x0a, 0x10, 'f', 'o', 'o'};
+  ASSERT_EQ(5, pwrite(reader->fd(), kTruncated, sizeof(kTruncated),
+                      static_cast<off_t>(ReadBuffersRing::kHeaderSize)));
+  EXPECT_FALSE(reader->ReadPackets(5, &packets));
+
+  // A wrong field id.
+  const char kWrongTag[] = {0x12, 0x03, 'f', 'o', 'o'};
+  ASSERT_EQ(5, pwrite(reader->fd(), kWrongTag, sizeof(kWrongTag),
+                      static_cast<off_t>(ReadBuffersRing::kHeaderSize)));
+  EXPECT_FALSE(reader->ReadPackets(5, &packets));
+  EXPECT_TRUE(packets.empty());
+}
+
+TEST(ReadBuffersRingTest, AttachToInvalidFd) {
+  EXPECT_FALSE(ReadBuffersRing::AttachToFd(base::ScopedFile()));
+
+  // Too small.
+  base::TempFile tmp_file = base::TempFile::CreateUnlinked();
+  ASSERT_EQ(0, ftruncate(tmp_file.fd(), ReadBuffersRing::kHeaderSize));
+  EXPECT_FALSE(ReadBuffersRing::AttachToFd(tmp_file.ReleaseFD()));
+
+  // Not writable.
+  tmp_file = base::TempFile::Create();
+  ASSERT_EQ(0, ftruncate(tmp_file.fd(), kRingSize));
+  base::ScopedFile read_only_fd(open(tmp_file.path().c_str(), O_RDONLY));
+  ASSERT_TRUE(read_only_fd);
+  EXPECT_FALSE(ReadBuffersRing::AttachToFd(std::move(read_only_fd)));
+
+  // Not sealed: the consumer could shrink it.
+  tmp_file = base::TempFile::CreateUnlinked();
+  ASSERT_EQ(0, ftruncate(tmp_file.fd(), kRingSize));
+  EXPECT_FALSE(ReadBuffersRing::AttachToFd(tmp_file.ReleaseFD()));
+
+  // Not a regular file.
+  int pipe_fds[2];
+  ASSERT_EQ(0, pipe(pipe_fds));
+  base::ScopedFile pipe_wr(pipe_fds[1]);
+  EXPECT_FALSE(ReadBuffersRing::AttachToFd(base::ScopedFile(pipe_fds[0])));
+}
+
+}  // namespace
+}  // namespace perfetto
@@ -147,6 +147,34 @@ void ConsumerIPCService::GetTraceStats(const protos::GetTraceStatsRequest&,
   remote_consumer->service_endpoint->GetTraceStats();
 }
 
+// Called by the IPC layer.
+void ConsumerIPCService::CloneAndReadBuffers(
+    const protos::CloneAndReadBuffersRequest&,
+    DeferredReadBuffersResponse resp) {
+  // The cloned buffers are streamed back through OnTraceData(), as for
+  // ReadBuffers().
+  RemoteConsumer* remote_consumer = GetConsumerForCurrentRequest();
+  remote_consumer->read_buffers_response = std::move(resp);
+  remote_consumer->service_endpoint->CloneAndReadBuffers();
+}
+
+// Called by the IPC layer.
+void ConsumerIPCService::SetupReadBuffersSharedMemory(
+    const protos::SetupReadBuffersSharedMemoryRequest&,
+    DeferredSetupReadBuffersSharedMemoryResponse resp) {
+  RemoteConsumer* remote_consumer = GetConsumerForCurrentRequest();
+  std::unique_ptr<ReadBuffersRing> ring =
+      ReadBuffersRing::AttachToFd(ipc::Service::TakeReceivedFD());
+  if (!ring) {
+    resp.Reject();
+    return;
+  }
+  remote_consumer->read_buffers_ring = std::move(ring);
+  remote_consumer->ring_doorbell_pos = 0;
+  resp.Resolve(
+      ipc::AsyncResult<protos::SetupReadBuffersSharedMemoryResponse>::Create());
+}
+
 // Called by the service in response to a service_endpoint->Flush() request.
 void ConsumerIPCService::OnFlushCallback(
     bool success,
@@ -192,6 +220,29 @@ void ConsumerIPCService::RemoteConsumer::OnTraceData(
 
   auto result = ipc::AsyncResult<protos::ReadBuffersResponse>::Create();
 
+  // If the consumer set up a shared memory ring, copy as many packets as
+  // possible into it. The packets that don't fit are inlined into the IPC as
+  // below, after ringing the doorbell, so that the consumer sees them in
+  // order. To save IPCs, the doorbell is rung only when a good part of the
+  // ring is filled, when the ring is full or on the last reply.
+  size_t first_inline_packet = 0;
+  if (read_buffers_ring) {
+    for (; first_inline_packet < trace_packets.size(); first_inline_packet++) {
+      if (!read_buffers_ring->WritePacket(&trace_packets[first_inline_packet]))
+        break;
+    }
+    const uint64_t write_pos = read_buffers_ring->write_pos();
+    const bool ring_doorbell =
+        first_inline_packet < trace_packets.size() || !has_more ||
+        write_pos - ring_doorbell_pos >= read_buffers_ring->capacity() / 4;
+    if (!ring_doorbell)
+      return;
+    if (write_pos != ring_doorbell_pos) {
+      result->set_shm_write_pos(write_pos);
+      ring_doorbell_pos = write_pos;
+    }
+  }
+
   // A TracePacket might be too big to fit into a single IPC message (max
   // kIPCBufferSize). However a TracePacket is made of slices and each slice
   // is way smaller than kIPCBufferSize (a slice size is effectively bounded by
@@ -208,7 +259,8 @@ void ConsumerIPCService::RemoteConsumer::OnTraceData(
   };
 
   size_t approx_reply_size = 0;
-  for (const TracePacket& trace_packet : trace_packets) {
+  for (size_t i = first_inline_packet; i < trace_packets.size(); i++) {
+    const TracePacket& trace_packet = trace_packets[i];
     size_t num_slices_left_for_packet = trace_packet.slices().size();
     for (const Slice& slice : trace_packet.slices()) {
       // Check if this slice would cause the IPC to overflow its max size and,
@@ -17,6 +17,8 @@
 #ifndef SRC_TRACING_IPC_SERVICE_CONSUMER_IPC_SERVICE_H_
 #define SRC_TRACING_IPC_SERVICE_CONSUMER_IPC_SERVICE_H_
 
+#include <stdint.h>
+
 #include <list>
 #include <map>
 #include <memory>
@@ -26,6 +28,7 @@
 #include "perfetto/ipc/basic_types.h"
 #include "perfetto/tracing/core/consumer.h"
 #include "perfetto/tracing/core/tracing_service.h"
+#include "src/tracing/ipc/read_buffers_ring.h"
 
 #include "perfetto/ipc/consumer_port.ipc.h"
 
@@ -59,6 +62,11 @@ class ConsumerIPCService : public protos::ConsumerPort {
   void Attach(const protos::AttachRequest&, DeferredAttachResponse) override;
   void GetTraceStats(const protos::GetTraceStatsRequest&,
                      DeferredGetTraceStatsResponse) override;
+  void CloneAndReadBuffers(const protos::CloneAndReadBuffersRequest&,
+                           DeferredReadBuffersResponse) override;
+  void SetupReadBuffersSharedMemory(
+      const protos::SetupReadBuffersSharedMemoryRequest&,
+      DeferredSetupReadBuffersSharedMemoryResponse) override;
   void OnClientDisconnected() override;
 
  private:
@@ -89,6 +97,14 @@ class ConsumerIPCService : public protos::ConsumerPort {
     // allows to stream trace packets back to the client.
     DeferredReadBuffersResponse read_buffers_response;
 
+    // Set by SetupReadBuffersSharedMemory(). When present, OnTraceData()
+    // copies the packets into this ring and inlines them into the
+    // ReadBuffersResponse only when the ring is full.
+    std::unique_ptr<ReadBuffersRing> read_buffers_ring;
+
+    // The |shm_write_pos| sent in the last ReadBuffersResponse.
+    uint64_t ring_doorbell_pos = 0;
+
     // After EnableTracing() is invoked, this binds the async callback that
     // allows to send the OnTracingDisabled notification.
     DeferredEnableTracingResponse enable_tracing_response;
@@ -331,6 +331,8 @@ void ProducerIPCService::RemoteProducer::OnTracingSetup() {
   cmd.set_fd(shm_fd);
   cmd->mutable_setup_tracing()->set_shared_buffer_page_size_kb(
       static_cast<uint32_t>(service_endpoint->shared_buffer_page_size_kb()));
+  cmd->mutable_setup_tracing()->set_batch_commits_duration_ms(
+      service_endpoint->batch_commits_duration_ms());
   async_producer_commands.Resolve(std::move(cmd));
 }
 
@@ -41,8 +41,7 @@ class ServiceIPCHostImpl : public ServiceIPCHost {
              const char* consumer_socket_name) override;
   bool Start(base::ScopedFile producer_socket_fd,
              base::ScopedFile consumer_socket_fd) override;
-
-  TracingService* service_for_testing() const;
+  TracingService* service() const override;
 
  private:
   bool DoStart();
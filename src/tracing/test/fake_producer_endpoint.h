@@ -35,6 +35,7 @@ class FakeProducerEndpoint : public TracingService::ProducerEndpoint {
   void NotifyDataSourceStopped(DataSourceInstanceID) override {}
   SharedMemory* shared_memory() const override { return nullptr; }
   size_t shared_buffer_page_size_kb() const override { return 0; }
+  uint32_t batch_commits_duration_ms() const override { return 0; }
   std::unique_ptr<TraceWriter> CreateTraceWriter(BufferID) override {
     return nullptr;
   }
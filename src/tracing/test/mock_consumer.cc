@@ -94,6 +94,15 @@ MockConsumer::FlushRequest MockConsumer::Flush(uint32_t timeout_ms) {
 }
 
 std::vector<protos::TracePacket> MockConsumer::ReadBuffers() {
+  return ReadBuffersInternal(/*clone=*/false);
+}
+
+std::vector<protos::TracePacket> MockConsumer::CloneAndReadBuffers() {
+  return ReadBuffersInternal(/*clone=*/true);
+}
+
+std::vector<protos::TracePacket> MockConsumer::ReadBuffersInternal(
+    bool clone) {
   std::vector<protos::TracePacket> decoded_packets;
   static int i = 0;
   std::string checkpoint_name = "on_read_buffers_" + std::to_string(i++);
@@ -110,7 +119,11 @@ std::vector<protos::TracePacket> MockConsumer::ReadBuffers() {
             if (!has_more)
               on_read_buffers();
           }));
-  service_endpoint_->ReadBuffers();
+  if (clone) {
+    service_endpoint_->CloneAndReadBuffers();
+  } else {
+    service_endpoint_->ReadBuffers();
+  }
   task_runner_->RunUntilCheckpoint(checkpoint_name);
   return decoded_packets;
 }
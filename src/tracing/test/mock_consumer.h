@@ -54,6 +54,7 @@ class MockConsumer : public Consumer {
   void WaitForTracingDisabled(uint32_t timeout_ms = 3000);
   FlushRequest Flush(uint32_t timeout_ms = 10000);
   std::vector<protos::TracePacket> ReadBuffers();
+  std::vector<protos::TracePacket> CloneAndReadBuffers();
   void GetTraceStats();
   void WaitForTraceStats(bool success);
 
@@ -78,6 +79,8 @@ class MockConsumer : public Consumer {
   }
 
  private:
+  std::vector<protos::TracePacket> ReadBuffersInternal(bool clone);
+
   base::TestTaskRunner* const task_runner_;
   std::unique_ptr<TracingService::ConsumerEndpoint> service_endpoint_;
 };
@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <memory>
+
+#include "benchmark/benchmark.h"
+
+#include "perfetto/base/paged_memory.h"
+#include "perfetto/base/task_runner.h"
+#include "perfetto/base/utils.h"
+#include "perfetto/tracing/core/commit_data_request.h"
+#include "perfetto/tracing/core/shared_memory_abi.h"
+#include "perfetto/tracing/core/trace_writer.h"
+#include "perfetto/tracing/core/tracing_service.h"
+#include "src/tracing/core/shared_memory_arbiter_impl.h"
+#include "src/tracing/core/trace_writer_impl.h"
+
+#include "perfetto/trace/test_event.pbzero.h"
+#include "perfetto/trace/trace_packet.pbzero.h"
+
+// Measures the cost per event of writing tiny TracePackets, as done by
+// in-process instrumentation, into a shared memory buffer that is recycled as
+// soon as the chunks are committed:
+// - kVirtual: through the TraceWriter interface.
+// - kDirect: through TraceWriterImpl, whose calls are not virtual.
+
+namespace perfetto {
+namespace {
+
+constexpr size_t kPageSize = 4096;
+constexpr size_t kNumPages = 64;
+constexpr BufferID kBufId = 1;
+
+// Runs the tasks synchronously on the posting thread. This makes the arbiter
+// commit the chunks from whichever thread returns them, without the need of a
+// message loop.
+class InlineTaskRunner : public base::TaskRunner {
+ public:
+  void PostTask(std::function<void()> task) override { task(); }
+  void PostDelayedTask(std::function<void()> task, uint32_t) override {
+    task();
+  }
+  void AddFileDescriptorWatch(int, std::function<void()>) override {}
+  void RemoveFileDescriptorWatch(int) override {}
+  bool RunsTasksOnCurrentThread() const override { return true; }
+};
+
+// Frees the committed chunks straight away, as the service would do after
+// copying them into its trace buffer.
+class RecyclingProducerEndpoint : public TracingService::ProducerEndpoint {
+ public:
+  void set_shmem_abi(SharedMemoryABI* abi) { abi_ = abi; }
+
+  void CommitData(const CommitDataRequest& req,
+                  CommitDataCallback callback) override {
+    for (const auto& ctm : req.chunks_to_move()) {
+      auto chunk = abi_->TryAcquireChunkForReading(ctm.page(), ctm.chunk());
+      if (chunk.is_valid())
+        abi_->ReleaseChunkAsFree(std::move(chunk));
+    }
+    if (callback)
+      callback();
+  }
+
+  void RegisterDataSource(const DataSourceDescriptor&) override {}
+  void UnregisterDataSource(const std::string&) override {}
+  void RegisterTraceWriter(uint32_t, uint32_t) override {}
+  void UnregisterTraceWriter(uint32_t) override {}
+  void NotifyFlushComplete(FlushRequestID) override {}
+  void NotifyDataSourceStopped(DataSourceInstanceID) override {}
+  SharedMemory* shared_memory() const override { return nullptr; }
+  size_t shared_buffer_page_size_kb() const override { return 0; }
+  uint32_t batch_commits_duration_ms() const override { return 0; }
+  std::unique_ptr<TraceWriter> CreateTraceWriter(BufferID) override {
+    return nullptr;
+  }
+
+ private:
+  SharedMemoryABI* abi_ = nullptr;
+};
+
+struct TracingEnvironment {
+  TracingEnvironment()
+      : buf(base::PagedMemory::Allocate(kPageSize * kNumPages)),
+        arbiter(static_cast<uint8_t*>(buf.Get()),
+                kPageSize * kNumPages,
+                kPageSize,
+                &endpoint,
+                &task_runner) {
+    endpoint.set_shmem_abi(arbiter.shmem_abi_for_testing());
+  }
+
+  base::PagedMemory buf;
+  InlineTaskRunner task_runner;
+  RecyclingProducerEndpoint endpoint;
+  SharedMemoryArbiterImpl arbiter;
+};
+
+template <typename Writer>
+inline void WriteTinyEvent(Writer* writer, uint32_t value) {
+  auto packet = writer->NewTracePacket();
+  packet->set_for_testing()->set_seq_value(value);
+}
+
+enum class Access { kVirtual, kDirect };
+
+template <Access access>
+void BM_TraceWriterNewTracePacket(benchmark::State& state) {
+  TracingEnvironment env;
+  std::unique_ptr<TraceWriter> writer =
+      env.arbiter.CreateTraceWriter(kBufId);
+  uint32_t value = 0;
+  while (state.KeepRunning()) {
+    if (access == Access::kDirect) {
+      WriteTinyEvent(static_cast<TraceWriterImpl*>(writer.get()), ++value);
+    } else {
+      WriteTinyEvent(writer.get(), ++value);
+    }
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+}
+
+BENCHMARK_TEMPLATE(BM_TraceWriterNewTracePacket, Access::kVirtual);
+BENCHMARK_TEMPLATE(BM_TraceWriterNewTracePacket, Access::kDirect);
+
+}  // namespace
+}  // namespace perfetto
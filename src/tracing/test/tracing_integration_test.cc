@@ -20,6 +20,7 @@
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "perfetto/base/temp_file.h"
+#include "perfetto/base/utils.h"
 #include "perfetto/tracing/core/consumer.h"
 #include "perfetto/tracing/core/data_source_config.h"
 #include "perfetto/tracing/core/data_source_descriptor.h"
@@ -134,8 +135,9 @@ class TracingIntegrationTest : public ::testing::Test {
     producer_endpoint_->RegisterDataSource(ds_desc);
 
     // Create and connect a Consumer.
-    consumer_endpoint_ = ConsumerIPCClient::Connect(
-        kConsumerSockName, &consumer_, task_runner_.get());
+    consumer_endpoint_ =
+        ConsumerIPCClient::Connect(kConsumerSockName, &consumer_,
+                                   task_runner_.get(), read_buffers_shm_size_);
     auto on_consumer_connect =
         task_runner_->CreateCheckpoint("on_consumer_connect");
     EXPECT_CALL(consumer_, OnConnect()).WillOnce(Invoke(on_consumer_connect));
@@ -171,6 +173,7 @@ class TracingIntegrationTest : public ::testing::Test {
     DESTROY_TEST_SOCK(kConsumerSockName);
   }
 
+  size_t read_buffers_shm_size_ = 0;
   std::unique_ptr<base::TestTaskRunner> task_runner_;
   std::unique_ptr<ServiceIPCHost> svc_;
   std::unique_ptr<TracingService::ProducerEndpoint> producer_endpoint_;
@@ -394,6 +397,81 @@ TEST_F(TracingIntegrationTest, WriteIntoFile) {
   ASSERT_TRUE(saw_trace_stats);
 }
 
+// Reads back the trace through a shared memory ring that is too small to hold
+// all the packets, so that some of them are inlined into the IPCs.
+class TracingIntegrationTestWithShm : public TracingIntegrationTest {
+ public:
+  void SetUp() override {
+    read_buffers_shm_size_ = base::kPageSize * 2;
+    TracingIntegrationTest::SetUp();
+  }
+};
+
+TEST_F(TracingIntegrationTestWithShm, ReadBuffersThroughSharedMemory) {
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(4096 * 10);
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name("perfetto.test");
+  ds_config->set_target_buffer(0);
+  consumer_endpoint_->EnableTracing(trace_config);
+
+  BufferID global_buf_id = 0;
+  auto on_create_ds_instance =
+      task_runner_->CreateCheckpoint("on_create_ds_instance");
+  EXPECT_CALL(producer_, OnTracingSetup());
+  EXPECT_CALL(producer_, SetupDataSource(_, _));
+  EXPECT_CALL(producer_, StartDataSource(_, _))
+      .WillOnce(Invoke([on_create_ds_instance, &global_buf_id](
+                           DataSourceInstanceID, const DataSourceConfig& cfg) {
+        global_buf_id = static_cast<BufferID>(cfg.target_buffer());
+        on_create_ds_instance();
+      }));
+  task_runner_->RunUntilCheckpoint("on_create_ds_instance");
+
+  std::unique_ptr<TraceWriter> writer =
+      producer_endpoint_->CreateTraceWriter(global_buf_id);
+  ASSERT_TRUE(writer);
+
+  const size_t kNumPackets = 1000;
+  for (size_t i = 0; i < kNumPackets; i++) {
+    char buf[16];
+    sprintf(buf, "evt_%zu", i);
+    writer->NewTracePacket()->set_for_testing()->set_str(buf, strlen(buf));
+  }
+  auto on_data_committed = task_runner_->CreateCheckpoint("on_data_committed");
+  writer->Flush(on_data_committed);
+  task_runner_->RunUntilCheckpoint("on_data_committed");
+
+  consumer_endpoint_->ReadBuffers();
+  size_t num_pack_rx = 0;
+  auto all_packets_rx = task_runner_->CreateCheckpoint("all_packets_rx");
+  EXPECT_CALL(consumer_, OnTracePackets(_, _))
+      .WillRepeatedly(Invoke([&num_pack_rx, all_packets_rx](
+                                 std::vector<TracePacket>* packets,
+                                 bool has_more) {
+        for (auto& encoded_packet : *packets) {
+          protos::TracePacket packet;
+          ASSERT_TRUE(encoded_packet.Decode(&packet));
+          if (packet.has_for_testing()) {
+            ASSERT_EQ("evt_" + std::to_string(num_pack_rx++),
+                      packet.for_testing().str());
+          }
+        }
+        if (!has_more)
+          all_packets_rx();
+      }));
+  task_runner_->RunUntilCheckpoint("all_packets_rx");
+  ASSERT_EQ(kNumPackets, num_pack_rx);
+
+  consumer_endpoint_->DisableTracing();
+  auto on_tracing_disabled =
+      task_runner_->CreateCheckpoint("on_tracing_disabled");
+  EXPECT_CALL(producer_, StopDataSource(_));
+  EXPECT_CALL(consumer_, OnTracingDisabled())
+      .WillOnce(Invoke(on_tracing_disabled));
+  task_runner_->RunUntilCheckpoint("on_tracing_disabled");
+}
+
 // TODO(primiano): add tests to cover:
 // - unknown fields preserved end-to-end.
 // - >1 data source.
@@ -23,6 +23,10 @@
 
 #include "perfetto/base/logging.h"
 #include "tools/trace_to_text/proto_full_utils.h"
+#include "tools/trace_to_text/utils.h"
+
+#include "perfetto/trace/trace.pb.h"
+#include "perfetto/trace/trace_packet.pb.h"
 
 namespace perfetto {
 namespace trace_to_text {
@@ -30,13 +34,62 @@ namespace trace_to_text {
 namespace {
 using google::protobuf::Descriptor;
 using google::protobuf::DynamicMessageFactory;
+using google::protobuf::FieldDescriptor;
 using google::protobuf::FileDescriptor;
 using google::protobuf::Message;
+using google::protobuf::Reflection;
 using google::protobuf::TextFormat;
 using google::protobuf::compiler::DiskSourceTree;
 using google::protobuf::compiler::Importer;
 using google::protobuf::io::OstreamOutputStream;
 
+// Replaces the packets of |trace| that hold compressed_packets with the
+// packets they contain. Returns false if a block can't be decompressed.
+bool ExpandCompressedPackets(std::unique_ptr<Message>* trace) {
+  const Reflection* trace_refl = (*trace)->GetReflection();
+  const FieldDescriptor* packet_field =
+      (*trace)->GetDescriptor()->FindFieldByNumber(
+          protos::Trace::kPacketFieldNumber);
+  const FieldDescriptor* compressed_field =
+      packet_field->message_type()->FindFieldByNumber(
+          protos::TracePacket::kCompressedPacketsFieldNumber);
+  const int num_packets = trace_refl->FieldSize(**trace, packet_field);
+  auto is_compressed = [compressed_field](const Message& packet) {
+    return packet.GetReflection()->HasField(packet, compressed_field);
+  };
+
+  // Most traces don't have any compressed packets, leave them untouched.
+  int i = 0;
+  while (i < num_packets &&
+         !is_compressed(
+             trace_refl->GetRepeatedMessage(**trace, packet_field, i))) {
+    i++;
+  }
+  if (i == num_packets)
+    return true;
+
+  std::unique_ptr<Message> expanded((*trace)->New());
+  std::string packets;
+  for (i = 0; i < num_packets; i++) {
+    const Message& packet =
+        trace_refl->GetRepeatedMessage(**trace, packet_field, i);
+    if (!is_compressed(packet)) {
+      trace_refl->AddMessage(expanded.get(), packet_field)->CopyFrom(packet);
+      continue;
+    }
+    // The decompressed block is a serialized Trace, merging it appends its
+    // packets.
+    const std::string block =
+        packet.GetReflection()->GetString(packet, compressed_field);
+    if (!DecompressPackets(block, &packets) ||
+        !expanded->MergeFromString(packets)) {
+      return false;
+    }
+  }
+  *trace = std::move(expanded);
+  return true;
+}
+
 }  // namespace
 
 int TraceToText(std::istream* input, std::ostream* output) {
@@ -49,13 +102,16 @@ int TraceToText(std::istream* input, std::ostream* output) {
 
   DynamicMessageFactory dmf;
   const Descriptor* trace_descriptor = parsed_file->message_type(0);
-  const Message* msg_root = dmf.GetPrototype(trace_descriptor);
-  Message* msg = msg_root->New();
+  std::unique_ptr<Message> msg(dmf.GetPrototype(trace_descriptor)->New());
 
   if (!msg->ParseFromIstream(input)) {
     PERFETTO_ELOG("Could not parse input.");
     return 1;
   }
+  if (!ExpandCompressedPackets(&msg)) {
+    PERFETTO_ELOG("Could not decompress the compressed packets.");
+    return 1;
+  }
   OstreamOutputStream zero_copy_output(output);
   TextFormat::Print(*msg, &zero_copy_output);
   return 0;
@@ -24,6 +24,8 @@
 #include <utility>
 
 #include "perfetto/base/logging.h"
+#include "perfetto/base/lz_block.h"
+#include "perfetto/protozero/proto_utils.h"
 #include "perfetto/trace/ftrace/ftrace_stats.pb.h"
 #include "perfetto/traced/sys_stats_counters.h"
 
@@ -33,6 +35,27 @@
 namespace perfetto {
 namespace trace_to_text {
 
+namespace {
+
+// Decompresses a block of packets emitted by the service when
+// TraceConfig.compress_file is set (see TracePacket.compressed_packets) and
+// invokes |f| on each of them.
+void ForEachCompressedPacket(
+    const std::string& block,
+    const std::function<void(const protos::TracePacket&)>& f) {
+  std::string packets;
+  protos::Trace trace;
+  if (!DecompressPackets(block, &packets) ||
+      !trace.ParseFromString(packets)) {
+    PERFETTO_ELOG("Skipping invalid compressed packets");
+    return;
+  }
+  for (const protos::TracePacket& packet : trace.packet())
+    f(packet);
+}
+
+}  // namespace
+
 void ForEachPacketInTrace(
     std::istream* input,
     const std::function<void(const protos::TracePacket&)>& f) {
@@ -80,9 +103,29 @@ void ForEachPacketInTrace(
       PERFETTO_ELOG("Skipping invalid packet");
       continue;
     }
+    if (!packet.compressed_packets().empty()) {
+      ForEachCompressedPacket(packet.compressed_packets(), f);
+      continue;
+    }
     f(packet);
   }
 }
 
+bool DecompressPackets(const std::string& block, std::string* packets) {
+  const uint8_t* start = reinterpret_cast<const uint8_t*>(block.data());
+  const uint8_t* end = start + block.size();
+  uint64_t uncompressed_size = 0;
+  const uint8_t* data =
+      protozero::proto_utils::ParseVarInt(start, end, &uncompressed_size);
+  if (data == start ||
+      uncompressed_size > protozero::proto_utils::kMaxMessageLength) {
+    return false;
+  }
+  packets->resize(static_cast<size_t>(uncompressed_size));
+  return base::LzBlockDecompress(
+      data, static_cast<size_t>(end - data),
+      reinterpret_cast<uint8_t*>(&(*packets)[0]), packets->size());
+}
+
 }  // namespace trace_to_text
 }  // namespace perfetto
@@ -23,6 +23,7 @@
 #include <sys/ioctl.h>
 #include <functional>
 #include <iostream>
+#include <string>
 
 #include "perfetto/base/build_config.h"
 
@@ -63,6 +64,10 @@ void ForEachPacketInTrace(
     std::istream* input,
     const std::function<void(const protos::TracePacket&)>&);
 
+// Decompresses a TracePacket.compressed_packets block into |packets|, which
+// then holds a serialized Trace proto. Returns false if the block is invalid.
+bool DecompressPackets(const std::string& block, std::string* packets);
+
 }  // namespace trace_to_text
 }  // namespace perfetto
 